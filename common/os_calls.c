@@ -49,6 +49,7 @@
 #include <sys/stat.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
 #include <dlfcn.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -93,6 +94,12 @@ extern char **environ;
 #endif
 
 /* for solaris */
+/* older headers do not have the memfd sealing names */
+#if defined(__linux__) && !defined(F_GET_SEALS)
+#define F_GET_SEALS (1024 + 10)
+#define F_SEAL_SHRINK 0x0002
+#endif
+
 #if !defined(PF_LOCAL)
 #define PF_LOCAL AF_UNIX
 #endif
@@ -3036,6 +3043,26 @@ g_getpid(void)
 #endif
 }
 
+/*****************************************************************************/
+/* returns the number of online processors, at least 1 */
+int APP_CC
+g_get_num_cpus(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors < 1 ? 1 : (int)si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long rv;
+
+    rv = sysconf(_SC_NPROCESSORS_ONLN);
+    return rv < 1 ? 1 : (int)rv;
+#else
+    return 1;
+#endif
+}
+
 /*****************************************************************************/
 /* does not work in win32 */
 int APP_CC
@@ -3400,6 +3427,123 @@ g_shmdt(const void *shmaddr)
 #endif
 }
 
+/*****************************************************************************/
+/* like g_tcp_recv, file descriptors passed with SCM_RIGHTS are added to
+   fds, fds_count is how many are in it, ones past fds_max are closed */
+int APP_CC
+g_sck_recv_fd_set(int sck, void *ptr, int len, int *fds, int fds_max,
+                  int *fds_count)
+{
+#if defined(_WIN32)
+    return recv(sck, (char *)ptr, len, 0);
+#else
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int) * 8)];
+    int *cfds;
+    int num_fds;
+    int index;
+    int rv;
+
+    g_memset(&msg, 0, sizeof(msg));
+    iov.iov_base = ptr;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    rv = recvmsg(sck, &msg, 0);
+    if (rv < 1)
+    {
+        return rv;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != 0; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if ((cmsg->cmsg_level != SOL_SOCKET) ||
+            (cmsg->cmsg_type != SCM_RIGHTS))
+        {
+            continue;
+        }
+        cfds = (int *)CMSG_DATA(cmsg);
+        num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (index = 0; index < num_fds; index++)
+        {
+            if (*fds_count < fds_max)
+            {
+                fds[*fds_count] = cfds[index];
+                (*fds_count)++;
+            }
+            else
+            {
+                close(cfds[index]);
+            }
+        }
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+/* maps bytes of fd shared, returns pointer or nil on error */
+void * APP_CC
+g_mmap_fd(int fd, int bytes)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    void *rv;
+
+    rv = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (rv == MAP_FAILED)
+    {
+        return 0;
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+/* returns the size of the file fd is open on if it is sealed so it can not
+   shrink, a mapping of it can not fault then, -1 if not or on error */
+int APP_CC
+g_fd_sealed_size(int fd)
+{
+#if defined(F_GET_SEALS)
+    struct stat st;
+    int seals;
+
+    seals = fcntl(fd, F_GET_SEALS);
+    if ((seals == -1) || ((seals & F_SEAL_SHRINK) == 0))
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        return -1;
+    }
+    if (st.st_size > 0x7fffffff)
+    {
+        return 0x7fffffff;
+    }
+    return (int) (st.st_size);
+#else
+    return -1;
+#endif
+}
+
+/*****************************************************************************/
+/* returns -1 on error 0 on success */
+int APP_CC
+g_munmap(void *ptr, int bytes)
+{
+#if defined(_WIN32)
+    return -1;
+#else
+    return munmap(ptr, bytes);
+#endif
+}
+
 /*****************************************************************************/
 /* returns -1 on error 0 on success */
 int APP_CC
@@ -153,6 +153,7 @@ int APP_CC      g_setenv(const char* name, const char* value, int rewrite);
 char* APP_CC    g_getenv(const char* name);
 int APP_CC      g_exit(int exit_code);
 int APP_CC      g_getpid(void);
+int APP_CC      g_get_num_cpus(void);
 int APP_CC      g_sigterm(int pid);
 int APP_CC      g_getuser_info(const char* username, int* gid, int* uid, char* shell,
                                char* dir, char* gecos);
@@ -166,6 +167,11 @@ int APP_CC      g_save_to_bmp(const char* filename, char* data, int stride_bytes
 int APP_CC      g_text2bool(const char *s);
 void * APP_CC   g_shmat(int shmid);
 int APP_CC      g_shmdt(const void *shmaddr);
+int APP_CC      g_sck_recv_fd_set(int sck, void *ptr, int len, int *fds,
+                                  int fds_max, int *fds_count);
+void * APP_CC   g_mmap_fd(int fd, int bytes);
+int APP_CC      g_munmap(void *ptr, int bytes);
+int APP_CC      g_fd_sealed_size(int fd);
 int APP_CC      g_gethostname(char *name, int len);
 
 #endif
@@ -0,0 +1,1097 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pixel format conversion
+ *
+ * Every conversion goes to or from 32 bpp, anything else goes through a
+ * small 32 bpp buffer.  The plain C row functions are the reference, the
+ * SIMD ones must give the same bytes.  This file only needs the C library
+ * so X11rdp can build it too.
+ */
+
+#include <string.h>
+#include "arch.h"
+#include "defines.h"
+#include "pixel_convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define PIXEL_SSE2 1
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ > 4 || \
+    (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+/* ssse3 and avx2 kernels are picked at run time */
+#define PIXEL_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*pixel_row_proc)(const void *src, void *dst, int num_pixels);
+
+struct pixel_procs
+{
+    pixel_row_proc c32_to_16;
+    pixel_row_proc c32_to_15;
+    pixel_row_proc c32_to_24;
+    pixel_row_proc c16_to_32;
+    pixel_row_proc c15_to_32;
+    pixel_row_proc c24_to_32;
+    pixel_row_proc swap_rb32;
+    pixel_row_proc premultiply32;
+    pixel_row_proc alpha8;
+    const char *name;
+};
+
+static struct pixel_procs g_procs;
+static int g_procs_inited = 0;
+
+/*****************************************************************************/
+static void
+c32_to_16_c(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d16[index] = ((pixel >> 8) & 0xf800) | ((pixel >> 5) & 0x07e0) |
+                     ((pixel >> 3) & 0x001f);
+    }
+}
+
+/*****************************************************************************/
+static void
+c32_to_15_c(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d16[index] = ((pixel >> 9) & 0x7c00) | ((pixel >> 6) & 0x03e0) |
+                     ((pixel >> 3) & 0x001f);
+    }
+}
+
+/*****************************************************************************/
+static void
+c32_to_24_c(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d8 = (tui8 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d8[0] = pixel;
+        d8[1] = pixel >> 8;
+        d8[2] = pixel >> 16;
+        d8 += 3;
+    }
+}
+
+/*****************************************************************************/
+static void
+c16_to_32_c(const void *src, void *dst, int num_pixels)
+{
+    const tui16 *s16;
+    tui32 *d32;
+    int pixel;
+    int red;
+    int green;
+    int blue;
+    int index;
+
+    s16 = (const tui16 *)src;
+    d32 = (tui32 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s16[index];
+        SPLITCOLOR16(red, green, blue, pixel);
+        d32[index] = COLOR24RGB(red, green, blue);
+    }
+}
+
+/*****************************************************************************/
+static void
+c15_to_32_c(const void *src, void *dst, int num_pixels)
+{
+    const tui16 *s16;
+    tui32 *d32;
+    int pixel;
+    int red;
+    int green;
+    int blue;
+    int index;
+
+    s16 = (const tui16 *)src;
+    d32 = (tui32 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s16[index];
+        SPLITCOLOR15(red, green, blue, pixel);
+        d32[index] = COLOR24RGB(red, green, blue);
+    }
+}
+
+/*****************************************************************************/
+static void
+c24_to_32_c(const void *src, void *dst, int num_pixels)
+{
+    const tui8 *s8;
+    tui32 *d32;
+    int index;
+
+    s8 = (const tui8 *)src;
+    d32 = (tui32 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        d32[index] = s8[0] | (s8[1] << 8) | (s8[2] << 16);
+        s8 += 3;
+    }
+}
+
+/*****************************************************************************/
+static void
+swap_rb32_c(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui32 *d32;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d32 = (tui32 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d32[index] = (pixel & 0xff00ff00) | ((pixel >> 16) & 0xff) |
+                     ((pixel & 0xff) << 16);
+    }
+}
+
+/*****************************************************************************/
+/* c * a / 255, rounded */
+#define PIXEL_MUL_DIV255(_c, _a, _t) \
+    (_t = (_c) * (_a) + 128, ((_t) + ((_t) >> 8)) >> 8)
+
+/*****************************************************************************/
+static void
+premultiply32_c(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui32 *d32;
+    tui32 pixel;
+    int alpha;
+    int red;
+    int green;
+    int blue;
+    int t;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d32 = (tui32 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        alpha = pixel >> 24;
+        red = PIXEL_MUL_DIV255((pixel >> 16) & 0xff, alpha, t);
+        green = PIXEL_MUL_DIV255((pixel >> 8) & 0xff, alpha, t);
+        blue = PIXEL_MUL_DIV255(pixel & 0xff, alpha, t);
+        d32[index] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+    }
+}
+
+/*****************************************************************************/
+static void
+alpha8_c(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d8 = (tui8 *)dst;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        d8[index] = s32[index] >> 24;
+    }
+}
+
+#if defined(PIXEL_SSE2)
+
+/*****************************************************************************/
+static void
+c32_to_16_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m128i r_mask;
+    __m128i g_mask;
+    __m128i b_mask;
+    __m128i p0;
+    __m128i p1;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+    r_mask = _mm_set1_epi32(0xf800);
+    g_mask = _mm_set1_epi32(0x07e0);
+    b_mask = _mm_set1_epi32(0x001f);
+
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p0 = _mm_loadu_si128((const __m128i *)(s32 + index));
+        p1 = _mm_loadu_si128((const __m128i *)(s32 + index + 4));
+        p0 = _mm_or_si128(_mm_or_si128(
+                 _mm_and_si128(_mm_srli_epi32(p0, 8), r_mask),
+                 _mm_and_si128(_mm_srli_epi32(p0, 5), g_mask)),
+                 _mm_and_si128(_mm_srli_epi32(p0, 3), b_mask));
+        p1 = _mm_or_si128(_mm_or_si128(
+                 _mm_and_si128(_mm_srli_epi32(p1, 8), r_mask),
+                 _mm_and_si128(_mm_srli_epi32(p1, 5), g_mask)),
+                 _mm_and_si128(_mm_srli_epi32(p1, 3), b_mask));
+        /* sign extend so the signed pack keeps all 16 bits */
+        p0 = _mm_srai_epi32(_mm_slli_epi32(p0, 16), 16);
+        p1 = _mm_srai_epi32(_mm_slli_epi32(p1, 16), 16);
+        _mm_storeu_si128((__m128i *)(d16 + index), _mm_packs_epi32(p0, p1));
+    }
+
+    c32_to_16_c(s32 + index, d16 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+c32_to_15_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m128i r_mask;
+    __m128i g_mask;
+    __m128i b_mask;
+    __m128i p0;
+    __m128i p1;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+    r_mask = _mm_set1_epi32(0x7c00);
+    g_mask = _mm_set1_epi32(0x03e0);
+    b_mask = _mm_set1_epi32(0x001f);
+
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p0 = _mm_loadu_si128((const __m128i *)(s32 + index));
+        p1 = _mm_loadu_si128((const __m128i *)(s32 + index + 4));
+        p0 = _mm_or_si128(_mm_or_si128(
+                 _mm_and_si128(_mm_srli_epi32(p0, 9), r_mask),
+                 _mm_and_si128(_mm_srli_epi32(p0, 6), g_mask)),
+                 _mm_and_si128(_mm_srli_epi32(p0, 3), b_mask));
+        p1 = _mm_or_si128(_mm_or_si128(
+                 _mm_and_si128(_mm_srli_epi32(p1, 9), r_mask),
+                 _mm_and_si128(_mm_srli_epi32(p1, 6), g_mask)),
+                 _mm_and_si128(_mm_srli_epi32(p1, 3), b_mask));
+        _mm_storeu_si128((__m128i *)(d16 + index), _mm_packs_epi32(p0, p1));
+    }
+
+    c32_to_15_c(s32 + index, d16 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+/* 4 16 bpp pixels, zero extended to 32 bits, to x8r8g8b8 */
+static __m128i
+c16_to_32_x4_sse2(__m128i x)
+{
+    __m128i r;
+    __m128i g;
+    __m128i b;
+
+    r = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0xf8)),
+                     _mm_and_si128(_mm_srli_epi32(x, 13), _mm_set1_epi32(0x07)));
+    g = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 3), _mm_set1_epi32(0xfc)),
+                     _mm_and_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x03)));
+    b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(x, 3), _mm_set1_epi32(0xf8)),
+                     _mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0x07)));
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16),
+                                     _mm_slli_epi32(g, 8)), b);
+}
+
+/*****************************************************************************/
+static __m128i
+c15_to_32_x4_sse2(__m128i x)
+{
+    __m128i r;
+    __m128i g;
+    __m128i b;
+
+    r = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 7), _mm_set1_epi32(0xf8)),
+                     _mm_and_si128(_mm_srli_epi32(x, 12), _mm_set1_epi32(0x07)));
+    g = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0xf8)),
+                     _mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0x07)));
+    b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(x, 3), _mm_set1_epi32(0xf8)),
+                     _mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0x07)));
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16),
+                                     _mm_slli_epi32(g, 8)), b);
+}
+
+/*****************************************************************************/
+static void
+c16_to_32_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui16 *s16;
+    tui32 *d32;
+    __m128i zero;
+    __m128i p;
+    int index;
+
+    s16 = (const tui16 *)src;
+    d32 = (tui32 *)dst;
+    zero = _mm_setzero_si128();
+
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p = _mm_loadu_si128((const __m128i *)(s16 + index));
+        _mm_storeu_si128((__m128i *)(d32 + index),
+                         c16_to_32_x4_sse2(_mm_unpacklo_epi16(p, zero)));
+        _mm_storeu_si128((__m128i *)(d32 + index + 4),
+                         c16_to_32_x4_sse2(_mm_unpackhi_epi16(p, zero)));
+    }
+
+    c16_to_32_c(s16 + index, d32 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+c15_to_32_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui16 *s16;
+    tui32 *d32;
+    __m128i zero;
+    __m128i p;
+    int index;
+
+    s16 = (const tui16 *)src;
+    d32 = (tui32 *)dst;
+    zero = _mm_setzero_si128();
+
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p = _mm_loadu_si128((const __m128i *)(s16 + index));
+        _mm_storeu_si128((__m128i *)(d32 + index),
+                         c15_to_32_x4_sse2(_mm_unpacklo_epi16(p, zero)));
+        _mm_storeu_si128((__m128i *)(d32 + index + 4),
+                         c15_to_32_x4_sse2(_mm_unpackhi_epi16(p, zero)));
+    }
+
+    c15_to_32_c(s16 + index, d32 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+swap_rb32_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui32 *d32;
+    __m128i ag_mask;
+    __m128i rb_mask;
+    __m128i p;
+    __m128i rb;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d32 = (tui32 *)dst;
+    ag_mask = _mm_set1_epi32(0xff00ff00);
+    rb_mask = _mm_set1_epi32(0x00ff00ff);
+
+    for (index = 0; index + 4 <= num_pixels; index += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(s32 + index));
+        rb = _mm_and_si128(p, rb_mask);
+        rb = _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_slli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i *)(d32 + index),
+                         _mm_or_si128(_mm_and_si128(p, ag_mask), rb));
+    }
+
+    swap_rb32_c(s32 + index, d32 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+/* 2 pixels as 8 16 bit words, b g r a b g r a */
+static __m128i
+premultiply32_x2_sse2(__m128i p)
+{
+    __m128i mul;
+    __m128i t;
+
+    /* each pixel's alpha in all 4 words, then 255 for the alpha word so
+       alpha comes through unchanged */
+    mul = _mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+    mul = _mm_shufflehi_epi16(mul, _MM_SHUFFLE(3, 3, 3, 3));
+    mul = _mm_or_si128(_mm_and_si128(mul, _mm_set_epi16(0, -1, -1, -1,
+                                                        0, -1, -1, -1)),
+                       _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+    t = _mm_add_epi16(_mm_mullo_epi16(p, mul), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/*****************************************************************************/
+static void
+premultiply32_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui32 *d32;
+    __m128i zero;
+    __m128i p;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d32 = (tui32 *)dst;
+    zero = _mm_setzero_si128();
+
+    for (index = 0; index + 4 <= num_pixels; index += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(s32 + index));
+        p = _mm_packus_epi16(
+                premultiply32_x2_sse2(_mm_unpacklo_epi8(p, zero)),
+                premultiply32_x2_sse2(_mm_unpackhi_epi8(p, zero)));
+        _mm_storeu_si128((__m128i *)(d32 + index), p);
+    }
+
+    premultiply32_c(s32 + index, d32 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+alpha8_sse2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d8 = (tui8 *)dst;
+
+    for (index = 0; index + 16 <= num_pixels; index += 16)
+    {
+        p0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(s32 + index)), 24);
+        p1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(s32 + index + 4)), 24);
+        p2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(s32 + index + 8)), 24);
+        p3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(s32 + index + 12)), 24);
+        p0 = _mm_packs_epi32(p0, p1);
+        p2 = _mm_packs_epi32(p2, p3);
+        _mm_storeu_si128((__m128i *)(d8 + index), _mm_packus_epi16(p0, p2));
+    }
+
+    alpha8_c(s32 + index, d8 + index, num_pixels - index);
+}
+
+#endif /* PIXEL_SSE2 */
+
+#if defined(PIXEL_X86_DISPATCH)
+
+/*****************************************************************************/
+/* the 16 byte store writes 4 bytes past the 4 pixels, keep 6 pixels of
+   room */
+__attribute__((target("ssse3"))) static void
+c32_to_24_ssse3(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    __m128i shuf;
+    __m128i p;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d8 = (tui8 *)dst;
+    shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                         -1, -1, -1, -1);
+
+    for (index = 0; index + 6 <= num_pixels; index += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(s32 + index));
+        _mm_storeu_si128((__m128i *)(d8 + index * 3), _mm_shuffle_epi8(p, shuf));
+    }
+
+    c32_to_24_c(s32 + index, d8 + index * 3, num_pixels - index);
+}
+
+/*****************************************************************************/
+/* the 16 byte load reads 4 bytes past the 4 pixels, same room needed */
+__attribute__((target("ssse3"))) static void
+c24_to_32_ssse3(const void *src, void *dst, int num_pixels)
+{
+    const tui8 *s8;
+    tui32 *d32;
+    __m128i shuf;
+    __m128i p;
+    int index;
+
+    s8 = (const tui8 *)src;
+    d32 = (tui32 *)dst;
+    shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1,
+                         9, 10, 11, -1);
+
+    for (index = 0; index + 6 <= num_pixels; index += 4)
+    {
+        p = _mm_loadu_si128((const __m128i *)(s8 + index * 3));
+        _mm_storeu_si128((__m128i *)(d32 + index), _mm_shuffle_epi8(p, shuf));
+    }
+
+    c24_to_32_c(s8 + index * 3, d32 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2"))) static void
+c32_to_16_avx2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m256i r_mask;
+    __m256i g_mask;
+    __m256i b_mask;
+    __m256i p0;
+    __m256i p1;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+    r_mask = _mm256_set1_epi32(0xf800);
+    g_mask = _mm256_set1_epi32(0x07e0);
+    b_mask = _mm256_set1_epi32(0x001f);
+
+    for (index = 0; index + 16 <= num_pixels; index += 16)
+    {
+        p0 = _mm256_loadu_si256((const __m256i *)(s32 + index));
+        p1 = _mm256_loadu_si256((const __m256i *)(s32 + index + 8));
+        p0 = _mm256_or_si256(_mm256_or_si256(
+                 _mm256_and_si256(_mm256_srli_epi32(p0, 8), r_mask),
+                 _mm256_and_si256(_mm256_srli_epi32(p0, 5), g_mask)),
+                 _mm256_and_si256(_mm256_srli_epi32(p0, 3), b_mask));
+        p1 = _mm256_or_si256(_mm256_or_si256(
+                 _mm256_and_si256(_mm256_srli_epi32(p1, 8), r_mask),
+                 _mm256_and_si256(_mm256_srli_epi32(p1, 5), g_mask)),
+                 _mm256_and_si256(_mm256_srli_epi32(p1, 3), b_mask));
+        /* pack works per 128 bit lane, put the quarters back in order */
+        p0 = _mm256_packus_epi32(p0, p1);
+        p0 = _mm256_permute4x64_epi64(p0, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(d16 + index), p0);
+    }
+
+    c32_to_16_sse2(s32 + index, d16 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2"))) static void
+c32_to_15_avx2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m256i r_mask;
+    __m256i g_mask;
+    __m256i b_mask;
+    __m256i p0;
+    __m256i p1;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+    r_mask = _mm256_set1_epi32(0x7c00);
+    g_mask = _mm256_set1_epi32(0x03e0);
+    b_mask = _mm256_set1_epi32(0x001f);
+
+    for (index = 0; index + 16 <= num_pixels; index += 16)
+    {
+        p0 = _mm256_loadu_si256((const __m256i *)(s32 + index));
+        p1 = _mm256_loadu_si256((const __m256i *)(s32 + index + 8));
+        p0 = _mm256_or_si256(_mm256_or_si256(
+                 _mm256_and_si256(_mm256_srli_epi32(p0, 9), r_mask),
+                 _mm256_and_si256(_mm256_srli_epi32(p0, 6), g_mask)),
+                 _mm256_and_si256(_mm256_srli_epi32(p0, 3), b_mask));
+        p1 = _mm256_or_si256(_mm256_or_si256(
+                 _mm256_and_si256(_mm256_srli_epi32(p1, 9), r_mask),
+                 _mm256_and_si256(_mm256_srli_epi32(p1, 6), g_mask)),
+                 _mm256_and_si256(_mm256_srli_epi32(p1, 3), b_mask));
+        p0 = _mm256_packus_epi32(p0, p1);
+        p0 = _mm256_permute4x64_epi64(p0, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(d16 + index), p0);
+    }
+
+    c32_to_15_sse2(s32 + index, d16 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2"))) static void
+swap_rb32_avx2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui32 *d32;
+    __m256i shuf;
+    __m256i p;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d32 = (tui32 *)dst;
+    shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11,
+                            14, 13, 12, 15,
+                            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11,
+                            14, 13, 12, 15);
+
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p = _mm256_loadu_si256((const __m256i *)(s32 + index));
+        _mm256_storeu_si256((__m256i *)(d32 + index),
+                            _mm256_shuffle_epi8(p, shuf));
+    }
+
+    swap_rb32_sse2(s32 + index, d32 + index, num_pixels - index);
+}
+
+#endif /* PIXEL_X86_DISPATCH */
+
+#if defined(PIXEL_NEON)
+
+/*****************************************************************************/
+static void
+c32_to_24_neon(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    uint8x16x4_t p;
+    uint8x16x3_t q;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d8 = (tui8 *)dst;
+
+    for (index = 0; index + 16 <= num_pixels; index += 16)
+    {
+        p = vld4q_u8((const uint8_t *)(s32 + index));
+        q.val[0] = p.val[0];
+        q.val[1] = p.val[1];
+        q.val[2] = p.val[2];
+        vst3q_u8(d8 + index * 3, q);
+    }
+
+    c32_to_24_c(s32 + index, d8 + index * 3, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+c24_to_32_neon(const void *src, void *dst, int num_pixels)
+{
+    const tui8 *s8;
+    tui32 *d32;
+    uint8x16x3_t p;
+    uint8x16x4_t q;
+    int index;
+
+    s8 = (const tui8 *)src;
+    d32 = (tui32 *)dst;
+    q.val[3] = vdupq_n_u8(0);
+
+    for (index = 0; index + 16 <= num_pixels; index += 16)
+    {
+        p = vld3q_u8(s8 + index * 3);
+        q.val[0] = p.val[0];
+        q.val[1] = p.val[1];
+        q.val[2] = p.val[2];
+        vst4q_u8((uint8_t *)(d32 + index), q);
+    }
+
+    c24_to_32_c(s8 + index * 3, d32 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+c32_to_16_neon(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    uint8x8x4_t p;
+    uint16x8_t r;
+    uint16x8_t g;
+    uint16x8_t b;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d16 = (tui16 *)dst;
+
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p = vld4_u8((const uint8_t *)(s32 + index));
+        r = vandq_u16(vshll_n_u8(p.val[2], 8), vdupq_n_u16(0xf800));
+        g = vandq_u16(vshll_n_u8(p.val[1], 3), vdupq_n_u16(0x07e0));
+        b = vmovl_u8(vshr_n_u8(p.val[0], 3));
+        vst1q_u16(d16 + index, vorrq_u16(vorrq_u16(r, g), b));
+    }
+
+    c32_to_16_c(s32 + index, d16 + index, num_pixels - index);
+}
+
+/*****************************************************************************/
+static void
+swap_rb32_neon(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui32 *d32;
+    uint8x16x4_t p;
+    uint8x16_t t;
+    int index;
+
+    s32 = (const tui32 *)src;
+    d32 = (tui32 *)dst;
+
+    for (index = 0; index + 16 <= num_pixels; index += 16)
+    {
+        p = vld4q_u8((const uint8_t *)(s32 + index));
+        t = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = t;
+        vst4q_u8((uint8_t *)(d32 + index), p);
+    }
+
+    swap_rb32_c(s32 + index, d32 + index, num_pixels - index);
+}
+
+#endif /* PIXEL_NEON */
+
+/*****************************************************************************/
+/* pick the row functions once, later callers just read g_procs, two
+   threads racing here store the same values */
+static void
+pixel_convert_init(void)
+{
+    struct pixel_procs procs;
+
+    procs.c32_to_16 = c32_to_16_c;
+    procs.c32_to_15 = c32_to_15_c;
+    procs.c32_to_24 = c32_to_24_c;
+    procs.c16_to_32 = c16_to_32_c;
+    procs.c15_to_32 = c15_to_32_c;
+    procs.c24_to_32 = c24_to_32_c;
+    procs.swap_rb32 = swap_rb32_c;
+    procs.premultiply32 = premultiply32_c;
+    procs.alpha8 = alpha8_c;
+    procs.name = "c";
+#if defined(PIXEL_SSE2)
+    procs.c32_to_16 = c32_to_16_sse2;
+    procs.c32_to_15 = c32_to_15_sse2;
+    procs.c16_to_32 = c16_to_32_sse2;
+    procs.c15_to_32 = c15_to_32_sse2;
+    procs.swap_rb32 = swap_rb32_sse2;
+    procs.premultiply32 = premultiply32_sse2;
+    procs.alpha8 = alpha8_sse2;
+    procs.name = "sse2";
+#endif
+#if defined(PIXEL_X86_DISPATCH)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        procs.c32_to_24 = c32_to_24_ssse3;
+        procs.c24_to_32 = c24_to_32_ssse3;
+        procs.name = "ssse3";
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        procs.c32_to_16 = c32_to_16_avx2;
+        procs.c32_to_15 = c32_to_15_avx2;
+        procs.swap_rb32 = swap_rb32_avx2;
+        procs.name = "avx2";
+    }
+#endif
+#if defined(PIXEL_NEON)
+    procs.c32_to_24 = c32_to_24_neon;
+    procs.c24_to_32 = c24_to_32_neon;
+    procs.c32_to_16 = c32_to_16_neon;
+    procs.swap_rb32 = swap_rb32_neon;
+    procs.name = "neon";
+#endif
+    g_procs = procs;
+#if defined(__GNUC__)
+    __sync_synchronize();
+#endif
+    g_procs_inited = 1;
+}
+
+/*****************************************************************************/
+static int
+pixel_fmt_bytes(int fmt)
+{
+    switch (fmt)
+    {
+        case PIXEL_FMT_8:
+            return 1;
+        case PIXEL_FMT_15:
+        case PIXEL_FMT_16:
+            return 2;
+        case PIXEL_FMT_24:
+            return 3;
+        case PIXEL_FMT_32:
+            return 4;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+pixel_from_32(const void *src, void *dst, int dst_fmt, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    int red;
+    int green;
+    int blue;
+    int index;
+
+    switch (dst_fmt)
+    {
+        case PIXEL_FMT_8:
+            s32 = (const tui32 *)src;
+            d8 = (tui8 *)dst;
+
+            for (index = 0; index < num_pixels; index++)
+            {
+                SPLITCOLOR32(red, green, blue, s32[index]);
+                d8[index] = COLOR8(red, green, blue);
+            }
+
+            return 0;
+        case PIXEL_FMT_15:
+            g_procs.c32_to_15(src, dst, num_pixels);
+            return 0;
+        case PIXEL_FMT_16:
+            g_procs.c32_to_16(src, dst, num_pixels);
+            return 0;
+        case PIXEL_FMT_24:
+            g_procs.c32_to_24(src, dst, num_pixels);
+            return 0;
+    }
+
+    return 1;
+}
+
+/*****************************************************************************/
+static int
+pixel_to_32(const void *src, int src_fmt, void *dst, int num_pixels,
+            const int *palette)
+{
+    const tui8 *s8;
+    tui32 *d32;
+    int index;
+
+    switch (src_fmt)
+    {
+        case PIXEL_FMT_8:
+            if (palette == 0)
+            {
+                return 1;
+            }
+
+            s8 = (const tui8 *)src;
+            d32 = (tui32 *)dst;
+
+            for (index = 0; index < num_pixels; index++)
+            {
+                d32[index] = palette[s8[index]];
+            }
+
+            return 0;
+        case PIXEL_FMT_15:
+            g_procs.c15_to_32(src, dst, num_pixels);
+            return 0;
+        case PIXEL_FMT_16:
+            g_procs.c16_to_32(src, dst, num_pixels);
+            return 0;
+        case PIXEL_FMT_24:
+            g_procs.c24_to_32(src, dst, num_pixels);
+            return 0;
+    }
+
+    return 1;
+}
+
+/*****************************************************************************/
+int APP_CC
+pixel_convert_row(const void *src, int src_fmt, void *dst, int dst_fmt,
+                  int num_pixels, const int *palette)
+{
+    tui32 temp[256];
+    const tui8 *s8;
+    tui8 *d8;
+    int src_bytes;
+    int dst_bytes;
+    int chunk;
+
+    if (!g_procs_inited)
+    {
+        pixel_convert_init();
+    }
+
+    src_bytes = pixel_fmt_bytes(src_fmt);
+    dst_bytes = pixel_fmt_bytes(dst_fmt);
+
+    if (src_bytes == 0 || dst_bytes == 0)
+    {
+        return 1;
+    }
+
+    if (src_fmt == dst_fmt)
+    {
+        memcpy(dst, src, num_pixels * src_bytes);
+        return 0;
+    }
+
+    if (src_fmt == PIXEL_FMT_32)
+    {
+        return pixel_from_32(src, dst, dst_fmt, num_pixels);
+    }
+
+    if (dst_fmt == PIXEL_FMT_32)
+    {
+        return pixel_to_32(src, src_fmt, dst, num_pixels, palette);
+    }
+
+    s8 = (const tui8 *)src;
+    d8 = (tui8 *)dst;
+
+    while (num_pixels > 0)
+    {
+        chunk = MIN(num_pixels, 256);
+
+        if (pixel_to_32(s8, src_fmt, temp, chunk, palette) != 0 ||
+            pixel_from_32(temp, d8, dst_fmt, chunk) != 0)
+        {
+            return 1;
+        }
+
+        s8 += chunk * src_bytes;
+        d8 += chunk * dst_bytes;
+        num_pixels -= chunk;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+pixel_convert_rect(const void *src, int src_fmt, int src_stride,
+                   void *dst, int dst_fmt, int dst_stride,
+                   int width, int height, const int *palette)
+{
+    const tui8 *s8;
+    tui8 *d8;
+    int index;
+
+    s8 = (const tui8 *)src;
+    d8 = (tui8 *)dst;
+
+    for (index = 0; index < height; index++)
+    {
+        if (pixel_convert_row(s8, src_fmt, d8, dst_fmt, width, palette) != 0)
+        {
+            return 1;
+        }
+
+        s8 += src_stride;
+        d8 += dst_stride;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+void APP_CC
+pixel_swap_rb32(const void *src, void *dst, int num_pixels)
+{
+    if (!g_procs_inited)
+    {
+        pixel_convert_init();
+    }
+
+    g_procs.swap_rb32(src, dst, num_pixels);
+}
+
+/*****************************************************************************/
+void APP_CC
+pixel_premultiply32(const void *src, void *dst, int num_pixels)
+{
+    if (!g_procs_inited)
+    {
+        pixel_convert_init();
+    }
+
+    g_procs.premultiply32(src, dst, num_pixels);
+}
+
+/*****************************************************************************/
+void APP_CC
+pixel_alpha8(const void *src, void *dst, int num_pixels)
+{
+    if (!g_procs_inited)
+    {
+        pixel_convert_init();
+    }
+
+    g_procs.alpha8(src, dst, num_pixels);
+}
+
+/*****************************************************************************/
+const char *APP_CC
+pixel_convert_impl(void)
+{
+    if (!g_procs_inited)
+    {
+        pixel_convert_init();
+    }
+
+    return g_procs.name;
+}
@@ -0,0 +1,60 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pixel format conversion
+ */
+
+#if !defined(PIXEL_CONVERT_H)
+#define PIXEL_CONVERT_H
+
+#include "arch.h"
+
+/* pixel formats, in memory
+   8  COLOR8 (3-3-2) or a palette index
+   15 x1r5g5b5 in a tui16
+   16 r5g6b5 in a tui16
+   24 packed 3 bytes b, g, r
+   32 x8r8g8b8 in a tui32, what xrdp calls 24 bpp */
+#define PIXEL_FMT_8  8
+#define PIXEL_FMT_15 15
+#define PIXEL_FMT_16 16
+#define PIXEL_FMT_24 24
+#define PIXEL_FMT_32 32
+
+/* src and dst must not overlap, palette is 256 x8r8g8b8 entries and is
+   only used when converting from 8, returns error */
+int APP_CC
+pixel_convert_row(const void *src, int src_fmt, void *dst, int dst_fmt,
+                  int num_pixels, const int *palette);
+int APP_CC
+pixel_convert_rect(const void *src, int src_fmt, int src_stride,
+                   void *dst, int dst_fmt, int dst_stride,
+                   int width, int height, const int *palette);
+/* 32 bpp a8r8g8b8 <-> a8b8g8r8, src and dst can be the same */
+void APP_CC
+pixel_swap_rb32(const void *src, void *dst, int num_pixels);
+/* 32 bpp, colour channels times alpha / 255, src and dst can be the same */
+void APP_CC
+pixel_premultiply32(const void *src, void *dst, int num_pixels);
+/* 32 bpp to its 8 bit alpha plane */
+void APP_CC
+pixel_alpha8(const void *src, void *dst, int num_pixels);
+/* name of the best kernels in use, "c", "sse2", "ssse3", "avx2" or "neon" */
+const char *APP_CC
+pixel_convert_impl(void);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pointer hash, the X server and xrdp key the pointer cache with it
+ */
+
+#if !defined(POINTER_HASH_H)
+#define POINTER_HASH_H
+
+/* bytes of 32x32 pointer data, bpp 0 is 24 */
+#define POINTER_HASH_BYTES(_bpp) \
+  (((((_bpp) == 0) ? 24 : (_bpp)) + 7) / 8 * 32 * 32)
+
+/* FNV-1a over the hotspot, bpp, used data and mask, never 0
+   _hash is an unsigned int, bpp 0 hashes as 24 so both ends agree */
+#define POINTER_HASH(_hash, _x, _y, _bpp, _data, _mask) \
+  do \
+  { \
+    const unsigned char *_p; \
+    int _i; \
+    int _bytes; \
+    (_hash) = 2166136261U; \
+    (_hash) = ((_hash) ^ ((_x) & 0xff)) * 16777619U; \
+    (_hash) = ((_hash) ^ ((_y) & 0xff)) * 16777619U; \
+    (_hash) = ((_hash) ^ ((((_bpp) == 0) ? 24 : (_bpp)) & 0xff)) * \
+              16777619U; \
+    _p = (const unsigned char *) (_data); \
+    _bytes = POINTER_HASH_BYTES(_bpp); \
+    for (_i = 0; _i < _bytes; _i++) \
+    { \
+      (_hash) = ((_hash) ^ _p[_i]) * 16777619U; \
+    } \
+    _p = (const unsigned char *) (_mask); \
+    for (_i = 0; _i < 32 * 32 / 8; _i++) \
+    { \
+      (_hash) = ((_hash) ^ _p[_i]) * 16777619U; \
+    } \
+    if ((_hash) == 0) \
+    { \
+      (_hash) = 1; \
+    } \
+  } while (0)
+
+#endif
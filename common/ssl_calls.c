@@ -33,6 +33,7 @@
 #include "arch.h"
 #include "ssl_calls.h"
 #include "trans.h"
+#include "thread_calls.h"
 
 #if defined(OPENSSL_VERSION_NUMBER) && (OPENSSL_VERSION_NUMBER >= 0x0090800f)
 #undef OLD_RSA_GEN1
@@ -40,12 +41,74 @@
 #define OLD_RSA_GEN1
 #endif
 
+/* process wide server context, built once and shared by all connections,
+   each ssl_tls holds its own reference so a reload never pulls the
+   context out from under a live connection */
+static SSL_CTX *g_tls_ctx = 0;
+static char g_tls_ctx_key[1024];
+static char g_tls_ctx_cert[1024];
+static tbus g_tls_ctx_mutex = 0;
+static volatile int g_tls_ctx_reload = 0;
+/* set when every connection is a forked child of the listener */
+static int g_tls_ctx_forking = 0;
+
+/* how long a client gets to finish the TLS handshake */
+#define SSL_TLS_ACCEPT_TIMEOUT 30000
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/* before 1.1.0 openssl needs these to be used from more than one thread */
+static tbus *g_ssl_locks = 0;
+
+/*****************************************************************************/
+static void
+ssl_locking_callback(int mode, int type, const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK)
+    {
+        tc_mutex_lock(g_ssl_locks[type]);
+    }
+    else
+    {
+        tc_mutex_unlock(g_ssl_locks[type]);
+    }
+}
+
+/*****************************************************************************/
+static unsigned long
+ssl_id_callback(void)
+{
+    return (unsigned long)tc_get_threadid();
+}
+#endif
+
 /*****************************************************************************/
 int
 ssl_init(void)
 {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    int index;
+    int num_locks;
+#endif
+
     SSL_load_error_strings();
     SSL_library_init();
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    if (g_ssl_locks == 0)
+    {
+        num_locks = CRYPTO_num_locks();
+        g_ssl_locks = (tbus *)g_malloc(sizeof(tbus) * num_locks, 1);
+        for (index = 0; index < num_locks; index++)
+        {
+            g_ssl_locks[index] = tc_mutex_create();
+        }
+        CRYPTO_set_id_callback(ssl_id_callback);
+        CRYPTO_set_locking_callback(ssl_locking_callback);
+    }
+#endif
+    if (g_tls_ctx_mutex == 0)
+    {
+        g_tls_ctx_mutex = tc_mutex_create();
+    }
     return 0;
 }
 
@@ -123,6 +186,14 @@ ssl_sha1_complete(void *sha1_info, char *data)
     SHA1_Final((tui8 *)data, (SHA_CTX *)sha1_info);
 }
 
+/*****************************************************************************/
+/* copy the running state, lets a caller hash a common prefix once */
+void APP_CC
+ssl_sha1_copy(void *dst_sha1_info, void *src_sha1_info)
+{
+    g_memcpy(dst_sha1_info, src_sha1_info, sizeof(SHA_CTX));
+}
+
 /* md5 stuff */
 
 /*****************************************************************************/
@@ -160,6 +231,14 @@ ssl_md5_complete(void *md5_info, char *data)
     MD5_Final((tui8 *)data, (MD5_CTX *)md5_info);
 }
 
+/*****************************************************************************/
+/* copy the running state, lets a caller hash a common prefix once */
+void APP_CC
+ssl_md5_copy(void *dst_md5_info, void *src_md5_info)
+{
+    g_memcpy(dst_md5_info, src_md5_info, sizeof(MD5_CTX));
+}
+
 /* FIPS stuff */
 
 /*****************************************************************************/
@@ -279,6 +358,18 @@ ssl_hmac_sha1_init(void *hmac, const char *data, int len)
     HMAC_Init_ex(hmac_ctx, data, len, EVP_sha1(), NULL);
 }
 
+/*****************************************************************************/
+/* start a new mac with the key from the last ssl_hmac_sha1_init, the
+   keyed inner and outer states are reused, not hashed again */
+void APP_CC
+ssl_hmac_sha1_reset(void *hmac)
+{
+    HMAC_CTX *hmac_ctx;
+
+    hmac_ctx = (HMAC_CTX *) hmac;
+    HMAC_Init_ex(hmac_ctx, NULL, 0, NULL, NULL);
+}
+
 /*****************************************************************************/
 void APP_CC
 ssl_hmac_transform(void *hmac, const char *data, int len)
@@ -581,10 +672,10 @@ ssl_tls_print_error(char *func, SSL *connection, int value)
 }
 
 /*****************************************************************************/
-int APP_CC
-ssl_tls_accept(struct ssl_tls *self)
+static SSL_CTX *APP_CC
+ssl_tls_ctx_create(const char *key, const char *cert)
 {
-    int connection_status;
+    SSL_CTX *ctx;
     long options = 0;
 
     /**
@@ -624,30 +715,231 @@ ssl_tls_accept(struct ssl_tls *self)
      */
     options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
 
-    self->ctx = SSL_CTX_new(SSLv23_server_method());
+    ctx = SSL_CTX_new(SSLv23_server_method());
+
+    if (ctx == NULL)
+    {
+        g_writeln("ssl_tls_ctx_create: SSL_CTX_new failed");
+        return NULL;
+    }
+
     /* set context options */
-    SSL_CTX_set_mode(self->ctx,
+    SSL_CTX_set_mode(ctx,
                      SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
                      SSL_MODE_ENABLE_PARTIAL_WRITE);
-    SSL_CTX_set_options(self->ctx, options);
-    SSL_CTX_set_read_ahead(self->ctx, 1);
+    SSL_CTX_set_options(ctx, options);
+    SSL_CTX_set_read_ahead(ctx, 1);
 
-    if (self->ctx == NULL)
+    /**
+     * session resumption:
+     *
+     * Reconnecting clients can resume from a session ticket. The ticket
+     * keys are made with the context, so in fork mode children inherit
+     * them from the listener and any child can resume a session another
+     * one issued.
+     *
+     * The server side cache is per process. A forked child's cache only
+     * ever holds its own session and goes when the child exits, so in
+     * fork mode it is turned off and tickets are the only way to resume.
+     * With threads every connection shares it, so clients that do not
+     * do tickets can resume by session id.
+     */
+    SSL_CTX_set_session_cache_mode(ctx, g_tls_ctx_forking ?
+                                   SSL_SESS_CACHE_OFF :
+                                   SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"xrdp", 4);
+
+    if (SSL_CTX_use_RSAPrivateKey_file(ctx, key, SSL_FILETYPE_PEM) <= 0)
+    {
+        g_writeln("ssl_tls_ctx_create: SSL_CTX_use_RSAPrivateKey_file failed");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) <= 0)
+    {
+        g_writeln("ssl_tls_ctx_create: SSL_CTX_use_certificate_chain_file "
+                  "failed");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/*****************************************************************************/
+static void APP_CC
+ssl_tls_ctx_ref(SSL_CTX *ctx)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    CRYPTO_add(&(ctx->references), 1, CRYPTO_LOCK_SSL_CTX);
+#else
+    SSL_CTX_up_ref(ctx);
+#endif
+}
+
+/*****************************************************************************/
+/* build the shared context from key and cert, replacing the current one,
+   must be called with g_tls_ctx_mutex held, returns error */
+static int APP_CC
+ssl_tls_ctx_load(const char *key, const char *cert)
+{
+    SSL_CTX *ctx;
+#if defined(SSL_CTX_get_tlsext_ticket_keys)
+    char ticket_keys[48];
+#endif
+
+    ctx = ssl_tls_ctx_create(key, cert);
+
+    if (ctx == NULL)
     {
-        g_writeln("ssl_tls_accept: SSL_CTX_new failed");
         return 1;
     }
 
-    if (SSL_CTX_use_RSAPrivateKey_file(self->ctx, self->key, SSL_FILETYPE_PEM)
-            <= 0)
+    if (g_tls_ctx != NULL)
+    {
+#if defined(SSL_CTX_get_tlsext_ticket_keys)
+        /* keep the ticket keys so a reload does not stop resumption */
+        if (SSL_CTX_get_tlsext_ticket_keys(g_tls_ctx, ticket_keys,
+                                           sizeof(ticket_keys)) == 1)
+        {
+            SSL_CTX_set_tlsext_ticket_keys(ctx, ticket_keys,
+                                           sizeof(ticket_keys));
+            g_memset(ticket_keys, 0, sizeof(ticket_keys));
+        }
+#endif
+        SSL_CTX_free(g_tls_ctx);
+    }
+
+    g_tls_ctx = ctx;
+    g_strncpy(g_tls_ctx_key, key, sizeof(g_tls_ctx_key) - 1);
+    g_strncpy(g_tls_ctx_cert, cert, sizeof(g_tls_ctx_cert) - 1);
+    g_tls_ctx_reload = 0;
+    g_writeln("ssl_tls_ctx_load: loaded key %s and certificate %s",
+              key, cert);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns a referenced shared context for key and cert, the caller frees
+   it with SSL_CTX_free, NULL on error */
+static SSL_CTX *APP_CC
+ssl_tls_ctx_get(const char *key, const char *cert)
+{
+    SSL_CTX *ctx;
+
+    ctx = NULL;
+    tc_mutex_lock(g_tls_ctx_mutex);
+
+    if ((g_tls_ctx == NULL) || g_tls_ctx_reload ||
+        (g_strcmp(g_tls_ctx_key, key) != 0) ||
+        (g_strcmp(g_tls_ctx_cert, cert) != 0))
+    {
+        if (ssl_tls_ctx_load(key, cert) != 0)
+        {
+            g_writeln("ssl_tls_ctx_get: ssl_tls_ctx_load failed");
+        }
+    }
+
+    if ((g_tls_ctx != NULL) && (g_strcmp(g_tls_ctx_key, key) == 0) &&
+        (g_strcmp(g_tls_ctx_cert, cert) == 0))
+    {
+        ctx = g_tls_ctx;
+        ssl_tls_ctx_ref(ctx);
+    }
+
+    tc_mutex_unlock(g_tls_ctx_mutex);
+    return ctx;
+}
+
+/*****************************************************************************/
+/* load the shared context ahead of the first connection, in fork mode the
+   listener calls this so every child starts with it, forking is set if
+   each connection is a forked child, returns error */
+int APP_CC
+ssl_tls_ctx_preload(const char *key, const char *cert, int forking)
+{
+    int rv;
+
+    tc_mutex_lock(g_tls_ctx_mutex);
+    g_tls_ctx_forking = forking;
+    rv = ssl_tls_ctx_load(key, cert);
+    tc_mutex_unlock(g_tls_ctx_mutex);
+    return rv;
+}
+
+/*****************************************************************************/
+/* safe to call from a signal handler, the key and certificate are read
+   again before the next handshake or by ssl_tls_ctx_refresh */
+void APP_CC
+ssl_tls_ctx_reload(void)
+{
+    g_tls_ctx_reload = 1;
+}
+
+/*****************************************************************************/
+/* reload the shared context now if ssl_tls_ctx_reload was called,
+   returns error */
+int APP_CC
+ssl_tls_ctx_refresh(void)
+{
+    int rv;
+
+    rv = 0;
+
+    if (g_tls_ctx_reload)
+    {
+        tc_mutex_lock(g_tls_ctx_mutex);
+        if (g_tls_ctx_reload && (g_tls_ctx != NULL))
+        {
+            rv = ssl_tls_ctx_load(g_tls_ctx_key, g_tls_ctx_cert);
+        }
+        tc_mutex_unlock(g_tls_ctx_mutex);
+    }
+
+    return rv;
+}
+
+/*****************************************************************************/
+/* wait, without spinning, until the socket is ready for what the last
+   SSL call asked for, returns error */
+static int APP_CC
+ssl_tls_wait(struct ssl_tls *self, int ssl_error, int millis)
+{
+    int sck;
+
+    sck = self->trans->sck;
+
+    if ((self->trans->is_term != 0) && self->trans->is_term())
     {
-        g_writeln("ssl_tls_accept: SSL_CTX_use_RSAPrivateKey_file failed");
         return 1;
     }
 
-    if (SSL_CTX_use_certificate_chain_file(self->ctx, self->cert) <= 0)
+    if (ssl_error == SSL_ERROR_WANT_WRITE)
+    {
+        g_tcp_can_send(sck, millis);
+    }
+    else
+    {
+        g_tcp_can_recv(sck, millis);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+ssl_tls_accept(struct ssl_tls *self)
+{
+    int connection_status;
+    int ssl_error;
+    int start_time;
+
+    self->ctx = ssl_tls_ctx_get(self->key, self->cert);
+
+    if (self->ctx == NULL)
     {
-        g_writeln("ssl_tls_accept: SSL_CTX_use_certificate_chain_file failed");
+        g_writeln("ssl_tls_accept: no TLS context");
         return 1;
     }
 
@@ -665,28 +957,43 @@ ssl_tls_accept(struct ssl_tls *self)
         return 1;
     }
 
-    while(1) {
+    start_time = g_time3();
+
+    while (1)
+    {
         connection_status = SSL_accept(self->ssl);
 
-        if (connection_status <= 0)
+        if (connection_status > 0)
         {
-            if (ssl_tls_print_error("SSL_accept", self->ssl, connection_status))
-            {
-                return 1;
-            }
-            /**
-             * retry when SSL_get_error returns:
-             *     SSL_ERROR_WANT_READ
-             *     SSL_ERROR_WANT_WRITE
-             */
+            break;
         }
-        else
+
+        if (ssl_tls_print_error("SSL_accept", self->ssl, connection_status))
         {
-            break;
+            return 1;
+        }
+
+        /**
+         * SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE, the socket is non
+         * blocking so wait for it instead of calling SSL_accept again
+         * straight away
+         */
+        if (g_time3() - start_time > SSL_TLS_ACCEPT_TIMEOUT)
+        {
+            g_writeln("ssl_tls_accept: handshake timed out");
+            return 1;
+        }
+
+        ssl_error = SSL_get_error(self->ssl, connection_status);
+
+        if (ssl_tls_wait(self, ssl_error, 100) != 0)
+        {
+            return 1;
         }
     }
 
-    g_writeln("ssl_tls_accept: TLS connection accepted");
+    g_writeln("ssl_tls_accept: TLS connection accepted%s",
+              SSL_session_reused(self->ssl) ? ", session resumed" : "");
 
     return 0;
 }
@@ -733,7 +1040,17 @@ ssl_tls_delete(struct ssl_tls *self)
     if (self != NULL)
     {
         if (self->ssl)
+        {
+            /* openssl drops the session from the cache if it was not shut
+               down, a client going without one is the usual end of an RDP
+               connection and no reason to stop it resuming */
+            if (SSL_is_init_finished(self->ssl))
+            {
+                SSL_set_shutdown(self->ssl,
+                                 SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            }
             SSL_free(self->ssl);
+        }
 
         if (self->ctx)
             SSL_CTX_free(self->ctx);
@@ -749,12 +1066,14 @@ int APP_CC
 ssl_tls_read(struct ssl_tls *tls, char *data, int length)
 {
     int status;
+    int ssl_error;
     int break_flag;
 
     while(1) {
         status = SSL_read(tls->ssl, data, length);
+        ssl_error = SSL_get_error(tls->ssl, status);
 
-        switch (SSL_get_error(tls->ssl, status))
+        switch (ssl_error)
         {
             case SSL_ERROR_NONE:
                 break_flag = 1;
@@ -766,7 +1085,14 @@ ssl_tls_read(struct ssl_tls *tls, char *data, int length)
                  * retry when SSL_get_error returns:
                  *     SSL_ERROR_WANT_READ
                  *     SSL_ERROR_WANT_WRITE
+                 * once the socket is ready
                  */
+                if (ssl_tls_wait(tls, ssl_error, 100) != 0)
+                {
+                    status = -1;
+                    break_flag = 1;
+                    break;
+                }
                 continue;
 
             default:
@@ -795,12 +1121,14 @@ int APP_CC
 ssl_tls_write(struct ssl_tls *tls, const char *data, int length)
 {
     int status;
+    int ssl_error;
     int break_flag;
 
     while(1) {
         status = SSL_write(tls->ssl, data, length);
+        ssl_error = SSL_get_error(tls->ssl, status);
 
-        switch (SSL_get_error(tls->ssl, status))
+        switch (ssl_error)
         {
             case SSL_ERROR_NONE:
                 break_flag = 1;
@@ -812,7 +1140,14 @@ ssl_tls_write(struct ssl_tls *tls, const char *data, int length)
                  * retry when SSL_get_error returns:
                  *     SSL_ERROR_WANT_READ
                  *     SSL_ERROR_WANT_WRITE
+                 * once the socket is ready
                  */
+                if (ssl_tls_wait(tls, ssl_error, 100) != 0)
+                {
+                    status = -1;
+                    break_flag = 1;
+                    break;
+                }
                 continue;
 
             default:
@@ -44,6 +44,8 @@ void APP_CC
 ssl_sha1_transform(void* sha1_info, char* data, int len);
 void APP_CC
 ssl_sha1_complete(void* sha1_info, char* data);
+void APP_CC
+ssl_sha1_copy(void* dst_sha1_info, void* src_sha1_info);
 void* APP_CC
 ssl_md5_info_create(void);
 void APP_CC
@@ -54,6 +56,8 @@ void APP_CC
 ssl_md5_transform(void* md5_info, char* data, int len);
 void APP_CC
 ssl_md5_complete(void* md5_info, char* data);
+void APP_CC
+ssl_md5_copy(void* dst_md5_info, void* src_md5_info);
 void *APP_CC
 ssl_des3_encrypt_info_create(const char *key, const char* ivec);
 void *APP_CC
@@ -71,6 +75,8 @@ ssl_hmac_info_delete(void *hmac);
 void APP_CC
 ssl_hmac_sha1_init(void *hmac, const char *data, int len);
 void APP_CC
+ssl_hmac_sha1_reset(void *hmac);
+void APP_CC
 ssl_hmac_transform(void *hmac, const char *data, int len);
 void APP_CC
 ssl_hmac_complete(void *hmac, char *data, int len);
@@ -107,5 +113,11 @@ int APP_CC
 ssl_tls_write(struct ssl_tls *tls, const char *data, int length);
 int APP_CC
 ssl_tls_can_recv(struct ssl_tls *tls, int sck, int millis);
+int APP_CC
+ssl_tls_ctx_preload(const char *key, const char *cert, int forking);
+void APP_CC
+ssl_tls_ctx_reload(void);
+int APP_CC
+ssl_tls_ctx_refresh(void);
 
 #endif
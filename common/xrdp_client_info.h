@@ -138,6 +138,7 @@ struct xrdp_client_info
   int h264_codec_id;
   int h264_prop_len;
   char h264_prop[64];
+  int h264_bitrate; /* kbit/s, 0 means pick from the screen size */
 
   int use_frame_acks;
   int max_unacknowledged_frame_count;
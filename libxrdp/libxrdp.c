@@ -854,6 +854,23 @@ libxrdp_orders_send_bitmap2(struct xrdp_session *session, int width, int height,
 			width, height, bpp, data, cache_id, cache_idx, hints);
 }
 
+/*****************************************************************************/
+/* thread safe, needs no session */
+int EXPORT_CC
+libxrdp_orders_compress_bitmap2(int width, int height, int bpp, char *data,
+		struct stream *s, struct stream *temp_s) {
+	return xrdp_orders_compress_bitmap2(width, height, bpp, data, s, temp_s);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_orders_send_bitmap2_comp(struct xrdp_session *session, int width,
+		int height, int bpp, char *comp_data, int comp_bytes, int cache_id,
+		int cache_idx) {
+	return xrdp_orders_send_bitmap2_comp((struct xrdp_orders *) session->orders,
+			width, height, bpp, comp_data, comp_bytes, cache_id, cache_idx);
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_orders_send_bitmap3(struct xrdp_session *session, int width, int height,
@@ -862,6 +879,13 @@ libxrdp_orders_send_bitmap3(struct xrdp_session *session, int width, int height,
 			width, height, bpp, data, cache_id, cache_idx, hints);
 }
 
+/*****************************************************************************/
+/* bytes the last order sent took, for stats */
+int EXPORT_CC
+libxrdp_orders_last_size(struct xrdp_session *session) {
+	return xrdp_orders_last_size((struct xrdp_orders *) session->orders);
+}
+
 /*****************************************************************************/
 /* returns error */
 /* this function gets the channel name and its flags, index is zero
@@ -1090,7 +1114,36 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session, int format,
 	orders = (struct xrdp_orders *) (session->orders);
 	jpeg_han = orders->jpeg_han;
 	return xrdp_codec_jpeg_compress(jpeg_han, format, inp_data, width, height,
-			stride, x, y, cx, cy, quality, out_data, io_len);
+			stride, x, y, cx, cy, quality, 0, out_data, io_len);
+}
+
+/*****************************************************************************/
+/* a compressor of the caller's own, for use off the main thread */
+void *EXPORT_CC
+libxrdp_codec_jpeg_create(void) {
+	return xrdp_jpeg_init();
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_codec_jpeg_delete(void *handle) {
+	return xrdp_jpeg_deinit(handle);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_codec_jpeg_compress_handle(void *handle, int format, char *inp_data,
+		int width, int height, int stride, int x, int y, int cx, int cy,
+		int quality, int flags, char *out_data, int *io_len) {
+	return xrdp_codec_jpeg_compress(handle, format, inp_data, width, height,
+			stride, x, y, cx, cy, quality, flags, out_data, io_len);
+}
+
+/*****************************************************************************/
+/* size of out_data that is always enough for a cx by cy rect */
+int EXPORT_CC
+libxrdp_codec_jpeg_buf_size(int cx, int cy) {
+	return xrdp_codec_jpeg_buf_size(cx, cy);
 }
 
 /*****************************************************************************/
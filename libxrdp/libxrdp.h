@@ -118,6 +118,10 @@ struct xrdp_sec
     char sign_key[16];
     void *decrypt_rc4_info;
     void *encrypt_rc4_info;
+    void *sign_sha1_info; /* sign_key and pad 54 already hashed */
+    void *sign_md5_info; /* sign_key and pad 92 already hashed */
+    void *sha1_info; /* scratch, reused for every pdu */
+    void *md5_info;
     char pub_exp[4];
     char pub_mod[256];
     char pub_sig[64];
@@ -261,6 +265,7 @@ struct xrdp_orders
     struct xrdp_wm *wm;
 
     char *order_count_ptr; /* pointer to count, set when sending */
+    char *order_start; /* where the last order written starts */
     int order_count;
     int order_level; /* inc for every call to xrdp_orders_init */
     struct xrdp_orders_state orders_state;
@@ -420,6 +425,8 @@ xrdp_orders_force_send(struct xrdp_orders *self);
 int APP_CC
 xrdp_orders_check(struct xrdp_orders *self, int max_size);
 int APP_CC
+xrdp_orders_last_size(struct xrdp_orders *self);
+int APP_CC
 xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
                  int color, struct xrdp_rect *rect);
 int APP_CC
@@ -485,6 +492,14 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
                              int width, int height, int bpp, char *data,
                              int cache_id, int cache_idx);
 int APP_CC
+xrdp_orders_compress_bitmap2(int width, int height, int bpp, char *data,
+                             struct stream *s, struct stream *temp_s);
+int APP_CC
+xrdp_orders_send_bitmap2_comp(struct xrdp_orders *self,
+                              int width, int height, int bpp,
+                              char *comp_data, int comp_bytes,
+                              int cache_id, int cache_idx);
+int APP_CC
 xrdp_orders_send_bitmap2(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
                          int cache_id, int cache_idx, int hints);
@@ -531,10 +546,13 @@ xrdp_codec_jpeg_compress(void *handle,
                          int   cx,       /* width of area to compress */
                          int   cy,       /* height of area to compress */
                          int   quality,  /* higher numbers compress less */
+                         int   flags,    /* XRDP_JPEG_FLAG_* */
                          char *out_data, /* dest for jpg image */
                          int  *io_len    /* length of out_data and on return */
                                          /* len of compressed data */
                          );
+int APP_CC
+xrdp_codec_jpeg_buf_size(int cx, int cy);
 
 void *APP_CC
 xrdp_jpeg_init(void);
@@ -25,6 +25,9 @@
 
 /* struct xrdp_client_info moved to xrdp_client_info.h */
 
+/* libxrdp_codec_jpeg_compress flags */
+#define XRDP_JPEG_FLAG_444 1 /* no chroma subsampling, for text */
+
 struct xrdp_brush
 {
     int x_orgin;
@@ -182,10 +185,20 @@ libxrdp_orders_send_bitmap2(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
                             int cache_id, int cache_idx, int hints);
 int DEFAULT_CC
+libxrdp_orders_compress_bitmap2(int width, int height, int bpp, char *data,
+                                struct stream *s, struct stream *temp_s);
+int DEFAULT_CC
+libxrdp_orders_send_bitmap2_comp(struct xrdp_session *session,
+                                 int width, int height, int bpp,
+                                 char *comp_data, int comp_bytes,
+                                 int cache_id, int cache_idx);
+int DEFAULT_CC
 libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
                             int cache_id, int cache_idx, int hints);
 int DEFAULT_CC
+libxrdp_orders_last_size(struct xrdp_session *session);
+int DEFAULT_CC
 libxrdp_query_channel(struct xrdp_session *session, int index,
                       char *channel_name, int *channel_flags);
 int DEFAULT_CC
@@ -237,6 +250,19 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session,
                             int stride, int x, int y,
                             int cx, int cy, int quality,
                             char *out_data, int *io_len);
+void *DEFAULT_CC
+libxrdp_codec_jpeg_create(void);
+int DEFAULT_CC
+libxrdp_codec_jpeg_delete(void *handle);
+int DEFAULT_CC
+libxrdp_codec_jpeg_compress_handle(void *handle,
+                                   int format, char *inp_data,
+                                   int width, int height,
+                                   int stride, int x, int y,
+                                   int cx, int cy, int quality, int flags,
+                                   char *out_data, int *io_len);
+int DEFAULT_CC
+libxrdp_codec_jpeg_buf_size(int cx, int cy);
 int DEFAULT_CC
 libxrdp_fastpath_send_surface(struct xrdp_session *session,
                               char *data_pad, int pad_bytes,
@@ -115,6 +115,7 @@ xrdp_codec_jpeg_compress(void *handle,
                          int   cx,       /* width of area to compress */
                          int   cy,       /* height of area to compress */
                          int   quality,  /* higher numbers compress less */
+                         int   flags,    /* XRDP_JPEG_FLAG_* */
                          char *out_data, /* dest for jpg image */
                          int  *io_len    /* length of out_data and on return */
                                          /* len of compressed data */
@@ -123,7 +124,9 @@ xrdp_codec_jpeg_compress(void *handle,
     tjhandle       tj_han;
     int            error;
     int            bpp;
+    int            subsamp;
     char          *src_ptr;
+    unsigned char *dst_ptr;
     unsigned long  lio_len;
 
     /*
@@ -144,7 +147,15 @@ xrdp_codec_jpeg_compress(void *handle,
     /* start of inner rect in inp_data */
     src_ptr = inp_data + (y * stride + x * bpp);
 
+    subsamp = (flags & XRDP_JPEG_FLAG_444) ? TJSAMP_444 : TJSAMP_420;
+    if (tjBufSize(cx, cy, subsamp) > (unsigned long) (*io_len))
+    {
+        g_writeln("xrdp_codec_jpeg_compress: out_data too small");
+        *io_len = 0;
+        return height;
+    }
     lio_len = *io_len;
+    dst_ptr = (unsigned char *) out_data;
     /* compress inner rect */
 
     /* notes
@@ -159,22 +170,35 @@ xrdp_codec_jpeg_compress(void *handle,
      * TJPF_ABGR no works, zero bytes
      * TJPF_ARGB no works, zero bytes */
 
-    error = tjCompress(tj_han,     /* opaque handle */
-                       src_ptr,    /* source buf */
-                       cx,         /* width of area to compress */
-                       stride,     /* pitch */
-                       cy,         /* height of area to compress */
-                       TJPF_XBGR,  /* pixel size */
-                       out_data,   /* dest buf */
-                       &lio_len,   /* inner_buf length & compressed_size */
-                       TJSAMP_420, /* jpeg sub sample */
-                       quality,    /* jpeg quality */
-                       0           /* flags */
-                       );
+    /* out_data is big enough so turbo jpeg writes straight into it */
+    error = tjCompress2(tj_han,      /* opaque handle */
+                        (unsigned char *) src_ptr, /* source buf */
+                        cx,          /* width of area to compress */
+                        stride,      /* pitch */
+                        cy,          /* height of area to compress */
+                        TJPF_XBGR,   /* pixel size */
+                        &dst_ptr,    /* dest buf */
+                        &lio_len,    /* compressed_size */
+                        subsamp,     /* jpeg sub sample */
+                        quality,     /* jpeg quality */
+                        TJFLAG_NOREALLOC | TJFLAG_FASTDCT);
+    if (error != 0)
+    {
+        lio_len = 0;
+    }
     *io_len = lio_len;
     return height;
 }
 
+/*****************************************************************************/
+/* bytes out_data needs for a cx by cy rect at any quality or flags,
+   4:2:0 pads to 16 pixels so on thin rects it can need more than 4:4:4 */
+int APP_CC
+xrdp_codec_jpeg_buf_size(int cx, int cy)
+{
+    return MAX(tjBufSize(cx, cy, TJSAMP_444), tjBufSize(cx, cy, TJSAMP_420));
+}
+
 /*****************************************************************************/
 void *APP_CC
 xrdp_jpeg_init(void)
@@ -208,9 +232,15 @@ xrdp_jpeg_deinit(void *handle)
 #include <stdlib.h>
 #include <string.h>
 #include <jpeglib.h>
+#include "pixel_convert.h"
 
 #define JP_QUALITY 75
 
+/* source pixel layouts */
+#define JP_FMT_BGRX 0 /* x8r8g8b8, bytes fed as r, g, b like the old 24 bpp
+                         path so the output does not change */
+#define JP_FMT_XBGR 1 /* same as TJPF_XBGR in the turbo jpeg build */
+
 struct mydata_comp
 {
     char *cb;
@@ -219,6 +249,18 @@ struct mydata_comp
     int overwrite;
 };
 
+/* a compressor kept for the life of its user, libjpeg's pools and tables
+   are set up once instead of on every image, one per thread */
+struct xrdp_jpeg
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dst_mgr;
+    struct mydata_comp md;
+    char *row; /* one padded or converted row */
+    int row_bytes;
+};
+
 /*****************************************************************************/
 /* called at begining */
 static void DEFAULT_CC
@@ -264,125 +306,115 @@ my_term_destination(j_compress_ptr cinfo)
 }
 
 /*****************************************************************************/
-static int APP_CC
-jp_do_compress(char *data, int width, int height, int bpp, int quality,
-               char *comp_data, int *comp_data_bytes)
+/* returns the row to hand libjpeg, padded with e copies of the last pixel
+   and, without the libjpeg-turbo colour space extensions, converted to
+   3 bytes a pixel */
+static JSAMPROW APP_CC
+jp_get_row(struct xrdp_jpeg *jp, const char *src, int width, int e, int fmt)
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    struct jpeg_destination_mgr dst_mgr;
-    struct mydata_comp md;
-    JSAMPROW row_pointer[4];
+    int index;
     int Bpp;
+    tui8 *d8;
+#if defined(JCS_EXTENSIONS)
 
-    Bpp = (bpp + 7) / 8;
-    memset(&cinfo, 0, sizeof(cinfo));
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    memset(&md, 0, sizeof(md));
-    md.cb = comp_data,
-       md.cb_bytes = *comp_data_bytes;
-    cinfo.client_data = &md;
-    memset(&dst_mgr, 0, sizeof(dst_mgr));
-    dst_mgr.init_destination = my_init_destination;
-    dst_mgr.empty_output_buffer = my_empty_output_buffer;
-    dst_mgr.term_destination = my_term_destination;
-    cinfo.dest = &dst_mgr;
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = Bpp;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    cinfo.num_components = 3;
-    cinfo.dct_method = JDCT_FLOAT;
-    jpeg_set_quality(&cinfo, quality, 1);
-    jpeg_start_compress(&cinfo, 1);
-
-    while (cinfo.next_scanline + 3 < cinfo.image_height)
+    if (e == 0)
     {
-        row_pointer[0] = data;
-        data += width * Bpp;
-        row_pointer[1] = data;
-        data += width * Bpp;
-        row_pointer[2] = data;
-        data += width * Bpp;
-        row_pointer[3] = data;
-        data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 4);
+        return (JSAMPROW) src;
     }
+    Bpp = 4;
+    g_memcpy(jp->row, src, width * 4);
+#else
+    const tui8 *s8;
 
-    while (cinfo.next_scanline < cinfo.image_height)
+    Bpp = 3;
+    s8 = (const tui8 *) src;
+    d8 = (tui8 *) (jp->row);
+    if (fmt == JP_FMT_BGRX)
     {
-        row_pointer[0] = data;
-        data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        pixel_convert_row(src, PIXEL_FMT_32, jp->row, PIXEL_FMT_24, width, 0);
     }
-
-    jpeg_finish_compress(&cinfo);
-    *comp_data_bytes = md.total_done;
-    jpeg_destroy_compress(&cinfo);
-
-    if (md.overwrite)
+    else
     {
-        return 1;
+        for (index = 0; index < width; index++)
+        {
+            d8[0] = s8[3];
+            d8[1] = s8[2];
+            d8[2] = s8[1];
+            s8 += 4;
+            d8 += 3;
+        }
     }
-
-    return 0;
+#endif
+    /* pad with the last pixel */
+    d8 = (tui8 *) (jp->row + width * Bpp);
+    for (index = 0; index < e; index++)
+    {
+        g_memcpy(d8, d8 - Bpp, Bpp);
+        d8 += Bpp;
+    }
+    return (JSAMPROW) (jp->row);
 }
 
 /*****************************************************************************/
+/* src is 32 bpp in fmt, returns error, 1 if comp_data was too small */
 static int APP_CC
-jpeg_compress(char *in_data, int width, int height,
-              struct stream *s, struct stream *temp_s, int bpp,
-              int byte_limit, int e, int quality)
+jp_do_compress(struct xrdp_jpeg *jp, const char *src, int stride,
+               int width, int height, int e, int fmt, int quality,
+               int flags, char *comp_data, int *comp_data_bytes)
 {
-    char *data;
-    tui32 *src32;
-    tui16 *src16;
-    tui8 *dst8;
-    tui32 pixel;
-    int red;
-    int blue;
-    int green;
-    int j;
-    int i;
-    int cdata_bytes;
+    struct jpeg_compress_struct *cinfo;
+    JSAMPROW row_pointer[1];
+    int bytes;
 
-    data = temp_s->data;
-    dst8 = data;
-
-    if (bpp == 24)
+    bytes = (width + e) * 4;
+    if (bytes > jp->row_bytes)
     {
-        src32 = (tui32 *)in_data;
-
-        for (j = 0; j < height; j++)
+        g_free(jp->row);
+        jp->row = (char *) g_malloc(bytes, 0);
+        jp->row_bytes = jp->row == 0 ? 0 : bytes;
+        if (jp->row == 0)
         {
-            for (i = 0; i < width; i++)
-            {
-                pixel = src32[i + j * width];
-                SPLITCOLOR32(red, green, blue, pixel);
-                *(dst8++) = blue;
-                *(dst8++) = green;
-                *(dst8++) = red;
-            }
-
-            for (i = 0; i < e; i++)
-            {
-                *(dst8++) = blue;
-                *(dst8++) = green;
-                *(dst8++) = red;
-            }
+            return 1;
         }
     }
-    else
+    cinfo = &(jp->cinfo);
+    jp->md.cb = comp_data;
+    jp->md.cb_bytes = *comp_data_bytes;
+    cinfo->image_width = width + e;
+    cinfo->image_height = height;
+#if defined(JCS_EXTENSIONS)
+    cinfo->input_components = 4;
+    cinfo->in_color_space = fmt == JP_FMT_BGRX ? JCS_EXT_RGBX : JCS_EXT_XBGR;
+#else
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_RGB;
+#endif
+    jpeg_set_defaults(cinfo);
+    cinfo->num_components = 3;
+    cinfo->dct_method = fmt == JP_FMT_BGRX ? JDCT_FLOAT : JDCT_IFAST;
+    if (flags & XRDP_JPEG_FLAG_444)
     {
-        g_writeln("bpp wrong %d", bpp);
+        cinfo->comp_info[0].h_samp_factor = 1;
+        cinfo->comp_info[0].v_samp_factor = 1;
     }
+    jpeg_set_quality(cinfo, quality, 1);
+    jpeg_start_compress(cinfo, 1);
+    while (cinfo->next_scanline < cinfo->image_height)
+    {
+        row_pointer[0] = jp_get_row(jp, src, width, e, fmt);
+        src += stride;
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+    /* leaves cinfo ready for the next image */
+    jpeg_finish_compress(cinfo);
+    *comp_data_bytes = jp->md.total_done;
 
-    cdata_bytes = byte_limit;
-    jp_do_compress(data, width + e, height, 24, quality, s->p, &cdata_bytes);
-    s->p += cdata_bytes;
-    return cdata_bytes;
+    if (jp->md.overwrite)
+    {
+        return 1;
+    }
+
+    return 0;
 }
 
 /*****************************************************************************/
@@ -392,8 +424,23 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    int start_line, struct stream *temp_s,
                    int e, int quality)
 {
-    jpeg_compress(in_data, width, height, s, temp_s, bpp, byte_limit,
-                  e, quality);
+    int cdata_bytes;
+
+    if (bpp != 24)
+    {
+        g_writeln("xrdp_jpeg_compress: bpp wrong %d", bpp);
+        return height;
+    }
+    if (handle == 0)
+    {
+        g_writeln("xrdp_jpeg_compress: handle is nil");
+        return height;
+    }
+    cdata_bytes = byte_limit;
+    jp_do_compress((struct xrdp_jpeg *) handle, in_data, width * 4,
+                   width, height, e, JP_FMT_BGRX, quality, 0,
+                   s->p, &cdata_bytes);
+    s->p += cdata_bytes;
     return height;
 }
 
@@ -401,22 +448,68 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
 int APP_CC
 xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
                          int height, int stride, int x, int y, int cx, int cy,
-                         int quality, char *out_data, int *io_len)
+                         int quality, int flags, char *out_data, int *io_len)
 {
-    return 0;
+    char *src_ptr;
+
+    if (handle == 0)
+    {
+        g_writeln("xrdp_codec_jpeg_compress: handle is nil");
+        return height;
+    }
+    /* start of inner rect in inp_data */
+    src_ptr = inp_data + (y * stride + x * 4);
+    if (jp_do_compress((struct xrdp_jpeg *) handle, src_ptr, stride,
+                       cx, cy, 0, JP_FMT_XBGR, quality, flags,
+                       out_data, io_len) != 0)
+    {
+        *io_len = 0;
+    }
+    return height;
+}
+
+/*****************************************************************************/
+/* bytes out_data needs for a cx by cy rect at any quality or flags, the
+   same bounds turbo jpeg's tjBufSize gives for 4:4:4 and 4:2:0, the
+   destination manager fails rather than write past it */
+int APP_CC
+xrdp_codec_jpeg_buf_size(int cx, int cy)
+{
+    return MAX(((cx + 7) & ~7) * ((cy + 7) & ~7) * 6,
+               ((cx + 15) & ~15) * ((cy + 15) & ~15) * 3) + 2048;
 }
 
 /*****************************************************************************/
 void *APP_CC
 xrdp_jpeg_init(void)
 {
-    return 0;
+    struct xrdp_jpeg *jp;
+
+    jp = (struct xrdp_jpeg *) g_malloc(sizeof(struct xrdp_jpeg), 1);
+    jp->cinfo.err = jpeg_std_error(&(jp->jerr));
+    jpeg_create_compress(&(jp->cinfo));
+    jp->cinfo.client_data = &(jp->md);
+    jp->dst_mgr.init_destination = my_init_destination;
+    jp->dst_mgr.empty_output_buffer = my_empty_output_buffer;
+    jp->dst_mgr.term_destination = my_term_destination;
+    jp->cinfo.dest = &(jp->dst_mgr);
+    return jp;
 }
 
 /*****************************************************************************/
 int APP_CC
 xrdp_jpeg_deinit(void *handle)
 {
+    struct xrdp_jpeg *jp;
+
+    if (handle == 0)
+    {
+        return 0;
+    }
+    jp = (struct xrdp_jpeg *) handle;
+    jpeg_destroy_compress(&(jp->cinfo));
+    g_free(jp->row);
+    g_free(jp);
     return 0;
 }
 
@@ -436,7 +529,15 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
 int APP_CC
 xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
                          int height, int stride, int x, int y, int cx, int cy,
-                         int quality, char *out_data, int *io_len)
+                         int quality, int flags, char *out_data, int *io_len)
+{
+    *io_len = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_codec_jpeg_buf_size(int cx, int cy)
 {
     return 0;
 }
@@ -201,6 +201,7 @@ xrdp_orders_check(struct xrdp_orders *self, int max_size) {
 			return 1;
 		} else {
 			xrdp_orders_init(self);
+			self->order_start = self->out_s->p;
 			return 0;
 		}
 	}
@@ -229,9 +230,21 @@ xrdp_orders_check(struct xrdp_orders *self, int max_size) {
 		xrdp_orders_init(self);
 	}
 
+	self->order_start = self->out_s->p;
 	return 0;
 }
 
+/*****************************************************************************/
+/* bytes of the last order written, every order starts with
+   xrdp_orders_check so it is out_s from there on */
+int APP_CC
+xrdp_orders_last_size(struct xrdp_orders *self) {
+	if (self->order_start == 0) {
+		return 0;
+	}
+	return (int) (self->out_s->p - self->order_start);
+}
+
 /*****************************************************************************/
 /* check if rect is the same as the last one sent */
 /* returns boolean */
@@ -2160,23 +2173,14 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self, int width, int height,
 
 /*****************************************************************************/
 /* returns error */
-/* max size width * height * Bpp + 14 */
+/* compress a bitmap for a bitmap2 cache order into s, s->data to s->end,
+   does not use an xrdp_orders so it can run on any thread */
 int APP_CC
-xrdp_orders_send_bitmap2(struct xrdp_orders *self, int width, int height,
-		int bpp, char *data, int cache_id, int cache_idx, int hints) {
-	int order_flags = 0;
-	int len = 0;
-	int bufsize = 0;
-	int Bpp = 0;
-	int i = 0;
+xrdp_orders_compress_bitmap2(int width, int height, int bpp, char *data,
+		struct stream *s, struct stream *temp_s) {
 	int lines_sending = 0;
 	int e = 0;
-	struct stream *s = NULL;
-	struct stream *temp_s = NULL;
-	char *p = NULL;
-#ifdef DEBUG_ORDER
-	log_order("bitmap2 :");
-#endif
+
 	if (width > 64) {
 		g_writeln("error, width > 64");
 		return 1;
@@ -2193,37 +2197,62 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self, int width, int height,
 		e = 4 - e;
 	}
 
-	s = self->s;
 	init_stream(s, 16384 * 2);
-	temp_s = self->temp_s;
 	init_stream(temp_s, 16384 * 2);
-	p = s->p;
-	i = height;
 	if (bpp > 24) {
 		lines_sending = xrdp_bitmap32_compress(data, width, height, s, bpp,
-				16384, i - 1, temp_s, e, 0x10);
+				16384, height - 1, temp_s, e, 0x10);
 	} else {
 		lines_sending = xrdp_bitmap_compress(data, width, height, s, bpp, 16384,
-				i - 1, temp_s, e);
+				height - 1, temp_s, e);
 	}
 
 	if (lines_sending != height) {
 		g_writeln(
-				"error in xrdp_orders_send_bitmap2, lines_sending(%d) != \
+				"error in xrdp_orders_compress_bitmap2, lines_sending(%d) != \
 height(%d)",
 				lines_sending, height);
 		return 1;
 	}
 
-	bufsize = (int) (s->p - p);
+	s_mark_end(s);
+	return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send a bitmap2 cache order from xrdp_orders_compress_bitmap2 output */
+int APP_CC
+xrdp_orders_send_bitmap2_comp(struct xrdp_orders *self, int width, int height,
+		int bpp, char *comp_data, int comp_bytes, int cache_id,
+		int cache_idx) {
+	int order_flags = 0;
+	int len = 0;
+	int Bpp = 0;
+	int i = 0;
+	int e = 0;
+
+#ifdef DEBUG_ORDER
+	log_order("bitmap2 :");
+#endif
+	e = width % 4;
+
+	if (e != 0) {
+		e = 4 - e;
+	}
+
 	Bpp = (bpp + 7) / 8;
-	if (xrdp_orders_check(self, bufsize + 14) != 0) {
+	/* bitmapLength is 14 bits */
+	if ((comp_bytes < 0) || (comp_bytes > 0x3fff)) {
+		return 1;
+	}
+	if (xrdp_orders_check(self, comp_bytes + 14) != 0) {
 		return 1;
 	}
 	self->order_count++;
 	order_flags = RDP_ORDER_STANDARD | RDP_ORDER_SECONDARY;
 	out_uint8(self->out_s, order_flags);
-	len = (bufsize + 6) - 7; /* length after type minus 7 */
+	len = (comp_bytes + 6) - 7; /* length after type minus 7 */
 	out_uint16_le(self->out_s, len);
 	i = (((Bpp + 2) << 3) & 0x38) | (cache_id & 7);
 	i = i | (0x08 << 7); /* CBR2_NO_BITMAP_COMPRESSION_HDR */
@@ -2231,15 +2260,32 @@ height(%d)",
 	out_uint8(self->out_s, RDP_ORDER_BMPCACHE2); /* type */
 	out_uint8(self->out_s, width + e);
 	out_uint8(self->out_s, height);
-	out_uint16_be(self->out_s, bufsize | 0x4000);
+	out_uint16_be(self->out_s, comp_bytes | 0x4000);
 	i = ((cache_idx >> 8) & 0xff) | 0x80;
 	out_uint8(self->out_s, i);
 	i = cache_idx & 0xff;
 	out_uint8(self->out_s, i);
-	out_uint8a(self->out_s, s->data, bufsize);
+	out_uint8a(self->out_s, comp_data, comp_bytes);
 	return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+/* max size width * height * Bpp + 14 */
+int APP_CC
+xrdp_orders_send_bitmap2(struct xrdp_orders *self, int width, int height,
+		int bpp, char *data, int cache_id, int cache_idx, int hints) {
+	struct stream *s = NULL;
+
+	s = self->s;
+	if (xrdp_orders_compress_bitmap2(width, height, bpp, data, s,
+			self->temp_s) != 0) {
+		return 1;
+	}
+	return xrdp_orders_send_bitmap2_comp(self, width, height, bpp, s->data,
+			(int) (s->end - s->data), cache_id, cache_idx);
+}
+
 /*****************************************************************************/
 static int xrdp_orders_send_as_jpeg(struct xrdp_orders *self, int width,
 		int height, int bpp, int hints) {
@@ -101,6 +101,8 @@ xrdp_rdp_read_config(struct xrdp_client_info *client_info) {
 			client_info->max_bpp = g_atoi(value);
 		} else if (g_strcasecmp(item, "rfx_min_pixel") == 0) {
 			client_info->rfx_min_pixel = g_atoi(value);
+		} else if (g_strcasecmp(item, "h264_bitrate") == 0) {
+			client_info->h264_bitrate = g_atoi(value);
 		} else if (g_strcasecmp(item, "new_cursors") == 0) {
 			client_info->pointer_flags = g_text2bool(value) == 0 ? 2 : 0;
 		} else if (g_strcasecmp(item, "require_credentials") == 0) {
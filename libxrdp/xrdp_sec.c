@@ -30,6 +30,9 @@
 #define LHEXDUMP(_level, _args) \
     do { if (_level < LOG_LEVEL) { g_hexdump _args ; } } while (0)
 
+/* bytes xrdp_sec_sign_encrypt hashes and then encrypts at a time */
+#define XRDP_SEC_CRYPT_CHUNK 4096
+
 /* some compilers need unsigned char to avoid warnings */
 static tui8 g_pad_54[40] = { 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
 		54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
@@ -359,6 +362,10 @@ xrdp_sec_delete(struct xrdp_sec *self) {
 	ssl_des3_info_delete(self->decrypt_fips_info);
 	ssl_des3_info_delete(self->encrypt_fips_info);
 	ssl_hmac_info_delete(self->sign_fips_info);
+	ssl_sha1_info_delete(self->sign_sha1_info);
+	ssl_md5_info_delete(self->sign_md5_info);
+	ssl_sha1_info_delete(self->sha1_info);
+	ssl_md5_info_delete(self->md5_info);
 	g_free(self->client_mcs_data.data);
 	g_free(self->server_mcs_data.data);
 	/* Crypto information must always be cleared */
@@ -464,22 +471,6 @@ xrdp_sec_fips_encrypt(struct xrdp_sec *self, char *data, int len) {
 	self->encrypt_use_count++;
 }
 
-/*****************************************************************************/
-static void APP_CC
-xrdp_sec_encrypt(struct xrdp_sec *self, char *data, int len) {
-	LLOGLN(10, ("xrdp_sec_encrypt:"));
-	if (self->encrypt_use_count == 4096) {
-		xrdp_sec_update(self->encrypt_key, self->encrypt_update_key,
-				self->rc4_key_len);
-		ssl_rc4_set_key(self->encrypt_rc4_info, self->encrypt_key,
-				self->rc4_key_len);
-		self->encrypt_use_count = 0;
-	}
-
-	ssl_rc4_crypt(self->encrypt_rc4_info, data, len);
-	self->encrypt_use_count++;
-}
-
 /*****************************************************************************/
 static int APP_CC
 unicode_in(struct stream *s, int uni_len, char *dst, int dst_len) {
@@ -908,6 +899,7 @@ xrdp_sec_fips_establish_keys(struct xrdp_sec *self) {
 	self->decrypt_fips_info = ssl_des3_decrypt_info_create(
 			self->fips_decrypt_key, fips_ivec);
 	self->sign_fips_info = ssl_hmac_info_create();
+	ssl_hmac_sha1_init(self->sign_fips_info, self->fips_sign_key, 20);
 }
 
 /****************************************************************************/
@@ -946,6 +938,20 @@ xrdp_sec_establish_keys(struct xrdp_sec *self) {
 			self->rc4_key_len);
 	ssl_rc4_set_key(self->encrypt_rc4_info, self->encrypt_key,
 			self->rc4_key_len);
+
+	/* the mac key prefix is the same for every pdu, hash it once */
+	if (self->sign_sha1_info == 0) {
+		self->sign_sha1_info = ssl_sha1_info_create();
+		self->sign_md5_info = ssl_md5_info_create();
+		self->sha1_info = ssl_sha1_info_create();
+		self->md5_info = ssl_md5_info_create();
+	}
+	ssl_sha1_clear(self->sign_sha1_info);
+	ssl_sha1_transform(self->sign_sha1_info, self->sign_key, self->rc4_key_len);
+	ssl_sha1_transform(self->sign_sha1_info, (char *) g_pad_54, 40);
+	ssl_md5_clear(self->sign_md5_info);
+	ssl_md5_transform(self->sign_md5_info, self->sign_key, self->rc4_key_len);
+	ssl_md5_transform(self->sign_md5_info, (char *) g_pad_92, 48);
 }
 
 /*****************************************************************************/
@@ -1151,7 +1157,7 @@ xrdp_sec_fips_sign(struct xrdp_sec *self, char *out, int out_len, char *data,
 	char lenhdr[4];
 
 	buf_out_uint32(lenhdr, self->encrypt_use_count);
-	ssl_hmac_sha1_init(self->sign_fips_info, self->fips_sign_key, 20);
+	ssl_hmac_sha1_reset(self->sign_fips_info);
 	ssl_hmac_transform(self->sign_fips_info, data, data_len);
 	ssl_hmac_transform(self->sign_fips_info, lenhdr, 4);
 	ssl_hmac_complete(self->sign_fips_info, buf, 20);
@@ -1159,33 +1165,41 @@ xrdp_sec_fips_sign(struct xrdp_sec *self, char *out, int out_len, char *data,
 }
 
 /*****************************************************************************/
-/* Generate a MAC hash (5.2.3.1), using a combination of SHA1 and MD5 */
+/* Generate a MAC hash (5.2.3.1), using a combination of SHA1 and MD5, and
+   RC4 encrypt data in place, both in one pass, each piece is hashed then
+   encrypted while it is still in cache */
 static void APP_CC
-xrdp_sec_sign(struct xrdp_sec *self, char *out, int out_len, char *data,
-		int data_len) {
+xrdp_sec_sign_encrypt(struct xrdp_sec *self, char *out, int out_len,
+		char *data, int data_len) {
 	char shasig[20];
 	char md5sig[16];
 	char lenhdr[4];
-	void *sha1_info;
-	void *md5_info;
+	int index;
+	int bytes;
+
+	LLOGLN(10, ("xrdp_sec_sign_encrypt:"));
+	if (self->encrypt_use_count == 4096) {
+		xrdp_sec_update(self->encrypt_key, self->encrypt_update_key,
+				self->rc4_key_len);
+		ssl_rc4_set_key(self->encrypt_rc4_info, self->encrypt_key,
+				self->rc4_key_len);
+		self->encrypt_use_count = 0;
+	}
 
 	buf_out_uint32(lenhdr, data_len);
-	sha1_info = ssl_sha1_info_create();
-	md5_info = ssl_md5_info_create();
-	ssl_sha1_clear(sha1_info);
-	ssl_sha1_transform(sha1_info, self->sign_key, self->rc4_key_len);
-	ssl_sha1_transform(sha1_info, (char *) g_pad_54, 40);
-	ssl_sha1_transform(sha1_info, lenhdr, 4);
-	ssl_sha1_transform(sha1_info, data, data_len);
-	ssl_sha1_complete(sha1_info, shasig);
-	ssl_md5_clear(md5_info);
-	ssl_md5_transform(md5_info, self->sign_key, self->rc4_key_len);
-	ssl_md5_transform(md5_info, (char *) g_pad_92, 48);
-	ssl_md5_transform(md5_info, shasig, 20);
-	ssl_md5_complete(md5_info, md5sig);
+	ssl_sha1_copy(self->sha1_info, self->sign_sha1_info);
+	ssl_sha1_transform(self->sha1_info, lenhdr, 4);
+	for (index = 0; index < data_len; index += bytes) {
+		bytes = MIN(data_len - index, XRDP_SEC_CRYPT_CHUNK);
+		ssl_sha1_transform(self->sha1_info, data + index, bytes);
+		ssl_rc4_crypt(self->encrypt_rc4_info, data + index, bytes);
+	}
+	ssl_sha1_complete(self->sha1_info, shasig);
+	ssl_md5_copy(self->md5_info, self->sign_md5_info);
+	ssl_md5_transform(self->md5_info, shasig, 20);
+	ssl_md5_complete(self->md5_info, md5sig);
 	g_memcpy(out, md5sig, out_len);
-	ssl_sha1_info_delete(sha1_info);
-	ssl_md5_info_delete(md5_info);
+	self->encrypt_use_count++;
 }
 
 /*****************************************************************************/
@@ -1215,8 +1229,7 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan) {
 		} else if (self->crypt_level > CRYPT_LEVEL_LOW) {
 			out_uint32_le(s, SEC_ENCRYPT);
 			datalen = (int) ((s->end - s->p) - 8);
-			xrdp_sec_sign(self, s->p, 8, s->p + 8, datalen);
-			xrdp_sec_encrypt(self, s->p + 8, datalen);
+			xrdp_sec_sign_encrypt(self, s->p, 8, s->p + 8, datalen);
 		} else {
 			out_uint32_le(s, 0);
 		}
@@ -1306,8 +1319,7 @@ xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s) {
 		out_uint8(s, fpOutputHeader);
 		pdulen |= 0x8000;
 		out_uint16_be(s, pdulen);
-		xrdp_sec_sign(self, s->p, 8, s->p + 8, datalen);
-		xrdp_sec_encrypt(self, s->p + 8, datalen);
+		xrdp_sec_sign_encrypt(self, s->p, 8, s->p + 8, datalen);
 		error = xrdp_fastpath_send(self->fastpath_layer, s);
 	} else {
 		LLOGLN(10, ("xrdp_sec_send_fastpath: no crypt"));
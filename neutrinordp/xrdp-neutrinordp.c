@@ -21,6 +21,7 @@
 #include "xrdp-color.h"
 #include "xrdp_rail.h"
 #include "log.h"
+#include "thread_calls.h"
 #include <freerdp/settings.h>
 #include <X11/Xlib.h>
 
@@ -536,6 +537,153 @@ lfreerdp_set_bounds(rdpContext *context, rdpBounds *bounds)
     }
 }
 
+/******************************************************************************/
+/* decompress a bitmap update rect and convert it to client bpp, called on
+   either thread, free the return with g_free */
+static char *APP_CC
+lfreerdp_decode_rect(struct mod *mod, BITMAP_DATA *bd, int server_bpp)
+{
+    int server_Bpp;
+    int j;
+    int line_bytes;
+    char *dst_data;
+    char *dst_data1;
+    char *src;
+    char *dst;
+
+    server_Bpp = (server_bpp + 7) / 8;
+    line_bytes = server_Bpp * bd->width;
+    dst_data = (char *)g_malloc(bd->height * line_bytes + 16, 0);
+
+    if (bd->compressed)
+    {
+        LLOGLN(20,("decompress size : %d",bd->bitmapLength));
+        if(!bitmap_decompress(bd->bitmapDataStream, (tui8 *)dst_data, bd->width,
+                          bd->height, bd->bitmapLength, server_bpp, server_bpp)){
+            LLOGLN(0,("Failure to decompress the bitmap"));
+        }
+    }
+    else
+    {
+        /* bitmap is upside down */
+        LLOGLN(10,("bitmap upside down"));
+        src = (char *)(bd->bitmapDataStream);
+        dst = dst_data + bd->height * line_bytes;
+
+        for (j = 0; j < bd->height; j++)
+        {
+            dst -= line_bytes;
+            g_memcpy(dst, src, line_bytes);
+            src += line_bytes;
+        }
+    }
+
+    dst_data1 = convert_bitmap(server_bpp, mod->bpp, dst_data,
+                               bd->width, bd->height, mod->colormap);
+
+    if (dst_data1 != dst_data)
+    {
+        g_free(dst_data);
+    }
+
+    return dst_data1;
+}
+
+/******************************************************************************/
+/* decodes the rects of each bitmap update in order, posting
+   decode_done_sem after each so they can be painted as they come */
+static THREAD_RV THREAD_CC
+lfreerdp_decode_thread(void *arg)
+{
+    struct mod *mod;
+    BITMAP_UPDATE *bitmap;
+    char **data;
+    int index;
+    int count;
+
+    mod = (struct mod *)arg;
+
+    while (1)
+    {
+        tc_sem_dec(mod->decode_start_sem);
+
+        if (mod->decode_term)
+        {
+            break;
+        }
+
+        /* none of this is valid once the last rect is posted */
+        bitmap = mod->decode_bitmap;
+        data = mod->decode_data;
+        count = bitmap->number;
+
+        for (index = 0; index < count; index++)
+        {
+            data[index] = lfreerdp_decode_rect(mod, bitmap->rectangles + index,
+                                               mod->decode_server_bpp);
+            tc_sem_inc(mod->decode_done_sem);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* returns error */
+static int APP_CC
+lfreerdp_decode_start(struct mod *mod)
+{
+    if (g_get_num_cpus() < 2)
+    {
+        /* nothing to run it beside */
+        mod->decode_state = -1;
+        return 1;
+    }
+
+    mod->decode_start_sem = tc_sem_create(0);
+    mod->decode_done_sem = tc_sem_create(0);
+    mod->decode_term = 0;
+
+    /* not tc_thread_create, that detaches and lfreerdp_decode_stop has to
+       know the thread is gone before mod is freed */
+    if (pthread_create(&(mod->decode_thread), 0, lfreerdp_decode_thread,
+                       mod) != 0)
+    {
+        LLOGLN(0, ("lfreerdp_decode_start: pthread_create failed"));
+        tc_sem_delete(mod->decode_start_sem);
+        tc_sem_delete(mod->decode_done_sem);
+        mod->decode_state = -1;
+        return 1;
+    }
+
+    mod->decode_state = 1;
+    return 0;
+}
+
+/******************************************************************************/
+static void APP_CC
+lfreerdp_decode_stop(struct mod *mod)
+{
+    if (mod->decode_updates > 0)
+    {
+        LLOGLN(0, ("lfreerdp_decode_stop: %d of %d bitmap updates decoded on "
+                   "the decode thread", mod->decode_threaded,
+                   mod->decode_updates));
+    }
+
+    if (mod->decode_state != 1)
+    {
+        return;
+    }
+
+    mod->decode_term = 1;
+    tc_sem_inc(mod->decode_start_sem);
+    pthread_join(mod->decode_thread, 0);
+    tc_sem_delete(mod->decode_start_sem);
+    tc_sem_delete(mod->decode_done_sem);
+    mod->decode_state = 0;
+}
+
 /******************************************************************************/
 static void DEFAULT_CC
 lfreerdp_bitmap_update(rdpContext *context, BITMAP_UPDATE *bitmap)
@@ -545,66 +693,61 @@ lfreerdp_bitmap_update(rdpContext *context, BITMAP_UPDATE *bitmap)
     int cx;
     int cy;
     int server_bpp;
-    int server_Bpp;
-    int client_bpp;
-    int j;
-    int line_bytes;
+    int threaded;
     BITMAP_DATA *bd;
     char *dst_data;
-    char *dst_data1;
-    char *src;
-    char *dst;
 
     mod = ((struct mod_context *)context)->modi;
     LLOGLN(10, ("lfreerdp_bitmap_update: %d %d", bitmap->number, bitmap->count));
 
     server_bpp = mod->inst->settings->color_depth;
-    server_Bpp = (server_bpp + 7) / 8;
-    client_bpp = mod->bpp;
+    mod->decode_updates++;
+
+    if ((bitmap->number > 1) && (mod->decode_state == 0))
+    {
+        lfreerdp_decode_start(mod);
+    }
+
+    /* with more than one rect, the next is decoded while this one is
+       painted */
+    threaded = (bitmap->number > 1) && (mod->decode_state == 1);
+
+    if (threaded)
+    {
+        mod->decode_threaded++;
+        mod->decode_bitmap = bitmap;
+        mod->decode_data = (char **)g_malloc(sizeof(char *) * bitmap->number, 1);
+        mod->decode_server_bpp = server_bpp;
+        tc_sem_inc(mod->decode_start_sem);
+    }
 
     for (index = 0; index < bitmap->number; index++)
     {
         bd = &bitmap->rectangles[index];
         cx = (bd->destRight - bd->destLeft) + 1;
         cy = (bd->destBottom - bd->destTop) + 1;
-        line_bytes = server_Bpp * bd->width;
-        dst_data = (char *)g_malloc(bd->height * line_bytes + 16, 0);
 
-        if (bd->compressed)
+        if (threaded)
         {
-            LLOGLN(20,("decompress size : %d",bd->bitmapLength));
-            if(!bitmap_decompress(bd->bitmapDataStream, (tui8 *)dst_data, bd->width,
-                              bd->height, bd->bitmapLength, server_bpp, server_bpp)){
-                LLOGLN(0,("Failure to decompress the bitmap"));
-            }
+            tc_sem_dec(mod->decode_done_sem);
+            dst_data = mod->decode_data[index];
         }
         else
         {
-            /* bitmap is upside down */
-            LLOGLN(10,("bitmap upside down"));
-            src = (char *)(bd->bitmapDataStream);
-            dst = dst_data + bd->height * line_bytes;
-
-            for (j = 0; j < bd->height; j++)
-            {
-                dst -= line_bytes;
-                g_memcpy(dst, src, line_bytes);
-                src += line_bytes;
-            }
+            dst_data = lfreerdp_decode_rect(mod, bd, server_bpp);
         }
 
-        dst_data1 = convert_bitmap(server_bpp, client_bpp, dst_data,
-                                   bd->width, bd->height, mod->colormap);
         mod->server_paint_rect(mod, bd->destLeft, bd->destTop, cx, cy,
-                               dst_data1, bd->width, bd->height, 0, 0);
-
-        if (dst_data1 != dst_data)
-        {
-            g_free(dst_data1);
-        }
-
+                               dst_data, bd->width, bd->height, 0, 0);
         g_free(dst_data);
     }
+
+    if (threaded)
+    {
+        g_free(mod->decode_data);
+        mod->decode_data = 0;
+        mod->decode_bitmap = 0;
+    }
 }
 
 /******************************************************************************/
@@ -1951,6 +2094,7 @@ mod_exit(struct mod *mod)
         return 0 ;
     }
 
+    lfreerdp_decode_stop(mod);
     freerdp_disconnect(mod->inst);
 
     if ((mod->vmaj == 1) && (mod->vmin == 0) && (mod->vrev == 1))
@@ -24,6 +24,7 @@
 #include "defines.h"
 #include "xrdp_rail.h"
 #include "xrdp_client_info.h"
+#include <pthread.h>
 
 /* this is the freerdp main header */
 #include <freerdp/freerdp.h>
@@ -183,4 +184,16 @@ struct mod
   struct brush_item brush_cache[64];
   struct pointer_item pointer_cache[32];
 
+  /* bitmap updates are decoded on their own thread while this one paints */
+  int decode_state; /* 0 not started, 1 running, -1 one cpu */
+  int decode_term;
+  pthread_t decode_thread; /* joined before mod is freed */
+  tbus decode_start_sem; /* one post per bitmap update */
+  tbus decode_done_sem; /* one post per rect decoded */
+  BITMAP_UPDATE* decode_bitmap;
+  char** decode_data; /* decoded rects, client bpp */
+  int decode_server_bpp;
+  int decode_updates;
+  int decode_threaded; /* updates that used the thread */
+
 };
@@ -53,6 +53,8 @@ struct rdp_bitmap
   int height;
   int bpp;
   char* data;
+  char* comp_data; /* as the server compressed it, if xrdp can take that */
+  int comp_bytes;
 };
 
 struct rdp_cursor
@@ -310,7 +312,12 @@ struct mod
                                 char* data, int data_len,
                                 int total_data_len, int flags);
   int (*server_bell_trigger)(struct mod* v);
-  long server_dumby[100 - 25]; /* align, 100 minus the number of server
+  long server_dumby1[43 - 25]; /* server functions this module does not use */
+  int (*server_paint_rect_comp)(struct mod* v, int x, int y, int cx, int cy,
+                                char* data, int width, int height,
+                                int srcx, int srcy,
+                                char* comp_data, int comp_bytes);
+  long server_dumby[100 - 44]; /* align, 100 minus the number of server
                                   functions above */
   /* common */
   long handle; /* pointer to self as long */
@@ -450,6 +457,8 @@ rdp_orders_reset_state(struct rdp_orders* self);
 int APP_CC
 rdp_orders_process_orders(struct rdp_orders* self, struct stream* s,
                           int num_orders);
+int APP_CC
+rdp_orders_can_pass_comp(struct mod* mod, int bpp, int width, int height);
 char* APP_CC
 rdp_orders_convert_bitmap(int in_bpp, int out_bpp, char* bmpdata,
                           int width, int height, int* palette);
@@ -23,316 +23,175 @@
 /******************************************************************************/
 #define CVAL(p) ((unsigned char)(*(p++)))
 
-#if defined(B_ENDIAN)
-#define EIK0 1
-#define EIK1 0
-#else
-#define EIK0 0
-#define EIK1 1
-#endif
-
-/******************************************************************************/
-#define REPEAT(statement) \
+/* return false unless the input has _bytes left, checked once per opcode
+   or run, not once per byte */
+#define IN_CHECK(_bytes) \
+    do \
     { \
-        while ((count > 0) && (x < width)) \
+        if ((end - input) < (_bytes)) \
         { \
-            statement; \
-            count--; \
-            x++; \
+            return 0; \
         } \
-    }
+    } \
+    while (0)
 
-/******************************************************************************/
-#define MASK_UPDATE \
-    { \
-        mixmask <<= 1; \
-        if ((mixmask & 0xff) == 0) \
-        { \
-            mask = fom_mask ? fom_mask : CVAL(input); \
-            mixmask = 1; \
-        } \
-    }
+/* runs of fewer bytes than this are written a byte at a time, a call to
+   g_memset or g_memcpy costs more than it saves on them */
+#define SHORT_RUN_BYTES 64
 
 /******************************************************************************/
-/* 1 byte bitmap decompress */
-/* returns boolean */
-static int APP_CC
-bitmap_decompress1(char *output, int width, int height, char *input, int size)
+/* one pixel from the wire, little endian, to host order */
+static void APP_CC
+bitmap_in_pixel(char **input, char *pixel, int Bpp)
 {
-    char *prevline;
-    char *line;
-    char *end;
-    char color1;
-    char color2;
-    char mix;
-    int code;
-    int mixmask;
-    int mask;
-    int opcode;
-    int count;
-    int offset;
-    int isfillormix;
-    int x;
-    int lastopcode;
-    int insertmix;
-    int bicolor;
-    int fom_mask;
+    char *p;
 
-    end = input + size;
-    prevline = 0;
-    line = 0;
-    x = width;
-    lastopcode = -1;
-    insertmix = 0;
-    bicolor = 0;
-    color1 = 0;
-    color2 = 0;
-    mix = 0xff;
-    mask = 0;
-    fom_mask = 0;
-
-    while (input < end)
+    p = *input;
+#if defined(B_ENDIAN)
+    if (Bpp == 2)
     {
-        fom_mask = 0;
-        code = CVAL(input);
-        opcode = code >> 4;
-
-        /* Handle different opcode forms */
-        switch (opcode)
-        {
-            case 0xc:
-            case 0xd:
-            case 0xe:
-                opcode -= 6;
-                count = code & 0xf;
-                offset = 16;
-                break;
-            case 0xf:
-                opcode = code & 0xf;
+        pixel[0] = p[1];
+        pixel[1] = p[0];
+        *input = p + 2;
+        return;
+    }
+#endif
+    pixel[0] = p[0];
 
-                if (opcode < 9)
-                {
-                    count = CVAL(input);
-                    count |= CVAL(input) << 8;
-                }
-                else
-                {
-                    count = (opcode < 0xb) ? 8 : 1;
-                }
+    if (Bpp > 1)
+    {
+        pixel[1] = p[1];
+    }
 
-                offset = 0;
-                break;
-            default:
-                opcode >>= 1;
-                count = code & 0x1f;
-                offset = 32;
-                break;
-        }
+    if (Bpp > 2)
+    {
+        pixel[2] = p[2];
+    }
 
-        /* Handle strange cases for counts */
-        if (offset != 0)
-        {
-            isfillormix = ((opcode == 2) || (opcode == 7));
+    *input = p + Bpp;
+}
 
-            if (count == 0)
-            {
-                if (isfillormix)
-                {
-                    count = CVAL(input) + 1;
-                }
-                else
-                {
-                    count = CVAL(input) + offset;
-                }
-            }
-            else if (isfillormix)
-            {
-                count <<= 3;
-            }
-        }
+/******************************************************************************/
+static void APP_CC
+bitmap_set_bytes(char *dst, int val, int bytes)
+{
+    int index;
 
-        /* Read preliminary data */
-        switch (opcode)
-        {
-            case 0: /* Fill */
+    if (bytes >= SHORT_RUN_BYTES)
+    {
+        g_memset(dst, val, bytes);
+        return;
+    }
 
-                if ((lastopcode == opcode) && !((x == width) && (prevline == 0)))
-                {
-                    insertmix = 1;
-                }
+    for (index = 0; index < bytes; index++)
+    {
+        dst[index] = val;
+    }
+}
 
-                break;
-            case 8: /* Bicolor */
-                color1 = CVAL(input);
-                /* fall through is intentional */
-            case 3: /* Color */
-                color2 = CVAL(input);
-                break;
-            case 6: /* SetMix/Mix */
-            case 7: /* SetMix/FillOrMix */
-                mix = CVAL(input);
-                opcode -= 5;
-                break;
-            case 9: /* FillOrMix_1 */
-                mask = 0x03;
-                opcode = 0x02;
-                fom_mask = 3;
-                break;
-            case 0x0a: /* FillOrMix_2 */
-                mask = 0x05;
-                opcode = 0x02;
-                fom_mask = 5;
-                break;
-        }
+/******************************************************************************/
+static void APP_CC
+bitmap_copy_bytes(char *dst, const char *src, int bytes)
+{
+    int index;
 
-        lastopcode = opcode;
-        mixmask = 0;
+    if (bytes >= SHORT_RUN_BYTES)
+    {
+        g_memcpy(dst, src, bytes);
+        return;
+    }
 
-        /* Output body */
-        while (count > 0)
-        {
-            if (x >= width)
-            {
-                if (height <= 0)
-                {
-                    return 0;
-                }
+    for (index = 0; index < bytes; index++)
+    {
+        dst[index] = src[index];
+    }
+}
 
-                x = 0;
-                height--;
-                prevline = line;
-                line = output + height * width;
-            }
+/******************************************************************************/
+/* num copies of pixel at dst, long runs double what is already written so
+   they are a few memcpys */
+static void APP_CC
+bitmap_fill_pixels(char *dst, const char *pixel, int num, int Bpp)
+{
+    int bytes;
+    int done;
+    int index;
 
-            switch (opcode)
-            {
-                case 0: /* Fill */
+    if (Bpp == 1)
+    {
+        bitmap_set_bytes(dst, (unsigned char)(pixel[0]), num);
+        return;
+    }
 
-                    if (insertmix)
-                    {
-                        if (prevline == 0)
-                        {
-                            line[x] = mix;
-                        }
-                        else
-                        {
-                            line[x] = prevline[x] ^ mix;
-                        }
+    bytes = num * Bpp;
 
-                        insertmix = 0;
-                        count--;
-                        x++;
-                    }
+    if (bytes < SHORT_RUN_BYTES)
+    {
+        for (index = 0; index < num; index++)
+        {
+            dst[0] = pixel[0];
+            dst[1] = pixel[1];
 
-                    if (prevline == 0)
-                    {
-                        REPEAT(line[x] = 0)
-                    }
-                    else
-                    {
-                        REPEAT(line[x] = prevline[x])
-                    }
+            if (Bpp == 3)
+            {
+                dst[2] = pixel[2];
+            }
 
-                    break;
-                case 1: /* Mix */
+            dst += Bpp;
+        }
 
-                    if (prevline == 0)
-                    {
-                        REPEAT(line[x] = mix)
-                    }
-                    else
-                    {
-                        REPEAT(line[x] = prevline[x] ^ mix)
-                    }
+        return;
+    }
 
-                    break;
-                case 2: /* Fill or Mix */
+    dst[0] = pixel[0];
+    dst[1] = pixel[1];
 
-                    if (prevline == 0)
-                    {
-                        REPEAT
-                        (
-                            MASK_UPDATE;
+    if (Bpp == 3)
+    {
+        dst[2] = pixel[2];
+    }
 
-                            if (mask & mixmask)
-                    {
-                        line[x] = mix;
-                        }
-                        else
-                        {
-                            line[x] = 0;
-                        }
-                        )
-                    }
-                    else
-                    {
-                        REPEAT
-                        (
-                            MASK_UPDATE;
+    done = Bpp;
 
-                            if (mask & mixmask)
-                    {
-                        line[x] = prevline[x] ^ mix;
-                        }
-                        else
-                        {
-                            line[x] = prevline[x];
-                        }
-                        )
-                    }
+    while (done < bytes)
+    {
+        index = MIN(done, bytes - done);
+        g_memcpy(dst + done, dst, index);
+        done += index;
+    }
+}
 
-                    break;
-                case 3: /* Color */
-                    REPEAT(line[x] = color2)
-                    break;
-                case 4: /* Copy */
-                    REPEAT(line[x] = CVAL(input))
-                    break;
-                case 8: /* Bicolor */
-                    REPEAT
-                    (
+/******************************************************************************/
+static void APP_CC
+bitmap_xor_bytes(char *dst, const char *src, int bytes)
+{
+    int index;
 
-                        if (bicolor)
-                {
-                    line[x] = color2;
-                        bicolor = 0;
-                    }
-                    else
-                    {
-                        line[x] = color1;
-                        bicolor = 1;
-                        count++;
-                    }
-                    )
-                    break;
-                case 0xd: /* White */
-                    REPEAT(line[x] = 0xff)
-                    break;
-                case 0xe: /* Black */
-                    REPEAT(line[x] = 0)
-                    break;
-                default:
-                    return 0;
-                    break;
-            }
-        }
+    for (index = 0; index < bytes; index++)
+    {
+        dst[index] ^= src[index];
     }
-
-    return 1;
 }
 
 /******************************************************************************/
-/* 2 byte bitmap decompress */
-/* returns boolean */
+/* interleaved rle, 1, 2 or 3 bytes per pixel, bottom up
+   each opcode's run is split where it crosses a row and each piece is one
+   fill, copy or xor over the row so the inner loops are memset, memcpy or
+   plain byte loops the compiler vectorizes
+   returns boolean, false for bad or short input */
 static int APP_CC
-bitmap_decompress2(char *output, int width, int height, char *input, int size)
+bitmap_decompress(char *output, int width, int height, char *input, int size,
+                  int Bpp)
 {
     char *prevline;
     char *line;
     char *end;
-    char color1[2];
-    char color2[2];
-    char mix[2];
+    char *dst;
+    char *prev;
+    char color1[4];
+    char color2[4];
+    char mix[4];
+    char white[4];
     int code;
     int mixmask;
     int mask;
@@ -341,24 +200,26 @@ bitmap_decompress2(char *output, int width, int height, char *input, int size)
     int offset;
     int isfillormix;
     int x;
+    int n;
+    int index;
+    int line_bytes;
     int lastopcode;
     int insertmix;
     int bicolor;
     int fom_mask;
 
     end = input + size;
+    line_bytes = width * Bpp;
     prevline = 0;
     line = 0;
     x = width;
     lastopcode = -1;
     insertmix = 0;
     bicolor = 0;
-    color1[0] = 0;
-    color1[1] = 0;
-    color2[0] = 0;
-    color2[1] = 0;
-    mix[0] = 0xff;
-    mix[1] = 0xff;
+    g_memset(color1, 0, sizeof(color1));
+    g_memset(color2, 0, sizeof(color2));
+    g_memset(mix, 0xff, sizeof(mix));
+    g_memset(white, 0xff, sizeof(white));
     mask = 0;
     fom_mask = 0;
 
@@ -383,6 +244,7 @@ bitmap_decompress2(char *output, int width, int height, char *input, int size)
 
                 if (opcode < 9)
                 {
+                    IN_CHECK(2);
                     count = CVAL(input);
                     count |= CVAL(input) << 8;
                 }
@@ -407,6 +269,8 @@ bitmap_decompress2(char *output, int width, int height, char *input, int size)
 
             if (count == 0)
             {
+                IN_CHECK(1);
+
                 if (isfillormix)
                 {
                     count = CVAL(input) + 1;
@@ -434,17 +298,17 @@ bitmap_decompress2(char *output, int width, int height, char *input, int size)
 
                 break;
             case 8: /* Bicolor */
-                color1[EIK0] = CVAL(input);
-                color1[EIK1] = CVAL(input);
+                IN_CHECK(Bpp * 2);
+                bitmap_in_pixel(&input, color1, Bpp);
                 /* fall through is intentional */
             case 3: /* Color */
-                color2[EIK0] = CVAL(input);
-                color2[EIK1] = CVAL(input);
+                IN_CHECK(Bpp);
+                bitmap_in_pixel(&input, color2, Bpp);
                 break;
             case 6: /* SetMix/Mix */
             case 7: /* SetMix/FillOrMix */
-                mix[EIK0] = CVAL(input);
-                mix[EIK1] = CVAL(input);
+                IN_CHECK(Bpp);
+                bitmap_in_pixel(&input, mix, Bpp);
                 opcode -= 5;
                 break;
             case 9: /* FillOrMix_1 */
@@ -462,7 +326,7 @@ bitmap_decompress2(char *output, int width, int height, char *input, int size)
         lastopcode = opcode;
         mixmask = 0;
 
-        /* Output body */
+        /* Output body, a row at a time */
         while (count > 0)
         {
             if (x >= width)
@@ -475,496 +339,156 @@ bitmap_decompress2(char *output, int width, int height, char *input, int size)
                 x = 0;
                 height--;
                 prevline = line;
-                line = output + height * (width * 2);
+                line = output + height * line_bytes;
             }
 
+            n = MIN(count, width - x);
+            dst = line + x * Bpp;
+            prev = (prevline == 0) ? 0 : prevline + x * Bpp;
+
             switch (opcode)
             {
                 case 0: /* Fill */
 
                     if (insertmix)
                     {
-                        if (prevline == 0)
-                        {
-                            line[x * 2 + 0] = mix[0];
-                            line[x * 2 + 1] = mix[1];
-                        }
-                        else
+                        bitmap_fill_pixels(dst, mix, 1, Bpp);
+
+                        if (prev != 0)
                         {
-                            line[x * 2 + 0] = prevline[x * 2 + 0] ^ mix[0];
-                            line[x * 2 + 1] = prevline[x * 2 + 1] ^ mix[1];
+                            bitmap_xor_bytes(dst, prev, Bpp);
+                            prev += Bpp;
                         }
 
                         insertmix = 0;
+                        dst += Bpp;
                         count--;
                         x++;
+                        n--;
                     }
 
-                    if (prevline == 0)
+                    if (prev == 0)
                     {
-                        REPEAT
-                        (
-                            line[x * 2 + 0] = 0;
-                            line[x * 2 + 1] = 0;
-                        )
+                        bitmap_set_bytes(dst, 0, n * Bpp);
                     }
                     else
                     {
-                        REPEAT
-                        (
-                            line[x * 2 + 0] = prevline[x * 2 + 0];
-                            line[x * 2 + 1] = prevline[x * 2 + 1];
-                        )
+                        bitmap_copy_bytes(dst, prev, n * Bpp);
                     }
 
                     break;
                 case 1: /* Mix */
+                    bitmap_fill_pixels(dst, mix, n, Bpp);
 
-                    if (prevline == 0)
-                    {
-                        REPEAT
-                        (
-                            line[x * 2 + 0] = mix[0];
-                            line[x * 2 + 1] = mix[1];
-                        )
-                    }
-                    else
+                    if (prev != 0)
                     {
-                        REPEAT
-                        (
-                            line[x * 2 + 0] = prevline[x * 2 + 0] ^ mix[0];
-                            line[x * 2 + 1] = prevline[x * 2 + 1] ^ mix[1];
-                        )
+                        bitmap_xor_bytes(dst, prev, n * Bpp);
                     }
 
                     break;
                 case 2: /* Fill or Mix */
 
-                    if (prevline == 0)
-                    {
-                        REPEAT
-                        (
-                            MASK_UPDATE;
-
-                            if (mask & mixmask)
+                    /* fill the run then mix in the pixels the mask says */
+                    if (prev == 0)
                     {
-                        line[x * 2 + 0] = mix[0];
-                            line[x * 2 + 1] = mix[1];
-                        }
-                        else
-                        {
-                            line[x * 2 + 0] = 0;
-                            line[x * 2 + 1] = 0;
-                        }
-                        )
+                        bitmap_set_bytes(dst, 0, n * Bpp);
                     }
                     else
                     {
-                        REPEAT
-                        (
-                            MASK_UPDATE;
+                        bitmap_copy_bytes(dst, prev, n * Bpp);
+                    }
 
-                            if (mask & mixmask)
+                    for (index = 0; index < n; index++)
                     {
-                        line[x * 2 + 0] = prevline[x * 2 + 0] ^ mix[0];
-                            line[x * 2 + 1] = prevline[x * 2 + 1] ^ mix[1];
+                        mixmask <<= 1;
+
+                        if ((mixmask & 0xff) == 0)
+                        {
+                            if (fom_mask == 0)
+                            {
+                                IN_CHECK(1);
+                                mask = CVAL(input);
+                            }
+                            else
+                            {
+                                mask = fom_mask;
+                            }
+
+                            mixmask = 1;
                         }
-                        else
+
+                        if (mask & mixmask)
                         {
-                            line[x * 2 + 0] = prevline[x * 2 + 0];
-                            line[x * 2 + 1] = prevline[x * 2 + 1];
+                            prev = dst + index * Bpp;
+                            prev[0] ^= mix[0];
+
+                            if (Bpp > 1)
+                            {
+                                prev[1] ^= mix[1];
+                            }
+
+                            if (Bpp > 2)
+                            {
+                                prev[2] ^= mix[2];
+                            }
                         }
-                        )
                     }
 
                     break;
                 case 3: /* Color */
-                    REPEAT
-                    (
-                        line[x * 2 + 0] = color2[0];
-                        line[x * 2 + 1] = color2[1];
-                    )
+                    bitmap_fill_pixels(dst, color2, n, Bpp);
                     break;
                 case 4: /* Copy */
-                    REPEAT
-                    (
-                        line[x * 2 + EIK0] = CVAL(input);
-                        line[x * 2 + EIK1] = CVAL(input);
-                    )
-                    break;
-                case 8: /* Bicolor */
-                    REPEAT
-                    (
-
-                        if (bicolor)
-                {
-                    line[x * 2 + 0] = color2[0];
-                        line[x * 2 + 1] = color2[1];
-                        bicolor = 0;
-                    }
-                    else
-                    {
-                        line[x * 2 + 0] = color1[0];
-                        line[x * 2 + 1] = color1[1];
-                        bicolor = 1;
-                        count++;
-                    }
-                    )
-                    break;
-                case 0xd: /* White */
-                    REPEAT
-                    (
-                        line[x * 2 + 0] = 0xff;
-                        line[x * 2 + 1] = 0xff;
-                    )
-                    break;
-                case 0xe: /* Black */
-                    REPEAT
-                    (
-                        line[x * 2 + 0] = 0;
-                        line[x * 2 + 1] = 0;
-                    )
-                    break;
-                default:
-                    return 0;
-                    break;
-            }
-        }
-    }
-
-    return 1;
-}
-
-/******************************************************************************/
-/* 3 byte bitmap decompress */
-/* returns boolean */
-static int APP_CC
-bitmap_decompress3(char *output, int width, int height, char *input, int size)
-{
-    char *prevline;
-    char *line;
-    char *end;
-    char color1[3];
-    char color2[3];
-    char mix[3];
-    int code;
-    int mixmask;
-    int mask;
-    int opcode;
-    int count;
-    int offset;
-    int isfillormix;
-    int x;
-    int lastopcode;
-    int insertmix;
-    int bicolor;
-    int fom_mask;
-
-    end = input + size;
-    prevline = 0;
-    line = 0;
-    x = width;
-    lastopcode = -1;
-    insertmix = 0;
-    bicolor = 0;
-    color1[0] = 0;
-    color1[1] = 0;
-    color1[2] = 0;
-    color2[0] = 0;
-    color2[1] = 0;
-    color2[2] = 0;
-    mix[0] = 0xff;
-    mix[1] = 0xff;
-    mix[2] = 0xff;
-    mask = 0;
-    fom_mask = 0;
-
-    while (input < end)
-    {
-        fom_mask = 0;
-        code = CVAL(input);
-        opcode = code >> 4;
-
-        /* Handle different opcode forms */
-        switch (opcode)
-        {
-            case 0xc:
-            case 0xd:
-            case 0xe:
-                opcode -= 6;
-                count = code & 0xf;
-                offset = 16;
-                break;
-            case 0xf:
-                opcode = code & 0xf;
-
-                if (opcode < 9)
-                {
-                    count = CVAL(input);
-                    count |= CVAL(input) << 8;
-                }
-                else
-                {
-                    count = (opcode < 0xb) ? 8 : 1;
-                }
-
-                offset = 0;
-                break;
-            default:
-                opcode >>= 1;
-                count = code & 0x1f;
-                offset = 32;
-                break;
-        }
-
-        /* Handle strange cases for counts */
-        if (offset != 0)
-        {
-            isfillormix = ((opcode == 2) || (opcode == 7));
-
-            if (count == 0)
-            {
-                if (isfillormix)
-                {
-                    count = CVAL(input) + 1;
-                }
-                else
-                {
-                    count = CVAL(input) + offset;
-                }
-            }
-            else if (isfillormix)
-            {
-                count <<= 3;
-            }
-        }
-
-        /* Read preliminary data */
-        switch (opcode)
-        {
-            case 0: /* Fill */
-
-                if ((lastopcode == opcode) && !((x == width) && (prevline == 0)))
-                {
-                    insertmix = 1;
-                }
-
-                break;
-            case 8: /* Bicolor */
-                color1[0] = CVAL(input);
-                color1[1] = CVAL(input);
-                color1[2] = CVAL(input);
-                /* fall through is intentional */
-            case 3: /* Color */
-                color2[0] = CVAL(input);
-                color2[1] = CVAL(input);
-                color2[2] = CVAL(input);
-                break;
-            case 6: /* SetMix/Mix */
-            case 7: /* SetMix/FillOrMix */
-                mix[0] = CVAL(input);
-                mix[1] = CVAL(input);
-                mix[2] = CVAL(input);
-                opcode -= 5;
-                break;
-            case 9: /* FillOrMix_1 */
-                mask = 0x03;
-                opcode = 0x02;
-                fom_mask = 3;
-                break;
-            case 0x0a: /* FillOrMix_2 */
-                mask = 0x05;
-                opcode = 0x02;
-                fom_mask = 5;
-                break;
-        }
-
-        lastopcode = opcode;
-        mixmask = 0;
-
-        /* Output body */
-        while (count > 0)
-        {
-            if (x >= width)
-            {
-                if (height <= 0)
-                {
-                    return 0;
-                }
-
-                x = 0;
-                height--;
-                prevline = line;
-                line = output + height * (width * 3);
-            }
-
-            switch (opcode)
-            {
-                case 0: /* Fill */
-
-                    if (insertmix)
+                    IN_CHECK(n * Bpp);
+#if defined(B_ENDIAN)
+                    if (Bpp == 2)
                     {
-                        if (prevline == 0)
+                        for (index = 0; index < n; index++)
                         {
-                            line[x * 3 + 0] = mix[0];
-                            line[x * 3 + 1] = mix[1];
-                            line[x * 3 + 2] = mix[2];
+                            bitmap_in_pixel(&input, dst + index * 2, 2);
                         }
-                        else
-                        {
-                            line[x * 3 + 0] = prevline[x * 3 + 0] ^ mix[0];
-                            line[x * 3 + 1] = prevline[x * 3 + 1] ^ mix[1];
-                            line[x * 3 + 2] = prevline[x * 3 + 2] ^ mix[2];
-                        }
-
-                        insertmix = 0;
-                        count--;
-                        x++;
-                    }
 
-                    if (prevline == 0)
-                    {
-                        REPEAT
-                        (
-                            line[x * 3 + 0] = 0;
-                            line[x * 3 + 1] = 0;
-                            line[x * 3 + 2] = 0;
-                        )
-                    }
-                    else
-                    {
-                        REPEAT
-                        (
-                            line[x * 3 + 0] = prevline[x * 3 + 0];
-                            line[x * 3 + 1] = prevline[x * 3 + 1];
-                            line[x * 3 + 2] = prevline[x * 3 + 2];
-                        )
+                        break;
                     }
-
-                    break;
-                case 1: /* Mix */
-
-                    if (prevline == 0)
-                    {
-                        REPEAT
-                        (
-                            line[x * 3 + 0] = mix[0];
-                            line[x * 3 + 1] = mix[1];
-                            line[x * 3 + 2] = mix[2];
-                        )
-                    }
-                    else
-                    {
-                        REPEAT
-                        (
-                            line[x * 3 + 0] = prevline[x * 3 + 0] ^ mix[0];
-                            line[x * 3 + 1] = prevline[x * 3 + 1] ^ mix[1];
-                            line[x * 3 + 2] = prevline[x * 3 + 2] ^ mix[2];
-                        )
-                    }
-
+#endif
+                    bitmap_copy_bytes(dst, input, n * Bpp);
+                    input += n * Bpp;
                     break;
-                case 2: /* Fill or Mix */
-
-                    if (prevline == 0)
-                    {
-                        REPEAT
-                        (
-                            MASK_UPDATE;
+                case 8: /* Bicolor */
 
-                            if (mask & mixmask)
+                    /* a color1 color2 pair is one count */
+                    while ((count > 0) && (x < width))
                     {
-                        line[x * 3 + 0] = mix[0];
-                            line[x * 3 + 1] = mix[1];
-                            line[x * 3 + 2] = mix[2];
-                        }
-                        else
+                        if (bicolor)
                         {
-                            line[x * 3 + 0] = 0;
-                            line[x * 3 + 1] = 0;
-                            line[x * 3 + 2] = 0;
-                        }
-                        )
-                    }
-                    else
-                    {
-                        REPEAT
-                        (
-                            MASK_UPDATE;
-
-                            if (mask & mixmask)
-                    {
-                        line[x * 3 + 0] = prevline[x * 3 + 0] ^ mix[0];
-                            line[x * 3 + 1] = prevline[x * 3 + 1] ^ mix[1];
-                            line[x * 3 + 2] = prevline[x * 3 + 2] ^ mix[2];
+                            bitmap_fill_pixels(line + x * Bpp, color2, 1, Bpp);
+                            bicolor = 0;
+                            count--;
                         }
                         else
                         {
-                            line[x * 3 + 0] = prevline[x * 3 + 0];
-                            line[x * 3 + 1] = prevline[x * 3 + 1];
-                            line[x * 3 + 2] = prevline[x * 3 + 2];
+                            bitmap_fill_pixels(line + x * Bpp, color1, 1, Bpp);
+                            bicolor = 1;
                         }
-                        )
-                    }
-
-                    break;
-                case 3: /* Color */
-                    REPEAT
-                    (
-                        line[x * 3 + 0] = color2[0];
-                        line[x * 3 + 1] = color2[1];
-                        line[x * 3 + 2] = color2[2];
-                    )
-                    break;
-                case 4: /* Copy */
-                    REPEAT
-                    (
-                        line[x * 3 + 0] = CVAL(input);
-                        line[x * 3 + 1] = CVAL(input);
-                        line[x * 3 + 2] = CVAL(input);
-                    )
-                    break;
-                case 8: /* Bicolor */
-                    REPEAT
-                    (
 
-                        if (bicolor)
-                {
-                    line[x * 3 + 0] = color2[0];
-                        line[x * 3 + 1] = color2[1];
-                        line[x * 3 + 2] = color2[2];
-                        bicolor = 0;
-                    }
-                    else
-                    {
-                        line[x * 3 + 0] = color1[0];
-                        line[x * 3 + 1] = color1[1];
-                        line[x * 3 + 2] = color1[2];
-                        bicolor = 1;
-                        count++;
+                        x++;
                     }
-                    )
+
+                    n = 0;
                     break;
                 case 0xd: /* White */
-                    REPEAT
-                    (
-                        line[x * 3 + 0] = 0xff;
-                        line[x * 3 + 1] = 0xff;
-                        line[x * 3 + 2] = 0xff;
-                    )
+                    bitmap_fill_pixels(dst, white, n, Bpp);
                     break;
                 case 0xe: /* Black */
-                    REPEAT
-                    (
-                        line[x * 3 + 0] = 0;
-                        line[x * 3 + 1] = 0;
-                        line[x * 3 + 2] = 0;
-                    )
+                    bitmap_set_bytes(dst, 0, n * Bpp);
                     break;
                 default:
                     return 0;
                     break;
             }
+
+            x += n;
+            count -= n;
         }
     }
 
@@ -977,23 +501,10 @@ int APP_CC
 rdp_bitmap_decompress(char *output, int width, int height, char *input,
                       int size, int Bpp)
 {
-    int rv;
-
-    switch (Bpp)
+    if ((Bpp < 1) || (Bpp > 3))
     {
-        case 1:
-            rv = bitmap_decompress1(output, width, height, input, size);
-            break;
-        case 2:
-            rv = bitmap_decompress2(output, width, height, input, size);
-            break;
-        case 3:
-            rv = bitmap_decompress3(output, width, height, input, size);
-            break;
-        default:
-            rv = 0;
-            break;
+        return 0;
     }
 
-    return rv;
+    return bitmap_decompress(output, width, height, input, size, Bpp);
 }
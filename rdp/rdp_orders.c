@@ -61,6 +61,7 @@ rdp_orders_delete(struct rdp_orders *self)
             if (self->cache_bitmap[i][j] != 0)
             {
                 g_free(self->cache_bitmap[i][j]->data);
+                g_free(self->cache_bitmap[i][j]->comp_data);
             }
 
             g_free(self->cache_bitmap[i][j]);
@@ -277,7 +278,7 @@ rdp_orders_process_raw_bmpcache(struct rdp_orders *self, struct stream *s,
         }
     }
 
-    bitmap = (struct rdp_bitmap *)g_malloc(sizeof(struct rdp_bitmap), 0);
+    bitmap = (struct rdp_bitmap *)g_malloc(sizeof(struct rdp_bitmap), 1);
     bitmap->width = width;
     bitmap->height = height;
     bitmap->bpp = bpp;
@@ -286,6 +287,7 @@ rdp_orders_process_raw_bmpcache(struct rdp_orders *self, struct stream *s,
     if (self->cache_bitmap[cache_id][cache_idx] != 0)
     {
         g_free(self->cache_bitmap[cache_id][cache_idx]->data);
+        g_free(self->cache_bitmap[cache_id][cache_idx]->comp_data);
     }
 
     g_free(self->cache_bitmap[cache_id][cache_idx]);
@@ -356,16 +358,24 @@ rdp_orders_process_bmpcache(struct rdp_orders *self, struct stream *s,
 
     in_uint8p(s, data, size);
     bmpdata = (char *)g_malloc(width * height * Bpp, 0);
+    bitmap = (struct rdp_bitmap *)g_malloc(sizeof(struct rdp_bitmap), 1);
 
     if (rdp_bitmap_decompress(bmpdata, width, height, data, size, Bpp))
     {
+        /* keep it compressed too so xrdp does not compress it again */
+        if (rdp_orders_can_pass_comp(self->rdp_layer->mod, bpp,
+                                     width, height))
+        {
+            bitmap->comp_data = (char *)g_malloc(size, 0);
+            g_memcpy(bitmap->comp_data, data, size);
+            bitmap->comp_bytes = size;
+        }
     }
     else
     {
         /* error */
     }
 
-    bitmap = (struct rdp_bitmap *)g_malloc(sizeof(struct rdp_bitmap), 0);
     bitmap->width = width;
     bitmap->height = height;
     bitmap->bpp = bpp;
@@ -374,6 +384,7 @@ rdp_orders_process_bmpcache(struct rdp_orders *self, struct stream *s,
     if (self->cache_bitmap[cache_id][cache_idx] != 0)
     {
         g_free(self->cache_bitmap[cache_id][cache_idx]->data);
+        g_free(self->cache_bitmap[cache_id][cache_idx]->comp_data);
     }
 
     g_free(self->cache_bitmap[cache_id][cache_idx]);
@@ -1229,16 +1240,29 @@ rdp_orders_process_memblt(struct rdp_orders *self, struct stream *s,
                                             bitmap->height,
                                             self->cache_colormap
                                             [self->state.memblt_color_table]->colors);
-        self->rdp_layer->mod->server_paint_rect(self->rdp_layer->mod,
-                                                self->state.memblt_x,
-                                                self->state.memblt_y,
-                                                self->state.memblt_cx,
-                                                self->state.memblt_cy,
-                                                bmpdata,
-                                                bitmap->width,
-                                                bitmap->height,
-                                                self->state.memblt_srcx,
-                                                self->state.memblt_srcy);
+        if (bitmap->comp_data != 0)
+        {
+            self->rdp_layer->mod->server_paint_rect_comp(
+                self->rdp_layer->mod,
+                self->state.memblt_x, self->state.memblt_y,
+                self->state.memblt_cx, self->state.memblt_cy,
+                bmpdata, bitmap->width, bitmap->height,
+                self->state.memblt_srcx, self->state.memblt_srcy,
+                bitmap->comp_data, bitmap->comp_bytes);
+        }
+        else
+        {
+            self->rdp_layer->mod->server_paint_rect(self->rdp_layer->mod,
+                                                    self->state.memblt_x,
+                                                    self->state.memblt_y,
+                                                    self->state.memblt_cx,
+                                                    self->state.memblt_cy,
+                                                    bmpdata,
+                                                    bitmap->width,
+                                                    bitmap->height,
+                                                    self->state.memblt_srcx,
+                                                    self->state.memblt_srcy);
+        }
         self->rdp_layer->mod->server_set_opcode(self->rdp_layer->mod, 0xcc);
 
         if (self->rdp_layer->rec_mode)
@@ -1434,6 +1458,31 @@ rdp_orders_process_orders(struct rdp_orders *self, struct stream *s,
     return 0;
 }
 
+/*****************************************************************************/
+/* true if a bitmap the server compressed can be given to xrdp as it is,
+   the same bpp on both sides and one xrdp bitmap cache tile */
+int APP_CC
+rdp_orders_can_pass_comp(struct mod *mod, int bpp, int width, int height)
+{
+    if (mod->server_paint_rect_comp == 0)
+    {
+        return 0;
+    }
+
+    if (bpp != mod->xrdp_bpp)
+    {
+        return 0;
+    }
+
+    /* rdp_orders_convert_bitmap has no 15 to 15 */
+    if ((bpp != 16) && (bpp != 24))
+    {
+        return 0;
+    }
+
+    return (width <= 64) && (height <= 64) && ((width % 4) == 0);
+}
+
 /*****************************************************************************/
 /* returns pointer, it might return bmpdata if the data dosen't need to
    be converted, else it mallocs it.  The calling function must free
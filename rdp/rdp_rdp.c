@@ -558,6 +558,7 @@ rdp_rdp_process_bitmap_updates(struct rdp_rdp *self, struct stream *s)
     int i = 0;
     int x = 0;
     int y = 0;
+    int ok = 0;
     char *data = NULL;
     char *bmpdata0 = NULL;
     char *bmpdata1 = NULL;
@@ -594,12 +595,24 @@ rdp_rdp_process_bitmap_updates(struct rdp_rdp *self, struct stream *s)
             }
 
             in_uint8p(s, data, size);
-            rdp_bitmap_decompress(bmpdata0, width, height, data, size, Bpp);
+            ok = rdp_bitmap_decompress(bmpdata0, width, height, data, size,
+                                       Bpp);
             bmpdata1 = rdp_orders_convert_bitmap(bpp, self->mod->xrdp_bpp,
                                                  bmpdata0, width, height,
                                                  self->colormap.colors);
-            self->mod->server_paint_rect(self->mod, left, top, cx, cy, bmpdata1,
-                                         width, height, 0, 0);
+
+            if (ok && rdp_orders_can_pass_comp(self->mod, bpp, width, height))
+            {
+                /* xrdp sends it on as it came */
+                self->mod->server_paint_rect_comp(self->mod, left, top, cx, cy,
+                                                  bmpdata1, width, height,
+                                                  0, 0, data, size);
+            }
+            else
+            {
+                self->mod->server_paint_rect(self->mod, left, top, cx, cy,
+                                             bmpdata1, width, height, 0, 0);
+            }
         }
         else /* not compressed */
         {
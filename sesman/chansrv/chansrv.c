@@ -221,6 +221,9 @@ g_is_term(void)
     return g_is_wait_obj_set(g_term_event);
 }
 
+static int APP_CC
+add_stream_to_chan_item(struct chan_item *chan_item, struct stream *s);
+
 /*****************************************************************************/
 /* add data to chan_item, on its way to the client */
 /* returns error */
@@ -228,12 +231,22 @@ static int APP_CC
 add_data_to_chan_item(struct chan_item *chan_item, char *data, int size)
 {
     struct stream *s;
-    struct chan_out_data *cod;
 
     make_stream(s);
     init_stream(s, size);
     g_memcpy(s->data, data, size);
     s->end = s->data + size;
+    return add_stream_to_chan_item(chan_item, s);
+}
+
+/*****************************************************************************/
+/* queue s on chan_item, s is freed once it is sent */
+/* returns error */
+static int APP_CC
+add_stream_to_chan_item(struct chan_item *chan_item, struct stream *s)
+{
+    struct chan_out_data *cod;
+
     cod = (struct chan_out_data *)g_malloc(sizeof(struct chan_out_data), 1);
     cod->s = s;
 
@@ -369,6 +382,42 @@ send_channel_data(int chan_id, char *data, int size)
     return 1;
 }
 
+/*****************************************************************************/
+/* like send_channel_data but takes ownership of s, data is from s->data to
+   s->end, this avoids a copy for large channel messages
+   returns error */
+int APP_CC
+send_channel_data_stream(int chan_id, struct stream *s)
+{
+    int index;
+
+    LOGM((LOG_LEVEL_DEBUG, "chansrv::send_channel_data_stream: size %d",
+          (int)(s->end - s->data)));
+
+    if (chan_id == -1)
+    {
+        g_writeln("send_channel_data_stream: error, chan_id is -1");
+        free_stream(s);
+        return 1;
+    }
+
+    for (index = 0; index < g_num_chan_items; index++)
+    {
+        if (g_chan_items[index].id == chan_id)
+        {
+            /* total length sent with each fragment comes from s->size */
+            s->p = s->data;
+            s->size = (int)(s->end - s->data);
+            add_stream_to_chan_item(g_chan_items + index, s);
+            check_chan_items();
+            return 0;
+        }
+    }
+
+    free_stream(s);
+    return 1;
+}
+
 /*****************************************************************************/
 /* returns error */
 int APP_CC
@@ -58,6 +58,7 @@ int DEFAULT_CC
 g_is_term(void);
 
 int APP_CC send_channel_data(int chan_id, char *data, int size);
+int APP_CC send_channel_data_stream(int chan_id, struct stream *s);
 int APP_CC send_rail_drawing_orders(char* data, int size);
 int APP_CC main_cleanup(void);
 int APP_CC add_timeout(int msoffset, void (*callback)(void* data), void* data);
@@ -215,16 +215,51 @@ struct xfuse_handle
 };
 typedef struct xfuse_handle XFUSE_HANDLE;
 
-/* used for file data request sent to client */
+/* a FUSE read on a .clipboard file waiting for data from the client */
 struct req_list_item
 {
     fuse_req_t req;
-    int stream_id;
     int lindex;
     int off;
     int size;
 };
 
+/* clipboard file data is fetched from the client in fixed size chunks,
+ * several FileContentsRequest PDUs can be outstanding at a time, each with
+ * its own stream id, and the responses are assembled in a spool file so
+ * reads that hit already fetched data are served locally */
+#define CLIP_CHUNK_SIZE         (64 * 1024)
+#define CLIP_MAX_OUTSTANDING    8  /* range requests in flight            */
+#define CLIP_PREFETCH_CHUNKS    16 /* read ahead past the last FUSE read  */
+
+#define CLIP_CHUNK_NONE         0
+#define CLIP_CHUNK_PENDING      1
+#define CLIP_CHUNK_DONE         2
+#define CLIP_CHUNK_FAILED       3  /* waiting reads get EIO, then NONE    */
+
+/* local copy of a clipboard file */
+struct clip_spool
+{
+    int   lindex;
+    int   size;
+    int   fd;
+    int   num_chunks;
+    int   chunks_done;
+    int   next_prefetch;           /* next chunk to read ahead            */
+    int   prefetch_end;            /* read ahead stops before this chunk  */
+    char *chunk_state;             /* one of CLIP_CHUNK_* per chunk       */
+    char  filename[256];
+    int   start_time;              /* for throughput logging              */
+};
+
+/* range request sent to client */
+struct clip_range_req
+{
+    int stream_id;
+    int lindex;
+    int chunk;
+};
+
 struct dir_info
 {
     /* last index accessed in g_xrdp_fs.inode_table[] */
@@ -241,7 +276,10 @@ struct opendir_req
 
 FIFO g_fifo_opendir;
 
-static struct list *g_req_list = 0;
+static struct list *g_req_list = 0;           /* struct req_list_item    */
+static struct list *g_clip_range_list = 0;    /* struct clip_range_req   */
+static struct list *g_clip_spool_list = 0;    /* struct clip_spool       */
+static int g_clip_next_stream_id = 1;
 static struct xrdp_fs g_xrdp_fs;             /* an inst of xrdp file system */
 static char *g_mount_point = 0;              /* our FUSE mount point        */
 static struct fuse_lowlevel_ops g_xfuse_ops; /* setup FUSE callbacks        */
@@ -285,6 +323,11 @@ static void xfuse_update_xrdpfs_size();
 static void xfuse_enum_dir(fuse_req_t req, fuse_ino_t ino, size_t size,
                            off_t off, struct fuse_file_info *fi);
 
+static struct clip_spool * xfuse_clip_get_spool(int lindex, int size);
+static void xfuse_clip_delete_spools(void);
+static int  xfuse_clip_try_reply(struct req_list_item *rli);
+static void xfuse_clip_send_requests(void);
+
 /* forward declarations for calls we make into devredir */
 int dev_redir_get_dir_listing(void *fusep, tui32 device_id, char *path);
 
@@ -526,12 +569,26 @@ xfuse_deinit(void)
         g_buffer = 0;
     }
 
+    xfuse_clip_delete_spools();
+
     if (g_req_list != 0)
     {
         list_delete(g_req_list);
         g_req_list = 0;
     }
 
+    if (g_clip_range_list != 0)
+    {
+        list_delete(g_clip_range_list);
+        g_clip_range_list = 0;
+    }
+
+    if (g_clip_spool_list != 0)
+    {
+        list_delete(g_clip_spool_list);
+        g_clip_spool_list = 0;
+    }
+
     g_xfuse_inited = 0;
     return 0;
 }
@@ -693,6 +750,9 @@ int xfuse_clear_clip_dir(void)
 
     log_debug("entered");
 
+    /* the client's file list changed, cached data is no longer valid */
+    xfuse_clip_delete_spools();
+
     /* xinode for .clipboard */
     xip = g_xrdp_fs.inode_table[2];
 
@@ -720,40 +780,96 @@ int xfuse_clear_clip_dir(void)
 
 int xfuse_file_contents_range(int stream_id, char *data, int data_bytes)
 {
-    log_debug("entered: stream_id=%d data_bytes=%d", stream_id, data_bytes);
+    struct clip_range_req *crr;
+    struct req_list_item  *rli;
+    struct clip_spool     *spool;
+    int                    index;
+    int                    chunk_bytes;
+    int                    chunk;
 
-    struct req_list_item *rli;
+    log_debug("entered: stream_id=%d data_bytes=%d", stream_id, data_bytes);
 
-    if ((rli = (struct req_list_item *) list_get_item(g_req_list, 0)) == NULL)
+    crr = NULL;
+    for (index = 0; index < g_clip_range_list->count; index++)
     {
-        log_error("range error!");
-        return -1;
+        crr = (struct clip_range_req *)
+              list_get_item(g_clip_range_list, index);
+        if (crr->stream_id == stream_id)
+        {
+            break;
+        }
+        crr = NULL;
     }
 
-    log_debug("lindex=%d off=%d size=%d", rli->lindex, rli->off, rli->size);
-
-    fuse_reply_buf(rli->req, data, data_bytes);
-
-    list_remove_item(g_req_list, 0);
-    if (g_req_list->count <= 0)
+    if (crr == NULL)
     {
-        log_debug("completed all requests");
+        /* can happen when the clipboard changed while requests were
+           outstanding */
+        log_debug("no request for stream_id %d, ignoring", stream_id);
         return 0;
     }
 
-    /* send next request */
-    rli = (struct req_list_item *) list_get_item(g_req_list, 0);
-    if (rli == NULL)
+    chunk = crr->chunk;
+    spool = xfuse_clip_get_spool(crr->lindex, -1);
+    if (spool != NULL)
     {
-        log_error("range error!");
-        return -1;
+        log_debug("lindex=%d chunk=%d", crr->lindex, chunk);
+
+        /* a failed response comes here with no data, a short one is a
+           failure too, the chunk is never marked done without all of it */
+        chunk_bytes = min(CLIP_CHUNK_SIZE,
+                          spool->size - chunk * CLIP_CHUNK_SIZE);
+        if (data_bytes < chunk_bytes)
+        {
+            log_error("lindex %d chunk %d: got %d bytes, wanted %d",
+                      crr->lindex, chunk, data_bytes, chunk_bytes);
+            spool->chunk_state[chunk] = CLIP_CHUNK_FAILED;
+        }
+        else
+        {
+            g_file_seek(spool->fd, chunk * CLIP_CHUNK_SIZE);
+            if (g_file_write(spool->fd, data, chunk_bytes) != chunk_bytes)
+            {
+                log_error("error writing to spool file %s", spool->filename);
+                spool->chunk_state[chunk] = CLIP_CHUNK_FAILED;
+            }
+            else
+            {
+                spool->chunk_state[chunk] = CLIP_CHUNK_DONE;
+                spool->chunks_done++;
+            }
+        }
+        if (spool->chunks_done == spool->num_chunks)
+        {
+            log_info("lindex %d: %d bytes fetched in %d ms", spool->lindex,
+                     spool->size, g_time3() - spool->start_time);
+        }
     }
+    list_remove_item(g_clip_range_list, index);
 
-    log_debug("requesting clipboard file data");
+    /* reply to all FUSE reads that are now complete */
+    index = 0;
+    while (index < g_req_list->count)
+    {
+        rli = (struct req_list_item *) list_get_item(g_req_list, index);
+        if (xfuse_clip_try_reply(rli))
+        {
+            list_remove_item(g_req_list, index);
+        }
+        else
+        {
+            index++;
+        }
+    }
 
-    clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                    rli->off, rli->size);
+    /* the reads waiting on a failed chunk have had EIO, a later read
+       asks for it again */
+    if ((spool != NULL) && (spool->chunk_state[chunk] == CLIP_CHUNK_FAILED))
+    {
+        spool->chunk_state[chunk] = CLIP_CHUNK_NONE;
+    }
 
+    xfuse_clip_send_requests();
     return 0;
 }
 
@@ -842,6 +958,11 @@ static int xfuse_init_lib(struct fuse_args *args)
     g_req_list = list_create();
     g_req_list->auto_free = 1;
 
+    g_clip_range_list = list_create();
+    g_clip_range_list->auto_free = 1;
+
+    g_clip_spool_list = list_create();
+
     return 0;
 }
 
@@ -1417,6 +1538,222 @@ static void xfuse_update_xrdpfs_size()
     g_xrdp_fs.inode_table = vp;
 }
 
+/**
+ * Get the spool for a clipboard file, create it if size is not -1
+ *
+ * @return spool on success, NULL on failure
+ *****************************************************************************/
+
+static struct clip_spool * xfuse_clip_get_spool(int lindex, int size)
+{
+    struct clip_spool *spool;
+    int                index;
+
+    for (index = 0; index < g_clip_spool_list->count; index++)
+    {
+        spool = (struct clip_spool *) list_get_item(g_clip_spool_list, index);
+        if (spool->lindex == lindex)
+        {
+            return spool;
+        }
+    }
+
+    if (size < 0)
+    {
+        return NULL;
+    }
+
+    spool = (struct clip_spool *) g_malloc(sizeof(struct clip_spool), 1);
+    spool->lindex = lindex;
+    spool->size = size;
+    spool->num_chunks = (size + CLIP_CHUNK_SIZE - 1) / CLIP_CHUNK_SIZE;
+    spool->chunk_state = (char *) g_malloc(spool->num_chunks + 1, 1);
+    spool->start_time = g_time3();
+    /* unique name, created 0600, and unlinked at once so nothing else
+       can open it, the fd is all that is used */
+    g_snprintf(spool->filename, 255, "/tmp/.xrdp/xrdp_clip_spool_XXXXXX");
+    spool->fd = mkstemp(spool->filename);
+    if (spool->fd < 0)
+    {
+        log_error("failed to create spool file %s", spool->filename);
+        g_free(spool->chunk_state);
+        g_free(spool);
+        return NULL;
+    }
+    g_file_delete(spool->filename);
+    list_add_item(g_clip_spool_list, (tbus) spool);
+    return spool;
+}
+
+/**
+ * Remove all spool files, fail any reads waiting for them
+ *****************************************************************************/
+
+static void xfuse_clip_delete_spools(void)
+{
+    struct clip_spool     *spool;
+    struct req_list_item  *rli;
+    int                    index;
+
+    if (g_req_list != 0)
+    {
+        for (index = 0; index < g_req_list->count; index++)
+        {
+            rli = (struct req_list_item *) list_get_item(g_req_list, index);
+            fuse_reply_err(rli->req, EIO);
+        }
+        list_clear(g_req_list);
+    }
+
+    /* responses to these will be ignored */
+    if (g_clip_range_list != 0)
+    {
+        list_clear(g_clip_range_list);
+    }
+
+    if (g_clip_spool_list != 0)
+    {
+        for (index = 0; index < g_clip_spool_list->count; index++)
+        {
+            spool = (struct clip_spool *)
+                    list_get_item(g_clip_spool_list, index);
+            g_file_close(spool->fd);
+            g_free(spool->chunk_state);
+            g_free(spool);
+        }
+        list_clear(g_clip_spool_list);
+    }
+}
+
+/**
+ * Reply to a FUSE read from the spool if all the data is there
+ *
+ * @return 1 if the read was replied to, 0 if still waiting for data
+ *****************************************************************************/
+
+static int xfuse_clip_try_reply(struct req_list_item *rli)
+{
+    struct clip_spool *spool;
+    char              *buf;
+    int                chunk;
+    int                bytes;
+
+    spool = xfuse_clip_get_spool(rli->lindex, -1);
+    if (spool == NULL)
+    {
+        fuse_reply_err(rli->req, EIO);
+        return 1;
+    }
+
+    bytes = min(rli->size, spool->size - rli->off);
+    if (bytes <= 0)
+    {
+        fuse_reply_buf(rli->req, 0, 0);
+        return 1;
+    }
+
+    for (chunk = rli->off / CLIP_CHUNK_SIZE;
+         chunk <= (rli->off + bytes - 1) / CLIP_CHUNK_SIZE; chunk++)
+    {
+        if (spool->chunk_state[chunk] == CLIP_CHUNK_FAILED)
+        {
+            fuse_reply_err(rli->req, EIO);
+            return 1;
+        }
+        if (spool->chunk_state[chunk] != CLIP_CHUNK_DONE)
+        {
+            return 0;
+        }
+    }
+
+    buf = (char *) g_malloc(bytes, 0);
+    g_file_seek(spool->fd, rli->off);
+    bytes = g_file_read(spool->fd, buf, bytes);
+    fuse_reply_buf(rli->req, buf, bytes > 0 ? bytes : 0);
+    g_free(buf);
+    return 1;
+}
+
+/**
+ * Send a FileContentsRequest for one chunk of a clipboard file
+ *****************************************************************************/
+
+static void xfuse_clip_request_chunk(struct clip_spool *spool, int chunk)
+{
+    struct clip_range_req *crr;
+    int                    bytes;
+
+    crr = (struct clip_range_req *) g_malloc(sizeof(struct clip_range_req), 1);
+    crr->stream_id = g_clip_next_stream_id++;
+    crr->lindex = spool->lindex;
+    crr->chunk = chunk;
+    list_add_item(g_clip_range_list, (tbus) crr);
+    spool->chunk_state[chunk] = CLIP_CHUNK_PENDING;
+
+    bytes = min(CLIP_CHUNK_SIZE, spool->size - chunk * CLIP_CHUNK_SIZE);
+
+    log_debug("requesting clipboard file data stream_id = %d lindex = %d "
+              "off = %d size = %d", crr->stream_id, crr->lindex,
+              chunk * CLIP_CHUNK_SIZE, bytes);
+
+    clipboard_request_file_data(crr->stream_id, crr->lindex,
+                                chunk * CLIP_CHUNK_SIZE, bytes);
+}
+
+/**
+ * Fill the window of outstanding range requests, chunks needed by
+ * waiting FUSE reads go first, then sequential read ahead
+ *****************************************************************************/
+
+static void xfuse_clip_send_requests(void)
+{
+    struct req_list_item *rli;
+    struct clip_spool    *spool;
+    int                   index;
+    int                   chunk;
+    int                   last_chunk;
+
+    for (index = 0; index < g_req_list->count; index++)
+    {
+        rli = (struct req_list_item *) list_get_item(g_req_list, index);
+        spool = xfuse_clip_get_spool(rli->lindex, -1);
+        if (spool == NULL)
+        {
+            continue;
+        }
+        last_chunk = min(spool->num_chunks - 1,
+                         (rli->off + rli->size - 1) / CLIP_CHUNK_SIZE);
+        for (chunk = rli->off / CLIP_CHUNK_SIZE; chunk <= last_chunk; chunk++)
+        {
+            if (g_clip_range_list->count >= CLIP_MAX_OUTSTANDING)
+            {
+                return;
+            }
+            if (spool->chunk_state[chunk] == CLIP_CHUNK_NONE)
+            {
+                xfuse_clip_request_chunk(spool, chunk);
+            }
+        }
+    }
+
+    for (index = 0; index < g_clip_spool_list->count; index++)
+    {
+        spool = (struct clip_spool *) list_get_item(g_clip_spool_list, index);
+        while (spool->next_prefetch < spool->prefetch_end)
+        {
+            if (g_clip_range_list->count >= CLIP_MAX_OUTSTANDING)
+            {
+                return;
+            }
+            if (spool->chunk_state[spool->next_prefetch] == CLIP_CHUNK_NONE)
+            {
+                xfuse_clip_request_chunk(spool, spool->next_prefetch);
+            }
+            spool->next_prefetch++;
+        }
+    }
+}
+
 /******************************************************************************
 **                                                                           **
 **                         callbacks for devredir                            **
@@ -2653,6 +2990,7 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
     XFUSE_INFO            *fusep;
     XRDP_INODE            *xinode;
     struct req_list_item  *rli;
+    struct clip_spool     *spool;
     long                   handle;
 
     log_debug("want_bytes %ld bytes at off %ld", size, off);
@@ -2679,25 +3017,38 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
             return;
         }
 
+        spool = xfuse_clip_get_spool(xinode->lindex, xinode->size);
+        if (spool == NULL)
+        {
+            fuse_reply_err(req, EIO);
+            return;
+        }
+
         rli = (struct req_list_item *)
                 g_malloc(sizeof(struct req_list_item), 1);
 
-        rli->stream_id = 0;
         rli->req = req;
         rli->lindex = xinode->lindex;
         rli->off = off;
         rli->size = size;
-        list_add_item(g_req_list, (tbus) rli);
 
-        if (g_req_list->count == 1)
+        if (xfuse_clip_try_reply(rli))
         {
-            log_debug("requesting clipboard file data lindex = %d off = %d size = %d",
-                      rli->lindex, (int) off, (int) size);
-
-            clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                        (int) off, (int) size);
+            g_free(rli);
+            return;
         }
 
+        list_add_item(g_req_list, (tbus) rli);
+
+        /* read ahead up to CLIP_PREFETCH_CHUNKS past this read */
+        if (spool->next_prefetch < off / CLIP_CHUNK_SIZE)
+        {
+            spool->next_prefetch = off / CLIP_CHUNK_SIZE;
+        }
+        spool->prefetch_end = min(spool->num_chunks,
+                                  (off + size - 1) / CLIP_CHUNK_SIZE + 1 +
+                                  CLIP_PREFETCH_CHUNKS);
+        xfuse_clip_send_requests();
         return;
     }
 
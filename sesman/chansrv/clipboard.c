@@ -259,6 +259,10 @@ static XSelectionRequestEvent g_saved_selection_req_event;
 /* xserver maximum request size in bytes */
 static int g_incr_max_req_size = 0;
 
+/* starting size of the buffers used when streaming clipboard data, they
+   only grow when the other side is not keeping up */
+#define CLIP_STREAM_BUF_SIZE (256 * 1024)
+
 /* server to client, pasting from linux app to mstsc */
 struct clip_s2c g_clip_s2c;
 /* client to server, pasting from mstsc to linux app */
@@ -520,6 +524,8 @@ clipboard_deinit(void)
     g_clip_c2s.data = 0;
     g_free(g_clip_s2c.data);
     g_clip_s2c.data = 0;
+    free_stream(g_clip_s2c.incr_s);
+    g_clip_s2c.incr_s = 0;
 
     free_stream(g_ins);
     g_ins = 0;
@@ -645,6 +651,124 @@ clipboard_in_unicode(struct stream *s, char *text, int *num_chars)
     return index * 2;
 }
 
+/*****************************************************************************/
+/* make room for bytes more at s->p, grows by doubling so building a large
+   message out of many small pieces is not quadratic
+   returns error */
+static int APP_CC
+clipboard_stream_reserve(struct stream *s, int bytes)
+{
+    char *data;
+    int used;
+    int size;
+
+    used = (int)(s->p - s->data);
+    if (used + bytes <= s->size)
+    {
+        return 0;
+    }
+    size = s->size * 2;
+    if (size < used + bytes)
+    {
+        size = used + bytes;
+    }
+    data = (char *) g_malloc(size, 0);
+    if (data == 0)
+    {
+        return 1;
+    }
+    g_memcpy(data, s->data, used);
+    /* the length is written through channel_hdr once the data is in */
+    if (s->channel_hdr != 0)
+    {
+        s->channel_hdr = data + (s->channel_hdr - s->data);
+    }
+    g_free(s->data);
+    s->data = data;
+    s->p = data + used;
+    s->size = size;
+    return 0;
+}
+
+/*****************************************************************************/
+/* write UTF-8, or Latin-1 if latin1 is set, text as UTF-16LE, a UTF-8
+   sequence split across calls is kept in code and left, s must have room
+   for bytes * 2 + 4
+   returns number of bytes written */
+static int APP_CC
+clipboard_out_utf16_part(struct stream *s, const char *text, int bytes,
+                         int latin1, int *code, int *left)
+{
+    char *holdp;
+    int index;
+    int chr;
+    int lcode;
+
+    holdp = s->p;
+    for (index = 0; index < bytes; index++)
+    {
+        chr = (tui8)(text[index]);
+        if (*left > 0)
+        {
+            if ((chr & 0xc0) == 0x80)
+            {
+                *code = (*code << 6) | (chr & 0x3f);
+                *left -= 1;
+                if (*left > 0)
+                {
+                    continue;
+                }
+                lcode = *code;
+                if (lcode > 0x10ffff)
+                {
+                    out_uint16_le(s, 0xfffd);
+                }
+                else if (lcode > 0xffff)
+                {
+                    lcode -= 0x10000;
+                    out_uint16_le(s, 0xd800 | (lcode >> 10));
+                    out_uint16_le(s, 0xdc00 | (lcode & 0x3ff));
+                }
+                else
+                {
+                    out_uint16_le(s, lcode);
+                }
+                continue;
+            }
+            /* broken sequence, drop it */
+            *left = 0;
+        }
+        if (chr == 0)
+        {
+            continue;
+        }
+        if ((chr < 0x80) || latin1)
+        {
+            out_uint16_le(s, chr);
+        }
+        else if ((chr & 0xe0) == 0xc0)
+        {
+            *code = chr & 0x1f;
+            *left = 1;
+        }
+        else if ((chr & 0xf0) == 0xe0)
+        {
+            *code = chr & 0x0f;
+            *left = 2;
+        }
+        else if ((chr & 0xf8) == 0xf0)
+        {
+            *code = chr & 0x07;
+            *left = 3;
+        }
+        else
+        {
+            out_uint16_le(s, 0xfffd);
+        }
+    }
+    return (int)(s->p - holdp);
+}
+
 static char windows_native_format[] =
 {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -793,8 +917,9 @@ clipboard_send_data_response_for_image(char* data, int data_size)
     out_uint32_le(s, 0);
     s_mark_end(s);
     size = (int)(s->end - s->data);
-    rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
-    free_stream(s);
+    log_debug("clipboard_send_data_response_for_image: size %d", size);
+    /* s is freed by chansrv once sent */
+    rv = send_channel_data_stream(g_cliprdr_chan_id, s);
     return rv;
 }
 
@@ -805,40 +930,146 @@ clipboard_send_data_response_for_text(char* data, int data_size)
     struct stream *s;
     int size;
     int rv;
-    int num_chars;
+    int code;
+    int left;
 
     log_debug("clipboard_send_data_response_for_text: data_size %d",
                  data_size);
     //g_hexdump(data, data_size);
-    num_chars = g_mbstowcs(0, data, 0);
-    if (num_chars < 0)
+    make_stream(s);
+    init_stream(s, 64 + data_size * 2);
+    out_uint16_le(s, CB_FORMAT_DATA_RESPONSE); /* 5 CLIPRDR_DATA_RESPONSE */
+    out_uint16_le(s, CB_RESPONSE_OK); /* 1 status */
+    s_push_layer(s, channel_hdr, 4); /* length, set below */
+    code = 0;
+    left = 0;
+    clipboard_out_utf16_part(s, data, data_size, 0, &code, &left);
+    out_uint16_le(s, 0); /* nil for string */
+    size = (int)(s->p - s->channel_hdr) - 4;
+    out_uint32_le(s, 0);
+    s_mark_end(s);
+    s->p = s->channel_hdr;
+    out_uint32_le(s, size); /* length */
+    log_debug("clipboard_send_data_response_for_text: data out, "
+          "sending CLIPRDR_DATA_RESPONSE (clip_msg_id = 5) length %d",
+          size);
+    /* s is freed by chansrv once sent */
+    rv = send_channel_data_stream(g_cliprdr_chan_id, s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* the INCR transfer from the X app is starting, the UTF-16 or DIB data is
+   put in the CLIPRDR_DATA_RESPONSE as each piece comes in so there is no
+   separate copy of the whole X data
+   returns error */
+static int APP_CC
+clipboard_s2c_incr_start(int size_hint)
+{
+    struct stream *s;
+    int size;
+
+    free_stream(g_clip_s2c.incr_s);
+    size = CLIP_STREAM_BUF_SIZE;
+    if ((size_hint > size) && (size_hint < 64 * 1024 * 1024))
     {
-        log_error("clipboard_send_data_response_for_text: "
-             "bad string");
-        num_chars = 0;
+        size = size_hint;
+        if (g_clip_s2c.type != g_image_bmp_atom)
+        {
+            size *= 2;
+        }
     }
-    log_debug("clipboard_send_data_response_for_text: data_size %d "
-                "num_chars %d", data_size, num_chars);
     make_stream(s);
-    init_stream(s, 64 + num_chars * 2);
+    init_stream(s, size + 64);
     out_uint16_le(s, CB_FORMAT_DATA_RESPONSE); /* 5 CLIPRDR_DATA_RESPONSE */
     out_uint16_le(s, CB_RESPONSE_OK); /* 1 status */
-    out_uint32_le(s, num_chars * 2 + 2); /* length */
-    if (clipboard_out_unicode(s, data, num_chars) != num_chars * 2)
+    s_push_layer(s, channel_hdr, 4); /* length, set at the end */
+    g_clip_s2c.incr_s = s;
+    g_clip_s2c.incr_skip = g_clip_s2c.type == g_image_bmp_atom ? 14 : 0;
+    g_clip_s2c.utf8_code = 0;
+    g_clip_s2c.utf8_left = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+/* add a piece of INCR data to the response
+   returns error */
+static int APP_CC
+clipboard_s2c_incr_part(char *data, int data_bytes)
+{
+    struct stream *s;
+    int skip;
+
+    s = g_clip_s2c.incr_s;
+    if (s == 0)
     {
-        log_error("clipboard_send_data_response_for_text: error "
-              "clipboard_out_unicode didn't write right number of bytes");
+        return 1;
     }
-    out_uint16_le(s, 0); /* nil for string */
+    /* drop the bmp file header, the client wants a DIB */
+    skip = data_bytes < g_clip_s2c.incr_skip ? data_bytes : g_clip_s2c.incr_skip;
+    data += skip;
+    data_bytes -= skip;
+    g_clip_s2c.incr_skip -= skip;
+    if (g_clip_s2c.type == g_image_bmp_atom)
+    {
+        if (clipboard_stream_reserve(s, data_bytes + 4) != 0)
+        {
+            log_error("clipboard_s2c_incr_part: out of memory");
+            free_stream(s);
+            g_clip_s2c.incr_s = 0;
+            return 1;
+        }
+        out_uint8a(s, data, data_bytes);
+    }
+    else
+    {
+        if (clipboard_stream_reserve(s, data_bytes * 2 + 8) != 0)
+        {
+            log_error("clipboard_s2c_incr_part: out of memory");
+            free_stream(s);
+            g_clip_s2c.incr_s = 0;
+            return 1;
+        }
+        clipboard_out_utf16_part(s, data, data_bytes,
+                                 g_clip_s2c.type == XA_STRING,
+                                 &(g_clip_s2c.utf8_code),
+                                 &(g_clip_s2c.utf8_left));
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* INCR transfer from the X app is done, send the response to the client
+   returns error */
+static int APP_CC
+clipboard_s2c_incr_end(void)
+{
+    struct stream *s;
+    int size;
+
+    s = g_clip_s2c.incr_s;
+    g_clip_s2c.incr_s = 0;
+    if (s == 0)
+    {
+        return 1;
+    }
+    if (clipboard_stream_reserve(s, 8) != 0)
+    {
+        free_stream(s);
+        return 1;
+    }
+    if (g_clip_s2c.type != g_image_bmp_atom)
+    {
+        out_uint16_le(s, 0); /* nil for string */
+    }
+    size = (int)(s->p - s->channel_hdr) - 4;
     out_uint32_le(s, 0);
     s_mark_end(s);
-    size = (int)(s->end - s->data);
-    log_debug("clipboard_send_data_response_for_text: data out, "
-          "sending CLIPRDR_DATA_RESPONSE (clip_msg_id = 5) size %d "
-          "num_chars %d", size, num_chars);
-    rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
-    free_stream(s);
-    return rv;
+    s->p = s->channel_hdr;
+    out_uint32_le(s, size); /* length */
+    log_debug("clipboard_s2c_incr_end: length %d", size);
+    /* s is freed by chansrv once sent */
+    return send_channel_data_stream(g_cliprdr_chan_id, s);
 }
 
 /*****************************************************************************/
@@ -1222,6 +1453,7 @@ clipboard_process_data_response_for_image(struct stream *s,
     }
     g_clip_c2s.total_bytes = len;
     g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
+    g_clip_c2s.data_offset = 0;
     g_memcpy(g_clip_c2s.data, g_bmp_image_header, 14);
     in_uint8a(s, g_clip_c2s.data + 14, len);
     log_debug("clipboard_process_data_response_for_image: calling "
@@ -1277,6 +1509,7 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
         }
         g_clip_c2s.total_bytes = g_strlen(g_clip_c2s.data);
         g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
+        g_clip_c2s.data_offset = 0;
         clipboard_provide_selection_c2s(lxev, lxev->target);
         return 0;
     }
@@ -1322,6 +1555,7 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
     {
         g_clip_c2s.total_bytes = g_strlen(g_clip_c2s.data);
         g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
+        g_clip_c2s.data_offset = 0;
         clipboard_provide_selection_c2s(lxev, lxev->target);
     }
     g_free(wtext);
@@ -1377,36 +1611,218 @@ clipboard_process_clip_caps(struct stream *s, int clip_msg_status,
 }
 
 /*****************************************************************************/
+/* send the next piece of an INCR transfer to the requestor, called when it
+   deleted the property or when more data came in while waiting for the
+   client
+   returns error */
 static int APP_CC
-ss_part(char *data, int data_bytes)
+clipboard_c2s_incr_send(void)
+{
+    char *data;
+    int data_bytes;
+
+    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
+    if ((data_bytes < 1) && g_clip_c2s.doing_response_ss)
+    {
+        /* more is coming from the client, ss_part will call us again */
+        log_debug("clipboard_c2s_incr_send: waiting for client data");
+        g_clip_c2s.incr_in_progress = 0;
+        return 0;
+    }
+    if (data_bytes > g_incr_max_req_size)
+    {
+        data_bytes = g_incr_max_req_size;
+    }
+    data = g_clip_c2s.data +
+           (g_clip_c2s.incr_bytes_done - g_clip_c2s.data_offset);
+    g_clip_c2s.incr_bytes_done += data_bytes;
+    log_debug("clipboard_c2s_incr_send: data_bytes %d", data_bytes);
+    XChangeProperty(g_display, g_clip_c2s.window,
+                    g_clip_c2s.property, g_clip_c2s.type, 8,
+                    PropModeReplace, (tui8 *)data, data_bytes);
+    g_clip_c2s.incr_in_progress = 1;
+    if (data_bytes < 1)
+    {
+        log_debug("clipboard_c2s_incr_send: INCR done");
+        g_clip_c2s.incr_in_progress = 0;
+        /* ss_start only guessed the size, the UTF-8 or Latin-1 text can
+           be longer or shorter than it, this is what was really sent */
+        g_clip_c2s.total_bytes = g_clip_c2s.read_bytes_done;
+        /* we no longer need property notify */
+        XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+        /* can only be given out again if none of it was dropped */
+        g_clip_c2s.converted = g_clip_c2s.data_offset == 0;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* make room for bytes more at the end of g_clip_c2s.data while doing
+   response short circuit, data that was already given to the requestor is
+   dropped so the buffer only holds what is in flight
+   returns where to write or nil */
+static char * APP_CC
+ss_reserve(int bytes)
 {
+    char *data;
+    int drop;
+    int used;
+    int size;
+
+    drop = g_clip_c2s.incr_bytes_done - g_clip_c2s.data_offset;
+    used = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
+    if (drop + used + bytes <= g_clip_c2s.data_alloc)
+    {
+        return g_clip_c2s.data + drop + used;
+    }
+    if ((drop >= used) && (used + bytes <= g_clip_c2s.data_alloc))
+    {
+        /* no overlap, move the unsent data to the front */
+        g_memcpy(g_clip_c2s.data, g_clip_c2s.data + drop, used);
+        g_clip_c2s.data_offset += drop;
+        return g_clip_c2s.data + used;
+    }
+    size = g_clip_c2s.data_alloc * 2;
+    if (size < used + bytes)
+    {
+        size = used + bytes;
+    }
+    data = (char *) g_malloc(size, 0);
+    if (data == 0)
+    {
+        return 0;
+    }
+    g_memcpy(data, g_clip_c2s.data + drop, used);
+    g_free(g_clip_c2s.data);
+    g_clip_c2s.data = data;
+    g_clip_c2s.data_alloc = size;
+    g_clip_c2s.data_offset += drop;
+    return g_clip_c2s.data + used;
+}
+
+/*****************************************************************************/
+/* convert a piece of UTF-16LE text from the client to UTF-8, or Latin-1
+   for STRING, a byte or surrogate split across pieces is held for the next
+   call
+   returns error */
+static int APP_CC
+ss_in_utf16(char *data, int data_bytes)
+{
+    char *out;
+    char *holdp;
     int index;
-    char *text;
+    int unit;
+    int code;
+
+    out = ss_reserve(((data_bytes + 1) / 2) * 3 + 4);
+    if (out == 0)
+    {
+        return 1;
+    }
+    holdp = out;
+    index = 0;
+    while ((index < data_bytes) && !g_clip_c2s.text_done)
+    {
+        if (g_clip_c2s.utf16_hold >= 0)
+        {
+            unit = g_clip_c2s.utf16_hold | ((tui8)(data[index]) << 8);
+            g_clip_c2s.utf16_hold = -1;
+            index++;
+        }
+        else if (index + 1 < data_bytes)
+        {
+            unit = (tui8)(data[index]) | ((tui8)(data[index + 1]) << 8);
+            index += 2;
+        }
+        else
+        {
+            g_clip_c2s.utf16_hold = (tui8)(data[index]);
+            index++;
+            continue;
+        }
+        if (unit == 0)
+        {
+            g_clip_c2s.text_done = 1;
+            break;
+        }
+        if ((unit >= 0xd800) && (unit < 0xdc00))
+        {
+            g_clip_c2s.utf16_high = unit;
+            continue;
+        }
+        if ((unit >= 0xdc00) && (unit < 0xe000))
+        {
+            if (g_clip_c2s.utf16_high == 0)
+            {
+                continue;
+            }
+            code = 0x10000 + ((g_clip_c2s.utf16_high - 0xd800) << 10) +
+                   (unit - 0xdc00);
+        }
+        else
+        {
+            code = unit;
+        }
+        g_clip_c2s.utf16_high = 0;
+        if (g_clip_c2s.type == XA_STRING)
+        {
+            *(out++) = code < 0x100 ? code : '?';
+        }
+        else if (code < 0x80)
+        {
+            *(out++) = code;
+        }
+        else if (code < 0x800)
+        {
+            *(out++) = 0xc0 | (code >> 6);
+            *(out++) = 0x80 | (code & 0x3f);
+        }
+        else if (code < 0x10000)
+        {
+            *(out++) = 0xe0 | (code >> 12);
+            *(out++) = 0x80 | ((code >> 6) & 0x3f);
+            *(out++) = 0x80 | (code & 0x3f);
+        }
+        else
+        {
+            *(out++) = 0xf0 | (code >> 18);
+            *(out++) = 0x80 | ((code >> 12) & 0x3f);
+            *(out++) = 0x80 | ((code >> 6) & 0x3f);
+            *(out++) = 0x80 | (code & 0x3f);
+        }
+    }
+    g_clip_c2s.read_bytes_done += (int)(out - holdp);
+    return 0;
+}
+
+/*****************************************************************************/
+static int APP_CC
+ss_part(char *data, int data_bytes)
+{
+    char *out;
 
     log_debug("ss_part: data_bytes %d read_bytes_done %d "
               "incr_bytes_done %d", data_bytes,
               g_clip_c2s.read_bytes_done,
               g_clip_c2s.incr_bytes_done);
-    /* copy to buffer */
-    if (g_clip_c2s.type == g_utf8_atom)
+    /* convert into buffer */
+    if ((g_clip_c2s.type == g_utf8_atom) || (g_clip_c2s.type == XA_STRING))
     {
-        /* todo unicode */
-        text = (char *)g_malloc(data_bytes, 0);
-        index = 0;
-        data_bytes /= 2;
-        while (index < data_bytes)
+        if (ss_in_utf16(data, data_bytes) != 0)
         {
-            text[index] = data[index * 2];
-            index++;
+            log_error("ss_part: out of memory");
+            return 1;
         }
-        text[index] = 0;
-        g_memcpy(g_clip_c2s.data + g_clip_c2s.read_bytes_done, text, data_bytes);
-        g_clip_c2s.read_bytes_done += data_bytes;
-        g_free(text);
     }
     else
     {
-        g_memcpy(g_clip_c2s.data + g_clip_c2s.read_bytes_done, data, data_bytes);
+        out = ss_reserve(data_bytes);
+        if (out == 0)
+        {
+            log_error("ss_part: out of memory");
+            return 1;
+        }
+        g_memcpy(out, data, data_bytes);
         g_clip_c2s.read_bytes_done += data_bytes;
     }
     if (g_clip_c2s.incr_in_progress)
@@ -1414,32 +1830,13 @@ ss_part(char *data, int data_bytes)
         log_debug("ss_part: incr_in_progress set");
         return 0;
     }
-    if (g_clip_c2s.read_bytes_done <= g_clip_c2s.incr_bytes_done)
-    {
-        log_debug("ss_part: read_bytes_done < incr_bytes_done");
-        return 0;
-    }
-    data = g_clip_c2s.data + g_clip_c2s.incr_bytes_done;
-    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-    if (data_bytes > g_incr_max_req_size)
-    {
-        data_bytes = g_incr_max_req_size;
-    }
-    g_clip_c2s.incr_bytes_done += data_bytes;
-    XChangeProperty(g_display, g_clip_c2s.window,
-                    g_clip_c2s.property, g_clip_c2s.type, 8,
-                    PropModeReplace, (tui8 *)data, data_bytes);
-    g_clip_c2s.incr_in_progress = 1;
-    return 0;
+    return clipboard_c2s_incr_send();
 }
 
 /*****************************************************************************/
 static int APP_CC
 ss_end(void)
 {
-    char *data;
-    int data_bytes;
-
     log_debug("ss_end:");
     g_clip_c2s.doing_response_ss = 0;
     g_clip_c2s.in_request = 0;
@@ -1449,23 +1846,8 @@ ss_end(void)
         log_debug("ss_end: incr_in_progress set");
         return 0;
     }
-    if (g_clip_c2s.read_bytes_done <= g_clip_c2s.incr_bytes_done)
-    {
-        log_debug("ss_end: read_bytes_done < incr_bytes_done");
-        return 0;
-    }
-    data = g_clip_c2s.data + g_clip_c2s.incr_bytes_done;
-    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-    if (data_bytes > g_incr_max_req_size)
-    {
-        data_bytes = g_incr_max_req_size;
-    }
-    g_clip_c2s.incr_bytes_done += data_bytes;
-    XChangeProperty(g_display, g_clip_c2s.window,
-                    g_clip_c2s.property, g_clip_c2s.type, 8,
-                    PropModeReplace, (tui8 *)data, data_bytes);
-    g_clip_c2s.incr_in_progress = 1;
-    return 0;
+    /* sends what is left or the zero length end of INCR */
+    return clipboard_c2s_incr_send();
 }
 
 /*****************************************************************************/
@@ -1499,9 +1881,16 @@ ss_start(char *data, int data_bytes, int total_bytes)
     g_clip_c2s.type = req->target;
     g_clip_c2s.property = req->property;
     g_clip_c2s.window = req->requestor;
+    /* bounded buffer, only the data not yet given to the requestor is
+       kept, see ss_reserve */
     g_free(g_clip_c2s.data);
-    g_clip_c2s.data = (char *)g_malloc(incr_bytes + 64, 0);
+    g_clip_c2s.data_alloc = CLIP_STREAM_BUF_SIZE;
+    g_clip_c2s.data = (char *)g_malloc(g_clip_c2s.data_alloc, 0);
+    g_clip_c2s.data_offset = 0;
     g_clip_c2s.total_bytes = incr_bytes;
+    g_clip_c2s.utf16_hold = -1;
+    g_clip_c2s.utf16_high = 0;
+    g_clip_c2s.text_done = 0;
 
     XChangeProperty(g_display, req->requestor, req->property,
                     g_incr_atom, 32, PropModeReplace, (tui8 *)val1, 1);
@@ -1572,7 +1961,8 @@ clipboard_data_in(struct stream *s, int chan_id, int chan_flags, int length,
     {
         if (total_length > 32 * 1024)
         {
-            if ((chan_flags & 3) == 1)
+            /* the first chunk must hold the whole header */
+            if (((chan_flags & 3) == 1) && (length >= 8))
             {
                 holdp = s->p;
                 in_uint16_le(s, clip_msg_id);
@@ -1900,6 +2290,9 @@ clipboard_event_selection_notify(XEvent *xevent)
             g_free(g_clip_s2c.data);
             g_clip_s2c.data = 0;
             //g_hexdump(data, sizeof(long));
+            /* the INCR value is a lower bound on the size */
+            clipboard_s2c_incr_start(data_size >= (int) sizeof(long) ?
+                                     (int) (*((long *) data)) : 0);
             g_free(data);
             return 0;
         }
@@ -2320,8 +2713,6 @@ clipboard_event_property_notify(XEvent *xevent)
     int rv;
     int format_in_bytes;
     int new_data_len;
-    int data_bytes;
-    char *cptr;
 
     log_debug("clipboard_event_property_notify:");
     log_debug("clipboard_event_property_notify: PropertyNotify .window %d "
@@ -2343,32 +2734,7 @@ clipboard_event_property_notify(XEvent *xevent)
             log_debug("clipboard_event_property_notify: INCR error");
             return 0;
         }
-        data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
-        data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-        if ((data_bytes < 1) &&
-            (g_clip_c2s.read_bytes_done < g_clip_c2s.total_bytes))
-        {
-            g_clip_c2s.incr_in_progress = 0;
-            return 0;
-        }
-        if (data_bytes > g_incr_max_req_size)
-        {
-            data_bytes = g_incr_max_req_size;
-        }
-        g_clip_c2s.incr_bytes_done += data_bytes;
-        log_debug("clipboard_event_property_notify: data_bytes %d", data_bytes);
-        XChangeProperty(xevent->xproperty.display, xevent->xproperty.window,
-                        xevent->xproperty.atom, g_clip_c2s.type, 8,
-                        PropModeReplace, data, data_bytes);
-        if (data_bytes < 1)
-        {
-            log_debug("clipboard_event_property_notify: INCR done");
-            g_clip_c2s.incr_in_progress = 0;
-            /* we no longer need property notify */
-            XSelectInput(xevent->xproperty.display, xevent->xproperty.window,
-                         NoEventMask);
-            g_clip_c2s.converted = 1;
-        }
+        clipboard_c2s_incr_send();
     }
     if (g_clip_s2c.incr_in_progress &&
             (xevent->xproperty.window == g_wnd) &&
@@ -2391,27 +2757,31 @@ clipboard_event_property_notify(XEvent *xevent)
             log_debug("clipboard_event_property_notify: INCR done");
             /* clipboard INCR cycle has completed */
             g_clip_s2c.incr_in_progress = 0;
-            if (g_clip_s2c.type == g_image_bmp_atom)
+            if ((g_clip_s2c.type == g_image_bmp_atom) ||
+                (g_clip_s2c.type == XA_STRING) ||
+                (g_clip_s2c.type == g_utf8_atom))
             {
-                g_clip_s2c.xrdp_clip_type = XRDP_CB_BITMAP;
-                //g_hexdump(g_last_clip_data, 64);
-                /* skip header */
-                clipboard_send_data_response(g_clip_s2c.xrdp_clip_type,
-                                             g_clip_s2c.data + 14,
-                                             g_clip_s2c.total_bytes - 14);
-            }
-            else if ((g_clip_s2c.type == XA_STRING) ||
-                     (g_clip_s2c.type == g_utf8_atom))
-            {
-                g_clip_s2c.xrdp_clip_type = XRDP_CB_TEXT;
-                clipboard_send_data_response(g_clip_s2c.xrdp_clip_type,
-                                             g_clip_s2c.data,
-                                             g_clip_s2c.total_bytes);
+                if (g_clip_s2c.type == g_image_bmp_atom)
+                {
+                    g_clip_s2c.xrdp_clip_type = XRDP_CB_BITMAP;
+                }
+                else
+                {
+                    g_clip_s2c.xrdp_clip_type = XRDP_CB_TEXT;
+                }
+                log_info("clipboard_event_property_notify: INCR %d bytes",
+                         g_clip_s2c.total_bytes);
+                if (clipboard_s2c_incr_end() != 0)
+                {
+                    clipboard_send_data_response_failed();
+                }
             }
             else
             {
                 log_error("clipboard_event_property_notify: error unknown type %d",
                            g_clip_s2c.type);
+                free_stream(g_clip_s2c.incr_s);
+                g_clip_s2c.incr_s = 0;
                 clipboard_send_data_response_failed();
             }
 
@@ -2425,31 +2795,13 @@ clipboard_event_property_notify(XEvent *xevent)
 
             format_in_bytes = FORMAT_TO_BYTES(actual_format_return);
             new_data_len = nitems_returned * format_in_bytes;
-            cptr = (char *) g_malloc(g_clip_s2c.total_bytes + new_data_len, 0);
-            g_memcpy(cptr, g_clip_s2c.data, g_clip_s2c.total_bytes);
-            g_free(g_clip_s2c.data);
-
-            if (cptr == NULL)
-            {
-                g_clip_s2c.data = 0;
-
-                /* cannot add any more data */
-                if (data != 0)
-                {
-                    XFree(data);
-                }
-
-                XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
-                return 0;
-            }
-
             log_debug("clipboard_event_property_notify: new_data_len %d", new_data_len);
-            g_clip_s2c.data = cptr;
-            g_memcpy(g_clip_s2c.data + g_clip_s2c.total_bytes, data, new_data_len);
-            g_clip_s2c.total_bytes += new_data_len;
 
-            if (data)
+            /* converted and added to the response right away */
+            if (data != 0)
             {
+                clipboard_s2c_incr_part((char *) data, new_data_len);
+                g_clip_s2c.total_bytes += new_data_len;
                 XFree(data);
             }
 
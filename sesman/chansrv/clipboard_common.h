@@ -97,6 +97,10 @@ struct clip_s2c /* server to client, pasting from linux app to mstsc */
     int xrdp_clip_type; /* XRDP_CB_TEXT, XRDP_CB_BITMAP, XRDP_CB_FILE, ... */
     int converted;
     Time clip_time;
+    struct stream *incr_s; /* CLIPRDR_DATA_RESPONSE built as INCR data comes */
+    int incr_skip; /* leading bytes of INCR data to drop, bmp file header */
+    int utf8_code; /* UTF-8 sequence split across INCR chunks */
+    int utf8_left;
 };
 
 struct clip_c2s /* client to server, pasting from mstsc to linux app */
@@ -114,6 +118,11 @@ struct clip_c2s /* client to server, pasting from mstsc to linux app */
     int in_request; /* a data request has been sent to client */
     int doing_response_ss; /* doing response short circuit */
     Time clip_time;
+    int data_offset; /* bytes dropped from the front of data, already sent */
+    int data_alloc; /* size of data when doing response short circuit */
+    int utf16_hold; /* odd byte split across channel chunks, -1 if none */
+    int utf16_high; /* high surrogate split across channel chunks */
+    int text_done; /* got the nil at the end of the text */
 };
 
 struct clip_file_desc /* CLIPRDR_FILEDESCRIPTOR */
@@ -94,8 +94,19 @@ struct cb_file_info
 
 static struct list *g_files_list = 0;
 
-/* used when server is asking for file info from the client */
-static int g_file_request_sent_type = 0;
+/* a CB_FILECONTENTS_REQUEST sent to the client and not answered yet,
+   size and range requests can both be outstanding and the response only
+   carries the stream id, so that is what the type is found by */
+struct cb_file_request
+{
+    int stream_id;
+    int type; /* CB_FILECONTENTS_SIZE or CB_FILECONTENTS_RANGE */
+};
+
+/* more than this and the oldest is taken as lost */
+#define CB_FILE_REQUESTS_MAX 64
+
+static struct list *g_file_requests = 0;
 
 /* number of seconds from 1 Jan. 1601 00:00 to 1 Jan 1970 00:00 UTC */
 #define CB_EPOCH_DIFF 11644473600LL
@@ -375,6 +386,58 @@ clipboard_send_file_size(int streamId, int lindex)
     return rv;
 }
 
+/*****************************************************************************/
+static void APP_CC
+clipboard_file_request_add(int stream_id, int type)
+{
+    struct cb_file_request *cfr;
+
+    if (g_file_requests == 0)
+    {
+        g_file_requests = list_create();
+        g_file_requests->auto_free = 1;
+    }
+    if (g_file_requests->count >= CB_FILE_REQUESTS_MAX)
+    {
+        log_error("clipboard_file_request_add: too many outstanding "
+                  "requests, dropping the oldest");
+        list_remove_item(g_file_requests, 0);
+    }
+    cfr = (struct cb_file_request *)
+          g_malloc(sizeof(struct cb_file_request), 1);
+    cfr->stream_id = stream_id;
+    cfr->type = type;
+    list_add_item(g_file_requests, (tintptr)cfr);
+}
+
+/*****************************************************************************/
+/* returns the type of the oldest request for stream_id and forgets it,
+   0 if there is none */
+static int APP_CC
+clipboard_file_request_remove(int stream_id)
+{
+    struct cb_file_request *cfr;
+    int index;
+    int type;
+
+    if (g_file_requests == 0)
+    {
+        return 0;
+    }
+    for (index = 0; index < g_file_requests->count; index++)
+    {
+        cfr = (struct cb_file_request *)
+              list_get_item(g_file_requests, index);
+        if (cfr->stream_id == stream_id)
+        {
+            type = cfr->type;
+            list_remove_item(g_file_requests, index);
+            return type;
+        }
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* ask the client to send the file size */
 int APP_CC
@@ -385,11 +448,6 @@ clipboard_request_file_size(int stream_id, int lindex)
     int rv;
 
     log_debug("clipboard_request_file_size:");
-    if (g_file_request_sent_type != 0)
-    {
-        log_error("clipboard_request_file_size: warning, still waiting "
-                   "for CB_FILECONTENTS_RESPONSE");
-    }
     make_stream(s);
     init_stream(s, 8192);
     out_uint16_le(s, CB_FILECONTENTS_REQUEST); /* 8 */
@@ -407,7 +465,7 @@ clipboard_request_file_size(int stream_id, int lindex)
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
     free_stream(s);
-    g_file_request_sent_type = CB_FILECONTENTS_SIZE;
+    clipboard_file_request_add(stream_id, CB_FILECONTENTS_SIZE);
     return rv;
 }
 
@@ -491,11 +549,6 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     log_debug("clipboard_request_file_data: stream_id=%d lindex=%d off=%d request_bytes=%d",
                stream_id, lindex, offset, request_bytes);
 
-    if (g_file_request_sent_type != 0)
-    {
-        log_error("clipboard_request_file_data: warning, still waiting "
-                   "for CB_FILECONTENTS_RESPONSE");
-    }
     make_stream(s);
     init_stream(s, 8192);
     out_uint16_le(s, CB_FILECONTENTS_REQUEST); /* 8 */
@@ -513,7 +566,7 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
     free_stream(s);
-    g_file_request_sent_type = CB_FILECONTENTS_RANGE;
+    clipboard_file_request_add(stream_id, CB_FILECONTENTS_RANGE);
     return rv;
 }
 
@@ -561,27 +614,41 @@ clipboard_process_file_response(struct stream *s, int clip_msg_status,
 {
     int streamId;
     int file_size;
+    int type;
 
     log_debug("clipboard_process_file_response:");
-    if (g_file_request_sent_type == CB_FILECONTENTS_SIZE)
+    if (clip_msg_len < 4)
+    {
+        log_error("clipboard_process_file_response: error, too short");
+        return 1;
+    }
+    in_uint32_le(s, streamId);
+    type = clipboard_file_request_remove(streamId);
+    if (type == CB_FILECONTENTS_SIZE)
     {
-        g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
-        in_uint32_le(s, file_size);
+        file_size = -1;
+        if ((clip_msg_status == CB_RESPONSE_OK) && (clip_msg_len >= 8))
+        {
+            in_uint32_le(s, file_size);
+        }
         log_debug("clipboard_process_file_response: streamId %d "
                    "file_size %d", streamId, file_size);
         xfuse_file_contents_size(streamId, file_size);
     }
-    else if (g_file_request_sent_type == CB_FILECONTENTS_RANGE)
+    else if (type == CB_FILECONTENTS_RANGE)
     {
-        g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
+        if (clip_msg_status != CB_RESPONSE_OK)
+        {
+            log_error("clipboard_process_file_response: client failed "
+                       "request for streamId %d", streamId);
+            clip_msg_len = 4;
+        }
         xfuse_file_contents_range(streamId, s->p, clip_msg_len - 4);
     }
     else
     {
-        log_error("clipboard_process_file_response: error");
-        g_file_request_sent_type = 0;
+        log_error("clipboard_process_file_response: error, no request "
+                  "for streamId %d", streamId);
     }
     return 0;
 }
@@ -0,0 +1,398 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * benchmark of the rdp module's compressed bitmap pass through
+ * every tile of a stream of server compressed bitmaps is decompressed and
+ * converted as the module does, then compressed again for the client as
+ * before or passed through, prints tiles/s for both, the bytes sent each
+ * way and the tiles too big for a bitmap cache v2 order that
+ * xrdp_painter_copy_comp leaves to xrdp_painter_copy
+ *
+ * bitmap_pass_bench [file], file is a recorded stream, one record per
+ * bitmap, bpp, width and height a byte each, a 2 byte little endian
+ * length and the compressed bytes, without a file the stream is made of
+ * synthetic ui, text, gradient and photo tiles in 16 and 24 bpp and one
+ * 24 bpp tile sent as single pixel copies, bigger than the order allows
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arch.h"
+#include "parse.h"
+#include "os_calls.h"
+#include "defines.h"
+#include "pixel_convert.h"
+
+#define T_LOOPS 200
+#define T_MAX_COMP 0x3fff /* 14 bit bitmapLength in a bitmap cache v2 order */
+
+int APP_CC
+rdp_bitmap_decompress(char *output, int width, int height, char *input,
+                      int size, int Bpp);
+int APP_CC
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e);
+
+struct tile
+{
+    int bpp;
+    int width;
+    int height;
+    int bytes;
+    char *data;
+};
+
+static struct tile g_tiles[1024];
+static int g_num_tiles = 0;
+static unsigned int g_seed = 3;
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+static void
+add_tile(int bpp, int width, int height, const char *data, int bytes)
+{
+    struct tile *t;
+
+    if (g_num_tiles >= 1024)
+    {
+        return;
+    }
+    t = g_tiles + g_num_tiles;
+    t->bpp = bpp;
+    t->width = width;
+    t->height = height;
+    t->bytes = bytes;
+    t->data = (char *) g_malloc(bytes, 0);
+    g_memcpy(t->data, data, bytes);
+    g_num_tiles++;
+}
+
+/*****************************************************************************/
+/* what the module hands xrdp, 16 bpp as is, 24 bpp as 32 bpp pixels */
+static void
+make_pixels(char *data, int kind, int bpp, int width, int height)
+{
+    int x;
+    int y;
+    int p;
+    int r;
+    int g;
+    int b;
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            switch (kind)
+            {
+                case 0: /* panel and title bar */
+                    p = ((x < width - 14) && (y > 10)) ? 0xf0f0f0 : 0x3366cc;
+                    break;
+                case 1: /* text */
+                    p = (((rnd() % 6) == 0) && ((y % 12) < 9)) ?
+                        0x000000 : 0xffffff;
+                    break;
+                case 2: /* gradient */
+                    p = ((x * 4) << 8) | (y * 4);
+                    break;
+                default: /* photo */
+                    p = rnd() & 0xffffff;
+                    break;
+            }
+            if (bpp == 16)
+            {
+                SPLITCOLOR32(r, g, b, p);
+                ((tui16 *) data)[y * width + x] = COLOR16(r, g, b);
+            }
+            else
+            {
+                ((tui32 *) data)[y * width + x] = p;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/* compress as xrdp_orders_compress_bitmap2 does, returns bytes or 0 */
+static int
+compress_tile(char *data, int bpp, int width, int height,
+              struct stream *s, struct stream *temp_s)
+{
+    init_stream(s, 16384 * 2);
+    init_stream(temp_s, 16384 * 2);
+    if (xrdp_bitmap_compress(data, width, height, s, bpp, 16384,
+                             height - 1, temp_s, 0) != height)
+    {
+        return 0;
+    }
+    s_mark_end(s);
+    return (int) (s->end - s->data);
+}
+
+/*****************************************************************************/
+static void
+make_stream_tiles(void)
+{
+    struct stream *s;
+    struct stream *temp_s;
+    char *data;
+    char *p;
+    int kind;
+    int bpp;
+    int size;
+    int bytes;
+    int index;
+
+    make_stream(s);
+    make_stream(temp_s);
+    data = (char *) g_malloc(64 * 64 * 4, 0);
+    for (bpp = 16; bpp <= 24; bpp += 8)
+    {
+        for (kind = 0; kind < 4; kind++)
+        {
+            for (size = 64; size >= 16; size /= 2)
+            {
+                make_pixels(data, kind, bpp, size, size);
+                bytes = compress_tile(data, bpp, size, size, s, temp_s);
+                if (bytes > 0)
+                {
+                    add_tile(bpp, size, size, s->data, bytes);
+                }
+            }
+        }
+    }
+    /* 4096 copy runs of one pixel, valid, 16384 bytes */
+    p = data;
+    for (index = 0; index < 64 * 64; index++)
+    {
+        p[0] = (char) 0x81;
+        p[1] = rnd();
+        p[2] = rnd();
+        p[3] = rnd();
+        p += 4;
+    }
+    add_tile(24, 64, 64, data, 64 * 64 * 4);
+    g_free(data);
+    free_stream(s);
+    free_stream(temp_s);
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+read_stream_tiles(const char *filename)
+{
+    unsigned char hdr[5];
+    char *data;
+    int fd;
+    int bytes;
+
+    fd = g_file_open_ex(filename, 1, 0, 0, 0);
+    if (fd < 0)
+    {
+        printf("can not open %s\n", filename);
+        return 1;
+    }
+    data = (char *) g_malloc(65536, 0);
+    while (g_file_read(fd, (char *) hdr, 5) == 5)
+    {
+        bytes = hdr[3] | (hdr[4] << 8);
+        if (g_file_read(fd, data, bytes) != bytes)
+        {
+            printf("%s: short record\n", filename);
+            break;
+        }
+        add_tile(hdr[0], hdr[1], hdr[2], data, bytes);
+    }
+    g_free(data);
+    g_file_close(fd);
+    return 0;
+}
+
+/*****************************************************************************/
+/* the module's side, decompress and convert to what xrdp takes,
+   returns the xrdp bpp or 0 */
+static int
+module_tile(struct tile *t, char *raw, char *pixels)
+{
+    int Bpp;
+
+    Bpp = (t->bpp + 7) / 8;
+    if (!rdp_bitmap_decompress(raw, t->width, t->height, t->data, t->bytes,
+                               Bpp))
+    {
+        return 0;
+    }
+    if (t->bpp == 24)
+    {
+        pixel_convert_row(raw, PIXEL_FMT_24, pixels, PIXEL_FMT_32,
+                          t->width * t->height, 0);
+    }
+    else
+    {
+        g_memcpy(pixels, raw, t->width * t->height * Bpp);
+    }
+    return t->bpp;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct stream *s;
+    struct stream *temp_s;
+    struct tile *t;
+    char *raw;
+    char *pixels;
+    int loop;
+    int index;
+    int bytes;
+    int start;
+    int ms_old;
+    int ms_new;
+    int bytes_old;
+    int bytes_new;
+    int too_big;
+    int pixel_count;
+    int errors;
+
+    g_init("bitmap_pass_bench");
+    if (argc > 1)
+    {
+        if (read_stream_tiles(argv[1]) != 0)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        make_stream_tiles();
+    }
+    make_stream(s);
+    make_stream(temp_s);
+    raw = (char *) g_malloc(64 * 64 * 4, 0);
+    pixels = (char *) g_malloc(64 * 64 * 4, 0);
+    errors = 0;
+    bytes_old = 0;
+    bytes_new = 0;
+    too_big = 0;
+    pixel_count = 0;
+
+    /* before, everything compressed again */
+    start = g_time3();
+    for (loop = 0; loop < T_LOOPS; loop++)
+    {
+        for (index = 0; index < g_num_tiles; index++)
+        {
+            t = g_tiles + index;
+            if (module_tile(t, raw, pixels) == 0)
+            {
+                continue;
+            }
+            bytes = compress_tile(pixels, t->bpp, t->width, t->height,
+                                  s, temp_s);
+            if (loop == 0)
+            {
+                bytes_old += bytes;
+            }
+        }
+    }
+    ms_old = g_time3() - start;
+
+    /* pass through, compressed again only when over the order's limit */
+    start = g_time3();
+    for (loop = 0; loop < T_LOOPS; loop++)
+    {
+        for (index = 0; index < g_num_tiles; index++)
+        {
+            t = g_tiles + index;
+            if (module_tile(t, raw, pixels) == 0)
+            {
+                if (loop == 0)
+                {
+                    printf("tile %d: %dx%d %d bpp does not decompress\n",
+                           index, t->width, t->height, t->bpp);
+                    errors++;
+                }
+                continue;
+            }
+            if (t->bytes > T_MAX_COMP)
+            {
+                bytes = compress_tile(pixels, t->bpp, t->width, t->height,
+                                      s, temp_s);
+                if (loop == 0)
+                {
+                    too_big++;
+                    if ((bytes < 1) || (bytes > T_MAX_COMP))
+                    {
+                        printf("tile %d: fallback gave %d bytes\n", index,
+                               bytes);
+                        errors++;
+                    }
+                }
+            }
+            else
+            {
+                bytes = t->bytes;
+            }
+            if (loop == 0)
+            {
+                bytes_new += bytes;
+                pixel_count += t->width * t->height;
+            }
+        }
+    }
+    ms_new = g_time3() - start;
+
+    printf("%d tiles, %d pixels, %d loops\n", g_num_tiles, pixel_count,
+           T_LOOPS);
+    printf("compress again %6d ms %8.0f tiles/s %7d bytes\n", ms_old,
+           ms_old < 1 ? 0 : (double) g_num_tiles * T_LOOPS * 1000 / ms_old,
+           bytes_old);
+    printf("pass through   %6d ms %8.0f tiles/s %7d bytes, %d over 0x%x\n",
+           ms_new,
+           ms_new < 1 ? 0 : (double) g_num_tiles * T_LOOPS * 1000 / ms_new,
+           bytes_new, too_big, T_MAX_COMP);
+    if ((argc < 2) && (too_big != 1))
+    {
+        printf("the single pixel copy tile was not caught\n");
+        errors++;
+    }
+
+    for (index = 0; index < g_num_tiles; index++)
+    {
+        g_free(g_tiles[index].data);
+    }
+    g_free(raw);
+    g_free(pixels);
+    free_stream(s);
+    free_stream(temp_s);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,526 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of the clipboard's large transfers, no X server
+ * client to server, a CLIPRDR_DATA_RESPONSE of random UTF-16 text, with
+ * surrogate pairs, or of a DIB, goes through clipboard_data_in in channel
+ * chunks of random size, XChangeProperty is taken over here to play the X
+ * requestor that reads each INCR piece, checks it gets the UTF-8, Latin-1
+ * or bmp file the text or DIB should give and how big the buffer got
+ * server to client, the same text as UTF-8 or Latin-1, or a bmp file,
+ * goes through the INCR handlers in pieces of random size, checks the
+ * response given to send_channel_data_stream, then prints MB/s for both
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the transfer functions and state are static, take the module in whole */
+#include "clipboard.c"
+
+#define T_CHARS (1024 * 1024)
+#define T_RUNS 20
+
+/* what the rest of chansrv has */
+int g_cliprdr_chan_id = 1;
+Display *g_display = 0;
+int g_x_socket = 0;
+tbus g_x_wait_obj = 0;
+Screen *g_screen = 0;
+int g_screen_num = 0;
+
+/* what the requestor got */
+static char *g_got = 0;
+static int g_got_bytes = 0;
+static int g_got_alloc = 0;
+static int g_got_end = 0;
+/* the most the transfer buffer held */
+static int g_most = 0;
+/* what the client got */
+static struct stream *g_sent = 0;
+static unsigned int g_seed = 3;
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+int
+XChangeProperty(Display *display, Window w, Atom property, Atom type,
+                int format, int mode, _Xconst unsigned char *data,
+                int nelements)
+{
+    if (type == g_incr_atom)
+    {
+        return 0;
+    }
+    if (nelements < 1)
+    {
+        g_got_end = 1;
+        return 0;
+    }
+    if (g_got_bytes + nelements > g_got_alloc)
+    {
+        g_got_alloc = (g_got_bytes + nelements) * 2;
+        g_got = (char *) realloc(g_got, g_got_alloc);
+    }
+    g_memcpy(g_got + g_got_bytes, data, nelements);
+    g_got_bytes += nelements;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+XSelectInput(Display *display, Window w, long event_mask)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+Status
+XSendEvent(Display *display, Window w, Bool propagate, long event_mask,
+           XEvent *event_send)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+int APP_CC
+send_channel_data_stream(int chan_id, struct stream *s)
+{
+    free_stream(g_sent);
+    g_sent = s;
+    return 0;
+}
+
+/*****************************************************************************/
+/* the clipboard calls these on paths this test does not take */
+int APP_CC
+send_channel_data(int chan_id, char *data, int size)
+{
+    return 0;
+}
+
+int APP_CC
+xcommon_init(void)
+{
+    return 0;
+}
+
+int APP_CC
+clipboard_c2s_in_files(struct stream *s, char *file_list)
+{
+    return 0;
+}
+
+int APP_CC
+clipboard_process_file_request(struct stream *s, int clip_msg_status,
+                               int clip_msg_len)
+{
+    return 0;
+}
+
+int APP_CC
+clipboard_process_file_response(struct stream *s, int clip_msg_status,
+                                int clip_msg_len)
+{
+    return 0;
+}
+
+int APP_CC
+clipboard_send_data_response_for_file(char *data, int data_size)
+{
+    return 0;
+}
+
+int APP_CC
+xfuse_init(void)
+{
+    return 0;
+}
+
+int APP_CC
+xfuse_deinit(void)
+{
+    return 0;
+}
+
+int APP_CC
+xfuse_clear_clip_dir(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+/* random code points, all planes but no nil or lone surrogates */
+static void
+make_codes(int *codes, int count)
+{
+    int index;
+    int code;
+
+    for (index = 0; index < count; index++)
+    {
+        switch (rnd() % 4)
+        {
+            case 0:
+                code = 1 + rnd() % 0x7f;
+                break;
+            case 1:
+                code = 0x80 + rnd() % 0x780;
+                break;
+            case 2:
+                code = 0x800 + rnd() % 0xf800;
+                if ((code >= 0xd800) && (code < 0xe000))
+                {
+                    code -= 0x800;
+                }
+                break;
+            default:
+                code = 0x10000 + rnd() % 0x100000;
+                break;
+        }
+        codes[index] = code;
+    }
+}
+
+/*****************************************************************************/
+/* returns bytes */
+static int
+to_utf16(const int *codes, int count, char *out)
+{
+    char *p;
+    int index;
+    int code;
+
+    p = out;
+    for (index = 0; index < count; index++)
+    {
+        code = codes[index];
+        if (code > 0xffff)
+        {
+            code -= 0x10000;
+            *(p++) = (0xd800 | (code >> 10)) & 0xff;
+            *(p++) = (0xd800 | (code >> 10)) >> 8;
+            *(p++) = (0xdc00 | (code & 0x3ff)) & 0xff;
+            *(p++) = (0xdc00 | (code & 0x3ff)) >> 8;
+        }
+        else
+        {
+            *(p++) = code & 0xff;
+            *(p++) = code >> 8;
+        }
+    }
+    return (int) (p - out);
+}
+
+/*****************************************************************************/
+/* UTF-8, or Latin-1 with ? for what it does not have, returns bytes */
+static int
+to_utf8(const int *codes, int count, int latin1, char *out)
+{
+    unsigned char *p;
+    int index;
+    int code;
+
+    p = (unsigned char *) out;
+    for (index = 0; index < count; index++)
+    {
+        code = codes[index];
+        if (latin1)
+        {
+            *(p++) = code < 0x100 ? code : '?';
+        }
+        else if (code < 0x80)
+        {
+            *(p++) = code;
+        }
+        else if (code < 0x800)
+        {
+            *(p++) = 0xc0 | (code >> 6);
+            *(p++) = 0x80 | (code & 0x3f);
+        }
+        else if (code < 0x10000)
+        {
+            *(p++) = 0xe0 | (code >> 12);
+            *(p++) = 0x80 | ((code >> 6) & 0x3f);
+            *(p++) = 0x80 | (code & 0x3f);
+        }
+        else
+        {
+            *(p++) = 0xf0 | (code >> 18);
+            *(p++) = 0x80 | ((code >> 12) & 0x3f);
+            *(p++) = 0x80 | ((code >> 6) & 0x3f);
+            *(p++) = 0x80 | (code & 0x3f);
+        }
+    }
+    return (int) ((char *) p - out);
+}
+
+/*****************************************************************************/
+/* a CLIPRDR_DATA_RESPONSE of data through clipboard_data_in in channel
+   chunks of up to max_chunk, the requestor takes each INCR piece as soon
+   as it is there */
+static void
+c2s_transfer(Atom target, const char *data, int bytes, int max_chunk)
+{
+    struct stream *s;
+    int total;
+    int offset;
+    int chunk;
+    int flags;
+
+    total = bytes + 8;
+    make_stream(s);
+    init_stream(s, total);
+    out_uint16_le(s, CB_FORMAT_DATA_RESPONSE);
+    out_uint16_le(s, CB_RESPONSE_OK);
+    out_uint32_le(s, bytes);
+    out_uint8a(s, data, bytes);
+    g_memset(&g_saved_selection_req_event, 0,
+             sizeof(g_saved_selection_req_event));
+    g_saved_selection_req_event.target = target;
+    g_saved_selection_req_event.property = g_clip_property_atom;
+    g_saved_selection_req_event.requestor = 1;
+    g_clip_c2s.in_request = 1;
+    g_got_bytes = 0;
+    g_got_end = 0;
+    offset = 0;
+    while (offset < total)
+    {
+        chunk = 1 + rnd() % max_chunk;
+        if (offset == 0)
+        {
+            /* a client puts the whole header in the first chunk */
+            chunk = chunk < 8 ? 8 : chunk;
+        }
+        if (chunk > total - offset)
+        {
+            chunk = total - offset;
+        }
+        flags = offset == 0 ? 1 : 0;
+        flags |= offset + chunk == total ? 2 : 0;
+        s->p = s->data + offset;
+        clipboard_data_in(s, g_cliprdr_chan_id, flags, chunk, total);
+        offset += chunk;
+        if (g_clip_c2s.data_alloc > g_most)
+        {
+            g_most = g_clip_c2s.data_alloc;
+        }
+        /* the requestor deletes the property after each piece */
+        while (g_clip_c2s.incr_in_progress)
+        {
+            clipboard_c2s_incr_send();
+        }
+    }
+    free_stream(s);
+}
+
+/*****************************************************************************/
+/* data through the INCR handlers in pieces of up to max_piece */
+static void
+s2c_transfer(Atom type, const char *data, int bytes, int max_piece)
+{
+    int offset;
+    int piece;
+
+    g_clip_s2c.type = type;
+    clipboard_s2c_incr_start(0);
+    offset = 0;
+    while (offset < bytes)
+    {
+        piece = 1 + rnd() % max_piece;
+        if (piece > bytes - offset)
+        {
+            piece = bytes - offset;
+        }
+        clipboard_s2c_incr_part((char *) data + offset, piece);
+        offset += piece;
+    }
+    clipboard_s2c_incr_end();
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+check_s2c(const char *name, const char *want, int want_bytes)
+{
+    struct stream *s;
+    int msg_type;
+    int status;
+    int len;
+
+    s = g_sent;
+    if (s == 0)
+    {
+        printf("%s: nothing sent\n", name);
+        return 1;
+    }
+    s->p = s->data;
+    in_uint16_le(s, msg_type);
+    in_uint16_le(s, status);
+    in_uint32_le(s, len);
+    if ((msg_type != CB_FORMAT_DATA_RESPONSE) || (status != CB_RESPONSE_OK) ||
+        (len != want_bytes) || (s->end - s->p != want_bytes + 4) ||
+        (g_memcmp(s->p, want, want_bytes) != 0))
+    {
+        printf("%s: response of %d bytes is not the %d wanted\n", name, len,
+               want_bytes);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const int chunks[] = { 1, 7, 1600, 65536 };
+    int *codes;
+    char *utf16;
+    char *utf8;
+    char *latin1;
+    char *bmp;
+    int utf16_bytes;
+    int utf8_bytes;
+    int latin1_bytes;
+    int bmp_bytes;
+    int errors;
+    int index;
+    int start;
+    int ms;
+    int count;
+
+    g_init("clipboard_test");
+    errors = 0;
+    g_utf8_atom = 100;
+    g_image_bmp_atom = 101;
+    g_incr_atom = 102;
+    g_clip_property_atom = 103;
+    g_incr_max_req_size = 64 * 1024;
+    g_clip_up = 1;
+    make_stream(g_ins);
+    codes = (int *) g_malloc(T_CHARS * sizeof(int), 0);
+    utf16 = (char *) g_malloc(T_CHARS * 4 + 2, 0);
+    utf8 = (char *) g_malloc(T_CHARS * 4, 0);
+    latin1 = (char *) g_malloc(T_CHARS, 0);
+    bmp = (char *) g_malloc(T_CHARS * 4 + 14, 0);
+    make_codes(codes, T_CHARS);
+    utf16_bytes = to_utf16(codes, T_CHARS, utf16);
+    utf16[utf16_bytes++] = 0;
+    utf16[utf16_bytes++] = 0;
+    utf8_bytes = to_utf8(codes, T_CHARS, 0, utf8);
+    latin1_bytes = to_utf8(codes, T_CHARS, 1, latin1);
+    g_memcpy(bmp, g_bmp_image_header, 14);
+    for (index = 14; index < T_CHARS * 4 + 14; index++)
+    {
+        bmp[index] = rnd();
+    }
+    bmp_bytes = T_CHARS * 4 + 14;
+
+    /* client to server, the chunk sizes split UTF-16 units and pairs */
+    for (index = 0; index < 4; index++)
+    {
+        g_most = 0;
+        c2s_transfer(g_utf8_atom, utf16, utf16_bytes, chunks[index]);
+        if (!g_got_end || (g_got_bytes != utf8_bytes) ||
+            (g_memcmp(g_got, utf8, utf8_bytes) != 0))
+        {
+            printf("c2s UTF8_STRING chunks to %d: %d bytes, %d wanted\n",
+                   chunks[index], g_got_bytes, utf8_bytes);
+            errors++;
+        }
+        c2s_transfer(XA_STRING, utf16, utf16_bytes, chunks[index]);
+        if (!g_got_end || (g_got_bytes != latin1_bytes) ||
+            (g_memcmp(g_got, latin1, latin1_bytes) != 0))
+        {
+            printf("c2s STRING chunks to %d: %d bytes, %d wanted\n",
+                   chunks[index], g_got_bytes, latin1_bytes);
+            errors++;
+        }
+        c2s_transfer(g_image_bmp_atom, bmp + 14, bmp_bytes - 14,
+                     chunks[index]);
+        if (!g_got_end || (g_got_bytes != bmp_bytes) ||
+            (g_memcmp(g_got, bmp, bmp_bytes) != 0))
+        {
+            printf("c2s image/bmp chunks to %d: %d bytes, %d wanted\n",
+                   chunks[index], g_got_bytes, bmp_bytes);
+            errors++;
+        }
+        printf("c2s chunks up to %5d: buffer at most %d KB for %d KB "
+               "transfers\n", chunks[index], g_most / 1024,
+               bmp_bytes / 1024);
+    }
+
+    /* server to client, the piece sizes split UTF-8 sequences */
+    for (index = 0; index < 4; index++)
+    {
+        s2c_transfer(g_utf8_atom, utf8, utf8_bytes, chunks[index]);
+        errors += check_s2c("s2c UTF8_STRING", utf16, utf16_bytes);
+        s2c_transfer(g_image_bmp_atom, bmp, bmp_bytes, chunks[index]);
+        errors += check_s2c("s2c image/bmp", bmp + 14, bmp_bytes - 14);
+    }
+    /* Latin-1 in, every byte is a char */
+    for (index = 0; index < latin1_bytes; index++)
+    {
+        codes[index] = (tui8) (latin1[index]);
+    }
+    utf16_bytes = to_utf16(codes, latin1_bytes, utf16);
+    utf16[utf16_bytes++] = 0;
+    utf16[utf16_bytes++] = 0;
+    s2c_transfer(XA_STRING, latin1, latin1_bytes, 1600);
+    errors += check_s2c("s2c STRING", utf16, utf16_bytes);
+
+    count = 0;
+    start = g_time3();
+    for (index = 0; index < T_RUNS; index++)
+    {
+        c2s_transfer(g_utf8_atom, utf16, utf16_bytes, 1600);
+        count += utf16_bytes;
+    }
+    ms = g_time3() - start;
+    printf("c2s UTF-16 to UTF-8 in 1600 byte chunks %6.0f MB/s\n",
+           ms < 1 ? 0 : count / 1000.0 / ms);
+    count = 0;
+    start = g_time3();
+    for (index = 0; index < T_RUNS; index++)
+    {
+        s2c_transfer(g_utf8_atom, utf8, utf8_bytes, 256 * 1024);
+        count += utf8_bytes;
+    }
+    ms = g_time3() - start;
+    printf("s2c UTF-8 to UTF-16 in INCR pieces to 256 KB %6.0f MB/s\n",
+           ms < 1 ? 0 : count / 1000.0 / ms);
+
+    free_stream(g_sent);
+    free_stream(g_ins);
+    free(g_got);
+    g_free(codes);
+    g_free(utf16);
+    g_free(utf8);
+    g_free(latin1);
+    g_free(bmp);
+    g_free(g_clip_c2s.data);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,513 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * throughput of .clipboard file reads against an emulated client
+ * a reader copies a file out of .clipboard with 128K FUSE reads, one at a
+ * time like cp, through xfuse_cb_read, the FileContentsRequests that
+ * clipboard_file.c sends go to an emulated client on a link with a round
+ * trip time and a bandwidth, in virtual time, the client answers the
+ * requests it has in random order, and a size request is outstanding
+ * beside the ranges, the first chunk fails once and the read waiting on
+ * it has to get EIO, the read again must work, every byte read is
+ * checked, then prints MB/s against one request at a time over the same
+ * link
+ *
+ * clipfile_bench [rtt ms] [link Mbit/s], 20 ms and 100 Mbit/s without them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* the read path and its lists are static, take the module in whole */
+#include "chansrv_fuse.c"
+
+#include <X11/Xlib.h>
+#include "clipboard_common.h"
+
+#define T_FILE_BYTES (64 * 1024 * 1024)
+#define T_READ_BYTES (128 * 1024)
+#define T_LINDEX 3
+#define T_SIZE_STREAM_ID 0x7fff0000
+#define T_FAIL_CHUNK 0
+#define T_MAX_MSGS 64
+
+/* a request on its way to the client, or a response on its way back */
+struct t_msg
+{
+    double time; /* when it gets to the other end, us */
+    int stream_id;
+    int type;
+    int offset;
+    int bytes;
+    int status;
+};
+
+int g_cliprdr_chan_id = 1;
+
+/* in clipboard_file.c */
+int APP_CC
+clipboard_request_file_size(int stream_id, int lindex);
+int APP_CC
+clipboard_process_file_response(struct stream *s, int clip_msg_status,
+                                int clip_msg_len);
+
+static double g_now = 0; /* virtual us */
+static double g_rtt = 20000;
+static double g_us_per_byte = 8.0 / 100;
+/* sent, not at the client yet */
+static struct t_msg g_to_client[T_MAX_MSGS];
+static int g_num_to_client = 0;
+/* at the client, waiting for the link */
+static struct t_msg g_at_client[T_MAX_MSGS];
+static int g_num_at_client = 0;
+/* on the link, done at time */
+static struct t_msg g_on_link;
+static int g_link_busy = 0;
+/* sent back, not at chansrv yet */
+static struct t_msg g_to_server[T_MAX_MSGS];
+static int g_num_to_server = 0;
+static int g_failed_once = 0;
+static int g_size_answered = 0;
+static int g_most_outstanding = 0;
+static int g_errors = 0;
+static unsigned int g_seed = 7;
+
+/* the FUSE read the reader is waiting on */
+struct fuse_req
+{
+    int done;
+    int err;
+    int off;
+    int bytes;
+};
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+static int
+pattern(int offset)
+{
+    return (offset ^ (offset >> 11) ^ (offset >> 19)) & 0xff;
+}
+
+/*****************************************************************************/
+int
+fuse_reply_buf(fuse_req_t req, const char *buf, size_t size)
+{
+    int index;
+
+    req->done = 1;
+    if ((int) size != req->bytes)
+    {
+        printf("read at %d: got %d bytes, wanted %d\n", req->off, (int) size,
+               req->bytes);
+        g_errors++;
+        return 0;
+    }
+    for (index = 0; index < (int) size; index++)
+    {
+        if ((buf[index] & 0xff) != pattern(req->off + index))
+        {
+            printf("read at %d: byte %d is wrong\n", req->off, index);
+            g_errors++;
+            break;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+fuse_reply_err(fuse_req_t req, int err)
+{
+    req->done = 1;
+    req->err = err;
+    return 0;
+}
+
+/*****************************************************************************/
+/* the rest of libfuse, devredir and the clipboard, on paths this bench
+   does not take */
+int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e)
+{ return 0; }
+int fuse_reply_attr(fuse_req_t req, const struct stat *attr,
+                    double attr_timeout)
+{ return 0; }
+int fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi)
+{ return 0; }
+int fuse_reply_write(fuse_req_t req, size_t count)
+{ return 0; }
+int fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *e,
+                      const struct fuse_file_info *fi)
+{ return 0; }
+size_t fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize,
+                         const char *name, const struct stat *stbuf,
+                         off_t off)
+{ return 0; }
+int fuse_parse_cmdline(struct fuse_args *args, char **mountpoint,
+                       int *multithreaded, int *foreground)
+{ return -1; }
+int fuse_opt_add_arg(struct fuse_args *args, const char *arg)
+{ return 0; }
+void fuse_opt_free_args(struct fuse_args *args)
+{ }
+struct fuse_chan *fuse_mount(const char *mountpoint, struct fuse_args *args)
+{ return 0; }
+void fuse_unmount(const char *mountpoint, struct fuse_chan *ch)
+{ }
+struct fuse_session *fuse_lowlevel_new(struct fuse_args *args,
+                                       const struct fuse_lowlevel_ops *op,
+                                       size_t op_size, void *userdata)
+{ return 0; }
+void fuse_session_add_chan(struct fuse_session *se, struct fuse_chan *ch)
+{ }
+void fuse_session_remove_chan(struct fuse_chan *ch)
+{ }
+void fuse_session_destroy(struct fuse_session *se)
+{ }
+void fuse_session_process(struct fuse_session *se, const char *buf,
+                          size_t len, struct fuse_chan *ch)
+{ }
+size_t fuse_chan_bufsize(struct fuse_chan *ch)
+{ return 0; }
+int fuse_chan_fd(struct fuse_chan *ch)
+{ return -1; }
+int fuse_chan_recv(struct fuse_chan **ch, char *buf, size_t size)
+{ return -1; }
+int dev_redir_get_dir_listing(void *fusep, tui32 device_id, char *path)
+{ return 0; }
+int dev_redir_file_open(void *fusep, tui32 device_id, char *path,
+                        int mode, int type, char *gen_buf)
+{ return 0; }
+int devredir_file_read(void *fusep, tui32 device_id, tui32 FileId,
+                       tui32 Length, tui64 Offset)
+{ return 0; }
+int dev_redir_file_write(void *fusep, tui32 device_id, tui32 FileId,
+                         const char *buf, tui32 Length, tui64 Offset)
+{ return 0; }
+int devredir_file_close(void *fusep, tui32 device_id, tui32 FileId)
+{ return 0; }
+int devredir_rmdir_or_file(void *fusep, tui32 device_id, char *path,
+                           int mode)
+{ return 0; }
+int APP_CC clipboard_out_unicode(struct stream *s, char *text, int num_chars)
+{ return 0; }
+int APP_CC clipboard_in_unicode(struct stream *s, char *text, int *num_chars)
+{ return 0; }
+
+/*****************************************************************************/
+/* the client end of the channel, takes the FileContentsRequest */
+int APP_CC
+send_channel_data(int chan_id, char *data, int size)
+{
+    struct stream ls;
+    struct stream *s;
+    struct t_msg *msg;
+    int msg_type;
+    int lindex;
+
+    s = &ls;
+    g_memset(s, 0, sizeof(struct stream));
+    s->data = data;
+    s->p = data;
+    s->end = data + size;
+    in_uint16_le(s, msg_type);
+    in_uint8s(s, 6);
+    if ((msg_type != CB_FILECONTENTS_REQUEST) ||
+        (g_num_to_client >= T_MAX_MSGS))
+    {
+        printf("unexpected message %d\n", msg_type);
+        g_errors++;
+        return 1;
+    }
+    msg = g_to_client + g_num_to_client;
+    g_num_to_client++;
+    in_uint32_le(s, msg->stream_id);
+    in_uint32_le(s, lindex);
+    in_uint32_le(s, msg->type);
+    in_uint32_le(s, msg->offset);
+    in_uint8s(s, 4);
+    in_uint32_le(s, msg->bytes);
+    msg->time = g_now + g_rtt / 2;
+    if (lindex != T_LINDEX)
+    {
+        printf("request for lindex %d\n", lindex);
+        g_errors++;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* the client sends one of the requests it has, any one */
+static void
+link_start(void)
+{
+    int index;
+
+    if (g_link_busy || (g_num_at_client < 1))
+    {
+        return;
+    }
+    index = rnd() % g_num_at_client;
+    g_on_link = g_at_client[index];
+    g_at_client[index] = g_at_client[g_num_at_client - 1];
+    g_num_at_client--;
+    g_on_link.status = CB_RESPONSE_OK;
+    if (g_on_link.type == CB_FILECONTENTS_SIZE)
+    {
+        g_on_link.bytes = 8;
+    }
+    else if ((g_on_link.offset == T_FAIL_CHUNK * CLIP_CHUNK_SIZE) &&
+             !g_failed_once)
+    {
+        g_failed_once = 1;
+        g_on_link.status = CB_RESPONSE_FAIL;
+        g_on_link.bytes = 0;
+    }
+    g_on_link.time = (g_now > g_on_link.time ? g_now : g_on_link.time) +
+                     (16 + g_on_link.bytes) * g_us_per_byte;
+    g_link_busy = 1;
+}
+
+/*****************************************************************************/
+/* a response gets to chansrv */
+static void
+deliver(struct t_msg *msg)
+{
+    struct stream *s;
+    int index;
+
+    make_stream(s);
+    init_stream(s, msg->bytes + 64);
+    out_uint32_le(s, msg->stream_id);
+    if (msg->type == CB_FILECONTENTS_SIZE)
+    {
+        out_uint32_le(s, T_FILE_BYTES);
+        out_uint32_le(s, 0);
+        g_size_answered = 1;
+    }
+    else
+    {
+        for (index = 0; index < msg->bytes; index++)
+        {
+            out_uint8(s, pattern(msg->offset + index));
+        }
+    }
+    s_mark_end(s);
+    s->p = s->data;
+    clipboard_process_file_response(s, msg->status,
+                                    (int) (s->end - s->data));
+    free_stream(s);
+}
+
+/*****************************************************************************/
+/* runs the next thing that happens, returns 0 when nothing is left */
+static int
+step(void)
+{
+    double next;
+    int which;
+    int index;
+    int found;
+    struct t_msg msg;
+
+    if (g_clip_range_list->count > g_most_outstanding)
+    {
+        g_most_outstanding = g_clip_range_list->count;
+    }
+    next = 0;
+    which = -1;
+    found = -1;
+    for (index = 0; index < g_num_to_client; index++)
+    {
+        if ((which < 0) || (g_to_client[index].time < next))
+        {
+            next = g_to_client[index].time;
+            which = 0;
+            found = index;
+        }
+    }
+    if (g_link_busy && ((which < 0) || (g_on_link.time < next)))
+    {
+        next = g_on_link.time;
+        which = 1;
+    }
+    for (index = 0; index < g_num_to_server; index++)
+    {
+        if ((which < 0) || (g_to_server[index].time < next))
+        {
+            next = g_to_server[index].time;
+            which = 2;
+            found = index;
+        }
+    }
+    if (which < 0)
+    {
+        return 0;
+    }
+    g_now = next;
+    if (which == 0)
+    {
+        g_at_client[g_num_at_client++] = g_to_client[found];
+        g_to_client[found] = g_to_client[--g_num_to_client];
+        link_start();
+    }
+    else if (which == 1)
+    {
+        g_link_busy = 0;
+        msg = g_on_link;
+        msg.time = g_now + g_rtt / 2;
+        g_to_server[g_num_to_server++] = msg;
+        link_start();
+    }
+    else
+    {
+        msg = g_to_server[found];
+        g_to_server[found] = g_to_server[--g_num_to_server];
+        deliver(&msg);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static int
+time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    XRDP_INODE *xinode;
+    XFUSE_HANDLE fh;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    double one_at_a_time;
+    double mb;
+    int off;
+    int eio;
+    int start;
+    int cpu_us;
+
+    g_init("clipfile_bench");
+    if (argc > 1)
+    {
+        g_rtt = atoi(argv[1]) * 1000.0;
+    }
+    if (argc > 2)
+    {
+        g_us_per_byte = 8.0 / atoi(argv[2]);
+    }
+    g_create_dir("/tmp/.xrdp");
+    xfuse_init_xrdp_fs();
+    g_req_list = list_create();
+    g_req_list->auto_free = 1;
+    g_clip_range_list = list_create();
+    g_clip_range_list->auto_free = 1;
+    g_clip_spool_list = list_create();
+    xfuse_add_clip_dir_item("big.bin", 0, T_FILE_BYTES, T_LINDEX);
+    xinode = xfuse_get_inode_from_pinode_name(2, "big.bin");
+    g_memset(&fh, 0, sizeof(fh));
+    fh.is_loc_resource = 1;
+    g_memset(&fi, 0, sizeof(fi));
+    fi.fh = (unsigned long) &fh;
+
+    eio = 0;
+    start = time_us();
+    off = 0;
+    while (off < T_FILE_BYTES)
+    {
+        g_memset(&req, 0, sizeof(req));
+        req.off = off;
+        req.bytes = min(T_READ_BYTES, T_FILE_BYTES - off);
+        xfuse_cb_read(&req, xinode->inode, T_READ_BYTES, off, &fi);
+        if (off == 0)
+        {
+            /* asked for while the first ranges are outstanding */
+            clipboard_request_file_size(T_SIZE_STREAM_ID, T_LINDEX);
+        }
+        while (!req.done)
+        {
+            if (!step())
+            {
+                printf("read at %d never finished\n", off);
+                g_errors++;
+                break;
+            }
+        }
+        if (!req.done)
+        {
+            break;
+        }
+        if (req.err != 0)
+        {
+            /* the failed chunk, read it again */
+            eio++;
+            continue;
+        }
+        off += req.bytes;
+    }
+    while (step())
+    {
+    }
+    cpu_us = time_us() - start;
+
+    if (eio != 1)
+    {
+        printf("%d reads got EIO, wanted 1\n", eio);
+        g_errors++;
+    }
+    if (!g_size_answered)
+    {
+        printf("the size request was not answered\n");
+        g_errors++;
+    }
+    if (g_clip_range_list->count != 0)
+    {
+        printf("%d range requests left\n", g_clip_range_list->count);
+        g_errors++;
+    }
+
+    mb = T_FILE_BYTES / (1024.0 * 1024.0);
+    one_at_a_time = (T_FILE_BYTES / T_READ_BYTES) *
+                    (g_rtt + (16 + T_READ_BYTES) * g_us_per_byte);
+    printf("%d MB, rtt %.0f ms, link %.0f Mbit/s, at most %d requests out\n",
+           T_FILE_BYTES / (1024 * 1024), g_rtt / 1000, 8 / g_us_per_byte,
+           g_most_outstanding);
+    printf("one request a read %7.1f MB/s\n", mb * 1000000 / one_at_a_time);
+    printf("pipelined          %7.1f MB/s\n", mb * 1000000 / g_now);
+    printf("chansrv side %d ms of cpu, %.0f MB/s\n", cpu_us / 1000,
+           cpu_us < 1 ? 0 : mb * 1000000 / cpu_us);
+
+    xfuse_clip_delete_spools();
+    g_deinit();
+    printf("%s\n", g_errors == 0 ? "ok" : "FAILED");
+    return g_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * the part of the libfuse 2.x low level api chansrv_fuse.c uses, so
+ * clipfile_bench can build it without libfuse, the bench is the kernel
+ * side and gives the fuse_reply_ calls, the rest are never called
+ */
+
+#ifndef _FUSE_LOWLEVEL_H_
+#define _FUSE_LOWLEVEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct fuse_req *fuse_req_t;
+typedef unsigned long fuse_ino_t;
+
+struct fuse_chan;
+struct fuse_session;
+
+struct fuse_args
+{
+    int argc;
+    char **argv;
+    int allocated;
+};
+
+#define FUSE_ARGS_INIT(argc, argv) { argc, argv, 0 }
+
+struct fuse_file_info
+{
+    int flags;
+    unsigned long fh_old;
+    int writepage;
+    unsigned int direct_io : 1;
+    unsigned int keep_cache : 1;
+    unsigned int flush : 1;
+    unsigned int nonseekable : 1;
+    unsigned int padding : 28;
+    unsigned long fh;
+    unsigned long lock_owner;
+};
+
+struct fuse_entry_param
+{
+    fuse_ino_t ino;
+    unsigned long generation;
+    struct stat attr;
+    double attr_timeout;
+    double entry_timeout;
+};
+
+struct fuse_lowlevel_ops
+{
+    void *lookup;
+    void *getattr;
+    void *setattr;
+    void *mkdir;
+    void *unlink;
+    void *rmdir;
+    void *rename;
+    void *open;
+    void *read;
+    void *write;
+    void *fsync;
+    void *opendir;
+    void *readdir;
+    void *releasedir;
+    void *release;
+    void *create;
+};
+
+#define FUSE_SET_ATTR_MODE      (1 << 0)
+#define FUSE_SET_ATTR_UID       (1 << 1)
+#define FUSE_SET_ATTR_GID       (1 << 2)
+#define FUSE_SET_ATTR_SIZE      (1 << 3)
+#define FUSE_SET_ATTR_ATIME     (1 << 4)
+#define FUSE_SET_ATTR_MTIME     (1 << 5)
+#define FUSE_SET_ATTR_ATIME_NOW (1 << 7)
+#define FUSE_SET_ATTR_MTIME_NOW (1 << 8)
+
+int fuse_reply_err(fuse_req_t req, int err);
+int fuse_reply_buf(fuse_req_t req, const char *buf, size_t size);
+int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e);
+int fuse_reply_attr(fuse_req_t req, const struct stat *attr,
+                    double attr_timeout);
+int fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi);
+int fuse_reply_write(fuse_req_t req, size_t count);
+int fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *e,
+                      const struct fuse_file_info *fi);
+size_t fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize,
+                         const char *name, const struct stat *stbuf,
+                         off_t off);
+
+int fuse_parse_cmdline(struct fuse_args *args, char **mountpoint,
+                       int *multithreaded, int *foreground);
+int fuse_opt_add_arg(struct fuse_args *args, const char *arg);
+void fuse_opt_free_args(struct fuse_args *args);
+struct fuse_chan *fuse_mount(const char *mountpoint, struct fuse_args *args);
+void fuse_unmount(const char *mountpoint, struct fuse_chan *ch);
+struct fuse_session *fuse_lowlevel_new(struct fuse_args *args,
+                                       const struct fuse_lowlevel_ops *op,
+                                       size_t op_size, void *userdata);
+void fuse_session_add_chan(struct fuse_session *se, struct fuse_chan *ch);
+void fuse_session_remove_chan(struct fuse_chan *ch);
+void fuse_session_destroy(struct fuse_session *se);
+void fuse_session_process(struct fuse_session *se, const char *buf,
+                          size_t len, struct fuse_chan *ch);
+size_t fuse_chan_bufsize(struct fuse_chan *ch);
+int fuse_chan_fd(struct fuse_chan *ch);
+int fuse_chan_recv(struct fuse_chan **ch, char *buf, size_t size);
+
+#endif
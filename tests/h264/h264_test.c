@@ -0,0 +1,491 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * headless check of the h264 stage in xrdp/xrdp_encoder.c
+ * NV12 frames from a fixture file go through process_enc_h264 with no
+ * session, the output is checked for the AVC420 metablock, Annex B NAL
+ * units, one IDR at the start, a qp in range, frame sizes kept near the
+ * VBV budget and a lost frame turning into an intra refresh, then the
+ * bitstream is decoded with ffmpeg and compared against the fixture
+ *
+ * h264_test <fixture.nv12> <width> <height> [ffmpeg]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* process_enc_h264 is static, take the encoder in whole */
+#include "xrdp_encoder.c"
+
+/* every frame is at least this close to the fixture, the stream is
+   rate limited so this is well below what the encoder can do, the first
+   IDR has to fit one frame of VBV and comes out coarse, the frames after
+   it sharpen it so the first T_SETTLE frames are only checked for the
+   average */
+#define T_MIN_PSNR 28.0
+#define T_MIN_AVG_PSNR 38.0
+#define T_SETTLE 8
+#define T_STREAM "h264_test.264"
+
+static int g_width;
+static int g_height;
+
+/*****************************************************************************/
+/* from xrdp.c, proc_enc_msg is not run here */
+tbus APP_CC
+g_get_term_event(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+/* the jpeg stage is not used here */
+void *DEFAULT_CC
+libxrdp_codec_jpeg_create(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_codec_jpeg_delete(void *handle)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_codec_jpeg_compress_handle(void *handle, int format, char *inp_data,
+                                   int width, int height, int stride,
+                                   int x, int y, int cx, int cy, int quality,
+                                   int flags, char *out_data, int *io_len)
+{
+    *io_len = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_codec_jpeg_buf_size(int cx, int cy)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+rd16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/*****************************************************************************/
+static int
+rd32(const unsigned char *p)
+{
+    return rd16(p) | (rd16(p + 2) << 16);
+}
+
+/*****************************************************************************/
+/* checks one RDPGFX_AVC420_METABLOCK and its bitstream, counts the NAL
+   types in nal_counts, returns error */
+static int
+check_frame(const unsigned char *p, int bytes, int *qp, int *nal_counts)
+{
+    const unsigned char *end;
+    int count;
+    int index;
+    int type;
+
+    end = p + bytes;
+    if (bytes < 4 + 8 + 2 + 4)
+    {
+        printf("frame too short, %d bytes\n", bytes);
+        return 1;
+    }
+    count = rd32(p);
+    if (count != 1)
+    {
+        printf("numRegionRects %d, wanted 1\n", count);
+        return 1;
+    }
+    if ((rd16(p + 4) != 0) || (rd16(p + 6) != 0) ||
+        (rd16(p + 8) != g_width) || (rd16(p + 10) != g_height))
+    {
+        printf("region rect %d %d %d %d\n", rd16(p + 4), rd16(p + 6),
+               rd16(p + 8), rd16(p + 10));
+        return 1;
+    }
+    *qp = p[12];
+    if ((*qp & 0x80) || (*qp > 51) || (p[13] != 100))
+    {
+        printf("qp %d quality %d\n", *qp, p[13]);
+        return 1;
+    }
+    p += 14;
+    if ((p[0] != 0) || (p[1] != 0) ||
+        ((p[2] != 1) && ((p[2] != 0) || (p[3] != 1))))
+    {
+        printf("bitstream does not start with a start code\n");
+        return 1;
+    }
+    for (index = 0; index + 3 < (int) (end - p); index++)
+    {
+        if ((p[index] == 0) && (p[index + 1] == 0) && (p[index + 2] == 1))
+        {
+            type = p[index + 3] & 0x1f;
+            nal_counts[type]++;
+            index += 3;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* one frame through the stage, returns the done item or nil */
+static XRDP_ENC_DATA_DONE *
+encode_one(struct xrdp_encoder *self, char *data)
+{
+    XRDP_ENC_DATA *enc;
+
+    enc = (XRDP_ENC_DATA *) g_malloc(sizeof(XRDP_ENC_DATA), 1);
+    enc->num_drects = 1;
+    enc->drects = (short *) g_malloc(sizeof(short) * 4, 0);
+    enc->drects[0] = 0;
+    enc->drects[1] = 0;
+    enc->drects[2] = g_width;
+    enc->drects[3] = g_height;
+    enc->num_crects = 1;
+    enc->crects = (short *) g_malloc(sizeof(short) * 4, 0);
+    g_memcpy(enc->crects, enc->drects, sizeof(short) * 4);
+    enc->data = data;
+    enc->width = g_width;
+    enc->height = g_height;
+    process_enc_h264(self, enc);
+    return (XRDP_ENC_DATA_DONE *) fifo_remove_item(self->fifo_processed);
+}
+
+/*****************************************************************************/
+static void
+free_done(XRDP_ENC_DATA_DONE *done)
+{
+    g_free(done->enc->drects);
+    g_free(done->enc->crects);
+    g_free(done->enc);
+    g_free(done->comp_pad_data);
+    g_free(done);
+}
+
+/*****************************************************************************/
+/* whole file in memory, returns bytes or -1 */
+static int
+read_file(const char *name, char **data)
+{
+    int fd;
+    int bytes;
+    int got;
+
+    bytes = g_file_get_size(name);
+    if (bytes < 1)
+    {
+        return -1;
+    }
+    fd = g_file_open_ex(name, 1, 0, 0, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    *data = (char *) g_malloc(bytes, 0);
+    got = g_file_read(fd, *data, bytes);
+    g_file_close(fd);
+    return got == bytes ? bytes : -1;
+}
+
+/*****************************************************************************/
+/* psnr of one plane in dB, 99 when equal */
+static double
+psnr(const unsigned char *a, const unsigned char *b, int bytes)
+{
+    double sse;
+    int index;
+    int d;
+
+    sse = 0;
+    for (index = 0; index < bytes; index++)
+    {
+        d = a[index] - b[index];
+        sse += d * d;
+    }
+    if (sse == 0)
+    {
+        return 99;
+    }
+    return 10 * log10(255.0 * 255.0 * bytes / sse);
+}
+
+/*****************************************************************************/
+/* decodes the stream with ffmpeg and compares each frame with the
+   fixture, returns error */
+static int
+check_decoded(const char *ffmpeg, const char *fixture, int frames)
+{
+    char cmd[1024];
+    char *data;
+    char *dec;
+    FILE *pipe;
+    int frame_size;
+    int frame;
+    int errors;
+    double y;
+    double uv;
+    double y_min;
+    double uv_min;
+    double y_sum;
+
+    if (read_file(fixture, &data) < 0)
+    {
+        return 1;
+    }
+    frame_size = g_width * g_height * 3 / 2;
+    g_snprintf(cmd, sizeof(cmd), "%s -loglevel error -f h264 -i %s "
+               "-fps_mode passthrough -f rawvideo -pix_fmt nv12 -",
+               ffmpeg, T_STREAM);
+    pipe = popen(cmd, "r");
+    if (pipe == 0)
+    {
+        printf("can not run %s\n", ffmpeg);
+        g_free(data);
+        return 1;
+    }
+    dec = (char *) g_malloc(frame_size, 0);
+    errors = 0;
+    y_min = 99;
+    uv_min = 99;
+    y_sum = 0;
+    for (frame = 0; frame < frames; frame++)
+    {
+        if (fread(dec, 1, frame_size, pipe) != frame_size)
+        {
+            printf("decoder gave %d frames, wanted %d\n", frame, frames);
+            errors++;
+            break;
+        }
+        y = psnr((unsigned char *) (data + frame * frame_size),
+                 (unsigned char *) dec, g_width * g_height);
+        uv = psnr((unsigned char *) (data + frame * frame_size +
+                                     g_width * g_height),
+                  (unsigned char *) (dec + g_width * g_height),
+                  g_width * g_height / 2);
+        y_sum += y;
+        if (frame < T_SETTLE)
+        {
+            continue;
+        }
+        if ((y < T_MIN_PSNR) || (uv < T_MIN_PSNR))
+        {
+            printf("frame %d: psnr y %.1f uv %.1f\n", frame, y, uv);
+            errors++;
+        }
+        y_min = MIN(y_min, y);
+        uv_min = MIN(uv_min, uv);
+    }
+    if ((errors == 0) && (fread(dec, 1, frame_size, pipe) > 0))
+    {
+        printf("decoder gave more than %d frames\n", frames);
+        errors++;
+    }
+    if (pclose(pipe) != 0)
+    {
+        printf("%s failed\n", ffmpeg);
+        errors++;
+    }
+    printf("decoded psnr y min %.1f avg %.1f uv min %.1f\n", y_min,
+           y_sum / MAX(frame, 1), uv_min);
+    if ((errors == 0) && (y_sum / frames < T_MIN_AVG_PSNR))
+    {
+        printf("average psnr below %.1f\n", T_MIN_AVG_PSNR);
+        errors++;
+    }
+    g_free(dec);
+    g_free(data);
+    return errors;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct xrdp_client_info client_info;
+    struct xrdp_wm wm;
+    struct xrdp_mm mm;
+    struct xrdp_encoder encoder;
+    XRDP_ENC_DATA_DONE *done;
+    char *fixture;
+    char *data;
+    int nal_counts[32];
+    int first_counts[32];
+    int frame_size;
+    int frames;
+    int frame;
+    int qp;
+    int qp_min;
+    int qp_max;
+    int bytes;
+    int max_bytes;
+    int total_bytes;
+    int errors;
+    int fd;
+
+    if (argc < 4)
+    {
+        printf("usage: h264_test <fixture.nv12> <width> <height> "
+               "[ffmpeg]\n");
+        return 1;
+    }
+    g_init("h264_test");
+    g_width = g_atoi(argv[2]);
+    g_height = g_atoi(argv[3]);
+    frame_size = g_width * g_height * 3 / 2;
+    bytes = read_file(argv[1], &fixture);
+    if ((frame_size < 1) || (bytes < frame_size) || (bytes % frame_size))
+    {
+        printf("%s is not NV12 %dx%d\n", argv[1], g_width, g_height);
+        return 1;
+    }
+    frames = bytes / frame_size;
+    g_memset(&client_info, 0, sizeof(client_info));
+    g_memset(&wm, 0, sizeof(wm));
+    g_memset(&mm, 0, sizeof(mm));
+    g_memset(&encoder, 0, sizeof(encoder));
+    wm.client_info = &client_info;
+    mm.wm = &wm;
+    encoder.mm = &mm;
+    encoder.mutex = tc_mutex_create();
+    encoder.fifo_processed = fifo_create();
+    encoder.xrdp_encoder_event_processed = g_create_wait_obj("h264_test");
+    /* the stage does not own the frame, give it a copy like the module
+       shared memory */
+    data = (char *) g_malloc(frame_size, 0);
+    g_file_delete(T_STREAM);
+    fd = g_file_open_ex(T_STREAM, 0, 1, 1, 1);
+
+    errors = 0;
+    qp_min = 52;
+    qp_max = -1;
+    max_bytes = 0;
+    total_bytes = 0;
+    g_memset(nal_counts, 0, sizeof(nal_counts));
+    g_memset(first_counts, 0, sizeof(first_counts));
+    for (frame = 0; frame < frames; frame++)
+    {
+        g_memcpy(data, fixture + frame * frame_size, frame_size);
+        if (frame == frames / 2)
+        {
+            /* what xrdp_mm does when a surface command fails */
+            encoder.frame_lost = 1;
+        }
+        done = encode_one(&encoder, data);
+        if (done == 0)
+        {
+            printf("frame %d: nothing back\n", frame);
+            errors++;
+            break;
+        }
+        if (frame == frames / 2)
+        {
+            if (encoder.frame_lost != 0)
+            {
+                printf("frame %d: frame_lost not taken\n", frame);
+                errors++;
+            }
+        }
+        bytes = done->comp_bytes;
+        if ((bytes < 1) || (done->pad_bytes != XRDP_H264_PAD) ||
+            (done->last != 1))
+        {
+            printf("frame %d: bytes %d pad %d last %d\n", frame, bytes,
+                   done->pad_bytes, done->last);
+            errors++;
+        }
+        else if (check_frame((unsigned char *) done->comp_pad_data +
+                             done->pad_bytes, bytes, &qp,
+                             frame == 0 ? first_counts : nal_counts) != 0)
+        {
+            printf("frame %d: bad\n", frame);
+            errors++;
+        }
+        else
+        {
+            qp_min = MIN(qp_min, qp);
+            qp_max = MAX(qp_max, qp);
+            total_bytes += bytes;
+            if (frame > 0)
+            {
+                max_bytes = MAX(max_bytes, bytes);
+            }
+            /* the bitstream after the metablock header */
+            g_file_write(fd, done->comp_pad_data + done->pad_bytes + 14,
+                         bytes - 14);
+        }
+        free_done(done);
+    }
+    g_file_close(fd);
+
+    printf("frames %d bytes %d max %d qp %d..%d\n", frames, total_bytes,
+           max_bytes, qp_min, qp_max);
+    /* SPS, PPS and one IDR up front, then no IDR, intra refresh only */
+    if ((first_counts[7] < 1) || (first_counts[8] < 1) ||
+        (first_counts[5] < 1))
+    {
+        printf("first frame: sps %d pps %d idr %d\n", first_counts[7],
+               first_counts[8], first_counts[5]);
+        errors++;
+    }
+    if (nal_counts[5] != 0)
+    {
+        printf("%d IDR slices after the first frame\n", nal_counts[5]);
+        errors++;
+    }
+    /* qp comes from i_qpplus1 and the picture is not trivial */
+    if ((qp_min < 1) || (qp_max > 51))
+    {
+        printf("qp %d..%d out of range\n", qp_min, qp_max);
+        errors++;
+    }
+    /* VBV holds a frame near the average, allow headers and slack */
+    if (max_bytes > 4 * total_bytes / frames + 2048)
+    {
+        printf("largest frame %d, average %d\n", max_bytes,
+               total_bytes / frames);
+        errors++;
+    }
+    if ((errors == 0) && (argc > 4))
+    {
+        errors += check_decoded(argv[4], argv[1], frames);
+    }
+
+    xrdp_enc_h264_delete((struct xrdp_enc_h264 *) (encoder.codec_handle));
+    g_free(data);
+    g_free(fixture);
+    fifo_delete(encoder.fifo_processed);
+    tc_mutex_delete(encoder.mutex);
+    g_delete_wait_obj(encoder.xrdp_encoder_event_processed);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
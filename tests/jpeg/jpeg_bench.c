@@ -0,0 +1,561 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of the jpeg stage in xrdp/xrdp_encoder.c
+ * a frame, captured or a synthetic desktop with text on the left and a
+ * photo on the right, is cut in tiles and compressed at session quality
+ * one tile after the other, with a compressor made per tile as before and
+ * with one kept, then through process_enc_jpg with its workers and text
+ * quality, prints MPix/s, bytes and PSNR of text and photo tiles for each,
+ * and checks libxrdp_codec_jpeg_buf_size is enough for any rect
+ *
+ * jpeg_bench [width height file], file is raw a8b8g8r8 as xrdp gets it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <jpeglib.h>
+
+/* process_enc_jpg is static, take the encoder in whole */
+#include "xrdp_encoder.c"
+#include "libxrdp.h"
+
+#define T_WIDTH 1024
+#define T_HEIGHT 768
+#define T_TILE 64
+#define T_QUALITY 75 /* what mstsc asks for by default */
+#define T_LOOPS 10
+
+/* totals for one way of compressing a frame */
+struct bench_result
+{
+    int ms;
+    int bytes;
+    double text_err; /* squared error sums */
+    int text_pixels;
+    double photo_err;
+    int photo_pixels;
+};
+
+/*****************************************************************************/
+/* from xrdp.c, proc_enc_msg is not run here */
+tbus APP_CC
+g_get_term_event(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+/* libxrdp.c wrappers, the bench links xrdp_jpeg_compress.c alone */
+void *DEFAULT_CC
+libxrdp_codec_jpeg_create(void)
+{
+    return xrdp_jpeg_init();
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_codec_jpeg_delete(void *handle)
+{
+    return xrdp_jpeg_deinit(handle);
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_codec_jpeg_compress_handle(void *handle, int format, char *inp_data,
+                                   int width, int height, int stride,
+                                   int x, int y, int cx, int cy, int quality,
+                                   int flags, char *out_data, int *io_len)
+{
+    return xrdp_codec_jpeg_compress(handle, format, inp_data, width, height,
+                                    stride, x, y, cx, cy, quality, flags,
+                                    out_data, io_len);
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_codec_jpeg_buf_size(int cx, int cy)
+{
+    return xrdp_codec_jpeg_buf_size(cx, cy);
+}
+
+/*****************************************************************************/
+static void
+put_pixel(char *data, int x, int y, int r, int g, int b)
+{
+    unsigned char *p;
+
+    p = (unsigned char *) data + (y * T_WIDTH + x) * 4;
+    p[0] = 0xff;
+    p[1] = b;
+    p[2] = g;
+    p[3] = r;
+}
+
+/*****************************************************************************/
+/* white page with lines of glyph like strokes on the left, a smooth noisy
+   picture on the right */
+static void
+make_frame(char *data)
+{
+    int x;
+    int y;
+    int v;
+    int seed;
+
+    seed = 1;
+    for (y = 0; y < T_HEIGHT; y++)
+    {
+        for (x = 0; x < T_WIDTH / 2; x++)
+        {
+            put_pixel(data, x, y, 255, 255, 255);
+            /* 8x14 cells, a 10 pixel tall line of strokes in each */
+            if ((y % 14 >= 2) && (y % 14 < 12) && (x % 8 < 6))
+            {
+                v = ((x / 8) * 31 + (y / 14) * 17 + (y % 14) * 5 + x % 8);
+                if ((v * 2654435761u) >> 29 == 0)
+                {
+                    put_pixel(data, x, y, 0, 0, 0);
+                }
+            }
+        }
+        for (x = T_WIDTH / 2; x < T_WIDTH; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            v = (seed >> 16) & 15;
+            put_pixel(data, x, y,
+                      (int) (128 + 100 * sin(x / 37.0) * cos(y / 53.0)) + v,
+                      (int) (110 + 90 * sin((x + y) / 71.0)) + v,
+                      (int) (100 + 80 * cos(x / 23.0 - y / 41.0)) + v);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* decodes one jpeg and adds the squared error against the tile to res */
+static int
+add_error(struct bench_result *res, const char *data, int width,
+          int x, int y, int cx, int cy, const char *jpg, int jpg_bytes)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *row;
+    const unsigned char *src;
+    JSAMPROW rows[1];
+    double err;
+    int d;
+    int index;
+    int text;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *) jpg, jpg_bytes);
+    jpeg_read_header(&cinfo, 1);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    if ((cinfo.output_width != cx) || (cinfo.output_height != cy))
+    {
+        printf("tile %d %d decodes to %dx%d\n", x, y, cinfo.output_width,
+               cinfo.output_height);
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
+    }
+    row = (unsigned char *) g_malloc(cx * 3, 0);
+    rows[0] = row;
+    err = 0;
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        src = (const unsigned char *) data +
+              ((y + cinfo.output_scanline) * width + x) * 4;
+        jpeg_read_scanlines(&cinfo, rows, 1);
+        for (index = 0; index < cx; index++)
+        {
+            d = row[index * 3 + 0] - src[index * 4 + 3];
+            err += d * d;
+            d = row[index * 3 + 1] - src[index * 4 + 2];
+            err += d * d;
+            d = row[index * 3 + 2] - src[index * 4 + 1];
+            err += d * d;
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    g_free(row);
+    text = xrdp_enc_jpg_is_text(data, width * 4, x, y, cx, cy);
+    if (text)
+    {
+        res->text_err += err;
+        res->text_pixels += cx * cy;
+    }
+    else
+    {
+        res->photo_err += err;
+        res->photo_pixels += cx * cy;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static double
+psnr(double err, int pixels)
+{
+    if (pixels < 1)
+    {
+        return 0;
+    }
+    if (err <= 0)
+    {
+        return 99;
+    }
+    return 10 * log10(255.0 * 255.0 * pixels * 3 / err);
+}
+
+/*****************************************************************************/
+static void
+print_result(const char *name, struct bench_result *res, int pixels)
+{
+    printf("%-10s %7.1f MPix/s %8d bytes/frame  text %5.2f dB  "
+           "photo %5.2f dB\n", name,
+           res->ms < 1 ? 0 : (double) pixels * T_LOOPS / res->ms / 1000,
+           res->bytes, psnr(res->text_err, res->text_pixels),
+           psnr(res->photo_err, res->photo_pixels));
+}
+
+/*****************************************************************************/
+/* session quality, one tile at a time, a compressor made for every tile
+   as before or one kept for all */
+static int
+bench_serial(struct bench_result *res, XRDP_ENC_DATA *enc, int keep)
+{
+    void *han;
+    char *buf;
+    int loop;
+    int index;
+    int bytes;
+    int start;
+    const short *r;
+
+    g_memset(res, 0, sizeof(struct bench_result));
+    buf = (char *) g_malloc(xrdp_codec_jpeg_buf_size(T_TILE, T_TILE), 0);
+    han = keep ? xrdp_jpeg_init() : 0;
+    start = g_time3();
+    for (loop = 0; loop < T_LOOPS; loop++)
+    {
+        for (index = 0; index < enc->num_crects; index++)
+        {
+            r = enc->crects + index * 4;
+            if (!keep)
+            {
+                han = xrdp_jpeg_init();
+            }
+            bytes = xrdp_codec_jpeg_buf_size(r[2], r[3]);
+            xrdp_codec_jpeg_compress(han, 0, enc->data, enc->width,
+                                     enc->height, enc->width * 4,
+                                     r[0], r[1], r[2], r[3], T_QUALITY, 0,
+                                     buf, &bytes);
+            if (!keep)
+            {
+                xrdp_jpeg_deinit(han);
+                han = 0;
+            }
+            if (bytes < 1)
+            {
+                printf("serial: tile %d failed\n", index);
+                xrdp_jpeg_deinit(han);
+                g_free(buf);
+                return 1;
+            }
+            if (loop == 0)
+            {
+                res->bytes += bytes;
+                if (add_error(res, enc->data, enc->width, r[0], r[1],
+                              r[2], r[3], buf, bytes) != 0)
+                {
+                    xrdp_jpeg_deinit(han);
+                    g_free(buf);
+                    return 1;
+                }
+            }
+        }
+    }
+    res->ms = g_time3() - start;
+    xrdp_jpeg_deinit(han);
+    g_free(buf);
+    return 0;
+}
+
+/*****************************************************************************/
+/* the encoder stage, done items come back in crect order */
+static int
+bench_new(struct bench_result *res, struct xrdp_encoder *self,
+          XRDP_ENC_DATA *enc)
+{
+    XRDP_ENC_DATA_DONE *done;
+    int loop;
+    int index;
+    int start;
+    int ms;
+    int error;
+
+    g_memset(res, 0, sizeof(struct bench_result));
+    error = 0;
+    ms = 0;
+    for (loop = 0; loop < T_LOOPS; loop++)
+    {
+        start = g_time3();
+        process_enc_jpg(self, enc);
+        ms += g_time3() - start;
+        index = 0;
+        while (!fifo_is_empty(self->fifo_processed))
+        {
+            done = (XRDP_ENC_DATA_DONE *)
+                   fifo_remove_item(self->fifo_processed);
+            if ((done->x != enc->crects[index * 4 + 0]) ||
+                (done->y != enc->crects[index * 4 + 1]) ||
+                (done->last != (index == enc->num_crects - 1)))
+            {
+                printf("new: tile %d out of order\n", index);
+                error = 1;
+            }
+            else if (loop == 0)
+            {
+                res->bytes += done->comp_bytes - 2;
+                error |= add_error(res, enc->data, enc->width,
+                                   done->x, done->y, done->cx, done->cy,
+                                   done->comp_pad_data + done->pad_bytes + 2,
+                                   done->comp_bytes - 2);
+            }
+            g_free(done->comp_pad_data);
+            g_free(done);
+            index++;
+        }
+        if (index != enc->num_crects)
+        {
+            printf("new: %d of %d tiles back\n", index, enc->num_crects);
+            error = 1;
+        }
+        if (error)
+        {
+            return 1;
+        }
+    }
+    res->ms = ms;
+    return 0;
+}
+
+/*****************************************************************************/
+/* noise is the worst case, every rect up to 80 wide and a few tall and
+   thin ones at top quality both ways must fit */
+static int
+check_buf_size(void)
+{
+    char *data;
+    char *buf;
+    void *han;
+    int *p;
+    int cx;
+    int cy;
+    int flags;
+    int bytes;
+    int limit;
+    int errors;
+    int index;
+
+    data = (char *) g_malloc(T_WIDTH * T_HEIGHT * 4, 0);
+    p = (int *) data;
+    for (index = 0; index < T_WIDTH * T_HEIGHT; index++)
+    {
+        p[index] = rand();
+    }
+    limit = xrdp_codec_jpeg_buf_size(T_WIDTH, T_HEIGHT);
+    buf = (char *) g_malloc(limit, 0);
+    han = xrdp_jpeg_init();
+    errors = 0;
+    for (cx = 1; cx <= 80; cx++)
+    {
+        for (cy = 1; cy <= 80; cy += (cy < 20) ? 1 : 7)
+        {
+            for (flags = 0; flags <= XRDP_JPEG_FLAG_444;
+                 flags += XRDP_JPEG_FLAG_444)
+            {
+                bytes = xrdp_codec_jpeg_buf_size(cx, cy);
+                xrdp_codec_jpeg_compress(han, 0, data, T_WIDTH, T_HEIGHT,
+                                         T_WIDTH * 4, 0, 0, cx, cy, 100,
+                                         flags, buf, &bytes);
+                if (bytes < 1)
+                {
+                    printf("buf size: %dx%d flags %d does not fit in %d\n",
+                           cx, cy, flags, xrdp_codec_jpeg_buf_size(cx, cy));
+                    errors++;
+                }
+            }
+        }
+    }
+    for (index = 0; index < 4; index++)
+    {
+        cx = index < 2 ? 1 + index : T_WIDTH;
+        cy = index < 2 ? T_HEIGHT : 1 + index - 2;
+        for (flags = 0; flags <= XRDP_JPEG_FLAG_444;
+             flags += XRDP_JPEG_FLAG_444)
+        {
+            bytes = xrdp_codec_jpeg_buf_size(cx, cy);
+            xrdp_codec_jpeg_compress(han, 0, data, T_WIDTH, T_HEIGHT,
+                                     T_WIDTH * 4, 0, 0, cx, cy, 100,
+                                     flags, buf, &bytes);
+            if (bytes < 1)
+            {
+                printf("buf size: %dx%d flags %d does not fit in %d\n",
+                       cx, cy, flags, xrdp_codec_jpeg_buf_size(cx, cy));
+                errors++;
+            }
+        }
+    }
+    xrdp_jpeg_deinit(han);
+    g_free(buf);
+    g_free(data);
+    return errors;
+}
+
+/*****************************************************************************/
+/* reads a raw a8b8g8r8 capture, returns nil on error */
+static char *
+read_frame(const char *filename, int width, int height)
+{
+    char *data;
+    int fd;
+    int bytes;
+
+    fd = g_file_open_ex(filename, 1, 0, 0, 0);
+    if (fd < 0)
+    {
+        printf("can not open %s\n", filename);
+        return 0;
+    }
+    bytes = width * height * 4;
+    data = (char *) g_malloc(bytes, 0);
+    if (g_file_read(fd, data, bytes) != bytes)
+    {
+        printf("%s is shorter than %dx%d\n", filename, width, height);
+        g_free(data);
+        data = 0;
+    }
+    g_file_close(fd);
+    return data;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct xrdp_encoder encoder;
+    struct bench_result res;
+    XRDP_ENC_DATA enc;
+    int x;
+    int y;
+    int index;
+    int errors;
+
+    g_init("jpeg_bench");
+    g_memset(&encoder, 0, sizeof(encoder));
+    g_memset(&enc, 0, sizeof(enc));
+    if (argc > 3)
+    {
+        enc.width = g_atoi(argv[1]);
+        enc.height = g_atoi(argv[2]);
+        if ((enc.width < 1) || (enc.height < 1) ||
+            (enc.width > 8192) || (enc.height > 8192))
+        {
+            printf("bad size %dx%d\n", enc.width, enc.height);
+            return 1;
+        }
+        enc.data = read_frame(argv[3], enc.width, enc.height);
+        if (enc.data == 0)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        enc.width = T_WIDTH;
+        enc.height = T_HEIGHT;
+        enc.data = (char *) g_malloc(T_WIDTH * T_HEIGHT * 4, 0);
+        make_frame(enc.data);
+    }
+    /* tiles, the edge ones cut short */
+    enc.crects = (short *) g_malloc(sizeof(short) * 4 *
+                                    ((enc.width + T_TILE - 1) / T_TILE) *
+                                    ((enc.height + T_TILE - 1) / T_TILE), 0);
+    index = 0;
+    for (y = 0; y < enc.height; y += T_TILE)
+    {
+        for (x = 0; x < enc.width; x += T_TILE)
+        {
+            enc.crects[index * 4 + 0] = x;
+            enc.crects[index * 4 + 1] = y;
+            enc.crects[index * 4 + 2] = MIN(T_TILE, enc.width - x);
+            enc.crects[index * 4 + 3] = MIN(T_TILE, enc.height - y);
+            index++;
+        }
+    }
+    enc.num_crects = index;
+
+    encoder.codec_handle = xrdp_enc_jpg_create();
+    encoder.codec_quality = T_QUALITY;
+    encoder.mutex = tc_mutex_create();
+    encoder.fifo_processed = fifo_create();
+    encoder.xrdp_encoder_event_processed = g_create_wait_obj("jpeg_bench");
+
+    errors = check_buf_size();
+    printf("%dx%d, %d tiles, quality %d, %d loops\n", enc.width, enc.height,
+           enc.num_crects, T_QUALITY, T_LOOPS);
+    if (bench_serial(&res, &enc, 0) != 0)
+    {
+        errors++;
+    }
+    else
+    {
+        print_result("per tile", &res, enc.width * enc.height);
+    }
+    if (bench_serial(&res, &enc, 1) != 0)
+    {
+        errors++;
+    }
+    else
+    {
+        print_result("kept", &res, enc.width * enc.height);
+    }
+    if (bench_new(&res, &encoder, &enc) != 0)
+    {
+        errors++;
+    }
+    else
+    {
+        print_result("encoder", &res, enc.width * enc.height);
+    }
+
+    xrdp_enc_jpg_delete((struct xrdp_enc_jpg *) (encoder.codec_handle));
+    fifo_delete(encoder.fifo_processed);
+    tc_mutex_delete(encoder.mutex);
+    g_delete_wait_obj(encoder.xrdp_encoder_event_processed);
+    g_free(enc.crects);
+    g_free(enc.data);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
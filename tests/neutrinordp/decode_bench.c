@@ -0,0 +1,264 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * fps benchmark of the neutrinordp module's bitmap update decode thread
+ * frames of 64x64 16 bpp tiles, compressed the way a server sends them,
+ * go through lfreerdp_bitmap_update with the decode inline and then on
+ * the decode thread, the paint callback compresses each tile again the
+ * way xrdp does for its client, prints frames/s for both, checks the
+ * threaded run paints the same tiles in the same order and that
+ * lfreerdp_decode_stop has the thread gone before mod is freed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the decode functions are static, take the module in whole */
+#include "xrdp-neutrinordp.c"
+
+#define T_WIDTH 1024
+#define T_HEIGHT 768
+#define T_TILE 64
+#define T_TILES ((T_WIDTH / T_TILE) * (T_HEIGHT / T_TILE))
+#define T_SOURCES 4 /* different frames, sent in turn */
+#define T_FRAMES 200
+
+int APP_CC
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e);
+
+static struct stream *g_s = 0;
+static struct stream *g_temp_s = 0;
+static int g_sums[T_FRAMES * T_TILES];
+static int g_num_sums = 0;
+static int g_check = 0; /* 0 record sums, 1 compare */
+static int g_errors = 0;
+
+/*****************************************************************************/
+/* what xrdp does with a painted rect for its client, and a sum of it */
+static int
+bench_paint_rect(struct mod *v, int x, int y, int cx, int cy,
+                 char *data, int width, int height, int srcx, int srcy)
+{
+    int sum;
+    int index;
+
+    init_stream(g_s, 16384 * 2);
+    init_stream(g_temp_s, 16384 * 2);
+    xrdp_bitmap_compress(data, width, height, g_s, 16, 16384, height - 1,
+                         g_temp_s, 0);
+    sum = x * 31 + y;
+    for (index = 0; index < width * height * 2; index++)
+    {
+        sum = sum * 33 + (unsigned char) (data[index]);
+    }
+    if (g_num_sums >= T_FRAMES * T_TILES)
+    {
+        return 0;
+    }
+    if (g_check)
+    {
+        if (g_sums[g_num_sums] != sum)
+        {
+            if (g_errors < 10)
+            {
+                printf("rect %d at %d %d differs\n", g_num_sums, x, y);
+            }
+            g_errors++;
+        }
+    }
+    else
+    {
+        g_sums[g_num_sums] = sum;
+    }
+    g_num_sums++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* source frame n as 16 bpp tiles, compressed */
+static void
+make_update(BITMAP_UPDATE *update, int n)
+{
+    BITMAP_DATA *bd;
+    tui16 pixels[T_TILE * T_TILE];
+    int x;
+    int y;
+    int index;
+    int tx;
+    int ty;
+    int v;
+    int bytes;
+
+    update->number = T_TILES;
+    update->count = T_TILES;
+    update->rectangles = (BITMAP_DATA *)
+                         g_malloc(sizeof(BITMAP_DATA) * T_TILES, 1);
+    for (index = 0; index < T_TILES; index++)
+    {
+        tx = (index % (T_WIDTH / T_TILE)) * T_TILE;
+        ty = (index / (T_WIDTH / T_TILE)) * T_TILE;
+        for (y = 0; y < T_TILE; y++)
+        {
+            for (x = 0; x < T_TILE; x++)
+            {
+                /* text on a panel on the left, a gradient on the right */
+                if (tx < T_WIDTH / 2)
+                {
+                    v = ((((x + n) * 7 + y * 13) % 11) == 0) &&
+                        ((y % 14) < 10);
+                    pixels[y * T_TILE + x] = v ? 0 : 0xef7d;
+                }
+                else
+                {
+                    pixels[y * T_TILE + x] = (tx + x + n) * 3 + (ty + y) * 5;
+                }
+            }
+        }
+        init_stream(g_s, 16384 * 2);
+        init_stream(g_temp_s, 16384 * 2);
+        xrdp_bitmap_compress((char *) pixels, T_TILE, T_TILE, g_s, 16, 16384,
+                             T_TILE - 1, g_temp_s, 0);
+        s_mark_end(g_s);
+        bytes = (int) (g_s->end - g_s->data);
+        bd = update->rectangles + index;
+        bd->destLeft = tx;
+        bd->destTop = ty;
+        bd->destRight = tx + T_TILE - 1;
+        bd->destBottom = ty + T_TILE - 1;
+        bd->width = T_TILE;
+        bd->height = T_TILE;
+        bd->bitsPerPixel = 16;
+        bd->compressed = 1;
+        bd->bitmapLength = bytes;
+        bd->bitmapDataStream = (tui8 *) g_malloc(bytes, 0);
+        g_memcpy(bd->bitmapDataStream, g_s->data, bytes);
+    }
+}
+
+/*****************************************************************************/
+/* returns frames per second */
+static int
+run_frames(struct mod *mod, BITMAP_UPDATE *updates, int *ms)
+{
+    modContext context;
+    int frame;
+    int start;
+
+    g_memset(&context, 0, sizeof(context));
+    context.modi = mod;
+    g_num_sums = 0;
+    start = g_time3();
+    for (frame = 0; frame < T_FRAMES; frame++)
+    {
+        lfreerdp_bitmap_update((rdpContext *) &context,
+                               updates + frame % T_SOURCES);
+    }
+    *ms = g_time3() - start;
+    return *ms < 1 ? 0 : T_FRAMES * 1000 / *ms;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    BITMAP_UPDATE updates[T_SOURCES];
+    rdpSettings settings;
+    freerdp inst;
+    struct mod *mod;
+    int index;
+    int tile;
+    int fps;
+    int ms;
+
+    g_init("decode_bench");
+    make_stream(g_s);
+    make_stream(g_temp_s);
+    for (index = 0; index < T_SOURCES; index++)
+    {
+        make_update(updates + index, index);
+    }
+    g_memset(&settings, 0, sizeof(settings));
+    g_memset(&inst, 0, sizeof(inst));
+    settings.color_depth = 16;
+    inst.settings = &settings;
+
+    /* one cpu, decode_state -1, as lfreerdp_decode_start leaves it */
+    mod = (struct mod *) g_malloc(sizeof(struct mod), 1);
+    mod->inst = &inst;
+    mod->bpp = 16;
+    mod->server_paint_rect = bench_paint_rect;
+    mod->decode_state = -1;
+    g_check = 0;
+    fps = run_frames(mod, updates, &ms);
+    printf("%dx%d, %d tiles a frame, %d frames\n", T_WIDTH, T_HEIGHT,
+           T_TILES, T_FRAMES);
+    printf("inline   %5d ms %5d fps\n", ms, fps);
+    lfreerdp_decode_stop(mod);
+    g_free(mod);
+
+    mod = (struct mod *) g_malloc(sizeof(struct mod), 1);
+    mod->inst = &inst;
+    mod->bpp = 16;
+    mod->server_paint_rect = bench_paint_rect;
+    g_check = 1;
+    fps = run_frames(mod, updates, &ms);
+    if (mod->decode_state == 1)
+    {
+        printf("threaded %5d ms %5d fps, %d of %d updates on the thread\n",
+               ms, fps, mod->decode_threaded, mod->decode_updates);
+        if (mod->decode_threaded != T_FRAMES)
+        {
+            g_errors++;
+        }
+    }
+    else
+    {
+        printf("threaded: not started, %d cpu\n", g_get_num_cpus());
+    }
+    if (g_num_sums != T_FRAMES * T_TILES)
+    {
+        printf("%d rects painted, wanted %d\n", g_num_sums,
+               T_FRAMES * T_TILES);
+        g_errors++;
+    }
+    /* the thread is joined here, freeing mod right after is safe */
+    lfreerdp_decode_stop(mod);
+    if (mod->decode_state == 1)
+    {
+        g_errors++;
+    }
+    g_memset(mod, 0xcd, sizeof(struct mod));
+    g_free(mod);
+
+    for (index = 0; index < T_SOURCES; index++)
+    {
+        for (tile = 0; tile < T_TILES; tile++)
+        {
+            g_free(updates[index].rectangles[tile].bitmapDataStream);
+        }
+        g_free(updates[index].rectangles);
+    }
+    free_stream(g_s);
+    free_stream(g_temp_s);
+    g_deinit();
+    printf("%s\n", g_errors == 0 ? "ok" : "FAILED");
+    return g_errors == 0 ? 0 : 1;
+}
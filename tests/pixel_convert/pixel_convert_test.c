@@ -0,0 +1,591 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of common/pixel_convert
+ * every row kernel this cpu can run, scalar and vector, is checked against
+ * the COLOR and SPLITCOLOR macros for every colour of its source format,
+ * 2^24 for 24 and 32 bpp, 2^16 for 15 and 16 bpp, then for every length up
+ * to 67 pixels from 4 start offsets, not writing past the end, then
+ * pixel_convert_row for every pair of formats and pixel_convert_rect with
+ * strides, prints MPix/s for each kernel over a 1920x1080 frame
+ * premultiply is checked against c * a / 255 rounded, for every alpha with
+ * every red and every green, the vector kernel has to give what the scalar
+ * one does bit for bit, in place too
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* the kernels are static, take the module in whole */
+#include "pixel_convert.c"
+
+#define T_CHUNK 4096
+#define T_WIDTH 1920
+#define T_HEIGHT 1080
+#define T_FRAMES 20
+#define T_CANARY 0xa5
+
+#define K_32_TO_16 0
+#define K_32_TO_15 1
+#define K_32_TO_24 2
+#define K_16_TO_32 3
+#define K_15_TO_32 4
+#define K_24_TO_32 5
+#define K_SWAP_RB32 6
+#define K_ALPHA8 7
+#define K_PREMULTIPLY32 8
+
+struct kernel
+{
+    int op;
+    const char *name;
+    pixel_row_proc proc;
+    const char *cpu; /* feature it needs at run time, or 0 */
+};
+
+static const struct kernel g_kernels[] =
+{
+    { K_32_TO_16, "c", c32_to_16_c, 0 },
+    { K_32_TO_15, "c", c32_to_15_c, 0 },
+    { K_32_TO_24, "c", c32_to_24_c, 0 },
+    { K_16_TO_32, "c", c16_to_32_c, 0 },
+    { K_15_TO_32, "c", c15_to_32_c, 0 },
+    { K_24_TO_32, "c", c24_to_32_c, 0 },
+    { K_SWAP_RB32, "c", swap_rb32_c, 0 },
+    { K_ALPHA8, "c", alpha8_c, 0 },
+    { K_PREMULTIPLY32, "c", premultiply32_c, 0 },
+#if defined(PIXEL_SSE2)
+    { K_32_TO_16, "sse2", c32_to_16_sse2, 0 },
+    { K_32_TO_15, "sse2", c32_to_15_sse2, 0 },
+    { K_16_TO_32, "sse2", c16_to_32_sse2, 0 },
+    { K_15_TO_32, "sse2", c15_to_32_sse2, 0 },
+    { K_SWAP_RB32, "sse2", swap_rb32_sse2, 0 },
+    { K_ALPHA8, "sse2", alpha8_sse2, 0 },
+    { K_PREMULTIPLY32, "sse2", premultiply32_sse2, 0 },
+#endif
+#if defined(PIXEL_X86_DISPATCH)
+    { K_32_TO_24, "ssse3", c32_to_24_ssse3, "ssse3" },
+    { K_24_TO_32, "ssse3", c24_to_32_ssse3, "ssse3" },
+    { K_32_TO_16, "avx2", c32_to_16_avx2, "avx2" },
+    { K_32_TO_15, "avx2", c32_to_15_avx2, "avx2" },
+    { K_SWAP_RB32, "avx2", swap_rb32_avx2, "avx2" },
+#endif
+#if defined(PIXEL_NEON)
+    { K_32_TO_24, "neon", c32_to_24_neon, 0 },
+    { K_24_TO_32, "neon", c24_to_32_neon, 0 },
+    { K_32_TO_16, "neon", c32_to_16_neon, 0 },
+    { K_SWAP_RB32, "neon", swap_rb32_neon, 0 },
+#endif
+    { -1, 0, 0, 0 }
+};
+
+static const char *g_op_names[] =
+{
+    "32 to 16", "32 to 15", "32 to 24", "16 to 32", "15 to 32", "24 to 32",
+    "swap rb32", "alpha8", "premul32"
+};
+
+/* source and destination bytes a pixel of each op */
+static const int g_op_src_bytes[] = { 4, 4, 4, 2, 2, 3, 4, 4, 4 };
+static const int g_op_dst_bytes[] = { 2, 2, 3, 4, 4, 4, 4, 1, 4 };
+
+static unsigned int g_seed = 7;
+static int g_errors = 0;
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+static int
+kernel_runs_here(const struct kernel *k)
+{
+    if (k->cpu == 0)
+    {
+        return 1;
+    }
+#if defined(PIXEL_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (strcmp(k->cpu, "ssse3") == 0)
+    {
+        return __builtin_cpu_supports("ssse3");
+    }
+    if (strcmp(k->cpu, "avx2") == 0)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 0;
+}
+
+/*****************************************************************************/
+/* source pixel colour of index in the format of op, with a random alpha
+   byte in 32 bpp sources, for premultiply index is alpha, red and green
+   and blue is random */
+static void
+make_src(int op, int index, tui8 *s8)
+{
+    tui32 pixel;
+
+    switch (g_op_src_bytes[op])
+    {
+        case 2:
+            *((tui16 *) s8) = index;
+            break;
+        case 3:
+            s8[0] = index;
+            s8[1] = index >> 8;
+            s8[2] = index >> 16;
+            break;
+        default:
+            pixel = (index & 0xffffff) | ((rnd() & 0xff) << 24);
+            if (op == K_ALPHA8)
+            {
+                pixel = (index << 24) | (rnd() & 0xffffff);
+            }
+            else if (op == K_PREMULTIPLY32)
+            {
+                pixel = (index << 8) | (rnd() & 0xff);
+            }
+            *((tui32 *) s8) = pixel;
+            break;
+    }
+}
+
+/*****************************************************************************/
+/* what the macros make of one source pixel */
+static void
+make_want(int op, const tui8 *s8, tui8 *d8)
+{
+    tui32 pixel;
+    int alpha;
+    int red;
+    int green;
+    int blue;
+
+    switch (op)
+    {
+        case K_32_TO_16:
+            pixel = *((const tui32 *) s8);
+            SPLITCOLOR32(red, green, blue, pixel);
+            *((tui16 *) d8) = COLOR16(red, green, blue);
+            break;
+        case K_32_TO_15:
+            pixel = *((const tui32 *) s8);
+            SPLITCOLOR32(red, green, blue, pixel);
+            *((tui16 *) d8) = COLOR15(red, green, blue);
+            break;
+        case K_32_TO_24:
+            pixel = *((const tui32 *) s8);
+            d8[0] = pixel;
+            d8[1] = pixel >> 8;
+            d8[2] = pixel >> 16;
+            break;
+        case K_16_TO_32:
+            pixel = *((const tui16 *) s8);
+            SPLITCOLOR16(red, green, blue, pixel);
+            *((tui32 *) d8) = COLOR24RGB(red, green, blue);
+            break;
+        case K_15_TO_32:
+            pixel = *((const tui16 *) s8);
+            SPLITCOLOR15(red, green, blue, pixel);
+            *((tui32 *) d8) = COLOR24RGB(red, green, blue);
+            break;
+        case K_24_TO_32:
+            *((tui32 *) d8) = s8[0] | (s8[1] << 8) | (s8[2] << 16);
+            break;
+        case K_SWAP_RB32:
+            pixel = *((const tui32 *) s8);
+            *((tui32 *) d8) = (pixel & 0xff00ff00) | ((pixel >> 16) & 0xff) |
+                              ((pixel & 0xff) << 16);
+            break;
+        case K_PREMULTIPLY32:
+            pixel = *((const tui32 *) s8);
+            alpha = pixel >> 24;
+            SPLITCOLOR32(red, green, blue, pixel);
+            red = (red * alpha + 127) / 255;
+            green = (green * alpha + 127) / 255;
+            blue = (blue * alpha + 127) / 255;
+            *((tui32 *) d8) = (alpha << 24) | COLOR24RGB(red, green, blue);
+            break;
+        default:
+            d8[0] = *((const tui32 *) s8) >> 24;
+            break;
+    }
+}
+
+/*****************************************************************************/
+/* every colour of the source format, returns error */
+static int
+check_all_colours(const struct kernel *k, tui8 *src, tui8 *dst, tui8 *want)
+{
+    int colours;
+    int first;
+    int count;
+    int index;
+    int sb;
+    int db;
+
+    sb = g_op_src_bytes[k->op];
+    db = g_op_dst_bytes[k->op];
+    colours = sb == 2 ? 1 << 16 : k->op == K_ALPHA8 ? 1 << 8 : 1 << 24;
+    for (first = 0; first < colours; first += T_CHUNK)
+    {
+        count = MIN(T_CHUNK, colours - first);
+        for (index = 0; index < count; index++)
+        {
+            make_src(k->op, first + index, src + index * sb);
+            make_want(k->op, src + index * sb, want + index * db);
+        }
+        k->proc(src, dst, count);
+        if (memcmp(dst, want, count * db) != 0)
+        {
+            for (index = 0; index < count; index++)
+            {
+                if (memcmp(dst + index * db, want + index * db, db) != 0)
+                {
+                    break;
+                }
+            }
+            printf("%-9s %-5s: colour 0x%6.6x wrong\n", g_op_names[k->op],
+                   k->name, first + index);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* every length to 67 from 4 start pixels, nothing past the end is
+   written, swap rb32 and premultiply in place too, returns error */
+static int
+check_lengths(const struct kernel *k, tui8 *src, tui8 *dst, tui8 *want)
+{
+    int length;
+    int start;
+    int index;
+    int sb;
+    int db;
+
+    sb = g_op_src_bytes[k->op];
+    db = g_op_dst_bytes[k->op];
+    for (start = 0; start < 4; start++)
+    {
+        for (length = 0; length < 68; length++)
+        {
+            for (index = 0; index < length; index++)
+            {
+                make_src(k->op, rnd() & 0xffffff, src + (start + index) * sb);
+                make_want(k->op, src + (start + index) * sb,
+                          want + index * db);
+            }
+            memset(dst, T_CANARY, (start + length + 64) * db);
+            k->proc(src + start * sb, dst + start * db, length);
+            if ((memcmp(dst + start * db, want, length * db) != 0) ||
+                (dst[(start + length) * db] != T_CANARY) ||
+                ((start > 0) && (dst[start * db - 1] != T_CANARY)))
+            {
+                printf("%-9s %-5s: %d pixels from %d wrong\n",
+                       g_op_names[k->op], k->name, length, start);
+                return 1;
+            }
+            if ((k->op == K_SWAP_RB32) || (k->op == K_PREMULTIPLY32))
+            {
+                k->proc(src + start * sb, src + start * sb, length);
+                if (memcmp(src + start * sb, want, length * db) != 0)
+                {
+                    printf("%-9s %-5s: %d pixels from %d in place wrong\n",
+                           g_op_names[k->op], k->name, length, start);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+fmt_bytes(int fmt)
+{
+    return fmt == 8 ? 1 : fmt == 24 ? 3 : fmt == 32 ? 4 : 2;
+}
+
+/*****************************************************************************/
+/* one pixel of fmt at p as x8r8g8b8, the way the macros read it */
+static tui32
+ref_to_32(int fmt, const tui8 *p, const int *palette)
+{
+    int red;
+    int green;
+    int blue;
+    int pixel;
+
+    switch (fmt)
+    {
+        case 8:
+            return palette[p[0]];
+        case 15:
+            pixel = *((const tui16 *) p);
+            SPLITCOLOR15(red, green, blue, pixel);
+            return COLOR24RGB(red, green, blue);
+        case 16:
+            pixel = *((const tui16 *) p);
+            SPLITCOLOR16(red, green, blue, pixel);
+            return COLOR24RGB(red, green, blue);
+        case 24:
+            return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+    return *((const tui32 *) p);
+}
+
+/*****************************************************************************/
+static void
+ref_from_32(int fmt, tui32 pixel, tui8 *p)
+{
+    int red;
+    int green;
+    int blue;
+
+    SPLITCOLOR32(red, green, blue, pixel);
+    switch (fmt)
+    {
+        case 8:
+            p[0] = COLOR8(red, green, blue);
+            break;
+        case 15:
+            *((tui16 *) p) = COLOR15(red, green, blue);
+            break;
+        case 16:
+            *((tui16 *) p) = COLOR16(red, green, blue);
+            break;
+        case 24:
+            p[0] = blue;
+            p[1] = green;
+            p[2] = red;
+            break;
+        default:
+            *((tui32 *) p) = pixel;
+            break;
+    }
+}
+
+/*****************************************************************************/
+/* pixel_convert_row for every pair of formats, more than its 256 pixel
+   chunk, and pixel_convert_rect with strides, returns errors */
+static int
+check_public(tui8 *src, tui8 *dst, tui8 *want)
+{
+    static const int fmts[] = { 8, 15, 16, 24, 32 };
+    int palette[256];
+    int errors;
+    int si;
+    int di;
+    int sb;
+    int db;
+    int index;
+    int y;
+    int num;
+
+    errors = 0;
+    num = 1000;
+    for (index = 0; index < 256; index++)
+    {
+        palette[index] = rnd() & 0xffffff;
+    }
+    for (si = 0; si < 5; si++)
+    {
+        sb = fmt_bytes(fmts[si]);
+        for (index = 0; index < num * sb; index++)
+        {
+            src[index] = rnd();
+        }
+        for (di = 0; di < 5; di++)
+        {
+            db = fmt_bytes(fmts[di]);
+            for (index = 0; index < num; index++)
+            {
+                ref_from_32(fmts[di],
+                            ref_to_32(fmts[si], src + index * sb, palette),
+                            want + index * db);
+            }
+            if (fmts[si] == fmts[di])
+            {
+                memcpy(want, src, num * sb);
+            }
+            if ((pixel_convert_row(src, fmts[si], dst, fmts[di], num,
+                                   palette) != 0) ||
+                (memcmp(dst, want, num * db) != 0))
+            {
+                printf("pixel_convert_row %d to %d wrong\n", fmts[si],
+                       fmts[di]);
+                errors++;
+            }
+            /* 25 rows of 40 with the rows 3 and 7 pixels apart */
+            memset(dst, T_CANARY, 25 * 47 * db);
+            if (pixel_convert_rect(src, fmts[si], 43 * sb, dst, fmts[di],
+                                   47 * db, 40, 25, palette) != 0)
+            {
+                errors++;
+            }
+            for (y = 0; y < 25; y++)
+            {
+                for (index = 0; index < 40; index++)
+                {
+                    if (fmts[si] == fmts[di])
+                    {
+                        memcpy(want, src + (y * 43 + index) * sb, sb);
+                    }
+                    else
+                    {
+                        ref_from_32(fmts[di],
+                                    ref_to_32(fmts[si],
+                                              src + (y * 43 + index) * sb,
+                                              palette), want);
+                    }
+                    if (memcmp(dst + (y * 47 + index) * db, want, db) != 0)
+                    {
+                        break;
+                    }
+                }
+                if ((index < 40) || (dst[(y * 47 + 40) * db] != T_CANARY))
+                {
+                    printf("pixel_convert_rect %d to %d row %d wrong\n",
+                           fmts[si], fmts[di], y);
+                    errors++;
+                    break;
+                }
+            }
+        }
+    }
+    /* premultiply through the public call, in place */
+    for (index = 0; index < num; index++)
+    {
+        make_src(K_PREMULTIPLY32, rnd() & 0xffffff, src + index * 4);
+        make_want(K_PREMULTIPLY32, src + index * 4, want + index * 4);
+    }
+    pixel_premultiply32(src, src, num);
+    if (memcmp(src, want, num * 4) != 0)
+    {
+        printf("pixel_premultiply32 wrong\n");
+        errors++;
+    }
+    if (pixel_convert_row(src, 8, dst, 32, num, 0) == 0)
+    {
+        printf("pixel_convert_row from 8 without a palette did not fail\n");
+        errors++;
+    }
+    if (pixel_convert_row(src, 12, dst, 32, num, palette) == 0)
+    {
+        printf("pixel_convert_row from 12 did not fail\n");
+        errors++;
+    }
+    return errors;
+}
+
+/*****************************************************************************/
+/* MPix/s of k over a frame, row by row */
+static double
+bench_kernel(const struct kernel *k, tui8 *src, tui8 *dst)
+{
+    double start;
+    double took;
+    int frame;
+    int y;
+    int sb;
+    int db;
+
+    sb = g_op_src_bytes[k->op];
+    db = g_op_dst_bytes[k->op];
+    for (y = 0; y < T_WIDTH * T_HEIGHT * sb; y++)
+    {
+        src[y] = rnd();
+    }
+    start = now_us();
+    for (frame = 0; frame < T_FRAMES; frame++)
+    {
+        for (y = 0; y < T_HEIGHT; y++)
+        {
+            k->proc(src + y * T_WIDTH * sb, dst + y * T_WIDTH * db, T_WIDTH);
+        }
+    }
+    took = now_us() - start;
+    return took < 1 ? 0 : (double) T_WIDTH * T_HEIGHT * T_FRAMES / took;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    const struct kernel *k;
+    tui8 *src;
+    tui8 *dst;
+    tui8 *want;
+    double mpix;
+    double c_mpix[9];
+
+    src = (tui8 *) malloc(T_WIDTH * T_HEIGHT * 4);
+    dst = (tui8 *) malloc(T_WIDTH * T_HEIGHT * 4);
+    want = (tui8 *) malloc(T_CHUNK * 4 + 64);
+    printf("in use: %s\n", pixel_convert_impl());
+    for (k = g_kernels; k->proc != 0; k++)
+    {
+        if (!kernel_runs_here(k))
+        {
+            printf("%-9s %-5s: not on this cpu\n", g_op_names[k->op],
+                   k->name);
+            continue;
+        }
+        g_errors += check_all_colours(k, src, dst, want);
+        g_errors += check_lengths(k, src, dst, want);
+        mpix = bench_kernel(k, src, dst);
+        if (strcmp(k->name, "c") == 0)
+        {
+            c_mpix[k->op] = mpix;
+            printf("%-9s %-5s: %7.0f MPix/s\n", g_op_names[k->op], k->name,
+                   mpix);
+        }
+        else
+        {
+            printf("%-9s %-5s: %7.0f MPix/s, %.1fx c\n", g_op_names[k->op],
+                   k->name, mpix, c_mpix[k->op] > 0 ?
+                   mpix / c_mpix[k->op] : 0);
+        }
+    }
+    g_errors += check_public(src, dst, want);
+    free(src);
+    free(dst);
+    free(want);
+    printf("%s\n", g_errors == 0 ? "ok" : "FAILED");
+    return g_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * fuzz and benchmark of the rdp module's interleaved rle decoder
+ * random streams and streams made of valid opcodes with random operands,
+ * 1, 2 and 3 bytes a pixel, 1 to 64 pixels wide and high, go through
+ * rdp_bitmap_decompress, the input ends at a page nobody can read so any
+ * read past it faults, every stream it takes is decoded by the one pixel
+ * at a time decoder it had before, kept in old_bitmap.c, and must give
+ * the same pixels, then 64x64 tiles from xrdp_bitmap_compress are decoded
+ * by both, prints MB/s of pixels for each
+ *
+ * rdp_bitmap_test [streams], 200000 streams without it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arch.h"
+#include "parse.h"
+#include "os_calls.h"
+#include "defines.h"
+
+#define T_MAX_IN 70000
+#define T_LOOPS 20000
+
+int APP_CC
+rdp_bitmap_decompress(char *output, int width, int height, char *input,
+                      int size, int Bpp);
+int APP_CC
+old_rdp_bitmap_decompress(char *output, int width, int height, char *input,
+                          int size, int Bpp);
+int APP_CC
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e);
+
+static unsigned int g_seed = 1;
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+/* mostly valid opcodes with random operands, returns bytes */
+static int
+make_opcodes(unsigned char *b, int max, int Bpp)
+{
+    int n;
+    int c;
+    int index;
+
+    n = 0;
+    while (n < max - 16)
+    {
+        switch (rnd() % 10)
+        {
+            case 0: /* fill */
+                b[n++] = 0x00 | (rnd() % 32);
+                break;
+            case 1: /* mix */
+                b[n++] = 0x20 | (rnd() % 32);
+                break;
+            case 2: /* fill or mix with a mask byte */
+                b[n++] = 0x40 | (rnd() % 32);
+                b[n++] = rnd();
+                break;
+            case 3: /* colour */
+                b[n++] = 0x60 | (rnd() % 32);
+                for (index = 0; index < Bpp; index++)
+                {
+                    b[n++] = rnd();
+                }
+                break;
+            case 4: /* copy */
+                c = 1 + rnd() % 31;
+                if (n + 1 + c * Bpp >= max - 16)
+                {
+                    return n;
+                }
+                b[n++] = 0x80 | c;
+                for (index = 0; index < c * Bpp; index++)
+                {
+                    b[n++] = rnd();
+                }
+                break;
+            case 5: /* mix with a colour */
+                b[n++] = 0xc0 | (rnd() % 16);
+                for (index = 0; index < Bpp; index++)
+                {
+                    b[n++] = rnd();
+                }
+                break;
+            case 6: /* bicolour */
+                b[n++] = 0xe0 | (1 + rnd() % 15);
+                for (index = 0; index < 2 * Bpp; index++)
+                {
+                    b[n++] = rnd();
+                }
+                break;
+            case 7: /* white */
+                b[n++] = 0xfd;
+                break;
+            case 8: /* black */
+                b[n++] = 0xfe;
+                break;
+            default: /* long fill */
+                b[n++] = 0xf0;
+                b[n++] = rnd() % 200;
+                b[n++] = 0;
+                break;
+        }
+    }
+    return n;
+}
+
+/*****************************************************************************/
+/* returns errors */
+static int
+fuzz(int streams)
+{
+    static char in[T_MAX_IN];
+    static char o1[64 * 64 * 3];
+    static char o2[64 * 64 * 3];
+    char *guarded;
+    char *page_end;
+    int page;
+    int index;
+    int Bpp;
+    int width;
+    int height;
+    int size;
+    int r1;
+    int r2;
+    int taken;
+
+    /* the stream is copied to end right where the page that can not be
+       read starts */
+    page = sysconf(_SC_PAGESIZE);
+    size = ((T_MAX_IN + page - 1) / page) * page;
+    guarded = (char *) mmap(0, size + page, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guarded == MAP_FAILED)
+    {
+        printf("mmap failed\n");
+        return 1;
+    }
+    page_end = guarded + size;
+    mprotect(page_end, page, PROT_NONE);
+    taken = 0;
+    for (index = 0; index < streams; index++)
+    {
+        Bpp = 1 + rnd() % 3;
+        width = 1 + rnd() % 64;
+        height = 1 + rnd() % 64;
+        if (rnd() % 2)
+        {
+            width = 64;
+            height = 64;
+        }
+        if (rnd() % 2)
+        {
+            size = make_opcodes((unsigned char *) in,
+                                20 + rnd() % (width * height / 8 + 20), Bpp);
+        }
+        else
+        {
+            size = rnd() % (width * height / 4 + 8);
+            for (r1 = 0; r1 < size; r1++)
+            {
+                in[r1] = rnd();
+            }
+        }
+        g_memcpy(page_end - size, in, size);
+        g_memset(o1, 0x55, sizeof(o1));
+        g_memset(o2, 0x55, sizeof(o2));
+        r2 = rdp_bitmap_decompress(o2, width, height, page_end - size, size,
+                                   Bpp);
+        if (!r2)
+        {
+            continue;
+        }
+        taken++;
+        r1 = old_rdp_bitmap_decompress(o1, width, height, in, size, Bpp);
+        if ((r1 != r2) || (g_memcmp(o1, o2, width * height * Bpp) != 0))
+        {
+            printf("stream %d: %dx%d %d Bpp %d bytes decodes differently\n",
+                   index, width, height, Bpp, size);
+            munmap(guarded, page_end - guarded + page);
+            return 1;
+        }
+    }
+    printf("%d streams, %d taken and the same as before, %d refused\n",
+           streams, taken, streams - taken);
+    munmap(guarded, page_end - guarded + page);
+    return 0;
+}
+
+/*****************************************************************************/
+/* a 64x64 tile of ui, text, gradient or photo */
+static void
+make_tile(char *data, int kind, int bpp)
+{
+    int x;
+    int y;
+    int p;
+    int r;
+    int g;
+    int b;
+
+    for (y = 0; y < 64; y++)
+    {
+        for (x = 0; x < 64; x++)
+        {
+            switch (kind)
+            {
+                case 0:
+                    p = ((x < 50) && (y > 10)) ? 0xf0f0f0 : 0x3366cc;
+                    break;
+                case 1:
+                    p = (((rnd() % 6) == 0) && ((y % 12) < 9)) ?
+                        0x000000 : 0xffffff;
+                    break;
+                case 2:
+                    p = ((x * 4) << 8) | (y * 4);
+                    break;
+                default:
+                    p = rnd() & 0xffffff;
+                    break;
+            }
+            if (bpp == 16)
+            {
+                SPLITCOLOR32(r, g, b, p);
+                ((tui16 *) data)[y * 64 + x] = COLOR16(r, g, b);
+            }
+            else
+            {
+                ((tui32 *) data)[y * 64 + x] = p;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+bench(void)
+{
+    static const char *kinds[] = { "ui", "text", "gradient", "photo" };
+    static char tile[64 * 64 * 4];
+    static char out[64 * 64 * 4];
+    struct stream *s;
+    struct stream *temp_s;
+    int bpp;
+    int Bpp;
+    int kind;
+    int size;
+    int loop;
+    int start;
+    int ms_old;
+    int ms_new;
+    double mb;
+
+    make_stream(s);
+    make_stream(temp_s);
+    for (bpp = 16; bpp <= 24; bpp += 8)
+    {
+        Bpp = (bpp + 7) / 8;
+        for (kind = 0; kind < 4; kind++)
+        {
+            make_tile(tile, kind, bpp);
+            init_stream(s, 32768);
+            init_stream(temp_s, 32768);
+            xrdp_bitmap_compress(tile, 64, 64, s, bpp, 16384, 63, temp_s, 0);
+            s_mark_end(s);
+            size = (int) (s->end - s->data);
+            start = g_time3();
+            for (loop = 0; loop < T_LOOPS; loop++)
+            {
+                old_rdp_bitmap_decompress(out, 64, 64, s->data, size, Bpp);
+            }
+            ms_old = g_time3() - start;
+            start = g_time3();
+            for (loop = 0; loop < T_LOOPS; loop++)
+            {
+                rdp_bitmap_decompress(out, 64, 64, s->data, size, Bpp);
+            }
+            ms_new = g_time3() - start;
+            mb = 64.0 * 64 * Bpp * T_LOOPS / 1000.0;
+            printf("%d bpp %-8s %5d bytes  before %6.0f MB/s  now %6.0f "
+                   "MB/s\n", bpp, kinds[kind], size,
+                   ms_old < 1 ? 0 : mb / ms_old, ms_new < 1 ? 0 : mb / ms_new);
+        }
+    }
+    free_stream(s);
+    free_stream(temp_s);
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    int errors;
+
+    g_init("rdp_bitmap_test");
+    errors = fuzz(argc > 1 ? atoi(argv[1]) : 200000);
+    bench();
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,627 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * conformance checks for xrdp/xrdp_rfx.c
+ * RLGR1 against bit strings worked by hand from the [MS-RDPRFX]
+ * 3.1.8.1.7.3 pseudocode, RLGR1 round trips through a decoder written
+ * from the same section and whole frames decoded with the reference
+ * inverse pipeline (dequantize, inverse DWT 5/3, YCbCr to RGB)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* the encoder's kernels are static, take them in whole */
+#include "xrdp_rfx.c"
+
+struct rlgr_vector
+{
+    const char *name;
+    int count;
+    short data[20];
+    int bytes;
+    unsigned char expect[4];
+};
+
+/* k and kr start at 1, so a short block of zeros is one run */
+static const struct rlgr_vector g_vectors[] =
+{
+    /* run of 3, then the last zero sent as the run's value */
+    { "zeros 4", 4, { 0, 0, 0, 0 }, 1, { 0x60 } },
+    /* empty run, sign 0, GR(4) with kr 1 */
+    { "single 5", 1, { 5 }, 1, { 0x98 } },
+    /* run mode then GR mode once kp drops to 2 */
+    { "-1 0", 2, { -1, 0 }, 1, { 0xa0 } },
+    /* the run grows k to 3 before the remainder is sent */
+    { "zeros 16 then 3", 17, { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                               0, 0, 3 }, 2, { 0x0c, 0x40 } }
+};
+
+static const unsigned char *g_bits;
+static int g_bit_pos;
+static int g_bit_end;
+
+/*****************************************************************************/
+static int
+get_bit(void)
+{
+    int bit;
+
+    if (g_bit_pos >= g_bit_end)
+    {
+        return 0;
+    }
+    bit = (g_bits[g_bit_pos >> 3] >> (7 - (g_bit_pos & 7))) & 1;
+    g_bit_pos++;
+    return bit;
+}
+
+/*****************************************************************************/
+static int
+get_bits(int nbits)
+{
+    int value;
+
+    value = 0;
+    while (nbits-- > 0)
+    {
+        value = (value << 1) | get_bit();
+    }
+    return value;
+}
+
+/*****************************************************************************/
+#define DEC_UPDATE(_param, _delta, _k) do \
+{ \
+    _param += _delta; \
+    if (_param > KPMAX) _param = KPMAX; \
+    if (_param < 0) _param = 0; \
+    _k = _param >> LSGR; \
+} while (0)
+
+/*****************************************************************************/
+static int
+dec_gr(int *krp)
+{
+    int kr;
+    int vk;
+    int value;
+
+    kr = *krp >> LSGR;
+    vk = 0;
+    while (get_bit())
+    {
+        vk++;
+    }
+    value = (vk << kr) | get_bits(kr);
+    if (vk == 0)
+    {
+        DEC_UPDATE(*krp, -2, kr);
+    }
+    else if (vk > 1)
+    {
+        DEC_UPDATE(*krp, vk, kr);
+    }
+    return value;
+}
+
+/*****************************************************************************/
+/* RLGR1 decode as the spec gives it, writes are bounded by count, stops
+   at the end of the input */
+static void
+dec_rlgr1(const unsigned char *in, int in_bytes, short *out, int count)
+{
+    int k;
+    int kp;
+    int krp;
+    int n;
+    int run;
+    int sign;
+    int mag;
+    int twoms;
+
+    memset(out, 0x55, count * sizeof(short));
+    g_bits = in;
+    g_bit_pos = 0;
+    g_bit_end = in_bytes * 8;
+    k = 1;
+    kp = 1 << LSGR;
+    krp = 1 << LSGR;
+    n = 0;
+    while ((n < count) && (g_bit_pos < g_bit_end))
+    {
+        if (k)
+        {
+            run = 0;
+            while (!get_bit() && (g_bit_pos < g_bit_end))
+            {
+                run += 1 << k;
+                DEC_UPDATE(kp, UP_GR, k);
+            }
+            run += get_bits(k);
+            while ((run > 0) && (n < count))
+            {
+                out[n++] = 0;
+                run--;
+            }
+            sign = get_bit();
+            mag = dec_gr(&krp) + 1;
+            if (n < count)
+            {
+                out[n++] = sign ? -mag : mag;
+            }
+            DEC_UPDATE(kp, -DN_GR, k);
+        }
+        else
+        {
+            twoms = dec_gr(&krp);
+            if (twoms)
+            {
+                DEC_UPDATE(kp, -DQ_GR, k);
+            }
+            else
+            {
+                DEC_UPDATE(kp, UQ_GR, k);
+            }
+            out[n++] = (twoms & 1) ? -((twoms + 1) >> 1) : twoms >> 1;
+        }
+    }
+}
+
+/*****************************************************************************/
+static int
+test_vectors(void)
+{
+    const struct rlgr_vector *v;
+    char out[64];
+    short back[20];
+    int index;
+    int bytes;
+    int errors;
+
+    errors = 0;
+    for (index = 0; index < (int) (sizeof(g_vectors) / sizeof(g_vectors[0]));
+         index++)
+    {
+        v = g_vectors + index;
+        bytes = rfx_rlgr1_encode(v->data, v->count, out, sizeof(out));
+        if ((bytes != v->bytes) || (memcmp(out, v->expect, bytes) != 0))
+        {
+            printf("rlgr1 vector '%s': got %d bytes %02x %02x\n", v->name,
+                   bytes, (unsigned char) out[0], (unsigned char) out[1]);
+            errors++;
+            continue;
+        }
+        /* a trailing zero comes back as 1, the spec codes it as a run's
+           value, so only round trip the ones that end nonzero */
+        if (v->data[v->count - 1] != 0)
+        {
+            dec_rlgr1((unsigned char *) out, bytes, back, v->count);
+            if (memcmp(back, v->data, v->count * sizeof(short)) != 0)
+            {
+                printf("rlgr1 vector '%s': round trip differs\n", v->name);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+/*****************************************************************************/
+/* sparse blocks shaped like quantized subbands, large values included */
+static int
+test_round_trip(void)
+{
+    short data[4096];
+    short back[4096];
+    char out[RFX_COMP_MAX];
+    int iter;
+    int index;
+    int bytes;
+    int density;
+    int errors;
+
+    errors = 0;
+    srand(1);
+    for (iter = 0; iter < 2000; iter++)
+    {
+        density = 1 + (iter % 64);
+        for (index = 0; index < 4096; index++)
+        {
+            data[index] = 0;
+            if ((rand() % 64) < density)
+            {
+                data[index] = (rand() % 2001) - 1000;
+                if ((rand() & 7) != 0)
+                {
+                    data[index] /= 64;
+                }
+            }
+        }
+        data[4095] = (rand() & 1) ? 1 : -1;
+        bytes = rfx_rlgr1_encode(data, 4096, out, sizeof(out));
+        if (bytes < 0)
+        {
+            /* dense noise can pass RFX_COMP_MAX, the encoder requantizes */
+            continue;
+        }
+        dec_rlgr1((unsigned char *) out, bytes, back, 4096);
+        if (memcmp(back, data, sizeof(data)) != 0)
+        {
+            printf("rlgr1 round trip %d differs\n", iter);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/*****************************************************************************/
+static void
+idwt_level(short *buffer, short *idwt, int sub_width)
+{
+    int total_width;
+    int x;
+    int n;
+    int y;
+    short *ll;
+    short *hl;
+    short *lh;
+    short *hh;
+    short *ld;
+    short *hd;
+    short *l;
+    short *h;
+    short *d;
+
+    total_width = sub_width * 2;
+    hl = buffer;
+    lh = buffer + sub_width * sub_width;
+    hh = buffer + sub_width * sub_width * 2;
+    ll = buffer + sub_width * sub_width * 3;
+    ld = idwt;
+    hd = idwt + sub_width * sub_width * 2;
+    /* horizontal */
+    for (y = 0; y < sub_width; y++)
+    {
+        ld[0] = ll[0] - ((hl[0] + hl[0] + 1) >> 1);
+        hd[0] = lh[0] - ((hh[0] + hh[0] + 1) >> 1);
+        for (n = 1; n < sub_width; n++)
+        {
+            x = n << 1;
+            ld[x] = ll[n] - ((hl[n - 1] + hl[n] + 1) >> 1);
+            hd[x] = lh[n] - ((hh[n - 1] + hh[n] + 1) >> 1);
+        }
+        for (n = 0; n < sub_width - 1; n++)
+        {
+            x = n << 1;
+            ld[x + 1] = (hl[n] << 1) + ((ld[x] + ld[x + 2]) >> 1);
+            hd[x + 1] = (hh[n] << 1) + ((hd[x] + hd[x + 2]) >> 1);
+        }
+        x = n << 1;
+        ld[x + 1] = (hl[n] << 1) + ld[x];
+        hd[x + 1] = (hh[n] << 1) + hd[x];
+        ll += sub_width;
+        hl += sub_width;
+        lh += sub_width;
+        hh += sub_width;
+        ld += total_width;
+        hd += total_width;
+    }
+    /* vertical */
+    for (x = 0; x < total_width; x++)
+    {
+        l = idwt + x;
+        h = idwt + x + sub_width * total_width;
+        d = buffer + x;
+        d[0] = l[0] - ((h[0] * 2 + 1) >> 1);
+        for (n = 1; n < sub_width; n++)
+        {
+            l += total_width;
+            h += total_width;
+            d[2 * total_width] = l[0] - ((h[-total_width] + h[0] + 1) >> 1);
+            d[total_width] = (h[-total_width] << 1) +
+                             ((d[0] + d[2 * total_width]) >> 1);
+            d += 2 * total_width;
+        }
+        d[total_width] = (h[0] << 1) + ((d[0] * 2) >> 1);
+    }
+}
+
+/*****************************************************************************/
+static void
+dequant(short *buffer, int count, int q)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        buffer[index] <<= (q - 1);
+    }
+}
+
+/*****************************************************************************/
+static void
+decode_component(const unsigned char *in, int in_bytes, int quant_idx,
+                 short *out)
+{
+    short tmp[4096];
+    const int *q;
+    int index;
+
+    q = g_rfx_quants[quant_idx];
+    dec_rlgr1(in, in_bytes, out, 4096);
+    for (index = 1; index < 64; index++)
+    {
+        out[4032 + index] += out[4032 + index - 1];
+    }
+    dequant(out, 1024, q[8]);
+    dequant(out + 1024, 1024, q[7]);
+    dequant(out + 2048, 1024, q[9]);
+    dequant(out + 3072, 256, q[5]);
+    dequant(out + 3328, 256, q[4]);
+    dequant(out + 3584, 256, q[6]);
+    dequant(out + 3840, 64, q[2]);
+    dequant(out + 3904, 64, q[1]);
+    dequant(out + 3968, 64, q[3]);
+    dequant(out + 4032, 64, q[0]);
+    idwt_level(out + 3840, tmp, 8);
+    idwt_level(out + 3072, tmp, 16);
+    idwt_level(out, tmp, 32);
+}
+
+/*****************************************************************************/
+static int
+rd16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/*****************************************************************************/
+static int
+rd32(const unsigned char *p)
+{
+    return rd16(p) | (rd16(p + 2) << 16);
+}
+
+/*****************************************************************************/
+static int
+clamp8(double v)
+{
+    int i;
+
+    i = (int) lrint(v);
+    return i < 0 ? 0 : i > 255 ? 255 : i;
+}
+
+/*****************************************************************************/
+/* walks one message, decodes every tile against img, returns error */
+static int
+check_message(const unsigned char *p, int bytes, const int *img,
+              int width, int height, int *has_header, int *num_tiles,
+              double *psnr)
+{
+    const unsigned char *end;
+    const unsigned char *q;
+    short y[4096];
+    short cb[4096];
+    short cr[4096];
+    double se;
+    double yy;
+    double d;
+    long count;
+    int type;
+    int len;
+    int tiles;
+    int tile_len;
+    int lens[3];
+    int tx;
+    int ty;
+    int px;
+    int py;
+    int x;
+    int i;
+    int o;
+
+    end = p + bytes;
+    *has_header = 0;
+    *num_tiles = 0;
+    se = 0;
+    count = 0;
+    while (p < end)
+    {
+        type = rd16(p);
+        len = rd32(p + 2);
+        if ((len < 6) || (p + len > end))
+        {
+            printf("bad block 0x%4.4x len %d\n", type, len);
+            return 1;
+        }
+        if (type == WBT_SYNC)
+        {
+            *has_header = 1;
+        }
+        if (type == WBT_EXTENSION)
+        {
+            /* codecId, channelId, CBT_TILESET, idx, properties */
+            q = p + 6 + 2 + 2 + 2 + 2;
+            tiles = rd16(q + 2);
+            q += 8 + q[0] * 5;
+            for (i = 0; i < tiles; i++)
+            {
+                tile_len = rd32(q + 2);
+                tx = rd16(q + 9);
+                ty = rd16(q + 11);
+                lens[0] = rd16(q + 13);
+                lens[1] = rd16(q + 15);
+                lens[2] = rd16(q + 17);
+                if (RFX_TILE_HEADER + lens[0] + lens[1] + lens[2] != tile_len)
+                {
+                    printf("tile %d %d bad length\n", tx, ty);
+                    return 1;
+                }
+                decode_component(q + 19, lens[0], q[6], y);
+                decode_component(q + 19 + lens[0], lens[1], q[7], cb);
+                decode_component(q + 19 + lens[0] + lens[1], lens[2], q[8],
+                                 cr);
+                for (x = 0; x < 4096; x++)
+                {
+                    px = tx * 64 + (x & 63);
+                    py = ty * 64 + (x >> 6);
+                    if ((px >= width) || (py >= height))
+                    {
+                        continue;
+                    }
+                    yy = y[x] + 4096;
+                    o = img[py * width + px];
+                    d = clamp8((yy + 1.402525 * cr[x]) / 32) -
+                        ((o >> 16) & 0xff);
+                    se += d * d;
+                    d = clamp8((yy - 0.343730 * cb[x] - 0.714401 * cr[x]) /
+                               32) - ((o >> 8) & 0xff);
+                    se += d * d;
+                    d = clamp8((yy + 1.769905 * cb[x]) / 32) - (o & 0xff);
+                    se += d * d;
+                    count += 3;
+                }
+                (*num_tiles)++;
+                q += tile_len;
+            }
+        }
+        p += len;
+    }
+    *psnr = count == 0 ? 0 : se == 0 ? 99 :
+            10 * log10(255.0 * 255.0 / (se / count));
+    return 0;
+}
+
+/*****************************************************************************/
+/* gradient, checker and noise, 200x130 so the right and bottom tiles are
+   partial */
+static int
+test_frames(void)
+{
+    struct xrdp_rfx *rfx;
+    int *img;
+    int width;
+    int height;
+    int x;
+    int y;
+    int r;
+    int g;
+    int b;
+    int header;
+    int tiles;
+    int out_bytes;
+    int errors;
+    char *out_data;
+    double psnr;
+    short drects[4];
+    short crects[8];
+
+    width = 200;
+    height = 130;
+    errors = 0;
+    img = (int *) malloc(width * height * 4);
+    srand(2);
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            r = x * 255 / width;
+            g = y * 255 / height;
+            b = ((x / 8 + y / 8) & 1) ? 200 : 30;
+            if ((x > 100) && (y > 60))
+            {
+                r = rand() & 0xff;
+                g = rand() & 0xff;
+                b = rand() & 0xff;
+            }
+            img[y * width + x] = (r << 16) | (g << 8) | b;
+        }
+    }
+    drects[0] = 0;
+    drects[1] = 0;
+    drects[2] = width;
+    drects[3] = height;
+    crects[0] = 0;
+    crects[1] = 0;
+    crects[2] = 100;
+    crects[3] = 50;
+    crects[4] = 90;
+    crects[5] = 40;
+    crects[6] = 110;
+    crects[7] = 90;
+    rfx = xrdp_rfx_create(width, height);
+    for (x = 0; x < 2; x++)
+    {
+        if (xrdp_rfx_encode(rfx, (char *) img, width, height, width * 4,
+                            drects, 1, crects, 2, x == 0, 256,
+                            &out_data, &out_bytes) != 0)
+        {
+            printf("xrdp_rfx_encode failed\n");
+            errors++;
+            break;
+        }
+        if (check_message((unsigned char *) out_data + 256, out_bytes, img,
+                          width, height, &header, &tiles, &psnr) != 0)
+        {
+            errors++;
+        }
+        else
+        {
+            printf("frame %d: bytes %d tiles %d psnr %.2f\n", x, out_bytes,
+                   tiles, psnr);
+            if (header != (x == 0))
+            {
+                printf("frame %d: header %d, wanted %d\n", x, header, x == 0);
+                errors++;
+            }
+            /* every grid tile touching the crects, 4 in row 0, 3 in rows 1, 2 */
+            if (tiles != 10)
+            {
+                printf("frame %d: %d tiles, wanted 10\n", x, tiles);
+                errors++;
+            }
+            if (psnr < 30)
+            {
+                printf("frame %d: psnr %.2f under 30\n", x, psnr);
+                errors++;
+            }
+        }
+        g_free(out_data);
+    }
+    xrdp_rfx_delete(rfx);
+    free(img);
+    return errors;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    int errors;
+
+    g_init("rfx_test");
+    errors = test_vectors();
+    errors += test_round_trip();
+    errors += test_frames();
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * the ssl_tls calls trans.c makes, for tests that link trans.o but never
+ * turn TLS on, so they build without openssl in place of ssl_calls.o,
+ * a trans asked for TLS fails as if ssl_tls_create could not allocate
+ */
+
+#include "arch.h"
+#include "ssl_calls.h"
+
+/*****************************************************************************/
+struct ssl_tls *APP_CC
+ssl_tls_create(struct trans *trans, const char *key, const char *cert)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+ssl_tls_accept(struct ssl_tls *self)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+int APP_CC
+ssl_tls_disconnect(struct ssl_tls *self)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+void APP_CC
+ssl_tls_delete(struct ssl_tls *self)
+{
+}
+
+/*****************************************************************************/
+int APP_CC
+ssl_tls_read(struct ssl_tls *tls, char *data, int length)
+{
+    return -1;
+}
+
+/*****************************************************************************/
+int APP_CC
+ssl_tls_write(struct ssl_tls *tls, const char *data, int length)
+{
+    return -1;
+}
+
+/*****************************************************************************/
+int APP_CC
+ssl_tls_can_recv(struct ssl_tls *tls, int sck, int millis)
+{
+    return 0;
+}
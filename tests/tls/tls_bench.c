@@ -0,0 +1,301 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of the TLS handshake in ssl_calls.c
+ * ssl_tls_accept is on one end of a unix socket pair, an openssl client
+ * thread on the other, checks a client resumes by session id when the
+ * connections share a process and by ticket when each is a forked child,
+ * and that a forked child keeps no session cache, then prints handshakes/s
+ * with a context made for every handshake, the way ssl_tls_accept used to,
+ * and with the shared one, full and resumed, in process and forked
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include <openssl/ssl.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "thread_calls.h"
+#include "trans.h"
+#include "ssl_calls.h"
+
+#define T_KEY "key.pem"
+#define T_CERT "cert.pem"
+#define T_HANDSHAKES 200
+
+/* the client end of one connection */
+struct client
+{
+    int sck;
+    SSL_CTX *ctx;
+    SSL_SESSION *session; /* to resume, then the one it got */
+    int ok;
+    tbus done; /* semaphore, up when the thread is finished */
+};
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* connects, keeps the session and sends a byte so the server knows the
+   client is done with the handshake */
+static THREAD_RV THREAD_CC
+client_thread(void *arg)
+{
+    struct client *cl;
+    SSL *ssl;
+
+    cl = (struct client *)arg;
+    ssl = SSL_new(cl->ctx);
+    SSL_set_fd(ssl, cl->sck);
+    if (cl->session != 0)
+    {
+        SSL_set_session(ssl, cl->session);
+    }
+    if ((SSL_connect(ssl) == 1) && (SSL_write(ssl, "x", 1) == 1))
+    {
+        if (cl->session != 0)
+        {
+            SSL_SESSION_free(cl->session);
+        }
+        cl->session = SSL_get1_session(ssl);
+        cl->ok = 1;
+    }
+    SSL_free(ssl);
+    close(cl->sck);
+    tc_sem_inc(cl->done);
+    return 0;
+}
+
+/*****************************************************************************/
+/* xrdp's end, what trans_set_tls_mode does, returns 1 for a full
+   handshake, 2 for a resumed one, 3 or more if the context has sessions
+   cached, 0 on error */
+static int
+server_accept(int sck)
+{
+    struct trans trans;
+    struct ssl_tls *tls;
+    char byte;
+    int rv;
+
+    g_memset(&trans, 0, sizeof(trans));
+    trans.sck = sck;
+    g_tcp_set_non_blocking(sck);
+    rv = 0;
+    tls = ssl_tls_create(&trans, T_KEY, T_CERT);
+    if ((ssl_tls_accept(tls) == 0) && (ssl_tls_read(tls, &byte, 1) == 1))
+    {
+        rv = SSL_session_reused(tls->ssl) ? 2 : 1;
+        if (SSL_CTX_sess_number(tls->ctx) > 0)
+        {
+            rv += 2;
+        }
+    }
+    ssl_tls_delete(tls);
+    close(sck);
+    return rv;
+}
+
+/*****************************************************************************/
+/* one connection, the client in a thread and the server here or in a
+   forked child as xrdp_listen_fork does it, returns what server_accept
+   does */
+static int
+connection(struct client *cl, int forking)
+{
+    int sv[2];
+    int pid;
+    int status;
+    int rv;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        return 0;
+    }
+    pid = 0;
+    if (forking)
+    {
+        /* before the client thread starts, the child has no locks held */
+        pid = g_fork();
+        if (pid == 0)
+        {
+            close(sv[1]);
+            _exit(server_accept(sv[0]));
+        }
+        close(sv[0]);
+    }
+    cl->sck = sv[1];
+    cl->ok = 0;
+    tc_thread_create(client_thread, cl);
+    if (forking)
+    {
+        waitpid(pid, &status, 0);
+        rv = WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+    }
+    else
+    {
+        rv = server_accept(sv[0]);
+    }
+    tc_sem_dec(cl->done);
+    return cl->ok ? rv : 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+check(SSL_CTX *ctx, SSL_CTX *ctx_no_ticket)
+{
+    struct client cl;
+    int errors;
+    int first;
+    int second;
+
+    errors = 0;
+    g_memset(&cl, 0, sizeof(cl));
+    cl.done = tc_sem_create(0);
+    /* in process, the session cache is shared, a client that does not do
+       tickets resumes by id */
+    ssl_tls_ctx_preload(T_KEY, T_CERT, 0);
+    cl.ctx = ctx_no_ticket;
+    first = connection(&cl, 0);
+    second = connection(&cl, 0);
+    if ((first != 3) || (second != 4))
+    {
+        printf("in process: not resumed by session id, %d %d\n",
+               first, second);
+        errors++;
+    }
+    SSL_SESSION_free(cl.session);
+    cl.session = 0;
+    /* forked, a child's cache would die with it so it has none, the
+       ticket a child issued is good in the next one */
+    ssl_tls_ctx_preload(T_KEY, T_CERT, 1);
+    first = connection(&cl, 1);
+    if (first != 1)
+    {
+        printf("forked: session cached, %d\n", first);
+        errors++;
+    }
+    SSL_SESSION_free(cl.session);
+    cl.session = 0;
+    cl.ctx = ctx;
+    first = connection(&cl, 1);
+    second = connection(&cl, 1);
+    if ((first != 1) || (second != 2))
+    {
+        printf("forked: not resumed by ticket, %d %d\n", first, second);
+        errors++;
+    }
+    SSL_SESSION_free(cl.session);
+    tc_sem_delete(cl.done);
+    printf("session resumption: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+static void
+bench_one(const char *name, SSL_CTX *ctx, int forking, int resume,
+          int reload)
+{
+    struct client cl;
+    double start;
+    double took;
+    int index;
+    int resumed;
+    int rv;
+
+    g_memset(&cl, 0, sizeof(cl));
+    cl.ctx = ctx;
+    cl.done = tc_sem_create(0);
+    ssl_tls_ctx_preload(T_KEY, T_CERT, forking);
+    /* the session to resume from */
+    connection(&cl, forking);
+    resumed = 0;
+    start = now_us();
+    for (index = 0; index < T_HANDSHAKES; index++)
+    {
+        if (!resume)
+        {
+            SSL_SESSION_free(cl.session);
+            cl.session = 0;
+        }
+        if (reload)
+        {
+            /* a new context from the key and certificate on disk */
+            ssl_tls_ctx_reload();
+        }
+        rv = connection(&cl, forking);
+        if ((rv == 2) || (rv == 4))
+        {
+            resumed++;
+        }
+    }
+    took = now_us() - start;
+    SSL_SESSION_free(cl.session);
+    tc_sem_delete(cl.done);
+    printf("%-28s %7.1f handshakes/s %7.3f ms each, %d resumed\n", name,
+           T_HANDSHAKES * 1000000.0 / took, took / T_HANDSHAKES / 1000.0,
+           resumed);
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    SSL_CTX *ctx;
+    SSL_CTX *ctx_no_ticket;
+    int errors;
+
+    g_init("tls_bench");
+    ssl_init();
+    if (!g_file_exist(T_KEY) || !g_file_exist(T_CERT))
+    {
+        printf("no %s or %s, make makes them\n", T_KEY, T_CERT);
+        return 1;
+    }
+    ctx = SSL_CTX_new(SSLv23_client_method());
+    ctx_no_ticket = SSL_CTX_new(SSLv23_client_method());
+    SSL_CTX_set_options(ctx_no_ticket, SSL_OP_NO_TICKET);
+    errors = check(ctx, ctx_no_ticket);
+    printf("%d handshakes each, RSA 2048\n", T_HANDSHAKES);
+    bench_one("context per handshake", ctx, 0, 0, 1);
+    bench_one("shared context, full", ctx, 0, 0, 0);
+    bench_one("shared context, ticket", ctx, 0, 1, 0);
+    bench_one("shared context, session id", ctx_no_ticket, 0, 1, 0);
+    bench_one("forked, full", ctx, 1, 0, 0);
+    bench_one("forked, ticket", ctx, 1, 1, 0);
+    SSL_CTX_free(ctx);
+    SSL_CTX_free(ctx_no_ticket);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
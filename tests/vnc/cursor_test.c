@@ -0,0 +1,161 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of the vnc module's cursor rebuild
+ * random cursors in 8, 15, 16 and 24 bpp, every width and height from 1
+ * to 40, go through lib_paint_cursor and the per pixel rebuild it had
+ * before, kept in old_cursor.c, checks both give the same 32x32 data and
+ * mask, prints cursors/s for both
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* lib_paint_cursor is static, take the module in whole */
+#include "vnc.c"
+
+#define T_LOOPS 20000
+
+void APP_CC
+old_paint_cursor(struct vnc *v, struct vnc_job *job, char *cursor_data,
+                 char *cursor_mask);
+
+static char g_data[32 * (32 * 3)];
+static char g_mask[32 * (32 / 8)];
+static unsigned int g_seed = 5;
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+test_set_cursor(struct vnc *v, int x, int y, char *data, char *mask)
+{
+    g_memcpy(g_data, data, sizeof(g_data));
+    g_memcpy(g_mask, mask, sizeof(g_mask));
+    return 0;
+}
+
+/*****************************************************************************/
+/* a cursor as the server sends it, pixels then the mask */
+static void
+make_job(struct vnc *v, struct vnc_job *job, int cx, int cy)
+{
+    int Bpp;
+    int bytes;
+    int index;
+
+    Bpp = (v->mod_bpp + 7) / 8;
+    Bpp = Bpp == 3 ? 4 : Bpp;
+    bytes = cx * cy * Bpp + ((cx + 7) / 8) * cy;
+    init_stream(job->s, bytes);
+    for (index = 0; index < bytes; index++)
+    {
+        job->s->data[index] = rnd();
+    }
+    job->cx = cx;
+    job->cy = cy;
+    job->x = rnd() % 40;
+    job->y = rnd() % 40;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const int bpps[] = { 8, 15, 16, 24 };
+    struct vnc *v;
+    struct vnc_job job;
+    char old_data[32 * (32 * 3)];
+    char old_mask[32 * (32 / 8)];
+    int errors;
+    int index;
+    int cx;
+    int cy;
+    int loop;
+    int start;
+    int ms_old;
+    int ms_new;
+
+    g_init("cursor_test");
+    errors = 0;
+    v = (struct vnc *) g_malloc(sizeof(struct vnc), 1);
+    v->server_set_cursor = test_set_cursor;
+    for (index = 0; index < 256; index++)
+    {
+        v->palette[index] = rnd() & 0xffffff;
+    }
+    g_memset(&job, 0, sizeof(job));
+    make_stream(job.s);
+    for (index = 0; index < 4; index++)
+    {
+        v->mod_bpp = bpps[index];
+        for (cy = 1; cy <= 40; cy++)
+        {
+            for (cx = 1; cx <= 40; cx++)
+            {
+                make_job(v, &job, cx, cy);
+                old_paint_cursor(v, &job, old_data, old_mask);
+                lib_paint_cursor(v, &job);
+                if ((g_memcmp(old_data, g_data, sizeof(g_data)) != 0) ||
+                    (g_memcmp(old_mask, g_mask, sizeof(g_mask)) != 0))
+                {
+                    if (errors < 10)
+                    {
+                        printf("%d bpp %dx%d cursor differs\n", v->mod_bpp,
+                               cx, cy);
+                    }
+                    errors++;
+                }
+            }
+        }
+    }
+
+    for (index = 0; index < 4; index++)
+    {
+        v->mod_bpp = bpps[index];
+        make_job(v, &job, 32, 32);
+        start = g_time3();
+        for (loop = 0; loop < T_LOOPS; loop++)
+        {
+            old_paint_cursor(v, &job, old_data, old_mask);
+        }
+        ms_old = g_time3() - start;
+        start = g_time3();
+        for (loop = 0; loop < T_LOOPS; loop++)
+        {
+            lib_paint_cursor(v, &job);
+        }
+        ms_new = g_time3() - start;
+        printf("%2d bpp 32x32 per pixel %8.0f cursors/s, by row %8.0f "
+               "cursors/s\n", v->mod_bpp,
+               ms_old < 1 ? 0 : T_LOOPS * 1000.0 / ms_old,
+               ms_new < 1 ? 0 : T_LOOPS * 1000.0 / ms_new);
+    }
+
+    free_stream(job.s);
+    g_free(v);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
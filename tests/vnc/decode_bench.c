@@ -0,0 +1,1251 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of the vnc module's rect decoding against an Xvnc
+ * stand in
+ * the stand in is a forked child on a loopback tcp port, it does the RFB
+ * 3.3 handshake and answers each FramebufferUpdateRequest with the next
+ * frame of a 1920x1080 24 bpp desktop, an editor window scrolling a line
+ * of text a frame and a video window, in raw, ZRLE, Tight or Tight with
+ * JPEG, the ZRLE and Tight frames are recorded before the module connects
+ * so encoding does not hold it back, raw frames are drawn while the module
+ * paints the one before
+ * the module is driven through its wait objects the way xrdp does, checks
+ * what it painted is the desktop, JPEG only close in the video window,
+ * then prints fps, the wire rate, the cpu the module used, decoder thread
+ * included, and the cpu of the main thread alone
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <zlib.h>
+#include <jpeglib.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "vnc.h"
+#include "vnc_decode.h"
+
+#define T_WIDTH 1920
+#define T_HEIGHT 1080
+#define T_FRAMES 100
+#define T_BACKGROUND 0x3a6ea5
+
+/* the windows that change every frame */
+#define T_EDIT_X 80
+#define T_EDIT_Y 60
+#define T_EDIT_W 1024
+#define T_EDIT_H 768
+#define T_VIDEO_X 1200
+#define T_VIDEO_Y 300
+#define T_VIDEO_W 640
+#define T_VIDEO_H 360
+
+#define T_RAW 0
+#define T_ZRLE 1
+#define T_TIGHT 2
+#define T_TIGHT_JPEG 3
+
+struct vnc *EXPORT_CC
+mod_init(void);
+int EXPORT_CC
+mod_exit(struct vnc *v);
+
+/* a growing byte buffer, a recorded frame or a rect before deflate */
+struct rec
+{
+    char *data;
+    int bytes;
+    int size;
+};
+
+/* the stand in's encoder state, the zlib streams last the connection */
+struct standin
+{
+    int mode;
+    z_stream zrle_zs;
+    z_stream tight_zs[3];
+    struct rec tmp;
+    tui32 *fb;
+};
+
+static tui32 *g_fb; /* what the module painted */
+static int g_rects;
+
+/*****************************************************************************/
+static tui32
+hash(tui32 a, tui32 b)
+{
+    a = a * 0x9e3779b1 + b;
+    a ^= a >> 15;
+    a *= 0x85ebca6b;
+    a ^= a >> 13;
+    return a;
+}
+
+/*****************************************************************************/
+static int
+tri(int v)
+{
+    v &= 0x1ff;
+    return v > 255 ? 511 - v : v;
+}
+
+/*****************************************************************************/
+/* frame 0 is the whole desktop, after that only the windows change and
+   what is in them depends only on the frame */
+static void
+render(tui32 *fb, int frame)
+{
+    tui32 *d;
+    int line;
+    int col;
+    int ch;
+    int bits;
+    int x;
+    int y;
+    int r;
+    int g;
+    int b;
+
+    if (frame == 0)
+    {
+        for (x = 0; x < T_WIDTH * T_HEIGHT; x++)
+        {
+            fb[x] = T_BACKGROUND;
+        }
+    }
+
+    /* 8x16 cells, one text line scrolls off the top every frame */
+    for (y = 0; y < T_EDIT_H; y++)
+    {
+        d = fb + (T_EDIT_Y + y) * T_WIDTH + T_EDIT_X;
+        line = y / 16 + frame;
+
+        for (x = 0; x < T_EDIT_W; x++)
+        {
+            col = x / 8;
+            ch = hash(line, col) % 96;
+            bits = 0;
+
+            if ((col < (int)(hash(line, 0) % 120)) && (ch > 16) &&
+                (y % 16 > 2) && (y % 16 < 14))
+            {
+                bits = hash(ch, y % 16) >> (x % 8 + 8);
+            }
+
+            d[x] = (bits & 1) ? 0x000000 : 0xffffff;
+        }
+    }
+
+    /* smooth colours and a little noise, moving every frame */
+    for (y = 0; y < T_VIDEO_H; y++)
+    {
+        d = fb + (T_VIDEO_Y + y) * T_WIDTH + T_VIDEO_X;
+
+        for (x = 0; x < T_VIDEO_W; x++)
+        {
+            r = tri(x * 2 + frame * 5) + (hash(x, y + frame) & 3);
+            g = tri(y * 3 + frame * 3) + (hash(y, x + frame) & 3);
+            b = tri(x + y + frame * 7);
+            d[x] = (MIN(r, 255) << 16) | (MIN(g, 255) << 8) | b;
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+rec_reserve(struct rec *r, int bytes)
+{
+    if (r->bytes + bytes > r->size)
+    {
+        r->size = (r->bytes + bytes) * 2;
+        r->data = (char *)realloc(r->data, r->size);
+    }
+}
+
+/*****************************************************************************/
+static void
+rec_u8(struct rec *r, int v)
+{
+    rec_reserve(r, 1);
+    r->data[r->bytes++] = v;
+}
+
+/*****************************************************************************/
+static void
+rec_u16(struct rec *r, int v)
+{
+    rec_u8(r, v >> 8);
+    rec_u8(r, v);
+}
+
+/*****************************************************************************/
+static void
+rec_u32(struct rec *r, int v)
+{
+    rec_u16(r, v >> 16);
+    rec_u16(r, v);
+}
+
+/*****************************************************************************/
+static void
+rec_data(struct rec *r, const void *data, int bytes)
+{
+    rec_reserve(r, bytes);
+    memcpy(r->data + r->bytes, data, bytes);
+    r->bytes += bytes;
+}
+
+/*****************************************************************************/
+/* ZRLE CPIXEL, the low 3 bytes of the little endian pixel */
+static void
+rec_cpixel(struct rec *r, tui32 pixel)
+{
+    rec_u8(r, pixel);
+    rec_u8(r, pixel >> 8);
+    rec_u8(r, pixel >> 16);
+}
+
+/*****************************************************************************/
+/* Tight TPIXEL, r, g, b */
+static void
+rec_tpixel(struct rec *r, tui32 pixel)
+{
+    rec_u8(r, pixel >> 16);
+    rec_u8(r, pixel >> 8);
+    rec_u8(r, pixel);
+}
+
+/*****************************************************************************/
+static void
+rec_rect(struct rec *r, int x, int y, int cx, int cy, int encoding)
+{
+    rec_u16(r, x);
+    rec_u16(r, y);
+    rec_u16(r, cx);
+    rec_u16(r, cy);
+    rec_u32(r, encoding);
+}
+
+/*****************************************************************************/
+/* deflate in to the end of r, flushed so the rect stands alone */
+static void
+rec_deflate(struct rec *r, z_stream *zs, struct rec *in)
+{
+    zs->next_in = (Bytef *)(in->data);
+    zs->avail_in = in->bytes;
+
+    do
+    {
+        rec_reserve(r, in->bytes / 2 + 1024);
+        zs->next_out = (Bytef *)(r->data + r->bytes);
+        zs->avail_out = r->size - r->bytes;
+        deflate(zs, Z_SYNC_FLUSH);
+        r->bytes = r->size - zs->avail_out;
+    }
+    while (zs->avail_out == 0);
+}
+
+/*****************************************************************************/
+/* up to max distinct colours of the rect into palette, returns the count
+   or max + 1 if there are more */
+static int
+count_colors(const tui32 *fb, int x, int y, int cx, int cy,
+             tui32 *palette, int max)
+{
+    const tui32 *s;
+    int count;
+    int i;
+    int j;
+    int k;
+
+    count = 0;
+
+    for (j = 0; j < cy; j++)
+    {
+        s = fb + (y + j) * T_WIDTH + x;
+
+        for (i = 0; i < cx; i++)
+        {
+            /* runs are common, skip the search for them */
+            if (count > 0 && s[i] == palette[count - 1])
+            {
+                continue;
+            }
+
+            for (k = 0; k < count; k++)
+            {
+                if (palette[k] == s[i])
+                {
+                    break;
+                }
+            }
+
+            if (k == count)
+            {
+                if (count == max)
+                {
+                    return max + 1;
+                }
+
+                palette[count++] = s[i];
+            }
+        }
+    }
+
+    return count;
+}
+
+/*****************************************************************************/
+static int
+palette_index(const tui32 *palette, int count, tui32 pixel)
+{
+    int k;
+
+    for (k = 0; k < count; k++)
+    {
+        if (palette[k] == pixel)
+        {
+            return k;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* 64x64 tiles, solid, packed palette or raw */
+static void
+zrle_rect(struct standin *st, struct rec *r, int x, int y, int cx, int cy)
+{
+    struct rec *t;
+    tui32 palette[17];
+    const tui32 *s;
+    int count;
+    int bits;
+    int shift;
+    int byte;
+    int tx;
+    int ty;
+    int tw;
+    int th;
+    int i;
+    int j;
+
+    t = &(st->tmp);
+    t->bytes = 0;
+
+    for (ty = y; ty < y + cy; ty += 64)
+    {
+        th = MIN(64, y + cy - ty);
+
+        for (tx = x; tx < x + cx; tx += 64)
+        {
+            tw = MIN(64, x + cx - tx);
+            count = count_colors(st->fb, tx, ty, tw, th, palette, 16);
+
+            if (count == 1)
+            {
+                rec_u8(t, 1);
+                rec_cpixel(t, palette[0]);
+                continue;
+            }
+
+            if (count > 16)
+            {
+                rec_u8(t, 0);
+
+                for (j = 0; j < th; j++)
+                {
+                    s = st->fb + (ty + j) * T_WIDTH + tx;
+
+                    for (i = 0; i < tw; i++)
+                    {
+                        rec_cpixel(t, s[i]);
+                    }
+                }
+
+                continue;
+            }
+
+            rec_u8(t, count);
+
+            for (i = 0; i < count; i++)
+            {
+                rec_cpixel(t, palette[i]);
+            }
+
+            bits = count <= 2 ? 1 : count <= 4 ? 2 : 4;
+
+            for (j = 0; j < th; j++)
+            {
+                s = st->fb + (ty + j) * T_WIDTH + tx;
+                byte = 0;
+                shift = 8 - bits;
+
+                for (i = 0; i < tw; i++)
+                {
+                    byte |= palette_index(palette, count, s[i]) << shift;
+                    shift -= bits;
+
+                    if (shift < 0)
+                    {
+                        rec_u8(t, byte);
+                        byte = 0;
+                        shift = 8 - bits;
+                    }
+                }
+
+                if (shift != 8 - bits)
+                {
+                    rec_u8(t, byte);
+                }
+            }
+        }
+    }
+
+    rec_rect(r, x, y, cx, cy, VNC_ENC_ZRLE);
+    rec_u32(r, 0);
+    i = r->bytes;
+    rec_deflate(r, &(st->zrle_zs), t);
+    /* the length goes in front */
+    j = r->bytes - i;
+    r->data[i - 4] = j >> 24;
+    r->data[i - 3] = j >> 16;
+    r->data[i - 2] = j >> 8;
+    r->data[i - 1] = j;
+}
+
+/*****************************************************************************/
+static void
+rec_compact_length(struct rec *r, int length)
+{
+    if (length < 0x80)
+    {
+        rec_u8(r, length);
+    }
+    else if (length < 0x4000)
+    {
+        rec_u8(r, (length & 0x7f) | 0x80);
+        rec_u8(r, length >> 7);
+    }
+    else
+    {
+        rec_u8(r, (length & 0x7f) | 0x80);
+        rec_u8(r, ((length >> 7) & 0x7f) | 0x80);
+        rec_u8(r, length >> 14);
+    }
+}
+
+/*****************************************************************************/
+static void
+tight_jpeg(struct rec *r, const tui32 *fb, int x, int y, int cx, int cy)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row_pointer[1];
+    unsigned char *out;
+    unsigned long out_bytes;
+    unsigned char *row;
+    const tui32 *s;
+    int i;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    out = 0;
+    out_bytes = 0;
+    jpeg_mem_dest(&cinfo, &out, &out_bytes);
+    cinfo.image_width = cx;
+    cinfo.image_height = cy;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    /* quality level 8, what the module asks for */
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    row = (unsigned char *)malloc(cx * 3);
+    row_pointer[0] = row;
+
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        s = fb + (y + cinfo.next_scanline) * T_WIDTH + x;
+
+        for (i = 0; i < cx; i++)
+        {
+            row[i * 3 + 0] = s[i] >> 16;
+            row[i * 3 + 1] = s[i] >> 8;
+            row[i * 3 + 2] = s[i];
+        }
+
+        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    rec_u8(r, 0x90);
+    rec_compact_length(r, out_bytes);
+    rec_data(r, out, out_bytes);
+    free(out);
+}
+
+/*****************************************************************************/
+/* one Tight rect, fill, two colour or indexed palette, JPEG or copy */
+static void
+tight_sub(struct standin *st, struct rec *r, int x, int y, int cx, int cy)
+{
+    struct rec *t;
+    tui32 palette[256];
+    const tui32 *s;
+    int count;
+    int zid;
+    int byte;
+    int i;
+    int j;
+
+    rec_rect(r, x, y, cx, cy, VNC_ENC_TIGHT);
+    count = count_colors(st->fb, x, y, cx, cy, palette, 16);
+
+    if (count == 1)
+    {
+        rec_u8(r, 0x80);
+        rec_tpixel(r, palette[0]);
+        return;
+    }
+
+    /* JPEG for the video, as a server that finds the photo parts would,
+       the rest stays lossless */
+    if (count > 16 && st->mode == T_TIGHT_JPEG && x >= T_VIDEO_X &&
+        y >= T_VIDEO_Y && x + cx <= T_VIDEO_X + T_VIDEO_W &&
+        y + cy <= T_VIDEO_Y + T_VIDEO_H)
+    {
+        tight_jpeg(r, st->fb, x, y, cx, cy);
+        return;
+    }
+
+    t = &(st->tmp);
+    t->bytes = 0;
+
+    if (count > 16)
+    {
+        zid = 0;
+        rec_u8(r, 0x00);
+
+        for (j = 0; j < cy; j++)
+        {
+            s = st->fb + (y + j) * T_WIDTH + x;
+
+            for (i = 0; i < cx; i++)
+            {
+                rec_tpixel(t, s[i]);
+            }
+        }
+    }
+    else
+    {
+        zid = count == 2 ? 1 : 2;
+        rec_u8(r, (zid | 4) << 4);
+        rec_u8(r, 1);
+        rec_u8(r, count - 1);
+
+        for (i = 0; i < count; i++)
+        {
+            rec_tpixel(r, palette[i]);
+        }
+
+        for (j = 0; j < cy; j++)
+        {
+            s = st->fb + (y + j) * T_WIDTH + x;
+            byte = 0;
+
+            for (i = 0; i < cx; i++)
+            {
+                if (count == 2)
+                {
+                    byte |= palette_index(palette, 2, s[i]) << (7 - (i & 7));
+
+                    if ((i & 7) == 7 || i == cx - 1)
+                    {
+                        rec_u8(t, byte);
+                        byte = 0;
+                    }
+                }
+                else
+                {
+                    rec_u8(t, palette_index(palette, count, s[i]));
+                }
+            }
+        }
+    }
+
+    if (t->bytes < 12)
+    {
+        rec_data(r, t->data, t->bytes);
+        return;
+    }
+
+    i = r->bytes;
+    rec_deflate(r, &(st->tight_zs[zid]), t);
+    /* the compact length goes in front, move the data up for it */
+    j = r->bytes - i;
+    rec_reserve(r, 3);
+    memmove(r->data + i + 3, r->data + i, j);
+    r->bytes = i;
+    rec_compact_length(r, j);
+    memmove(r->data + r->bytes, r->data + i + 3, j);
+    r->bytes += j;
+}
+
+/*****************************************************************************/
+/* Tight rects are at most 2048 wide and 64k pixels, as TigerVNC sends */
+static int
+tight_band(int cx)
+{
+    return MAX(1, 65536 / MIN(cx, 2048));
+}
+
+/*****************************************************************************/
+static int
+tight_rects(int cx, int cy)
+{
+    return ((cx + 2047) / 2048) * ((cy + tight_band(cx) - 1) / tight_band(cx));
+}
+
+/*****************************************************************************/
+static void
+tight_rect(struct standin *st, struct rec *r, int x, int y, int cx, int cy)
+{
+    int band;
+    int i;
+    int j;
+
+    band = tight_band(cx);
+
+    for (j = 0; j < cy; j += band)
+    {
+        for (i = 0; i < cx; i += 2048)
+        {
+            tight_sub(st, r, x + i, y + j, MIN(2048, cx - i),
+                      MIN(band, cy - j));
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+raw_rect(struct standin *st, struct rec *r, int x, int y, int cx, int cy)
+{
+    int j;
+
+    rec_rect(r, x, y, cx, cy, VNC_ENC_RAW);
+
+    for (j = 0; j < cy; j++)
+    {
+        rec_data(r, st->fb + (y + j) * T_WIDTH + x, cx * 4);
+    }
+}
+
+/*****************************************************************************/
+/* the rects of a frame, frame 0 is everything */
+static int
+frame_areas(int frame, int *areas)
+{
+    if (frame == 0)
+    {
+        areas[0] = 0;
+        areas[1] = 0;
+        areas[2] = T_WIDTH;
+        areas[3] = T_HEIGHT;
+        return 1;
+    }
+
+    areas[0] = T_EDIT_X;
+    areas[1] = T_EDIT_Y;
+    areas[2] = T_EDIT_W;
+    areas[3] = T_EDIT_H;
+    areas[4] = T_VIDEO_X;
+    areas[5] = T_VIDEO_Y;
+    areas[6] = T_VIDEO_W;
+    areas[7] = T_VIDEO_H;
+    return 2;
+}
+
+/*****************************************************************************/
+/* rects the module gets for the whole run */
+static int
+total_rects(int mode)
+{
+    int areas[8];
+    int count;
+    int frame;
+    int total;
+    int i;
+
+    total = 0;
+
+    for (frame = 0; frame <= T_FRAMES; frame++)
+    {
+        count = frame_areas(frame, areas);
+
+        for (i = 0; i < count; i++)
+        {
+            if (mode == T_TIGHT || mode == T_TIGHT_JPEG)
+            {
+                total += tight_rects(areas[i * 4 + 2], areas[i * 4 + 3]);
+            }
+            else
+            {
+                total += 1;
+            }
+        }
+    }
+
+    return total;
+}
+
+/*****************************************************************************/
+/* the FramebufferUpdate for a frame, appended to r */
+static void
+encode_frame(struct standin *st, struct rec *r, int frame)
+{
+    int areas[8];
+    int count;
+    int rects;
+    int i;
+    int *a;
+
+    render(st->fb, frame);
+    count = frame_areas(frame, areas);
+    rects = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (st->mode == T_TIGHT || st->mode == T_TIGHT_JPEG)
+        {
+            rects += tight_rects(areas[i * 4 + 2], areas[i * 4 + 3]);
+        }
+        else
+        {
+            rects++;
+        }
+    }
+
+    rec_u8(r, 0);
+    rec_u8(r, 0);
+    rec_u16(r, rects);
+
+    for (i = 0; i < count; i++)
+    {
+        a = areas + i * 4;
+
+        switch (st->mode)
+        {
+            case T_RAW:
+                raw_rect(st, r, a[0], a[1], a[2], a[3]);
+                break;
+            case T_ZRLE:
+                zrle_rect(st, r, a[0], a[1], a[2], a[3]);
+                break;
+            default:
+                tight_rect(st, r, a[0], a[1], a[2], a[3]);
+                break;
+        }
+    }
+}
+
+/*****************************************************************************/
+static int
+read_full(int sck, char *data, int bytes)
+{
+    int rv;
+
+    while (bytes > 0)
+    {
+        rv = recv(sck, data, bytes, 0);
+
+        if (rv <= 0)
+        {
+            return 1;
+        }
+
+        data += rv;
+        bytes -= rv;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+write_full(int sck, const char *data, int bytes)
+{
+    int rv;
+
+    while (bytes > 0)
+    {
+        rv = send(sck, data, bytes, 0);
+
+        if (rv <= 0)
+        {
+            return 1;
+        }
+
+        data += rv;
+        bytes -= rv;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* read client messages up to and including a FramebufferUpdateRequest,
+   returns error, the connection closing is one */
+static int
+wait_request(int sck)
+{
+    char buf[256];
+    int bytes;
+
+    while (1)
+    {
+        if (read_full(sck, buf, 1) != 0)
+        {
+            return 1;
+        }
+
+        switch ((tui8)(buf[0]))
+        {
+            case 0: /* SetPixelFormat */
+                bytes = 19;
+                break;
+            case 2: /* SetEncodings */
+                if (read_full(sck, buf, 3) != 0)
+                {
+                    return 1;
+                }
+
+                bytes = (((tui8)(buf[1]) << 8) | (tui8)(buf[2])) * 4;
+                break;
+            case 3: /* FramebufferUpdateRequest */
+                return read_full(sck, buf, 9);
+            case 4: /* KeyEvent */
+                bytes = 7;
+                break;
+            case 5: /* PointerEvent */
+                bytes = 5;
+                break;
+            default:
+                return 1;
+        }
+
+        while (bytes > 0)
+        {
+            if (read_full(sck, buf, MIN(bytes, 256)) != 0)
+            {
+                return 1;
+            }
+
+            bytes -= MIN(bytes, 256);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* the Xvnc stand in, in its own process, writes the bytes it sent to
+   the pipe when the module goes away */
+static void
+standin(int lsck, int mode, int pipe_fd)
+{
+    struct standin st;
+    struct rec *frames;
+    struct rec r;
+    struct rec init;
+    double sent;
+    char buf[16];
+    int sck;
+    int frame;
+    int i;
+
+    memset(&st, 0, sizeof(st));
+    st.mode = mode;
+    st.fb = (tui32 *)malloc(T_WIDTH * T_HEIGHT * 4);
+    deflateInit(&(st.zrle_zs), 1);
+
+    for (i = 0; i < 3; i++)
+    {
+        deflateInit(&(st.tight_zs[i]), 1);
+    }
+
+    /* record the compressed frames */
+    frames = (struct rec *)calloc(T_FRAMES + 1, sizeof(struct rec));
+
+    if (mode != T_RAW)
+    {
+        for (frame = 0; frame <= T_FRAMES; frame++)
+        {
+            encode_frame(&st, frames + frame, frame);
+        }
+    }
+
+    sck = accept(lsck, 0, 0);
+    close(lsck);
+    memset(&init, 0, sizeof(init));
+    rec_data(&init, "RFB 003.003\n", 12);
+    rec_u32(&init, 1); /* no security */
+
+    if (write_full(sck, init.data, init.bytes) != 0 ||
+        read_full(sck, buf, 12) != 0 || read_full(sck, buf, 1) != 0)
+    {
+        _exit(1);
+    }
+
+    init.bytes = 0;
+    rec_u16(&init, T_WIDTH);
+    rec_u16(&init, T_HEIGHT);
+    rec_data(&init, "\x20\x18\x00\x01\x00\xff\x00\xff\x00\xff\x10\x08\x00"
+             "\x00\x00\x00", 16);
+    rec_u32(&init, 5);
+    rec_data(&init, "bench", 5);
+    write_full(sck, init.data, init.bytes);
+    sent = 0;
+    memset(&r, 0, sizeof(r));
+
+    for (frame = 0; frame <= T_FRAMES; frame++)
+    {
+        if (mode == T_RAW)
+        {
+            /* drawn while the module is busy with the last one */
+            r.bytes = 0;
+            encode_frame(&st, &r, frame);
+        }
+        else
+        {
+            r = frames[frame];
+        }
+
+        if (wait_request(sck) != 0 || write_full(sck, r.data, r.bytes) != 0)
+        {
+            break;
+        }
+
+        sent += r.bytes;
+    }
+
+    /* the module asks once more, then closes */
+    while (wait_request(sck) == 0)
+    {
+    }
+
+    write(pipe_fd, &sent, sizeof(sent));
+    close(sck);
+    _exit(0);
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_paint_rect(struct vnc *v, int x, int y, int cx, int cy, char *data,
+                 int width, int height, int srcx, int srcy)
+{
+    int j;
+
+    for (j = 0; j < cy; j++)
+    {
+        memcpy(g_fb + (y + j) * T_WIDTH + x,
+               data + ((srcy + j) * width + srcx) * 4, cx * 4);
+    }
+
+    g_rects++;
+    return 0;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_screen_blt(struct vnc *v, int x, int y, int cx, int cy, int srcx,
+                 int srcy)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_nothing(struct vnc *v)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_msg(struct vnc *v, char *msg, int code)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_reset(struct vnc *v, int width, int height, int bpp)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_set_cursor(struct vnc *v, int x, int y, char *data, char *mask)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_get_channel_id(struct vnc *v, char *name)
+{
+    return -1;
+}
+
+/*****************************************************************************/
+static double
+cpu_us(int who)
+{
+    struct rusage ru;
+    struct timespec ts;
+
+    if (who == 0)
+    {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+    }
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* what the module painted against the last frame, exact or, for JPEG,
+   exact outside the video window and close inside it, returns error */
+static int
+check_fb(const tui32 *expect, int mode)
+{
+    double diff;
+    int in_video;
+    int x;
+    int y;
+    int c;
+    tui32 a;
+    tui32 b;
+
+    diff = 0;
+
+    for (y = 0; y < T_HEIGHT; y++)
+    {
+        for (x = 0; x < T_WIDTH; x++)
+        {
+            a = expect[y * T_WIDTH + x] & 0xffffff;
+            b = g_fb[y * T_WIDTH + x] & 0xffffff;
+            in_video = x >= T_VIDEO_X && x < T_VIDEO_X + T_VIDEO_W &&
+                       y >= T_VIDEO_Y && y < T_VIDEO_Y + T_VIDEO_H;
+
+            if (mode == T_TIGHT_JPEG && in_video)
+            {
+                for (c = 0; c < 24; c += 8)
+                {
+                    diff += abs((int)((a >> c) & 0xff) -
+                                (int)((b >> c) & 0xff));
+                }
+            }
+            else if (a != b)
+            {
+                printf("pixel %d %d is %6.6x, not %6.6x\n", x, y, b, a);
+                return 1;
+            }
+        }
+    }
+
+    diff /= T_VIDEO_W * T_VIDEO_H * 3;
+
+    if (diff > 4)
+    {
+        printf("jpeg off by %.1f a channel\n", diff);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* one run of the module against the stand in, returns error */
+static int
+run(const char *name, int mode, const tui32 *expect)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    struct vnc *v;
+    tbus robjs[32];
+    tbus wobjs[32];
+    char port[16];
+    double start;
+    double took;
+    double cpu_start;
+    double cpu;
+    double main_start;
+    double main_cpu;
+    double sent;
+    int pipe_fds[2];
+    int rcount;
+    int wcount;
+    int timeout;
+    int total;
+    int lsck;
+    int pid;
+    int error;
+
+    lsck = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(lsck, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(lsck, 2) != 0 || pipe(pipe_fds) != 0)
+    {
+        printf("%s: no loopback socket\n", name);
+        return 1;
+    }
+
+    addr_len = sizeof(addr);
+    getsockname(lsck, (struct sockaddr *)&addr, &addr_len);
+    g_snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+    pid = fork();
+
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        standin(lsck, mode, pipe_fds[1]);
+    }
+
+    close(lsck);
+    close(pipe_fds[1]);
+    memset(g_fb, 0, T_WIDTH * T_HEIGHT * 4);
+    g_rects = 0;
+    total = total_rects(mode);
+    v = mod_init();
+    v->server_begin_update = bench_nothing;
+    v->server_end_update = bench_nothing;
+    v->server_paint_rect = bench_paint_rect;
+    v->server_screen_blt = bench_screen_blt;
+    v->server_msg = bench_msg;
+    v->server_reset = bench_reset;
+    v->server_set_cursor = bench_set_cursor;
+    v->server_get_channel_id = bench_get_channel_id;
+    v->server_bpp = 24;
+    v->mod_set_param(v, "ip", "127.0.0.1");
+    v->mod_set_param(v, "port", port);
+    error = v->mod_connect(v);
+    start = now_us();
+    cpu_start = cpu_us(1);
+    main_start = cpu_us(0);
+
+    while (error == 0 && g_rects < total)
+    {
+        rcount = 0;
+        wcount = 0;
+        timeout = 1000;
+        v->mod_get_wait_objs(v, robjs, &rcount, wobjs, &wcount, &timeout);
+        g_obj_wait(robjs, rcount, wobjs, wcount, timeout);
+        error = v->mod_check_wait_objs(v);
+
+        if (now_us() - start > 120 * 1000000.0)
+        {
+            printf("%s: timed out, %d rects of %d\n", name, g_rects, total);
+            error = 1;
+        }
+    }
+
+    took = now_us() - start;
+    cpu = cpu_us(1) - cpu_start;
+    main_cpu = cpu_us(0) - main_start;
+    mod_exit(v);
+    sent = 0;
+
+    if (read(pipe_fds[0], &sent, sizeof(sent)) != sizeof(sent))
+    {
+        error = 1;
+    }
+
+    close(pipe_fds[0]);
+    waitpid(pid, 0, 0);
+
+    if (error == 0)
+    {
+        error = check_fb(expect, mode);
+    }
+
+    printf("%-12s %6.1f fps %7.1f MB/s %6.0f KB a frame  cpu %4.0f%%  "
+           "main thread %4.0f%%  %s\n", name,
+           (T_FRAMES + 1) * 1000000.0 / took, sent / took,
+           sent / 1024 / (T_FRAMES + 1), cpu * 100 / took,
+           main_cpu * 100 / took, error == 0 ? "ok" : "FAILED");
+    return error;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    tui32 *expect;
+    int errors;
+
+    g_init("decode_bench");
+    g_fb = (tui32 *)malloc(T_WIDTH * T_HEIGHT * 4);
+    expect = (tui32 *)malloc(T_WIDTH * T_HEIGHT * 4);
+    render(expect, 0);
+    render(expect, T_FRAMES);
+    printf("%dx%d 24 bpp, %d frames, editor %dx%d scrolling, video %dx%d\n",
+           T_WIDTH, T_HEIGHT, T_FRAMES + 1, T_EDIT_W, T_EDIT_H, T_VIDEO_W,
+           T_VIDEO_H);
+    errors = 0;
+    errors += run("raw", T_RAW, expect);
+    errors += run("zrle", T_ZRLE, expect);
+    errors += run("tight", T_TIGHT, expect);
+    errors += run("tight jpeg", T_TIGHT_JPEG, expect);
+    free(expect);
+    free(g_fb);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * the vnc module's cursor rebuild as it was, one pixel at a time, kept
+ * here as the reference cursor_test checks the row at a time one against
+ */
+
+#include "vnc.h"
+#include "vnc_decode.h"
+#include "log.h"
+
+/******************************************************************************/
+static int
+get_pixel_safe(char *data, int x, int y, int width, int height, int bpp)
+{
+    int start = 0;
+    int shift = 0;
+
+    if (x < 0)
+    {
+        return 0;
+    }
+
+    if (y < 0)
+    {
+        return 0;
+    }
+
+    if (x >= width)
+    {
+        return 0;
+    }
+
+    if (y >= height)
+    {
+        return 0;
+    }
+
+    if (bpp == 1)
+    {
+        width = (width + 7) / 8;
+        start = (y * width) + x / 8;
+        shift = x % 8;
+        return (data[start] & (0x80 >> shift)) != 0;
+    }
+    else if (bpp == 4)
+    {
+        width = (width + 1) / 2;
+        start = y * width + x / 2;
+        shift = x % 2;
+
+        if (shift == 0)
+        {
+            return (data[start] & 0xf0) >> 4;
+        }
+        else
+        {
+            return data[start] & 0x0f;
+        }
+    }
+    else if (bpp == 8)
+    {
+        return *(((unsigned char *)data) + (y * width + x));
+    }
+    else if (bpp == 15 || bpp == 16)
+    {
+        return *(((unsigned short *)data) + (y * width + x));
+    }
+    else if (bpp == 24 || bpp == 32)
+    {
+        return *(((unsigned int *)data) + (y * width + x));
+    }
+    else
+    {
+        log_message(LOG_LEVEL_ERROR, "error in get_pixel_safe bpp %d", bpp);
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+static void
+set_pixel_safe(char *data, int x, int y, int width, int height, int bpp,
+               int pixel)
+{
+    int start = 0;
+    int shift = 0;
+
+    if (x < 0)
+    {
+        return;
+    }
+
+    if (y < 0)
+    {
+        return;
+    }
+
+    if (x >= width)
+    {
+        return;
+    }
+
+    if (y >= height)
+    {
+        return;
+    }
+
+    if (bpp == 1)
+    {
+        width = (width + 7) / 8;
+        start = (y * width) + x / 8;
+        shift = x % 8;
+
+        if (pixel & 1)
+        {
+            data[start] = data[start] | (0x80 >> shift);
+        }
+        else
+        {
+            data[start] = data[start] & ~(0x80 >> shift);
+        }
+    }
+    else if (bpp == 15 || bpp == 16)
+    {
+        *(((unsigned short *)data) + (y * width + x)) = pixel;
+    }
+    else if (bpp == 24)
+    {
+        *(data + (3 * (y * width + x)) + 0) = pixel >> 0;
+        *(data + (3 * (y * width + x)) + 1) = pixel >> 8;
+        *(data + (3 * (y * width + x)) + 2) = pixel >> 16;
+    }
+    else
+    {
+        log_message(LOG_LEVEL_ERROR, "error in set_pixel_safe bpp %d", bpp);
+    }
+}
+
+/******************************************************************************/
+static int
+split_color(int pixel, int *r, int *g, int *b, int bpp, int *palette)
+{
+    if (bpp == 8)
+    {
+        if (pixel >= 0 && pixel < 256 && palette != 0)
+        {
+            *r = (palette[pixel] >> 16) & 0xff;
+            *g = (palette[pixel] >> 8) & 0xff;
+            *b = (palette[pixel] >> 0) & 0xff;
+        }
+    }
+    else if (bpp == 15)
+    {
+        *r = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
+        *g = ((pixel >> 2) & 0xf8) | ((pixel >> 8) & 0x7);
+        *b = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
+    }
+    else if (bpp == 16)
+    {
+        *r = ((pixel >> 8) & 0xf8) | ((pixel >> 13) & 0x7);
+        *g = ((pixel >> 3) & 0xfc) | ((pixel >> 9) & 0x3);
+        *b = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
+    }
+    else if (bpp == 24 || bpp == 32)
+    {
+        *r = (pixel >> 16) & 0xff;
+        *g = (pixel >> 8) & 0xff;
+        *b = pixel & 0xff;
+    }
+    else
+    {
+        log_message(LOG_LEVEL_ERROR, "error in split_color bpp %d", bpp);
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+static int
+make_color(int r, int g, int b, int bpp)
+{
+    if (bpp == 24)
+    {
+        return (r << 16) | (g << 8) | b;
+    }
+    else
+    {
+        log_message(LOG_LEVEL_ERROR, "error in make_color bpp %d", bpp);
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* the cursor data and mask lib_paint_cursor made before */
+void APP_CC
+old_paint_cursor(struct vnc *v, struct vnc_job *job, char *cursor_data,
+                 char *cursor_mask)
+{
+    char *d1;
+    char *d2;
+    int j;
+    int k;
+    int pixel;
+    int r;
+    int g;
+    int b;
+    int Bpp;
+
+    Bpp = (v->mod_bpp + 7) / 8;
+
+    if (Bpp == 3)
+    {
+        Bpp = 4;
+    }
+
+    g_memset(cursor_data, 0, 32 * (32 * 3));
+    g_memset(cursor_mask, 0, 32 * (32 / 8));
+    d1 = job->s->data;
+    d2 = d1 + job->cx * job->cy * Bpp;
+
+    for (j = 0; j < 32; j++)
+    {
+        for (k = 0; k < 32; k++)
+        {
+            pixel = get_pixel_safe(d2, k, 31 - j, job->cx, job->cy, 1);
+            set_pixel_safe(cursor_mask, k, j, 32, 32, 1, !pixel);
+
+            if (pixel)
+            {
+                pixel = get_pixel_safe(d1, k, 31 - j, job->cx, job->cy, v->mod_bpp);
+                split_color(pixel, &r, &g, &b, v->mod_bpp, v->palette);
+                pixel = make_color(r, g, b, 24);
+                set_pixel_safe(cursor_data, k, j, 32, 32, 24, pixel);
+            }
+        }
+    }
+}
@@ -0,0 +1,201 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check of the vnc module's update pacing
+ * the module's trans is one end of a socket pair, each case sets up the
+ * pacing state and the rdp client backlog, then checks what
+ * lib_pace_updates sends the server and whether lib_mod_get_wait_objs
+ * asks xrdp to poll, it should only when the client catching up is all
+ * that holds things back
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* lib_pace_updates is static, take the module in whole */
+#include "vnc.c"
+
+#define T_NONE -1
+
+static int g_errors = 0;
+
+/*****************************************************************************/
+/* type of the first message the module sent the server and the enable
+   flag of a ContinuousUpdates, T_NONE if it sent nothing */
+static int
+sent(int sck, int *flag)
+{
+    char buf[256];
+    int rv;
+
+    rv = recv(sck, buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (rv < 1)
+    {
+        return T_NONE;
+    }
+
+    *flag = rv > 1 ? (tui8)(buf[1]) : 0;
+    return (tui8)(buf[0]);
+}
+
+/*****************************************************************************/
+/* the timeout xrdp would wait with, -1 for none */
+static int
+timeout_of(struct vnc *v)
+{
+    tbus robjs[32];
+    tbus wobjs[32];
+    int rcount;
+    int wcount;
+    int timeout;
+
+    rcount = 0;
+    wcount = 0;
+    timeout = -1;
+    lib_mod_get_wait_objs(v, robjs, &rcount, wobjs, &wcount, &timeout);
+    return timeout;
+}
+
+/*****************************************************************************/
+/* one step, pace then look at what went out and the timeout */
+static void
+step(struct vnc *v, int sck, const char *name, int expect_type,
+     int expect_flag, int expect_timeout)
+{
+    int type;
+    int flag;
+    int timeout;
+
+    flag = 0;
+
+    if (lib_pace_updates(v) != 0)
+    {
+        printf("%s: lib_pace_updates failed\n", name);
+        g_errors++;
+        return;
+    }
+
+    type = sent(sck, &flag);
+    timeout = timeout_of(v);
+
+    if (type != expect_type || (type == 150 && flag != expect_flag))
+    {
+        printf("%s: sent %d %d, not %d %d\n", name, type, flag, expect_type,
+               expect_flag);
+        g_errors++;
+    }
+
+    if (timeout != expect_timeout)
+    {
+        printf("%s: timeout %d, not %d\n", name, timeout, expect_timeout);
+        g_errors++;
+    }
+}
+
+/*****************************************************************************/
+static void
+reset(struct vnc *v, struct source_info *si)
+{
+    v->jobs_pending = 0;
+    v->update_wanted = 0;
+    v->cu_supported = 0;
+    v->cu_enabled = 0;
+    v->fence_supported = 0;
+    v->fence_pending = 0;
+    si->source[XRDP_SOURCE_MOD] = 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct source_info si;
+    struct vnc *v;
+    int sv[2];
+
+    g_init("pace_test");
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        printf("no socket pair\n");
+        return 1;
+    }
+
+    g_memset(&si, 0, sizeof(si));
+    v = mod_init();
+    v->si = (tintptr)&si;
+    v->mod_width = 1024;
+    v->mod_height = 768;
+    v->trans = trans_create(TRANS_MODE_TCP, 8192, 8192);
+    v->trans->sck = sv[0];
+    v->trans->status = TRANS_STATUS_UP;
+    v->trans->type1 = TRANS_TYPE_CLIENT;
+
+    reset(v, &si);
+    step(v, sv[1], "idle", T_NONE, 0, -1);
+
+    /* no Fence, continuous updates are never turned on, nothing to wait
+       for */
+    reset(v, &si);
+    v->cu_supported = 1;
+    step(v, sv[1], "continuous without fence", T_NONE, 0, -1);
+    si.source[XRDP_SOURCE_MOD] = VNC_CONGESTED_BYTES + 1;
+    step(v, sv[1], "continuous without fence, behind", T_NONE, 0, -1);
+
+    /* the tail of the last update still going out is not behind */
+    reset(v, &si);
+    v->update_wanted = 1;
+    si.source[XRDP_SOURCE_MOD] = 1000;
+    step(v, sv[1], "request, keeping up", 3, 0, -1);
+
+    reset(v, &si);
+    v->update_wanted = 1;
+    si.source[XRDP_SOURCE_MOD] = VNC_CONGESTED_BYTES + 1;
+    step(v, sv[1], "request, behind", T_NONE, 0, VNC_PACE_MS);
+    step(v, sv[1], "request, still behind", T_NONE, 0, VNC_PACE_MS);
+    si.source[XRDP_SOURCE_MOD] = VNC_CONGESTED_BYTES;
+    step(v, sv[1], "request, caught up", 3, 0, -1);
+
+    /* painting the queued rects wakes the module, no need to poll */
+    reset(v, &si);
+    v->update_wanted = 1;
+    v->jobs_pending = 3;
+    si.source[XRDP_SOURCE_MOD] = VNC_CONGESTED_BYTES + 1;
+    step(v, sv[1], "request, rects queued", T_NONE, 0, -1);
+    v->jobs_pending = 0;
+    step(v, sv[1], "request, rects painted", T_NONE, 0, VNC_PACE_MS);
+
+    reset(v, &si);
+    v->cu_supported = 1;
+    v->fence_supported = 1;
+    step(v, sv[1], "continuous, on", 150, 1, -1);
+    si.source[XRDP_SOURCE_MOD] = VNC_CONGESTED_BYTES + 1;
+    step(v, sv[1], "continuous, behind", 150, 0, VNC_PACE_MS);
+    step(v, sv[1], "continuous, still behind", T_NONE, 0, VNC_PACE_MS);
+    si.source[XRDP_SOURCE_MOD] = 0;
+    step(v, sv[1], "continuous, caught up", 150, 1, -1);
+
+    close(sv[1]);
+    mod_exit(v);
+    g_deinit();
+    printf("%s\n", g_errors == 0 ? "ok" : "FAILED");
+    return g_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,762 @@
+/*
+Copyright 2013 Jay Sorg
+
+Permission to use, copy, modify, distribute, and sell this software and its
+documentation for any purpose is hereby granted without fee, provided that
+the above copyright notice appear in all copies and that both that
+copyright notice and this permission notice appear in supporting
+documentation.
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+OPEN GROUP BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+check and benchmark of the draw item list in rdpdraw.c
+checks draw_item_add merges and culls only where the client ends up with
+the same pixels: fills and screen blts are played on a small frame buffer
+as the client would, once in the order they were drawn and once from the
+list draw_item_add and draw_item_pack leave, and the two must match, xor
+pairs must stay two items and nothing is culled from before a screen blt
+then prints, for a few kinds of frame, the items and rects a frame sends
+and the time to add and pack them, with draw_item_add and with the plain
+append it replaced
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* draw_item_cull and remove_empties are static, take the module in whole */
+#include "rdpdraw.c"
+
+#define T_FB_W 64
+#define T_FB_H 48
+#define T_SEQUENCES 2000
+#define T_SEQUENCE_OPS 40
+#define T_SCREEN_W 1024
+#define T_SCREEN_H 768
+#define T_FRAMES 2000
+
+rdpScreenInfoRec g_rdpScreen;
+DevPrivateKeyRec g_rdpGCIndex;
+DevPrivateKeyRec g_rdpWindowIndex;
+DevPrivateKeyRec g_rdpPixmapIndex;
+int g_Bpp = 4;
+ScreenPtr g_pScreen = 0;
+Bool g_wrapPixmap = 1;
+WindowPtr g_invalidate_window = 0;
+int g_use_rail = 0;
+int g_do_dirty_os = 1;
+int g_do_dirty_ons = 0;
+rdpPixmapRec g_screenPriv;
+int g_con_number = 0;
+int g_do_glyph_cache = 0;
+
+/* which add the list is built with, draw_item_add or old_draw_item_add */
+static int g_old_add = 0;
+
+/*****************************************************************************/
+void *
+g_malloc(int size, int zero)
+{
+    return zero ? calloc(1, size) : malloc(size);
+}
+
+/*****************************************************************************/
+void
+g_free(void *ptr)
+{
+    free(ptr);
+}
+
+/*****************************************************************************/
+void
+rdpLog(char *format, ...)
+{
+}
+
+/*****************************************************************************/
+int
+WalkTree(ScreenPtr pScreen, int (*func)(WindowPtr pWin, pointer data),
+         pointer data)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+TellLostMap(WindowPtr pWin, pointer value)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+TellGainedMap(WindowPtr pWin, pointer value)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+delete_rdp_text(struct rdp_text *rtext)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void
+rdpScheduleDeferredUpdate(void)
+{
+}
+
+/*****************************************************************************/
+int
+rdpup_add_os_bitmap(PixmapPtr pixmap, rdpPixmapPtr priv)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_remove_os_bitmap(int rdpindex)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_update_os_use(int rdpindex)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_create_os_surface(int rdpindex, int width, int height)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_delete_os_surface(int rdpindex)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_switch_os_surface(int rdpindex)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_begin_update(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_end_update(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_check_dirty_screen(rdpPixmapRec *pDirtyPriv)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void
+rdpup_get_pixmap_image_rect(PixmapPtr pPixmap, struct image_data *id)
+{
+}
+
+/*****************************************************************************/
+void
+rdpup_send_area(struct image_data *id, int x, int y, int w, int h)
+{
+}
+
+/*****************************************************************************/
+int
+rdpup_screen_blt(short x, short y, int cx, int cy, short srcx, short srcy)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_set_clip(short x, short y, int cx, int cy)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_reset_clip(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+/* the GC ops, g_rdpGCOps points at them, nothing here draws through a GC */
+void
+rdpFillSpans(DrawablePtr pDrawable, GCPtr pGC, int nInit,
+             DDXPointPtr pptInit, int *pwidthInit, int fSorted)
+{
+}
+
+/*****************************************************************************/
+void
+rdpSetSpans(DrawablePtr pDrawable, GCPtr pGC, char *psrc,
+            DDXPointPtr ppt, int *pwidth, int nspans, int fSorted)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPutImage(DrawablePtr pDst, GCPtr pGC, int depth, int x, int y,
+            int w, int h, int leftPad, int format, char *pBits)
+{
+}
+
+/*****************************************************************************/
+RegionPtr
+rdpCopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+            int srcx, int srcy, int w, int h, int dstx, int dsty)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+RegionPtr
+rdpCopyPlane(DrawablePtr pSrcDrawable, DrawablePtr pDstDrawable,
+             GCPtr pGC, int srcx, int srcy, int width, int height,
+             int dstx, int dsty, unsigned long bitPlane)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void
+rdpPolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
+             int npt, DDXPointPtr in_pts)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolylines(DrawablePtr pDrawable, GCPtr pGC, int mode,
+             int npt, DDXPointPtr pptInit)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSegs)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int nrects,
+                 xRectangle *rects)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolyArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+}
+
+/*****************************************************************************/
+void
+rdpFillPolygon(DrawablePtr pDrawable, GCPtr pGC,
+               int shape, int mode, int count,
+               DDXPointPtr pPts)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrectFill,
+                xRectangle *prectInit)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolyFillArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+}
+
+/*****************************************************************************/
+int
+rdpPolyText8(DrawablePtr pDrawable, GCPtr pGC,
+             int x, int y, int count, char *chars)
+{
+    return x;
+}
+
+/*****************************************************************************/
+int
+rdpPolyText16(DrawablePtr pDrawable, GCPtr pGC,
+              int x, int y, int count, unsigned short *chars)
+{
+    return x;
+}
+
+/*****************************************************************************/
+void
+rdpImageText8(DrawablePtr pDrawable, GCPtr pGC,
+              int x, int y, int count, char *chars)
+{
+}
+
+/*****************************************************************************/
+void
+rdpImageText16(DrawablePtr pDrawable, GCPtr pGC,
+               int x, int y, int count, unsigned short *chars)
+{
+}
+
+/*****************************************************************************/
+void
+rdpImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+                 int x, int y, unsigned int nglyph,
+                 CharInfoPtr *ppci, pointer pglyphBase)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+                int x, int y, unsigned int nglyph,
+                CharInfoPtr *ppci, pointer pglyphBase)
+{
+}
+
+/*****************************************************************************/
+void
+rdpPushPixels(GCPtr pGC, PixmapPtr pBitMap, DrawablePtr pDst,
+              int w, int h, int x, int y)
+{
+}
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* draw_item_add before it merged and culled, every item is linked */
+static int
+old_draw_item_add(rdpPixmapRec *priv, struct rdp_draw_item *di)
+{
+    priv->is_alpha_dirty_not = 0;
+
+    if (priv->draw_item_tail == 0)
+    {
+        priv->draw_item_tail = di;
+        priv->draw_item_head = di;
+    }
+    else
+    {
+        di->prev = priv->draw_item_tail;
+        priv->draw_item_tail->next = di;
+        priv->draw_item_tail = di;
+    }
+    priv->draw_item_count++;
+
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+add_item(rdpPixmapRec *priv, int type, int x, int y, int w, int h,
+         int opcode, int color)
+{
+    struct rdp_draw_item *di;
+    BoxRec box;
+
+    box.x1 = x;
+    box.y1 = y;
+    box.x2 = x + w;
+    box.y2 = y + h;
+    di = (struct rdp_draw_item *)g_malloc(sizeof(struct rdp_draw_item), 1);
+    di->type = type;
+    di->reg = RegionCreate(&box, 0);
+    if (type == RDI_FILL)
+    {
+        di->u.fill.fg_color = color;
+        di->u.fill.opcode = opcode;
+    }
+    else
+    {
+        di->u.img.opcode = opcode;
+    }
+    if (g_old_add)
+    {
+        old_draw_item_add(priv, di);
+    }
+    else
+    {
+        draw_item_add(priv, di);
+    }
+}
+
+/*****************************************************************************/
+/* a copy of the w by h area at srcx, srcy to dstx, dsty, the region is the
+   destination, what rdpCopyArea adds for a window to itself */
+static void
+add_scrblt(rdpPixmapRec *priv, int srcx, int srcy, int dstx, int dsty,
+           int w, int h)
+{
+    struct rdp_draw_item *di;
+    BoxRec box;
+
+    box.x1 = dstx;
+    box.y1 = dsty;
+    box.x2 = dstx + w;
+    box.y2 = dsty + h;
+    di = (struct rdp_draw_item *)g_malloc(sizeof(struct rdp_draw_item), 1);
+    di->type = RDI_SCRBLT;
+    di->u.scrblt.srcx = srcx;
+    di->u.scrblt.srcy = srcy;
+    di->u.scrblt.dstx = dstx;
+    di->u.scrblt.dsty = dsty;
+    di->u.scrblt.cx = w;
+    di->u.scrblt.cy = h;
+    di->reg = RegionCreate(&box, 0);
+    if (g_old_add)
+    {
+        old_draw_item_add(priv, di);
+    }
+    else
+    {
+        draw_item_add(priv, di);
+    }
+}
+
+/*****************************************************************************/
+/* the client's side, fills and screen blts drawn on fb the way
+   rdpup_send_area and friends have the client draw them */
+static void
+play_items(rdpPixmapRec *priv, unsigned char *fb)
+{
+    unsigned char src[T_FB_W * T_FB_H];
+    struct rdp_draw_item *di;
+    BoxPtr box;
+    unsigned char *p;
+    int index;
+    int x;
+    int y;
+
+    for (di = priv->draw_item_head; di != 0; di = di->next)
+    {
+        if (di->type == RDI_SCRBLT)
+        {
+            memcpy(src, fb, sizeof(src));
+        }
+        for (index = 0; index < REGION_NUM_RECTS(di->reg); index++)
+        {
+            box = REGION_RECTS(di->reg) + index;
+            for (y = box->y1; y < box->y2; y++)
+            {
+                for (x = box->x1; x < box->x2; x++)
+                {
+                    p = fb + y * T_FB_W + x;
+                    if (di->type == RDI_SCRBLT)
+                    {
+                        *p = src[(y - di->u.scrblt.dsty + di->u.scrblt.srcy) *
+                                 T_FB_W +
+                                 (x - di->u.scrblt.dstx + di->u.scrblt.srcx)];
+                        continue;
+                    }
+                    switch (di->u.fill.opcode)
+                    {
+                        case GXcopy:
+                            *p = di->u.fill.fg_color;
+                            break;
+                        case GXxor:
+                            *p ^= di->u.fill.fg_color;
+                            break;
+                        case GXor:
+                            *p |= di->u.fill.fg_color;
+                            break;
+                        case GXand:
+                            *p &= di->u.fill.fg_color;
+                            break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/* a random run of fills and screen blts into priv, the same run for the
+   same seed */
+static void
+add_sequence(rdpPixmapRec *priv, unsigned int seed)
+{
+    static const int opcodes[] = { GXcopy, GXcopy, GXxor, GXor, GXand };
+    int op;
+    int w;
+    int h;
+
+    srand(seed);
+    for (op = 0; op < T_SEQUENCE_OPS; op++)
+    {
+        w = 1 + rand() % (T_FB_W / 2);
+        h = 1 + rand() % (T_FB_H / 2);
+        if ((rand() % 8) == 0)
+        {
+            add_scrblt(priv, rand() % (T_FB_W - w), rand() % (T_FB_H - h),
+                       rand() % (T_FB_W - w), rand() % (T_FB_H - h), w, h);
+        }
+        else
+        {
+            /* few colours so a run of the same fill comes up */
+            add_item(priv, RDI_FILL, rand() % (T_FB_W - w + 1),
+                     rand() % (T_FB_H - h + 1), w, h,
+                     opcodes[rand() % 5], 1 << (rand() % 3));
+        }
+    }
+}
+
+/*****************************************************************************/
+/* item count after adding the items, then removes them */
+static int
+count_items(rdpPixmapRec *priv)
+{
+    int count;
+
+    count = priv->draw_item_count;
+    draw_item_remove_all(priv);
+    return count;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+check(void)
+{
+    unsigned char want[T_FB_W * T_FB_H];
+    unsigned char got[T_FB_W * T_FB_H];
+    rdpPixmapRec priv;
+    PixmapRec pix;
+    unsigned int seed;
+    int errors;
+    int count;
+    int apart;
+
+    errors = 0;
+    memset(&priv, 0, sizeof(priv));
+    memset(&pix, 0, sizeof(pix));
+    pix.drawable.width = T_FB_W;
+    pix.drawable.height = T_FB_H;
+    for (seed = 1; seed <= T_SEQUENCES; seed++)
+    {
+        memset(want, 0x55, sizeof(want));
+        memset(got, 0x55, sizeof(got));
+        g_old_add = 1;
+        add_sequence(&priv, seed);
+        play_items(&priv, want);
+        draw_item_remove_all(&priv);
+        g_old_add = 0;
+        add_sequence(&priv, seed);
+        draw_item_pack(&pix, &priv);
+        play_items(&priv, got);
+        draw_item_remove_all(&priv);
+        if (memcmp(want, got, sizeof(want)) != 0)
+        {
+            printf("sequence %u: the list draws other pixels\n", seed);
+            errors++;
+        }
+    }
+    /* xor twice over the same pixels is two items, apart it is one */
+    add_item(&priv, RDI_FILL, 0, 0, 8, 8, GXxor, 1);
+    add_item(&priv, RDI_FILL, 4, 4, 8, 8, GXxor, 1);
+    count = count_items(&priv);
+    add_item(&priv, RDI_FILL, 0, 0, 8, 8, GXxor, 1);
+    add_item(&priv, RDI_FILL, 16, 0, 8, 8, GXxor, 1);
+    apart = count_items(&priv);
+    if ((count != 2) || (apart != 1))
+    {
+        printf("xor fills merged over each other\n");
+        errors++;
+    }
+    /* an image under an opaque fill is gone, under an xor one it is not */
+    add_item(&priv, RDI_IMGLL, 2, 2, 4, 4, GXcopy, 0);
+    add_item(&priv, RDI_FILL, 0, 0, 8, 8, GXcopy, 1);
+    count = count_items(&priv);
+    add_item(&priv, RDI_IMGLL, 2, 2, 4, 4, GXcopy, 0);
+    add_item(&priv, RDI_FILL, 0, 0, 8, 8, GXxor, 1);
+    apart = count_items(&priv);
+    if ((count != 1) || (apart != 2))
+    {
+        printf("covered image not culled, or culled by a xor fill\n");
+        errors++;
+    }
+    /* a screen blt could copy from the image, it has to stay */
+    add_item(&priv, RDI_IMGLL, 2, 2, 4, 4, GXcopy, 0);
+    add_scrblt(&priv, 2, 2, 20, 20, 4, 4);
+    add_item(&priv, RDI_FILL, 0, 0, 8, 8, GXcopy, 1);
+    if (count_items(&priv) != 3)
+    {
+        printf("item culled from before a screen blt\n");
+        errors++;
+    }
+    printf("draw items: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+/* one frame of kind into priv
+   0 a menu, one colour of small fills then the text cells as images
+   1 a window dragged over, the same area repainted in layers
+   2 a terminal scroll, a screen blt then the new line
+   3 a rubber band, the old rectangle xored out and the new one in */
+static void
+add_frame(rdpPixmapRec *priv, int kind, int frame)
+{
+    int index;
+    int x;
+    int y;
+
+    switch (kind)
+    {
+        case 0:
+            for (index = 0; index < 40; index++)
+            {
+                add_item(priv, RDI_FILL, 100, 100 + index * 16, 200, 15,
+                         GXcopy, 0xc0c0c0);
+            }
+            for (index = 0; index < 40; index++)
+            {
+                add_item(priv, RDI_IMGLL, 110, 102 + index * 16, 120, 12,
+                         GXcopy, 0);
+            }
+            break;
+        case 1:
+            x = 200 + frame % 64;
+            y = 150 + frame % 48;
+            for (index = 0; index < 6; index++)
+            {
+                add_item(priv, RDI_FILL, x, y, 400, 300, GXcopy,
+                         0x303030 * (index + 1));
+                add_item(priv, RDI_IMGLL, x + 10, y + 30, 380, 260, GXcopy,
+                         0);
+            }
+            break;
+        case 2:
+            add_scrblt(priv, 0, 16, 0, 0, 640, 464);
+            add_item(priv, RDI_FILL, 0, 464, 640, 16, GXcopy, 0);
+            for (index = 0; index < 80; index++)
+            {
+                add_item(priv, RDI_IMGLL, index * 8, 464, 8, 16, GXcopy, 0);
+            }
+            break;
+        case 3:
+            x = 300 + frame % 100;
+            for (index = 0; index < 2; index++)
+            {
+                add_item(priv, RDI_FILL, 300, 200, x - 300 + index, 1,
+                         GXxor, 0xffffff);
+                add_item(priv, RDI_FILL, 300, 200, 1, x - 300 + index,
+                         GXxor, 0xffffff);
+                add_item(priv, RDI_FILL, 300, 200 + x - 300 + index,
+                         x - 300 + index, 1, GXxor, 0xffffff);
+                add_item(priv, RDI_FILL, x + index, 200, 1, x - 300 + index,
+                         GXxor, 0xffffff);
+            }
+            break;
+    }
+}
+
+/*****************************************************************************/
+static void
+bench(void)
+{
+    static const char *names[] =
+    {
+        "menu", "drag", "scroll", "rubber band"
+    };
+    rdpPixmapRec priv;
+    PixmapRec pix;
+    struct rdp_draw_item *di;
+    double start;
+    double took;
+    int items;
+    int rects;
+    int frame;
+    int kind;
+
+    memset(&priv, 0, sizeof(priv));
+    memset(&pix, 0, sizeof(pix));
+    pix.drawable.width = T_SCREEN_W;
+    pix.drawable.height = T_SCREEN_H;
+    printf("%d frames of each, a frame added then packed\n", T_FRAMES);
+    for (kind = 0; kind < 4; kind++)
+    {
+        for (g_old_add = 1; g_old_add >= 0; g_old_add--)
+        {
+            items = 0;
+            rects = 0;
+            took = 0;
+            for (frame = 0; frame < T_FRAMES; frame++)
+            {
+                start = now_us();
+                add_frame(&priv, kind, frame);
+                draw_item_pack(&pix, &priv);
+                took += now_us() - start;
+                items += priv.draw_item_count;
+                for (di = priv.draw_item_head; di != 0; di = di->next)
+                {
+                    rects += REGION_NUM_RECTS(di->reg);
+                }
+                draw_item_remove_all(&priv);
+            }
+            printf("%-11s %-6s %6.1f items %7.1f rects %8.2f us a frame\n",
+                   names[kind], g_old_add ? "append" : "add",
+                   (double)items / T_FRAMES, (double)rects / T_FRAMES,
+                   took / T_FRAMES);
+        }
+    }
+    g_old_add = 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    int errors;
+
+    errors = check();
+    bench();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,556 @@
+/*
+Copyright 2013 Jay Sorg
+
+Permission to use, copy, modify, distribute, and sell this software and its
+documentation for any purpose is hereby granted without fee, provided that
+the above copyright notice appear in all copies and that both that
+copyright notice and this permission notice appear in supporting
+documentation.
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+OPEN GROUP BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+check and benchmark of the glyph rows in rdpglyph.c
+checks glyph_get_data gives the same bytes as the per pixel lget_pixel and
+set_mono_pixel it replaced, for a1 and a8 glyphs to mono and alpha, every
+width from 1 to 70 with junk in the row padding, then prints the glyph
+conversion both ways and a terminal scrolling, a line of text a scroll
+through rdpGlyphs, glyph cache and all, in lines/s
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* glyph_get_data is static, take the module in whole */
+#include "rdpglyph.c"
+
+#define T_MAX_WIDTH 70
+#define T_COLS 80
+#define T_FONT_CHARS 95
+#define T_CHAR_W 9
+#define T_CHAR_H 18
+#define T_CONVERTS 20000
+#define T_SCROLLS 20000
+
+DevPrivateKeyRec g_rdpPixmapIndex;
+int g_do_dirty_os = 0;
+int g_do_alpha_glyphs = 0;
+int g_do_glyph_cache = 1;
+int g_doing_font = 0;
+ScreenPtr g_pScreen = 0;
+rdpScreenInfoRec g_rdpScreen;
+
+static ScreenRec g_screen;
+static int g_new_chars = 0;
+static int g_char_bytes = 0;
+static int g_texts = 0;
+static int g_text_bytes = 0;
+
+/*****************************************************************************/
+void *
+g_malloc(int size, int zero)
+{
+    return zero ? calloc(1, size) : malloc(size);
+}
+
+/*****************************************************************************/
+void
+g_free(void *ptr)
+{
+    free(ptr);
+}
+
+/*****************************************************************************/
+/* crc32, what rdpmisc.c does without the seed */
+int
+get_crc(char *data, int data_bytes)
+{
+    unsigned int crc;
+    int index;
+    int bit;
+
+    crc = 0xffffffff;
+    for (index = 0; index < data_bytes; index++)
+    {
+        crc ^= (unsigned char)data[index];
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+    }
+    return (int)~crc;
+}
+
+/*****************************************************************************/
+int
+rdpup_check_dirty(PixmapPtr pDirtyPixmap, rdpPixmapRec *pDirtyPriv)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_switch_os_surface(int rdpindex)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void
+rdpup_get_pixmap_image_rect(PixmapPtr pPixmap, struct image_data *id)
+{
+}
+
+/*****************************************************************************/
+void
+rdpup_get_screen_image_rect(struct image_data *id)
+{
+}
+
+/*****************************************************************************/
+int
+rdpup_begin_update(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_end_update(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_set_fgcolor(int fgcolor)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_set_clip(short x, short y, int cx, int cy)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_reset_clip(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void
+rdpup_set_hints(int hints, int mask)
+{
+}
+
+/*****************************************************************************/
+int
+rdpup_pre_check(int in_size)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_add_char(int font, int charactor, short x, short y, int cx, int cy,
+               char *bmpdata, int bmpdata_bytes)
+{
+    g_new_chars++;
+    g_char_bytes += 18 + bmpdata_bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_add_char_alpha(int font, int charactor, short x, short y, int cx,
+                     int cy, char *bmpdata, int bmpdata_bytes)
+{
+    g_new_chars++;
+    g_char_bytes += 18 + bmpdata_bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdpup_draw_text(int font, int flags, int mixmode,
+                short clip_left, short clip_top,
+                short clip_right, short clip_bottom,
+                short box_left, short box_top,
+                short box_right, short box_bottom, short x, short y,
+                char *data, int data_bytes)
+{
+    g_texts++;
+    g_text_bytes += 32 + data_bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+draw_item_add_text_region(rdpPixmapRec *priv, RegionPtr reg, int color,
+                          int opcode, struct rdp_text *rtext)
+{
+    delete_rdp_text(rtext);
+    return 0;
+}
+
+/*****************************************************************************/
+/* fb's Glyphs, the pixels are not drawn here */
+static void
+bench_glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+             PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int nlists,
+             GlyphListPtr lists, GlyphPtr *glyphs)
+{
+}
+
+/*****************************************************************************/
+/* before, a pixel at a time */
+static void
+old_set_mono_pixel(char *data, int x, int y, int width, int pixel)
+{
+    int start;
+    int shift;
+
+    width = (width + 7) / 8;
+    start = (y * width) + x / 8;
+    shift = x % 8;
+    if (pixel != 0)
+    {
+        data[start] = data[start] | (0x80 >> shift);
+    }
+    else
+    {
+        data[start] = data[start] & ~(0x80 >> shift);
+    }
+}
+
+/*****************************************************************************/
+static int
+old_lget_pixel(char *data, int x, int y, int depth, int stride_bytes)
+{
+    int start;
+    int shift;
+
+    if (depth == 1)
+    {
+        start = (y * stride_bytes) + x / 8;
+        shift = x % 8;
+        return (data[start] & (0x01 << shift)) ? 0xff : 0;
+    }
+    else if (depth == 8)
+    {
+        return data[y * stride_bytes + x];
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* glyph_get_data as it was */
+static int
+old_glyph_get_data(ScreenPtr pScreen, GlyphPtr glyph,
+                   struct rdp_font_char *rfd)
+{
+    int i;
+    int j;
+    int src_xoff;
+    int src_yoff;
+    int src_stride_bytes;
+    int dst_stride_bytes;
+    int src_depth;
+    unsigned char pixel;
+    PicturePtr pPicture;
+    pixman_image_t *src;
+    char *pi8;
+
+    pPicture = GlyphPicture(glyph)[pScreen->myNum];
+    src = image_from_pict(pPicture, FALSE, &src_xoff, &src_yoff);
+    src_stride_bytes = pixman_image_get_stride(src);
+    if (g_do_alpha_glyphs)
+    {
+        dst_stride_bytes = (glyph->info.width + 3) & ~3;
+        rfd->bpp = 8;
+    }
+    else
+    {
+        dst_stride_bytes = (((glyph->info.width + 7) / 8) + 3) & ~3;
+        rfd->bpp = 1;
+    }
+    src_depth = pixman_image_get_depth(src);
+    rfd->data_bytes = glyph->info.height * dst_stride_bytes;
+    rfd->data = (char *)g_malloc(rfd->data_bytes, 1);
+    rfd->offset = -glyph->info.x;
+    rfd->baseline = -glyph->info.y;
+    rfd->width = glyph->info.width;
+    rfd->height = glyph->info.height;
+    pi8 = (char *)pixman_image_get_data(src);
+    for (j = 0; j < rfd->height; j++)
+    {
+        for (i = 0; i < rfd->width; i++)
+        {
+            pixel = old_lget_pixel(pi8, i, j, src_depth, src_stride_bytes);
+            if (g_do_alpha_glyphs)
+            {
+                rfd->data[j * dst_stride_bytes + i] = pixel;
+            }
+            else
+            {
+                old_set_mono_pixel(rfd->data, i, j, rfd->width,
+                                   pixel > 0x7f);
+            }
+        }
+    }
+    free_pixman_pict(pPicture, src);
+    return 0;
+}
+
+/*****************************************************************************/
+/* a glyph of random pixels, the padding past width is random too */
+static GlyphPtr
+make_glyph(int width, int height, int depth, unsigned int seed)
+{
+    GlyphPtr glyph;
+    PicturePtr pict;
+    uint32_t *bits;
+    int stride;
+    int index;
+
+    stride = depth == 1 ? ((width + 31) / 32) * 4 : (width + 3) & ~3;
+    bits = (uint32_t *)malloc(stride * height);
+    for (index = 0; index < stride * height; index++)
+    {
+        seed = seed * 1103515245 + 12345;
+        ((unsigned char *)bits)[index] = seed >> 16;
+    }
+    pict = (PicturePtr)calloc(1, sizeof(PictureRec));
+    pict->image = pixman_image_create_bits(depth == 1 ? PIXMAN_a1 :
+                                           PIXMAN_a8, width, height, bits,
+                                           stride);
+    glyph = (GlyphPtr)calloc(1, sizeof(GlyphRec));
+    glyph->info.width = width;
+    glyph->info.height = height;
+    glyph->info.x = -1;
+    glyph->info.y = height - 4;
+    glyph->info.xOff = width + 1;
+    glyph->pictures[0] = pict;
+    return glyph;
+}
+
+/*****************************************************************************/
+static void
+free_glyph(GlyphPtr glyph)
+{
+    PicturePtr pict;
+
+    pict = glyph->pictures[0];
+    free(pixman_image_get_data(pict->image));
+    pixman_image_unref(pict->image);
+    free(pict);
+    free(glyph);
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+check_rows(void)
+{
+    static const int heights[] = { 1, 5, 13 };
+    struct rdp_font_char old_rfd;
+    struct rdp_font_char new_rfd;
+    GlyphPtr glyph;
+    int errors;
+    int depth;
+    int alpha;
+    int width;
+    int index;
+
+    errors = 0;
+    for (depth = 1; depth <= 8; depth += 7)
+    {
+        for (alpha = 0; alpha < 2; alpha++)
+        {
+            g_do_alpha_glyphs = alpha;
+            for (width = 1; width <= T_MAX_WIDTH; width++)
+            {
+                for (index = 0; index < 3; index++)
+                {
+                    glyph = make_glyph(width, heights[index], depth,
+                                       width * 7 + index);
+                    memset(&old_rfd, 0, sizeof(old_rfd));
+                    memset(&new_rfd, 0, sizeof(new_rfd));
+                    old_glyph_get_data(&g_screen, glyph, &old_rfd);
+                    glyph_get_data(&g_screen, glyph, &new_rfd);
+                    if ((old_rfd.data_bytes != new_rfd.data_bytes) ||
+                        (old_rfd.bpp != new_rfd.bpp) ||
+                        (memcmp(old_rfd.data, new_rfd.data,
+                                old_rfd.data_bytes) != 0))
+                    {
+                        if (errors < 10)
+                        {
+                            printf("a%d to %s, %dx%d: not as before\n",
+                                   depth, alpha ? "alpha" : "mono", width,
+                                   heights[index]);
+                        }
+                        errors++;
+                    }
+                    g_free(old_rfd.data);
+                    g_free(new_rfd.data);
+                    free_glyph(glyph);
+                }
+            }
+        }
+    }
+    g_do_alpha_glyphs = 0;
+    printf("glyph rows: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* a font's worth of glyphs, before and after, Mpix/s */
+static void
+bench_convert(GlyphPtr *font, int depth, int alpha)
+{
+    struct rdp_font_char rfd;
+    double start;
+    double took[2];
+    int pass;
+    int index;
+
+    g_do_alpha_glyphs = alpha;
+    for (pass = 0; pass < 2; pass++)
+    {
+        start = now_us();
+        for (index = 0; index < T_CONVERTS; index++)
+        {
+            memset(&rfd, 0, sizeof(rfd));
+            if (pass == 0)
+            {
+                old_glyph_get_data(&g_screen, font[index % T_FONT_CHARS],
+                                   &rfd);
+            }
+            else
+            {
+                glyph_get_data(&g_screen, font[index % T_FONT_CHARS], &rfd);
+            }
+            g_free(rfd.data);
+        }
+        took[pass] = now_us() - start;
+    }
+    printf("a%d to %-5s %dx%d glyphs  before %7.1f Mpix/s  now %7.1f "
+           "Mpix/s\n", depth, alpha ? "alpha" : "mono", T_CHAR_W, T_CHAR_H,
+           T_CONVERTS * T_CHAR_W * T_CHAR_H / took[0],
+           T_CONVERTS * T_CHAR_W * T_CHAR_H / took[1]);
+    g_do_alpha_glyphs = 0;
+}
+
+/*****************************************************************************/
+/* a terminal scrolling, each scroll draws the new bottom line of
+   T_COLS chars through rdpGlyphs, the text repeats now and then like
+   a build log does */
+static void
+bench_scroll(GlyphPtr *font, int depth, int alpha)
+{
+    GlyphListRec list;
+    GlyphPtr line[T_COLS];
+    PictureRec src;
+    PictureRec dst;
+    WindowRec win;
+    double start;
+    double took;
+    int scroll;
+    int col;
+
+    rdpGlyphInit();
+    g_do_alpha_glyphs = alpha;
+    memset(&win, 0, sizeof(win));
+    win.drawable.type = DRAWABLE_WINDOW;
+    win.drawable.pScreen = &g_screen;
+    win.drawable.width = T_COLS * T_CHAR_W;
+    win.drawable.height = 50 * T_CHAR_H;
+    win.viewable = 1;
+    memset(&dst, 0, sizeof(dst));
+    dst.pDrawable = &win.drawable;
+    memset(&src, 0, sizeof(src));
+    src.image = font[0]->pictures[0]->image;
+    list.xOff = 0;
+    list.yOff = 49 * T_CHAR_H + T_CHAR_H - 4;
+    list.len = T_COLS;
+    list.format = 0;
+    g_new_chars = 0;
+    g_char_bytes = 0;
+    g_texts = 0;
+    g_text_bytes = 0;
+    start = now_us();
+    for (scroll = 0; scroll < T_SCROLLS; scroll++)
+    {
+        for (col = 0; col < T_COLS; col++)
+        {
+            line[col] = font[((scroll % 97) * 13 + col * 7 + col / 9) %
+                             T_FONT_CHARS];
+        }
+        rdpGlyphs(3 /* PictOpOver */, &src, &dst, 0, 0, 0, 1, &list, line);
+    }
+    took = now_us() - start;
+    printf("a%d to %-5s scroll  %8.0f lines/s %6.3f us a glyph, %d chars "
+           "sent %.1f bytes a line\n", depth, alpha ? "alpha" : "mono",
+           T_SCROLLS * 1000000.0 / took, took / (T_SCROLLS * T_COLS),
+           g_new_chars, (double)(g_char_bytes + g_text_bytes) / T_SCROLLS);
+    g_do_alpha_glyphs = 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    GlyphPtr font[T_FONT_CHARS];
+    int errors;
+    int depth;
+    int alpha;
+    int index;
+
+    g_pScreen = &g_screen;
+    g_rdpScreen.Glyphs = bench_glyphs;
+    rdpGlyphInit();
+    errors = check_rows();
+    for (depth = 1; depth <= 8; depth += 7)
+    {
+        for (index = 0; index < T_FONT_CHARS; index++)
+        {
+            font[index] = make_glyph(T_CHAR_W, T_CHAR_H, depth, index + 1);
+        }
+        for (alpha = 0; alpha < 2; alpha++)
+        {
+            bench_convert(font, depth, alpha);
+            bench_scroll(font, depth, alpha);
+        }
+        for (index = 0; index < T_FONT_CHARS; index++)
+        {
+            free_glyph(font[index]);
+        }
+    }
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,437 @@
+/*
+Copyright 2005-2013 Jay Sorg
+
+Permission to use, copy, modify, distribute, and sell this software and its
+documentation for any purpose is hereby granted without fee, provided that
+the above copyright notice appear in all copies and that both that
+copyright notice and this permission notice appear in supporting
+documentation.
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+OPEN GROUP BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+the part of the X server the X11rdp files use, so they build and run
+outside a server tree, rdp.h takes this for xorg-server.h and the other
+server headers it wants are empty, see the Makefile
+only what the X11rdp code reads is in the structures, regions are banded
+like pixman's, see xserver.c
+
+*/
+
+#ifndef __XORG_SERVER_H
+#define __XORG_SERVER_H
+
+#define XORGSERVER 1
+#define X_LITTLE_ENDIAN 1234
+#define X_BIG_ENDIAN 4321
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define X_BYTE_ORDER X_BIG_ENDIAN
+#else
+#define X_BYTE_ORDER X_LITTLE_ENDIAN
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <X11/X.h>
+#include <X11/Xproto.h>
+
+typedef void *pointer;
+typedef int Bool;
+typedef unsigned long Pixel;
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+typedef struct _Box
+{
+    short x1;
+    short y1;
+    short x2;
+    short y2;
+} BoxRec, *BoxPtr;
+
+typedef struct _DDXPoint
+{
+    short x;
+    short y;
+} DDXPointRec, *DDXPointPtr;
+
+/* banded, y then x, the way the server keeps them */
+typedef struct _Region
+{
+    BoxRec extents;
+    int numRects;
+    int size;
+    BoxPtr rects;
+} RegionRec, *RegionPtr;
+
+#define rgnOUT 0
+#define rgnIN 1
+#define rgnPART 2
+
+#define NullBox ((BoxPtr)0)
+#define NullRegion ((RegionPtr)0)
+#define REGION_NUM_RECTS(_reg) ((_reg)->numRects)
+#define REGION_RECTS(_reg) ((_reg)->rects)
+#define RegionNumRects(_reg) ((_reg)->numRects)
+#define RegionRects(_reg) ((_reg)->rects)
+#define RegionExtents(_reg) (&(_reg)->extents)
+#define RegionNotEmpty(_reg) ((_reg)->numRects != 0)
+#define RegionNil(_reg) ((_reg)->numRects == 0)
+
+void RegionInit(RegionPtr reg, BoxPtr box, int size);
+void RegionUninit(RegionPtr reg);
+RegionPtr RegionCreate(BoxPtr box, int size);
+void RegionDestroy(RegionPtr reg);
+Bool RegionCopy(RegionPtr dst, RegionPtr src);
+Bool RegionUnion(RegionPtr dst, RegionPtr reg1, RegionPtr reg2);
+Bool RegionIntersect(RegionPtr dst, RegionPtr reg1, RegionPtr reg2);
+Bool RegionSubtract(RegionPtr dst, RegionPtr reg1, RegionPtr reg2);
+void RegionTranslate(RegionPtr reg, int x, int y);
+void RegionEmpty(RegionPtr reg);
+void RegionReset(RegionPtr reg, BoxPtr box);
+int RegionContainsRect(RegionPtr reg, BoxPtr box);
+RegionPtr RegionFromRects(int nrects, xRectangle *prect, int ctype);
+
+typedef struct _PrivateRec *PrivateRec;
+typedef struct _DevPrivateKeyRec
+{
+    int offset;
+} DevPrivateKeyRec, *DevPrivateKey;
+void *dixLookupPrivate(PrivateRec *privates, DevPrivateKey key);
+void *dixGetPrivateAddr(PrivateRec *privates, DevPrivateKey key);
+
+typedef struct _Screen *ScreenPtr;
+typedef struct _Client *ClientPtr;
+typedef struct _GC *GCPtr;
+typedef struct _Drawable *DrawablePtr;
+typedef struct _Pixmap *PixmapPtr;
+typedef struct _Window *WindowPtr;
+typedef struct _ColormapRec *ColormapPtr;
+typedef struct _Cursor *CursorPtr;
+typedef struct _Picture *PicturePtr;
+typedef struct _PictFormat *PictFormatPtr;
+typedef struct _GlyphList *GlyphListPtr;
+typedef struct _Glyph *GlyphPtr;
+typedef struct _Font *FontPtr;
+typedef struct _DeviceIntRec *DeviceIntPtr;
+typedef struct _CallbackList *CallbackListPtr;
+typedef struct _OsTimerRec *OsTimerPtr;
+typedef union _InternalEvent InternalEvent;
+typedef struct _CharInfo *CharInfoPtr;
+typedef struct _PictTransform PictTransform;
+
+typedef Bool (*CloseScreenProcPtr)(int index, ScreenPtr pScreen);
+typedef Bool (*CreateGCProcPtr)(GCPtr pGC);
+typedef PixmapPtr (*CreatePixmapProcPtr)(ScreenPtr pScreen, int width,
+                                         int height, int depth,
+                                         unsigned usage_hint);
+typedef Bool (*DestroyPixmapProcPtr)(PixmapPtr pPixmap);
+typedef Bool (*ModifyPixmapHeaderProcPtr)(PixmapPtr pPixmap, int width,
+                                          int height, int depth,
+                                          int bitsPerPixel, int devKind,
+                                          pointer pPixData);
+typedef Bool (*CreateWindowProcPtr)(WindowPtr pWindow);
+typedef Bool (*DestroyWindowProcPtr)(WindowPtr pWindow);
+typedef Bool (*PositionWindowProcPtr)(WindowPtr pWindow, int x, int y);
+typedef Bool (*RealizeWindowProcPtr)(WindowPtr pWindow);
+typedef Bool (*UnrealizeWindowProcPtr)(WindowPtr pWindow);
+typedef Bool (*ChangeWindowAttributesProcPtr)(WindowPtr pWindow,
+                                              unsigned long mask);
+typedef void (*WindowExposuresProcPtr)(WindowPtr pWindow, RegionPtr pRegion,
+                                       RegionPtr pBSRegion);
+typedef void *CreateColormapProcPtr;
+typedef void *DestroyColormapProcPtr;
+typedef void (*CopyWindowProcPtr)(WindowPtr pWin, DDXPointRec ptOldOrg,
+                                  RegionPtr pOldRegion);
+typedef void (*ClearToBackgroundProcPtr)(WindowPtr pWin, int x, int y,
+                                         int w, int h,
+                                         Bool generateExposures);
+typedef void *ScreenWakeupHandlerProcPtr;
+typedef void *CreatePictureProcPtr;
+typedef void *DestroyPictureProcPtr;
+typedef void *CompositeProcPtr;
+typedef void (*GlyphsProcPtr)(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+                              PictFormatPtr maskFormat, INT16 xSrc,
+                              INT16 ySrc, int nlists, GlyphListPtr lists,
+                              GlyphPtr *glyphs);
+typedef RegionPtr (*RestoreAreasProcPtr)(WindowPtr pWin,
+                                          RegionPtr prgnExposed);
+
+#define DRAWABLE_WINDOW 0
+#define DRAWABLE_PIXMAP 1
+
+typedef struct _Drawable
+{
+    unsigned char type;
+    unsigned char class;
+    unsigned char depth;
+    unsigned char bitsPerPixel;
+    XID id;
+    short x;
+    short y;
+    unsigned short width;
+    unsigned short height;
+    ScreenPtr pScreen;
+    unsigned long serialNumber;
+} DrawableRec;
+
+typedef struct _Pixmap
+{
+    DrawableRec drawable;
+    PrivateRec devPrivates;
+    int refcnt;
+    int devKind;
+    void *devPrivate;
+    unsigned usage_hint;
+} PixmapRec;
+
+typedef struct _Window
+{
+    DrawableRec drawable;
+    PrivateRec devPrivates;
+    WindowPtr parent;
+    RegionRec clipList;
+    RegionRec borderClip;
+    int viewable;
+    int overrideRedirect;
+} WindowRec;
+
+typedef struct _GCOps
+{
+    void (*FillSpans)(DrawablePtr pDrawable, GCPtr pGC, int nInit,
+                      DDXPointPtr pptInit, int *pwidthInit, int fSorted);
+    void (*SetSpans)(DrawablePtr pDrawable, GCPtr pGC, char *psrc,
+                     DDXPointPtr ppt, int *pwidth, int nspans, int fSorted);
+    void (*PutImage)(DrawablePtr pDst, GCPtr pGC, int depth, int x, int y,
+                     int w, int h, int leftPad, int format, char *pBits);
+    RegionPtr (*CopyArea)(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+                          int srcx, int srcy, int w, int h,
+                          int dstx, int dsty);
+    RegionPtr (*CopyPlane)(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+                           int srcx, int srcy, int w, int h,
+                           int dstx, int dsty, unsigned long bitPlane);
+    void (*PolyPoint)(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
+                      DDXPointPtr pptInit);
+    void (*Polylines)(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
+                      DDXPointPtr pptInit);
+    void (*PolySegment)(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+                        xSegment *pSegs);
+    void (*PolyRectangle)(DrawablePtr pDrawable, GCPtr pGC, int nrects,
+                          xRectangle *rects);
+    void (*PolyArc)(DrawablePtr pDrawable, GCPtr pGC, int narcs,
+                    xArc *parcs);
+    void (*FillPolygon)(DrawablePtr pDrawable, GCPtr pGC, int shape,
+                        int mode, int count, DDXPointPtr pPts);
+    void (*PolyFillRect)(DrawablePtr pDrawable, GCPtr pGC, int nrectFill,
+                         xRectangle *prectInit);
+    void (*PolyFillArc)(DrawablePtr pDrawable, GCPtr pGC, int narcs,
+                        xArc *parcs);
+    int (*PolyText8)(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                     int count, char *chars);
+    int (*PolyText16)(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                      int count, unsigned short *chars);
+    void (*ImageText8)(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                       int count, char *chars);
+    void (*ImageText16)(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                        int count, unsigned short *chars);
+    void (*ImageGlyphBlt)(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                          unsigned int nglyph, CharInfoPtr *ppci,
+                          pointer pglyphBase);
+    void (*PolyGlyphBlt)(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                         unsigned int nglyph, CharInfoPtr *ppci,
+                         pointer pglyphBase);
+    void (*PushPixels)(GCPtr pGC, PixmapPtr pBitMap, DrawablePtr pDst,
+                       int w, int h, int x, int y);
+} GCOps;
+
+typedef struct _GCFuncs
+{
+    void (*ValidateGC)(GCPtr pGC, unsigned long changes, DrawablePtr pDraw);
+    void (*ChangeGC)(GCPtr pGC, unsigned long mask);
+    void (*CopyGC)(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst);
+    void (*DestroyGC)(GCPtr pGC);
+    void (*ChangeClip)(GCPtr pGC, int type, pointer pvalue, int nrects);
+    void (*DestroyClip)(GCPtr pGC);
+    void (*CopyClip)(GCPtr pgcDst, GCPtr pgcSrc);
+} GCFuncs;
+
+#define CT_NONE 0
+#define CT_PIXMAP 1
+#define CT_REGION 2
+
+typedef struct _GC
+{
+    ScreenPtr pScreen;
+    unsigned char depth;
+    unsigned char alu;
+    unsigned long planemask;
+    unsigned long fgPixel;
+    unsigned long bgPixel;
+    GCFuncs *funcs;
+    GCOps *ops;
+    PrivateRec devPrivates;
+    unsigned int subWindowMode;
+    unsigned int clientClipType;
+    DDXPointRec clipOrg;
+    pointer clientClip;
+    RegionPtr pCompositeClip;
+} GC;
+
+typedef struct _Screen
+{
+    int myNum;
+    short width;
+    short height;
+    unsigned long rootVisual;
+    WindowPtr root;
+    Colormap defColormap;
+    PrivateRec devPrivates;
+    CloseScreenProcPtr CloseScreen;
+    CreateGCProcPtr CreateGC;
+    CreatePixmapProcPtr CreatePixmap;
+    DestroyPixmapProcPtr DestroyPixmap;
+    ModifyPixmapHeaderProcPtr ModifyPixmapHeader;
+    CreateWindowProcPtr CreateWindow;
+    DestroyWindowProcPtr DestroyWindow;
+    PositionWindowProcPtr PositionWindow;
+    RealizeWindowProcPtr RealizeWindow;
+    UnrealizeWindowProcPtr UnrealizeWindow;
+    ChangeWindowAttributesProcPtr ChangeWindowAttributes;
+    WindowExposuresProcPtr WindowExposures;
+    CopyWindowProcPtr CopyWindow;
+    ClearToBackgroundProcPtr ClearToBackground;
+    RestoreAreasProcPtr RestoreAreas;
+} ScreenRec;
+
+typedef struct _ColormapRec
+{
+    Colormap mid;
+    ScreenPtr pScreen;
+} ColormapRec;
+
+#define WT_WALKCHILDREN 1
+int WalkTree(ScreenPtr pScreen, int (*func)(WindowPtr pWin, pointer data),
+             pointer data);
+int TellLostMap(WindowPtr pWin, pointer value);
+int TellGainedMap(WindowPtr pWin, pointer value);
+
+/* fonts, the text ops read the bounds */
+typedef struct _CharInfo
+{
+    struct
+    {
+        short leftSideBearing;
+        short rightSideBearing;
+        short characterWidth;
+        short ascent;
+        short descent;
+        unsigned short attributes;
+    } metrics;
+    char *bits;
+} CharInfoRec;
+
+typedef struct _Font
+{
+    CharInfoRec maxbounds;
+    CharInfoRec minbounds;
+    short fontAscent;
+    short fontDescent;
+} FontRec;
+
+#define FONTASCENT(_font) ((_font)->fontAscent)
+#define FONTDESCENT(_font) ((_font)->fontDescent)
+#define FONTMAXBOUNDS(_font, _field) ((_font)->maxbounds.metrics._field)
+#define FONTMINBOUNDS(_font, _field) ((_font)->minbounds.metrics._field)
+
+/* render, pixman is not here, an image is what image_from_pict gives */
+#define MAXSHORT 32767
+#define MINSHORT (-MAXSHORT)
+
+typedef struct pixman_image pixman_image_t;
+#define PIXMAN_a1 0x01011000
+#define PIXMAN_a8 0x08018000
+pixman_image_t *pixman_image_create_bits(int format, int width, int height,
+                                         uint32_t *bits, int stride);
+int pixman_image_unref(pixman_image_t *image);
+uint32_t *pixman_image_get_data(pixman_image_t *image);
+int pixman_image_get_width(pixman_image_t *image);
+int pixman_image_get_height(pixman_image_t *image);
+int pixman_image_get_stride(pixman_image_t *image);
+int pixman_image_get_depth(pixman_image_t *image);
+
+typedef struct _Picture
+{
+    DrawablePtr pDrawable;
+    int clientClipType;
+    RegionPtr pCompositeClip;
+    pixman_image_t *image;
+} PictureRec;
+
+pixman_image_t *image_from_pict(PicturePtr pict, Bool has_clip, int *xoff,
+                                int *yoff);
+void free_pixman_pict(PicturePtr pict, pixman_image_t *image);
+
+typedef struct _xGlyphInfo
+{
+    unsigned short width;
+    unsigned short height;
+    short x;
+    short y;
+    short xOff;
+    short yOff;
+} xGlyphInfo;
+
+typedef struct _Glyph
+{
+    CARD32 refcnt;
+    PrivateRec devPrivates;
+    unsigned char sha1[20];
+    xGlyphInfo info;
+    PicturePtr pictures[1]; /* one screen, after the glyph in the server */
+} GlyphRec;
+
+#define GlyphPicture(_glyph) ((_glyph)->pictures)
+
+typedef struct _GlyphList
+{
+    INT16 xOff;
+    INT16 yOff;
+    CARD8 len;
+    PictFormatPtr format;
+} GlyphListRec;
+
+typedef struct _PictureScreen
+{
+    GlyphsProcPtr Glyphs;
+} PictureScreenRec, *PictureScreenPtr;
+
+PictureScreenPtr GetPictureScreen(ScreenPtr pScreen);
+
+CARD32 GetTimeInMillis(void);
+void ErrorF(const char *f, ...);
+XID FakeClientID(int client);
+Bool AddResource(XID id, unsigned long type, void *value);
+
+#define PixmapBytePad(_w, _d) \
+    ((((_w) * ((_d) > 16 ? 32 : (_d) > 8 ? 16 : 8) + 31) >> 5) << 2)
+
+#define min(_a, _b) (((_a) < (_b)) ? (_a) : (_b))
+#define max(_a, _b) (((_a) > (_b)) ? (_a) : (_b))
+
+typedef struct
+{
+    CARD32 months;
+    CARD32 milliseconds;
+} TimeStamp;
+extern TimeStamp currentTime;
+
+#endif
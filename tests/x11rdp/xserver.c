@@ -0,0 +1,651 @@
+/*
+Copyright 2005-2013 Jay Sorg
+
+Permission to use, copy, modify, distribute, and sell this software and its
+documentation for any purpose is hereby granted without fee, provided that
+the above copyright notice appear in all copies and that both that
+copyright notice and this permission notice appear in supporting
+documentation.
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+OPEN GROUP BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+the X server calls from xorg-server.h
+regions are kept the way pixman keeps them, y-x banded, rects in a band
+have the same y1 and y2, do not overlap and are sorted on x, bands that
+touch and have the same x spans are one band, so two regions with the
+same area have the same rects
+union, intersect and subtract go band by band like pixman's op, it is
+not pixman, that is not here, but the rects come out the same
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <sys/time.h>
+
+#include "xorg-server.h"
+
+TimeStamp currentTime;
+
+struct pixman_image
+{
+    int depth;
+    int width;
+    int height;
+    int stride;
+    uint32_t *data;
+};
+
+static PictureScreenRec g_picture_screen;
+
+#define OP_UNION 0
+#define OP_INTERSECT 1
+#define OP_SUBTRACT 2
+
+/*****************************************************************************/
+static int
+region_grow(RegionPtr reg, int size)
+{
+    BoxPtr rects;
+
+    if (size <= reg->size)
+    {
+        return 1;
+    }
+    size = size < 16 ? 16 : size;
+    if (size < reg->size * 2)
+    {
+        size = reg->size * 2;
+    }
+    rects = (BoxPtr)realloc(reg->rects, size * sizeof(BoxRec));
+    if (rects == 0)
+    {
+        return 0;
+    }
+    reg->rects = rects;
+    reg->size = size;
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+region_set_extents(RegionPtr reg)
+{
+    int index;
+    BoxPtr box;
+
+    if (reg->numRects == 0)
+    {
+        reg->extents.x1 = 0;
+        reg->extents.y1 = 0;
+        reg->extents.x2 = 0;
+        reg->extents.y2 = 0;
+        return;
+    }
+    reg->extents.x1 = reg->rects[0].x1;
+    reg->extents.y1 = reg->rects[0].y1;
+    reg->extents.x2 = reg->rects[0].x2;
+    reg->extents.y2 = reg->rects[reg->numRects - 1].y2;
+    for (index = 1; index < reg->numRects; index++)
+    {
+        box = reg->rects + index;
+        reg->extents.x1 = min(reg->extents.x1, box->x1);
+        reg->extents.x2 = max(reg->extents.x2, box->x2);
+    }
+}
+
+/*****************************************************************************/
+void
+RegionInit(RegionPtr reg, BoxPtr box, int size)
+{
+    reg->numRects = 0;
+    reg->size = 0;
+    reg->rects = 0;
+    if ((box != 0) && (box->x2 > box->x1) && (box->y2 > box->y1))
+    {
+        if (region_grow(reg, max(size, 1)))
+        {
+            reg->rects[0] = *box;
+            reg->numRects = 1;
+        }
+    }
+    else if (size > 0)
+    {
+        region_grow(reg, size);
+    }
+    region_set_extents(reg);
+}
+
+/*****************************************************************************/
+void
+RegionUninit(RegionPtr reg)
+{
+    free(reg->rects);
+    reg->rects = 0;
+    reg->size = 0;
+    reg->numRects = 0;
+}
+
+/*****************************************************************************/
+RegionPtr
+RegionCreate(BoxPtr box, int size)
+{
+    RegionPtr reg;
+
+    reg = (RegionPtr)malloc(sizeof(RegionRec));
+    if (reg != 0)
+    {
+        RegionInit(reg, box, size);
+    }
+    return reg;
+}
+
+/*****************************************************************************/
+void
+RegionDestroy(RegionPtr reg)
+{
+    if (reg != 0)
+    {
+        RegionUninit(reg);
+        free(reg);
+    }
+}
+
+/*****************************************************************************/
+Bool
+RegionCopy(RegionPtr dst, RegionPtr src)
+{
+    if (dst == src)
+    {
+        return TRUE;
+    }
+    if (!region_grow(dst, src->numRects))
+    {
+        return FALSE;
+    }
+    if (src->numRects > 0)
+    {
+        memcpy(dst->rects, src->rects, src->numRects * sizeof(BoxRec));
+    }
+    dst->numRects = src->numRects;
+    dst->extents = src->extents;
+    return TRUE;
+}
+
+/*****************************************************************************/
+/* the rects of the band of reg that covers y, *index is where to start
+   looking and moves on, the bands before y are never needed again */
+static BoxPtr
+region_band(RegionPtr reg, int y, int *index, int *count)
+{
+    BoxPtr rects;
+    int i;
+
+    rects = reg->rects;
+    i = *index;
+    while ((i < reg->numRects) && (rects[i].y2 <= y))
+    {
+        i++;
+    }
+    *index = i;
+    *count = 0;
+    if ((i >= reg->numRects) || (rects[i].y1 > y))
+    {
+        return 0;
+    }
+    while ((i + *count < reg->numRects) &&
+           (rects[i + *count].y1 == rects[i].y1))
+    {
+        (*count)++;
+    }
+    return rects + i;
+}
+
+/*****************************************************************************/
+/* next y after y where a band of reg starts or ends, or 0x7fffffff */
+static int
+region_next_y(RegionPtr reg, int index, int y)
+{
+    int i;
+
+    for (i = index; i < reg->numRects; i++)
+    {
+        if (reg->rects[i].y1 > y)
+        {
+            return reg->rects[i].y1;
+        }
+        if (reg->rects[i].y2 > y)
+        {
+            return reg->rects[i].y2;
+        }
+    }
+    return 0x7fffffff;
+}
+
+/*****************************************************************************/
+/* x spans of one band from the spans of the two regions there */
+static int
+band_op(int op, BoxPtr a, int na, BoxPtr b, int nb, short *out)
+{
+    int ia;
+    int ib;
+    int x;
+    int next;
+    int in_a;
+    int in_b;
+    int in;
+    int count;
+
+    ia = 0;
+    ib = 0;
+    count = 0;
+    x = -0x7fffffff;
+    for (;;)
+    {
+        /* skip spans that end at or before x */
+        while ((ia < na) && (a[ia].x2 <= x))
+        {
+            ia++;
+        }
+        while ((ib < nb) && (b[ib].x2 <= x))
+        {
+            ib++;
+        }
+        if ((ia >= na) && (ib >= nb))
+        {
+            break;
+        }
+        in_a = (ia < na) && (a[ia].x1 <= x);
+        in_b = (ib < nb) && (b[ib].x1 <= x);
+        next = 0x7fffffff;
+        if (ia < na)
+        {
+            next = min(next, in_a ? a[ia].x2 : a[ia].x1);
+        }
+        if (ib < nb)
+        {
+            next = min(next, in_b ? b[ib].x2 : b[ib].x1);
+        }
+        switch (op)
+        {
+            case OP_UNION:
+                in = in_a || in_b;
+                break;
+            case OP_INTERSECT:
+                in = in_a && in_b;
+                break;
+            default:
+                in = in_a && !in_b;
+                break;
+        }
+        if (in)
+        {
+            if ((count > 0) && (out[count * 2 - 1] == x))
+            {
+                out[count * 2 - 1] = next;
+            }
+            else
+            {
+                out[count * 2] = x;
+                out[count * 2 + 1] = next;
+                count++;
+            }
+        }
+        x = next;
+    }
+    return count;
+}
+
+/*****************************************************************************/
+static Bool
+region_op(int op, RegionPtr dst, RegionPtr reg1, RegionPtr reg2)
+{
+    RegionRec res;
+    BoxPtr a;
+    BoxPtr b;
+    short *spans;
+    int na;
+    int nb;
+    int ia;
+    int ib;
+    int y;
+    int y2;
+    int count;
+    int index;
+    int last_start;
+    int last_count;
+    int same;
+
+    res.numRects = 0;
+    res.size = 0;
+    res.rects = 0;
+    spans = (short *)malloc((reg1->numRects + reg2->numRects + 1) * 4 *
+                            sizeof(short));
+    if (spans == 0)
+    {
+        return FALSE;
+    }
+    ia = 0;
+    ib = 0;
+    last_start = 0;
+    last_count = 0;
+    y = -0x7fffffff;
+    if (reg1->numRects > 0)
+    {
+        y = reg1->rects[0].y1;
+    }
+    if (reg2->numRects > 0)
+    {
+        y = reg1->numRects > 0 ? min(y, reg2->rects[0].y1) :
+            reg2->rects[0].y1;
+    }
+    while ((reg1->numRects > 0) || (reg2->numRects > 0))
+    {
+        y2 = min(region_next_y(reg1, ia, y), region_next_y(reg2, ib, y));
+        if (y2 == 0x7fffffff)
+        {
+            break;
+        }
+        a = region_band(reg1, y, &ia, &na);
+        b = region_band(reg2, y, &ib, &nb);
+        count = band_op(op, a, na, b, nb, spans);
+        if (count > 0)
+        {
+            /* same spans as the band just above and touching, one band */
+            same = (last_count == count) &&
+                   (res.rects[last_start].y2 == y);
+            for (index = 0; same && (index < count); index++)
+            {
+                same = (res.rects[last_start + index].x1 ==
+                        spans[index * 2]) &&
+                       (res.rects[last_start + index].x2 ==
+                        spans[index * 2 + 1]);
+            }
+            if (same)
+            {
+                for (index = 0; index < count; index++)
+                {
+                    res.rects[last_start + index].y2 = y2;
+                }
+            }
+            else
+            {
+                if (!region_grow(&res, res.numRects + count))
+                {
+                    free(spans);
+                    RegionUninit(&res);
+                    return FALSE;
+                }
+                last_start = res.numRects;
+                last_count = count;
+                for (index = 0; index < count; index++)
+                {
+                    res.rects[res.numRects].x1 = spans[index * 2];
+                    res.rects[res.numRects].x2 = spans[index * 2 + 1];
+                    res.rects[res.numRects].y1 = y;
+                    res.rects[res.numRects].y2 = y2;
+                    res.numRects++;
+                }
+            }
+        }
+        y = y2;
+    }
+    free(spans);
+    RegionUninit(dst);
+    *dst = res;
+    region_set_extents(dst);
+    return TRUE;
+}
+
+/*****************************************************************************/
+Bool
+RegionUnion(RegionPtr dst, RegionPtr reg1, RegionPtr reg2)
+{
+    return region_op(OP_UNION, dst, reg1, reg2);
+}
+
+/*****************************************************************************/
+Bool
+RegionIntersect(RegionPtr dst, RegionPtr reg1, RegionPtr reg2)
+{
+    return region_op(OP_INTERSECT, dst, reg1, reg2);
+}
+
+/*****************************************************************************/
+Bool
+RegionSubtract(RegionPtr dst, RegionPtr reg1, RegionPtr reg2)
+{
+    return region_op(OP_SUBTRACT, dst, reg1, reg2);
+}
+
+/*****************************************************************************/
+void
+RegionTranslate(RegionPtr reg, int x, int y)
+{
+    int index;
+
+    for (index = 0; index < reg->numRects; index++)
+    {
+        reg->rects[index].x1 += x;
+        reg->rects[index].y1 += y;
+        reg->rects[index].x2 += x;
+        reg->rects[index].y2 += y;
+    }
+    region_set_extents(reg);
+}
+
+/*****************************************************************************/
+void
+RegionEmpty(RegionPtr reg)
+{
+    reg->numRects = 0;
+    region_set_extents(reg);
+}
+
+/*****************************************************************************/
+void
+RegionReset(RegionPtr reg, BoxPtr box)
+{
+    reg->numRects = 0;
+    if (region_grow(reg, 1))
+    {
+        reg->rects[0] = *box;
+        reg->numRects = 1;
+    }
+    region_set_extents(reg);
+}
+
+/*****************************************************************************/
+/* rgnIN if all of box is in reg, rgnPART if some, else rgnOUT */
+int
+RegionContainsRect(RegionPtr reg, BoxPtr box)
+{
+    RegionRec breg;
+    RegionRec tmp;
+    int rv;
+
+    RegionInit(&breg, box, 0);
+    RegionInit(&tmp, NullBox, 0);
+    RegionIntersect(&tmp, &breg, reg);
+    if (tmp.numRects == 0)
+    {
+        rv = rgnOUT;
+    }
+    else
+    {
+        RegionSubtract(&tmp, &breg, reg);
+        rv = tmp.numRects == 0 ? rgnIN : rgnPART;
+    }
+    RegionUninit(&tmp);
+    RegionUninit(&breg);
+    return rv;
+}
+
+/*****************************************************************************/
+RegionPtr
+RegionFromRects(int nrects, xRectangle *prect, int ctype)
+{
+    RegionPtr reg;
+    RegionRec breg;
+    BoxRec box;
+    int index;
+
+    reg = RegionCreate(NullBox, 0);
+    if (reg == 0)
+    {
+        return 0;
+    }
+    for (index = 0; index < nrects; index++)
+    {
+        box.x1 = prect[index].x;
+        box.y1 = prect[index].y;
+        box.x2 = prect[index].x + prect[index].width;
+        box.y2 = prect[index].y + prect[index].height;
+        RegionInit(&breg, &box, 0);
+        RegionUnion(reg, reg, &breg);
+        RegionUninit(&breg);
+    }
+    return reg;
+}
+
+/*****************************************************************************/
+void *
+dixLookupPrivate(PrivateRec *privates, DevPrivateKey key)
+{
+    return *(void **)dixGetPrivateAddr(privates, key);
+}
+
+/*****************************************************************************/
+void *
+dixGetPrivateAddr(PrivateRec *privates, DevPrivateKey key)
+{
+    return (char *)*privates + key->offset;
+}
+
+/*****************************************************************************/
+CARD32
+GetTimeInMillis(void)
+{
+    struct timeval tp;
+
+    gettimeofday(&tp, 0);
+    return tp.tv_sec * 1000 + tp.tv_usec / 1000;
+}
+
+/*****************************************************************************/
+void
+ErrorF(const char *f, ...)
+{
+    va_list ap;
+
+    va_start(ap, f);
+    vfprintf(stderr, f, ap);
+    va_end(ap);
+}
+
+/*****************************************************************************/
+XID
+FakeClientID(int client)
+{
+    static XID id = 0x100;
+
+    return id++;
+}
+
+/*****************************************************************************/
+Bool
+AddResource(XID id, unsigned long type, void *value)
+{
+    return TRUE;
+}
+
+/*****************************************************************************/
+/* the alpha formats only, depth is the format's bits a pixel */
+pixman_image_t *
+pixman_image_create_bits(int format, int width, int height, uint32_t *bits,
+                         int stride)
+{
+    pixman_image_t *image;
+
+    image = (pixman_image_t *)calloc(1, sizeof(pixman_image_t));
+    image->depth = (format >> 24) & 0xff;
+    image->width = width;
+    image->height = height;
+    image->stride = stride;
+    image->data = bits;
+    return image;
+}
+
+/*****************************************************************************/
+int
+pixman_image_unref(pixman_image_t *image)
+{
+    free(image);
+    return 1;
+}
+
+/*****************************************************************************/
+uint32_t *
+pixman_image_get_data(pixman_image_t *image)
+{
+    return image->data;
+}
+
+/*****************************************************************************/
+int
+pixman_image_get_width(pixman_image_t *image)
+{
+    return image->width;
+}
+
+/*****************************************************************************/
+int
+pixman_image_get_height(pixman_image_t *image)
+{
+    return image->height;
+}
+
+/*****************************************************************************/
+int
+pixman_image_get_stride(pixman_image_t *image)
+{
+    return image->stride;
+}
+
+/*****************************************************************************/
+int
+pixman_image_get_depth(pixman_image_t *image)
+{
+    return image->depth;
+}
+
+/*****************************************************************************/
+pixman_image_t *
+image_from_pict(PicturePtr pict, Bool has_clip, int *xoff, int *yoff)
+{
+    *xoff = 0;
+    *yoff = 0;
+    return pict->image;
+}
+
+/*****************************************************************************/
+void
+free_pixman_pict(PicturePtr pict, pixman_image_t *image)
+{
+}
+
+/*****************************************************************************/
+PictureScreenPtr
+GetPictureScreen(ScreenPtr pScreen)
+{
+    return &g_picture_screen;
+}
@@ -0,0 +1,573 @@
+/*
+Copyright 2013 Jay Sorg
+
+Permission to use, copy, modify, distribute, and sell this software and its
+documentation for any purpose is hereby granted without fee, provided that
+the above copyright notice appear in all copies and that both that
+copyright notice and this permission notice appear in supporting
+documentation.
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+OPEN GROUP BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+check and benchmark of rdpXvPutImage
+checks a frame bigger than rdpXvQueryImageAttributes lays out is refused
+before anything reads it, the I420 plane offsets, that an h264 session
+gets the frame in NV12 as it came with the screen keyed under it and that
+rdpXvScreenToNV12 puts the video and the rest of the screen together,
+then prints fps and cpu a frame for the RGB and the NV12 path at 1280x720
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* the Xv handlers are static, take the module in whole */
+#include "rdpxv.c"
+
+#define T_SCREEN_W 128
+#define T_SCREEN_H 96
+#define T_WIN_X 10
+#define T_WIN_Y 6
+#define T_FRAME_W 64
+#define T_FRAME_H 48
+#define T_BACK 0x00808080
+#define T_BENCH_W 1280
+#define T_BENCH_H 720
+#define T_BENCH_FRAMES 300
+
+rdpScreenInfoRec g_rdpScreen;
+int g_Bpp = 4;
+rdpPixmapRec g_screenPriv;
+unsigned long XvRTPort = 0;
+
+static int g_nv12 = 0;
+static int g_regions = 0;
+static BoxRec g_region_extents;
+static int g_put_images = 0;
+static int g_put_w = 0;
+static int g_put_h = 0;
+static CARD32 g_put_pixel = 0;
+static int g_put_draw = 0;
+
+/*****************************************************************************/
+int
+rdpup_nv12_capture(void)
+{
+    return g_nv12;
+}
+
+/*****************************************************************************/
+int
+draw_item_add_img_region(rdpPixmapRec *priv, RegionPtr reg, int opcode,
+                         int type, int code)
+{
+    g_regions++;
+    g_region_extents = *RegionExtents(reg);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+XvScreenInit(ScreenPtr pScreen)
+{
+    return Success;
+}
+
+/*****************************************************************************/
+DevPrivateKey
+XvGetScreenKey(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+bench_put_image(DrawablePtr pDst, GCPtr pGC, int depth, int x, int y, int w,
+                int h, int leftPad, int format, char *pBits)
+{
+    int index;
+
+    g_put_images++;
+    g_put_w = w;
+    g_put_h = h;
+    g_put_pixel = ((CARD32 *)pBits)[0];
+    if (g_put_draw)
+    {
+        /* what fb does with it, x, y is on the screen here */
+        for (index = 0; index < h; index++)
+        {
+            memcpy(g_rdpScreen.pfbMemory +
+                   (y + index) * g_rdpScreen.paddedWidthInBytes + x * 4,
+                   pBits + index * w * 4, w * 4);
+        }
+    }
+}
+
+static GCOps g_ops = { .PutImage = bench_put_image };
+
+/*****************************************************************************/
+/* I420 frame of width x height, what rdpXvQueryImageAttributes says it is,
+   ending on a page that can not be read so an overread faults */
+static unsigned char *
+make_frame(int width, int height, int *size, int seed)
+{
+    XvImageRec format;
+    CARD16 w;
+    CARD16 h;
+    int pitches[3];
+    int offsets[3];
+    int bytes;
+    int page;
+    int index;
+    unsigned char *mem;
+    unsigned char *data;
+
+    memset(&format, 0, sizeof(format));
+    format.id = FOURCC_I420;
+    w = width;
+    h = height;
+    bytes = rdpXvQueryImageAttributes(0, 0, &format, &w, &h, pitches,
+                                      offsets);
+    page = getpagesize();
+    index = (bytes + page - 1) / page * page;
+    mem = (unsigned char *)mmap(0, index + page, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return 0;
+    }
+    mprotect(mem + index, page, PROT_NONE);
+    data = mem + index - bytes;
+    for (index = 0; index < bytes; index++)
+    {
+        /* y, u, v all different and in video range */
+        data[index] = 16 + ((index * 7 + seed + (index >> 9)) % 220);
+    }
+    *size = bytes;
+    return data;
+}
+
+/*****************************************************************************/
+static int
+put(DrawablePtr pDraw, GCPtr pGC, unsigned char *data, int src_x, int src_y,
+    int src_w, int src_h, int drw_x, int drw_y, int drw_w, int drw_h,
+    int width, int height)
+{
+    XvImageRec format;
+
+    memset(&format, 0, sizeof(format));
+    format.id = FOURCC_I420;
+    return rdpXvPutImage(0, pDraw, &g_ports[0], pGC, src_x, src_y, src_w,
+                         src_h, drw_x, drw_y, drw_w, drw_h, &format, data,
+                         FALSE, width, height);
+}
+
+/*****************************************************************************/
+static void
+set_screen(int width, int height)
+{
+    CARD32 *fb;
+    int index;
+
+    free(g_rdpScreen.pfbMemory);
+    g_rdpScreen.width = width;
+    g_rdpScreen.height = height;
+    g_rdpScreen.depth = 24;
+    g_rdpScreen.paddedWidthInBytes = width * 4;
+    g_rdpScreen.pfbMemory = (char *)malloc(width * height * 4);
+    fb = (CARD32 *)g_rdpScreen.pfbMemory;
+    for (index = 0; index < width * height; index++)
+    {
+        fb[index] = T_BACK;
+    }
+}
+
+/*****************************************************************************/
+static void
+set_window(WindowRec *win, int x, int y, int width, int height)
+{
+    memset(win, 0, sizeof(WindowRec));
+    win->drawable.type = DRAWABLE_WINDOW;
+    win->drawable.depth = 24;
+    win->drawable.x = x;
+    win->drawable.y = y;
+    win->drawable.width = width;
+    win->drawable.height = height;
+}
+
+/*****************************************************************************/
+static int
+check_clamp(void)
+{
+    WindowRec win;
+    GC gc;
+    unsigned char *data;
+    int size;
+    int rv;
+    int errors;
+
+    errors = 0;
+    set_window(&win, 0, 0, T_SCREEN_W, T_SCREEN_H);
+    memset(&gc, 0, sizeof(gc));
+    gc.ops = &g_ops;
+    /* the client says 4000 wide, the buffer is for 2046 */
+    data = make_frame(4000, 16, &size, 1);
+    rv = put(&win.drawable, &gc, data, 0, 0, 4000, 16, 0, 0, 64, 16,
+             4000, 16);
+    if (rv != BadValue)
+    {
+        printf("clamp: 4000 wide gave %d, not BadValue\n", rv);
+        errors++;
+    }
+    rv = put(&win.drawable, &gc, data, 2000, 0, 46, 16, 0, 0, 64, 16,
+             2046, 16);
+    if (rv != Success)
+    {
+        printf("clamp: 2046 wide, last 46 gave %d\n", rv);
+        errors++;
+    }
+    /* 2046 is laid out 2048 wide */
+    rv = put(&win.drawable, &gc, data, 2003, 0, 46, 16, 0, 0, 64, 16,
+             2046, 16);
+    if (rv != BadValue)
+    {
+        printf("clamp: source past 2048 gave %d, not BadValue\n", rv);
+        errors++;
+    }
+    rv = put(&win.drawable, &gc, data, 0, 10, 64, 10, 0, 0, 64, 16,
+             2046, 16);
+    if (rv != BadValue)
+    {
+        printf("clamp: source past the last row gave %d, not BadValue\n",
+               rv);
+        errors++;
+    }
+    printf("clamp: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+static int
+check_offsets(void)
+{
+    XvImageRec format;
+    CARD16 w;
+    CARD16 h;
+    int pitches[3];
+    int offsets[3];
+    int size;
+
+    memset(&format, 0, sizeof(format));
+    format.id = FOURCC_I420;
+    w = 64;
+    h = 48;
+    size = rdpXvQueryImageAttributes(0, 0, &format, &w, &h, pitches,
+                                     offsets);
+    if ((offsets[1] != 64 * 48) || (offsets[2] != 64 * 48 + 32 * 24) ||
+        (size != 64 * 48 + 2 * 32 * 24) || (pitches[1] != 32))
+    {
+        printf("offsets: u %d v %d size %d, want %d %d %d: FAILED\n",
+               offsets[1], offsets[2], size, 64 * 48, 64 * 48 + 32 * 24,
+               64 * 48 + 2 * 32 * 24);
+        return 1;
+    }
+    printf("offsets: ok\n");
+    return 0;
+}
+
+/*****************************************************************************/
+/* 1:1 frame in a window with another window over part of it */
+static int
+check_nv12(void)
+{
+    WindowRec win;
+    GC gc;
+    RegionRec clip;
+    RegionRec over;
+    BoxRec box;
+    CARD32 *fb;
+    CARD32 pixel;
+    unsigned char *data;
+    unsigned char *yuv;
+    unsigned char *uv;
+    unsigned char *fy;
+    unsigned char *fu;
+    unsigned char *fv;
+    int size;
+    int errors;
+    int covered;
+    int video;
+    int x;
+    int y;
+    int wy;
+    int wu;
+    int wv;
+    int r;
+    int g;
+    int b;
+
+    errors = 0;
+    g_nv12 = 1;
+    set_screen(T_SCREEN_W, T_SCREEN_H);
+    set_window(&win, T_WIN_X, T_WIN_Y, T_FRAME_W, T_FRAME_H);
+    memset(&gc, 0, sizeof(gc));
+    gc.ops = &g_ops;
+    /* the window less a window on top at 40,20 to 60,30 screen */
+    box.x1 = T_WIN_X;
+    box.y1 = T_WIN_Y;
+    box.x2 = T_WIN_X + T_FRAME_W;
+    box.y2 = T_WIN_Y + T_FRAME_H;
+    RegionInit(&clip, &box, 0);
+    box.x1 = 40;
+    box.y1 = 20;
+    box.x2 = 60;
+    box.y2 = 30;
+    RegionInit(&over, &box, 0);
+    RegionSubtract(&clip, &clip, &over);
+    gc.pCompositeClip = &clip;
+    data = make_frame(T_FRAME_W, T_FRAME_H, &size, 3);
+    g_regions = 0;
+    g_put_images = 0;
+    if (put(&win.drawable, &gc, data, 0, 0, T_FRAME_W, T_FRAME_H, 0, 0,
+            T_FRAME_W, T_FRAME_H, T_FRAME_W, T_FRAME_H) != Success)
+    {
+        printf("nv12: PutImage failed\n");
+        errors++;
+    }
+    if ((g_regions != 1) || (g_put_images != 0) ||
+        (g_region_extents.x1 != T_WIN_X) ||
+        (g_region_extents.y1 != T_WIN_Y) ||
+        (g_region_extents.x2 != T_WIN_X + T_FRAME_W) ||
+        (g_region_extents.y2 != T_WIN_Y + T_FRAME_H))
+    {
+        printf("nv12: %d regions, %d PutImage, extents %d %d %d %d\n",
+               g_regions, g_put_images, g_region_extents.x1,
+               g_region_extents.y1, g_region_extents.x2,
+               g_region_extents.y2);
+        errors++;
+    }
+
+    /* what the memfd gets */
+    yuv = (unsigned char *)malloc(T_SCREEN_W * T_SCREEN_H * 3 / 2);
+    uv = yuv + T_SCREEN_W * T_SCREEN_H;
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = T_SCREEN_W;
+    box.y2 = T_SCREEN_H;
+    rdpXvScreenToNV12(&box, (char *)yuv, (char *)uv, T_SCREEN_W);
+    fb = (CARD32 *)g_rdpScreen.pfbMemory;
+    for (y = 0; y < T_SCREEN_H; y++)
+    {
+        for (x = 0; x < T_SCREEN_W; x++)
+        {
+            video = (x >= T_WIN_X) && (x < T_WIN_X + T_FRAME_W) &&
+                    (y >= T_WIN_Y) && (y < T_WIN_Y + T_FRAME_H);
+            covered = (x >= 40) && (x < 60) && (y >= 20) && (y < 30);
+            video = video && !covered;
+            pixel = fb[y * T_SCREEN_W + x];
+            if (video != (pixel == XV_COLORKEY))
+            {
+                printf("nv12: screen at %d %d is 0x%6.6x\n", x, y,
+                       (unsigned int)pixel);
+                errors++;
+                goto done;
+            }
+            if (video)
+            {
+                fy = data + (y - T_WIN_Y) * T_FRAME_W;
+                wy = fy[x - T_WIN_X];
+            }
+            else
+            {
+                wy = XV_RGB2Y(0x80, 0x80, 0x80);
+            }
+            if (yuv[y * T_SCREEN_W + x] != wy)
+            {
+                printf("nv12: y at %d %d is %d, want %d\n", x, y,
+                       yuv[y * T_SCREEN_W + x], wy);
+                errors++;
+                goto done;
+            }
+            if (((x & 1) != 0) || ((y & 1) != 0))
+            {
+                continue;
+            }
+            /* chroma goes with the top left pixel of the block */
+            if (video)
+            {
+                fu = data + T_FRAME_W * T_FRAME_H +
+                     ((y - T_WIN_Y) >> 1) * (T_FRAME_W / 2);
+                fv = fu + (T_FRAME_W / 2) * (T_FRAME_H / 2);
+                wu = fu[(x - T_WIN_X) >> 1];
+                wv = fv[(x - T_WIN_X) >> 1];
+            }
+            else
+            {
+                /* the block is the background or partly video */
+                r = 0;
+                g = 0;
+                b = 0;
+                for (wy = 0; wy < 4; wy++)
+                {
+                    pixel = fb[(y + (wy >> 1)) * T_SCREEN_W + x + (wy & 1)];
+                    r += (pixel >> 16) & 0xff;
+                    g += (pixel >> 8) & 0xff;
+                    b += pixel & 0xff;
+                }
+                r = (r + 2) >> 2;
+                g = (g + 2) >> 2;
+                b = (b + 2) >> 2;
+                wu = XV_RGB2U(r, g, b);
+                wv = XV_RGB2V(r, g, b);
+            }
+            if ((uv[(y >> 1) * T_SCREEN_W + x] != wu) ||
+                (uv[(y >> 1) * T_SCREEN_W + x + 1] != wv))
+            {
+                printf("nv12: uv at %d %d is %d %d, want %d %d\n", x, y,
+                       uv[(y >> 1) * T_SCREEN_W + x],
+                       uv[(y >> 1) * T_SCREEN_W + x + 1], wu, wv);
+                errors++;
+                goto done;
+            }
+        }
+    }
+done:
+    free(yuv);
+    RegionUninit(&over);
+    RegionUninit(&clip);
+    g_nv12 = 0;
+    printf("nv12: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+/* not an h264 session, the frame is RGB and drawn with PutImage */
+static int
+check_rgb(void)
+{
+    WindowRec win;
+    GC gc;
+    unsigned char *data;
+    int size;
+    int r;
+    int g;
+    int b;
+    int u;
+    int v;
+    CARD32 want;
+
+    set_screen(T_SCREEN_W, T_SCREEN_H);
+    set_window(&win, T_WIN_X, T_WIN_Y, T_FRAME_W, T_FRAME_H);
+    memset(&gc, 0, sizeof(gc));
+    gc.ops = &g_ops;
+    data = make_frame(T_FRAME_W, T_FRAME_H, &size, 5);
+    g_regions = 0;
+    g_put_images = 0;
+    put(&win.drawable, &gc, data, 0, 0, T_FRAME_W, T_FRAME_H, 0, 0,
+        T_FRAME_W, T_FRAME_H, T_FRAME_W, T_FRAME_H);
+    u = data[T_FRAME_W * T_FRAME_H];
+    v = data[T_FRAME_W * T_FRAME_H + (T_FRAME_W / 2) * (T_FRAME_H / 2)];
+    XV_YUV2RGB(data[0], u, v, r, g, b);
+    want = (r << 16) | (g << 8) | b;
+    if ((g_put_images != 1) || (g_regions != 0) || (g_put_w != T_FRAME_W) ||
+        (g_put_h != T_FRAME_H) || (g_put_pixel != want))
+    {
+        printf("rgb: %d PutImage %dx%d pixel 0x%6.6x want 0x%6.6x, "
+               "%d regions: FAILED\n", g_put_images, g_put_w, g_put_h,
+               (unsigned int)g_put_pixel, (unsigned int)want, g_regions);
+        return 1;
+    }
+    printf("rgb: ok\n");
+    return 0;
+}
+
+/*****************************************************************************/
+/* a 1280x720 stream filling the screen in an h264 session, both ways
+   end in the NV12 the memfd gets, the RGB way draws the converted frame
+   and rdpXvScreenToNV12 takes it back to YUV, the NV12 way keys the screen
+   and the video goes through as it came */
+static void
+bench(int nv12)
+{
+    WindowRec win;
+    GC gc;
+    BoxRec box;
+    unsigned char *data;
+    char *yuv;
+    int size;
+    int index;
+    CARD32 start_ms;
+    CARD32 start_cpu;
+    CARD32 put_cpu;
+    CARD32 ms;
+    CARD32 cpu;
+
+    g_nv12 = nv12;
+    g_put_draw = 1;
+    set_screen(T_BENCH_W, T_BENCH_H);
+    set_window(&win, 0, 0, T_BENCH_W, T_BENCH_H);
+    memset(&gc, 0, sizeof(gc));
+    gc.ops = &g_ops;
+    data = make_frame(T_BENCH_W, T_BENCH_H, &size, 7);
+    yuv = (char *)malloc(T_BENCH_W * T_BENCH_H * 3 / 2);
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = T_BENCH_W;
+    box.y2 = T_BENCH_H;
+    start_ms = GetTimeInMillis();
+    put_cpu = 0;
+    for (index = 0; index < T_BENCH_FRAMES; index++)
+    {
+        start_cpu = rdpXvCpuMs();
+        put(&win.drawable, &gc, data, 0, 0, T_BENCH_W, T_BENCH_H, 0, 0,
+            T_BENCH_W, T_BENCH_H, T_BENCH_W, T_BENCH_H);
+        put_cpu += rdpXvCpuMs() - start_cpu;
+        rdpXvScreenToNV12(&box, yuv, yuv + T_BENCH_W * T_BENCH_H,
+                          T_BENCH_W);
+    }
+    ms = GetTimeInMillis() - start_ms;
+    cpu = 0;
+    start_cpu = rdpXvCpuMs();
+    for (index = 0; index < T_BENCH_FRAMES; index++)
+    {
+        rdpXvScreenToNV12(&box, yuv, yuv + T_BENCH_W * T_BENCH_H,
+                          T_BENCH_W);
+    }
+    cpu = rdpXvCpuMs() - start_cpu;
+    printf("%s: %d frames %dx%d in %u ms, %u fps, cpu a frame %.2f ms "
+           "PutImage, %.2f ms screen to NV12\n",
+           nv12 ? "nv12" : "rgb ", T_BENCH_FRAMES, T_BENCH_W, T_BENCH_H,
+           (unsigned int)ms,
+           (unsigned int)(T_BENCH_FRAMES * 1000 / max(ms, 1)),
+           (double)put_cpu / T_BENCH_FRAMES, (double)cpu / T_BENCH_FRAMES);
+    free(yuv);
+    g_put_draw = 0;
+    g_nv12 = 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    int errors;
+
+    errors = check_clamp();
+    errors += check_offsets();
+    errors += check_nv12();
+    errors += check_rgb();
+    bench(0);
+    bench(1);
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
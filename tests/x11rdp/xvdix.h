@@ -0,0 +1,123 @@
+/*
+the Xv side of the X server that rdpxv.c uses, see xorg-server.h
+*/
+
+#ifndef __XVDIX_H
+#define __XVDIX_H
+
+typedef struct
+{
+    int numerator;
+    int denominator;
+} XvRationalRec;
+
+typedef struct
+{
+    XID id;
+    ScreenPtr pScreen;
+    char *name;
+    unsigned short width;
+    unsigned short height;
+    XvRationalRec rate;
+} XvEncodingRec, *XvEncodingPtr;
+
+typedef struct
+{
+    char depth;
+    unsigned long visual;
+} XvFormatRec, *XvFormatPtr;
+
+typedef struct
+{
+    int id;
+    int type;
+    int byte_order;
+    char guid[16];
+    int bits_per_pixel;
+    int format;
+    int num_planes;
+    int depth;
+    unsigned int red_mask;
+    unsigned int green_mask;
+    unsigned int blue_mask;
+    unsigned int y_sample_bits;
+    unsigned int u_sample_bits;
+    unsigned int v_sample_bits;
+    unsigned int horz_y_period;
+    unsigned int horz_u_period;
+    unsigned int horz_v_period;
+    unsigned int vert_y_period;
+    unsigned int vert_u_period;
+    unsigned int vert_v_period;
+    char component_order[32];
+    int scanline_order;
+} XvImageRec, *XvImagePtr;
+
+typedef struct _XvAdaptorRec *XvAdaptorPtr;
+
+typedef struct
+{
+    XID id;
+    ClientPtr client;
+} XvGrabRec;
+
+typedef struct _XvPortRec
+{
+    unsigned long id;
+    XvAdaptorPtr pAdaptor;
+    void *pNotify;
+    DrawablePtr pDraw;
+    TimeStamp time;
+    XvGrabRec grab;
+    union
+    {
+        int val;
+        void *ptr;
+    } devPriv;
+} XvPortRec, *XvPortPtr;
+
+typedef struct _XvAdaptorRec
+{
+    unsigned long base_id;
+    unsigned char type;
+    char *name;
+    int nEncodings;
+    XvEncodingPtr pEncodings;
+    int nFormats;
+    XvFormatPtr pFormats;
+    int nAttributes;
+    void *pAttributes;
+    int nImages;
+    XvImagePtr pImages;
+    int nPorts;
+    XvPortPtr pPorts;
+    ScreenPtr pScreen;
+    void *ddAllocatePort;
+    void *ddFreePort;
+    void *ddPutVideo;
+    void *ddPutStill;
+    void *ddGetVideo;
+    void *ddGetStill;
+    void *ddStopVideo;
+    void *ddSetPortAttribute;
+    void *ddGetPortAttribute;
+    void *ddQueryBestSize;
+    void *ddPutImage;
+    void *ddQueryImageAttributes;
+} XvAdaptorRec;
+
+typedef struct
+{
+    int version;
+    int revision;
+    int nAdaptors;
+    XvAdaptorPtr pAdaptors;
+    void *ddCloseScreen;
+    void *ddQueryAdaptors;
+} XvScreenRec, *XvScreenPtr;
+
+extern unsigned long XvRTPort;
+int XvScreenInit(ScreenPtr pScreen);
+DevPrivateKey XvGetScreenKey(void);
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * painter
+ *
+ * the raw bitmap part of xrdp/xrdp_painter.c xrdp_painter_copy as it was
+ * before the tile pipeline, one tile at a time through
+ * xrdp_cache_add_bitmap, renamed, kept here as the reference painter_test
+ * checks the order stream against
+ */
+
+#include "xrdp.h"
+
+/*****************************************************************************/
+int APP_CC
+old_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
+		struct xrdp_bitmap *dst, int x, int y, int cx, int cy, int srcx,
+		int srcy) {
+	struct xrdp_rect clip_rect;
+	struct xrdp_rect draw_rect;
+	struct xrdp_rect rect1;
+	struct xrdp_rect rect2;
+	struct xrdp_region *region;
+	struct xrdp_bitmap *b;
+	int i;
+	int j;
+	int k;
+	int dx;
+	int dy;
+	int palette_id;
+	int bitmap_id;
+	int cache_id;
+	int cache_idx;
+	int dstx;
+	int dsty;
+	int w;
+	int h;
+
+	if (self == 0 || src == 0 || dst == 0) {
+		return 0;
+	}
+
+	if (src->data != 0) {
+		xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
+		region = xrdp_region_create(self->wm);
+
+		if (dst->type != WND_TYPE_OFFSCREEN) {
+			xrdp_wm_get_vis_region(self->wm, dst, x, y, cx, cy, region,
+					self->clip_children);
+		} else {
+			xrdp_region_add_rect(region, &clip_rect);
+		}
+
+		x += dx;
+		y += dy;
+		palette_id = 0;
+		j = srcy;
+
+		while (j < (srcy + cy)) {
+			i = srcx;
+
+			while (i < (srcx + cx)) {
+				w = MIN(64, ((srcx + cx) - i));
+				h = MIN(63, ((srcy + cy) - j));
+				b = xrdp_bitmap_create(w, h, src->bpp, 0, self->wm);
+				xrdp_bitmap_copy_box_with_crc(src, b, i, j, w, h);
+				bitmap_id = xrdp_cache_add_bitmap(self->wm->cache, b,
+						self->wm->hints);
+				cache_id = HIWORD(bitmap_id);
+				cache_idx = LOWORD(bitmap_id);
+				dstx = (x + i) - srcx;
+				dsty = (y + j) - srcy;
+				k = 0;
+
+				while (xrdp_region_get_rect(region, k, &rect1) == 0) {
+					if (rect_intersect(&rect1, &clip_rect, &rect2)) {
+						MAKERECT(rect1, dstx, dsty, w, h);
+
+						if (rect_intersect(&rect2, &rect1, &draw_rect)) {
+							libxrdp_orders_mem_blt(self->session, cache_id,
+									palette_id, dstx, dsty, w, h, self->rop, 0,
+									0, cache_idx, &draw_rect);
+						}
+					}
+
+					k++;
+				}
+
+				i += 64;
+			}
+
+			j += 63;
+		}
+
+		xrdp_region_delete(region);
+	}
+
+	return 0;
+}
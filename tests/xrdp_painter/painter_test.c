@@ -0,0 +1,1275 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * replay check and benchmark of xrdp_painter_copy's raw bitmap tiles
+ * the libxrdp orders are stubbed out here and record what they are given,
+ * a run of copies of ui, text and photo like bitmaps, 16, 24 and 32 bpp,
+ * bitmap cache v1 and v2, raw and rle, with caches small enough to evict,
+ * goes through xrdp_painter_copy with no worker threads and with three,
+ * and through the one tile at a time copy it had before, kept in
+ * old_painter.c, checks all give the same orders in the same order, and
+ * with a clip, that all draw the same and none sends tiles it does not
+ * draw, with bitmap cache v3, that ui and text tiles go lossless and
+ * photo tiles through the codec, and on every path that the cache counts
+ * the bytes of every bitmap order sent, in the update they went out in,
+ * then prints ms a 1920x1080 frame for each
+ * also checks xrdp_cache_reset keeps each client side cache the client's
+ * capabilities did not change for and clears the rest, and that off screen
+ * bitmaps are always gone after it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xrdp.h"
+#include "pointer_hash.h"
+
+#define T_WIDTH 1920
+#define T_HEIGHT 1080
+#define T_MAX_ORDERS 100000
+#define T_FRAMES 20
+
+#define T_RAW 1
+#define T_BITMAP 2
+#define T_RAW2 3
+#define T_BITMAP2 4
+#define T_BITMAP3 5
+#define T_MEMBLT 6
+
+int APP_CC
+old_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
+                 struct xrdp_bitmap *dst, int x, int y, int cx, int cy,
+                 int srcx, int srcy);
+int APP_CC
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e);
+int APP_CC
+xrdp_bitmap32_compress(char *in_data, int width, int height,
+                       struct stream *s, int bpp, int byte_limit,
+                       int start_line, struct stream *temp_s,
+                       int e, int flags);
+
+struct t_order
+{
+    int kind;
+    int v[12];
+    unsigned int hash;
+};
+
+/* what the stubs were given and the cache counted, before an update */
+struct t_counts
+{
+    double sent;
+    double bytes;
+    double codec_bytes;
+    double raw_bytes;
+    int frames;
+};
+
+struct t_setup
+{
+    const char *name;
+    int version;
+    int comp;
+    int entries;
+};
+
+static struct t_order g_orders[T_MAX_ORDERS];
+static int g_num_orders = 0;
+/* 0 nothing, 1 every order, 2 only what memblts draw */
+static int g_record = 0;
+static struct stream *g_s = 0;
+static struct stream *g_temp_s = 0;
+static unsigned int g_seed = 7;
+/* what the cache sent that the orders above do not record */
+static int g_fonts = 0;
+static int g_brushes = 0;
+static int g_pointers = 0;
+static int g_pointer_sets = 0;
+/* bytes of the last bitmap order the stubs took, and of all of them */
+static int g_last_size = 0;
+static double g_sent_bytes = 0;
+
+/*****************************************************************************/
+static int
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/*****************************************************************************/
+static unsigned int
+hash_bytes(const char *data, int bytes)
+{
+    unsigned int hash;
+    int index;
+
+    hash = 2166136261u;
+    for (index = 0; index < bytes; index++)
+    {
+        hash = (hash ^ (unsigned char) (data[index])) * 16777619u;
+    }
+    return hash;
+}
+
+/*****************************************************************************/
+static void
+add_order(int kind, int v0, int v1, int v2, int v3, int v4, int v5,
+          unsigned int hash)
+{
+    struct t_order *order;
+
+    if ((g_record != 1) || (g_num_orders >= T_MAX_ORDERS))
+    {
+        return;
+    }
+    order = g_orders + g_num_orders;
+    g_memset(order, 0, sizeof(struct t_order));
+    order->kind = kind;
+    order->v[0] = v0;
+    order->v[1] = v1;
+    order->v[2] = v2;
+    order->v[3] = v3;
+    order->v[4] = v4;
+    order->v[5] = v5;
+    order->hash = hash;
+    g_num_orders++;
+}
+
+/*****************************************************************************/
+static void
+add_sent(int bytes)
+{
+    g_last_size = bytes;
+    g_sent_bytes += bytes;
+}
+
+/*****************************************************************************/
+/* as xrdp_orders_compress_bitmap2 */
+static int
+t_compress(int width, int height, int bpp, char *data,
+           struct stream *s, struct stream *temp_s)
+{
+    int lines;
+    int e;
+
+    e = (4 - (width % 4)) & 3;
+    init_stream(s, 16384 * 2);
+    init_stream(temp_s, 16384 * 2);
+    if (bpp > 24)
+    {
+        lines = xrdp_bitmap32_compress(data, width, height, s, bpp, 16384,
+                                       height - 1, temp_s, e, 0x10);
+    }
+    else
+    {
+        lines = xrdp_bitmap_compress(data, width, height, s, bpp, 16384,
+                                     height - 1, temp_s, e);
+    }
+    if (lines != height)
+    {
+        return 1;
+    }
+    s_mark_end(s);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+raw_bytes(int width, int height, int bpp)
+{
+    return width * height * ((bpp == 15) || (bpp == 16) ? 2 : 4);
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_send_raw_bitmap(struct xrdp_session *session,
+                               int width, int height, int bpp, char *data,
+                               int cache_id, int cache_idx)
+{
+    add_order(T_RAW, width, height, bpp, cache_id, cache_idx, 0,
+              hash_bytes(data, raw_bytes(width, height, bpp)));
+    add_sent(raw_bytes(width, height, bpp));
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_send_bitmap(struct xrdp_session *session,
+                           int width, int height, int bpp, char *data,
+                           int cache_id, int cache_idx)
+{
+    add_order(T_BITMAP, width, height, bpp, cache_id, cache_idx, 0,
+              hash_bytes(data, raw_bytes(width, height, bpp)));
+    /* not compressed here, any size less than raw will do */
+    add_sent(raw_bytes(width, height, bpp) / 2);
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_send_raw_bitmap2(struct xrdp_session *session,
+                                int width, int height, int bpp, char *data,
+                                int cache_id, int cache_idx)
+{
+    add_order(T_RAW2, width, height, bpp, cache_id, cache_idx, 0,
+              hash_bytes(data, raw_bytes(width, height, bpp)));
+    add_sent(raw_bytes(width, height, bpp));
+    return 0;
+}
+
+/*****************************************************************************/
+/* compresses here as xrdp_orders_send_bitmap2 does, so it costs the same
+   and records the same as libxrdp_orders_send_bitmap2_comp */
+int DEFAULT_CC
+libxrdp_orders_send_bitmap2(struct xrdp_session *session,
+                            int width, int height, int bpp, char *data,
+                            int cache_id, int cache_idx, int hints)
+{
+    int bytes;
+
+    if (t_compress(width, height, bpp, data, g_s, g_temp_s) != 0)
+    {
+        return 1;
+    }
+    bytes = (int) (g_s->end - g_s->data);
+    add_order(T_BITMAP2, width, height, bpp, cache_id, cache_idx, bytes,
+              hash_bytes(g_s->data, bytes));
+    add_sent(bytes);
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_compress_bitmap2(int width, int height, int bpp, char *data,
+                                struct stream *s, struct stream *temp_s)
+{
+    return t_compress(width, height, bpp, data, s, temp_s);
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_send_bitmap2_comp(struct xrdp_session *session,
+                                 int width, int height, int bpp,
+                                 char *comp_data, int comp_bytes,
+                                 int cache_id, int cache_idx)
+{
+    add_order(T_BITMAP2, width, height, bpp, cache_id, cache_idx, comp_bytes,
+              hash_bytes(comp_data, comp_bytes));
+    add_sent(comp_bytes);
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_send_bitmap3(struct xrdp_session *session,
+                            int width, int height, int bpp, char *data,
+                            int cache_id, int cache_idx, int hints)
+{
+    add_order(T_BITMAP3, width, height, bpp, cache_id, cache_idx, hints,
+              hash_bytes(data, raw_bytes(width, height, bpp)));
+    add_sent(raw_bytes(width, height, bpp) / 8);
+    return 0;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_last_size(struct xrdp_session *session)
+{
+    return g_last_size;
+}
+
+/*****************************************************************************/
+int DEFAULT_CC
+libxrdp_orders_mem_blt(struct xrdp_session *session, int cache_id,
+                       int color_table, int x, int y, int cx, int cy,
+                       int rop, int srcx, int srcy,
+                       int cache_idx, struct xrdp_rect *rect)
+{
+    struct t_order *order;
+
+    if ((g_record == 0) || (g_num_orders >= T_MAX_ORDERS))
+    {
+        return 0;
+    }
+    order = g_orders + g_num_orders;
+    g_memset(order, 0, sizeof(struct t_order));
+    order->kind = T_MEMBLT;
+    order->v[0] = x;
+    order->v[1] = y;
+    order->v[2] = cx;
+    order->v[3] = cy;
+    order->v[4] = rop;
+    order->v[5] = srcx;
+    order->v[6] = srcy;
+    order->v[7] = rect->left;
+    order->v[8] = rect->top;
+    order->v[9] = rect->right;
+    order->v[10] = rect->bottom;
+    if (g_record == 1)
+    {
+        order->v[11] = cache_id;
+        order->hash = cache_idx;
+    }
+    g_num_orders++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* the painter and cache call these on paths this test does not take */
+int DEFAULT_CC
+libxrdp_orders_init(struct xrdp_session *session)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_send(struct xrdp_session *session)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_rect(struct xrdp_session *session, int x, int y,
+                    int cx, int cy, int color, struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_screen_blt(struct xrdp_session *session, int x, int y,
+                          int cx, int cy, int srcx, int srcy,
+                          int rop, struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_pat_blt(struct xrdp_session *session, int x, int y,
+                       int cx, int cy, int rop, int bg_color,
+                       int fg_color, struct xrdp_brush *brush,
+                       struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_dest_blt(struct xrdp_session *session, int x, int y,
+                        int cx, int cy, int rop,
+                        struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_line(struct xrdp_session *session, int mix_mode,
+                    int startx, int starty,
+                    int endx, int endy, int rop, int bg_color,
+                    struct xrdp_pen *pen,
+                    struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_composite_blt(struct xrdp_session *session, int srcidx,
+                             int srcformat, int srcwidth, int srcrepeat,
+                             int *srctransform, int mskflags,
+                             int mskidx, int mskformat, int mskwidth,
+                             int mskrepeat, int op, int srcx, int srcy,
+                             int mskx, int msky, int dstx, int dsty,
+                             int width, int height, int dstformat,
+                             struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_text(struct xrdp_session *session,
+                    int font, int flags, int mixmode,
+                    int fg_color, int bg_color,
+                    int clip_left, int clip_top,
+                    int clip_right, int clip_bottom,
+                    int box_left, int box_top,
+                    int box_right, int box_bottom,
+                    int x, int y, char *data, int data_len,
+                    struct xrdp_rect *rect)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_send_palette(struct xrdp_session *session, int *palette,
+                            int cache_id)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_send_font(struct xrdp_session *session,
+                         struct xrdp_font_char *font_char,
+                         int font_index, int char_index)
+{
+    g_fonts++;
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_send_brush(struct xrdp_session *session,
+                          int width, int height, int bpp, int type,
+                          int size, char *data, int cache_id)
+{
+    g_brushes++;
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_send_create_os_surface(struct xrdp_session *session, int id,
+                                      int width, int height,
+                                      struct list *del_list)
+{
+    return 0;
+}
+
+int DEFAULT_CC
+libxrdp_orders_send_switch_os_surface(struct xrdp_session *session, int id)
+{
+    return 0;
+}
+
+int APP_CC
+xrdp_wm_get_vis_region(struct xrdp_wm *self, struct xrdp_bitmap *bitmap,
+                       int x, int y, int cx, int cy,
+                       struct xrdp_region *region, int clip_children)
+{
+    return 0;
+}
+
+int APP_CC
+xrdp_wm_set_pointer(struct xrdp_wm *self, int cache_idx)
+{
+    g_pointer_sets++;
+    return 0;
+}
+
+int APP_CC
+xrdp_wm_send_pointer(struct xrdp_wm *self, int cache_idx,
+                     char *data, char *mask, int x, int y, int bpp)
+{
+    g_pointers++;
+    return 0;
+}
+
+int APP_CC
+xrdp_font_item_compare(struct xrdp_font_char *font1,
+                       struct xrdp_font_char *font2)
+{
+    int datasize;
+
+    if ((font1->data == 0) || (font2->data == 0) ||
+        (font1->offset != font2->offset) ||
+        (font1->baseline != font2->baseline) ||
+        (font1->width != font2->width) || (font1->height != font2->height))
+    {
+        return 0;
+    }
+    datasize = FONT_DATASIZE(font1);
+    return g_memcmp(font1->data, font2->data, datasize) == 0;
+}
+
+twchar APP_CC
+get_char_from_scan_code(int device_flags, int scan_code, int *keys,
+                        int caps_lock, int num_lock, int scroll_lock,
+                        struct xrdp_keymap *keymap)
+{
+    return 0;
+}
+
+void *APP_CC
+ssl_md5_info_create(void)
+{
+    return 0;
+}
+
+void APP_CC
+ssl_md5_info_delete(void *md5_info)
+{
+}
+
+void APP_CC
+ssl_md5_transform(void *md5_info, char *data, int len)
+{
+}
+
+void APP_CC
+ssl_md5_complete(void *md5_info, char *data)
+{
+}
+
+/*****************************************************************************/
+static void
+set_pixel(struct xrdp_bitmap *b, int x, int y, int pixel)
+{
+    int r;
+    int g;
+    int bl;
+
+    if (b->bpp == 16)
+    {
+        SPLITCOLOR32(r, g, bl, pixel);
+        ((tui16 *) (b->data))[y * b->width + x] = COLOR16(r, g, bl);
+    }
+    else
+    {
+        ((tui32 *) (b->data))[y * b->width + x] = pixel;
+    }
+}
+
+/*****************************************************************************/
+/* kind 0 ui, a desktop with windows, 1 text, 2 photo */
+static void
+make_image(struct xrdp_bitmap *b, int kind)
+{
+    int x;
+    int y;
+    int p;
+    int wx;
+    int wy;
+
+    for (y = 0; y < b->height; y++)
+    {
+        for (x = 0; x < b->width; x++)
+        {
+            switch (kind)
+            {
+                case 0:
+                    p = 0x3a6ea5;
+                    wx = x % 640;
+                    wy = y % 400;
+                    if ((wx > 40) && (wx < 600) && (wy > 30) && (wy < 370))
+                    {
+                        p = wy < 52 ? 0x000080 : 0xf0f0f0;
+                        if ((wy > 330) && (wy < 355) && (wx > 480) &&
+                            (wx < 580))
+                        {
+                            p = (wx == 481) || (wy == 331) ? 0xffffff :
+                                0xc0c0c0;
+                        }
+                    }
+                    break;
+                case 1:
+                    p = (((rnd() % 6) == 0) && ((y % 14) < 10) &&
+                         ((x % 300) < 280)) ? 0x000000 : 0xffffff;
+                    break;
+                default:
+                    p = ((((x * 255) / b->width) + rnd() % 40) & 0xff) << 16;
+                    p |= ((((y * 255) / b->height) + rnd() % 40) & 0xff) << 8;
+                    p |= (x + y + rnd() % 40) & 0xff;
+                    break;
+            }
+            set_pixel(b, x, y, p);
+        }
+    }
+}
+
+/*****************************************************************************/
+static struct xrdp_wm *
+wm_create(int threads)
+{
+    struct xrdp_wm *wm;
+    struct xrdp_client_info client_info;
+
+    wm = (struct xrdp_wm *) g_malloc(sizeof(struct xrdp_wm), 1);
+    wm->session = (struct xrdp_session *)
+                  g_malloc(sizeof(struct xrdp_session), 1);
+    g_memset(&client_info, 0, sizeof(client_info));
+    wm->cache = xrdp_cache_create(wm, wm->session, &client_info);
+    wm->workers = threads > 0 ? xrdp_workers_create(threads) : 0;
+    wm->tiles = (struct xrdp_tile *)
+                g_malloc(sizeof(struct xrdp_tile) * XRDP_TILE_BATCH, 1);
+    wm->painter = xrdp_painter_create(wm, wm->session);
+    return wm;
+}
+
+/*****************************************************************************/
+static void
+wm_delete(struct xrdp_wm *wm)
+{
+    int index;
+
+    xrdp_painter_delete(wm->painter);
+    xrdp_workers_delete(wm->workers);
+    for (index = 0; index < XRDP_TILE_BATCH; index++)
+    {
+        free_stream(wm->tiles[index].s);
+        free_stream(wm->tiles[index].temp_s);
+    }
+    g_free(wm->tiles);
+    /* the log is not started here, nothing to report the counts to */
+    wm->cache->bitmap_hits = 0;
+    wm->cache->bitmap_misses = 0;
+    xrdp_cache_delete(wm->cache);
+    g_free(wm->session);
+    g_free(wm);
+}
+
+/*****************************************************************************/
+/* a fresh client side cache for setup */
+static void
+wm_reset(struct xrdp_wm *wm, int bpp, const struct t_setup *setup)
+{
+    struct xrdp_client_info client_info;
+    int Bpp;
+
+    Bpp = (bpp + 7) / 8;
+    g_memset(&client_info, 0, sizeof(client_info));
+    client_info.bpp = bpp;
+    client_info.use_bitmap_comp = setup->comp;
+    client_info.bitmap_cache_version = setup->version;
+    client_info.cache1_entries = setup->entries;
+    client_info.cache1_size = 256 * Bpp;
+    client_info.cache2_entries = setup->entries;
+    client_info.cache2_size = 1024 * Bpp;
+    client_info.cache3_entries = setup->entries;
+    client_info.cache3_size = 4096 * Bpp;
+    /* no client has bpp 0, so nothing is kept */
+    wm->cache->bpp = 0;
+    xrdp_cache_reset(wm->cache, &client_info);
+    xrdp_painter_clr_clip(wm->painter);
+}
+
+/*****************************************************************************/
+/* the copies every run makes, src[0] ui, src[1] text, src[2] photo */
+static void
+copy_run(struct xrdp_wm *wm, struct xrdp_bitmap *dst,
+         struct xrdp_bitmap **src, int old)
+{
+    static const int copies[][7] =
+    {
+        /* src, x, y, cx, cy, srcx, srcy */
+        { 0, 0, 0, T_WIDTH, T_HEIGHT, 0, 0 },
+        { 0, 0, 0, T_WIDTH, T_HEIGHT, 0, 0 },
+        { 2, 100, 50, 700, 333, 37, 11 },
+        { 1, 0, 0, T_WIDTH, T_HEIGHT, 0, 0 },
+        { 0, 0, 0, T_WIDTH, 580, 0, 500 },
+        { 2, 1, 1, 63, 64, 1, 1 }
+    };
+    const int *c;
+    int index;
+
+    for (index = 0; index < 6; index++)
+    {
+        c = copies[index];
+        if (old)
+        {
+            old_painter_copy(wm->painter, src[c[0]], dst, c[1], c[2], c[3],
+                             c[4], c[5], c[6]);
+        }
+        else
+        {
+            xrdp_painter_copy(wm->painter, src[c[0]], dst, c[1], c[2], c[3],
+                              c[4], c[5], c[6]);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* starts an update, nested in another so only the outer one is a frame */
+static void
+counts_begin(struct xrdp_wm *wm, struct t_counts *counts)
+{
+    counts->sent = g_sent_bytes;
+    counts->bytes = wm->cache->bitmap_bytes;
+    counts->codec_bytes = wm->cache->bitmap_codec_bytes;
+    counts->raw_bytes = wm->cache->bitmap_raw_bytes;
+    counts->frames = wm->cache->bitmap_frames;
+    xrdp_cache_begin_update(wm->cache);
+    xrdp_cache_begin_update(wm->cache);
+}
+
+/*****************************************************************************/
+/* ends the update, the cache must have counted every byte the stubs were
+   given in it, codec is what of that went through the codec, raw is set
+   when all of it went uncompressed, returns errors */
+static int
+counts_end(struct xrdp_wm *wm, const char *name,
+           const struct t_counts *counts, double codec, int raw)
+{
+    struct xrdp_cache *cache;
+    double sent;
+    double bytes;
+    int frames;
+
+    cache = wm->cache;
+    xrdp_cache_end_update(cache);
+    frames = cache->bitmap_frames - counts->frames;
+    if (frames != 0)
+    {
+        printf("%s: a frame ended in a nested update\n", name);
+        return 1;
+    }
+    xrdp_cache_end_update(cache);
+    sent = g_sent_bytes - counts->sent;
+    bytes = cache->bitmap_bytes - counts->bytes;
+    frames = cache->bitmap_frames - counts->frames;
+    if ((bytes != sent) ||
+        (cache->bitmap_codec_bytes - counts->codec_bytes != codec) ||
+        (cache->bitmap_raw_bytes - counts->raw_bytes != (raw ? sent : 0)))
+    {
+        printf("%s: %.0f bytes sent, %.0f counted, %.0f codec %.0f "
+               "uncompressed\n", name, sent, bytes,
+               cache->bitmap_codec_bytes - counts->codec_bytes,
+               cache->bitmap_raw_bytes - counts->raw_bytes);
+        return 1;
+    }
+    if ((frames != (sent > 0 ? 1 : 0)) ||
+        ((sent > 0) && (cache->bitmap_frame_max < sent)))
+    {
+        printf("%s: %d frames for %.0f bytes, %d at most\n", name, frames,
+               sent, cache->bitmap_frame_max);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns errors */
+static int
+check(struct xrdp_wm *wm, int bpp, const struct t_setup *setup,
+      struct xrdp_bitmap **src, int clip)
+{
+    static struct t_order old_orders[T_MAX_ORDERS];
+    struct xrdp_bitmap *dst;
+    struct t_counts counts;
+    char name[64];
+    int old_num_orders;
+    int misses;
+    int old_sent;
+    int sent;
+    int index;
+
+    dst = xrdp_bitmap_create(T_WIDTH, T_HEIGHT, bpp, WND_TYPE_OFFSCREEN, wm);
+    g_record = clip ? 2 : 1;
+    wm_reset(wm, bpp, setup);
+    if (clip)
+    {
+        xrdp_painter_set_clip(wm->painter, 200, 150, 500, 400);
+    }
+    g_num_orders = 0;
+    misses = wm->cache->bitmap_misses;
+    copy_run(wm, dst, src, 1);
+    old_num_orders = g_num_orders;
+    g_memcpy(old_orders, g_orders, sizeof(struct t_order) * g_num_orders);
+    old_sent = wm->cache->bitmap_misses - misses;
+
+    wm_reset(wm, bpp, setup);
+    if (clip)
+    {
+        xrdp_painter_set_clip(wm->painter, 200, 150, 500, 400);
+    }
+    g_num_orders = 0;
+    misses = wm->cache->bitmap_misses;
+    counts_begin(wm, &counts);
+    copy_run(wm, dst, src, 0);
+    g_snprintf(name, sizeof(name), "%2d bpp %-12s %s", bpp, setup->name,
+               clip ? "clipped" : "");
+    if (counts_end(wm, name, &counts, 0, !setup->comp) != 0)
+    {
+        xrdp_bitmap_delete(dst);
+        g_record = 0;
+        return 1;
+    }
+    sent = wm->cache->bitmap_misses - misses;
+    xrdp_bitmap_delete(dst);
+    g_record = 0;
+
+    if (g_num_orders != old_num_orders)
+    {
+        printf("%2d bpp %-12s %s: %d orders, %d before\n", bpp, setup->name,
+               clip ? "clipped" : "", g_num_orders, old_num_orders);
+        return 1;
+    }
+    for (index = 0; index < g_num_orders; index++)
+    {
+        if (g_memcmp(g_orders + index, old_orders + index,
+                     sizeof(struct t_order)) != 0)
+        {
+            printf("%2d bpp %-12s %s: order %d of %d differs\n", bpp,
+                   setup->name, clip ? "clipped" : "", index, g_num_orders);
+            return 1;
+        }
+    }
+    if (clip && (sent >= old_sent))
+    {
+        printf("%2d bpp %-12s clipped: %d tiles sent, %d before\n", bpp,
+               setup->name, sent, old_sent);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* bitmap cache v3, ui and text tiles must go lossless as bitmap2, photo
+   tiles through the codec, which only looks at 24 and 32 bpp, returns
+   errors */
+static int
+check_codec(struct xrdp_wm *wm, int bpp, struct xrdp_bitmap **src)
+{
+    static const char *kinds[] = { "ui", "text", "photo" };
+    static const struct t_setup setup = { "v3", 2 | 4, 1, 600 };
+    struct xrdp_bitmap *dst;
+    struct t_counts counts;
+    char name[64];
+    double codec_bytes;
+    int kind;
+    int index;
+    int lossless;
+    int codec;
+    int codec_counted;
+    int want_codec;
+    int errors;
+
+    errors = 0;
+    dst = xrdp_bitmap_create(T_WIDTH, T_HEIGHT, bpp, WND_TYPE_OFFSCREEN, wm);
+    for (kind = 0; kind < 3; kind++)
+    {
+        wm_reset(wm, bpp, &setup);
+        g_record = 1;
+        g_num_orders = 0;
+        codec_counted = wm->cache->bitmap_codec;
+        counts_begin(wm, &counts);
+        xrdp_painter_copy(wm->painter, src[kind], dst, 0, 0, T_WIDTH,
+                          T_HEIGHT, 0, 0);
+        codec_counted = wm->cache->bitmap_codec - codec_counted;
+        g_record = 0;
+        lossless = 0;
+        codec = 0;
+        codec_bytes = 0;
+        for (index = 0; index < g_num_orders; index++)
+        {
+            lossless += g_orders[index].kind == T_BITMAP2;
+            if (g_orders[index].kind == T_BITMAP3)
+            {
+                codec++;
+                /* as the stub makes it */
+                codec_bytes += raw_bytes(g_orders[index].v[0],
+                                         g_orders[index].v[1], bpp) / 8;
+            }
+        }
+        g_snprintf(name, sizeof(name), "%2d bpp %-5s", bpp, kinds[kind]);
+        errors += counts_end(wm, name, &counts, codec_bytes, 0);
+        want_codec = (kind == 2) && (bpp > 16);
+        printf("%2d bpp %-5s %3d lossless %3d codec tiles\n", bpp,
+               kinds[kind], lossless, codec);
+        if ((lossless + codec == 0) || (codec != codec_counted) ||
+            (want_codec ? lossless : codec) != 0)
+        {
+            printf("%2d bpp %-5s tiles took the wrong path\n", bpp,
+                   kinds[kind]);
+            errors++;
+        }
+    }
+    xrdp_bitmap_delete(dst);
+    return errors;
+}
+
+/*****************************************************************************/
+/* ms a frame of T_FRAMES copies of the whole of src, with a pixel of every
+   tile changed each frame when change is set */
+static int
+bench_copy(struct xrdp_wm *wm, struct xrdp_bitmap *dst,
+           struct xrdp_bitmap *src, int old, int change)
+{
+    int frame;
+    int x;
+    int y;
+    int start;
+
+    start = g_time3();
+    for (frame = 0; frame < T_FRAMES; frame++)
+    {
+        if (change)
+        {
+            for (y = 0; y < src->height; y += 63)
+            {
+                for (x = 0; x < src->width; x += 64)
+                {
+                    set_pixel(src, x, y, frame);
+                }
+            }
+        }
+        if (old)
+        {
+            old_painter_copy(wm->painter, src, dst, 0, 0, src->width,
+                             src->height, 0, 0);
+        }
+        else
+        {
+            xrdp_painter_copy(wm->painter, src, dst, 0, 0, src->width,
+                              src->height, 0, 0);
+        }
+    }
+    return (g_time3() - start) / T_FRAMES;
+}
+
+/*****************************************************************************/
+static void
+bench(struct xrdp_wm *serial_wm, struct xrdp_wm *pool_wm)
+{
+    static const char *kinds[] = { "ui", "text", "photo" };
+    static const struct t_setup setup = { "v2 rle", 2, 1, 600 };
+    struct xrdp_bitmap *dst;
+    struct xrdp_bitmap *src;
+    int kind;
+    int change;
+    int ms_old;
+    int ms_serial;
+    int ms_pool;
+
+    printf("%d cpus, ms a %dx%d 24 bpp frame, bitmap cache v2 rle\n",
+           g_get_num_cpus(), T_WIDTH, T_HEIGHT);
+    dst = xrdp_bitmap_create(T_WIDTH, T_HEIGHT, 24, WND_TYPE_OFFSCREEN,
+                             serial_wm);
+    src = xrdp_bitmap_create(T_WIDTH, T_HEIGHT, 24, WND_TYPE_IMAGE,
+                             serial_wm);
+    for (kind = 0; kind < 3; kind++)
+    {
+        make_image(src, kind);
+        for (change = 1; change >= 0; change--)
+        {
+            wm_reset(serial_wm, 24, &setup);
+            ms_old = bench_copy(serial_wm, dst, src, 1, change);
+            wm_reset(serial_wm, 24, &setup);
+            ms_serial = bench_copy(serial_wm, dst, src, 0, change);
+            wm_reset(pool_wm, 24, &setup);
+            ms_pool = bench_copy(pool_wm, dst, src, 0, change);
+            printf("%-5s %-10s before %4d  now %4d  now with %d threads "
+                   "%4d\n", kinds[kind], change ? "all missed" : "all hit",
+                   ms_old, ms_serial, 3, ms_pool);
+        }
+    }
+    xrdp_bitmap_delete(src);
+    xrdp_bitmap_delete(dst);
+}
+
+/*****************************************************************************/
+/* what one reset sends again of a bitmap, glyph, pointer and brush the
+   client had before it, returns the mask of the ones sent, 1 bitmap,
+   2 glyph, 4 pointer, 8 brush */
+static int
+reset_sends(struct xrdp_wm *wm, struct xrdp_client_info *client_info,
+            struct xrdp_bitmap *image)
+{
+    struct xrdp_bitmap *b;
+    struct xrdp_font_char font;
+    struct xrdp_pointer_item pointer;
+    char glyph[8];
+    char brush[8];
+    int index;
+    int sent;
+
+    xrdp_cache_reset(wm->cache, client_info);
+    b = xrdp_bitmap_create(image->width, image->height, image->bpp,
+                           WND_TYPE_IMAGE, wm);
+    g_memcpy(b->data, image->data, image->width * image->height * 4);
+    g_memset(&font, 0, sizeof(font));
+    for (index = 0; index < 8; index++)
+    {
+        glyph[index] = index * 37;
+        brush[index] = index * 11 + 1;
+    }
+    font.width = 8;
+    font.height = 8;
+    font.data = glyph;
+    g_memset(&pointer, 0, sizeof(pointer));
+    pointer.x = 3;
+    pointer.y = 5;
+    pointer.bpp = 32;
+    pointer.data[100] = 1;
+    g_num_orders = 0;
+    g_fonts = 0;
+    g_pointers = 0;
+    g_brushes = 0;
+    g_record = 1;
+    xrdp_cache_add_bitmap(wm->cache, b, 0);
+    xrdp_cache_add_char(wm->cache, &font);
+    xrdp_cache_add_pointer(wm->cache, &pointer);
+    xrdp_cache_add_brush(wm->cache, brush);
+    g_record = 0;
+    sent = g_num_orders > 0 ? 1 : 0;
+    sent |= g_fonts > 0 ? 2 : 0;
+    sent |= g_pointers > 0 ? 4 : 0;
+    sent |= g_brushes > 0 ? 8 : 0;
+    return sent;
+}
+
+/*****************************************************************************/
+/* each change of client capability clears its cache and only that one,
+   off screen bitmaps and the surface drawn on are gone after any reset */
+static int
+check_reset(struct xrdp_wm *wm)
+{
+    static const struct
+    {
+        const char *name;
+        int bpp;
+        int entries;
+        int pointers;
+        int brush;
+        int glyph;
+        int want; /* sent again */
+    } steps[] =
+    {
+        { "first", 24, 600, 20, 1, 1, 15 },
+        { "nothing changed", 24, 600, 20, 1, 1, 0 },
+        { "bitmap cache", 24, 300, 20, 1, 1, 1 },
+        { "pointer cache", 24, 300, 10, 1, 1, 4 },
+        { "brush cache", 24, 300, 10, 0, 1, 8 },
+        { "glyph order", 24, 300, 10, 0, 0, 2 },
+        { "bpp", 32, 300, 10, 0, 0, 1 },
+        { "nothing changed", 32, 300, 10, 0, 0, 0 }
+    };
+    struct xrdp_client_info client_info;
+    struct xrdp_bitmap *image;
+    struct xrdp_bitmap *os;
+    struct xrdp_os_bitmap_item *bi;
+    int errors;
+    int index;
+    int sent;
+
+    errors = 0;
+    wm->screen = xrdp_bitmap_create(64, 64, 24, WND_TYPE_SCREEN, wm);
+    image = xrdp_bitmap_create(64, 64, 24, WND_TYPE_IMAGE, wm);
+    make_image(image, 2);
+    /* no client has bpp 0, the first step starts empty */
+    wm->cache->bpp = 0;
+    for (index = 0; index < 8; index++)
+    {
+        /* an off screen bitmap made on the client and being drawn on */
+        os = xrdp_bitmap_create(32, 32, 24, WND_TYPE_OFFSCREEN, wm);
+        os->item_index = 5;
+        os->id = 5;
+        os->tab_stop = 1;
+        xrdp_cache_add_os_bitmap(wm->cache, os, 5);
+        list_add_item(wm->cache->xrdp_os_del_list, 7);
+        wm->target_surface = os;
+        wm->current_surface_index = 5;
+
+        g_memset(&client_info, 0, sizeof(client_info));
+        client_info.bpp = steps[index].bpp;
+        client_info.use_bitmap_comp = 1;
+        client_info.bitmap_cache_version = 2;
+        client_info.cache1_entries = steps[index].entries;
+        client_info.cache1_size = 1024;
+        client_info.cache2_entries = steps[index].entries;
+        client_info.cache2_size = 4096;
+        client_info.cache3_entries = steps[index].entries;
+        client_info.cache3_size = 16384;
+        client_info.pointer_cache_entries = steps[index].pointers;
+        client_info.brush_cache_code = steps[index].brush;
+        client_info.orders[0x1b] = steps[index].glyph;
+        client_info.offscreen_support_level = 1;
+        client_info.offscreen_cache_entries = 100;
+        client_info.offscreen_cache_size = 7680 * 1024;
+        sent = reset_sends(wm, &client_info, image);
+        bi = xrdp_cache_get_os_bitmap(wm->cache, 5);
+        if ((sent != steps[index].want) || (bi->bitmap != 0) ||
+            (wm->cache->os_bytes != 0) ||
+            (wm->cache->xrdp_os_del_list->count != 0) ||
+            (wm->target_surface != wm->screen) ||
+            (wm->current_surface_index != 0xffff))
+        {
+            printf("reset, %s: sent again 0x%x want 0x%x, off screen %s, "
+                   "%d to delete, %s\n", steps[index].name, sent,
+                   steps[index].want, bi->bitmap != 0 ? "kept" : "gone",
+                   wm->cache->xrdp_os_del_list->count,
+                   wm->target_surface == wm->screen ? "on screen" :
+                   "on the old surface");
+            errors++;
+        }
+    }
+    wm->target_surface = 0;
+    xrdp_bitmap_delete(image);
+    xrdp_bitmap_delete(wm->screen);
+    wm->screen = 0;
+    printf("cache reset: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+/* a pointer as X11rdp sends it and xrdp_wm_pointer adds it, returns the
+   hash X11rdp sends for it after that */
+static int
+add_pointer(struct xrdp_wm *wm, int index, int bpp)
+{
+    struct xrdp_pointer_item pointer;
+    unsigned int hash;
+    int i;
+
+    g_memset(&pointer, 0, sizeof(pointer));
+    pointer.x = index;
+    pointer.y = 31 - index;
+    for (i = 0; i < POINTER_HASH_BYTES(bpp); i++)
+    {
+        pointer.data[i] = (char) (index * 13 + i);
+    }
+    for (i = 0; i < 32 * 32 / 8; i++)
+    {
+        pointer.mask[i] = (char) (index * 5 + i);
+    }
+    POINTER_HASH(hash, pointer.x, pointer.y, bpp, pointer.data, pointer.mask);
+    pointer.bpp = bpp == 0 ? 24 : bpp;
+    xrdp_cache_add_pointer(wm->cache, &pointer);
+    return (int) hash;
+}
+
+/*****************************************************************************/
+/* a pointer X11rdp sent before is found by its hash while it is in the
+   cache and set on the client, one that fell out is not */
+static int
+check_pointer_hash(struct xrdp_wm *wm)
+{
+    struct xrdp_client_info client_info;
+    int hashes[6];
+    int errors;
+    int index;
+    int got;
+
+    errors = 0;
+    g_memset(&client_info, 0, sizeof(client_info));
+    client_info.bpp = 24;
+    client_info.pointer_cache_entries = 6; /* 4 after the 2 fixed ones */
+    xrdp_cache_reset(wm->cache, &client_info);
+    for (index = 0; index < 4; index++)
+    {
+        hashes[index] = add_pointer(wm, index, index == 3 ? 32 : 0);
+    }
+    /* not up, the client is set to it */
+    g_pointer_sets = 0;
+    got = xrdp_cache_set_pointer_hash(wm->cache, hashes[1]);
+    if ((got < 2) || (wm->cache->pointer_items[got].x != 1) ||
+        (wm->cache->pointer_items[got].bpp != 24) ||
+        (wm->current_pointer != got) || (g_pointer_sets != 1))
+    {
+        printf("pointer by hash: not found or not set, index %d\n", got);
+        errors++;
+    }
+    /* up already, nothing sent */
+    if ((xrdp_cache_set_pointer_hash(wm->cache, hashes[1]) != got) ||
+        (g_pointer_sets != 1))
+    {
+        printf("pointer by hash: the one up sent again\n");
+        errors++;
+    }
+    if (xrdp_cache_set_pointer_hash(wm->cache, hashes[3]) < 2)
+    {
+        printf("pointer by hash: 32 bpp not found\n");
+        errors++;
+    }
+    /* 0 is the oldest and makes room for 4 */
+    hashes[4] = add_pointer(wm, 4, 32);
+    if ((xrdp_cache_set_pointer_hash(wm->cache, hashes[0]) != -1) ||
+        (wm->cache->pointer_hash_misses != 1) ||
+        (xrdp_cache_set_pointer_hash(wm->cache, hashes[4]) < 2) ||
+        (xrdp_cache_set_pointer_hash(wm->cache, hashes[2]) < 2))
+    {
+        printf("pointer by hash: the one that fell out found\n");
+        errors++;
+    }
+    /* one never sent */
+    hashes[5] = add_pointer(wm, 5, 24) + 1;
+    if (xrdp_cache_set_pointer_hash(wm->cache, hashes[5]) != -1)
+    {
+        printf("pointer by hash: a hash never sent found\n");
+        errors++;
+    }
+    printf("pointer by hash: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const int bpps[] = { 16, 24, 32 };
+    static const struct t_setup setups[] =
+    {
+        { "v1 raw", 1, 0, 600 },
+        { "v1 rle", 1, 1, 600 },
+        { "v2 raw", 2, 0, 600 },
+        { "v2 rle", 2, 1, 600 },
+        { "v2 rle small", 2, 1, 30 }
+    };
+    struct xrdp_wm *wms[2];
+    struct xrdp_bitmap *src[3];
+    int errors;
+    int runs;
+    int bpp;
+    int index;
+    int jndex;
+    int clip;
+
+    g_init("painter_test");
+    make_stream(g_s);
+    make_stream(g_temp_s);
+    wms[0] = wm_create(0);
+    wms[1] = wm_create(3);
+    errors = 0;
+    runs = 0;
+    for (index = 0; index < 3; index++)
+    {
+        bpp = bpps[index];
+        for (jndex = 0; jndex < 3; jndex++)
+        {
+            src[jndex] = xrdp_bitmap_create(T_WIDTH, T_HEIGHT, bpp,
+                                            WND_TYPE_IMAGE, wms[0]);
+            make_image(src[jndex], jndex);
+        }
+        for (jndex = 0; jndex < 5; jndex++)
+        {
+            for (clip = 0; clip < 2; clip++)
+            {
+                errors += check(wms[0], bpp, setups + jndex, src, clip);
+                errors += check(wms[1], bpp, setups + jndex, src, clip);
+                runs += 2;
+            }
+        }
+        errors += check_codec(wms[index % 2], bpp, src);
+        for (jndex = 0; jndex < 3; jndex++)
+        {
+            xrdp_bitmap_delete(src[jndex]);
+        }
+    }
+    printf("%d runs, %d differ from before or took the wrong path\n", runs,
+           errors);
+    errors += check_reset(wms[0]);
+    errors += check_pointer_hash(wms[0]);
+
+    bench(wms[0], wms[1]);
+
+    wm_delete(wms[0]);
+    wm_delete(wms[1]);
+    free_stream(g_s);
+    free_stream(g_temp_s);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,545 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of standard RDP security and FIPS on the way out
+ * two xrdp_secs are set up with the same keys, one sends with
+ * xrdp_sec_send and xrdp_sec_send_fastpath, the other with the sign then
+ * encrypt they replaced, the PDUs that reach the mcs and fastpath layers
+ * must be the same byte for byte, sizes run over the piece size and past
+ * the RC4 key update, then prints ns a PDU at each encryption level
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* the sign and encrypt calls are static, take the module in whole */
+#include "xrdp_sec.c"
+
+#define T_CHECK_PDUS 5000
+#define T_MAX_PDU 20000
+#define T_BENCH_BYTES (16 * 1024 * 1024)
+
+/* what reached the layer under xrdp_sec */
+static char g_sent[T_MAX_PDU + 64];
+static int g_sent_bytes = 0;
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+struct xrdp_mcs *APP_CC
+xrdp_mcs_create(struct xrdp_sec *owner, struct trans *trans,
+                struct stream *client_mcs_data,
+                struct stream *server_mcs_data)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_mcs_delete(struct xrdp_mcs *self)
+{
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_mcs_init(struct xrdp_mcs *self, struct stream *s)
+{
+    init_stream(s, 8192 * 4);
+    s_push_layer(s, iso_hdr, 7);
+    s_push_layer(s, mcs_hdr, 8);
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_mcs_send(struct xrdp_mcs *self, struct stream *s, int chan)
+{
+    g_sent_bytes = (int)(s->end - s->sec_hdr);
+    g_memcpy(g_sent, s->sec_hdr, g_sent_bytes);
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_mcs_recv(struct xrdp_mcs *self, struct stream *s, int *chan)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_mcs_incoming(struct xrdp_mcs *self)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_mcs_disconnect(struct xrdp_mcs *self)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_iso_incoming(struct xrdp_iso *self)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+struct xrdp_fastpath *APP_CC
+xrdp_fastpath_create(struct xrdp_sec *owner, struct trans *trans)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_fastpath_delete(struct xrdp_fastpath *self)
+{
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_fastpath_init(struct xrdp_fastpath *self, struct stream *s)
+{
+    init_stream(s, 32 * 1024);
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_fastpath_send(struct xrdp_fastpath *self, struct stream *s)
+{
+    g_sent_bytes = (int)(s->end - s->data);
+    g_memcpy(g_sent, s->data, g_sent_bytes);
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_fastpath_recv(struct xrdp_fastpath *self, struct stream *s)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+struct xrdp_channel *APP_CC
+xrdp_channel_create(struct xrdp_sec *owner, struct xrdp_mcs *mcs_layer)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_channel_delete(struct xrdp_channel *self)
+{
+}
+
+/*****************************************************************************/
+/* xrdp_sec_sign as it was, new contexts and the key hashed every PDU */
+static void APP_CC
+old_sec_sign(struct xrdp_sec *self, char *out, int out_len, char *data,
+             int data_len)
+{
+    char shasig[20];
+    char md5sig[16];
+    char lenhdr[4];
+    void *sha1_info;
+    void *md5_info;
+
+    buf_out_uint32(lenhdr, data_len);
+    sha1_info = ssl_sha1_info_create();
+    md5_info = ssl_md5_info_create();
+    ssl_sha1_clear(sha1_info);
+    ssl_sha1_transform(sha1_info, self->sign_key, self->rc4_key_len);
+    ssl_sha1_transform(sha1_info, (char *) g_pad_54, 40);
+    ssl_sha1_transform(sha1_info, lenhdr, 4);
+    ssl_sha1_transform(sha1_info, data, data_len);
+    ssl_sha1_complete(sha1_info, shasig);
+    ssl_md5_clear(md5_info);
+    ssl_md5_transform(md5_info, self->sign_key, self->rc4_key_len);
+    ssl_md5_transform(md5_info, (char *) g_pad_92, 48);
+    ssl_md5_transform(md5_info, shasig, 20);
+    ssl_md5_complete(md5_info, md5sig);
+    g_memcpy(out, md5sig, out_len);
+    ssl_sha1_info_delete(sha1_info);
+    ssl_md5_info_delete(md5_info);
+}
+
+/*****************************************************************************/
+/* xrdp_sec_encrypt as it was, a second pass over the data */
+static void APP_CC
+old_sec_encrypt(struct xrdp_sec *self, char *data, int len)
+{
+    if (self->encrypt_use_count == 4096)
+    {
+        xrdp_sec_update(self->encrypt_key, self->encrypt_update_key,
+                        self->rc4_key_len);
+        ssl_rc4_set_key(self->encrypt_rc4_info, self->encrypt_key,
+                        self->rc4_key_len);
+        self->encrypt_use_count = 0;
+    }
+    ssl_rc4_crypt(self->encrypt_rc4_info, data, len);
+    self->encrypt_use_count++;
+}
+
+/*****************************************************************************/
+/* xrdp_sec_fips_sign as it was, the HMAC keyed every PDU */
+static void APP_CC
+old_sec_fips_sign(struct xrdp_sec *self, char *out, int out_len, char *data,
+                  int data_len)
+{
+    char buf[20];
+    char lenhdr[4];
+
+    buf_out_uint32(lenhdr, self->encrypt_use_count);
+    ssl_hmac_sha1_init(self->sign_fips_info, self->fips_sign_key, 20);
+    ssl_hmac_transform(self->sign_fips_info, data, data_len);
+    ssl_hmac_transform(self->sign_fips_info, lenhdr, 4);
+    ssl_hmac_complete(self->sign_fips_info, buf, 20);
+    g_memcpy(out, buf, out_len);
+}
+
+/*****************************************************************************/
+/* xrdp_sec_fips_encrypt as it was */
+static void APP_CC
+old_sec_fips_encrypt(struct xrdp_sec *self, char *data, int len)
+{
+    ssl_des3_encrypt(self->encrypt_fips_info, len, data, data);
+    self->encrypt_use_count++;
+}
+
+/*****************************************************************************/
+/* the crypto part of xrdp_sec_send as it was */
+static int
+old_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
+{
+    int datalen;
+    int pad;
+
+    s_pop_layer(s, sec_hdr);
+    if (self->crypt_level == CRYPT_LEVEL_FIPS)
+    {
+        out_uint32_le(s, SEC_ENCRYPT);
+        datalen = (int) ((s->end - s->p) - 12);
+        out_uint16_le(s, 16);
+        out_uint8(s, 1);
+        pad = (8 - (datalen % 8)) & 7;
+        g_memset(s->end, 0, pad);
+        s->end += pad;
+        out_uint8(s, pad);
+        old_sec_fips_sign(self, s->p, 8, s->p + 8, datalen);
+        old_sec_fips_encrypt(self, s->p + 8, datalen + pad);
+    }
+    else if (self->crypt_level > CRYPT_LEVEL_LOW)
+    {
+        out_uint32_le(s, SEC_ENCRYPT);
+        datalen = (int) ((s->end - s->p) - 8);
+        old_sec_sign(self, s->p, 8, s->p + 8, datalen);
+        old_sec_encrypt(self, s->p + 8, datalen);
+    }
+    else
+    {
+        out_uint32_le(s, 0);
+    }
+    return xrdp_mcs_send(self->mcs_layer, s, chan);
+}
+
+/*****************************************************************************/
+/* the crypto part of xrdp_sec_send_fastpath as it was */
+static int
+old_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
+{
+    int datalen;
+    int pdulen;
+    int pad;
+    int error;
+    char save[8];
+
+    s_pop_layer(s, sec_hdr);
+    if (self->crypt_level == CRYPT_LEVEL_FIPS)
+    {
+        pdulen = (int) (s->end - s->p);
+        datalen = pdulen - 15;
+        pad = (8 - (datalen % 8)) & 7;
+        out_uint8(s, 0x2 << 6);
+        pdulen += pad;
+        pdulen |= 0x8000;
+        out_uint16_be(s, pdulen);
+        out_uint16_le(s, 16);
+        out_uint8(s, 1);
+        s->end += pad;
+        out_uint8(s, pad);
+        old_sec_fips_sign(self, s->p, 8, s->p + 8, datalen);
+        g_memcpy(save, s->p + 8 + datalen, pad);
+        g_memset(s->p + 8 + datalen, 0, pad);
+        old_sec_fips_encrypt(self, s->p + 8, datalen + pad);
+        error = xrdp_fastpath_send(self->fastpath_layer, s);
+        g_memcpy(s->p + 8 + datalen, save, pad);
+    }
+    else if (self->crypt_level > CRYPT_LEVEL_LOW)
+    {
+        pdulen = (int) (s->end - s->p);
+        datalen = pdulen - 11;
+        out_uint8(s, 0x2 << 6);
+        pdulen |= 0x8000;
+        out_uint16_be(s, pdulen);
+        old_sec_sign(self, s->p, 8, s->p + 8, datalen);
+        old_sec_encrypt(self, s->p + 8, datalen);
+        error = xrdp_fastpath_send(self->fastpath_layer, s);
+    }
+    else
+    {
+        pdulen = (int) (s->end - s->p);
+        out_uint8(s, 0);
+        pdulen |= 0x8000;
+        out_uint16_be(s, pdulen);
+        error = xrdp_fastpath_send(self->fastpath_layer, s);
+    }
+    return error;
+}
+
+/*****************************************************************************/
+/* an xrdp_sec at level with the keys from seed */
+static struct xrdp_sec *
+make_sec(int level, int method, int seed)
+{
+    struct xrdp_sec *self;
+    int index;
+
+    self = (struct xrdp_sec *) g_malloc(sizeof(struct xrdp_sec), 1);
+    self->crypt_level = level;
+    self->crypt_method = method;
+    srand(seed);
+    for (index = 0; index < 32; index++)
+    {
+        self->client_random[index] = rand();
+        self->server_random[index] = rand();
+    }
+    if (level == CRYPT_LEVEL_FIPS)
+    {
+        xrdp_sec_fips_establish_keys(self);
+    }
+    else if (level > CRYPT_LEVEL_LOW)
+    {
+        self->decrypt_rc4_info = ssl_rc4_info_create();
+        self->encrypt_rc4_info = ssl_rc4_info_create();
+        xrdp_sec_establish_keys(self);
+    }
+    return self;
+}
+
+/*****************************************************************************/
+/* one PDU of bytes through xrdp_sec_send, or the old send if old, slow
+   path or fast */
+static void
+send_pdu(struct xrdp_sec *self, struct stream *s, char *data, int bytes,
+         int fastpath, int old)
+{
+    if (fastpath)
+    {
+        xrdp_sec_init_fastpath(self, s);
+    }
+    else
+    {
+        xrdp_sec_init(self, s);
+    }
+    out_uint8a(s, data, bytes);
+    s_mark_end(s);
+    if (fastpath)
+    {
+        if (old)
+        {
+            old_sec_send_fastpath(self, s);
+        }
+        else
+        {
+            xrdp_sec_send_fastpath(self, s);
+        }
+    }
+    else
+    {
+        if (old)
+        {
+            old_sec_send(self, s, MCS_GLOBAL_CHANNEL);
+        }
+        else
+        {
+            xrdp_sec_send(self, s, MCS_GLOBAL_CHANNEL);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+check(struct stream *s)
+{
+    static const int levels[] =
+    {
+        CRYPT_LEVEL_CLIENT_COMPATIBLE, CRYPT_LEVEL_HIGH, CRYPT_LEVEL_FIPS
+    };
+    static const int methods[] =
+    {
+        CRYPT_METHOD_40BIT, CRYPT_METHOD_128BIT, CRYPT_METHOD_FIPS
+    };
+    static char data[T_MAX_PDU];
+    char old_sent[T_MAX_PDU + 64];
+    struct xrdp_sec *sec;
+    struct xrdp_sec *old_sec;
+    int old_bytes;
+    int errors;
+    int level;
+    int index;
+    int bytes;
+    int fastpath;
+
+    errors = 0;
+    for (level = 0; level < 3; level++)
+    {
+        sec = make_sec(levels[level], methods[level], level + 1);
+        old_sec = make_sec(levels[level], methods[level], level + 1);
+        for (index = 0; index < T_CHECK_PDUS; index++)
+        {
+            /* around the pieces, small ones, all sizes up to the most */
+            switch (index % 4)
+            {
+                case 0:
+                    bytes = XRDP_SEC_CRYPT_CHUNK * (1 + rand() % 3) +
+                            rand() % 17 - 8;
+                    break;
+                case 1:
+                    bytes = rand() % 64;
+                    break;
+                default:
+                    bytes = rand() % (16 * 1024);
+                    break;
+            }
+            for (fastpath = 0; fastpath < bytes; fastpath++)
+            {
+                data[fastpath] = rand();
+            }
+            fastpath = index & 1;
+            send_pdu(old_sec, s, data, bytes, fastpath, 1);
+            old_bytes = g_sent_bytes;
+            g_memcpy(old_sent, g_sent, old_bytes);
+            send_pdu(sec, s, data, bytes, fastpath, 0);
+            if ((old_bytes != g_sent_bytes) ||
+                (g_memcmp(old_sent, g_sent, old_bytes) != 0))
+            {
+                printf("level %d pdu %d, %d bytes%s: sent differs\n",
+                       levels[level], index, bytes,
+                       fastpath ? " fastpath" : "");
+                errors++;
+                break;
+            }
+        }
+        xrdp_sec_delete(sec);
+        xrdp_sec_delete(old_sec);
+    }
+    printf("sign and encrypt: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+static void
+bench(struct stream *s)
+{
+    static const char *names[] =
+    {
+        "low", "40 bit", "128 bit", "fips"
+    };
+    static const int levels[] =
+    {
+        CRYPT_LEVEL_LOW, CRYPT_LEVEL_CLIENT_COMPATIBLE, CRYPT_LEVEL_HIGH,
+        CRYPT_LEVEL_FIPS
+    };
+    static const int methods[] =
+    {
+        CRYPT_METHOD_NONE, CRYPT_METHOD_40BIT, CRYPT_METHOD_128BIT,
+        CRYPT_METHOD_FIPS
+    };
+    static const int sizes[] = { 64, 1400, 16000 };
+    static char data[T_MAX_PDU];
+    struct xrdp_sec *sec;
+    double start;
+    double took[2];
+    int level;
+    int size;
+    int old;
+    int pdus;
+    int index;
+
+    for (index = 0; index < T_MAX_PDU; index++)
+    {
+        data[index] = index * 7;
+    }
+    printf("fastpath PDUs, %d MB of each size\n",
+           T_BENCH_BYTES / (1024 * 1024));
+    for (level = 0; level < 4; level++)
+    {
+        for (size = 0; size < 3; size++)
+        {
+            pdus = T_BENCH_BYTES / sizes[size];
+            for (old = 0; old < 2; old++)
+            {
+                sec = make_sec(levels[level], methods[level], 1);
+                start = now_us();
+                for (index = 0; index < pdus; index++)
+                {
+                    send_pdu(sec, s, data, sizes[size], 1, old);
+                }
+                took[old] = now_us() - start;
+                xrdp_sec_delete(sec);
+            }
+            printf("%-8s %5d bytes  before %8.0f ns  now %8.0f ns a pdu  "
+                   "%7.1f MB/s\n", names[level], sizes[size],
+                   took[1] * 1000.0 / pdus, took[0] * 1000.0 / pdus,
+                   T_BENCH_BYTES / took[0]);
+        }
+    }
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct stream *s;
+    int errors;
+
+    g_init("sec_bench");
+    ssl_init();
+    make_stream(s);
+    errors = check(s);
+    bench(s);
+    free_stream(s);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of the cursor by hash, order 51 and 52
+ * this program plays the X server on one end of a unix socket pair and
+ * xrdp's pointer cache behind xup's callbacks, keyed by the same
+ * POINTER_HASH xrdp_cache.c uses, checks a cursor sent in full is found by
+ * its hash, a hash xrdp does not have is asked for with message 103 302,
+ * and a cached one is not, prints the bytes and time a cursor change takes
+ * sent in full and by hash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* the order handlers are static, take the module in whole */
+#include "xup.c"
+#include "pointer_hash.h"
+
+#define T_CURSORS 12
+#define T_SLOTS 8 /* like a client's 10 pointer cache entries, 2 fixed */
+#define T_CHANGES 200000
+
+int APP_CC
+trans_send_waiting(struct trans *self, int block);
+
+/* xrdp's pointer cache, LRU like xrdp_cache_add_pointer */
+static unsigned int g_hashes[T_SLOTS];
+static int g_stamps[T_SLOTS];
+static int g_stamp = 0;
+static int g_current = -1; /* slot the client has up */
+static int g_full = 0; /* set by order 51 */
+static int g_by_hash = 0; /* set by order 52 */
+static int g_x_sck = -1; /* the X server's end */
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* xrdp's side of order 51, xrdp_wm_pointer makes bpp 0 24 */
+static int DEFAULT_CC
+test_set_cursor_ex(struct mod *v, int x, int y, char *data, char *mask,
+                   int bpp)
+{
+    unsigned int hash;
+    int index;
+    int oldest;
+
+    if (bpp == 0)
+    {
+        bpp = 24;
+    }
+    POINTER_HASH(hash, x, y, bpp, data, mask);
+    g_stamp++;
+    oldest = 0;
+    for (index = 0; index < T_SLOTS; index++)
+    {
+        if (g_hashes[index] == hash)
+        {
+            oldest = index;
+            break;
+        }
+        if (g_stamps[index] < g_stamps[oldest])
+        {
+            oldest = index;
+        }
+    }
+    g_hashes[oldest] = hash;
+    g_stamps[oldest] = g_stamp;
+    g_current = oldest;
+    g_full++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* xrdp's side of order 52, returns 1 if it is not in the cache */
+static int DEFAULT_CC
+test_set_pointer_hash(struct mod *v, int hash)
+{
+    int index;
+
+    for (index = 0; index < T_SLOTS; index++)
+    {
+        if (g_hashes[index] == (unsigned int) hash)
+        {
+            g_stamp++;
+            g_stamps[index] = g_stamp;
+            g_current = index;
+            g_by_hash++;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+make_cursor(int index, char *data, char *mask, int bpp)
+{
+    int i;
+
+    for (i = 0; i < POINTER_HASH_BYTES(bpp); i++)
+    {
+        data[i] = (char) (index * 31 + i * 7);
+    }
+    for (i = 0; i < 32 * 32 / 8; i++)
+    {
+        mask[i] = (char) (index + i);
+    }
+}
+
+/*****************************************************************************/
+/* an order as rdpup_set_cursor_ex writes it, by hash if hash is not 0 */
+static void
+x_cursor_order(struct stream *s, int index, int bpp, unsigned int hash)
+{
+    char data[32 * (32 * 4)];
+    char mask[32 * (32 / 8)];
+
+    init_stream(s, 8192);
+    if (hash != 0)
+    {
+        out_uint32_le(s, hash);
+    }
+    else
+    {
+        make_cursor(index, data, mask, bpp);
+        out_uint16_le(s, index % 32);
+        out_uint16_le(s, 3);
+        out_uint16_le(s, bpp);
+        out_uint8a(s, data, POINTER_HASH_BYTES(bpp));
+        out_uint8a(s, mask, 32 * 32 / 8);
+    }
+    s_mark_end(s);
+    s->p = s->data;
+}
+
+/*****************************************************************************/
+/* hash of cursor index as the X server sends it */
+static unsigned int
+x_cursor_hash(int index, int bpp)
+{
+    char data[32 * (32 * 4)];
+    char mask[32 * (32 / 8)];
+    unsigned int hash;
+
+    make_cursor(index, data, mask, bpp);
+    POINTER_HASH(hash, index % 32, 3, bpp, data, mask);
+    return hash;
+}
+
+/*****************************************************************************/
+/* the hash xup asked the X server to send in full, 0 if none */
+static unsigned int
+x_read_request(struct mod *mod)
+{
+    char data[26];
+    int loops;
+    int type;
+    int msg;
+
+    for (loops = 0; loops < 100; loops++)
+    {
+        if (g_tcp_can_recv(g_x_sck, 0))
+        {
+            break;
+        }
+        trans_send_waiting(mod->trans, 0);
+    }
+    if (!g_tcp_can_recv(g_x_sck, 0) ||
+        (recv(g_x_sck, data, 26, MSG_WAITALL) != 26))
+    {
+        return 0;
+    }
+    type = (data[4] & 0xff) | ((data[5] & 0xff) << 8);
+    msg = (data[6] & 0xff) | ((data[7] & 0xff) << 8) |
+          ((data[8] & 0xff) << 16) | ((data[9] & 0xff) << 24);
+    if ((type != 103) || (msg != 302))
+    {
+        return 0;
+    }
+    return (data[10] & 0xff) | ((data[11] & 0xff) << 8) |
+           ((data[12] & 0xff) << 16) | ((unsigned int) (data[13] & 0xff) << 24);
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+check(struct mod *mod, struct stream *s)
+{
+    static const int bpps[] = { 0, 24, 32 };
+    unsigned int hash;
+    int errors;
+    int index;
+    int bpp;
+
+    errors = 0;
+    for (index = 0; index < 3; index++)
+    {
+        bpp = bpps[index];
+        /* sent in full then by hash, xrdp finds it, nothing comes back */
+        x_cursor_order(s, index, bpp, 0);
+        lib_mod_process_orders(mod, 51, s);
+        x_cursor_order(s, 20, 32, 0);
+        lib_mod_process_orders(mod, 51, s);
+        g_by_hash = 0;
+        hash = x_cursor_hash(index, bpp);
+        x_cursor_order(s, 0, 0, hash);
+        lib_mod_process_orders(mod, 52, s);
+        if ((g_by_hash != 1) || (g_hashes[g_current] != hash) ||
+            (x_read_request(mod) != 0))
+        {
+            printf("bpp %d: cursor sent before not found by hash\n", bpp);
+            errors++;
+        }
+    }
+    /* 0 and 24 are the same cursor to xrdp */
+    if (x_cursor_hash(1, 0) != x_cursor_hash(1, 24))
+    {
+        printf("bpp 0 and 24 hash apart\n");
+        errors++;
+    }
+    /* a hash xrdp does not have, the X server is asked for it */
+    hash = x_cursor_hash(99, 32);
+    x_cursor_order(s, 0, 0, hash);
+    lib_mod_process_orders(mod, 52, s);
+    if (x_read_request(mod) != hash)
+    {
+        printf("hash not in the cache not asked for\n");
+        errors++;
+    }
+    printf("cursor by hash: %s\n", errors == 0 ? "ok" : "FAILED");
+    return errors;
+}
+
+/*****************************************************************************/
+/* a cursor change out of T_CURSORS, full every time and by hash once sent */
+static void
+bench(struct mod *mod, struct stream *s)
+{
+    struct stream *orders[T_CURSORS];
+    struct stream *order;
+    unsigned int hashes[T_CURSORS];
+    double start;
+    double took[2];
+    double bytes[2];
+    int sent[T_CURSORS];
+    int change;
+    int index;
+    int pass;
+    int requests;
+
+    for (index = 0; index < T_CURSORS; index++)
+    {
+        make_stream(orders[index]);
+        x_cursor_order(orders[index], 100 + index, 32, 0);
+        hashes[index] = x_cursor_hash(100 + index, 32);
+    }
+    requests = 0;
+    for (pass = 0; pass < 2; pass++)
+    {
+        g_memset(sent, 0, sizeof(sent));
+        bytes[pass] = 0;
+        start = now_us();
+        for (change = 0; change < T_CHANGES; change++)
+        {
+            /* mostly a few cursors, now and then one of the rest */
+            index = (change * 7) % 3;
+            if ((change % 50) == 0)
+            {
+                index = (change / 50) % T_CURSORS;
+            }
+            if ((pass == 1) && sent[index])
+            {
+                x_cursor_order(s, 0, 0, hashes[index]);
+                bytes[pass] += 4 + 4;
+                lib_mod_process_orders(mod, 52, s);
+                if (!g_tcp_can_recv(g_x_sck, 0))
+                {
+                    continue;
+                }
+                /* evicted, rdpup sends it in full on message 302 */
+                x_read_request(mod);
+                requests++;
+                bytes[pass] += 26;
+            }
+            order = orders[index];
+            order->p = order->data;
+            bytes[pass] += (int) (order->end - order->data) + 4;
+            lib_mod_process_orders(mod, 51, order);
+            sent[index] = 1;
+        }
+        took[pass] = now_us() - start;
+    }
+    printf("%d cursor changes out of %d, %d cached\n", T_CHANGES, T_CURSORS,
+           T_SLOTS);
+    printf("full    %8.0f bytes a change %6.3f us a change\n",
+           bytes[0] / T_CHANGES, took[0] / T_CHANGES);
+    printf("by hash %8.0f bytes a change %6.3f us a change, %d asked for "
+           "again\n", bytes[1] / T_CHANGES, took[1] / T_CHANGES, requests);
+    for (index = 0; index < T_CURSORS; index++)
+    {
+        free_stream(orders[index]);
+    }
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct mod *mod;
+    struct stream *s;
+    int sv[2];
+    int errors;
+
+    g_init("cursor_test");
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        printf("socketpair failed\n");
+        return 1;
+    }
+    g_x_sck = sv[1];
+    mod = mod_init();
+    mod->server_set_cursor_ex = test_set_cursor_ex;
+    mod->server_set_pointer_hash = test_set_pointer_hash;
+    /* what lib_mod_connect leaves */
+    mod->trans = trans_create(TRANS_MODE_UNIX, 8 * 8192, 8192);
+    mod->trans->sck = sv[0];
+    mod->trans->status = TRANS_STATUS_UP;
+    make_stream(s);
+    errors = check(mod, s);
+    bench(mod, s);
+    free_stream(s);
+    mod_exit(mod);
+    close(sv[1]);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * input latency client for xup's events to the X server
+ * bursts of pointer and key events, what xrdp passes on in one wakeup, go
+ * through lib_mod_event and lib_mod_input_flush, this program reads them
+ * on the X server's end of a unix socket pair as rdpup_process_msg does,
+ * prints the time from the first event of a burst going in to the last
+ * one read and the messages a burst takes, one message 103 an event and
+ * batched in message 110, checks every event arrives once, in order
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* the event functions are static, take the module in whole */
+#include "xup.c"
+
+#define T_BURSTS 5000
+
+int APP_CC
+trans_send_waiting(struct trans *self, int block);
+
+static int g_x_sck = -1; /* the X server's end */
+static int g_errors = 0;
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* event index of a burst, a pointer move, button or key */
+static void
+make_event(int index, int *msg, int *param1, int *param2)
+{
+    switch (index % 4)
+    {
+        case 0:
+            *msg = 100; /* move */
+            *param1 = index % 1000;
+            *param2 = index % 700;
+            break;
+        case 1:
+            *msg = 102; /* left down */
+            *param1 = index % 1000;
+            *param2 = index % 700;
+            break;
+        case 2:
+            *msg = 101; /* left up */
+            *param1 = index % 1000;
+            *param2 = index % 700;
+            break;
+        default:
+            *msg = 15; /* key down */
+            *param1 = 'a';
+            *param2 = 'a';
+            break;
+    }
+}
+
+/*****************************************************************************/
+/* xup's trans holds what the socket would not take, xrdp's wait loop
+   sends it when it can, returns error */
+static int
+x_wait_msg(struct mod *mod)
+{
+    int loops;
+
+    for (loops = 0; loops < 1000; loops++)
+    {
+        if (g_tcp_can_recv(g_x_sck, 0))
+        {
+            return 0;
+        }
+        if (trans_send_waiting(mod->trans, 0) != 0)
+        {
+            return 1;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* reads one message, checks its events are the next ones,
+   returns the events in it or -1 */
+static int
+x_read_msg(struct mod *mod, struct stream *s, int first)
+{
+    int len;
+    int type;
+    int count;
+    int index;
+    int msg;
+    int param1;
+    int param2;
+    int want_msg;
+    int want_param1;
+    int want_param2;
+
+    if (x_wait_msg(mod) != 0)
+    {
+        return -1;
+    }
+    init_stream(s, 4);
+    if (recv(g_x_sck, s->data, 4, MSG_WAITALL) != 4)
+    {
+        return -1;
+    }
+    in_uint32_le(s, len);
+    if ((len < 6) || (len > s->size))
+    {
+        return -1;
+    }
+    init_stream(s, len);
+    if (recv(g_x_sck, s->data, len - 4, MSG_WAITALL) != len - 4)
+    {
+        return -1;
+    }
+    s->end = s->data + (len - 4);
+    in_uint16_le(s, type);
+    count = 1;
+    if (type == 110)
+    {
+        in_uint16_le(s, count);
+        if (!s_check_rem(s, count * 20))
+        {
+            return -1;
+        }
+    }
+    else if (type != 103)
+    {
+        return -1;
+    }
+    for (index = 0; index < count; index++)
+    {
+        in_uint32_le(s, msg);
+        in_uint32_le(s, param1);
+        in_uint32_le(s, param2);
+        in_uint8s(s, 8);
+        make_event(first + index, &want_msg, &want_param1, &want_param2);
+        if ((msg != want_msg) || (param1 != want_param1) ||
+            (param2 != want_param2))
+        {
+            if (g_errors < 10)
+            {
+                printf("event %d: got %d %d %d\n", first + index, msg,
+                       param1, param2);
+            }
+            g_errors++;
+        }
+    }
+    return count;
+}
+
+/*****************************************************************************/
+static void
+run_bursts(struct mod *mod, struct stream *s, const char *name, int size)
+{
+    double start;
+    double took;
+    double total;
+    double most;
+    int burst;
+    int index;
+    int msg;
+    int param1;
+    int param2;
+    int got;
+    int msgs;
+    int rv;
+
+    total = 0;
+    most = 0;
+    msgs = 0;
+    for (burst = 0; burst < T_BURSTS; burst++)
+    {
+        start = now_us();
+        for (index = 0; index < size; index++)
+        {
+            make_event(index, &msg, &param1, &param2);
+            lib_mod_event(mod, msg, param1, param2, 0, 0);
+        }
+        lib_mod_input_flush(mod);
+        got = 0;
+        while (got < size)
+        {
+            rv = x_read_msg(mod, s, got);
+            if (rv < 0)
+            {
+                printf("%s: bad message\n", name);
+                g_errors++;
+                return;
+            }
+            got += rv;
+            msgs++;
+        }
+        if (got != size)
+        {
+            printf("%s: %d events read, sent %d\n", name, got, size);
+            g_errors++;
+            return;
+        }
+        took = now_us() - start;
+        total += took;
+        most = MAX(most, took);
+    }
+    printf("%-4s %3d events a burst %6.2f us mean %7.1f us most "
+           "%5.1f messages\n", name, size, total / T_BURSTS, most,
+           (double) msgs / T_BURSTS);
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const int sizes[] = { 1, 3, 8, 32, 200 };
+    struct mod *mod;
+    struct stream *s;
+    int sv[2];
+    int index;
+
+    g_init("input_bench");
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        printf("socketpair failed\n");
+        return 1;
+    }
+    g_x_sck = sv[1];
+    mod = mod_init();
+    mod->trans = trans_create(TRANS_MODE_UNIX, 8 * 8192, 8192);
+    mod->trans->sck = sv[0];
+    mod->trans->status = TRANS_STATUS_UP;
+    make_stream(s);
+    init_stream(s, 8192);
+    printf("%d bursts each\n", T_BURSTS);
+    for (index = 0; index < 5; index++)
+    {
+        run_bursts(mod, s, "103", sizes[index]);
+    }
+    /* what cap type 2 from the X server sets up */
+    make_stream(mod->input_s);
+    init_stream(mod->input_s, 8 + 20 * XUP_INPUT_BATCH_MAX);
+    mod->input_s->p = mod->input_s->data + 8;
+    mod->input_batch = 1;
+    for (index = 0; index < 5; index++)
+    {
+        run_bursts(mod, s, "110", sizes[index]);
+    }
+    free_stream(s);
+    mod_exit(mod);
+    close(sv[1]);
+    g_deinit();
+    printf("%s\n", g_errors == 0 ? "ok" : "FAILED");
+    return g_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,427 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * check and benchmark of xup's screen frames from a memfd and from SysV shm
+ * this program plays the X server on one end of a unix socket pair, xup's
+ * trans is on the other, each frame is drawn into the shared screen, sent
+ * as order 61 and waited on for the message 106 ack, prints frames/s and
+ * the round trip for the SysV segment and the memfd passed with order 62,
+ * checks an fd that is not sealed or is smaller than it is said to be is
+ * not mapped and a frame that runs past the mapping is acked, not painted
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+/* the order handlers are static, take the module in whole */
+#include "xup.c"
+
+#if !defined(MFD_ALLOW_SEALING)
+#define MFD_ALLOW_SEALING 0x0002
+#endif
+#if !defined(F_ADD_SEALS)
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+#define T_WIDTH 1920
+#define T_HEIGHT 1080
+#define T_BPP 24 /* 4 bytes a pixel in the screen */
+#define T_FRAMES 2000
+#define T_BOX 256 /* drawn and painted each frame */
+
+static int g_x_sck = -1; /* the X server's end */
+static int g_painted = 0;
+static int g_paint_sum = 0;
+
+/*****************************************************************************/
+/* xrdp's side, reads the dirty box and acks at once */
+static int DEFAULT_CC
+bench_paint_rects(struct mod *v, int num_drects, short *drects,
+                  int num_crects, short *crects, char *data, int width,
+                  int height, int flags, int frame_id)
+{
+    int y;
+
+    for (y = 0; y < drects[3]; y++)
+    {
+        g_paint_sum += data[((drects[1] + y) * width + drects[0]) * 4];
+    }
+    g_painted++;
+    send_paint_rect_ex_ack(v, flags, frame_id);
+    return 0;
+}
+
+/*****************************************************************************/
+static int DEFAULT_CC
+bench_server_msg(struct mod *v, char *msg, int code)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static double
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+/*****************************************************************************/
+/* one order in a type 3 order list, fd is passed with it if not -1 */
+static int
+x_send_order(struct stream *s, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+    int len;
+
+    len = (int) (s->end - s->data);
+    g_memset(&msg, 0, sizeof(msg));
+    iov.iov_base = s->data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd != -1)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        g_memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(g_x_sck, &msg, 0) == len ? 0 : 1;
+}
+
+/*****************************************************************************/
+static void
+x_start_order(struct stream *s, int type)
+{
+    init_stream(s, 8192);
+    out_uint16_le(s, 3); /* order list with len after type */
+    out_uint16_le(s, 1);
+    out_uint32_le(s, 0);
+    out_uint16_le(s, type);
+    out_uint16_le(s, 0);
+}
+
+/*****************************************************************************/
+static void
+x_end_order(struct stream *s)
+{
+    int len;
+
+    s_mark_end(s);
+    len = (int) (s->end - s->data);
+    s->p = s->data + 4;
+    out_uint32_le(s, len - 8);
+    s->p = s->data + 10;
+    out_uint16_le(s, len - 8);
+}
+
+/*****************************************************************************/
+/* order 62, bytes is what the X server says the fd holds */
+static int
+x_send_memfd(struct stream *s, int fd, int bytes)
+{
+    x_start_order(s, 62);
+    out_uint32_le(s, bytes);
+    out_uint16_le(s, T_WIDTH);
+    out_uint16_le(s, T_HEIGHT);
+    x_end_order(s);
+    return x_send_order(s, fd);
+}
+
+/*****************************************************************************/
+/* order 61 for the whole screen with one dirty box at x, y */
+static int
+x_send_frame(struct stream *s, int frame_id, int shmem_id, int x, int y,
+             int height)
+{
+    x_start_order(s, 61);
+    out_uint16_le(s, 1);
+    out_uint16_le(s, x);
+    out_uint16_le(s, y);
+    out_uint16_le(s, T_BOX);
+    out_uint16_le(s, T_BOX);
+    out_uint16_le(s, 1);
+    out_uint16_le(s, x);
+    out_uint16_le(s, y);
+    out_uint16_le(s, T_BOX);
+    out_uint16_le(s, T_BOX);
+    out_uint32_le(s, 0); /* flags, screen */
+    out_uint32_le(s, frame_id);
+    out_uint32_le(s, shmem_id);
+    out_uint32_le(s, 0); /* offset */
+    out_uint16_le(s, T_WIDTH);
+    out_uint16_le(s, height);
+    x_end_order(s);
+    return x_send_order(s, -1);
+}
+
+/*****************************************************************************/
+/* xup reads until the X server's end has something, returns error */
+static int
+run_xup(struct mod *mod)
+{
+    int loops;
+
+    for (loops = 0; loops < 1000; loops++)
+    {
+        if (g_tcp_can_recv(g_x_sck, 0))
+        {
+            return 0;
+        }
+        if (trans_check_wait_objs(mod->trans) != 0)
+        {
+            return 1;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* waits for the ack of frame_id, returns error */
+static int
+x_read_ack(struct mod *mod, int frame_id)
+{
+    char data[14];
+    int len;
+    int type;
+    int id;
+
+    if (run_xup(mod) != 0)
+    {
+        return 1;
+    }
+    if (recv(g_x_sck, data, 14, MSG_WAITALL) != 14)
+    {
+        return 1;
+    }
+    len = (data[0] & 0xff) | ((data[1] & 0xff) << 8);
+    type = (data[4] & 0xff) | ((data[5] & 0xff) << 8);
+    id = (data[10] & 0xff) | ((data[11] & 0xff) << 8) |
+         ((data[12] & 0xff) << 16) | ((data[13] & 0xff) << 24);
+    return (len != 14) || (type != 106) || (id != frame_id);
+}
+
+/*****************************************************************************/
+/* frames with the box moving over pixels, returns error */
+static int
+x_run_frames(struct mod *mod, struct stream *s, const char *name,
+             char *pixels, int shmem_id)
+{
+    double start;
+    double total;
+    int frame;
+    int x;
+    int y;
+    int row;
+
+    g_painted = 0;
+    total = 0;
+    for (frame = 0; frame < T_FRAMES; frame++)
+    {
+        x = (frame * 37) % (T_WIDTH - T_BOX);
+        y = (frame * 19) % (T_HEIGHT - T_BOX);
+        start = now_us();
+        for (row = 0; row < T_BOX; row++)
+        {
+            g_memset(pixels + ((y + row) * T_WIDTH + x) * 4, frame,
+                     T_BOX * 4);
+        }
+        if ((x_send_frame(s, frame, shmem_id, x, y, T_HEIGHT) != 0) ||
+            (x_read_ack(mod, frame) != 0))
+        {
+            printf("%s: frame %d not acked\n", name, frame);
+            return 1;
+        }
+        total += now_us() - start;
+    }
+    printf("%-5s %8.0f frames/s %6.1f us a frame\n", name,
+           T_FRAMES * 1000000.0 / total, total / T_FRAMES);
+    if (g_painted != T_FRAMES)
+    {
+        printf("%s: %d of %d frames painted\n", name, g_painted, T_FRAMES);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns fd or -1 */
+static int
+x_make_memfd(int bytes, int seal)
+{
+    int fd;
+
+#if defined(SYS_memfd_create)
+    fd = syscall(SYS_memfd_create, "memfd_bench", MFD_ALLOW_SEALING);
+#else
+    fd = -1;
+#endif
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if ((ftruncate(fd, bytes) != 0) ||
+        (seal && (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct mod *mod;
+    struct stream *s;
+    char *pixels;
+    int sv[2];
+    int bytes;
+    int shmem_id;
+    int fd;
+    int errors;
+
+    g_init("memfd_bench");
+    errors = 0;
+    bytes = T_WIDTH * T_HEIGHT * 4;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        printf("socketpair failed\n");
+        return 1;
+    }
+    g_x_sck = sv[1];
+    mod = mod_init();
+    mod->bpp = T_BPP;
+    mod->server_paint_rects = bench_paint_rects;
+    mod->server_msg = bench_server_msg;
+    /* what lib_mod_connect and cap 3 leave */
+    mod->trans = trans_create(TRANS_MODE_UNIX, 8 * 8192, 8192);
+    mod->trans->sck = sv[0];
+    mod->trans->status = TRANS_STATUS_UP;
+    mod->trans->trans_data_in = lib_data_in;
+    mod->trans->header_size = 8;
+    mod->trans->callback_data = mod;
+    mod->trans->no_stream_init_on_data_in = 1;
+    mod->trans->extra_flags = 1;
+    mod->trans->trans_recv = lib_trans_recv_fd;
+    make_stream(s);
+    printf("%dx%d screen, %dx%d box drawn a frame, %d frames\n", T_WIDTH,
+           T_HEIGHT, T_BOX, T_BOX, T_FRAMES);
+
+    /* before, a SysV segment */
+    shmem_id = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0600);
+    pixels = (char *) shmat(shmem_id, 0, 0);
+    if ((shmem_id == -1) || (pixels == (char *) -1))
+    {
+        printf("shm: no segment\n");
+        errors++;
+    }
+    else
+    {
+        errors += x_run_frames(mod, s, "shm", pixels, shmem_id);
+        shmdt(pixels);
+        shmctl(shmem_id, IPC_RMID, 0);
+    }
+    g_shmdt(mod->screen_shmem_pixels);
+    mod->screen_shmem_pixels = 0;
+    mod->screen_shmem_id_mapped = 0;
+
+    /* not sealed, or smaller than said, is not mapped */
+    fd = x_make_memfd(bytes, 0);
+    if ((fd == -1) || (x_send_memfd(s, fd, bytes) != 0) ||
+        (x_send_frame(s, 1, -1, 0, 0, T_HEIGHT) != 0) ||
+        (x_read_ack(mod, 1) != 0) || (mod->screen_memfd_pixels != 0))
+    {
+        printf("memfd: an fd that is not sealed was taken\n");
+        errors++;
+    }
+    close(fd);
+    fd = x_make_memfd(bytes / 2, 1);
+    if ((fd == -1) || (x_send_memfd(s, fd, bytes) != 0) ||
+        (x_send_frame(s, 2, -1, 0, 0, T_HEIGHT) != 0) ||
+        (x_read_ack(mod, 2) != 0) || (mod->screen_memfd_pixels != 0))
+    {
+        printf("memfd: an fd smaller than said was taken\n");
+        errors++;
+    }
+    close(fd);
+
+    /* now, a sealed memfd passed once */
+    fd = x_make_memfd(bytes, 1);
+    pixels = fd == -1 ? MAP_FAILED :
+             (char *) mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+    if (pixels == MAP_FAILED)
+    {
+        printf("memfd: not supported here\n");
+        errors++;
+    }
+    else
+    {
+        if ((x_send_memfd(s, fd, bytes) != 0) ||
+            (x_send_frame(s, 3, -1, 0, 0, T_HEIGHT) != 0) ||
+            (x_read_ack(mod, 3) != 0) || (mod->screen_memfd_pixels == 0))
+        {
+            printf("memfd: not mapped\n");
+            errors++;
+        }
+        else
+        {
+            errors += x_run_frames(mod, s, "memfd", pixels, -1);
+            /* a frame taller than the screen runs past the mapping */
+            g_painted = 0;
+            if ((x_send_frame(s, 4, -1, 0, 0, T_HEIGHT + 1) != 0) ||
+                (x_read_ack(mod, 4) != 0) || (g_painted != 0))
+            {
+                printf("memfd: a frame past the end was painted\n");
+                errors++;
+            }
+        }
+        munmap(pixels, bytes);
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    free_stream(s);
+    mod_exit(mod);
+    close(sv[1]);
+    g_deinit();
+    printf("%s\n", errors == 0 ? "ok" : "FAILED");
+    return errors == 0 ? 0 : 1;
+}
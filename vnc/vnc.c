@@ -19,8 +19,10 @@
  */
 
 #include "vnc.h"
+#include "vnc_decode.h"
 #include "log.h"
 #include "trans.h"
+#include "pixel_convert.h"
 
 #define LLOG_LEVEL 1
 #define LLOGLN(_level, _args) \
@@ -36,8 +38,21 @@
 
 #define AS_LOG_MESSAGE log_message
 
+/* how often to look at the rdp side when updates are held back */
+#define VNC_PACE_MS 10
+/* the rdp client is behind once this much of what we painted is still
+   queued in its trans, less is the tail of the last update going out */
+#define VNC_CONGESTED_BYTES (64 * 1024)
+
+#define VNC_FENCE_BLOCK_BEFORE (1 << 0)
+#define VNC_FENCE_REQUEST      0x80000000
+
 static int APP_CC
 lib_mod_process_message(struct vnc *v, struct stream *s);
+static int APP_CC
+lib_pace_updates(struct vnc *v);
+static int APP_CC
+lib_send_continuous_updates(struct vnc *v, int enable);
 
 /******************************************************************************/
 static int APP_CC
@@ -360,218 +375,225 @@ lib_mod_event(struct vnc *v, int msg, long param1, long param2,
     return error;
 }
 
-//******************************************************************************
-int DEFAULT_CC
-get_pixel_safe(char *data, int x, int y, int width, int height, int bpp)
+/******************************************************************************/
+/* FramebufferUpdateRequest for the whole desktop */
+static int APP_CC
+lib_send_update_request(struct vnc *v)
 {
-    int start = 0;
-    int shift = 0;
+    struct stream *s;
+    int error;
 
-    if (x < 0)
-    {
-        return 0;
-    }
+    make_stream(s);
+    init_stream(s, 8192);
+    out_uint8(s, 3);
+    out_uint8(s, 1);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, v->mod_width);
+    out_uint16_be(s, v->mod_height);
+    s_mark_end(s);
+    error = lib_send_copy(v, s);
+    free_stream(s);
+    return error;
+}
 
-    if (y < 0)
-    {
-        return 0;
-    }
+/******************************************************************************/
+/* read 'bytes' more into s, growing it if needed, what is already in s is
+   kept */
+static int APP_CC
+lib_read_append(struct vnc *v, struct stream *s, int bytes)
+{
+    char *data;
+    int used;
+    int size;
 
-    if (x >= width)
-    {
-        return 0;
-    }
+    used = (int)(s->end - s->data);
 
-    if (y >= height)
+    if (used + bytes > s->size)
     {
-        return 0;
+        size = used + bytes + 1024;
+        data = (char *)g_malloc(size, 0);
+        g_memcpy(data, s->data, used);
+        s->p = data + (s->p - s->data);
+        g_free(s->data);
+        s->data = data;
+        s->end = data + used;
+        s->size = size;
     }
 
-    if (bpp == 1)
-    {
-        width = (width + 7) / 8;
-        start = (y * width) + x / 8;
-        shift = x % 8;
-        return (data[start] & (0x80 >> shift)) != 0;
-    }
-    else if (bpp == 4)
+    return trans_force_read_s(v->trans, s, bytes);
+}
+
+#if defined(XRDP_VNC_ZLIB)
+
+/******************************************************************************/
+static int APP_CC
+lib_read_tight_length(struct vnc *v, struct stream *s, int *length)
+{
+    int error;
+    int b;
+    int i;
+
+    *length = 0;
+
+    for (i = 0; i < 3; i++)
     {
-        width = (width + 1) / 2;
-        start = y * width + x / 2;
-        shift = x % 2;
+        error = lib_read_append(v, s, 1);
 
-        if (shift == 0)
+        if (error != 0)
         {
-            return (data[start] & 0xf0) >> 4;
+            return error;
         }
-        else
+
+        b = *((tui8 *)(s->end - 1));
+
+        if (i == 2)
         {
-            return data[start] & 0x0f;
+            /* the third byte is all length, there is no fourth */
+            *length |= b << 14;
+            break;
+        }
+
+        *length |= (b & 0x7f) << (i * 7);
+
+        if ((b & 0x80) == 0)
+        {
+            break;
         }
-    }
-    else if (bpp == 8)
-    {
-        return *(((unsigned char *)data) + (y * width + x));
-    }
-    else if (bpp == 15 || bpp == 16)
-    {
-        return *(((unsigned short *)data) + (y * width + x));
-    }
-    else if (bpp == 24 || bpp == 32)
-    {
-        return *(((unsigned int *)data) + (y * width + x));
-    }
-    else
-    {
-        log_message(LOG_LEVEL_ERROR, "error in get_pixel_safe bpp %d", bpp);
     }
 
     return 0;
 }
 
 /******************************************************************************/
-void DEFAULT_CC
-set_pixel_safe(char *data, int x, int y, int width, int height, int bpp,
-               int pixel)
+/* Tight rects have no length up front, walk the header to find out how
+   much to read, the decoder thread parses it again */
+static int APP_CC
+lib_read_tight(struct vnc *v, struct vnc_job *job)
 {
-    int start = 0;
-    int shift = 0;
+    struct stream *s;
+    int error;
+    int tp;
+    int comp;
+    int filter;
+    int num_colors;
+    int row_bytes;
+    int raw_bytes;
+    int length;
 
-    if (x < 0)
-    {
-        return;
-    }
+    s = job->s;
+    tp = v->mod_bpp == 24 ? 3 : (v->mod_bpp + 7) / 8;
+    error = lib_read_append(v, s, 1);
 
-    if (y < 0)
+    if (error != 0)
     {
-        return;
+        return error;
     }
 
-    if (x >= width)
-    {
-        return;
-    }
+    comp = (*((tui8 *)(s->data))) >> 4;
 
-    if (y >= height)
+    if (comp == 8) /* fill */
     {
-        return;
+        return lib_read_append(v, s, tp);
     }
 
-    if (bpp == 1)
+    if (comp == 9) /* jpeg */
     {
-        width = (width + 7) / 8;
-        start = (y * width) + x / 8;
-        shift = x % 8;
+        error = lib_read_tight_length(v, s, &length);
 
-        if (pixel & 1)
-        {
-            data[start] = data[start] | (0x80 >> shift);
-        }
-        else
+        if (error == 0)
         {
-            data[start] = data[start] & ~(0x80 >> shift);
+            error = lib_read_append(v, s, length);
         }
+
+        return error;
     }
-    else if (bpp == 15 || bpp == 16)
-    {
-        *(((unsigned short *)data) + (y * width + x)) = pixel;
-    }
-    else if (bpp == 24)
-    {
-        *(data + (3 * (y * width + x)) + 0) = pixel >> 0;
-        *(data + (3 * (y * width + x)) + 1) = pixel >> 8;
-        *(data + (3 * (y * width + x)) + 2) = pixel >> 16;
-    }
-    else
+
+    if (comp > 9)
     {
-        log_message(LOG_LEVEL_ERROR, "error in set_pixel_safe bpp %d", bpp);
+        return 1;
     }
-}
 
-/******************************************************************************/
-int DEFAULT_CC
-split_color(int pixel, int *r, int *g, int *b, int bpp, int *palette)
-{
-    if (bpp == 8)
+    filter = 0;
+    num_colors = 0;
+
+    if (comp & 4)
     {
-        if (pixel >= 0 && pixel < 256 && palette != 0)
+        error = lib_read_append(v, s, 1);
+
+        if (error != 0)
         {
-            *r = (palette[pixel] >> 16) & 0xff;
-            *g = (palette[pixel] >> 8) & 0xff;
-            *b = (palette[pixel] >> 0) & 0xff;
+            return error;
         }
+
+        filter = *((tui8 *)(s->end - 1));
     }
-    else if (bpp == 15)
-    {
-        *r = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-        *g = ((pixel >> 2) & 0xf8) | ((pixel >> 8) & 0x7);
-        *b = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-    }
-    else if (bpp == 16)
+
+    if (filter == 1) /* palette */
     {
-        *r = ((pixel >> 8) & 0xf8) | ((pixel >> 13) & 0x7);
-        *g = ((pixel >> 3) & 0xfc) | ((pixel >> 9) & 0x3);
-        *b = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
+        error = lib_read_append(v, s, 1);
+
+        if (error != 0)
+        {
+            return error;
+        }
+
+        num_colors = *((tui8 *)(s->end - 1)) + 1;
+        error = lib_read_append(v, s, num_colors * tp);
+
+        if (error != 0)
+        {
+            return error;
+        }
+
+        row_bytes = num_colors == 2 ? (job->cx + 7) / 8 : job->cx;
     }
-    else if (bpp == 24 || bpp == 32)
+    else if (filter == 0 || filter == 2)
     {
-        *r = (pixel >> 16) & 0xff;
-        *g = (pixel >> 8) & 0xff;
-        *b = pixel & 0xff;
+        row_bytes = job->cx * tp;
     }
     else
     {
-        log_message(LOG_LEVEL_ERROR, "error in split_color bpp %d", bpp);
+        return 1;
     }
 
-    return 0;
-}
+    raw_bytes = row_bytes * job->cy;
 
-/******************************************************************************/
-int DEFAULT_CC
-make_color(int r, int g, int b, int bpp)
-{
-    if (bpp == 24)
+    if (raw_bytes < 12)
     {
-        return (r << 16) | (g << 8) | b;
+        return lib_read_append(v, s, raw_bytes);
     }
-    else
+
+    error = lib_read_tight_length(v, s, &length);
+
+    if (error == 0)
     {
-        log_message(LOG_LEVEL_ERROR, "error in make_color bpp %d", bpp);
+        error = lib_read_append(v, s, length);
     }
 
-    return 0;
+    return error;
 }
 
+#endif
+
 /******************************************************************************/
+/* read the rects off the wire and queue them to the decoder, they get
+   painted in lib_paint_jobs */
 int DEFAULT_CC
 lib_framebuffer_update(struct vnc *v)
 {
-    char *d1;
-    char *d2;
-    char cursor_data[32 * (32 * 3)];
-    char cursor_mask[32 * (32 / 8)];
     char text[256];
     int num_recs;
     int i;
     int j;
     int k;
-    int x;
-    int y;
-    int cx;
-    int cy;
-    int srcx;
-    int srcy;
-    int encoding;
+#if defined(XRDP_VNC_ZLIB)
+    int length;
+#endif
     int Bpp;
-    int pixel;
-    int r;
-    int g;
-    int b;
     int error;
-    int need_size;
     struct stream *s;
-    struct stream *pixel_s;
+    struct vnc_job *job;
 
     num_recs = 0;
     Bpp = (v->mod_bpp + 7) / 8;
@@ -581,8 +603,6 @@ lib_framebuffer_update(struct vnc *v)
         Bpp = 4;
     }
 
-    make_stream(pixel_s);
-
     make_stream(s);
     init_stream(s, 8192);
     error = trans_force_read_s(v->trans, s, 3);
@@ -591,7 +611,6 @@ lib_framebuffer_update(struct vnc *v)
     {
         in_uint8s(s, 1);
         in_uint16_be(s, num_recs);
-        error = v->server_begin_update(v);
     }
 
     for (i = 0; i < num_recs; i++)
@@ -604,121 +623,563 @@ lib_framebuffer_update(struct vnc *v)
         init_stream(s, 8192);
         error = trans_force_read_s(v->trans, s, 12);
 
-        if (error == 0)
+        if (error != 0)
         {
-            in_uint16_be(s, x);
-            in_uint16_be(s, y);
-            in_uint16_be(s, cx);
-            in_uint16_be(s, cy);
-            in_uint32_be(s, encoding);
+            break;
+        }
 
-            if (encoding == 0) /* raw */
-            {
-                need_size = cx * cy * Bpp;
-                init_stream(pixel_s, need_size);
-                error = trans_force_read_s(v->trans, pixel_s, need_size);
+        job = (struct vnc_job *)g_malloc(sizeof(struct vnc_job), 1);
+        in_uint16_be(s, job->x);
+        in_uint16_be(s, job->y);
+        in_uint16_be(s, job->cx);
+        in_uint16_be(s, job->cy);
+        in_uint32_be(s, job->encoding);
+        make_stream(job->s);
+        init_stream(job->s, 1024);
+
+        if (i == num_recs - 1)
+        {
+            job->flags |= VNC_JOB_LAST;
+        }
+
+        switch (job->encoding)
+        {
+            case VNC_ENC_RAW:
+                error = lib_read_append(v, job->s, job->cx * job->cy * Bpp);
+                break;
+            case VNC_ENC_COPYRECT:
+                error = lib_read_append(v, job->s, 4);
 
                 if (error == 0)
                 {
-                    error = v->server_paint_rect(v, x, y, cx, cy, pixel_s->data, cx, cy, 0, 0);
+                    in_uint16_be(job->s, job->srcx);
+                    in_uint16_be(job->s, job->srcy);
                 }
-            }
-            else if (encoding == 1) /* copy rect */
-            {
-                init_stream(s, 8192);
-                error = trans_force_read_s(v->trans, s, 4);
+
+                break;
+            case VNC_ENC_CURSOR:
+                j = job->cx * job->cy * Bpp;
+                k = ((job->cx + 7) / 8) * job->cy;
+                error = lib_read_append(v, job->s, j + k);
+                break;
+            case VNC_ENC_DESKTOPSIZE:
+                break;
+#if defined(XRDP_VNC_ZLIB)
+            case VNC_ENC_ZRLE:
+                error = lib_read_append(v, job->s, 4);
 
                 if (error == 0)
                 {
-                    in_uint16_be(s, srcx);
-                    in_uint16_be(s, srcy);
-                    error = v->server_screen_blt(v, x, y, cx, cy, srcx, srcy);
+                    in_uint32_be(job->s, length);
+                    error = lib_read_append(v, job->s, length);
                 }
-            }
-            else if (encoding == 0xffffff11) /* cursor */
-            {
-                g_memset(cursor_data, 0, 32 * (32 * 3));
-                g_memset(cursor_mask, 0, 32 * (32 / 8));
-                j = cx * cy * Bpp;
-                k = ((cx + 7) / 8) * cy;
-                init_stream(s, j + k);
-                error = trans_force_read_s(v->trans, s, j + k);
 
-                if (error == 0)
-                {
-                    in_uint8p(s, d1, j);
-                    in_uint8p(s, d2, k);
+                break;
+            case VNC_ENC_TIGHT:
+                error = lib_read_tight(v, job);
+                break;
+#endif
+            default:
+                g_sprintf(text, "VNC error in lib_framebuffer_update encoding = %8.8x",
+                          job->encoding);
+                v->server_msg(v, text, 1);
+                job->encoding = -1;
+                break;
+        }
 
-                    for (j = 0; j < 32; j++)
-                    {
-                        for (k = 0; k < 32; k++)
-                        {
-                            pixel = get_pixel_safe(d2, k, 31 - j, cx, cy, 1);
-                            set_pixel_safe(cursor_mask, k, j, 32, 32, 1, !pixel);
-
-                            if (pixel)
-                            {
-                                pixel = get_pixel_safe(d1, k, 31 - j, cx, cy, v->mod_bpp);
-                                split_color(pixel, &r, &g, &b, v->mod_bpp, v->palette);
-                                pixel = make_color(r, g, b, 24);
-                                set_pixel_safe(cursor_data, k, j, 32, 32, 24, pixel);
-                            }
-                        }
-                    }
+        if (error != 0)
+        {
+            vnc_decoder_job_delete(job);
+            break;
+        }
 
-                    /* keep these in 32x32, vnc cursor can be alot bigger */
-                    if (x > 31)
-                    {
-                        x = 31;
-                    }
+        error = vnc_decoder_add_job(v, job);
 
-                    if (y > 31)
-                    {
-                        y = 31;
-                    }
+        if (error == 0)
+        {
+            v->jobs_pending++;
+        }
+    }
 
-                    error = v->server_set_cursor(v, x, y, cursor_data, cursor_mask);
-                }
+    if (error == 0 && num_recs == 0 && !v->cu_enabled)
+    {
+        v->update_wanted = 1;
+        error = lib_pace_updates(v);
+    }
+
+    free_stream(s);
+    return error;
+}
+
+/******************************************************************************/
+/* the 32x32 cursor is bottom up, 24 bpp, with a 1 in the mask for a
+   transparent pixel, rows of it are converted whole from the server's
+   top down cx by cy cursor with its 1 for an opaque pixel mask */
+static int APP_CC
+lib_paint_cursor(struct vnc *v, struct vnc_job *job)
+{
+    char *d1;
+    char *d2;
+    char cursor_data[32 * (32 * 3)];
+    char cursor_mask[32 * (32 / 8)];
+    char *src_mask;
+    char *dst;
+    char *dst_mask;
+    int j;
+    int k;
+    int x;
+    int y;
+    int cx;
+    int fmt;
+    int Bpp;
+    int mask_bytes;
+
+    Bpp = (v->mod_bpp + 7) / 8;
+
+    if (Bpp == 3)
+    {
+        Bpp = 4;
+    }
+
+    fmt = Bpp == 4 ? PIXEL_FMT_32 : v->mod_bpp;
+    cx = MIN(job->cx, 32);
+    mask_bytes = (job->cx + 7) / 8;
+    g_memset(cursor_data, 0, 32 * (32 * 3));
+    g_memset(cursor_mask, 0xff, 32 * (32 / 8));
+    d1 = job->s->data;
+    d2 = d1 + job->cx * job->cy * Bpp;
+
+    for (j = 0; j < 32; j++)
+    {
+        y = 31 - j;
+
+        if ((cx < 1) || (y >= job->cy))
+        {
+            continue;
+        }
+
+        dst = cursor_data + j * (32 * 3);
+        dst_mask = cursor_mask + j * (32 / 8);
+        src_mask = d2 + y * mask_bytes;
+
+        if (pixel_convert_row(d1 + y * job->cx * Bpp, fmt, dst,
+                              PIXEL_FMT_24, cx, v->palette) != 0)
+        {
+            g_memset(dst, 0, cx * 3);
+        }
+
+        for (k = 0; k < (cx + 7) / 8; k++)
+        {
+            dst_mask[k] = ~src_mask[k];
+        }
+
+        if (cx & 7)
+        {
+            dst_mask[cx / 8] |= 0xff >> (cx & 7);
+        }
+
+        /* no colour under a transparent pixel */
+        for (k = 0; k < cx; k++)
+        {
+            if (dst_mask[k / 8] & (0x80 >> (k & 7)))
+            {
+                dst[k * 3 + 0] = 0;
+                dst[k * 3 + 1] = 0;
+                dst[k * 3 + 2] = 0;
             }
-            else if (encoding == 0xffffff21) /* desktop size */
+        }
+    }
+
+    /* keep these in 32x32, vnc cursor can be alot bigger */
+    x = MIN(job->x, 31);
+    y = MIN(job->y, 31);
+    return v->server_set_cursor(v, x, y, cursor_data, cursor_mask);
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_paint_job(struct vnc *v, struct vnc_job *job)
+{
+    if (job->error != 0)
+    {
+        LLOGLN(0, ("lib_paint_job: decode failed encoding %8.8x", job->encoding));
+        return 1;
+    }
+
+    switch (job->encoding)
+    {
+        case VNC_ENC_RAW:
+            return v->server_paint_rect(v, job->x, job->y, job->cx, job->cy,
+                                        job->s->data, job->cx, job->cy, 0, 0);
+        case VNC_ENC_ZRLE:
+        case VNC_ENC_TIGHT:
+            return v->server_paint_rect(v, job->x, job->y, job->cx, job->cy,
+                                        job->pixels, job->cx, job->cy, 0, 0);
+        case VNC_ENC_COPYRECT:
+            return v->server_screen_blt(v, job->x, job->y, job->cx, job->cy,
+                                        job->srcx, job->srcy);
+        case VNC_ENC_CURSOR:
+            return lib_paint_cursor(v, job);
+        case VNC_ENC_DESKTOPSIZE:
+            v->mod_width = job->cx;
+            v->mod_height = job->cy;
+
+            if (v->server_reset(v, job->cx, job->cy, v->mod_bpp) != 0)
             {
-                v->mod_width = cx;
-                v->mod_height = cy;
-                error = v->server_reset(v, cx, cy, v->mod_bpp);
+                return 1;
             }
-            else
+
+            /* continuous updates are for an area, make it the new size */
+            if (v->cu_enabled)
             {
-                g_sprintf(text, "VNC error in lib_framebuffer_update encoding = %8.8x",
-                          encoding);
-                v->server_msg(v, text, 1);
+                return lib_send_continuous_updates(v, 1);
             }
+
+            return 0;
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* true if the rect of job 'inner' is all inside job 'outer' */
+static int APP_CC
+lib_job_covers(struct vnc_job *outer, struct vnc_job *inner)
+{
+    return inner->x >= outer->x && inner->y >= outer->y &&
+           inner->x + inner->cx <= outer->x + outer->cx &&
+           inner->y + inner->cy <= outer->y + outer->cy;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_job_is_paint(struct vnc_job *job)
+{
+    return job->encoding == VNC_ENC_RAW || job->encoding == VNC_ENC_ZRLE ||
+           job->encoding == VNC_ENC_TIGHT;
+}
+
+/******************************************************************************/
+/* when several updates are waiting, a rect that a later rect paints over
+   does not need to go to the client, stop looking at anything that reads
+   or resizes the screen */
+static int APP_CC
+lib_job_is_hidden(struct vnc_job **jobs, int index, int count)
+{
+    int later;
+    struct vnc_job *job;
+
+    job = jobs[index];
+
+    if (!lib_job_is_paint(job) || job->error != 0)
+    {
+        return 0;
+    }
+
+    for (later = index + 1; later < count; later++)
+    {
+        if (jobs[later]->encoding == VNC_ENC_COPYRECT ||
+            jobs[later]->encoding == VNC_ENC_DESKTOPSIZE)
+        {
+            break;
+        }
+
+        if (lib_job_is_paint(jobs[later]) && jobs[later]->error == 0 &&
+            lib_job_covers(jobs[later], job))
+        {
+            return 1;
         }
     }
 
+    return 0;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_send_fence(struct vnc *v, int flags, char *data, int bytes)
+{
+    struct stream *s;
+    int error;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    out_uint8(s, 248);
+    out_uint8s(s, 3);
+    out_uint32_be(s, flags);
+    out_uint8(s, bytes);
+    out_uint8a(s, data, bytes);
+    s_mark_end(s);
+    error = lib_send_copy(v, s);
+    free_stream(s);
+    return error;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_send_continuous_updates(struct vnc *v, int enable)
+{
+    struct stream *s;
+    int error;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    out_uint8(s, 150);
+    out_uint8(s, enable);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, v->mod_width);
+    out_uint16_be(s, v->mod_height);
+    s_mark_end(s);
+    error = lib_send_copy(v, s);
+    free_stream(s);
+    v->cu_enabled = enable;
+    return error;
+}
+
+/******************************************************************************/
+/* the rdp client is behind if more than VNC_CONGESTED_BYTES this module
+   painted is still waiting in the client trans */
+static int APP_CC
+lib_rdp_congested(struct vnc *v)
+{
+    struct source_info *si;
+
+    si = (struct source_info *)(v->si);
+
+    if (si == 0)
+    {
+        return 0;
+    }
+
+    return si->source[XRDP_SOURCE_MOD] > VNC_CONGESTED_BYTES;
+}
+
+/******************************************************************************/
+/* continuous updates are only used with Fence, without it there is no way
+   to know which rects came before they were turned off */
+static int APP_CC
+lib_cu_usable(struct vnc *v)
+{
+    return v->cu_supported && v->fence_supported;
+}
+
+/******************************************************************************/
+/* true if lib_pace_updates is holding back a request or continuous
+   updates only because the rdp client is behind, nothing wakes us when
+   it catches up so xrdp has to poll, queued rects wake us when painted */
+static int APP_CC
+lib_pace_waiting(struct vnc *v)
+{
+    if (v->jobs_pending != 0 || !lib_rdp_congested(v))
+    {
+        return 0;
+    }
+
+    return v->update_wanted || (lib_cu_usable(v) && !v->cu_enabled);
+}
+
+/******************************************************************************/
+/* decide whether the vnc server may send more, called after painting and
+   whenever xrdp polls us */
+static int APP_CC
+lib_pace_updates(struct vnc *v)
+{
+    int error;
+
+    error = 0;
+
+    if (v->fence_pending && v->jobs_pending == 0)
+    {
+        v->fence_pending = 0;
+        error = lib_send_fence(v, v->fence_flags, v->fence_data,
+                               v->fence_bytes);
+    }
+
+    if (error != 0)
+    {
+        return error;
+    }
+
+    if (lib_rdp_congested(v))
+    {
+        if (v->cu_enabled)
+        {
+            LLOGLN(10, ("lib_pace_updates: pausing continuous updates"));
+            error = lib_send_continuous_updates(v, 0);
+        }
+
+        return error;
+    }
+
+    if (lib_cu_usable(v))
+    {
+        if (!v->cu_enabled && v->jobs_pending == 0)
+        {
+            LLOGLN(10, ("lib_pace_updates: continuous updates on"));
+            v->update_wanted = 0;
+            error = lib_send_continuous_updates(v, 1);
+        }
+
+        return error;
+    }
+
+    if (v->update_wanted && v->jobs_pending == 0)
+    {
+        v->update_wanted = 0;
+        error = lib_send_update_request(v);
+    }
+
+    return error;
+}
+
+/******************************************************************************/
+/* paint everything the decoder has finished, in server order, and ask for
+   the next update once the last rect of this one is out */
+static int APP_CC
+lib_paint_jobs(struct vnc *v)
+{
+    struct vnc_job **jobs;
+    struct vnc_job **new_jobs;
+    struct vnc_job *job;
+    struct source_info *si;
+    int cur_source;
+    int count;
+    int alloc;
+    int index;
+    int error;
+
+    count = 0;
+    alloc = 0;
+    jobs = 0;
+    job = vnc_decoder_get_job(v);
+
+    while (job != 0)
+    {
+        if (count >= alloc)
+        {
+            alloc += 64;
+            new_jobs = (struct vnc_job **)g_malloc(alloc * sizeof(struct vnc_job *), 0);
+            g_memcpy(new_jobs, jobs, count * sizeof(struct vnc_job *));
+            g_free(jobs);
+            jobs = new_jobs;
+        }
+
+        jobs[count++] = job;
+        job = vnc_decoder_get_job(v);
+    }
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    /* so trans can tell how much of the client backlog is ours */
+    cur_source = 0;
+    si = (struct source_info *)(v->si);
+
+    if (si != 0)
+    {
+        cur_source = si->cur_source;
+        si->cur_source = XRDP_SOURCE_MOD;
+    }
+
+    error = v->server_begin_update(v);
+
+    for (index = 0; index < count; index++)
+    {
+        job = jobs[index];
+
+        if (error == 0 && !lib_job_is_hidden(jobs, index, count))
+        {
+            error = lib_paint_job(v, job);
+        }
+
+        if ((job->flags & VNC_JOB_LAST) && !v->cu_enabled)
+        {
+            v->update_wanted = 1;
+        }
+
+        vnc_decoder_job_delete(job);
+    }
+
+    v->jobs_pending -= count;
+    g_free(jobs);
+
     if (error == 0)
     {
         error = v->server_end_update(v);
     }
 
+    if (si != 0)
+    {
+        si->cur_source = cur_source;
+    }
+
+    return error;
+}
+
+/******************************************************************************/
+/* Fence from the server, the reply has to wait until everything before it
+   is painted, only BlockBefore is honoured */
+static int APP_CC
+lib_fence(struct vnc *v)
+{
+    struct stream *s;
+    int error;
+    int flags;
+    int bytes;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    error = trans_force_read_s(v->trans, s, 8);
+
+    if (error == 0)
+    {
+        in_uint8s(s, 3);
+        in_uint32_be(s, flags);
+        in_uint8(s, bytes);
+
+        if (bytes > 64)
+        {
+            error = 1;
+        }
+    }
+
     if (error == 0)
     {
-        /* FrambufferUpdateRequest */
         init_stream(s, 8192);
-        out_uint8(s, 3);
-        out_uint8(s, 1);
-        out_uint16_be(s, 0);
-        out_uint16_be(s, 0);
-        out_uint16_be(s, v->mod_width);
-        out_uint16_be(s, v->mod_height);
-        s_mark_end(s);
-        error = lib_send_copy(v, s);
+        error = trans_force_read_s(v->trans, s, bytes);
+    }
+
+    if (error == 0)
+    {
+        v->fence_supported = 1;
+
+        if (flags & VNC_FENCE_REQUEST)
+        {
+            v->fence_flags = flags & VNC_FENCE_BLOCK_BEFORE;
+            v->fence_bytes = bytes;
+            g_memcpy(v->fence_data, s->data, bytes);
+            v->fence_pending = 1;
+            error = lib_pace_updates(v);
+        }
     }
 
     free_stream(s);
-    free_stream(pixel_s);
     return error;
 }
 
+/******************************************************************************/
+/* EndOfContinuousUpdates, sent once to say the server supports them and
+   again each time they are turned off */
+static int APP_CC
+lib_end_of_continuous_updates(struct vnc *v)
+{
+    v->cu_supported = 1;
+    v->cu_enabled = 0;
+    return lib_pace_updates(v);
+}
+
 /******************************************************************************/
 /* clip data from the vnc server */
 int DEFAULT_CC
@@ -874,6 +1335,14 @@ lib_mod_process_message(struct vnc *v, struct stream *s)
             log_message(LOG_LEVEL_DEBUG, "VNC got clip data");
             error = lib_clip_data(v);
         }
+        else if (type == (char)150) /* end of continuous updates */
+        {
+            error = lib_end_of_continuous_updates(v);
+        }
+        else if (type == (char)248) /* fence */
+        {
+            error = lib_fence(v);
+        }
         else
         {
             g_sprintf(text, "VNC unknown in lib_mod_signal %d", type);
@@ -947,6 +1416,48 @@ lib_data_in(struct trans *trans)
     return 0;
 }
 
+/******************************************************************************/
+/* SetEncodings body, most preferred first */
+static int APP_CC
+lib_out_encodings(struct vnc *v, struct stream *s)
+{
+    int encodings[16];
+    int count;
+    int index;
+
+    count = 0;
+    encodings[count++] = VNC_ENC_COPYRECT;
+#if defined(XRDP_VNC_ZLIB)
+    encodings[count++] = VNC_ENC_ZRLE;
+    encodings[count++] = VNC_ENC_TIGHT;
+#endif
+    encodings[count++] = VNC_ENC_RAW;
+    encodings[count++] = VNC_ENC_CURSOR;
+    encodings[count++] = VNC_ENC_DESKTOPSIZE;
+    encodings[count++] = VNC_ENC_FENCE;
+    encodings[count++] = VNC_ENC_CONTINUOUSUPDATES;
+#if defined(XRDP_VNC_ZLIB)
+    /* loopback, favour cpu over bandwidth */
+    encodings[count++] = VNC_ENC_COMPRESSLEVEL0 + 1;
+#if defined(XRDP_TJPEG) || defined(XRDP_JPEG)
+    if (v->mod_bpp == 24)
+    {
+        encodings[count++] = VNC_ENC_QUALITYLEVEL0 + 8;
+    }
+#endif
+#endif
+    out_uint8(s, 2);
+    out_uint8(s, 0);
+    out_uint16_be(s, count);
+
+    for (index = 0; index < count; index++)
+    {
+        out_uint32_be(s, encodings[index]);
+    }
+
+    return 0;
+}
+
 /******************************************************************************/
 /*
   return error
@@ -1265,13 +1776,7 @@ lib_mod_connect(struct vnc *v)
     {
         /* SetEncodings */
         init_stream(s, 8192);
-        out_uint8(s, 2);
-        out_uint8(s, 0);
-        out_uint16_be(s, 4);
-        out_uint32_be(s, 0); /* raw */
-        out_uint32_be(s, 1); /* copy rect */
-        out_uint32_be(s, 0xffffff11); /* cursor */
-        out_uint32_be(s, 0xffffff21); /* desktop size */
+        lib_out_encodings(v, s);
         v->server_msg(v, "VNC sending encodings", 0);
         s_mark_end(s);
         error = trans_force_write_s(v->trans, s);
@@ -1282,6 +1787,11 @@ lib_mod_connect(struct vnc *v)
         error = v->server_reset(v, v->mod_width, v->mod_height, v->mod_bpp);
     }
 
+    if (error == 0)
+    {
+        error = vnc_decoder_create(v);
+    }
+
     if (error == 0)
     {
         /* FrambufferUpdateRequest */
@@ -1358,7 +1868,9 @@ lib_mod_end(struct vnc *v)
     {
     }
 
+    vnc_decoder_delete(v);
     free_stream(v->clip_data_s);
+    v->clip_data_s = 0;
     return 0;
 }
 
@@ -1409,6 +1921,17 @@ lib_mod_get_wait_objs(struct vnc *v, tbus *read_objs, int *rcount,
             trans_get_wait_objs_rw(v->trans, read_objs, rcount,
                                    write_objs, wcount, timeout);
         }
+
+        vnc_decoder_get_wait_objs(v, read_objs, rcount);
+
+        /* held back by pacing, look again soon */
+        if (lib_pace_waiting(v))
+        {
+            if (*timeout < 0 || *timeout > VNC_PACE_MS)
+            {
+                *timeout = VNC_PACE_MS;
+            }
+        }
     }
 
     return 0;
@@ -1428,6 +1951,16 @@ lib_mod_check_wait_objs(struct vnc *v)
         {
             rv = trans_check_wait_objs(v->trans);
         }
+
+        if (rv == 0 && vnc_decoder_check_wait_objs(v))
+        {
+            rv = lib_paint_jobs(v);
+        }
+
+        if (rv == 0 && v->trans != 0)
+        {
+            rv = lib_pace_updates(v);
+        }
     }
     return rv;
 }
@@ -1464,6 +1997,7 @@ mod_exit(struct vnc *v)
     {
         return 0;
     }
+    vnc_decoder_delete(v);
     trans_delete(v->trans);
     g_free(v);
     return 0;
@@ -27,6 +27,8 @@
 
 #define CURRENT_MOD_VER 3
 
+struct vnc_decoder;
+
 struct vnc
 {
   int size; /* size of this struct */
@@ -115,4 +117,14 @@ struct vnc
   struct stream *clip_data_s;
   int delay_ms;
   struct trans *trans;
+  struct vnc_decoder *decoder; /* rect decoder thread, vnc_decode.c */
+  int jobs_pending; /* rects queued to the decoder, not painted yet */
+  int update_wanted; /* FramebufferUpdateRequest held back by pacing */
+  int cu_supported; /* server sent EndOfContinuousUpdates */
+  int cu_enabled;
+  int fence_supported; /* server sent a Fence */
+  int fence_pending; /* Fence reply waits for queued rects to paint */
+  int fence_flags;
+  int fence_bytes;
+  char fence_data[64];
 };
@@ -0,0 +1,1349 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libvnc rect decoder thread
+ *
+ * ZRLE and Tight keep their zlib streams for the life of the connection
+ * so rects must be decoded in the order they arrive, one thread does all
+ * of them.  Rects that need no decoding go through the same fifo so the
+ * main thread always paints in server order.
+ */
+
+#include "vnc.h"
+#include "vnc_decode.h"
+#include "log.h"
+#include "fifo.h"
+#include "thread_calls.h"
+#include "pixel_convert.h"
+
+#if defined(XRDP_VNC_ZLIB)
+#include <zlib.h>
+#if defined(XRDP_TJPEG)
+#include <turbojpeg.h>
+#elif defined(XRDP_JPEG)
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+#endif
+
+#define LLOG_LEVEL 1
+#define LLOGLN(_level, _args) \
+  do \
+  { \
+    if (_level < LLOG_LEVEL) \
+    { \
+        g_write("xrdp:vnc_decode [%10.10u]: ", g_time3()); \
+        g_writeln _args ; \
+    } \
+  } \
+  while (0)
+
+struct vnc_decoder
+{
+    tbus mutex;
+    tbus term_event;
+    tbus event_to_proc;
+    tbus event_processed;
+    tbus thread_done;
+    FIFO *fifo_to_proc;
+    FIFO *fifo_processed;
+    int mod_bpp;
+    int Bpp;
+#if defined(XRDP_VNC_ZLIB)
+    z_stream zrle_zs;
+    int zrle_zs_inited;
+    z_stream tight_zs[4];
+    int tight_zs_inited[4];
+    char *zbuf;
+    int zbuf_size;
+#if defined(XRDP_TJPEG)
+    tjhandle tj;
+#endif
+#endif
+};
+
+#if defined(XRDP_VNC_ZLIB)
+
+/*****************************************************************************/
+/* read one pixel of 'bytes' size as it is on the wire, 3 byte pixels are
+   the low 3 bytes of a 32 bpp pixel */
+static int APP_CC
+vnc_get_pixel(const tui8 *p, int bytes)
+{
+    tui16 pixel16;
+    tui32 pixel32;
+
+    switch (bytes)
+    {
+        case 1:
+            return p[0];
+        case 2:
+            g_memcpy(&pixel16, p, 2);
+            return pixel16;
+        case 3:
+#if defined(B_ENDIAN)
+            return (p[0] << 16) | (p[1] << 8) | p[2];
+#else
+            return p[0] | (p[1] << 8) | (p[2] << 16);
+#endif
+        default:
+            g_memcpy(&pixel32, p, 4);
+            return pixel32;
+    }
+}
+
+/*****************************************************************************/
+static void APP_CC
+vnc_put_pixel(char *d, int Bpp, int pixel)
+{
+    tui16 pixel16;
+    tui32 pixel32;
+
+    switch (Bpp)
+    {
+        case 1:
+            d[0] = pixel;
+            break;
+        case 2:
+            pixel16 = pixel;
+            g_memcpy(d, &pixel16, 2);
+            break;
+        default:
+            pixel32 = pixel;
+            g_memcpy(d, &pixel32, 4);
+            break;
+    }
+}
+
+/*****************************************************************************/
+static void APP_CC
+vnc_fill(char *dst, int dst_width, int Bpp, int x, int y, int cx, int cy,
+         int pixel)
+{
+    int i;
+    int j;
+    char *d;
+
+    for (j = 0; j < cy; j++)
+    {
+        d = dst + ((y + j) * dst_width + x) * Bpp;
+
+        for (i = 0; i < cx; i++)
+        {
+            vnc_put_pixel(d, Bpp, pixel);
+            d += Bpp;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* make sure the inflate buffer can hold 'bytes' */
+static int APP_CC
+vnc_zbuf_reserve(struct vnc_decoder *self, int bytes)
+{
+    if (bytes > self->zbuf_size)
+    {
+        g_free(self->zbuf);
+        self->zbuf = (char *)g_malloc(bytes, 0);
+        self->zbuf_size = self->zbuf == 0 ? 0 : bytes;
+    }
+
+    return self->zbuf == 0;
+}
+
+/*****************************************************************************/
+/* inflate all of 'in' into zbuf, returns the number of bytes produced or
+   -1 on error, the server flushes its stream at the end of every rect so
+   all the input must be used up */
+static int APP_CC
+vnc_inflate(z_stream *zs, char *in, int in_bytes, char *out, int out_bytes)
+{
+    int rv;
+
+    zs->next_in = (Bytef *)in;
+    zs->avail_in = in_bytes;
+    zs->next_out = (Bytef *)out;
+    zs->avail_out = out_bytes;
+
+    while (zs->avail_in > 0)
+    {
+        if (zs->avail_out == 0)
+        {
+            LLOGLN(0, ("vnc_inflate: output too big"));
+            return -1;
+        }
+
+        rv = inflate(zs, Z_SYNC_FLUSH);
+
+        if (rv == Z_BUF_ERROR)
+        {
+            break;
+        }
+
+        if (rv != Z_OK && rv != Z_STREAM_END)
+        {
+            LLOGLN(0, ("vnc_inflate: inflate failed %d", rv));
+            return -1;
+        }
+    }
+
+    return out_bytes - (int)(zs->avail_out);
+}
+
+/*****************************************************************************/
+/* ZRLE CPIXEL size, the top byte of a 24 bit depth 32 bpp pixel is not
+   sent */
+static int APP_CC
+vnc_zrle_cpixel_bytes(struct vnc_decoder *self)
+{
+    if (self->mod_bpp == 24)
+    {
+        return 3;
+    }
+
+    return self->Bpp;
+}
+
+/*****************************************************************************/
+static int APP_CC
+vnc_zrle_run_length(struct stream *s, int *run)
+{
+    int b;
+
+    *run = 1;
+
+    do
+    {
+        if (!s_check_rem(s, 1))
+        {
+            return 1;
+        }
+
+        in_uint8(s, b);
+        *run += b;
+    }
+    while (b == 255);
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* one 64x64 (or smaller at the edges) tile */
+static int APP_CC
+vnc_zrle_tile(struct vnc_decoder *self, struct vnc_job *job, struct stream *s,
+              int tx, int ty, int tw, int th)
+{
+    int palette[128];
+    int subenc;
+    int palette_size;
+    int cb;
+    int bits;
+    int mask;
+    int index;
+    int shift;
+    int pixel;
+    int run;
+    int i;
+    int j;
+    int Bpp;
+    char *d;
+    char *end;
+    tui8 *p;
+
+    Bpp = self->Bpp;
+    cb = vnc_zrle_cpixel_bytes(self);
+
+    if (!s_check_rem(s, 1))
+    {
+        return 1;
+    }
+
+    in_uint8(s, subenc);
+
+    if (subenc == 0) /* raw */
+    {
+        if (!s_check_rem(s, tw * th * cb))
+        {
+            return 1;
+        }
+
+        for (j = 0; j < th; j++)
+        {
+            d = job->pixels + ((ty + j) * job->cx + tx) * Bpp;
+
+            for (i = 0; i < tw; i++)
+            {
+                vnc_put_pixel(d, Bpp, vnc_get_pixel((tui8 *)(s->p), cb));
+                s->p += cb;
+                d += Bpp;
+            }
+        }
+
+        return 0;
+    }
+
+    if (subenc == 1 || subenc > 127)
+    {
+        palette_size = subenc == 1 ? 1 : subenc & 0x7f;
+    }
+    else if (subenc <= 16)
+    {
+        palette_size = subenc;
+    }
+    else
+    {
+        LLOGLN(0, ("vnc_zrle_tile: bad subencoding %d", subenc));
+        return 1;
+    }
+
+    if (!s_check_rem(s, palette_size * cb))
+    {
+        return 1;
+    }
+
+    for (i = 0; i < palette_size; i++)
+    {
+        palette[i] = vnc_get_pixel((tui8 *)(s->p), cb);
+        s->p += cb;
+    }
+
+    if (subenc == 1) /* solid */
+    {
+        vnc_fill(job->pixels, job->cx, Bpp, tx, ty, tw, th, palette[0]);
+        return 0;
+    }
+
+    if (subenc <= 16) /* packed palette */
+    {
+        bits = palette_size <= 2 ? 1 : palette_size <= 4 ? 2 : 4;
+        mask = (1 << bits) - 1;
+
+        if (!s_check_rem(s, ((tw * bits + 7) / 8) * th))
+        {
+            return 1;
+        }
+
+        for (j = 0; j < th; j++)
+        {
+            d = job->pixels + ((ty + j) * job->cx + tx) * Bpp;
+            shift = 8 - bits;
+
+            for (i = 0; i < tw; i++)
+            {
+                index = (*((tui8 *)(s->p)) >> shift) & mask;
+
+                if (index >= palette_size)
+                {
+                    return 1;
+                }
+
+                vnc_put_pixel(d, Bpp, palette[index]);
+                d += Bpp;
+                shift -= bits;
+
+                if (shift < 0)
+                {
+                    shift = 8 - bits;
+                    s->p++;
+                }
+            }
+
+            if (shift != 8 - bits)
+            {
+                s->p++;
+            }
+        }
+
+        return 0;
+    }
+
+    /* plain rle (128) or palette rle (130 - 255), runs may wrap rows but
+       not leave the tile */
+    j = 0;
+    i = 0;
+    d = job->pixels + (ty * job->cx + tx) * Bpp;
+    end = d + tw * Bpp;
+
+    while (j < th)
+    {
+        if (subenc == 128)
+        {
+            if (!s_check_rem(s, cb))
+            {
+                return 1;
+            }
+
+            p = (tui8 *)(s->p);
+            pixel = vnc_get_pixel(p, cb);
+            s->p += cb;
+
+            if (vnc_zrle_run_length(s, &run) != 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            if (!s_check_rem(s, 1))
+            {
+                return 1;
+            }
+
+            in_uint8(s, index);
+            run = 1;
+
+            if (index & 0x80)
+            {
+                index &= 0x7f;
+
+                if (vnc_zrle_run_length(s, &run) != 0)
+                {
+                    return 1;
+                }
+            }
+
+            if (index >= palette_size)
+            {
+                return 1;
+            }
+
+            pixel = palette[index];
+        }
+
+        while (run > 0)
+        {
+            if (j >= th)
+            {
+                return 1;
+            }
+
+            vnc_put_pixel(d, Bpp, pixel);
+            d += Bpp;
+            run--;
+            i++;
+
+            if (d >= end)
+            {
+                i = 0;
+                j++;
+                d = job->pixels + ((ty + j) * job->cx + tx) * Bpp;
+                end = d + tw * Bpp;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+static int APP_CC
+vnc_decode_zrle(struct vnc_decoder *self, struct vnc_job *job)
+{
+    struct stream ls;
+    int bytes;
+    int max_bytes;
+    int tiles;
+    int cb;
+    int tx;
+    int ty;
+    int tw;
+    int th;
+
+    if (!self->zrle_zs_inited)
+    {
+        g_memset(&(self->zrle_zs), 0, sizeof(z_stream));
+
+        if (inflateInit(&(self->zrle_zs)) != Z_OK)
+        {
+            return 1;
+        }
+
+        self->zrle_zs_inited = 1;
+    }
+
+    /* worst case is a palette rle tile with one pixel runs */
+    cb = vnc_zrle_cpixel_bytes(self);
+    tiles = ((job->cx + 63) / 64) * ((job->cy + 63) / 64);
+    max_bytes = tiles * (1 + 128 * cb) + job->cx * job->cy * (cb + 1);
+
+    if (vnc_zbuf_reserve(self, max_bytes) != 0)
+    {
+        return 1;
+    }
+
+    job->s->p = job->s->data + 4;
+    bytes = vnc_inflate(&(self->zrle_zs), job->s->p,
+                        (int)(job->s->end - job->s->p),
+                        self->zbuf, max_bytes);
+
+    if (bytes < 0)
+    {
+        return 1;
+    }
+
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = self->zbuf;
+    ls.p = ls.data;
+    ls.end = ls.data + bytes;
+    ls.size = max_bytes;
+
+    for (ty = 0; ty < job->cy; ty += 64)
+    {
+        th = MIN(64, job->cy - ty);
+
+        for (tx = 0; tx < job->cx; tx += 64)
+        {
+            tw = MIN(64, job->cx - tx);
+
+            if (vnc_zrle_tile(self, job, &ls, tx, ty, tw, th) != 0)
+            {
+                LLOGLN(0, ("vnc_decode_zrle: bad tile at %d %d", tx, ty));
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* Tight TPIXEL size, 24 bit depth is sent as r, g, b */
+static int APP_CC
+vnc_tight_tpixel_bytes(struct vnc_decoder *self)
+{
+    if (self->mod_bpp == 24)
+    {
+        return 3;
+    }
+
+    return self->Bpp;
+}
+
+/*****************************************************************************/
+static int APP_CC
+vnc_tight_get_tpixel(struct vnc_decoder *self, const tui8 *p)
+{
+    if (self->mod_bpp == 24)
+    {
+        return (p[0] << 16) | (p[1] << 8) | p[2];
+    }
+
+    return vnc_get_pixel(p, self->Bpp);
+}
+
+/*****************************************************************************/
+static int APP_CC
+vnc_tight_compact_length(struct stream *s, int *length)
+{
+    int b;
+    int shift;
+
+    *length = 0;
+    shift = 0;
+
+    do
+    {
+        if (!s_check_rem(s, 1))
+        {
+            return 1;
+        }
+
+        in_uint8(s, b);
+
+        if (shift == 14)
+        {
+            /* the third byte is all length, there is no fourth */
+            *length |= b << 14;
+            break;
+        }
+
+        *length |= (b & 0x7f) << shift;
+        shift += 7;
+    }
+    while (b & 0x80);
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* component layout of a true colour pixel, used by the gradient filter */
+static int APP_CC
+vnc_tight_pixel_layout(struct vnc_decoder *self, int *shifts, int *maxes)
+{
+    switch (self->mod_bpp)
+    {
+        case 15:
+            shifts[0] = 10;
+            shifts[1] = 5;
+            shifts[2] = 0;
+            maxes[0] = 31;
+            maxes[1] = 31;
+            maxes[2] = 31;
+            return 0;
+        case 16:
+            shifts[0] = 11;
+            shifts[1] = 5;
+            shifts[2] = 0;
+            maxes[0] = 31;
+            maxes[1] = 63;
+            maxes[2] = 31;
+            return 0;
+        case 24:
+            shifts[0] = 16;
+            shifts[1] = 8;
+            shifts[2] = 0;
+            maxes[0] = 255;
+            maxes[1] = 255;
+            maxes[2] = 255;
+            return 0;
+    }
+
+    return 1;
+}
+
+/*****************************************************************************/
+static int APP_CC
+vnc_tight_gradient(struct vnc_decoder *self, struct vnc_job *job, char *data)
+{
+    int shifts[3];
+    int maxes[3];
+    int *prev_row;
+    int *this_row;
+    int *swap;
+    int pixel;
+    int value;
+    int left;
+    int up;
+    int upleft;
+    int tp;
+    int i;
+    int j;
+    int c;
+    char *d;
+    tui8 *src;
+
+    if (vnc_tight_pixel_layout(self, shifts, maxes) != 0)
+    {
+        return 1;
+    }
+
+    tp = vnc_tight_tpixel_bytes(self);
+    prev_row = (int *)g_malloc((job->cx + 1) * 3 * sizeof(int), 1);
+    this_row = (int *)g_malloc((job->cx + 1) * 3 * sizeof(int), 1);
+
+    if (prev_row == 0 || this_row == 0)
+    {
+        g_free(prev_row);
+        g_free(this_row);
+        return 1;
+    }
+
+    src = (tui8 *)data;
+
+    for (j = 0; j < job->cy; j++)
+    {
+        d = job->pixels + j * job->cx * self->Bpp;
+
+        for (i = 0; i < job->cx; i++)
+        {
+            value = vnc_tight_get_tpixel(self, src);
+            src += tp;
+            pixel = 0;
+
+            for (c = 0; c < 3; c++)
+            {
+                left = this_row[i * 3 + c];
+                up = prev_row[(i + 1) * 3 + c];
+                upleft = prev_row[i * 3 + c];
+                left = left + up - upleft;
+                left = MAX(0, MIN(maxes[c], left));
+                left = (left + ((value >> shifts[c]) & maxes[c])) & maxes[c];
+                this_row[(i + 1) * 3 + c] = left;
+                pixel |= left << shifts[c];
+            }
+
+            vnc_put_pixel(d, self->Bpp, pixel);
+            d += self->Bpp;
+        }
+
+        swap = prev_row;
+        prev_row = this_row;
+        this_row = swap;
+    }
+
+    g_free(prev_row);
+    g_free(this_row);
+    return 0;
+}
+
+#if defined(XRDP_TJPEG) || defined(XRDP_JPEG)
+
+/*****************************************************************************/
+/* rgb rows from the jpeg decoder to mod_bpp pixels, jpeg is only used
+   at 24 bpp */
+static void APP_CC
+vnc_tight_rgb_row(struct vnc_job *job, int row, const tui8 *rgb)
+{
+    char *d;
+
+    /* rgb is r, g, b bytes, PIXEL_FMT_24 is b, g, r so swap after */
+    d = job->pixels + row * job->cx * 4;
+    pixel_convert_row(rgb, PIXEL_FMT_24, d, PIXEL_FMT_32, job->cx, 0);
+    pixel_swap_rb32(d, d, job->cx);
+}
+
+#endif
+
+#if defined(XRDP_TJPEG)
+
+/*****************************************************************************/
+static int APP_CC
+vnc_tight_jpeg(struct vnc_decoder *self, struct vnc_job *job,
+               char *data, int bytes)
+{
+    int width;
+    int height;
+    int subsamp;
+    int j;
+
+    if (self->tj == 0)
+    {
+        self->tj = tjInitDecompress();
+
+        if (self->tj == 0)
+        {
+            return 1;
+        }
+    }
+
+    if (tjDecompressHeader2(self->tj, (unsigned char *)data, bytes,
+                            &width, &height, &subsamp) != 0 ||
+        width != job->cx || height != job->cy)
+    {
+        return 1;
+    }
+
+    if (vnc_zbuf_reserve(self, width * height * 3) != 0)
+    {
+        return 1;
+    }
+
+    if (tjDecompress2(self->tj, (unsigned char *)data, bytes,
+                      (unsigned char *)(self->zbuf), width, width * 3, height,
+                      TJPF_RGB, 0) != 0)
+    {
+        return 1;
+    }
+
+    for (j = 0; j < height; j++)
+    {
+        vnc_tight_rgb_row(job, j, (tui8 *)(self->zbuf + j * width * 3));
+    }
+
+    return 0;
+}
+
+#elif defined(XRDP_JPEG)
+
+struct vnc_jpeg_error_mgr
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+/*****************************************************************************/
+static void
+vnc_jpeg_error_exit(j_common_ptr cinfo)
+{
+    struct vnc_jpeg_error_mgr *err;
+
+    err = (struct vnc_jpeg_error_mgr *)(cinfo->err);
+    longjmp(err->jmp, 1);
+}
+
+/*****************************************************************************/
+static int APP_CC
+vnc_tight_jpeg(struct vnc_decoder *self, struct vnc_job *job,
+               char *data, int bytes)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct vnc_jpeg_error_mgr jerr;
+    JSAMPROW row_pointer[1];
+    int row;
+
+    cinfo.err = jpeg_std_error(&(jerr.pub));
+    jerr.pub.error_exit = vnc_jpeg_error_exit;
+
+    if (setjmp(jerr.jmp))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)data, bytes);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    if ((int)(cinfo.output_width) != job->cx ||
+        (int)(cinfo.output_height) != job->cy ||
+        vnc_zbuf_reserve(self, job->cx * 3) != 0)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
+    }
+
+    row_pointer[0] = (JSAMPROW)(self->zbuf);
+
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        row = cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, row_pointer, 1);
+        vnc_tight_rgb_row(job, row, (tui8 *)(self->zbuf));
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+}
+
+#endif
+
+/*****************************************************************************/
+static int APP_CC
+vnc_decode_tight(struct vnc_decoder *self, struct vnc_job *job)
+{
+    struct stream *s;
+    int palette[256];
+    int ctrl;
+    int comp;
+    int filter;
+    int num_colors;
+    int row_bytes;
+    int raw_bytes;
+    int length;
+    int zid;
+    int tp;
+    int Bpp;
+    int i;
+    int j;
+    int bit;
+    int index;
+    char *data;
+    char *d;
+    tui8 *src;
+
+    s = job->s;
+    s->p = s->data;
+    tp = vnc_tight_tpixel_bytes(self);
+    Bpp = self->Bpp;
+
+    if (!s_check_rem(s, 1))
+    {
+        return 1;
+    }
+
+    in_uint8(s, ctrl);
+
+    for (i = 0; i < 4; i++)
+    {
+        if ((ctrl & (1 << i)) && self->tight_zs_inited[i])
+        {
+            inflateReset(&(self->tight_zs[i]));
+        }
+    }
+
+    comp = ctrl >> 4;
+
+    if (comp == 8) /* fill */
+    {
+        if (!s_check_rem(s, tp))
+        {
+            return 1;
+        }
+
+        vnc_fill(job->pixels, job->cx, Bpp, 0, 0, job->cx, job->cy,
+                 vnc_tight_get_tpixel(self, (tui8 *)(s->p)));
+        return 0;
+    }
+
+    if (comp == 9) /* jpeg */
+    {
+        if (vnc_tight_compact_length(s, &length) != 0 ||
+            !s_check_rem(s, length) || Bpp != 4)
+        {
+            return 1;
+        }
+
+#if defined(XRDP_TJPEG) || defined(XRDP_JPEG)
+        return vnc_tight_jpeg(self, job, s->p, length);
+#else
+        LLOGLN(0, ("vnc_decode_tight: jpeg not built in"));
+        return 1;
+#endif
+    }
+
+    if (comp > 9)
+    {
+        return 1;
+    }
+
+    /* basic compression */
+    zid = comp & 3;
+    filter = 0;
+    num_colors = 0;
+
+    if (comp & 4)
+    {
+        if (!s_check_rem(s, 1))
+        {
+            return 1;
+        }
+
+        in_uint8(s, filter);
+    }
+
+    if (filter == 1) /* palette */
+    {
+        if (!s_check_rem(s, 1))
+        {
+            return 1;
+        }
+
+        in_uint8(s, num_colors);
+        num_colors++;
+
+        if (!s_check_rem(s, num_colors * tp))
+        {
+            return 1;
+        }
+
+        for (i = 0; i < num_colors; i++)
+        {
+            palette[i] = vnc_tight_get_tpixel(self, (tui8 *)(s->p));
+            s->p += tp;
+        }
+
+        row_bytes = num_colors == 2 ? (job->cx + 7) / 8 : job->cx;
+    }
+    else if (filter == 0 || filter == 2) /* copy or gradient */
+    {
+        row_bytes = job->cx * tp;
+    }
+    else
+    {
+        LLOGLN(0, ("vnc_decode_tight: bad filter %d", filter));
+        return 1;
+    }
+
+    raw_bytes = row_bytes * job->cy;
+
+    if (raw_bytes < 12)
+    {
+        if (!s_check_rem(s, raw_bytes))
+        {
+            return 1;
+        }
+
+        data = s->p;
+    }
+    else
+    {
+        if (vnc_tight_compact_length(s, &length) != 0 ||
+            !s_check_rem(s, length))
+        {
+            return 1;
+        }
+
+        if (!self->tight_zs_inited[zid])
+        {
+            g_memset(&(self->tight_zs[zid]), 0, sizeof(z_stream));
+
+            if (inflateInit(&(self->tight_zs[zid])) != Z_OK)
+            {
+                return 1;
+            }
+
+            self->tight_zs_inited[zid] = 1;
+        }
+
+        if (vnc_zbuf_reserve(self, raw_bytes) != 0)
+        {
+            return 1;
+        }
+
+        if (vnc_inflate(&(self->tight_zs[zid]), s->p, length,
+                        self->zbuf, raw_bytes) != raw_bytes)
+        {
+            return 1;
+        }
+
+        data = self->zbuf;
+    }
+
+    src = (tui8 *)data;
+
+    if (filter == 2)
+    {
+        return vnc_tight_gradient(self, job, data);
+    }
+
+    if (filter == 0)
+    {
+        d = job->pixels;
+
+        for (i = 0; i < job->cx * job->cy; i++)
+        {
+            vnc_put_pixel(d, Bpp, vnc_tight_get_tpixel(self, src));
+            src += tp;
+            d += Bpp;
+        }
+
+        return 0;
+    }
+
+    for (j = 0; j < job->cy; j++)
+    {
+        d = job->pixels + j * job->cx * Bpp;
+
+        if (num_colors == 2)
+        {
+            for (i = 0; i < job->cx; i++)
+            {
+                bit = (src[i / 8] >> (7 - (i & 7))) & 1;
+                vnc_put_pixel(d, Bpp, palette[bit]);
+                d += Bpp;
+            }
+        }
+        else
+        {
+            for (i = 0; i < job->cx; i++)
+            {
+                index = src[i];
+
+                if (index >= num_colors)
+                {
+                    return 1;
+                }
+
+                vnc_put_pixel(d, Bpp, palette[index]);
+                d += Bpp;
+            }
+        }
+
+        src += row_bytes;
+    }
+
+    return 0;
+}
+
+#endif /* XRDP_VNC_ZLIB */
+
+/*****************************************************************************/
+/* called from decoder thread */
+static int APP_CC
+vnc_decoder_process_job(struct vnc_decoder *self, struct vnc_job *job)
+{
+    if (job->encoding != VNC_ENC_ZRLE && job->encoding != VNC_ENC_TIGHT)
+    {
+        return 0;
+    }
+
+#if defined(XRDP_VNC_ZLIB)
+    job->pixels = (char *)g_malloc(job->cx * job->cy * self->Bpp, 0);
+
+    if (job->pixels == 0)
+    {
+        return 1;
+    }
+
+    if (job->encoding == VNC_ENC_ZRLE)
+    {
+        return vnc_decode_zrle(self, job);
+    }
+
+    return vnc_decode_tight(self, job);
+#else
+    return 1;
+#endif
+}
+
+/**
+ * Decoder thread main loop
+ *****************************************************************************/
+static THREAD_RV THREAD_CC
+vnc_decoder_thread(void *arg)
+{
+    struct vnc_decoder *self;
+    struct vnc_job *job;
+    tbus robjs[2];
+
+    self = (struct vnc_decoder *)arg;
+    LLOGLN(10, ("vnc_decoder_thread: thread is running"));
+
+    while (1)
+    {
+        robjs[0] = self->term_event;
+        robjs[1] = self->event_to_proc;
+
+        if (g_obj_wait(robjs, 2, 0, 0, -1) != 0)
+        {
+            /* error, should not get here */
+            g_sleep(100);
+        }
+
+        if (g_is_wait_obj_set(self->term_event))
+        {
+            break;
+        }
+
+        if (g_is_wait_obj_set(self->event_to_proc))
+        {
+            /* clear it right away */
+            g_reset_wait_obj(self->event_to_proc);
+            tc_mutex_lock(self->mutex);
+            job = (struct vnc_job *)fifo_remove_item(self->fifo_to_proc);
+            tc_mutex_unlock(self->mutex);
+
+            while (job != 0)
+            {
+                job->error = vnc_decoder_process_job(self, job);
+                tc_mutex_lock(self->mutex);
+                fifo_add_item(self->fifo_processed, job);
+                job = (struct vnc_job *)fifo_remove_item(self->fifo_to_proc);
+                tc_mutex_unlock(self->mutex);
+                /* signal completion for main thread */
+                g_set_wait_obj(self->event_processed);
+            }
+        }
+    }
+
+    LLOGLN(10, ("vnc_decoder_thread: thread exit"));
+    tc_sem_inc(self->thread_done);
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+vnc_decoder_create(struct vnc *v)
+{
+    struct vnc_decoder *self;
+    char buf[1024];
+    int pid;
+
+    if (v->decoder != 0)
+    {
+        return 0;
+    }
+
+    self = (struct vnc_decoder *)g_malloc(sizeof(struct vnc_decoder), 1);
+
+    if (self == 0)
+    {
+        return 1;
+    }
+
+    self->mod_bpp = v->mod_bpp;
+    self->Bpp = (v->mod_bpp + 7) / 8;
+
+    if (self->Bpp == 3)
+    {
+        self->Bpp = 4;
+    }
+
+    pid = g_getpid();
+    g_snprintf(buf, 1024, "xrdp_%8.8x_%8.8x_vnc_dec_to_proc", pid, (int)v->handle);
+    self->event_to_proc = g_create_wait_obj(buf);
+    g_snprintf(buf, 1024, "xrdp_%8.8x_%8.8x_vnc_dec_processed", pid, (int)v->handle);
+    self->event_processed = g_create_wait_obj(buf);
+    g_snprintf(buf, 1024, "xrdp_%8.8x_%8.8x_vnc_dec_term", pid, (int)v->handle);
+    self->term_event = g_create_wait_obj(buf);
+    self->thread_done = tc_sem_create(0);
+    self->mutex = tc_mutex_create();
+    self->fifo_to_proc = fifo_create();
+    self->fifo_processed = fifo_create();
+    v->decoder = self;
+
+    if (tc_thread_create(vnc_decoder_thread, self) != 0)
+    {
+        LLOGLN(0, ("vnc_decoder_create: tc_thread_create failed"));
+        tc_sem_inc(self->thread_done);
+        vnc_decoder_delete(v);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+vnc_decoder_delete(struct vnc *v)
+{
+    struct vnc_decoder *self;
+    struct vnc_job *job;
+#if defined(XRDP_VNC_ZLIB)
+    int i;
+#endif
+
+    self = v->decoder;
+
+    if (self == 0)
+    {
+        return 0;
+    }
+
+    /* tell worker thread to shut down and wait for it */
+    g_set_wait_obj(self->term_event);
+    tc_sem_dec(self->thread_done);
+
+    while (!fifo_is_empty(self->fifo_to_proc))
+    {
+        job = (struct vnc_job *)fifo_remove_item(self->fifo_to_proc);
+        vnc_decoder_job_delete(job);
+    }
+
+    while (!fifo_is_empty(self->fifo_processed))
+    {
+        job = (struct vnc_job *)fifo_remove_item(self->fifo_processed);
+        vnc_decoder_job_delete(job);
+    }
+
+    fifo_delete(self->fifo_to_proc);
+    fifo_delete(self->fifo_processed);
+    tc_mutex_delete(self->mutex);
+    tc_sem_delete(self->thread_done);
+    g_delete_wait_obj(self->event_to_proc);
+    g_delete_wait_obj(self->event_processed);
+    g_delete_wait_obj(self->term_event);
+#if defined(XRDP_VNC_ZLIB)
+    if (self->zrle_zs_inited)
+    {
+        inflateEnd(&(self->zrle_zs));
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        if (self->tight_zs_inited[i])
+        {
+            inflateEnd(&(self->tight_zs[i]));
+        }
+    }
+
+#if defined(XRDP_TJPEG)
+    if (self->tj != 0)
+    {
+        tjDestroy(self->tj);
+    }
+#endif
+    g_free(self->zbuf);
+#endif
+    g_free(self);
+    v->decoder = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+/* called from main thread, the decoder owns the job until it comes back
+   from vnc_decoder_get_job */
+int APP_CC
+vnc_decoder_add_job(struct vnc *v, struct vnc_job *job)
+{
+    struct vnc_decoder *self;
+
+    self = v->decoder;
+
+    if (self == 0)
+    {
+        vnc_decoder_job_delete(job);
+        return 1;
+    }
+
+    tc_mutex_lock(self->mutex);
+    fifo_add_item(self->fifo_to_proc, job);
+    tc_mutex_unlock(self->mutex);
+    g_set_wait_obj(self->event_to_proc);
+    return 0;
+}
+
+/*****************************************************************************/
+/* called from main thread, next decoded job in server order or nil */
+struct vnc_job *APP_CC
+vnc_decoder_get_job(struct vnc *v)
+{
+    struct vnc_decoder *self;
+    struct vnc_job *job;
+
+    self = v->decoder;
+
+    if (self == 0)
+    {
+        return 0;
+    }
+
+    tc_mutex_lock(self->mutex);
+    job = (struct vnc_job *)fifo_remove_item(self->fifo_processed);
+    tc_mutex_unlock(self->mutex);
+    return job;
+}
+
+/*****************************************************************************/
+int APP_CC
+vnc_decoder_job_delete(struct vnc_job *job)
+{
+    if (job == 0)
+    {
+        return 0;
+    }
+
+    free_stream(job->s);
+    g_free(job->pixels);
+    g_free(job);
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+vnc_decoder_get_wait_objs(struct vnc *v, tbus *objs, int *count)
+{
+    if (v->decoder != 0)
+    {
+        objs[(*count)++] = v->decoder->event_processed;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns non zero if decoded jobs may be waiting */
+int APP_CC
+vnc_decoder_check_wait_objs(struct vnc *v)
+{
+    if (v->decoder == 0)
+    {
+        return 0;
+    }
+
+    if (g_is_wait_obj_set(v->decoder->event_processed))
+    {
+        g_reset_wait_obj(v->decoder->event_processed);
+        return 1;
+    }
+
+    return 0;
+}
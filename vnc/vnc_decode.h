@@ -0,0 +1,76 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libvnc rect decoder thread
+ */
+
+#if !defined(VNC_DECODE_H)
+#define VNC_DECODE_H
+
+#include "arch.h"
+#include "parse.h"
+
+#define VNC_ENC_RAW         0
+#define VNC_ENC_COPYRECT    1
+#define VNC_ENC_TIGHT       7
+#define VNC_ENC_ZRLE        16
+#define VNC_ENC_CURSOR      0xffffff11
+#define VNC_ENC_DESKTOPSIZE 0xffffff21
+#define VNC_ENC_FENCE       0xfffffec8
+#define VNC_ENC_CONTINUOUSUPDATES 0xfffffec7
+#define VNC_ENC_COMPRESSLEVEL0 0xffffff00
+#define VNC_ENC_QUALITYLEVEL0 0xffffffe0
+
+/* job flags */
+#define VNC_JOB_LAST        1 /* last rect of a FramebufferUpdate */
+
+struct vnc;
+
+/* one rect of a FramebufferUpdate, the main thread reads it off the wire,
+   the decoder thread decodes it and the main thread paints it, always in
+   the order the server sent them */
+struct vnc_job
+{
+    int encoding;
+    int flags;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int srcx; /* copy rect */
+    int srcy;
+    struct stream *s; /* encoded data as read from the server */
+    char *pixels; /* decoded ZRLE / Tight data, cx * cy in mod_bpp */
+    int error;
+};
+
+int APP_CC
+vnc_decoder_create(struct vnc *v);
+int APP_CC
+vnc_decoder_delete(struct vnc *v);
+int APP_CC
+vnc_decoder_add_job(struct vnc *v, struct vnc_job *job);
+struct vnc_job *APP_CC
+vnc_decoder_get_job(struct vnc *v);
+int APP_CC
+vnc_decoder_job_delete(struct vnc_job *job);
+int APP_CC
+vnc_decoder_get_wait_objs(struct vnc *v, tbus *objs, int *count);
+int APP_CC
+vnc_decoder_check_wait_objs(struct vnc *v);
+
+#endif
@@ -122,6 +122,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define TAG_IMAGEGLYPHBLT 13
 #define TAG_POLYGLYPHBLT  14
 #define TAG_PUSHPIXELS    15
+#define TAG_OTHER         16
 
 struct image_data
 {
@@ -314,6 +315,7 @@ struct _rdpPixmapRec
   int kind_width;
   struct rdp_draw_item* draw_item_head;
   struct rdp_draw_item* draw_item_tail;
+  int draw_item_count;
 };
 typedef struct _rdpPixmapRec rdpPixmapRec;
 typedef rdpPixmapRec* rdpPixmapPtr;
@@ -339,6 +341,8 @@ void
 g_sleep(int msecs);
 int
 g_tcp_send(int sck, void* ptr, int len, int flags);
+int
+g_sck_send_fd(int sck, void* ptr, int len, int flags, int fd);
 void*
 g_malloc(int size, int zero);
 void
@@ -396,6 +400,8 @@ draw_item_remove_all(rdpPixmapRec* priv);
 int
 draw_item_pack(PixmapPtr pix, rdpPixmapRec* priv);
 int
+draw_item_drop_covered(rdpPixmapRec* priv);
+int
 draw_item_add_img_region(rdpPixmapRec* priv, RegionPtr reg, int opcode,
                          int type, int code);
 int
@@ -483,6 +489,8 @@ void
 rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
              INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask, INT16 xDst,
              INT16 yDst, CARD16 width, CARD16 height);
+void
+rdpCompositeLogStats(void);
 
 /* rdpinput.c */
 int
@@ -535,7 +543,13 @@ rdpup_get_pixmap_image_rect(PixmapPtr pPixmap, struct image_data* id);
 int
 rdpup_init(void);
 int
+rdpup_nv12_capture(void);
+int
 rdpup_check(void);
+void
+rdpup_block_handler(pointer pTimeout);
+int
+rdpup_flush(void);
 int
 rdpup_begin_update(void);
 int
@@ -593,6 +607,8 @@ rdpup_check_alpha_dirty(PixmapPtr pDirtyPixmap, rdpPixmapRec* pDirtyPriv);
 int
 rdpup_check_dirty_screen(rdpPixmapRec* pDirtyPriv);
 int
+rdpup_pre_check(int in_size);
+int
 rdpup_add_char(int font, int charactor, short x, short y, int cx, int cy,
                char* bmpdata, int bmpdata_bytes);
 int
@@ -618,6 +634,8 @@ rdpScheduleDeferredUpdate(void);
 
 int
 rdpXvInit(ScreenPtr pScreen);
+void
+rdpXvScreenToNV12(BoxPtr box, char *y_plane, char *uv_plane, int stride);
 
 #if defined(X_BYTE_ORDER)
 #  if X_BYTE_ORDER == X_LITTLE_ENDIAN
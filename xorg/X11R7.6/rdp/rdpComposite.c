@@ -48,6 +48,13 @@ extern int g_con_number; /* in rdpup.c */
 extern int g_crc_seed; /* in rdpmisc.c */
 extern int g_crc_table[]; /* in rdpmisc.c */
 
+/* what happened to the composites that changed something remote, logged
+   and cleared on disconnect */
+static int g_com_remoted = 0; /* composite orders */
+static int g_com_fills = 0; /* solid fills sent as fill items */
+static int g_com_images = 0; /* done here and sent as images */
+static double g_com_image_pixels = 0;
+
 /******************************************************************************/
 int
 rdpCreatePicture(PicturePtr pPicture)
@@ -625,6 +632,132 @@ rdpRemoteComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
     return 0;
 }
 
+/******************************************************************************/
+/* returns boolean, the composite puts one opaque colour over the whole
+   rect so it can go out as a fill, *color is in screen pixel format */
+static int
+rdpCompositeSolid(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
+                  PicturePtr pDst, int* color)
+{
+    PixmapPtr pSrcPixmap;
+    CARD32 argb;
+    int depth;
+
+    if ((pMask != 0) || (pDst->alphaMap != 0) || (pSrc->alphaMap != 0))
+    {
+        return 0;
+    }
+    if ((op != PictOpSrc) && (op != PictOpOver))
+    {
+        return 0;
+    }
+    depth = pDst->pDrawable->depth;
+    if (g_Bpp == 4)
+    {
+        if ((depth != 24) && (depth != 32))
+        {
+            return 0;
+        }
+    }
+    else if ((g_Bpp != 2) || (depth != 16))
+    {
+        return 0;
+    }
+    if (pSrc->pDrawable == 0)
+    {
+        if ((pSrc->pSourcePict == 0) ||
+            (pSrc->pSourcePict->type != SourcePictTypeSolidFill))
+        {
+            return 0;
+        }
+        argb = pSrc->pSourcePict->solidFill.color;
+    }
+    else
+    {
+        /* 1x1 repeating pixmap */
+        if ((pSrc->pDrawable->type != DRAWABLE_PIXMAP) ||
+            (pSrc->pDrawable->width != 1) || (pSrc->pDrawable->height != 1) ||
+            (pSrc->repeatType == RepeatNone) || (pSrc->transform != 0))
+        {
+            return 0;
+        }
+        pSrcPixmap = (PixmapPtr)(pSrc->pDrawable);
+        if (pSrc->format == PICT_a8r8g8b8)
+        {
+            argb = *((CARD32*)(pSrcPixmap->devPrivate.ptr));
+        }
+        else if (pSrc->format == PICT_x8r8g8b8)
+        {
+            argb = *((CARD32*)(pSrcPixmap->devPrivate.ptr)) | 0xff000000;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    if ((op == PictOpOver) && ((argb >> 24) != 0xff))
+    {
+        /* blends with what is there */
+        return 0;
+    }
+    if ((op == PictOpSrc) && (depth == 32) && ((argb >> 24) != 0xff))
+    {
+        /* the alpha would be lost */
+        return 0;
+    }
+    if (g_Bpp == 4)
+    {
+        *color = argb & 0xffffff;
+    }
+    else
+    {
+        *color = (((argb >> 19) & 0x1f) << 11) | (((argb >> 10) & 0x3f) << 5) |
+                 ((argb >> 3) & 0x1f);
+    }
+    return 1;
+}
+
+/******************************************************************************/
+/* counts a composite done here once it went out, reg is what was sent */
+static void
+rdpCompositeCount(RegionPtr reg, int fill)
+{
+    BoxPtr box;
+    int j;
+
+    if (!RegionNotEmpty(reg))
+    {
+        return;
+    }
+    if (fill)
+    {
+        g_com_fills++;
+        return;
+    }
+    g_com_images++;
+    for (j = REGION_NUM_RECTS(reg) - 1; j >= 0; j--)
+    {
+        box = REGION_RECTS(reg) + j;
+        g_com_image_pixels += (box->x2 - box->x1) * (box->y2 - box->y1);
+    }
+}
+
+/******************************************************************************/
+void
+rdpCompositeLogStats(void)
+{
+    if (g_com_remoted + g_com_fills + g_com_images > 0)
+    {
+        LLOGLN(0, ("rdpCompositeLogStats: %d remoted %d fills %d images "
+               "%.0f image pixels", g_com_remoted, g_com_fills, g_com_images,
+               g_com_image_pixels));
+    }
+    g_com_remoted = 0;
+    g_com_fills = 0;
+    g_com_images = 0;
+    g_com_image_pixels = 0;
+}
+
 /******************************************************************************/
 static void
 rdpCompositeOrg(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
@@ -679,6 +812,7 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
     int post_process;
     int reset_surface;
     int got_id;
+    int fill_color;
     WindowPtr pDstWnd;
     PixmapPtr pDstPixmap;
     rdpPixmapRec* pDstPriv;
@@ -716,6 +850,7 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
     {
         rdpCompositeOrg(op, pSrc, pMask, pDst, xSrc, ySrc,
                         xMask, yMask, xDst, yDst, width, height);
+        g_com_remoted++;
         return;
     }
 
@@ -784,7 +919,14 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
     {
         return;
     }
-    
+
+    /* a solid colour goes out as a fill, every client does fills */
+    if ((dirty_type != 0) &&
+        rdpCompositeSolid(op, pSrc, pMask, pDst, &fill_color))
+    {
+        dirty_type = RDI_FILL;
+    }
+
     if (pDst->pCompositeClip != 0)
     {
         box.x1 = p->x + xDst;
@@ -795,9 +937,15 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
         RegionInit(&reg2, NullBox, 0);
         RegionCopy(&reg2, pDst->pCompositeClip);
         RegionIntersect(&reg1, &reg1, &reg2);
-        if (dirty_type != 0)
+        if (dirty_type == RDI_FILL)
+        {
+            draw_item_add_fill_region(pDirtyPriv, &reg1, fill_color, GXcopy);
+            rdpCompositeCount(&reg1, 1);
+        }
+        else if (dirty_type != 0)
         {
             draw_item_add_img_region(pDirtyPriv, &reg1, GXcopy, dirty_type, TAG_COMPOSITE);
+            rdpCompositeCount(&reg1, 0);
         }
         else if (got_id)
         {
@@ -811,6 +959,7 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
                     rdpup_send_area(&id, box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1);
                 }
                 rdpup_end_update();
+                rdpCompositeCount(&reg1, 0);
             }
         }
         RegionUninit(&reg1);
@@ -822,10 +971,18 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
         box.y1 = p->y + yDst;
         box.x2 = box.x1 + width;
         box.y2 = box.y1 + height;
-        if (dirty_type != 0)
+        if (dirty_type == RDI_FILL)
+        {
+            RegionInit(&reg1, &box, 0);
+            draw_item_add_fill_region(pDirtyPriv, &reg1, fill_color, GXcopy);
+            rdpCompositeCount(&reg1, 1);
+            RegionUninit(&reg1);
+        }
+        else if (dirty_type != 0)
         {
             RegionInit(&reg1, &box, 0);
             draw_item_add_img_region(pDirtyPriv, &reg1, GXcopy, dirty_type, TAG_COMPOSITE);
+            rdpCompositeCount(&reg1, 0);
             RegionUninit(&reg1);
         }
         else if (got_id)
@@ -833,6 +990,9 @@ rdpComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
             rdpup_begin_update();
             rdpup_send_area(&id, box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1);
             rdpup_end_update();
+            RegionInit(&reg1, &box, 0);
+            rdpCompositeCount(&reg1, 0);
+            RegionUninit(&reg1);
         }
     }
     if (reset_surface)
@@ -403,22 +403,161 @@ rdpCloseScreen(int i, ScreenPtr pScreen)
     return 1;
 }
 
+/* how far back a new opaque item looks for items it covers */
+#define DRAW_ITEM_CULL_DEPTH 16
+/* more than this many items at pack time go out as one image */
+#define DRAW_ITEM_PACK_MAX 256
+
+/******************************************************************************/
+/* returns boolean, the item draws every pixel of its region with no regard
+   to what was there */
+static int
+draw_item_is_opaque(struct rdp_draw_item *di)
+{
+    switch (di->type)
+    {
+        case RDI_FILL:
+            return di->u.fill.opcode == GXcopy;
+        case RDI_IMGLL:
+        case RDI_IMGLY:
+            return di->u.img.opcode == GXcopy;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* returns boolean, drawing twice with opcode is the same as drawing once */
+static int
+draw_item_opcode_is_idempotent(int opcode)
+{
+    switch (opcode)
+    {
+        case GXclear:
+        case GXand:
+        case GXcopy:
+        case GXor:
+        case GXset:
+            return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* returns boolean, di can be unioned into the tail item, where the regions
+   overlap the union draws once so that is only done for an opcode like
+   GXcopy, a GXxor or GXinvert pair has to stay two items */
+static int
+draw_item_can_merge(struct rdp_draw_item *tail, struct rdp_draw_item *di)
+{
+    RegionRec reg;
+    int opcode;
+    int rv;
+
+    if (tail->type != di->type)
+    {
+        return 0;
+    }
+    switch (di->type)
+    {
+        case RDI_FILL:
+            if ((tail->u.fill.fg_color != di->u.fill.fg_color) ||
+                (tail->u.fill.opcode != di->u.fill.opcode))
+            {
+                return 0;
+            }
+            opcode = di->u.fill.opcode;
+            break;
+        case RDI_IMGLL:
+        case RDI_IMGLY:
+            if (tail->u.img.opcode != di->u.img.opcode)
+            {
+                return 0;
+            }
+            opcode = di->u.img.opcode;
+            break;
+        default:
+            return 0;
+    }
+    if (draw_item_opcode_is_idempotent(opcode))
+    {
+        return 1;
+    }
+    RegionInit(&reg, NullBox, 0);
+    RegionIntersect(&reg, tail->reg, di->reg);
+    rv = !RegionNotEmpty(&reg);
+    RegionUninit(&reg);
+    return rv;
+}
+
+/******************************************************************************/
+/* removes the last few items that di draws all over
+   fills, images, lines and text only change pixels in their own region,
+   reading at most the pixel they draw over, so whatever a covered item
+   left there is drawn over by di before anything can see it, the items
+   between them can stay in order
+   a screen blt is the one item that reads pixels somewhere else, what it
+   copies from could be in a covered item and end up outside di, so
+   nothing before it is removed */
+static void
+draw_item_cull(rdpPixmapRec *priv, struct rdp_draw_item *di)
+{
+    struct rdp_draw_item *di_prev;
+    struct rdp_draw_item *di_hold;
+    int depth;
+
+    di_prev = priv->draw_item_tail;
+    depth = 0;
+    while ((di_prev != 0) && (depth < DRAW_ITEM_CULL_DEPTH))
+    {
+        if (di_prev->type == RDI_SCRBLT)
+        {
+            break;
+        }
+        di_hold = di_prev->prev;
+        if (RegionContainsRect(di->reg, RegionExtents(di_prev->reg)) == rgnIN)
+        {
+            LLOGLN(10, ("draw_item_cull: removing covered item type %d",
+                   di_prev->type));
+            draw_item_remove(priv, di_prev);
+        }
+        di_prev = di_hold;
+        depth++;
+    }
+}
+
 /******************************************************************************/
 int
 draw_item_add(rdpPixmapRec *priv, struct rdp_draw_item *di)
 {
     priv->is_alpha_dirty_not = 0;
-    
-    if (priv->draw_item_tail == 0)
+
+    if ((priv->draw_item_tail != 0) &&
+        draw_item_can_merge(priv->draw_item_tail, di))
     {
-        priv->draw_item_tail = di;
-        priv->draw_item_head = di;
+        /* same kind of item as the last one, one item with both regions */
+        RegionUnion(priv->draw_item_tail->reg, priv->draw_item_tail->reg,
+                    di->reg);
+        RegionDestroy(di->reg);
+        g_free(di);
     }
     else
     {
-        di->prev = priv->draw_item_tail;
-        priv->draw_item_tail->next = di;
-        priv->draw_item_tail = di;
+        if (draw_item_is_opaque(di))
+        {
+            draw_item_cull(priv, di);
+        }
+        if (priv->draw_item_tail == 0)
+        {
+            priv->draw_item_tail = di;
+            priv->draw_item_head = di;
+        }
+        else
+        {
+            di->prev = priv->draw_item_tail;
+            priv->draw_item_tail->next = di;
+            priv->draw_item_tail = di;
+        }
+        priv->draw_item_count++;
     }
 
     if (priv == &g_screenPriv)
@@ -468,6 +607,7 @@ draw_item_remove(rdpPixmapRec *priv, struct rdp_draw_item *di)
 
     RegionDestroy(di->reg);
     g_free(di);
+    priv->draw_item_count--;
     return 0;
 }
 
@@ -628,6 +768,35 @@ region_interect_at_all(RegionPtr reg_small, RegionPtr reg_big)
     return rv;
 }
 
+/******************************************************************************/
+/* an image item sends what is in the frame buffer when it goes out, so
+   anything before it in the same place will be drawn over, used when the
+   output is backed up so the list does not grow without bound */
+int
+draw_item_drop_covered(rdpPixmapRec *priv)
+{
+    struct rdp_draw_item *di;
+    RegionRec covered;
+
+    RegionInit(&covered, NullBox, 0);
+    di = priv->draw_item_tail;
+    while (di != 0)
+    {
+        if (RegionNotEmpty(&covered))
+        {
+            RegionSubtract(di->reg, di->reg, &covered);
+        }
+        if (((di->type == RDI_IMGLL) || (di->type == RDI_IMGLY)) &&
+            (di->u.img.opcode == GXcopy))
+        {
+            RegionUnion(&covered, &covered, di->reg);
+        }
+        di = di->prev;
+    }
+    RegionUninit(&covered);
+    return remove_empties(priv);
+}
+
 /******************************************************************************/
 int
 draw_item_pack(PixmapPtr pix, rdpPixmapRec *priv)
@@ -658,6 +827,25 @@ draw_item_pack(PixmapPtr pix, rdpPixmapRec *priv)
     }
 #endif
 
+    if (priv->draw_item_count > DRAW_ITEM_PACK_MAX)
+    {
+        /* too many to send one by one, the pixels are all in the frame
+           buffer so send what they cover as one image */
+        LLOGLN(10, ("draw_item_pack: %d items, sending as one image",
+               priv->draw_item_count));
+        RegionInit(&treg, NullBox, 0);
+        di = priv->draw_item_head;
+        while (di != 0)
+        {
+            RegionUnion(&treg, &treg, di->reg);
+            di = di->next;
+        }
+        draw_item_remove_all(priv);
+        draw_item_add_img_region(priv, &treg, GXcopy, RDI_IMGLL, TAG_OTHER);
+        RegionUninit(&treg);
+        return 0;
+    }
+
 #if 1
     /* look for repeating draw types */
     if (priv->draw_item_head != 0)
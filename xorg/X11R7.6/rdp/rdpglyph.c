@@ -72,65 +72,97 @@ struct font_cache
     int height;
     int crc;
     int stamp;
+    int used;
+    int next; /* next slot in the same hash bucket, -1 for none */
 };
 
+#define FONT_CACHE_SLOTS 250
+#define FONT_HASH_SIZE 256
+
 static struct font_cache g_font_cache[12][256];
+/* first slot of each bucket, -1 for none, keyed on the crc */
+static int g_font_hash[12][FONT_HASH_SIZE];
 static int g_stamp = 0;
+/* bit order of a byte reversed, pixman a1 is lsb first, rdp glyphs msb */
+static unsigned char g_bit_rev[256];
 
 /*****************************************************************************/
+/* one row of glyph bits, lsb first a1 or a8, to rdp msb first mono */
 static void
-set_mono_pixel(char* data, int x, int y, int width, int pixel)
+glyph_row_to_mono(const unsigned char *src, int depth, int width,
+                  unsigned char *dst)
 {
-    int start;
-    int shift;
-    
-    width = (width + 7) / 8;
-    start = (y * width) + x / 8;
-    shift = x % 8;
-    if (pixel != 0)
+    int index;
+    int bytes;
+    int bits;
+    int mono;
+
+    bytes = width / 8;
+    if (depth == 1)
     {
-        data[start] = data[start] | (0x80 >> shift);
+        for (index = 0; index < bytes; index++)
+        {
+            dst[index] = g_bit_rev[src[index]];
+        }
+        if (width & 7)
+        {
+            dst[bytes] = g_bit_rev[src[bytes]] & (0xff << (8 - (width & 7)));
+        }
+        return;
     }
-    else
+    for (index = 0; index < bytes; index++)
+    {
+        /* top bit of each alpha byte, same as alpha > 0x7f */
+        dst[index] = (src[0] & 0x80) | ((src[1] & 0x80) >> 1) |
+                     ((src[2] & 0x80) >> 2) | ((src[3] & 0x80) >> 3) |
+                     ((src[4] & 0x80) >> 4) | ((src[5] & 0x80) >> 5) |
+                     ((src[6] & 0x80) >> 6) | ((src[7] & 0x80) >> 7);
+        src += 8;
+    }
+    bits = width & 7;
+    if (bits)
     {
-        data[start] = data[start] & ~(0x80 >> shift);
+        mono = 0;
+        for (index = 0; index < bits; index++)
+        {
+            mono |= (src[index] & 0x80) >> index;
+        }
+        dst[bytes] = mono;
     }
 }
 
 /*****************************************************************************/
-static int
-lget_pixel(char* data, int x, int y, int depth, int stride_bytes)
+/* one row of glyph bits, lsb first a1 or a8, to rdp a8 */
+static void
+glyph_row_to_alpha(const unsigned char *src, int depth, int width,
+                   unsigned char *dst)
 {
-    int start;
-    int shift;
-    
-    if (depth == 1)
+    int index;
+
+    if (depth == 8)
     {
-        start = (y * stride_bytes) + x / 8;
-        shift = x % 8;
-        return (data[start] & (0x01 << shift)) ? 0xff : 0;
+        memcpy(dst, src, width);
+        return;
     }
-    else if (depth == 8)
+    for (index = 0; index < width; index++)
     {
-        return data[y * stride_bytes + x];
+        dst[index] = (src[index >> 3] & (0x01 << (index & 7))) ? 0xff : 0;
     }
-    return 0;
 }
 
 /******************************************************************************/
 static int
 glyph_get_data(ScreenPtr pScreen, GlyphPtr glyph, struct rdp_font_char* rfd)
 {
-    int i;
     int j;
     int src_xoff;
     int src_yoff;
     int src_stride_bytes;
     int dst_stride_bytes;
+    int mono_stride_bytes;
     int hh;
     int ww;
     int src_depth;
-    unsigned char pixel;
     PicturePtr pPicture;
     pixman_image_t *src;
     uint32_t* pi32;
@@ -176,26 +208,21 @@ glyph_get_data(ScreenPtr pScreen, GlyphPtr glyph, struct rdp_font_char* rfd)
     rfd->height = glyph->info.height;
     pi32 = pixman_image_get_data(src);
     pi8 = (char*)pi32;
+    /* mono rows are not padded, the size is */
+    mono_stride_bytes = (rfd->width + 7) / 8;
     for (j = 0; j < rfd->height; j++)
     {
-        for (i = 0; i < rfd->width; i++)
+        if (g_do_alpha_glyphs)
         {
-            pixel = lget_pixel(pi8, i, j, src_depth, src_stride_bytes);
-            if (g_do_alpha_glyphs)
-            {
-                rfd->data[j * dst_stride_bytes + i] = pixel;
-            }
-            else
-            {
-                if (pixel > 0x7f)
-                {
-                    set_mono_pixel(rfd->data, i, j, rfd->width, 1);
-                }
-                else
-                {
-                    set_mono_pixel(rfd->data, i, j, rfd->width, 0);
-                }
-            }
+            glyph_row_to_alpha((unsigned char*)(pi8 + j * src_stride_bytes),
+                               src_depth, rfd->width,
+                               (unsigned char*)(rfd->data + j * dst_stride_bytes));
+        }
+        else
+        {
+            glyph_row_to_mono((unsigned char*)(pi8 + j * src_stride_bytes),
+                              src_depth, rfd->width,
+                              (unsigned char*)(rfd->data + j * mono_stride_bytes));
         }
     }
     free_pixman_pict(pPicture, src);
@@ -399,57 +426,101 @@ get_color(PicturePtr pPicture)
 }
 
 /******************************************************************************/
+/* returns the slot or -1 */
+static int
+find_char(int font, struct rdp_font_char* rfd, int crc)
+{
+    int index;
+    struct font_cache* fc;
+
+    index = g_font_hash[font][crc & (FONT_HASH_SIZE - 1)];
+    while (index != -1)
+    {
+        fc = &(g_font_cache[font][index]);
+        if ((fc->crc == crc) &&
+            (fc->width == rfd->width) &&
+            (fc->height == rfd->height) &&
+            (fc->offset == rfd->offset) &&
+            (fc->baseline == rfd->baseline))
+        {
+            return index;
+        }
+        index = fc->next;
+    }
+    return -1;
+}
+
+/******************************************************************************/
+static void
+unhash_char(int font, int char_index)
+{
+    int* pindex;
+    struct font_cache* fc;
+
+    fc = &(g_font_cache[font][char_index]);
+    pindex = &(g_font_hash[font][fc->crc & (FONT_HASH_SIZE - 1)]);
+    while (*pindex != -1)
+    {
+        if (*pindex == char_index)
+        {
+            *pindex = fc->next;
+            break;
+        }
+        pindex = &(g_font_cache[font][*pindex].next);
+    }
+    fc->next = -1;
+}
+
+/******************************************************************************/
+/* finds the char or takes the oldest slot for it, *is_new is set when the
+   char has to be sent */
 static int
-find_or_add_char(int font, struct rdp_font_char* rfd)
+find_or_add_char(int font, struct rdp_font_char* rfd, int* is_new)
 {
     int crc;
     int index;
     int char_index;
     int oldest;
-    
+    struct font_cache* fc;
+
     crc = get_crc(rfd->data, rfd->data_bytes);
     LLOGLN(10, ("find_or_add_char: crc 0x%8.8x", crc));
+    *is_new = 0;
+    char_index = find_char(font, rfd, crc);
+    g_stamp++;
+    if (char_index != -1)
+    {
+        g_font_cache[font][char_index].stamp = g_stamp;
+        LLOGLN(10, ("find_or_add_char: found char at %d %d", font, char_index));
+        return char_index;
+    }
+    /* only a miss looks at every slot */
     char_index = 0;
     oldest = 0x7fffffff;
-    for (index = 0; index < 250; index++)
+    for (index = 0; index < FONT_CACHE_SLOTS; index++)
     {
-        if ((g_font_cache[font][index].crc == crc) &&
-            (g_font_cache[font][index].width == rfd->width) &&
-            (g_font_cache[font][index].height == rfd->height) &&
-            (g_font_cache[font][index].offset == rfd->offset) &&
-            (g_font_cache[font][index].baseline == rfd->baseline))
-        {
-            g_stamp++;
-            g_font_cache[font][index].stamp = g_stamp;
-            LLOGLN(10, ("find_or_add_char: found char at %d %d", font, index));
-            return index;
-        }
         if (g_font_cache[font][index].stamp < oldest)
         {
             oldest = g_font_cache[font][index].stamp;
             char_index = index;
         }
     }
-    g_stamp++;
-    g_font_cache[font][char_index].stamp = g_stamp;
-    g_font_cache[font][char_index].crc = crc;
-    g_font_cache[font][char_index].width = rfd->width;
-    g_font_cache[font][char_index].height = rfd->height;
-    g_font_cache[font][char_index].offset = rfd->offset;
-    g_font_cache[font][char_index].baseline = rfd->baseline;
+    fc = &(g_font_cache[font][char_index]);
+    if (fc->used)
+    {
+        unhash_char(font, char_index);
+    }
+    fc->stamp = g_stamp;
+    fc->crc = crc;
+    fc->width = rfd->width;
+    fc->height = rfd->height;
+    fc->offset = rfd->offset;
+    fc->baseline = rfd->baseline;
+    fc->used = 1;
+    fc->next = g_font_hash[font][crc & (FONT_HASH_SIZE - 1)];
+    g_font_hash[font][crc & (FONT_HASH_SIZE - 1)] = char_index;
+    *is_new = 1;
     LLOGLN(10, ("find_or_add_char: adding char at %d %d", font, char_index));
-    if (rfd->bpp == 8)
-    {
-        rdpup_add_char_alpha(font, char_index, rfd->offset, rfd->baseline,
-                             rfd->width, rfd->height,
-                             rfd->data, rfd->data_bytes);
-    }
-    else
-    {
-        rdpup_add_char(font, char_index, rfd->offset, rfd->baseline,
-                       rfd->width, rfd->height,
-                       rfd->data, rfd->data_bytes);
-    }
     return char_index;
 }
 
@@ -460,19 +531,32 @@ rdp_text_chars_to_data(struct rdp_text* rtext)
     int index;
     int data_bytes;
     int char_index;
+    int is_new;
+    int new_bytes;
+    int char_indexes[256];
+    int char_new[256];
     struct rdp_font_char* rfd;
-    
+
     LLOGLN(10, ("rdp_text_chars_to_data: rtext->num_chars %d", rtext->num_chars));
     data_bytes = 0;
+    new_bytes = 0;
     for (index = 0; index < rtext->num_chars; index++)
     {
+        char_indexes[index] = -1;
+        char_new[index] = 0;
         rfd = rtext->chars[index];
         if (rfd == 0)
         {
             LLOGLN(0, ("rdp_text_chars_to_data: error rfd is nil"));
             continue;
         }
-        char_index = find_or_add_char(rtext->font, rfd);
+        char_index = find_or_add_char(rtext->font, rfd, &is_new);
+        char_indexes[index] = char_index;
+        if (is_new)
+        {
+            char_new[index] = 1;
+            new_bytes += 18 + rfd->data_bytes;
+        }
         rtext->data[data_bytes] = char_index;
         data_bytes++;
         if (rfd->incby > 127)
@@ -491,6 +575,35 @@ rdp_text_chars_to_data(struct rdp_text* rtext)
         }
     }
     rtext->data_bytes = data_bytes;
+
+    if (new_bytes > 0)
+    {
+        /* room for all the new chars and the text order so they go out
+           in one message */
+        rdpup_pre_check(new_bytes + 32 + data_bytes);
+        for (index = 0; index < rtext->num_chars; index++)
+        {
+            if (!char_new[index])
+            {
+                continue;
+            }
+            rfd = rtext->chars[index];
+            if (rfd->bpp == 8)
+            {
+                rdpup_add_char_alpha(rtext->font, char_indexes[index],
+                                     rfd->offset, rfd->baseline,
+                                     rfd->width, rfd->height,
+                                     rfd->data, rfd->data_bytes);
+            }
+            else
+            {
+                rdpup_add_char(rtext->font, char_indexes[index],
+                               rfd->offset, rfd->baseline,
+                               rfd->width, rfd->height,
+                               rfd->data, rfd->data_bytes);
+            }
+        }
+    }
     return 0;
 }
 
@@ -857,6 +970,21 @@ rdpGlyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 int
 rdpGlyphInit(void)
 {
+    int index;
+    int bit;
+
     memset(&g_font_cache, 0, sizeof(g_font_cache));
+    memset(&g_font_hash, 0xff, sizeof(g_font_hash));
+    for (index = 0; index < 256; index++)
+    {
+        g_bit_rev[index] = 0;
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (index & (1 << bit))
+            {
+                g_bit_rev[index] |= 0x80 >> bit;
+            }
+        }
+    }
     return 0;
 }
@@ -211,6 +211,7 @@ rdpWakeupHandler(int i, pointer blockData, unsigned long err,
 static void
 rdpBlockHandler1(pointer blockData, OSTimePtr pTimeout, pointer pReadmask)
 {
+    rdpup_block_handler(pTimeout);
 }
 
 /******************************************************************************/
@@ -218,6 +219,7 @@ static void
 rdpWakeupHandler1(pointer blockData, int result, pointer pReadmask)
 {
     rdpup_check();
+    rdpup_flush();
 }
 
 #if 0
@@ -578,7 +580,7 @@ rdpScreenInit(int index, ScreenPtr pScreen, int argc, char **argv)
 
     rdpGlyphInit();
 
-    //rdpXvInit(pScreen);
+    rdpXvInit(pScreen);
     
     rdpSetUDSRights();
 
@@ -24,6 +24,7 @@ the rest
 #include "rdp.h"
 
 #include <sys/un.h>
+#include <sys/uio.h>
 
 Bool noFontCacheExtension = 1;
 
@@ -246,6 +247,33 @@ g_tcp_send(int sck, void *ptr, int len, int flags)
     return send(sck, ptr, len, flags);
 }
 
+/*****************************************************************************/
+/* like g_tcp_send but passes fd along with the first byte sent, unix
+   domain sockets only */
+int
+g_sck_send_fd(int sck, void *ptr, int len, int flags, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base = ptr;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sck, &msg, flags);
+}
+
 /*****************************************************************************/
 void *
 g_malloc(int size, int zero)
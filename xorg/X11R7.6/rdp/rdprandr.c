@@ -121,6 +121,57 @@ rdpInvalidateArea(ScreenPtr pScreen, int x, int y, int cx, int cy)
     return 0;
 }
 
+/******************************************************************************/
+/* keeps what is on the screen where the old and new sizes overlap, the rows
+   move when the line pitch changes, so only the new area has to be drawn */
+static void
+rdpRRMoveFrameBuffer(int old_width, int old_height, int old_pitch)
+{
+    char *old_fb;
+    char *new_fb;
+    int bytes;
+    int lines;
+    int index;
+
+    old_fb = g_rdpScreen.pfbMemory;
+    new_fb = old_fb;
+    if (g_rdpScreen.sizeInBytes > g_rdpScreen.sizeInBytesAlloc)
+    {
+        new_fb = (char *)g_malloc(g_rdpScreen.sizeInBytes, 1);
+        ErrorF("new buffer size %d\n", g_rdpScreen.sizeInBytes);
+    }
+    if (old_fb != 0)
+    {
+        bytes = MIN(old_width, g_rdpScreen.width) *
+                (g_rdpScreen.bitsPerPixel / 8);
+        lines = MIN(old_height, g_rdpScreen.height);
+        if (g_rdpScreen.paddedWidthInBytes > old_pitch)
+        {
+            /* rows spread out, start at the bottom */
+            for (index = lines - 1; index >= 0; index--)
+            {
+                memmove(new_fb + index * g_rdpScreen.paddedWidthInBytes,
+                        old_fb + index * old_pitch, bytes);
+            }
+        }
+        else if ((g_rdpScreen.paddedWidthInBytes < old_pitch) ||
+                 (new_fb != old_fb))
+        {
+            for (index = 0; index < lines; index++)
+            {
+                memmove(new_fb + index * g_rdpScreen.paddedWidthInBytes,
+                        old_fb + index * old_pitch, bytes);
+            }
+        }
+    }
+    if (new_fb != old_fb)
+    {
+        g_free(old_fb);
+        g_rdpScreen.pfbMemory = new_fb;
+        g_rdpScreen.sizeInBytesAlloc = g_rdpScreen.sizeInBytes;
+    }
+}
+
 /******************************************************************************/
 Bool
 rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height,
@@ -128,6 +179,11 @@ rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height,
 {
     PixmapPtr screenPixmap;
     BoxRec box;
+    int old_width;
+    int old_height;
+    int old_pitch;
+    CARD32 start_time;
+    CARD32 fb_time;
 
     ErrorF("rdpRRScreenSetSize: width %d height %d mmWidth %d mmHeight %d\n",
            width, height, (int)mmWidth, (int)mmHeight);
@@ -138,6 +194,11 @@ rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height,
         return FALSE;
     }
 
+    start_time = GetTimeInMillis();
+    old_width = g_rdpScreen.width;
+    old_height = g_rdpScreen.height;
+    old_pitch = g_rdpScreen.paddedWidthInBytes;
+
     g_rdpScreen.width = width;
     g_rdpScreen.height = height;
     g_rdpScreen.paddedWidthInBytes =
@@ -156,13 +217,7 @@ rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height,
         ErrorF("  resizing screenPixmap [%p] to %dx%d, currently at %dx%d\n",
                (void *)screenPixmap, width, height,
                screenPixmap->drawable.width, screenPixmap->drawable.height);
-        if (g_rdpScreen.sizeInBytes > g_rdpScreen.sizeInBytesAlloc)
-        {
-            g_free(g_rdpScreen.pfbMemory);
-            g_rdpScreen.pfbMemory = (char*)g_malloc(g_rdpScreen.sizeInBytes, 1);
-            g_rdpScreen.sizeInBytesAlloc = g_rdpScreen.sizeInBytes;
-            ErrorF("new buffer size %d\n", g_rdpScreen.sizeInBytes);
-        }
+        rdpRRMoveFrameBuffer(old_width, old_height, old_pitch);
         pScreen->ModifyPixmapHeader(screenPixmap, width, height,
                                     g_rdpScreen.depth, g_rdpScreen.bitsPerPixel,
                                     g_rdpScreen.paddedWidthInBytes,
@@ -182,12 +237,25 @@ rdpRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height,
     RegionBreak(&pScreen->root->clipList);
     pScreen->root->drawable.width = width;
     pScreen->root->drawable.height = height;
+    fb_time = GetTimeInMillis();
     ResizeChildrenWinSize(pScreen->root, 0, 0, 0, 0);
     RRGetInfo(pScreen, 1);
     RRScreenSizeNotify(pScreen);
-    rdpInvalidateArea(g_pScreen, 0, 0, g_rdpScreen.width, g_rdpScreen.height);
-    ErrorF("  screen resized to %dx%d\n",
-           pScreen->width, pScreen->height);
+    /* the overlap is still good in the frame buffer, only what was not on
+       the screen before has to be drawn by the windows */
+    if (width > old_width)
+    {
+        rdpInvalidateArea(g_pScreen, old_width, 0,
+                          width - old_width, height);
+    }
+    if (height > old_height)
+    {
+        rdpInvalidateArea(g_pScreen, 0, old_height,
+                          MIN(width, old_width), height - old_height);
+    }
+    ErrorF("  screen resized to %dx%d, frame buffer %d ms windows %d ms\n",
+           pScreen->width, pScreen->height, (int)(fb_time - start_time),
+           (int)(GetTimeInMillis() - fb_time));
     return TRUE;
 }
 
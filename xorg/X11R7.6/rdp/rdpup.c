@@ -22,11 +22,25 @@
 #include "rdp.h"
 #include "xrdp_rail.h"
 #include "rdpglyph.h"
+#include "pixel_convert.h"
+#include "pointer_hash.h"
 
 #include <signal.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+
+/* older headers do not have the memfd sealing names */
+#if !defined(MFD_ALLOW_SEALING)
+#define MFD_ALLOW_SEALING 0x0002
+#endif
+#if !defined(F_ADD_SEALS)
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SHRINK 0x0002
+#endif
 
 //    do { if (_level < LOG_LEVEL) { ErrorF _args ; } } while (0)
 //    do { if (_level < LOG_LEVEL) { ErrorF _args ; ErrorF("\n"); } } while (0)
@@ -34,9 +48,16 @@
 static int g_use_shmem = 1; /* turns on or off */
 static int g_shmemid = -1;
 static char *g_shmemptr = 0;
+static int g_shmem_bytes = 0; /* size of the segment at g_shmemptr */
 static int g_shmem_lineBytes = 0;
 static RegionPtr g_shm_reg = 0;
 
+/* screen in a memfd passed to xrdp, used instead of the pixels in orders
+ when xrdp asks for it with message 111 */
+static int g_memfd = -1;
+static char *g_memfd_ptr = 0;
+static int g_memfd_bytes = 0;
+
 static int g_rect_id_ack = 0;
 static int g_rect_id = 0;
 
@@ -82,18 +103,74 @@ struct rdpup_os_bitmap {
 	PixmapPtr pixmap;
 	rdpPixmapPtr priv;
 	int stamp;
+	int bytes; /* what the surface takes in the client */
+	int lru_prev; /* toward older, -1 if the oldest */
+	int lru_next; /* toward newer, -1 if the newest */
 };
 
-#define USE_MAX_OS_BYTES 1
+/* upper limit, the client's offscreen cache size is used when smaller */
 #define MAX_OS_BYTES (16 * 1024 * 1024)
 static struct rdpup_os_bitmap *g_os_bitmaps = 0;
 static int g_max_os_bitmaps = 0;
 static int g_os_bitmap_stamp = 0;
 static int g_os_bitmap_alloc_size = 0;
+static int g_os_bitmap_max_bytes = MAX_OS_BYTES;
+static int g_os_lru_head = -1; /* least recently used */
+static int g_os_lru_tail = -1; /* most recently used */
+/* off screen stats, logged on disconnect */
+static int g_os_hits = 0;
+static int g_os_misses = 0;
+static int g_os_evictions = 0;
+static double g_os_bytes_saved = 0;
 
 static int g_pixmap_byte_total = 0;
 static int g_pixmap_num_used = 0;
 
+/* hashes of the cursors sent in full, after that only the hash is sent and
+ xrdp finds it in its pointer cache, if it is not there any more xrdp asks
+ for all of it with message 302 */
+#define MAX_CURSOR_HASHES 64
+static int g_cursor_hashes[MAX_CURSOR_HASHES];
+static int g_cursor_hash_next = 0; /* the one replaced next */
+static int g_cursor_hash_ok = 0; /* xup knows order 52 */
+/* last cursor, the same one is not sent again */
+static int g_cursor_hash = 0; /* 0 if none */
+static int g_cursor_hot_x = 0;
+static int g_cursor_hot_y = 0;
+static int g_cursor_bpp = 0;
+static char g_cursor_data[32 * (32 * 4)];
+static char g_cursor_mask[32 * (32 / 8)];
+static int g_cursor_sends = 0;
+static int g_cursor_hash_sends = 0;
+static int g_cursor_skips = 0;
+static int g_cursor_resends = 0;
+
+/* what could not be sent to xrdp yet, flushed from the block and wakeup
+ handlers so the X server never waits on xrdp */
+struct rdpup_out_item {
+	struct rdpup_out_item *next;
+	int len;
+	int sent;
+	int fd; /* passed with the first byte, -1 for none */
+	char *data;
+};
+
+/* over this the screen updates are held back and merged */
+#define OUT_QUEUE_HIGH (4 * 1024 * 1024)
+/* over this or no progress for this long, xrdp is gone */
+#define OUT_QUEUE_MAX (64 * 1024 * 1024)
+#define OUT_QUEUE_STALL_MS (30 * 1000)
+static struct rdpup_out_item *g_out_head = 0;
+static struct rdpup_out_item *g_out_tail = 0;
+static int g_out_bytes = 0; /* not sent yet */
+static int g_out_peak = 0;
+static int g_out_coalesced = 0; /* screen updates held back */
+static CARD32 g_out_progress_ms = 0; /* last time anything got sent */
+
+static void rdpup_out_free(void);
+static int rdpup_send_cursor_ex(void);
+int convert_pixels(void *src, void *dst, int num_pixels);
+
 struct rdpup_top_window {
 	WindowPtr wnd;
 	struct rdpup_top_window *next;
@@ -191,6 +268,16 @@ static int rdpup_disconnect(void) {
 	}
 
 	RemoveEnabledDevice(g_sck);
+	rdpup_out_free();
+	rdpCompositeLogStats();
+	if (g_memfd_ptr != 0) {
+		/* the next xrdp asks again if it wants it */
+		munmap(g_memfd_ptr, g_memfd_bytes);
+		close(g_memfd);
+		g_memfd_ptr = 0;
+		g_memfd_bytes = 0;
+		g_memfd = -1;
+	}
 	g_connected = 0;
 	g_tcp_close(g_sck);
 	g_sck = 0;
@@ -210,22 +297,97 @@ static int rdpup_disconnect(void) {
 	}
 	g_os_bitmap_alloc_size = 0;
 
+	g_os_lru_head = -1;
+	g_os_lru_tail = -1;
+	if (g_os_hits + g_os_misses > 0) {
+		LLOGLN(0,
+				("rdpup_disconnect: off screen %d hits %d misses %d evictions, " "%.0f bytes of blt pixels not sent", g_os_hits, g_os_misses, g_os_evictions, g_os_bytes_saved));
+	}
+	g_os_hits = 0;
+	g_os_misses = 0;
+	g_os_evictions = 0;
+	g_os_bytes_saved = 0;
 	g_max_os_bitmaps = 0;
 	g_free(g_os_bitmaps);
 	g_os_bitmaps = 0;
+	if (g_cursor_sends > 0) {
+		LLOGLN(0, ("rdpup_disconnect: cursor %d sent %d by hash %d not sent "
+				"again %d asked for again", g_cursor_sends, g_cursor_hash_sends,
+				g_cursor_skips, g_cursor_resends));
+	}
+	memset(g_cursor_hashes, 0, sizeof(g_cursor_hashes));
+	g_cursor_hash_next = 0;
+	g_cursor_hash_ok = 0;
+	g_cursor_hash = 0;
+	g_cursor_sends = 0;
+	g_cursor_hash_sends = 0;
+	g_cursor_skips = 0;
+	g_cursor_resends = 0;
 	g_use_rail = 0;
 	g_do_glyph_cache = 0;
 	g_do_composite = 0;
 	return 0;
 }
 
+/*****************************************************************************/
+static void rdpup_os_lru_unlink(int rdpindex) {
+	struct rdpup_os_bitmap *os;
+
+	os = g_os_bitmaps + rdpindex;
+	if (os->lru_prev == -1) {
+		g_os_lru_head = os->lru_next;
+	} else {
+		g_os_bitmaps[os->lru_prev].lru_next = os->lru_next;
+	}
+	if (os->lru_next == -1) {
+		g_os_lru_tail = os->lru_prev;
+	} else {
+		g_os_bitmaps[os->lru_next].lru_prev = os->lru_prev;
+	}
+	os->lru_prev = -1;
+	os->lru_next = -1;
+}
+
+/*****************************************************************************/
+/* makes rdpindex the most recently used */
+static void rdpup_os_lru_append(int rdpindex) {
+	struct rdpup_os_bitmap *os;
+
+	os = g_os_bitmaps + rdpindex;
+	os->lru_prev = g_os_lru_tail;
+	os->lru_next = -1;
+	if (g_os_lru_tail == -1) {
+		g_os_lru_head = rdpindex;
+	} else {
+		g_os_bitmaps[g_os_lru_tail].lru_next = rdpindex;
+	}
+	g_os_lru_tail = rdpindex;
+	os->stamp = g_os_bitmap_stamp;
+	g_os_bitmap_stamp++;
+}
+
+/*****************************************************************************/
+/* drops the least recently used surface here and in xrdp, returns error */
+static int rdpup_os_evict(void) {
+	int rdpindex;
+
+	rdpindex = g_os_lru_head;
+	if (rdpindex == -1) {
+		return 1;
+	}
+	LLOGLN(10,
+			("rdpup_os_evict: index %d stamp %d", rdpindex, g_os_bitmaps[rdpindex].stamp));
+	rdpup_remove_os_bitmap(rdpindex);
+	rdpup_delete_os_surface(rdpindex);
+	g_os_evictions++;
+	return 0;
+}
+
 /*****************************************************************************/
 /* returns -1 on error */
 int rdpup_add_os_bitmap(PixmapPtr pixmap, rdpPixmapPtr priv) {
 	int index;
 	int rv;
-	int oldest;
-	int oldest_index;
 	int this_bytes;
 
 	LLOGLN(10, ("rdpup_add_os_bitmap:"));
@@ -239,91 +401,54 @@ int rdpup_add_os_bitmap(PixmapPtr pixmap, rdpPixmapPtr priv) {
 		return -1;
 	}
 
-	this_bytes = pixmap->devKind * pixmap->drawable.height;
-	if (this_bytes > MAX_OS_BYTES) {
+	/* what the surface takes in the client, the width gets rounded up to 4
+	 when it's made */
+	this_bytes = ((pixmap->drawable.width + 3) & ~3) * pixmap->drawable.height
+			* g_rdpScreen.rdp_Bpp;
+	if (this_bytes > g_os_bitmap_max_bytes) {
 		LLOGLN(10,
-				("rdpup_add_os_bitmap: error, too big this_bytes %d " "width %d height %d", this_bytes, pixmap->drawable.height, pixmap->drawable.height));
+				("rdpup_add_os_bitmap: error, too big this_bytes %d " "width %d height %d", this_bytes, pixmap->drawable.width, pixmap->drawable.height));
 		return -1;
 	}
 
-	oldest = 0x7fffffff;
-	oldest_index = -1;
-	rv = -1;
-	index = 0;
+	/* make room, oldest first */
+	while (g_os_bitmap_alloc_size + this_bytes > g_os_bitmap_max_bytes) {
+		LLOGLN(10,
+				("rdpup_add_os_bitmap: must delete g_pixmap_num_used %d", g_pixmap_num_used));
+		if (rdpup_os_evict() != 0) {
+			LLOGLN(0, ("rdpup_add_os_bitmap: error 1"));
+			break;
+		}
+	}
 
-	while (index < g_max_os_bitmaps) {
+	rv = -1;
+	for (index = 0; index < g_max_os_bitmaps; index++) {
 		if (g_os_bitmaps[index].used == 0) {
-			g_os_bitmaps[index].used = 1;
-			g_os_bitmaps[index].pixmap = pixmap;
-			g_os_bitmaps[index].priv = priv;
-			g_os_bitmaps[index].stamp = g_os_bitmap_stamp;
-			g_os_bitmap_stamp++;
-			g_pixmap_num_used++;
 			rv = index;
 			break;
-		} else {
-			if (g_os_bitmaps[index].stamp < oldest) {
-				oldest = g_os_bitmaps[index].stamp;
-				oldest_index = index;
-			}
 		}
-		index++;
 	}
 
 	if (rv == -1) {
-		if (oldest_index == -1) {
+		LLOGLN(10, ("rdpup_add_os_bitmap: too many pixmaps removing oldest"));
+		rv = g_os_lru_head;
+		if (rv == -1) {
 			LLOGLN(0, ("rdpup_add_os_bitmap: error"));
-		} else {
-			LLOGLN(10,
-					("rdpup_add_os_bitmap: too many pixmaps removing " "oldest_index %d", oldest_index));
-			rdpup_remove_os_bitmap(oldest_index);
-			rdpup_delete_os_surface(oldest_index);
-			g_os_bitmaps[oldest_index].used = 1;
-			g_os_bitmaps[oldest_index].pixmap = pixmap;
-			g_os_bitmaps[oldest_index].priv = priv;
-			g_os_bitmaps[oldest_index].stamp = g_os_bitmap_stamp;
-			g_os_bitmap_stamp++;
-			g_pixmap_num_used++;
-			rv = oldest_index;
+			return -1;
 		}
+		rdpup_os_evict();
 	}
 
-	if (rv < 0) {
-		LLOGLN(10, ("rdpup_add_os_bitmap: test error 3"));
-		return rv;
-	}
-
+	g_os_bitmaps[rv].used = 1;
+	g_os_bitmaps[rv].pixmap = pixmap;
+	g_os_bitmaps[rv].priv = priv;
+	g_os_bitmaps[rv].bytes = this_bytes;
+	rdpup_os_lru_append(rv);
+	g_pixmap_num_used++;
+	g_os_misses++;
 	g_os_bitmap_alloc_size += this_bytes;
 	LLOGLN(10,
 			("rdpup_add_os_bitmap: this_bytes %d g_os_bitmap_alloc_size %d", this_bytes, g_os_bitmap_alloc_size));
-#if USE_MAX_OS_BYTES
-	while (g_os_bitmap_alloc_size > MAX_OS_BYTES) {
-		LLOGLN(10,
-				("rdpup_add_os_bitmap: must delete g_pixmap_num_used %d", g_pixmap_num_used));
-		/* find oldest */
-		oldest = 0x7fffffff;
-		oldest_index = -1;
-		index = 0;
-		while (index < g_max_os_bitmaps) {
-			if (g_os_bitmaps[index].used
-					&& (g_os_bitmaps[index].stamp < oldest)) {
-				oldest = g_os_bitmaps[index].stamp;
-				oldest_index = index;
-			}
-			index++;
-		}
-		if (oldest_index == -1) {
-			LLOGLN(0, ("rdpup_add_os_bitmap: error 1"));
-			break;
-		}
-		if (oldest_index == rv) {
-			LLOGLN(0, ("rdpup_add_os_bitmap: error 2"));
-			break;
-		}
-		rdpup_remove_os_bitmap(oldest_index);
-		rdpup_delete_os_surface(oldest_index);
-	}
-#endif
 	LLOGLN(10, ("rdpup_add_os_bitmap: new bitmap index %d", rv));
 	LLOGLN(10,
 			("rdpup_add_os_bitmap: g_pixmap_num_used %d " "g_os_bitmap_stamp 0x%8.8x", g_pixmap_num_used, g_os_bitmap_stamp));
@@ -334,32 +459,32 @@ int rdpup_add_os_bitmap(PixmapPtr pixmap, rdpPixmapPtr priv) {
 int rdpup_remove_os_bitmap(int rdpindex) {
 	PixmapPtr pixmap;
 	rdpPixmapPtr priv;
-	int this_bytes;
-
-	LLOGLN(10,
-			("rdpup_remove_os_bitmap: index %d stamp %d", rdpindex, g_os_bitmaps[rdpindex].stamp));
 
 	if (g_os_bitmaps == 0) {
 		LLOGLN(10, ("rdpup_remove_os_bitmap: test error 1"));
 		return 1;
 	}
 
-	if ((rdpindex < 0) && (rdpindex >= g_max_os_bitmaps)) {
+	if ((rdpindex < 0) || (rdpindex >= g_max_os_bitmaps)) {
 		LLOGLN(10, ("rdpup_remove_os_bitmap: test error 2"));
 		return 1;
 	}
 
+	LLOGLN(10,
+			("rdpup_remove_os_bitmap: index %d stamp %d", rdpindex, g_os_bitmaps[rdpindex].stamp));
+
 	if (g_os_bitmaps[rdpindex].used) {
 		pixmap = g_os_bitmaps[rdpindex].pixmap;
 		priv = g_os_bitmaps[rdpindex].priv;
 		draw_item_remove_all(priv);
-		this_bytes = pixmap->devKind * pixmap->drawable.height;
-		g_os_bitmap_alloc_size -= this_bytes;
+		g_os_bitmap_alloc_size -= g_os_bitmaps[rdpindex].bytes;
 		LLOGLN(10,
-				("rdpup_remove_os_bitmap: this_bytes %d " "g_os_bitmap_alloc_size %d", this_bytes, g_os_bitmap_alloc_size));
+				("rdpup_remove_os_bitmap: this_bytes %d " "g_os_bitmap_alloc_size %d", g_os_bitmaps[rdpindex].bytes, g_os_bitmap_alloc_size));
+		rdpup_os_lru_unlink(rdpindex);
 		g_os_bitmaps[rdpindex].used = 0;
 		g_os_bitmaps[rdpindex].pixmap = 0;
 		g_os_bitmaps[rdpindex].priv = 0;
+		g_os_bitmaps[rdpindex].bytes = 0;
 		g_pixmap_num_used--;
 		priv->status = 0;
 		priv->con_number = 0;
@@ -374,21 +499,24 @@ int rdpup_remove_os_bitmap(int rdpindex) {
 }
 
 /*****************************************************************************/
+/* the pixmap is drawn from or to while it's in the client, that is a hit,
+ its contents did not have to be sent */
 int rdpup_update_os_use(int rdpindex) {
-	LLOGLN(10,
-			("rdpup_update_use: index %d stamp %d", rdpindex, g_os_bitmaps[rdpindex].stamp));
-
 	if (g_os_bitmaps == 0) {
 		return 1;
 	}
 
-	if ((rdpindex < 0) && (rdpindex >= g_max_os_bitmaps)) {
+	if ((rdpindex < 0) || (rdpindex >= g_max_os_bitmaps)) {
 		return 1;
 	}
 
+	LLOGLN(10,
+			("rdpup_update_use: index %d stamp %d", rdpindex, g_os_bitmaps[rdpindex].stamp));
+
 	if (g_os_bitmaps[rdpindex].used) {
-		g_os_bitmaps[rdpindex].stamp = g_os_bitmap_stamp;
-		g_os_bitmap_stamp++;
+		rdpup_os_lru_unlink(rdpindex);
+		rdpup_os_lru_append(rdpindex);
+		g_os_hits++;
 	} else {
 		LLOGLN(0, ("rdpup_update_use: error rdpindex %d", rdpindex));
 	}
@@ -397,56 +525,183 @@ int rdpup_update_os_use(int rdpindex) {
 }
 
 /*****************************************************************************/
-/* returns error */
-static int rdpup_send(char *data, int len) {
-	int sent;
-	int all = len;
+static void rdpup_out_free(void) {
+	struct rdpup_out_item *item;
+
+	if (g_out_peak > 0) {
+		LLOGLN(0,
+				("rdpup_out_free: %d bytes dropped, queue peak %d bytes, " "%d screen updates held back", g_out_bytes, g_out_peak, g_out_coalesced));
+	}
+	while (g_out_head != 0) {
+		item = g_out_head;
+		g_out_head = item->next;
+		if (item->fd != -1) {
+			close(item->fd);
+		}
+		g_free(item);
+	}
+	g_out_tail = 0;
+	g_out_bytes = 0;
+	g_out_peak = 0;
+	g_out_coalesced = 0;
+}
+
+/*****************************************************************************/
+/* returns error, fd is passed with the first byte, the queue keeps its own
+ copy of it */
+static int rdpup_out_queue(char *data, int len, int fd) {
+	struct rdpup_out_item *item;
+
+	if (g_out_bytes + len > OUT_QUEUE_MAX) {
+		LLOGLN(0,
+				("rdpup_out_queue: xrdp is not reading, %d bytes waiting", g_out_bytes));
+		rdpup_disconnect();
+		return 1;
+	}
+	if (g_out_head == 0) {
+		g_out_progress_ms = GetTimeInMillis();
+	}
+	item = (struct rdpup_out_item *) g_malloc(
+			sizeof(struct rdpup_out_item) + len, 0);
+	item->next = 0;
+	item->len = len;
+	item->sent = 0;
+	item->fd = (fd == -1) ? -1 : dup(fd);
+	item->data = (char *) (item + 1);
+	memcpy(item->data, data, len);
+	if (g_out_tail == 0) {
+		g_out_head = item;
+	} else {
+		g_out_tail->next = item;
+	}
+	g_out_tail = item;
+	if ((g_out_bytes < OUT_QUEUE_HIGH) && (g_out_bytes + len >= OUT_QUEUE_HIGH)) {
+		LLOGLN(0,
+				("rdpup_out_queue: %d bytes waiting, holding back screen updates", g_out_bytes + len));
+	}
+	g_out_bytes += len;
+	g_out_peak = max(g_out_peak, g_out_bytes);
+	return 0;
+}
 
-	//
-	LLOGLN(10, ("rdpup_send - sending %d bytes", all));
+/*****************************************************************************/
+/* sends what it can without waiting, returns error */
+int rdpup_flush(void) {
+	struct rdpup_out_item *item;
+	int sent;
 
 	if (g_sck_closed) {
 		return 1;
 	}
-	int error = 0;
-	while (len > 0) {
-		LLOGLN(10, ("rdpup_send - sending %d / %d  ", len,all));
-		sent = g_tcp_send(g_sck, data, len, 0);
-		LLOGLN(10, ("rdpup_send - sending %d / %d ret sent: %d", len,all,sent));
+	while (g_out_head != 0) {
+		item = g_out_head;
+		if (item->fd != -1) {
+			sent = g_sck_send_fd(g_sck, item->data, item->len, 0, item->fd);
+			if (sent > 0) {
+				close(item->fd);
+				item->fd = -1;
+			}
+		} else {
+			sent = g_tcp_send(g_sck, item->data + item->sent,
+					item->len - item->sent, 0);
+		}
 		if (sent == -1) {
-
 			if (g_tcp_last_error_would_block(g_sck)) {
-				g_sleep(100);
-				error++;
-				if (error > 300) {
-					ErrorF(
-							"rdpup_send: time out on sending message (30s) %s for %d bytes",
-							strerror(errno), all);
-					rdpup_disconnect();
-					return 1;
-				}
+				break;
+			}
+			LLOGLN(0,
+					("rdpup_flush: g_tcp_send failed(returned -1) %s",strerror(errno)));
+			rdpup_disconnect();
+			return 1;
+		} else if (sent == 0) {
+			LLOGLN(0,
+					("rdpup_flush: g_tcp_send failed(returned zero) %s",strerror(errno)));
+			rdpup_disconnect();
+			return 1;
+		}
+		g_out_progress_ms = GetTimeInMillis();
+		item->sent += sent;
+		g_out_bytes -= sent;
+		if (item->sent >= item->len) {
+			g_out_head = item->next;
+			if (g_out_head == 0) {
+				g_out_tail = 0;
+			}
+			g_free(item);
+		}
+	}
+	if (g_out_head != 0) {
+		if (GetTimeInMillis() - g_out_progress_ms > OUT_QUEUE_STALL_MS) {
+			LLOGLN(0,
+					("rdpup_flush: time out on sending, %d bytes waiting", g_out_bytes));
+			rdpup_disconnect();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************/
+/* called before the X server waits, while there is output left wake up
+ soon to try again, the socket is not in the select write set */
+void rdpup_block_handler(pointer pTimeout) {
+	rdpup_flush();
+	if (g_out_head != 0) {
+		AdjustWaitForDelay(pTimeout, 10);
+	}
+}
+
+/*****************************************************************************/
+/* returns error, what can't be sent now is queued, never waits, fd is
+ passed with the first byte when not -1 */
+static int rdpup_send_fd(char *data, int len, int fd) {
+	int sent;
+
+	LLOGLN(10, ("rdpup_send - sending %d bytes", len));
+
+	if (g_sck_closed) {
+		return 1;
+	}
+
+	/* keep the order, only send now when nothing is waiting */
+	if (g_out_head == 0) {
+		while (len > 0) {
+			if (fd != -1) {
+				sent = g_sck_send_fd(g_sck, data, len, 0, fd);
 			} else {
+				sent = g_tcp_send(g_sck, data, len, 0);
+			}
+			if (sent == -1) {
+				if (g_tcp_last_error_would_block(g_sck)) {
+					break;
+				}
 				LLOGLN(0,
 						("rdpup_send: g_tcp_send failed(returned -1) %s",strerror(errno)));
 				rdpup_disconnect();
 				return 1;
+			} else if (sent == 0) {
+				LLOGLN(0,
+						("rdpup_send: g_tcp_send failed(returned zero) %s",strerror(errno)));
+				rdpup_disconnect();
+				return 1;
 			}
-		} else if (sent == 0) {
-			LLOGLN(0,
-					("rdpup_send: g_tcp_send failed(returned zero) %s",strerror(errno)));
-			rdpup_disconnect();
-			return 1;
-		} else {
-			error = 0;
-			LLOGLN(10, ("rdpup_send - sending %d / %d ok ", len,all));
 			data += sent;
 			len -= sent;
+			fd = -1;
 		}
 	}
-	LLOGLN(10, ("rdpup_send - sending %d bytes ok", all));
+
+	if (len > 0) {
+		return rdpup_out_queue(data, len, fd);
+	}
 	return 0;
 }
 
+/*****************************************************************************/
+static int rdpup_send(char *data, int len) {
+	return rdpup_send_fd(data, len, -1);
+}
+
 /******************************************************************************/
 static int rdpup_send_msg(struct stream *s) {
 	int len;
@@ -497,6 +752,206 @@ static int rdpup_send_pending(void) {
 	return rv;
 }
 
+/******************************************************************************/
+/* makes the screen memfd if it is not big enough and passes it to xrdp
+ with order 62, returns error */
+static int rdpup_send_memfd(void) {
+	struct stream *ls;
+	int bytes;
+	int len;
+	int rv;
+	int fd;
+	char *ptr;
+
+	bytes = g_rdpScreen.rdp_width * g_rdpScreen.rdp_height
+			* g_rdpScreen.rdp_Bpp;
+	if (bytes > g_memfd_bytes) {
+		if (g_memfd_ptr != 0) {
+			munmap(g_memfd_ptr, g_memfd_bytes);
+			close(g_memfd);
+			g_memfd_ptr = 0;
+			g_memfd_bytes = 0;
+			g_memfd = -1;
+		}
+#if defined(SYS_memfd_create)
+		fd = syscall(SYS_memfd_create, "X11rdp screen", MFD_ALLOW_SEALING);
+#else
+		fd = -1;
+#endif
+		if (fd == -1) {
+			LLOGLN(0, ("rdpup_send_memfd: memfd_create failed"));
+			return 1;
+		}
+		if (ftruncate(fd, bytes) != 0) {
+			LLOGLN(0, ("rdpup_send_memfd: ftruncate %d bytes failed", bytes));
+			close(fd);
+			return 1;
+		}
+		/* xrdp checks this, a file that can shrink under its mapping
+		 would fault it */
+		if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+			LLOGLN(0, ("rdpup_send_memfd: seal failed"));
+			close(fd);
+			return 1;
+		}
+		ptr = (char *) mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+				0);
+		if (ptr == MAP_FAILED) {
+			LLOGLN(0, ("rdpup_send_memfd: mmap %d bytes failed", bytes));
+			close(fd);
+			return 1;
+		}
+		g_memfd = fd;
+		g_memfd_ptr = ptr;
+		g_memfd_bytes = bytes;
+	}
+
+	make_stream(ls);
+	init_stream(ls, 8192);
+	s_push_layer(ls, iso_hdr, 8);
+	out_uint16_le(ls, 62); /* screen memfd */
+	out_uint16_le(ls, 12);
+	out_uint32_le(ls, bytes);
+	out_uint16_le(ls, g_rdpScreen.rdp_width);
+	out_uint16_le(ls, g_rdpScreen.rdp_height);
+	s_mark_end(ls);
+	len = (int) (ls->end - ls->data);
+	s_pop_layer(ls, iso_hdr);
+	out_uint16_le(ls, 3);
+	out_uint16_le(ls, 1);
+	out_uint32_le(ls, len - 8);
+
+	/* orders already made go before the fd */
+	rdpup_send_pending();
+	rv = rdpup_send_fd(ls->data, len, g_memfd);
+	free_stream(ls);
+	LLOGLN(0,
+			("rdpup_send_memfd: %dx%d %d bytes", g_rdpScreen.rdp_width, g_rdpScreen.rdp_height, bytes));
+	return rv;
+}
+
+/******************************************************************************/
+/* returns boolean, the screen memfd is NV12 for xrdp's h264 stage,
+ capture_code 3, instead of pixels in the client's format */
+int rdpup_nv12_capture(void) {
+	return (g_memfd_ptr != 0) && (g_Bpp == 4)
+			&& (g_rdpScreen.client_info.capture_code == 3);
+}
+
+/******************************************************************************/
+/* memfd mode, everything drawn on the screen is copied to the memfd and
+ xrdp gets one order 61 for all of it, acked with message 106 */
+static int rdpup_check_dirty_screen_memfd(rdpPixmapRec *pDirtyPriv) {
+	RegionRec reg;
+	RegionRec clip_reg;
+	BoxRec box;
+	BoxPtr rects;
+	struct rdp_draw_item *di;
+	char *s;
+	char *d;
+	int num_rects;
+	int index;
+	int lineBytes;
+	int size;
+	int ly;
+	int width;
+	int height;
+
+	RegionInit(&reg, NullBox, 0);
+	draw_item_pack(0, pDirtyPriv);
+	di = pDirtyPriv->draw_item_head;
+	while (di != 0) {
+		RegionUnion(&reg, &reg, di->reg);
+		di = di->next;
+	}
+	draw_item_remove_all(pDirtyPriv);
+	pDirtyPriv->is_dirty = 0;
+
+	box.x1 = 0;
+	box.y1 = 0;
+	box.x2 = min(g_rdpScreen.width, g_rdpScreen.rdp_width);
+	box.y2 = min(g_rdpScreen.height, g_rdpScreen.rdp_height);
+	RegionInit(&clip_reg, &box, 0);
+	RegionIntersect(&reg, &reg, &clip_reg);
+	RegionUninit(&clip_reg);
+
+	num_rects = REGION_NUM_RECTS(&reg);
+	rects = REGION_RECTS(&reg);
+	if (num_rects > 256) {
+		/* the order has room for this many, send the bounds */
+		num_rects = 1;
+		rects = RegionExtents(&reg);
+	}
+	if ((num_rects < 1) || !g_connected) {
+		RegionUninit(&reg);
+		return 0;
+	}
+
+	lineBytes = g_rdpScreen.rdp_width * g_rdpScreen.rdp_Bpp;
+	if (rdpup_nv12_capture()) {
+		/* chroma is per 2x2 block, so every rect grows to even */
+		width = min(g_rdpScreen.width, g_rdpScreen.rdp_width) & ~1;
+		height = min(g_rdpScreen.height, g_rdpScreen.rdp_height) & ~1;
+		d = g_memfd_ptr + g_rdpScreen.rdp_width * g_rdpScreen.rdp_height;
+		for (index = 0; index < num_rects; index++) {
+			box = rects[index];
+			box.x1 &= ~1;
+			box.y1 &= ~1;
+			box.x2 = min((box.x2 + 1) & ~1, width);
+			box.y2 = min((box.y2 + 1) & ~1, height);
+			if ((box.x2 > box.x1) && (box.y2 > box.y1)) {
+				rdpXvScreenToNV12(&box, g_memfd_ptr, d,
+						g_rdpScreen.rdp_width);
+			}
+		}
+	} else {
+		for (index = 0; index < num_rects; index++) {
+			box = rects[index];
+			s = g_rdpScreen.pfbMemory;
+			s += box.y1 * g_rdpScreen.paddedWidthInBytes + box.x1 * g_Bpp;
+			d = g_memfd_ptr;
+			d += box.y1 * lineBytes + box.x1 * g_rdpScreen.rdp_Bpp;
+			for (ly = box.y1; ly < box.y2; ly++) {
+				convert_pixels(s, d, box.x2 - box.x1);
+				s += g_rdpScreen.paddedWidthInBytes;
+				d += lineBytes;
+			}
+		}
+	}
+
+	size = 4 + 2 + num_rects * 8 + 2 + num_rects * 8 + 20;
+	rdpup_begin_update();
+	rdpup_pre_check(size);
+	out_uint16_le(g_out_s, 61); /* server_paint_rect_shmem_ex */
+	out_uint16_le(g_out_s, size);
+	g_count++;
+	/* dirty and copied rects are the same */
+	out_uint16_le(g_out_s, num_rects);
+	for (index = 0; index < num_rects; index++) {
+		out_uint16_le(g_out_s, rects[index].x1);
+		out_uint16_le(g_out_s, rects[index].y1);
+		out_uint16_le(g_out_s, rects[index].x2 - rects[index].x1);
+		out_uint16_le(g_out_s, rects[index].y2 - rects[index].y1);
+	}
+	out_uint16_le(g_out_s, num_rects);
+	for (index = 0; index < num_rects; index++) {
+		out_uint16_le(g_out_s, rects[index].x1);
+		out_uint16_le(g_out_s, rects[index].y1);
+		out_uint16_le(g_out_s, rects[index].x2 - rects[index].x1);
+		out_uint16_le(g_out_s, rects[index].y2 - rects[index].y1);
+	}
+	out_uint32_le(g_out_s, 0); /* flags, screen */
+	g_rect_id++;
+	out_uint32_le(g_out_s, g_rect_id);
+	out_uint32_le(g_out_s, -1); /* shmem_id, xrdp has the memfd */
+	out_uint32_le(g_out_s, 0); /* offset */
+	out_uint16_le(g_out_s, g_rdpScreen.rdp_width);
+	out_uint16_le(g_out_s, g_rdpScreen.rdp_height);
+	rdpup_end_update();
+	RegionUninit(&reg);
+	return 0;
+}
+
 /******************************************************************************/
 static CARD32 rdpDeferredUpdateCallback(OsTimerPtr timer, CARD32 now,
 		pointer arg) {
@@ -504,7 +959,13 @@ static CARD32 rdpDeferredUpdateCallback(OsTimerPtr timer, CARD32 now,
 			("\n\n\n\nrdpDeferredUpdateCallback--------------------------------"));
 
 	if (g_do_dirty_ons) {
-		if (g_rect_id == g_rect_id_ack) {
+		if (g_out_bytes >= OUT_QUEUE_HIGH) {
+			/* xrdp is behind, let the screen items merge and drop the
+			 ones drawn over, try again later */
+			draw_item_drop_covered(&g_screenPriv);
+			g_out_coalesced++;
+			return 40;
+		} else if (g_rect_id == g_rect_id_ack) {
 			rdpup_check_dirty_screen(&g_screenPriv);
 		} else {
 			LLOGLN(0, ("rdpDeferredUpdateCallback: skipping"));
@@ -575,6 +1036,7 @@ static int rdpup_recv_msg(struct stream *s) {
 			if (len > 3) {
 				init_stream(s, len);
 				rv = rdpup_recv(s->data, len - 4);
+				s->end = s->data + (len - 4);
 			}
 		}
 	}
@@ -622,6 +1084,8 @@ static int process_screen_size_msg(int width, int height, int bpp) {
 	int mmheight;
 	int bytes;
 	Bool ok;
+	CARD32 start_time;
+	CARD32 shm_time;
 
 	LLOGLN(0,
 			("process_screen_size_msg: set width %d height %d bpp %d", width, height, bpp));
@@ -643,13 +1107,16 @@ static int process_screen_size_msg(int width, int height, int bpp) {
 		g_rdpScreen.rdp_Bpp_mask = 0xffffff;
 	}
 
-	if (g_use_shmem) {
+	start_time = GetTimeInMillis();
+	bytes = g_rdpScreen.rdp_width * g_rdpScreen.rdp_height
+			* g_rdpScreen.rdp_Bpp;
+	/* the segment only has to be made again when it gets bigger */
+	if (g_use_shmem && (bytes > g_shmem_bytes)) {
 		if (g_shmemptr != 0) {
 			shmdt(g_shmemptr);
 			g_shmemptr = 0;
+			g_shmem_bytes = 0;
 		}
-		bytes = g_rdpScreen.rdp_width * g_rdpScreen.rdp_height
-				* g_rdpScreen.rdp_Bpp;
 		g_shmemid = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0777);
 		if (g_shmemid != -1) {
 			g_shmemptr = shmat(g_shmemid, 0, 0);
@@ -661,16 +1128,24 @@ static int process_screen_size_msg(int width, int height, int bpp) {
 				g_shmemid = -1;
 			} else {
 				shmctl(g_shmemid, IPC_RMID, NULL);
+				g_shmem_bytes = bytes;
 			}
 			LLOGLN(0,
 					("process_screen_size_msg: g_shmemid %d g_shmemptr %p", g_shmemid, g_shmemptr));
-			g_shmem_lineBytes = g_rdpScreen.rdp_Bpp * g_rdpScreen.rdp_width;
-			if (g_shm_reg != 0) {
-				RegionDestroy(g_shm_reg);
-			}
-			g_shm_reg = RegionCreate(NullBox, 0);
 		}
 	}
+	if (g_use_shmem) {
+		g_shmem_lineBytes = g_rdpScreen.rdp_Bpp * g_rdpScreen.rdp_width;
+		if (g_shm_reg != 0) {
+			RegionDestroy(g_shm_reg);
+		}
+		g_shm_reg = RegionCreate(NullBox, 0);
+	}
+	if ((g_memfd_ptr != 0) && (bytes > g_memfd_bytes)) {
+		/* xrdp keeps its old mapping until the new fd comes */
+		rdpup_send_memfd();
+	}
+	shm_time = GetTimeInMillis();
 
 	mmwidth = PixelToMM(width);
 	mmheight = PixelToMM(height);
@@ -684,6 +1159,8 @@ static int process_screen_size_msg(int width, int height, int bpp) {
 		LLOGLN(0, ("  RRScreenSizeSet ok=[%d]", ok));
 	}
 
+	LLOGLN(0,
+			("process_screen_size_msg: shmem %d ms randr %d ms", (int) (shm_time - start_time), (int) (GetTimeInMillis() - shm_time)));
 	return 0;
 }
 
@@ -727,6 +1204,20 @@ static int rdpup_send_caps(void) {
 	cap_bytes += 4;
 #endif
 
+	/* input batch, xrdp can send message 110 */
+	out_uint16_le(ls, 2);
+	out_uint16_le(ls, 4);
+	cap_count++;
+	cap_bytes += 4;
+
+	if (g_use_uds && g_do_dirty_ons) {
+		/* screen memfd, xrdp can send message 111 */
+		out_uint16_le(ls, 3);
+		out_uint16_le(ls, 4);
+		cap_count++;
+		cap_bytes += 4;
+	}
+
 	s_mark_end(ls);
 	len = (int) (ls->end - ls->data);
 	s_pop_layer(ls, iso_hdr);
@@ -753,6 +1244,10 @@ static int process_version_msg(int param1, int param2, int param3, int param4) {
 		rdpup_send_caps();
 	}
 
+	/* 0.0.0.2 and up take a cursor by hash */
+	g_cursor_hash_ok = (param1 > 0) || (param2 > 0) || (param3 > 0)
+			|| (param4 > 1);
+
 	return 0;
 }
 
@@ -805,115 +1300,153 @@ static int rdpup_process_msg(struct stream *s) {
 	int cy;
 	RegionRec reg;
 	BoxRec box;
+	int count;
+	int index;
 
 	in_uint16_le(s, msg_type);
 
+	count = 1;
+	if (msg_type == 110) {
+		/* batch of 103 messages, 20 bytes each */
+		in_uint16_le(s, count);
+		msg_type = 103;
+		if (!s_check_rem(s, count * 20)) {
+			LLOGLN(0, ("rdpup_process_msg: batch of %d events in %d bytes, "
+					"dropped", count, (int) (s->end - s->p)));
+			return 0;
+		}
+	}
+
 	if (msg_type == 103) {
-		in_uint32_le(s, msg);
-		in_uint32_le(s, param1);
-		in_uint32_le(s, param2);
-		in_uint32_le(s, param3);
-		in_uint32_le(s, param4);
-		LLOGLN(10,
-				("rdpup_process_msg - msg %d param1 %d param2 %d param3 %d " "param4 %d", msg, param1, param2, param3, param4));
+		for (index = 0; index < count; index++) {
+			in_uint32_le(s, msg);
+			in_uint32_le(s, param1);
+			in_uint32_le(s, param2);
+			in_uint32_le(s, param3);
+			in_uint32_le(s, param4);
+			LLOGLN(10,
+					("rdpup_process_msg - msg %d param1 %d param2 %d param3 %d " "param4 %d", msg, param1, param2, param3, param4));
 
-		switch (msg) {
-		case 15: /* key down */
-		case 16: /* key up */
-			KbdAddEvent(msg == 15, param1, param2, param3, param4);
-			break;
-		case 17: /* from RDP_INPUT_SYNCHRONIZE */
-			KbdSync(param1);
-			break;
-		case 100:
-			/* without the minus 2, strange things happen when dragging
-			 past the width or height */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 101: /* left button up */
-			g_button_mask = g_button_mask & (~XR_BUTTON1);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 102: /* left button down */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON1;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 103: /* right button up */
-			g_button_mask = g_button_mask & (~XR_BUTTON3);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 104: /* right button down */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON3;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 105: /* middle button down */
-			g_button_mask = g_button_mask & (~XR_BUTTON2);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 106: /* middle button up */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON2;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 107: /* button 4 up */
-			g_button_mask = g_button_mask & (~XR_BUTTON4);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 108: /* button 4 down */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON4;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 109: /* button 5 up */
-			g_button_mask = g_button_mask & (~XR_BUTTON5);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 110: /* button 5 down */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON5;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 111: /* button 6 up */
-			g_button_mask = g_button_mask & (~XR_BUTTON6);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 112: /* button 6 down */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON6;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 113: /* button 7 up */
-			g_button_mask = g_button_mask & (~XR_BUTTON7);
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 114: /* button 7 down */
-			g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
-			g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
-			g_button_mask = g_button_mask | XR_BUTTON7;
-			PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
-			break;
-		case 200:
-			rdpup_begin_update();
-			rdpup_send_area(0, (param1 >> 16) & 0xffff, param1 & 0xffff,
-					(param2 >> 16) & 0xffff, param2 & 0xffff);
-			rdpup_end_update();
-			break;
-		case 300:
-			process_screen_size_msg(param1, param2, param3);
-			break;
-		case 301:
-			process_version_msg(param1, param2, param3, param4);
-			break;
+			switch (msg) {
+			case 15: /* key down */
+			case 16: /* key up */
+				KbdAddEvent(msg == 15, param1, param2, param3, param4);
+				break;
+			case 17: /* from RDP_INPUT_SYNCHRONIZE */
+				KbdSync(param1);
+				break;
+			case 100:
+				/* without the minus 2, strange things happen when dragging
+				 past the width or height */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 101: /* left button up */
+				g_button_mask = g_button_mask & (~XR_BUTTON1);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 102: /* left button down */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON1;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 103: /* right button up */
+				g_button_mask = g_button_mask & (~XR_BUTTON3);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 104: /* right button down */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON3;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 105: /* middle button down */
+				g_button_mask = g_button_mask & (~XR_BUTTON2);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 106: /* middle button up */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON2;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 107: /* button 4 up */
+				g_button_mask = g_button_mask & (~XR_BUTTON4);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 108: /* button 4 down */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON4;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 109: /* button 5 up */
+				g_button_mask = g_button_mask & (~XR_BUTTON5);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 110: /* button 5 down */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON5;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 111: /* button 6 up */
+				g_button_mask = g_button_mask & (~XR_BUTTON6);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 112: /* button 6 down */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON6;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 113: /* button 7 up */
+				g_button_mask = g_button_mask & (~XR_BUTTON7);
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 114: /* button 7 down */
+				g_cursor_x = l_bound_by(param1, 0, g_rdpScreen.width - 2);
+				g_cursor_y = l_bound_by(param2, 0, g_rdpScreen.height - 2);
+				g_button_mask = g_button_mask | XR_BUTTON7;
+				PtrAddEvent(g_button_mask, g_cursor_x, g_cursor_y);
+				break;
+			case 200:
+				if (g_memfd_ptr != 0) {
+					/* goes out with the next frame */
+					box.x1 = (param1 >> 16) & 0xffff;
+					box.y1 = param1 & 0xffff;
+					box.x2 = box.x1 + ((param2 >> 16) & 0xffff);
+					box.y2 = box.y1 + (param2 & 0xffff);
+					RegionInit(&reg, &box, 0);
+					draw_item_add_img_region(&g_screenPriv, &reg, GXcopy,
+							RDI_IMGLL, TAG_OTHER);
+					RegionUninit(&reg);
+					g_screenPriv.is_dirty = 1;
+					rdpScheduleDeferredUpdate();
+					break;
+				}
+				rdpup_begin_update();
+				rdpup_send_area(0, (param1 >> 16) & 0xffff, param1 & 0xffff,
+						(param2 >> 16) & 0xffff, param2 & 0xffff);
+				rdpup_end_update();
+				break;
+			case 300:
+				process_screen_size_msg(param1, param2, param3);
+				break;
+			case 301:
+				process_version_msg(param1, param2, param3, param4);
+				break;
+			case 302: /* xrdp does not have the cursor with hash param1 */
+				if ((param1 != 0) && (param1 == g_cursor_hash)) {
+					g_cursor_resends++;
+					rdpup_begin_update();
+					rdpup_send_cursor_ex();
+					rdpup_end_update();
+				}
+				break;
+			}
 		}
 	} else if (msg_type == 104) {
 		in_uint32_le(s, bytes);
@@ -940,6 +1473,16 @@ static int rdpup_process_msg(struct stream *s) {
 				g_free(g_os_bitmaps);
 				g_os_bitmaps = (struct rdpup_os_bitmap *) g_malloc(
 						sizeof(struct rdpup_os_bitmap) * g_max_os_bitmaps, 1);
+				g_os_lru_head = -1;
+				g_os_lru_tail = -1;
+				g_os_bitmap_alloc_size = 0;
+				/* stay inside what the client said it can hold */
+				g_os_bitmap_max_bytes = MAX_OS_BYTES;
+				i1 = g_rdpScreen.client_info.offscreen_cache_size;
+				if ((i1 > 0) && (i1 < g_os_bitmap_max_bytes)) {
+					g_os_bitmap_max_bytes = i1;
+				}
+				LLOGLN(0, ("  offscreen budget %d bytes", g_os_bitmap_max_bytes));
 			}
 		}
 
@@ -1012,6 +1555,20 @@ static int rdpup_process_msg(struct stream *s) {
 		RegionSubtract(g_shm_reg, g_shm_reg, &reg);
 		RegionUninit(&reg);
 
+	} else if (msg_type == 106) {
+		/* paint rect ex ack, xrdp is done with the frame */
+		in_uint32_le(s, flags);
+		in_uint32_le(s, g_rect_id_ack);
+		LLOGLN(10,
+				("rdpup_process_msg: rect_id %d rect_id_ack %d", g_rect_id, g_rect_id_ack));
+		if (g_screenPriv.is_dirty) {
+			rdpScheduleDeferredUpdate();
+		}
+	} else if (msg_type == 111) {
+		LLOGLN(0, ("rdpup_process_msg: got screen memfd request"));
+		if (g_use_uds && g_do_dirty_ons) {
+			rdpup_send_memfd();
+		}
 	}
 
 	else {
@@ -1249,10 +1806,10 @@ int rdpup_end_update(void) {
 /******************************************************************************/
 int rdpup_pre_check(int in_size) {
 	int rv;
-	LLOGLN(0, ("rdpup_pre_check: %d",in_size));
+	LLOGLN(10, ("rdpup_pre_check: %d",in_size));
 	rv = 0;
 	if (!g_begin) {
-		LLOGLN(0, ("rdpup_pre_check: %d  init update",in_size));
+		LLOGLN(10, ("rdpup_pre_check: %d  init update",in_size));
 		rdpup_begin_update();
 	}
 
@@ -1260,18 +1817,18 @@ int rdpup_pre_check(int in_size) {
 		s_mark_end(g_out_s);
 
 
-		LLOGLN(0, ("rdpup_pre_check: rdpup_send_sending...%d",g_out_s->size));
+		LLOGLN(10, ("rdpup_pre_check: rdpup_send_sending...%d",g_out_s->size));
 		if (rdpup_send_msg(g_out_s) != 0) {
 			LLOGLN(0, ("rdpup_pre_check: rdpup_send_msg failed"));
 			rv = 1;
 		} else {
-			LLOGLN(0, ("rdpup_pre_check: %d  rdpup_send_msg ok",in_size));
+			LLOGLN(10, ("rdpup_pre_check: %d  rdpup_send_msg ok",in_size));
 		}
 		g_count = 0;
 		init_stream(g_out_s, 0);
 		s_push_layer(g_out_s, iso_hdr, 8);
 	}
-	LLOGLN(0, ("rdpup_pre_check: %d  done",in_size));
+	LLOGLN(10, ("rdpup_pre_check: %d  done",in_size));
 	return rv;
 }
 
@@ -1391,15 +1948,6 @@ int convert_pixel(int in_pixel) {
 }
 
 int convert_pixels(void *src, void *dst, int num_pixels) {
-	unsigned int pixel;
-	unsigned int red;
-	unsigned int green;
-	unsigned int blue;
-	unsigned int *src32;
-	unsigned int *dst32;
-	unsigned short *dst16;
-	unsigned char *dst8;
-	int index;
 	// LLOGLN(1, ("convert_pixels %d -> %d",g_rdpScreen.rdp_bpp,g_rdpScreen.depth));
 	if (g_rdpScreen.depth == g_rdpScreen.rdp_bpp) {
 		memcpy(dst, src, num_pixels * g_Bpp);
@@ -1407,50 +1955,17 @@ int convert_pixels(void *src, void *dst, int num_pixels) {
 	}
 
 	if (g_rdpScreen.depth == 24) {
-		src32 = (unsigned int *) src;
-
 		if (g_rdpScreen.rdp_bpp >= 24) {
-			dst32 = (unsigned int *) dst;
-
-			for (index = 0; index < num_pixels; index++) {
-				pixel = *src32;
-				*dst32 = pixel;
-				dst32++;
-				src32++;
-			}
+			memcpy(dst, src, num_pixels * 4);
 		} else if (g_rdpScreen.rdp_bpp == 16) {
-			dst16 = (unsigned short *) dst;
-
-			for (index = 0; index < num_pixels; index++) {
-				pixel = *src32;
-				SPLITCOLOR32(red, green, blue, pixel);
-				pixel = COLOR16(red, green, blue);
-				*dst16 = pixel;
-				dst16++;
-				src32++;
-			}
+			pixel_convert_row(src, PIXEL_FMT_32, dst, PIXEL_FMT_16,
+					num_pixels, 0);
 		} else if (g_rdpScreen.rdp_bpp == 15) {
-			dst16 = (unsigned short *) dst;
-
-			for (index = 0; index < num_pixels; index++) {
-				pixel = *src32;
-				SPLITCOLOR32(red, green, blue, pixel);
-				pixel = COLOR15(red, green, blue);
-				*dst16 = pixel;
-				dst16++;
-				src32++;
-			}
+			pixel_convert_row(src, PIXEL_FMT_32, dst, PIXEL_FMT_15,
+					num_pixels, 0);
 		} else if (g_rdpScreen.rdp_bpp == 8) {
-			dst8 = (unsigned char *) dst;
-
-			for (index = 0; index < num_pixels; index++) {
-				pixel = *src32;
-				SPLITCOLOR32(red, green, blue, pixel);
-				pixel = COLOR8(red, green, blue);
-				*dst8 = pixel;
-				dst8++;
-				src32++;
-			}
+			pixel_convert_row(src, PIXEL_FMT_32, dst, PIXEL_FMT_8,
+					num_pixels, 0);
 		} else {
 			LLOGLN(1, ("Error rdp %b depth not supported",g_rdpScreen.rdp_bpp));
 
@@ -1465,17 +1980,7 @@ int convert_pixels(void *src, void *dst, int num_pixels) {
 
 /******************************************************************************/
 int alpha_pixels(void* src, void* dst, int num_pixels) {
-	unsigned int* src32;
-	unsigned char* dst8;
-	int index;
-
-	src32 = (unsigned int*) src;
-	dst8 = (unsigned char*) dst;
-	for (index = 0; index < num_pixels; index++) {
-		*dst8 = (*src32) >> 24;
-		dst8++;
-		src32++;
-	}
+	pixel_alpha8(src, dst, num_pixels);
 	return 0;
 }
 
@@ -1563,6 +2068,7 @@ int rdpup_set_cursor(short x, short y, char *cur_data, char *cur_mask) {
 
 	if (g_connected) {
 		LLOGLN(10, ("  rdpup_set_cursor"));
+		g_cursor_hash = 0;
 		size = 8 + 32 * (32 * 3) + 32 * (32 / 8);
 		rdpup_pre_check(size);
 		out_uint16_le(g_out_s, 19); /* set cursor */
@@ -1581,29 +2087,77 @@ int rdpup_set_cursor(short x, short y, char *cur_data, char *cur_mask) {
 	return 0;
 }
 
+/******************************************************************************/
+/* order 51 with the last cursor, xrdp only needs its hash after this */
+static int rdpup_send_cursor_ex(void) {
+	int size;
+	int Bpp;
+	int index;
+
+	Bpp = (g_cursor_bpp == 0) ? 3 : (g_cursor_bpp + 7) / 8;
+	size = 10 + 32 * (32 * Bpp) + 32 * (32 / 8);
+	rdpup_pre_check(size);
+	out_uint16_le(g_out_s, 51); /* set cursor ex */
+	out_uint16_le(g_out_s, size); /* size */
+	g_count++;
+	out_uint16_le(g_out_s, g_cursor_hot_x);
+	out_uint16_le(g_out_s, g_cursor_hot_y);
+	out_uint16_le(g_out_s, g_cursor_bpp);
+	out_uint8a(g_out_s, g_cursor_data, 32 * (32 * Bpp));
+	out_uint8a(g_out_s, g_cursor_mask, 32 * (32 / 8));
+	g_cursor_sends++;
+	for (index = 0; index < MAX_CURSOR_HASHES; index++) {
+		if (g_cursor_hashes[index] == g_cursor_hash) {
+			return 0;
+		}
+	}
+	g_cursor_hashes[g_cursor_hash_next] = g_cursor_hash;
+	g_cursor_hash_next = (g_cursor_hash_next + 1) % MAX_CURSOR_HASHES;
+	return 0;
+}
+
 /******************************************************************************/
 int rdpup_set_cursor_ex(short x, short y, char *cur_data, char *cur_mask,
 		int bpp) {
-	int size;
 	int Bpp;
+	int index;
+	unsigned int hash;
 
 	if (g_connected) {
 		LLOGLN(10, ("  rdpup_set_cursor_ex"));
 		Bpp = (bpp == 0) ? 3 : (bpp + 7) / 8;
-		size = 10 + 32 * (32 * Bpp) + 32 * (32 / 8);
-		rdpup_pre_check(size);
-		out_uint16_le(g_out_s, 51); /* set cursor ex */
-		out_uint16_le(g_out_s, size); /* size */
-		g_count++;
 		x = MAX(0, x);
 		x = MIN(31, x);
 		y = MAX(0, y);
 		y = MIN(31, y);
-		out_uint16_le(g_out_s, x);
-		out_uint16_le(g_out_s, y);
-		out_uint16_le(g_out_s, bpp);
-		out_uint8a(g_out_s, cur_data, 32 * (32 * Bpp));
-		out_uint8a(g_out_s, cur_mask, 32 * (32 / 8));
+		/* apps set the same cursor over and over, xrdp already has it */
+		POINTER_HASH(hash, x, y, bpp, cur_data, cur_mask);
+		if ((int) hash == g_cursor_hash) {
+			g_cursor_skips++;
+			return 0;
+		}
+		g_cursor_hash = (int) hash;
+		g_cursor_hot_x = x;
+		g_cursor_hot_y = y;
+		g_cursor_bpp = bpp;
+		memcpy(g_cursor_data, cur_data, 32 * (32 * Bpp));
+		memcpy(g_cursor_mask, cur_mask, 32 * (32 / 8));
+		/* sent before, xrdp looks the hash up in its pointer cache */
+		if (g_cursor_hash_ok
+				&& (g_rdpScreen.client_info.pointer_cache_entries > 2)) {
+			for (index = 0; index < MAX_CURSOR_HASHES; index++) {
+				if (g_cursor_hashes[index] == g_cursor_hash) {
+					rdpup_pre_check(8);
+					out_uint16_le(g_out_s, 52); /* set cursor by hash */
+					out_uint16_le(g_out_s, 8); /* size */
+					g_count++;
+					out_uint32_le(g_out_s, g_cursor_hash);
+					g_cursor_hash_sends++;
+					return 0;
+				}
+			}
+		}
+		rdpup_send_cursor_ex();
 	}
 
 	return 0;
@@ -2029,6 +2583,9 @@ void rdpup_paint_rect_os(int x, int y, int cx, int cy, int rdpindex, int srcx,
 		out_uint32_le(g_out_s, rdpindex);
 		out_uint16_le(g_out_s, srcx);
 		out_uint16_le(g_out_s, srcy);
+		/* the client copies these pixels from its surface, they would
+		 otherwise have gone as an image */
+		g_os_bytes_saved += (double) cx * cy * g_rdpScreen.rdp_Bpp;
 	}
 }
 
@@ -2346,6 +2903,10 @@ int rdpup_check_dirty_screen(rdpPixmapRec *pDirtyPriv) {
 		return 0;
 	}
 
+	if (g_memfd_ptr != 0) {
+		return rdpup_check_dirty_screen_memfd(pDirtyPriv);
+	}
+
 	LLOGLN(10, ("rdpup_check_dirty_screen: got dirty"));
 	rdpup_get_screen_image_rect(&id);
 	rdpup_begin_update();
@@ -28,8 +28,13 @@ XVideo extension
 #include "xvdix.h"
 
 #include <fourcc.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 extern rdpScreenInfoRec g_rdpScreen; /* from rdpmain.c */
+extern int g_Bpp; /* from rdpmain.c */
+extern rdpPixmapRec g_screenPriv; /* from rdpmain.c */
 
 static DevPrivateKey g_XvScreenKey;
 static char g_xv_adaptor_name[] = "xrdp XVideo adaptor";
@@ -58,6 +63,24 @@ static XvPortRec g_ports[T_NUM_PORTS];
 #define FOURCC_RV24 0x34325652
 #define FOURCC_RV32 0x32335652
 
+/* frames converted for the drawable, grows to the biggest frame */
+static char *g_xv_rgb = 0;
+static size_t g_xv_rgb_bytes = 0;
+/* h264 sessions, the video in NV12 at the size of the screen, the screen
+   has XV_COLORKEY where the video shows, like a hardware overlay */
+static char *g_xv_nv12 = 0;
+static size_t g_xv_nv12_bytes = 0;
+static int g_xv_nv12_width = 0;
+static int g_xv_nv12_height = 0;
+/* per stream, logged on stop */
+static int g_xv_frames = 0;
+static int g_xv_nv12_frames = 0;
+static CARD32 g_xv_convert_ms = 0;
+static CARD32 g_xv_start_ms = 0;
+static CARD32 g_xv_start_cpu_ms = 0;
+
+#define XV_COLORKEY 0x00fe01fe
+
 #define T_NUM_IMAGES 8
 static XvImageRec g_images[T_NUM_IMAGES] =
 {
@@ -152,11 +175,44 @@ rdpXvGetStill(ClientPtr client, DrawablePtr pDraw, XvPortPtr pPort, GCPtr pGC,
     return Success;
 }
 
+/*****************************************************************************/
+/* user and system time of the process in ms */
+static CARD32
+rdpXvCpuMs(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+    {
+        return 0;
+    }
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+}
+
 /*****************************************************************************/
 static int
 rdpXvStopVideo(ClientPtr client, XvPortPtr pPort, DrawablePtr pDraw)
 {
+    CARD32 ms;
+    CARD32 cpu_ms;
+
     LLOGLN(0, ("rdpXvStopVideo:"));
+    if (g_xv_frames > 0)
+    {
+        /* cpu is the whole X server while the stream ran, converting is
+           the part spent in rdpXvPutImage */
+        ms = GetTimeInMillis() - g_xv_start_ms;
+        cpu_ms = rdpXvCpuMs() - g_xv_start_cpu_ms;
+        LLOGLN(0, ("rdpXvStopVideo: %d frames (%d nv12) in %u ms, "
+               "%u fps, %u ms converting, %u ms cpu",
+               g_xv_frames, g_xv_nv12_frames, (unsigned int)ms,
+               (unsigned int)(g_xv_frames * 1000 / max(ms, 1)),
+               (unsigned int)g_xv_convert_ms, (unsigned int)cpu_ms));
+    }
+    g_xv_frames = 0;
+    g_xv_nv12_frames = 0;
+    g_xv_convert_ms = 0;
     return Success;
 }
 
@@ -185,10 +241,351 @@ rdpXvQueryBestSize(ClientPtr client, XvPortPtr pPort, CARD8 motion,
                    unsigned int *p_w, unsigned int *p_h)
 {
     LLOGLN(0, ("rdpXvQueryBestSize:"));
+    /* any size, it is scaled on the way to the drawable */
+    *p_w = drw_w;
+    *p_h = drw_h;
     return Success;
 }
 
+static int
+rdpXvQueryImageAttributes(ClientPtr client, XvPortPtr pPort, XvImagePtr format,
+                          CARD16* width, CARD16* height, int* pitches,
+                          int* offsets);
+
+/*****************************************************************************/
+/* BT.601, video range */
+#define XV_CLAMP(_val) ((_val) < 0 ? 0 : (_val) > 255 ? 255 : (_val))
+#define XV_YUV2RGB(_y, _u, _v, _r, _g, _b) \
+    do \
+    { \
+        int _c = ((_y) - 16) * 298 + 128; \
+        int _d = (_u) - 128; \
+        int _e = (_v) - 128; \
+        _r = XV_CLAMP((_c + 409 * _e) >> 8); \
+        _g = XV_CLAMP((_c - 100 * _d - 208 * _e) >> 8); \
+        _b = XV_CLAMP((_c + 516 * _d) >> 8); \
+    } while (0)
+
+/*****************************************************************************/
+/* the rows of the frame's planes for frame row sy */
+#define XV_ROW(_id, _data, _pitches, _offsets, _sy, _yp, _up, _vp) \
+    do \
+    { \
+        _yp = (_data) + (_offsets)[0] + (_sy) * (_pitches)[0]; \
+        _up = _yp; \
+        _vp = _yp; \
+        if ((_id) == FOURCC_YV12) \
+        { \
+            _vp = (_data) + (_offsets)[1] + ((_sy) >> 1) * (_pitches)[1]; \
+            _up = (_data) + (_offsets)[2] + ((_sy) >> 1) * (_pitches)[2]; \
+        } \
+        else if ((_id) == FOURCC_I420) \
+        { \
+            _up = (_data) + (_offsets)[1] + ((_sy) >> 1) * (_pitches)[1]; \
+            _vp = (_data) + (_offsets)[2] + ((_sy) >> 1) * (_pitches)[2]; \
+        } \
+    } while (0)
+
+/* y, u and v of frame pixel sx in the row from XV_ROW */
+#define XV_SAMPLE(_id, _yp, _up, _vp, _sx, _y, _u, _v) \
+    do \
+    { \
+        switch (_id) \
+        { \
+            case FOURCC_YUY2: /* y0 u y1 v */ \
+                _y = (_yp)[(_sx) * 2]; \
+                _u = (_yp)[((_sx) & ~1) * 2 + 1]; \
+                _v = (_yp)[((_sx) & ~1) * 2 + 3]; \
+                break; \
+            case FOURCC_UYVY: /* u y0 v y1 */ \
+                _y = (_yp)[(_sx) * 2 + 1]; \
+                _u = (_yp)[((_sx) & ~1) * 2]; \
+                _v = (_yp)[((_sx) & ~1) * 2 + 2]; \
+                break; \
+            default: /* planar */ \
+                _y = (_yp)[_sx]; \
+                _u = (_up)[(_sx) >> 1]; \
+                _v = (_vp)[(_sx) >> 1]; \
+                break; \
+        } \
+    } while (0)
+
+/*****************************************************************************/
+/* one row of the drawable from the frame, sxs is the frame x for each
+   dst pixel, sy the frame row */
+static void
+rdpXvConvertRow(int id, unsigned char *data, int *pitches, int *offsets,
+                int *sxs, int sy, int dst_w, char *dst)
+{
+    unsigned char *yp;
+    unsigned char *up;
+    unsigned char *vp;
+    int index;
+    int sx;
+    int y;
+    int u;
+    int v;
+    int r;
+    int g;
+    int b;
+
+    XV_ROW(id, data, pitches, offsets, sy, yp, up, vp);
+    for (index = 0; index < dst_w; index++)
+    {
+        sx = sxs[index];
+        XV_SAMPLE(id, yp, up, vp, sx, y, u, v);
+        XV_YUV2RGB(y, u, v, r, g, b);
+        if (g_Bpp == 4)
+        {
+            ((CARD32 *)dst)[index] = (r << 16) | (g << 8) | b;
+        }
+        else
+        {
+            ((CARD16 *)dst)[index] = ((r >> 3) << 11) | ((g >> 2) << 5) |
+                                     (b >> 3);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* one row of the frame to the NV12 video frame, no colour conversion, the
+   frame is BT.601 video range already like the h264 stage wants it
+   sxs is the frame x for each dst pixel from dst_x on, sy the frame row,
+   dst_y and dst_uv are the start of the rows, the chroma pair is only
+   written when dst_uv is not nil */
+static void
+rdpXvRowToNV12(int id, unsigned char *data, int *pitches, int *offsets,
+               int *sxs, int sy, int dst_x, int dst_w, unsigned char *dst_y,
+               unsigned char *dst_uv)
+{
+    unsigned char *yp;
+    unsigned char *up;
+    unsigned char *vp;
+    int index;
+    int sx;
+    int x;
+    int y;
+    int u;
+    int v;
+
+    XV_ROW(id, data, pitches, offsets, sy, yp, up, vp);
+    for (index = 0; index < dst_w; index++)
+    {
+        sx = sxs[index];
+        x = dst_x + index;
+        XV_SAMPLE(id, yp, up, vp, sx, y, u, v);
+        dst_y[x] = y;
+        if ((dst_uv != 0) && (((x & 1) == 0) || (index == 0)))
+        {
+            dst_uv[x & ~1] = u;
+            dst_uv[(x & ~1) + 1] = v;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* h264 session, what can be seen of the frame goes to g_xv_nv12 as it is
+   and the screen under it gets XV_COLORKEY, rdpXvScreenToNV12 puts the two
+   together when the screen goes out
+   x1, y1, x2, y2 is the visible destination, drawable relative, and sxs
+   the frame x for each pixel of it */
+static int
+rdpXvPutNV12(DrawablePtr pDraw, GCPtr pGC, int id, unsigned char *data,
+             int *pitches, int *offsets, int *sxs, int src_y, int src_h,
+             int drw_y, int drw_h, int x1, int y1, int x2, int y2)
+{
+    RegionRec reg;
+    BoxRec box;
+    BoxPtr pbox;
+    CARD32 *fb;
+    unsigned char *dst_y;
+    unsigned char *dst_uv;
+    size_t bytes;
+    int width;
+    int height;
+    int num_boxes;
+    int index;
+    int x;
+    int y;
+    int sy;
+
+    width = (g_rdpScreen.width + 1) & ~1;
+    height = (g_rdpScreen.height + 1) & ~1;
+    if ((width != g_xv_nv12_width) || (height != g_xv_nv12_height))
+    {
+        /* new screen size, the old frame is no use */
+        bytes = (size_t)width * height * 3 / 2;
+        if (bytes > g_xv_nv12_bytes)
+        {
+            free(g_xv_nv12);
+            g_xv_nv12 = (char *)malloc(bytes);
+            if (g_xv_nv12 == 0)
+            {
+                g_xv_nv12_bytes = 0;
+                g_xv_nv12_width = 0;
+                g_xv_nv12_height = 0;
+                return BadAlloc;
+            }
+            g_xv_nv12_bytes = bytes;
+        }
+        memset(g_xv_nv12, 0, bytes);
+        g_xv_nv12_width = width;
+        g_xv_nv12_height = height;
+    }
+
+    /* screen relative from here */
+    box.x1 = max(pDraw->x + x1, 0);
+    box.y1 = max(pDraw->y + y1, 0);
+    box.x2 = min(pDraw->x + x2, g_rdpScreen.width);
+    box.y2 = min(pDraw->y + y2, g_rdpScreen.height);
+    if ((box.x2 <= box.x1) || (box.y2 <= box.y1))
+    {
+        return Success;
+    }
+    RegionInit(&reg, &box, 0);
+    if (pGC->pCompositeClip != 0)
+    {
+        RegionIntersect(&reg, &reg, pGC->pCompositeClip);
+    }
+    num_boxes = REGION_NUM_RECTS(&reg);
+    pbox = REGION_RECTS(&reg);
+    for (index = 0; index < num_boxes; index++)
+    {
+        box = pbox[index];
+        for (y = box.y1; y < box.y2; y++)
+        {
+            sy = src_y + ((CARD32)(y - pDraw->y - drw_y) * src_h) / drw_h;
+            dst_y = (unsigned char *)g_xv_nv12 + (size_t)y * width;
+            dst_uv = 0;
+            if (((y & 1) == 0) || (y == box.y1))
+            {
+                dst_uv = (unsigned char *)g_xv_nv12 + (size_t)width * height +
+                         (size_t)(y >> 1) * width;
+            }
+            rdpXvRowToNV12(id, data, pitches, offsets,
+                           sxs + (box.x1 - pDraw->x - x1), sy, box.x1,
+                           box.x2 - box.x1, dst_y, dst_uv);
+            fb = (CARD32 *)(g_rdpScreen.pfbMemory +
+                            y * g_rdpScreen.paddedWidthInBytes);
+            for (x = box.x1; x < box.x2; x++)
+            {
+                fb[x] = XV_COLORKEY;
+            }
+        }
+    }
+    draw_item_add_img_region(&g_screenPriv, &reg, GXcopy, RDI_IMGLY,
+                             TAG_PUTIMAGE);
+    g_screenPriv.is_dirty = 1;
+    RegionUninit(&reg);
+    g_xv_nv12_frames++;
+    return Success;
+}
+
+/*****************************************************************************/
+/* rgb to BT.601 video range */
+#define XV_RGB2Y(_r, _g, _b) \
+    ((((_r) * 66 + (_g) * 129 + (_b) * 25 + 128) >> 8) + 16)
+#define XV_RGB2U(_r, _g, _b) \
+    ((((_r) * -38 - (_g) * 74 + (_b) * 112 + 128) >> 8) + 128)
+#define XV_RGB2V(_r, _g, _b) \
+    ((((_r) * 112 - (_g) * 94 - (_b) * 18 + 128) >> 8) + 128)
+
+/*****************************************************************************/
+/* the 32 bpp screen to NV12 for the h264 stage, called from
+   rdpup_check_dirty_screen_memfd, box is on even pixels and inside the
+   frame buffer, where the screen has XV_COLORKEY the video frame shows
+   through, a 2x2 block takes its chroma from the video when its top left
+   pixel does */
+void
+rdpXvScreenToNV12(BoxPtr box, char *y_plane, char *uv_plane, int stride)
+{
+    CARD32 *s0;
+    CARD32 *s1;
+    CARD32 pixel;
+    unsigned char *yd;
+    unsigned char *uvd;
+    unsigned char *vy;
+    unsigned char *vuv;
+    int x;
+    int y;
+    int index;
+    int r;
+    int g;
+    int b;
+    int rs;
+    int gs;
+    int bs;
+    int video;
+
+    video = (g_xv_nv12 != 0) && (box->x2 <= g_xv_nv12_width) &&
+            (box->y2 <= g_xv_nv12_height);
+    vy = 0;
+    vuv = 0;
+    for (y = box->y1; y < box->y2; y += 2)
+    {
+        s0 = (CARD32 *)(g_rdpScreen.pfbMemory +
+                        y * g_rdpScreen.paddedWidthInBytes);
+        s1 = (CARD32 *)(g_rdpScreen.pfbMemory +
+                        (y + 1) * g_rdpScreen.paddedWidthInBytes);
+        yd = (unsigned char *)y_plane + (size_t)y * stride;
+        uvd = (unsigned char *)uv_plane + (size_t)(y >> 1) * stride;
+        if (video)
+        {
+            vy = (unsigned char *)g_xv_nv12 + (size_t)y * g_xv_nv12_width;
+            vuv = (unsigned char *)g_xv_nv12 +
+                  (size_t)g_xv_nv12_width * g_xv_nv12_height +
+                  (size_t)(y >> 1) * g_xv_nv12_width;
+        }
+        for (x = box->x1; x < box->x2; x += 2)
+        {
+            rs = 0;
+            gs = 0;
+            bs = 0;
+            for (index = 0; index < 4; index++)
+            {
+                pixel = (index < 2 ? s0 : s1)[x + (index & 1)];
+                r = (pixel >> 16) & 0xff;
+                g = (pixel >> 8) & 0xff;
+                b = pixel & 0xff;
+                rs += r;
+                gs += g;
+                bs += b;
+                if (video && ((pixel & 0xffffff) == XV_COLORKEY))
+                {
+                    yd[(index >> 1) * stride + x + (index & 1)] =
+                        vy[(index >> 1) * g_xv_nv12_width + x + (index & 1)];
+                }
+                else
+                {
+                    yd[(index >> 1) * stride + x + (index & 1)] =
+                        XV_RGB2Y(r, g, b);
+                }
+            }
+            if (video && ((s0[x] & 0xffffff) == XV_COLORKEY))
+            {
+                uvd[x] = vuv[x];
+                uvd[x + 1] = vuv[x + 1];
+            }
+            else
+            {
+                rs = (rs + 2) >> 2;
+                gs = (gs + 2) >> 2;
+                bs = (bs + 2) >> 2;
+                uvd[x] = XV_RGB2U(rs, gs, bs);
+                uvd[x + 1] = XV_RGB2V(rs, gs, bs);
+            }
+        }
+    }
+}
+
 /*****************************************************************************/
+/* the frame is converted and scaled here and drawn with PutImage so it
+   goes out like any other image, one lossy item for the clipped video
+   rect, in an h264 session it goes to the h264 stage as YUV instead, see
+   rdpXvPutNV12
+   only the part of the destination inside the drawable and the GC's
+   composite clip is converted, so the buffer is never bigger than what
+   can be seen */
 static int
 rdpXvPutImage(ClientPtr client, DrawablePtr pDraw, XvPortPtr pPort, GCPtr pGC,
               INT16 src_x, INT16 src_y, CARD16 src_w, CARD16 src_h,
@@ -196,7 +593,140 @@ rdpXvPutImage(ClientPtr client, DrawablePtr pDraw, XvPortPtr pPort, GCPtr pGC,
               XvImagePtr format,  unsigned char* data, Bool sync,
               CARD16 width, CARD16 height)
 {
-    LLOGLN(0, ("rdpXvPutImage:"));
+    int pitches[3];
+    int offsets[3];
+    int *sxs;
+    int dst_stride;
+    int index;
+    int sy;
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+    int clip_w;
+    int clip_h;
+    int rv;
+    int nv12;
+    size_t bytes;
+    char *rgb;
+    BoxPtr pbox;
+    CARD16 lwidth;
+    CARD16 lheight;
+    CARD32 start_ms;
+
+    LLOGLN(10, ("rdpXvPutImage:"));
+    switch (format->id)
+    {
+        case FOURCC_YV12:
+        case FOURCC_I420:
+        case FOURCC_YUY2:
+        case FOURCC_UYVY:
+            break;
+        default:
+            LLOGLN(0, ("rdpXvPutImage: format 0x%x not supported", format->id));
+            return BadMatch;
+    }
+    if ((g_Bpp != 4) && (g_Bpp != 2))
+    {
+        return BadMatch;
+    }
+    if ((drw_w < 1) || (drw_h < 1) || (src_w < 1) || (src_h < 1))
+    {
+        return Success;
+    }
+    /* the size the planes are laid out for, it is clamped to 2046 so the
+       source has to be inside that, not inside what the client said */
+    lwidth = width;
+    lheight = height;
+    memset(pitches, 0, sizeof(pitches));
+    memset(offsets, 0, sizeof(offsets));
+    rdpXvQueryImageAttributes(client, pPort, format, &lwidth, &lheight,
+                              pitches, offsets);
+    if ((src_x < 0) || (src_y < 0) || (lwidth < width) ||
+        (lheight < height) ||
+        (src_x + src_w > lwidth) || (src_y + src_h > lheight))
+    {
+        return BadValue;
+    }
+
+    /* visible part of the destination, drawable relative */
+    x1 = max(drw_x, 0);
+    y1 = max(drw_y, 0);
+    x2 = min(drw_x + drw_w, pDraw->width);
+    y2 = min(drw_y + drw_h, pDraw->height);
+    if (pGC->pCompositeClip != 0)
+    {
+        /* screen relative */
+        pbox = RegionExtents(pGC->pCompositeClip);
+        x1 = max(x1, pbox->x1 - pDraw->x);
+        y1 = max(y1, pbox->y1 - pDraw->y);
+        x2 = min(x2, pbox->x2 - pDraw->x);
+        y2 = min(y2, pbox->y2 - pDraw->y);
+    }
+    if ((x2 <= x1) || (y2 <= y1))
+    {
+        return Success;
+    }
+    clip_w = x2 - x1;
+    clip_h = y2 - y1;
+
+    start_ms = GetTimeInMillis();
+    if (g_xv_frames == 0)
+    {
+        g_xv_start_ms = start_ms;
+        g_xv_start_cpu_ms = rdpXvCpuMs();
+    }
+
+    /* the h264 stage takes the frame as it is, no RGB is made */
+    nv12 = rdpup_nv12_capture() && (pDraw->type == DRAWABLE_WINDOW);
+    dst_stride = PixmapBytePad(clip_w, pDraw->depth);
+    if ((size_t)clip_h > (SIZE_MAX - clip_w * sizeof(int)) / dst_stride)
+    {
+        return BadAlloc;
+    }
+    bytes = clip_w * sizeof(int);
+    if (!nv12)
+    {
+        bytes += (size_t)dst_stride * clip_h;
+    }
+    if (bytes > g_xv_rgb_bytes)
+    {
+        free(g_xv_rgb);
+        g_xv_rgb = (char *)malloc(bytes);
+        if (g_xv_rgb == 0)
+        {
+            g_xv_rgb_bytes = 0;
+            return BadAlloc;
+        }
+        g_xv_rgb_bytes = bytes;
+    }
+    /* scaled over the whole destination, only the visible part is made,
+       CARD32 as src_w times drw_w does not fit in an int */
+    sxs = (int *)g_xv_rgb;
+    rgb = g_xv_rgb + clip_w * sizeof(int);
+    for (index = 0; index < clip_w; index++)
+    {
+        sxs[index] = src_x + ((CARD32)(x1 - drw_x + index) * src_w) / drw_w;
+    }
+    if (nv12)
+    {
+        rv = rdpXvPutNV12(pDraw, pGC, format->id, data, pitches, offsets,
+                          sxs, src_y, src_h, drw_y, drw_h, x1, y1, x2, y2);
+        g_xv_convert_ms += GetTimeInMillis() - start_ms;
+        g_xv_frames++;
+        return rv;
+    }
+    for (index = 0; index < clip_h; index++)
+    {
+        sy = src_y + ((CARD32)(y1 - drw_y + index) * src_h) / drw_h;
+        rdpXvConvertRow(format->id, data, pitches, offsets, sxs, sy, clip_w,
+                        rgb + (size_t)index * dst_stride);
+    }
+    g_xv_convert_ms += GetTimeInMillis() - start_ms;
+    g_xv_frames++;
+
+    pGC->ops->PutImage(pDraw, pGC, pDraw->depth, x1, y1, clip_w, clip_h,
+                       0, ZPixmap, rgb);
     return Success;
 }
 
@@ -245,7 +775,8 @@ rdpXvQueryImageAttributes(ClientPtr client, XvPortPtr pPort, XvImagePtr format,
     int size;
     int tmp;
 
-    LLOGLN(0, ("rdpXvQueryImageAttributes:"));
+    /* called for every frame from rdpXvPutImage */
+    LLOGLN(10, ("rdpXvQueryImageAttributes:"));
 
 
     size = 0;
@@ -264,8 +795,11 @@ rdpXvQueryImageAttributes(ClientPtr client, XvPortPtr pPort, XvImagePtr format,
     {
         offsets[0] = 0;
     }
-    LLOGLN(0, ("format %x", format->id));
-    rdpXvPrintFormat(format->id);
+    LLOGLN(10, ("format %x", format->id));
+    if (10 < LOG_LEVEL)
+    {
+        rdpXvPrintFormat(format->id);
+    }
     switch (format->id)
     {
         case FOURCC_YV12:
@@ -294,7 +828,6 @@ rdpXvQueryImageAttributes(ClientPtr client, XvPortPtr pPort, XvImagePtr format,
             /* offset of V => Y plane + U plane (w*h + w/2*h/2) */
             tmp *= (*height >> 1);
             size += tmp;
-            size += tmp;
             if (offsets != 0)
             {
                 offsets[2] = size;
@@ -335,6 +868,14 @@ rdpXvCloseScreen(int i, ScreenPtr pScreen)
 
     LLOGLN(0, ("rdpXvCloseScreen:"));
     free(pxvs->pAdaptors);
+    free(g_xv_rgb);
+    g_xv_rgb = 0;
+    g_xv_rgb_bytes = 0;
+    free(g_xv_nv12);
+    g_xv_nv12 = 0;
+    g_xv_nv12_bytes = 0;
+    g_xv_nv12_width = 0;
+    g_xv_nv12_height = 0;
     return 0;
 }
 
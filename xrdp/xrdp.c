@@ -108,6 +108,13 @@ xrdp_shutdown(int sig) {
 	}
 }
 
+/*****************************************************************************/
+void DEFAULT_CC
+xrdp_hang_up(int sig) {
+	/* reread the TLS key and certificate before the next handshake */
+	ssl_tls_ctx_reload();
+}
+
 /*****************************************************************************/
 void DEFAULT_CC
 xrdp_child(int sig) {
@@ -486,6 +493,7 @@ main(int argc, char **argv) {
 	g_signal_pipe(pipe_sig); /* SIGPIPE */
 	g_signal_terminate(xrdp_shutdown); /* SIGTERM */
 	g_signal_child_stop(xrdp_child); /* SIGCHLD */
+	g_signal_hang_up(xrdp_hang_up); /* SIGHUP */
 	g_sync_mutex = tc_mutex_create();
 	g_sync1_mutex = tc_mutex_create();
 	pid = g_getpid();
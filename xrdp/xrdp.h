@@ -63,6 +63,18 @@ int APP_CC
 xrdp_cache_reset(struct xrdp_cache* self,
                  struct xrdp_client_info* client_info);
 int APP_CC
+xrdp_cache_insert_bitmap(struct xrdp_cache* self, struct xrdp_bitmap* bitmap,
+                         int* cache_id_out, int* cache_idx_out);
+int APP_CC
+xrdp_cache_send_bitmap(struct xrdp_cache* self, struct xrdp_bitmap* bitmap,
+                       int cache_id, int cache_idx, int hints);
+void APP_CC
+xrdp_cache_bitmap_sent(struct xrdp_cache* self, int kind);
+void APP_CC
+xrdp_cache_begin_update(struct xrdp_cache* self);
+void APP_CC
+xrdp_cache_end_update(struct xrdp_cache* self);
+int APP_CC
 xrdp_cache_add_bitmap(struct xrdp_cache* self, struct xrdp_bitmap* bitmap,
                       int hints);
 int APP_CC
@@ -78,6 +90,8 @@ xrdp_cache_add_pointer_static(struct xrdp_cache* self,
                               struct xrdp_pointer_item* pointer_item,
                               int index);
 int APP_CC
+xrdp_cache_set_pointer_hash(struct xrdp_cache* self, int hash);
+int APP_CC
 xrdp_cache_add_brush(struct xrdp_cache* self,
                      char* brush_item_data);
 int APP_CC
@@ -147,6 +161,8 @@ xrdp_wm_get_wait_objs(struct xrdp_wm* self, tbus* robjs, int* rc,
 int APP_CC
 xrdp_wm_check_wait_objs(struct xrdp_wm* self);
 int APP_CC
+xrdp_wm_input_flush(struct xrdp_wm* self);
+int APP_CC
 xrdp_wm_set_login_mode(struct xrdp_wm* self, int login_mode);
 
 /* xrdp_process.c */
@@ -236,6 +252,28 @@ xrdp_bitmap_get_screen_clip(struct xrdp_bitmap* self,
                             struct xrdp_rect* rect,
                             int* dx, int* dy);
 
+/* xrdp_workers.c */
+struct xrdp_workers* APP_CC
+xrdp_workers_create(int num_threads);
+void APP_CC
+xrdp_workers_delete(struct xrdp_workers* self);
+int APP_CC
+xrdp_workers_run(struct xrdp_workers* self, xrdp_workers_proc proc,
+                 void* arg, int count);
+
+/* xrdp_rfx.c */
+struct xrdp_rfx* APP_CC
+xrdp_rfx_create(int width, int height);
+void APP_CC
+xrdp_rfx_delete(struct xrdp_rfx* self);
+int APP_CC
+xrdp_rfx_encode(struct xrdp_rfx* self, const char* data, int width,
+                int height, int stride,
+                const short* drects, int num_drects,
+                const short* crects, int num_crects,
+                int send_header, int pad_bytes,
+                char** out_data, int* out_bytes);
+
 /* xrdp_painter.c */
 struct xrdp_painter* APP_CC
 xrdp_painter_create(struct xrdp_wm* wm, struct xrdp_session* session);
@@ -287,6 +325,13 @@ xrdp_painter_copy(struct xrdp_painter* self,
                   int x, int y, int cx, int cy,
                   int srcx, int srcy);
 int APP_CC
+xrdp_painter_copy_comp(struct xrdp_painter* self,
+                       struct xrdp_bitmap* src,
+                       struct xrdp_bitmap* dst,
+                       int x, int y, int cx, int cy,
+                       int srcx, int srcy,
+                       char* comp_data, int comp_bytes);
+int APP_CC
 xrdp_painter_composite(struct xrdp_painter* self,
                        struct xrdp_bitmap* src,
                        int srcformat,
@@ -400,6 +445,10 @@ server_paint_rect_bpp(struct xrdp_mod* mod, int x, int y, int cx, int cy,
                       char* data, int width, int height, int srcx, int srcy,
                       int bpp);
 int DEFAULT_CC
+server_paint_rect_comp(struct xrdp_mod* mod, int x, int y, int cx, int cy,
+                       char* data, int width, int height, int srcx, int srcy,
+                       char* comp_data, int comp_bytes);
+int DEFAULT_CC
 server_composite(struct xrdp_mod* mod, int srcidx, int srcformat, int srcwidth,
                  int srcrepeat, int* srctransform, int mskflags, int mskidx,
                  int mskformat, int mskwidth, int mskrepeat, int op,
@@ -417,6 +466,8 @@ int DEFAULT_CC
 server_set_pointer_ex(struct xrdp_mod* mod, int x, int y,
                       char* data, char* mask, int bpp);
 int DEFAULT_CC
+server_set_pointer_hash(struct xrdp_mod* mod, int hash);
+int DEFAULT_CC
 server_palette(struct xrdp_mod* mod, int* palette);
 int DEFAULT_CC
 server_msg(struct xrdp_mod* mod, char* msg, int code);
@@ -21,6 +21,7 @@
 #include "xrdp.h"
 #include "log.h"
 #include "crc16.h"
+#include "pointer_hash.h"
 
 #define LLOG_LEVEL 1
 #define LLOGLN(_level, _args) \
@@ -82,35 +83,54 @@ xrdp_cache_reset_crc(struct xrdp_cache *self) {
 }
 
 /*****************************************************************************/
-struct xrdp_cache *APP_CC
-xrdp_cache_create(struct xrdp_wm *owner, struct xrdp_session *session,
-		struct xrdp_client_info *client_info) {
-	struct xrdp_cache *self;
+static int APP_CC
+xrdp_cache_entries(int entries) {
+	return MAX(MIN(XRDP_MAX_BITMAP_CACHE_IDX, entries), 0);
+}
 
-	self = (struct xrdp_cache *) g_malloc(sizeof(struct xrdp_cache), 1);
-	self->wm = owner;
-	self->session = session;
+/*****************************************************************************/
+/* the part of the cache that depends on what the client said it can do */
+static void APP_CC
+xrdp_cache_set_layout(struct xrdp_cache *self,
+		struct xrdp_client_info *client_info) {
+	self->bpp = client_info->bpp;
 	self->use_bitmap_comp = client_info->use_bitmap_comp;
 
-	self->cache1_entries = MIN(XRDP_MAX_BITMAP_CACHE_IDX,
-			client_info->cache1_entries);
-	self->cache1_entries = MAX(self->cache1_entries, 0);
+	self->cache1_entries = xrdp_cache_entries(client_info->cache1_entries);
 	self->cache1_size = client_info->cache1_size;
 
-	self->cache2_entries = MIN(XRDP_MAX_BITMAP_CACHE_IDX,
-			client_info->cache2_entries);
-	self->cache2_entries = MAX(self->cache2_entries, 0);
+	self->cache2_entries = xrdp_cache_entries(client_info->cache2_entries);
 	self->cache2_size = client_info->cache2_size;
 
-	self->cache3_entries = MIN(XRDP_MAX_BITMAP_CACHE_IDX,
-			client_info->cache3_entries);
-	self->cache3_entries = MAX(self->cache3_entries, 0);
+	self->cache3_entries = xrdp_cache_entries(client_info->cache3_entries);
 	self->cache3_size = client_info->cache3_size;
 
 	self->bitmap_cache_persist_enable =
 			client_info->bitmap_cache_persist_enable;
 	self->bitmap_cache_version = client_info->bitmap_cache_version;
 	self->pointer_cache_entries = client_info->pointer_cache_entries;
+	self->brush_cache_code = client_info->brush_cache_code;
+	/* NEG_GLYPH_INDEX_INDEX, the order the glyph cache is used with */
+	self->glyph_order = client_info->orders[0x1b];
+
+	self->os_entries_max = 0;
+	self->os_bytes_max = 0;
+	if (client_info->offscreen_support_level > 0) {
+		self->os_entries_max = MIN(2000, client_info->offscreen_cache_entries);
+		self->os_bytes_max = client_info->offscreen_cache_size;
+	}
+}
+
+/*****************************************************************************/
+struct xrdp_cache *APP_CC
+xrdp_cache_create(struct xrdp_wm *owner, struct xrdp_session *session,
+		struct xrdp_client_info *client_info) {
+	struct xrdp_cache *self;
+
+	self = (struct xrdp_cache *) g_malloc(sizeof(struct xrdp_cache), 1);
+	self->wm = owner;
+	self->session = session;
+	xrdp_cache_set_layout(self, client_info);
 	self->xrdp_os_del_list = list_create();
 	xrdp_cache_reset_lru(self);
 	xrdp_cache_reset_crc(self);
@@ -130,6 +150,39 @@ xrdp_cache_delete(struct xrdp_cache *self) {
 		return;
 	}
 
+	if (self->bitmap_hits + self->bitmap_misses > 0) {
+		log_message(LOG_LEVEL_INFO, "bitmap cache: %d hits %d misses "
+				"(%d%% hit rate), %d lossless %d codec tiles, "
+				"%d passed through", self->bitmap_hits, self->bitmap_misses,
+				(self->bitmap_hits * 100) /
+				(self->bitmap_hits + self->bitmap_misses),
+				self->bitmap_misses - self->bitmap_codec, self->bitmap_codec,
+				self->bitmap_passthrough);
+	}
+
+	if (self->bitmap_frames > 0) {
+		log_message(LOG_LEVEL_INFO, "bitmap cache: %.0f bytes sent, "
+				"%.0f codec %.0f uncompressed, %d updates, %.0f bytes per "
+				"update, %d at most", self->bitmap_bytes,
+				self->bitmap_codec_bytes, self->bitmap_raw_bytes,
+				self->bitmap_frames, self->bitmap_bytes / self->bitmap_frames,
+				self->bitmap_frame_max);
+	}
+
+	if (self->os_creates > 0) {
+		log_message(LOG_LEVEL_INFO, "off screen cache: %d surfaces made, "
+				"peak %d of %d bytes, %d paints from it saved %.0f bytes",
+				self->os_creates, self->os_bytes_peak, self->os_bytes_max,
+				self->os_blts, self->os_blt_bytes);
+	}
+
+	if (self->pointer_sends > 0) {
+		log_message(LOG_LEVEL_INFO, "pointer cache: %d sent %d hits "
+				"%d repeats %d hashes not found, %.0f bytes not sent",
+				self->pointer_sends, self->pointer_hits, self->pointer_repeats,
+				self->pointer_hash_misses, self->pointer_bytes_saved);
+	}
+
 	/* free all the cached bitmaps */
 	for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++) {
 		for (j = 0; j < XRDP_MAX_BITMAP_CACHE_IDX; j++) {
@@ -162,48 +215,115 @@ xrdp_cache_delete(struct xrdp_cache *self) {
 }
 
 /*****************************************************************************/
+/* returns true if client_info gives the bitmap cache layout self has */
+static int APP_CC
+xrdp_cache_same_bitmap_layout(struct xrdp_cache *self,
+		struct xrdp_client_info *client_info) {
+	return (self->bpp == client_info->bpp) &&
+			(self->use_bitmap_comp == client_info->use_bitmap_comp) &&
+			(self->cache1_entries ==
+					xrdp_cache_entries(client_info->cache1_entries)) &&
+			(self->cache1_size == client_info->cache1_size) &&
+			(self->cache2_entries ==
+					xrdp_cache_entries(client_info->cache2_entries)) &&
+			(self->cache2_size == client_info->cache2_size) &&
+			(self->cache3_entries ==
+					xrdp_cache_entries(client_info->cache3_entries)) &&
+			(self->cache3_size == client_info->cache3_size) &&
+			(self->bitmap_cache_persist_enable ==
+					client_info->bitmap_cache_persist_enable) &&
+			(self->bitmap_cache_version ==
+					client_info->bitmap_cache_version);
+}
+
+/*****************************************************************************/
+/* the client loses its off screen bitmaps on a reactivate, they are
+   freed here, the module gets an error for any it still uses and the
+   screen is the target again */
+static void APP_CC
+xrdp_cache_clear_os(struct xrdp_cache *self) {
+	int i;
+
+	/* the client draws on the screen after a reactivate */
+	if ((self->wm->target_surface != 0) &&
+			(self->wm->target_surface->type == WND_TYPE_OFFSCREEN)) {
+		self->wm->target_surface = self->wm->screen;
+	}
+	self->wm->current_surface_index = 0xffff;
+	for (i = 0; i < 2000; i++) {
+		xrdp_bitmap_delete(self->os_bitmap_items[i].bitmap);
+	}
+	g_memset(self->os_bitmap_items, 0, sizeof(self->os_bitmap_items));
+	self->os_bytes = 0;
+	/* nothing left on the client to delete */
+	list_clear(self->xrdp_os_del_list);
+}
+
+/*****************************************************************************/
+/* called after a deactivate / reactivate, a resize for example
+   each client side cache is kept when what the client said about it is
+   the same as before and cleared when not, off screen bitmaps are always
+   gone */
 int APP_CC
 xrdp_cache_reset(struct xrdp_cache *self, struct xrdp_client_info *client_info) {
-	struct xrdp_wm *wm;
-	struct xrdp_session *session;
 	int i;
 	int j;
-
-	/* free all the cached bitmaps */
-	for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++) {
-		for (j = 0; j < XRDP_MAX_BITMAP_CACHE_IDX; j++) {
-			xrdp_bitmap_delete(self->bitmap_items[i][j].bitmap);
+	int cleared;
+
+	cleared = 0;
+	if (!xrdp_cache_same_bitmap_layout(self, client_info)) {
+		/* free all the cached bitmaps */
+		for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++) {
+			for (j = 0; j < XRDP_MAX_BITMAP_CACHE_IDX; j++) {
+				xrdp_bitmap_delete(self->bitmap_items[i][j].bitmap);
+			}
 		}
+		self->bitmap_stamp = 0;
+		g_memset(self->bitmap_items, 0, sizeof(self->bitmap_items));
+		xrdp_cache_reset_lru(self);
+		xrdp_cache_reset_crc(self);
+		cleared |= 1;
 	}
 
-	/* free all the cached font items */
-	for (i = 0; i < 12; i++) {
-		for (j = 0; j < 256; j++) {
-			g_free(self->char_items[i][j].font_item.data);
+	if (self->bpp != client_info->bpp) {
+		self->palette_stamp = 0;
+		g_memset(self->palette_items, 0, sizeof(self->palette_items));
+		cleared |= 2;
+	}
+
+	if (self->glyph_order != client_info->orders[0x1b]) {
+		/* free all the cached font items */
+		for (i = 0; i < 12; i++) {
+			for (j = 0; j < 256; j++) {
+				g_free(self->char_items[i][j].font_item.data);
+			}
 		}
+		self->char_stamp = 0;
+		g_memset(self->char_items, 0, sizeof(self->char_items));
+		cleared |= 4;
 	}
 
-	/* save these */
-	wm = self->wm;
-	session = self->session;
-	/* set whole struct to zero */
-	g_memset(self, 0, sizeof(struct xrdp_cache));
-	/* set some stuff back */
-	self->wm = wm;
-	self->session = session;
-	self->use_bitmap_comp = client_info->use_bitmap_comp;
-	self->cache1_entries = client_info->cache1_entries;
-	self->cache1_size = client_info->cache1_size;
-	self->cache2_entries = client_info->cache2_entries;
-	self->cache2_size = client_info->cache2_size;
-	self->cache3_entries = client_info->cache3_entries;
-	self->cache3_size = client_info->cache3_size;
-	self->bitmap_cache_persist_enable =
-			client_info->bitmap_cache_persist_enable;
-	self->bitmap_cache_version = client_info->bitmap_cache_version;
-	self->pointer_cache_entries = client_info->pointer_cache_entries;
-	xrdp_cache_reset_lru(self);
-	xrdp_cache_reset_crc(self);
+	if (self->pointer_cache_entries != client_info->pointer_cache_entries) {
+		self->pointer_stamp = 0;
+		g_memset(self->pointer_items, 0, sizeof(self->pointer_items));
+		/* the pointer the client had up is gone with the pointer cache,
+		   the next one has to be sent even if it is the same */
+		self->wm->current_pointer = -1;
+		cleared |= 8;
+	}
+
+	if (self->brush_cache_code != client_info->brush_cache_code) {
+		self->brush_stamp = 0;
+		g_memset(self->brush_items, 0, sizeof(self->brush_items));
+		cleared |= 16;
+	}
+
+	xrdp_cache_clear_os(self);
+	LLOGLN(0, ("xrdp_cache_reset: bpp %d to %d, cleared bitmap %d palette "
+			"%d glyph %d pointer %d brush %d", self->bpp, client_info->bpp,
+			(cleared & 1) != 0, (cleared & 2) != 0, (cleared & 4) != 0,
+			(cleared & 8) != 0, (cleared & 16) != 0));
+	xrdp_cache_set_layout(self, client_info);
 	return 0;
 }
 
@@ -276,10 +396,12 @@ xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index) {
 }
 
 /*****************************************************************************/
-/* returns cache id */
+/* find bitmap in the cache or take the lru slot for it, the cache owns
+   bitmap after this, on a hit it is deleted
+   returns 0 found, 1 added and the client needs it sent, -1 error */
 int APP_CC
-xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
-		int hints) {
+xrdp_cache_insert_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
+		int *cache_id_out, int *cache_idx_out) {
 	int index;
 	int jndex;
 	int cache_id;
@@ -323,7 +445,7 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
 				"too big(%d) bpp %d cache 1 : %d cache 2 : %d cache 3:%d",
 				bmp_size, bitmap->bpp, self->cache1_size, self->cache2_size,
 				self->cache3_size);
-		return 0;
+		return -1;
 	}
 
 	crc16 = bitmap->crc16;
@@ -345,7 +467,10 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
 		/* update lru to end */
 		xrdp_cache_update_lru(self, cache_id, lru_index);
 
-		return MAKELONG(cache_idx, cache_id);
+		*cache_id_out = cache_id;
+		*cache_idx_out = cache_idx;
+		self->bitmap_hits++;
+		return 0;
 	}
 
 	/* find lru */
@@ -402,39 +527,116 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
 		LLOGLN(10, ("xrdp_cache_add_bitmap: count %d", ll->count));
 	}
 
+	*cache_id_out = cache_id;
+	*cache_idx_out = cache_idx;
+	self->bitmap_misses++;
+	return 1;
+}
+
+/*****************************************************************************/
+/* counts the bitmap order just sent, kind is XRDP_BITMAP_SENT_* */
+void APP_CC
+xrdp_cache_bitmap_sent(struct xrdp_cache *self, int kind) {
+	int bytes;
+
+	bytes = libxrdp_orders_last_size(self->session);
+	self->bitmap_bytes += bytes;
+	if (kind == XRDP_BITMAP_SENT_CODEC) {
+		self->bitmap_codec_bytes += bytes;
+	} else if (kind == XRDP_BITMAP_SENT_RAW) {
+		self->bitmap_raw_bytes += bytes;
+	}
+	self->bitmap_frame_bytes += bytes;
+}
+
+/*****************************************************************************/
+/* the painter's updates are the frames the bitmap bytes are counted in */
+void APP_CC
+xrdp_cache_begin_update(struct xrdp_cache *self) {
+	self->update_level++;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_cache_end_update(struct xrdp_cache *self) {
+	if (self->update_level > 0) {
+		self->update_level--;
+	}
+	if ((self->update_level == 0) && (self->bitmap_frame_bytes > 0)) {
+		self->bitmap_frames++;
+		if (self->bitmap_frame_bytes > self->bitmap_frame_max) {
+			self->bitmap_frame_max = self->bitmap_frame_bytes;
+		}
+		self->bitmap_frame_bytes = 0;
+	}
+}
+
+/*****************************************************************************/
+/* send a bitmap xrdp_cache_insert_bitmap added to the client */
+int APP_CC
+xrdp_cache_send_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
+		int cache_id, int cache_idx, int hints) {
 	if (self->use_bitmap_comp) {
 		if (self->bitmap_cache_version & 4) {
 			if (libxrdp_orders_send_bitmap3(self->session, bitmap->width,
 					bitmap->height, bitmap->bpp, bitmap->data, cache_id,
 					cache_idx, hints) == 0) {
+				self->bitmap_codec++;
+				xrdp_cache_bitmap_sent(self, XRDP_BITMAP_SENT_CODEC);
 				return MAKELONG(cache_idx, cache_id);
 			}
 		}
 
 		if (self->bitmap_cache_version & 2) {
-			libxrdp_orders_send_bitmap2(self->session, bitmap->width,
+			if (libxrdp_orders_send_bitmap2(self->session, bitmap->width,
 					bitmap->height, bitmap->bpp, bitmap->data, cache_id,
-					cache_idx, hints);
+					cache_idx, hints) == 0) {
+				xrdp_cache_bitmap_sent(self, XRDP_BITMAP_SENT_LOSSLESS);
+			}
 		} else if (self->bitmap_cache_version & 1) {
-			libxrdp_orders_send_bitmap(self->session, bitmap->width,
+			if (libxrdp_orders_send_bitmap(self->session, bitmap->width,
 					bitmap->height, bitmap->bpp, bitmap->data, cache_id,
-					cache_idx);
+					cache_idx) == 0) {
+				xrdp_cache_bitmap_sent(self, XRDP_BITMAP_SENT_LOSSLESS);
+			}
 		}
 	} else {
 		if (self->bitmap_cache_version & 2) {
-			libxrdp_orders_send_raw_bitmap2(self->session, bitmap->width,
+			if (libxrdp_orders_send_raw_bitmap2(self->session, bitmap->width,
 					bitmap->height, bitmap->bpp, bitmap->data, cache_id,
-					cache_idx);
+					cache_idx) == 0) {
+				xrdp_cache_bitmap_sent(self, XRDP_BITMAP_SENT_RAW);
+			}
 		} else if (self->bitmap_cache_version & 1) {
-			libxrdp_orders_send_raw_bitmap(self->session, bitmap->width,
+			if (libxrdp_orders_send_raw_bitmap(self->session, bitmap->width,
 					bitmap->height, bitmap->bpp, bitmap->data, cache_id,
-					cache_idx);
+					cache_idx) == 0) {
+				xrdp_cache_bitmap_sent(self, XRDP_BITMAP_SENT_RAW);
+			}
 		}
 	}
 
 	return MAKELONG(cache_idx, cache_id);
 }
 
+/*****************************************************************************/
+/* returns cache id */
+int APP_CC
+xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
+		int hints) {
+	int cache_id;
+	int cache_idx;
+
+	switch (xrdp_cache_insert_bitmap(self, bitmap, &cache_id, &cache_idx)) {
+	case 0:
+		return MAKELONG(cache_idx, cache_id);
+	case 1:
+		return xrdp_cache_send_bitmap(self, bitmap, cache_id, cache_idx,
+				hints);
+	}
+	return 0;
+}
+
 /*****************************************************************************/
 /* not used */
 /* not sure how to use a palette in rdp */
@@ -542,6 +744,43 @@ xrdp_cache_add_char(struct xrdp_cache *self, struct xrdp_font_char *font_item) {
 	return MAKELONG(c, f);
 }
 
+/*****************************************************************************/
+/* bytes of pointer data for bpp, 0 is 24 like xrdp_wm_pointer */
+static int APP_CC
+xrdp_cache_pointer_bytes(int bpp) {
+	return POINTER_HASH_BYTES(bpp);
+}
+
+/*****************************************************************************/
+/* the same hash the X server sends in place of a pointer it sent before */
+static int APP_CC
+xrdp_cache_pointer_hash(struct xrdp_pointer_item *pointer_item) {
+	unsigned int hash;
+
+	POINTER_HASH(hash, pointer_item->x, pointer_item->y, pointer_item->bpp,
+			pointer_item->data, pointer_item->mask);
+	return (int) hash;
+}
+
+/*****************************************************************************/
+/* the pointer at index is wanted again, sets the client to it if it is not
+ up already */
+static void APP_CC
+xrdp_cache_use_pointer(struct xrdp_cache *self, int index) {
+	self->pointer_items[index].stamp = self->pointer_stamp;
+	self->pointer_bytes_saved += xrdp_cache_pointer_bytes(
+			self->pointer_items[index].bpp) + 32 * 32 / 8;
+	if (self->wm->current_pointer == index) {
+		/* the client has it up already */
+		self->pointer_repeats++;
+		return;
+	}
+	self->pointer_hits++;
+	xrdp_wm_set_pointer(self->wm, index);
+	self->wm->current_pointer = index;
+	DEBUG("found pointer at %d", index);
+}
+
 /*****************************************************************************/
 /* added the pointer to the cache and send it to client, it also sets the
  client if it finds it
@@ -553,26 +792,26 @@ xrdp_cache_add_pointer(struct xrdp_cache *self,
 	int i;
 	int oldest;
 	int index;
+	int hash;
 
 	if (self == 0) {
 		return 0;
 	}
 
 	self->pointer_stamp++;
+	hash = xrdp_cache_pointer_hash(pointer_item);
 
-	/* look for match */
+	/* look for match, the hash rules out all but the match */
 	for (i = 2; i < self->pointer_cache_entries; i++) {
-		if (self->pointer_items[i].x == pointer_item->x
+		if (self->pointer_items[i].hash == hash
+				&& self->pointer_items[i].x == pointer_item->x
 				&& self->pointer_items[i].y == pointer_item->y
 				&& g_memcmp(self->pointer_items[i].data, pointer_item->data,
 						32 * 32 * 4) == 0
 				&& g_memcmp(self->pointer_items[i].mask, pointer_item->mask,
 						32 * 32 / 8) == 0
 				&& self->pointer_items[i].bpp == pointer_item->bpp) {
-			self->pointer_items[i].stamp = self->pointer_stamp;
-			xrdp_wm_set_pointer(self->wm, i);
-			self->wm->current_pointer = i;
-			DEBUG("found pointer at %d", i);
+			xrdp_cache_use_pointer(self, i);
 			return i;
 		}
 	}
@@ -594,6 +833,8 @@ xrdp_cache_add_pointer(struct xrdp_cache *self,
 	g_memcpy(self->pointer_items[index].mask, pointer_item->mask, 32 * 32 / 8);
 	self->pointer_items[index].stamp = self->pointer_stamp;
 	self->pointer_items[index].bpp = pointer_item->bpp;
+	self->pointer_items[index].hash = hash;
+	self->pointer_sends++;
 	xrdp_wm_send_pointer(self->wm, index, self->pointer_items[index].data,
 			self->pointer_items[index].mask, self->pointer_items[index].x,
 			self->pointer_items[index].y, self->pointer_items[index].bpp);
@@ -602,6 +843,31 @@ xrdp_cache_add_pointer(struct xrdp_cache *self,
 	return index;
 }
 
+/*****************************************************************************/
+/* the X server sent only the hash of a pointer it sent before, sets the
+ client to it if it is still in the cache
+ returns the index in the cache or -1 if it is not there, then the X server
+ has to send the whole pointer */
+int APP_CC
+xrdp_cache_set_pointer_hash(struct xrdp_cache *self, int hash) {
+	int i;
+
+	if (self == 0 || hash == 0) {
+		return -1;
+	}
+
+	for (i = 2; i < self->pointer_cache_entries; i++) {
+		if (self->pointer_items[i].hash == hash) {
+			self->pointer_stamp++;
+			xrdp_cache_use_pointer(self, i);
+			return i;
+		}
+	}
+
+	self->pointer_hash_misses++;
+	return -1;
+}
+
 /*****************************************************************************/
 /* this does not take owership of pointer_item, it makes a copy */
 int APP_CC
@@ -618,6 +884,7 @@ xrdp_cache_add_pointer_static(struct xrdp_cache *self,
 	g_memcpy(self->pointer_items[index].mask, pointer_item->mask, 32 * 32 / 8);
 	self->pointer_items[index].stamp = self->pointer_stamp;
 	self->pointer_items[index].bpp = pointer_item->bpp;
+	self->pointer_items[index].hash = xrdp_cache_pointer_hash(pointer_item);
 	xrdp_wm_send_pointer(self->wm, index, self->pointer_items[index].data,
 			self->pointer_items[index].mask, self->pointer_items[index].x,
 			self->pointer_items[index].y, self->pointer_items[index].bpp);
@@ -669,18 +936,39 @@ xrdp_cache_add_brush(struct xrdp_cache *self, char *brush_item_data) {
 }
 
 /*****************************************************************************/
-/* returns error */
+/* returns error, the module evicts to stay in the client's budget, going
+   over is only logged so the module and client stay in step */
 int APP_CC
 xrdp_cache_add_os_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
 		int rdpindex) {
 	struct xrdp_os_bitmap_item *bi;
+	int Bpp;
 
 	if ((rdpindex < 0) || (rdpindex >= 2000)) {
 		return 1;
 	}
 
+	if (rdpindex >= self->os_entries_max) {
+		LLOGLN(0, ("xrdp_cache_add_os_bitmap: index %d past client's %d",
+				rdpindex, self->os_entries_max));
+	}
+
 	bi = self->os_bitmap_items + rdpindex;
+	if (bi->bitmap != 0) {
+		/* index used again without a delete */
+		xrdp_cache_remove_os_bitmap(self, rdpindex);
+	}
+
+	Bpp = (self->bpp + 7) / 8;
 	bi->bitmap = bitmap;
+	bi->bytes = bitmap->width * bitmap->height * Bpp;
+	self->os_bytes += bi->bytes;
+	self->os_bytes_peak = MAX(self->os_bytes_peak, self->os_bytes);
+	self->os_creates++;
+	if ((self->os_bytes_max > 0) && (self->os_bytes > self->os_bytes_max)) {
+		LLOGLN(0, ("xrdp_cache_add_os_bitmap: %d bytes over client's %d",
+				self->os_bytes, self->os_bytes_max));
+	}
 	return 0;
 }
 
@@ -697,6 +985,10 @@ xrdp_cache_remove_os_bitmap(struct xrdp_cache *self, int rdpindex) {
 
 	bi = self->os_bitmap_items + rdpindex;
 
+	if (bi->bitmap == 0) {
+		return 1;
+	}
+
 	if (bi->bitmap->tab_stop) {
 		index = list_index_of(self->xrdp_os_del_list, rdpindex);
 
@@ -705,6 +997,7 @@ xrdp_cache_remove_os_bitmap(struct xrdp_cache *self, int rdpindex) {
 		}
 	}
 
+	self->os_bytes -= bi->bytes;
 	xrdp_bitmap_delete(bi->bitmap);
 	g_memset(bi, 0, sizeof(struct xrdp_os_bitmap_item));
 	return 0;
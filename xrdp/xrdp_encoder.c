@@ -27,6 +27,11 @@
 #include "rfxcodec_encode.h"
 #endif
 
+#ifdef XRDP_X264
+#include <stdint.h>
+#include <x264.h>
+#endif
+
 #define LLOG_LEVEL 1
 #define LLOGLN(_level, _args) \
   do \
@@ -39,13 +44,50 @@
   } \
   while (0)
 
+/* compressors, one per thread that can be in xrdp_enc_jpg_proc */
+#define XRDP_ENC_JPG_CTXS 8
+/* in tenths, rects with more equal neighbours than this are text */
+#define XRDP_ENC_JPG_FLAT 6
+#define XRDP_ENC_JPG_TEXT_QUALITY 90
+
+struct xrdp_enc_jpg_ctx
+{
+    void *han;
+    char *buf; /* compress scratch, kept */
+    int buf_bytes;
+};
+
+/* jpeg session state, lives in codec_handle */
+struct xrdp_enc_jpg
+{
+    struct xrdp_workers *workers;
+    tbus mutex; /* protects free_ctxs */
+    struct xrdp_enc_jpg_ctx ctxs[XRDP_ENC_JPG_CTXS];
+    struct xrdp_enc_jpg_ctx *free_ctxs[XRDP_ENC_JPG_CTXS];
+    int num_free;
+    /* current frame */
+    XRDP_ENC_DATA *enc;
+    int quality;
+    XRDP_ENC_DATA_DONE **done; /* one per crect */
+    int done_alloc;
+};
+
 /*****************************************************************************/
 static int
 process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+static void
+xrdp_enc_jpg_delete(struct xrdp_enc_jpg *jpg);
+static struct xrdp_enc_jpg *
+xrdp_enc_jpg_create(void);
 static int
 process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
 static int
 process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+#ifdef XRDP_X264
+struct xrdp_enc_h264;
+static void
+xrdp_enc_h264_delete(struct xrdp_enc_h264 *h264);
+#endif
 
 /*****************************************************************************/
 struct xrdp_encoder *APP_CC
@@ -79,19 +121,28 @@ xrdp_encoder_create(struct xrdp_mm *mm)
             /* XRDP_a8b8g8r8 */
             (32 << 24) | (3 << 16) | (8 << 12) | (8 << 8) | (8 << 4) | 8;
         self->process_enc = process_enc_jpg;
+        self->codec_handle = xrdp_enc_jpg_create();
     }
     else if (mm->wm->client_info->rfx_codec_id != 0)
     {
         LLOGLN(0, ("xrdp_encoder_create: starting rfx codec session"));
         self->codec_id = mm->wm->client_info->rfx_codec_id;
         self->in_codec_mode = 1;
-        mm->wm->client_info->capture_code = 2;
         self->process_enc = process_enc_rfx;
 #ifdef XRDP_RFXCODEC
+        mm->wm->client_info->capture_code = 2;
         self->codec_handle =
             rfxcodec_encode_create(mm->wm->screen->width,
                                    mm->wm->screen->height,
                                    RFX_FORMAT_YUV, 0);
+#else
+        /* in tree encoder takes the plain screen and tiles it itself */
+        mm->wm->client_info->capture_code = 0;
+        mm->wm->client_info->capture_format =
+            /* XRDP_a8r8g8b8 */
+            (32 << 24) | (2 << 16) | (8 << 12) | (8 << 8) | (8 << 4) | 8;
+        self->codec_handle =
+            xrdp_rfx_create(mm->wm->screen->width, mm->wm->screen->height);
 #endif
     }
     else if (mm->wm->client_info->h264_codec_id != 0)
@@ -155,6 +206,25 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     g_sleep(1000);
 
     /* todo delete specific encoder */
+    if (self->process_enc == process_enc_jpg)
+    {
+        xrdp_enc_jpg_delete((struct xrdp_enc_jpg *) (self->codec_handle));
+        self->codec_handle = 0;
+    }
+#ifndef XRDP_RFXCODEC
+    if (self->process_enc == process_enc_rfx)
+    {
+        xrdp_rfx_delete((struct xrdp_rfx *) (self->codec_handle));
+        self->codec_handle = 0;
+    }
+#endif
+#ifdef XRDP_X264
+    if (self->process_enc == process_enc_h264)
+    {
+        xrdp_enc_h264_delete((struct xrdp_enc_h264 *) (self->codec_handle));
+        self->codec_handle = 0;
+    }
+#endif
 
     /* destroy wait objects used for signalling */
     g_delete_wait_obj(self->xrdp_encoder_event_to_proc);
@@ -199,92 +269,265 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
 }
 
 /*****************************************************************************/
-/* called from encoder thread */
+/* guesses whether a rect is text and flat ui or photo like, flat content
+   has long runs of the same pixel, photos almost none, samples every 4th
+   row, a8b8g8r8 */
 static int
-process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+xrdp_enc_jpg_is_text(const char *data, int stride, int x, int y,
+                     int cx, int cy)
 {
-    int index;
+    const int *src;
+    int row;
+    int col;
+    int same;
+    int total;
+
+    same = 0;
+    total = 0;
+    for (row = 0; row < cy; row += 4)
+    {
+        src = (const int *) (data + (y + row) * stride) + x;
+        for (col = 1; col < cx; col++)
+        {
+            same += (src[col] & 0xffffff) == (src[col - 1] & 0xffffff);
+        }
+        total += cx - 1;
+    }
+    return same * 10 > total * XRDP_ENC_JPG_FLAT;
+}
+
+/*****************************************************************************/
+static struct xrdp_enc_jpg_ctx *
+xrdp_enc_jpg_get_ctx(struct xrdp_enc_jpg *jpg)
+{
+    struct xrdp_enc_jpg_ctx *ctx;
+
+    tc_mutex_lock(jpg->mutex);
+    ctx = jpg->free_ctxs[--(jpg->num_free)];
+    tc_mutex_unlock(jpg->mutex);
+    return ctx;
+}
+
+/*****************************************************************************/
+static void
+xrdp_enc_jpg_put_ctx(struct xrdp_enc_jpg *jpg, struct xrdp_enc_jpg_ctx *ctx)
+{
+    tc_mutex_lock(jpg->mutex);
+    jpg->free_ctxs[(jpg->num_free)++] = ctx;
+    tc_mutex_unlock(jpg->mutex);
+}
+
+/*****************************************************************************/
+/* xrdp_workers_proc, compresses crect index into the ctx's scratch and
+   copies out just the bytes used */
+static void
+xrdp_enc_jpg_proc(void *arg, int index)
+{
+    struct xrdp_enc_jpg *jpg;
+    struct xrdp_enc_jpg_ctx *ctx;
+    XRDP_ENC_DATA *enc;
+    XRDP_ENC_DATA_DONE *enc_done;
     int x;
     int y;
     int cx;
     int cy;
     int quality;
-    int error;
+    int flags;
     int out_data_bytes;
-    int count;
     char *out_data;
+
+    jpg = (struct xrdp_enc_jpg *) arg;
+    enc = jpg->enc;
+    jpg->done[index] = 0;
+    x = enc->crects[index * 4 + 0];
+    y = enc->crects[index * 4 + 1];
+    cx = enc->crects[index * 4 + 2];
+    cy = enc->crects[index * 4 + 3];
+    if (cx < 1 || cy < 1)
+    {
+        LLOGLN(0, ("xrdp_enc_jpg_proc: error 1"));
+        return;
+    }
+
+    LLOGLN(10, ("xrdp_enc_jpg_proc: x %d y %d cx %d cy %d", x, y, cx, cy));
+
+    out_data_bytes = libxrdp_codec_jpeg_buf_size(cx, cy);
+    if (out_data_bytes > 16 * 1024 * 1024)
+    {
+        LLOGLN(0, ("xrdp_enc_jpg_proc: error 2"));
+        return;
+    }
+    quality = jpg->quality;
+    flags = 0;
+    if (xrdp_enc_jpg_is_text(enc->data, enc->width * 4, x, y, cx, cy))
+    {
+        quality = MAX(quality, XRDP_ENC_JPG_TEXT_QUALITY);
+        flags |= XRDP_JPEG_FLAG_444;
+    }
+
+    ctx = xrdp_enc_jpg_get_ctx(jpg);
+    if (out_data_bytes > ctx->buf_bytes)
+    {
+        g_free(ctx->buf);
+        ctx->buf = (char *) g_malloc(out_data_bytes, 0);
+        ctx->buf_bytes = ctx->buf == 0 ? 0 : out_data_bytes;
+    }
+    if (ctx->buf == 0)
+    {
+        xrdp_enc_jpg_put_ctx(jpg, ctx);
+        LLOGLN(0, ("xrdp_enc_jpg_proc: error 3"));
+        return;
+    }
+    libxrdp_codec_jpeg_compress_handle(ctx->han, 0, enc->data,
+                                       enc->width, enc->height,
+                                       enc->width * 4, x, y, cx, cy,
+                                       quality, flags,
+                                       ctx->buf, &out_data_bytes);
+    out_data = 0;
+    if (out_data_bytes > 0)
+    {
+        out_data = (char *) g_malloc(out_data_bytes + 256 + 2, 0);
+        if (out_data != 0)
+        {
+            out_data[256] = 0; /* header bytes */
+            out_data[257] = 0;
+            g_memcpy(out_data + 256 + 2, ctx->buf, out_data_bytes);
+        }
+    }
+    xrdp_enc_jpg_put_ctx(jpg, ctx);
+    if (out_data == 0)
+    {
+        LLOGLN(0, ("process_enc_jpg: jpeg error bytes %d", out_data_bytes));
+        return;
+    }
+    LLOGLN(10, ("jpeg bytes %d quality %d flags %d",
+           out_data_bytes, quality, flags));
+    enc_done = (XRDP_ENC_DATA_DONE *)
+               g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
+    enc_done->comp_bytes = out_data_bytes + 2;
+    enc_done->pad_bytes = 256;
+    enc_done->comp_pad_data = out_data;
+    enc_done->enc = enc;
+    enc_done->x = x;
+    enc_done->y = y;
+    enc_done->cx = cx;
+    enc_done->cy = cy;
+    jpg->done[index] = enc_done;
+}
+
+/*****************************************************************************/
+static struct xrdp_enc_jpg *
+xrdp_enc_jpg_create(void)
+{
+    struct xrdp_enc_jpg *jpg;
+    int index;
+
+    jpg = (struct xrdp_enc_jpg *) g_malloc(sizeof(struct xrdp_enc_jpg), 1);
+    jpg->workers = xrdp_workers_create(0);
+    jpg->mutex = tc_mutex_create();
+    for (index = 0; index < XRDP_ENC_JPG_CTXS; index++)
+    {
+        jpg->ctxs[index].han = libxrdp_codec_jpeg_create();
+        jpg->free_ctxs[index] = jpg->ctxs + index;
+    }
+    jpg->num_free = XRDP_ENC_JPG_CTXS;
+    return jpg;
+}
+
+/*****************************************************************************/
+static void
+xrdp_enc_jpg_delete(struct xrdp_enc_jpg *jpg)
+{
+    int index;
+
+    if (jpg == 0)
+    {
+        return;
+    }
+    xrdp_workers_delete(jpg->workers);
+    for (index = 0; index < XRDP_ENC_JPG_CTXS; index++)
+    {
+        libxrdp_codec_jpeg_delete(jpg->ctxs[index].han);
+        g_free(jpg->ctxs[index].buf);
+    }
+    tc_mutex_delete(jpg->mutex);
+    g_free(jpg->done);
+    g_free(jpg);
+}
+
+/*****************************************************************************/
+/* called from encoder thread
+   crects are compressed in parallel then handed to the main thread in
+   order, a frame where nothing could be compressed still goes back empty
+   so it is freed and acked */
+static int
+process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    int index;
+    int count;
+    int last;
+    struct xrdp_enc_jpg *jpg;
     XRDP_ENC_DATA_DONE *enc_done;
     FIFO *fifo_processed;
     tbus mutex;
     tbus event_processed;
 
     LLOGLN(10, ("process_enc_jpg:"));
-    quality = self->codec_quality;
+    jpg = (struct xrdp_enc_jpg *) (self->codec_handle);
     fifo_processed = self->fifo_processed;
     mutex = self->mutex;
     event_processed = self->xrdp_encoder_event_processed;
     count = enc->num_crects;
-    for (index = 0; index < count; index++)
+    if (count > jpg->done_alloc)
     {
-        x = enc->crects[index * 4 + 0];
-        y = enc->crects[index * 4 + 1];
-        cx = enc->crects[index * 4 + 2];
-        cy = enc->crects[index * 4 + 3];
-        if (cx < 1 || cy < 1)
-        {
-            LLOGLN(0, ("process_enc_jpg: error 1"));
-            continue;
-        }
-
-        LLOGLN(10, ("process_enc_jpg: x %d y %d cx %d cy %d", x, y, cx, cy));
-
-        out_data_bytes = MAX((cx + 4) * cy * 4, 8192);
-        if ((out_data_bytes < 1) || (out_data_bytes > 16 * 1024 * 1024))
-        {
-            LLOGLN(0, ("process_enc_jpg: error 2"));
-            return 1;
-        }
-        out_data = (char *) g_malloc(out_data_bytes + 256 + 2, 0);
-        if (out_data == 0)
+        g_free(jpg->done);
+        jpg->done = (XRDP_ENC_DATA_DONE **)
+                    g_malloc(count * sizeof(XRDP_ENC_DATA_DONE *), 1);
+        jpg->done_alloc = jpg->done == 0 ? 0 : count;
+        if (jpg->done == 0)
         {
-            LLOGLN(0, ("process_enc_jpg: error 3"));
-            return 1;
+            count = 0;
         }
+    }
+    jpg->enc = enc;
+    jpg->quality = self->codec_quality;
+    xrdp_workers_run(jpg->workers, xrdp_enc_jpg_proc, jpg, count);
 
-        out_data[256] = 0; /* header bytes */
-        out_data[257] = 0;
-        error = libxrdp_codec_jpeg_compress(self->mm->wm->session, 0, enc->data,
-                                            enc->width, enc->height,
-                                            enc->width * 4, x, y, cx, cy,
-                                            quality,
-                                            out_data + 256 + 2, &out_data_bytes);
-        if (error < 0)
+    last = -1;
+    for (index = 0; index < count; index++)
+    {
+        if (jpg->done[index] != 0)
         {
-            LLOGLN(0, ("process_enc_jpg: jpeg error %d bytes %d",
-                   error, out_data_bytes));
-            g_free(out_data);
-            return 1;
+            last = index;
         }
-        LLOGLN(10, ("jpeg error %d bytes %d", error, out_data_bytes));
+    }
+    if (last < 0)
+    {
         enc_done = (XRDP_ENC_DATA_DONE *)
                    g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
-        enc_done->comp_bytes = out_data_bytes + 2;
-        enc_done->pad_bytes = 256;
-        enc_done->comp_pad_data = out_data;
         enc_done->enc = enc;
-        enc_done->last = index == (enc->num_crects - 1);
-        enc_done->x = x;
-        enc_done->y = y;
-        enc_done->cx = cx;
-        enc_done->cy = cy;
+        enc_done->last = 1;
+        tc_mutex_lock(mutex);
+        fifo_add_item(fifo_processed, enc_done);
+        tc_mutex_unlock(mutex);
+    }
+    else
+    {
+        jpg->done[last]->last = 1;
         /* done with msg */
         /* inform main thread done */
         tc_mutex_lock(mutex);
-        fifo_add_item(fifo_processed, enc_done);
+        for (index = 0; index <= last; index++)
+        {
+            if (jpg->done[index] != 0)
+            {
+                fifo_add_item(fifo_processed, jpg->done[index]);
+            }
+        }
         tc_mutex_unlock(mutex);
-        /* signal completion for main thread */
-        g_set_wait_obj(event_processed);
     }
+    /* signal completion for main thread */
+    g_set_wait_obj(event_processed);
     return 0;
 }
 
@@ -396,24 +639,358 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 #else
 
 /*****************************************************************************/
-/* called from encoder thread */
+/* called from encoder thread
+   tiles are coded in parallel on the xrdp_rfx worker threads */
 static int
 process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 {
+    int error;
+    int out_data_bytes;
+    char *out_data;
+    XRDP_ENC_DATA_DONE *enc_done;
+
+    LLOGLN(10, ("process_enc_rfx: num_crects %d num_drects %d",
+           enc->num_crects, enc->num_drects));
+    error = xrdp_rfx_encode((struct xrdp_rfx *) (self->codec_handle),
+                            enc->data, enc->width, enc->height,
+                            enc->width * 4,
+                            enc->drects, enc->num_drects,
+                            enc->crects, enc->num_crects,
+                            enc->send_header, 256,
+                            &out_data, &out_data_bytes);
+    if (error != 0)
+    {
+        LLOGLN(0, ("process_enc_rfx: xrdp_rfx_encode error"));
+    }
+
+    /* an empty one still frees and acks the frame */
+    enc_done = (XRDP_ENC_DATA_DONE *)
+               g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
+    enc_done->comp_bytes = out_data_bytes;
+    enc_done->pad_bytes = 256;
+    enc_done->comp_pad_data = out_data;
+    enc_done->enc = enc;
+    enc_done->last = 1;
+    enc_done->cx = self->mm->wm->screen->width;
+    enc_done->cy = self->mm->wm->screen->height;
+
+    /* done with msg */
+    /* inform main thread done */
+    tc_mutex_lock(self->mutex);
+    fifo_add_item(self->fifo_processed, enc_done);
+    tc_mutex_unlock(self->mutex);
+    /* signal completion for main thread */
+    g_set_wait_obj(self->xrdp_encoder_event_processed);
+
     return 0;
 }
 
 #endif
 
+#ifdef XRDP_X264
+
+#define XRDP_H264_FPS 30
+#define XRDP_H264_MIN_KBPS 256
+#define XRDP_H264_PAD 256
+
+/* encoder state, lives in codec_handle and is only touched by the encoder
+   thread until xrdp_encoder_delete */
+struct xrdp_enc_h264
+{
+    x264_t *x264;
+    x264_param_t param;
+    int width;
+    int height;
+    int max_kbps; /* from xrdp.ini or the screen size */
+    int kbps; /* current target, lowered while the client lags */
+    int pts;
+};
+
+/*****************************************************************************/
+static void
+xrdp_enc_h264_delete(struct xrdp_enc_h264 *h264)
+{
+    if (h264 == 0)
+    {
+        return;
+    }
+    if (h264->x264 != 0)
+    {
+        x264_encoder_close(h264->x264);
+    }
+    g_free(h264);
+}
+
+/*****************************************************************************/
+/* low latency, no B frames and no periodic IDR, a column of intra blocks
+   sweeps the picture instead so no single frame is much bigger than the
+   rest, VBV caps each frame to about one frame time of bits */
+static struct xrdp_enc_h264 *
+xrdp_enc_h264_create(struct xrdp_encoder *self, int width, int height)
+{
+    struct xrdp_enc_h264 *h264;
+    x264_param_t *param;
+
+    h264 = (struct xrdp_enc_h264 *) g_malloc(sizeof(struct xrdp_enc_h264), 1);
+    param = &(h264->param);
+    if (x264_param_default_preset(param, "ultrafast", "zerolatency") < 0)
+    {
+        g_free(h264);
+        return 0;
+    }
+    h264->width = width;
+    h264->height = height;
+    h264->max_kbps = self->mm->wm->client_info->h264_bitrate;
+    if (h264->max_kbps < 1)
+    {
+        /* about 0.05 bits per pixel at full frame rate */
+        h264->max_kbps = (width * height) / 1000 * 3 / 2;
+    }
+    h264->max_kbps = MAX(h264->max_kbps, XRDP_H264_MIN_KBPS);
+    h264->kbps = h264->max_kbps;
+    param->i_width = width;
+    param->i_height = height;
+    param->i_csp = X264_CSP_NV12;
+    param->i_fps_num = XRDP_H264_FPS;
+    param->i_fps_den = 1;
+    param->i_keyint_max = X264_KEYINT_MAX_INFINITE;
+    param->b_intra_refresh = 1;
+    param->b_repeat_headers = 1;
+    param->b_annexb = 1;
+    param->i_log_level = X264_LOG_ERROR;
+    param->rc.i_rc_method = X264_RC_ABR;
+    param->rc.i_bitrate = h264->kbps;
+    param->rc.i_vbv_max_bitrate = h264->kbps;
+    param->rc.i_vbv_buffer_size = h264->kbps / XRDP_H264_FPS;
+    if (x264_param_apply_profile(param, "main") < 0)
+    {
+        g_free(h264);
+        return 0;
+    }
+    h264->x264 = x264_encoder_open(param);
+    if (h264->x264 == 0)
+    {
+        g_free(h264);
+        return 0;
+    }
+    LLOGLN(0, ("xrdp_enc_h264_create: width %d height %d kbps %d",
+           width, height, h264->kbps));
+    return h264;
+}
+
+/*****************************************************************************/
+/* back off by a quarter while more than half the allowed frames are
+   unacknowledged, creep back up once the client has caught up */
+static void
+xrdp_enc_h264_rate(struct xrdp_encoder *self, struct xrdp_enc_h264 *h264)
+{
+    int kbps;
+    int lag;
+    int max_lag;
+
+    if (self->mm->wm->client_info->use_frame_acks == 0)
+    {
+        return;
+    }
+    lag = self->frame_id_server - self->frame_id_client;
+    max_lag = self->mm->wm->client_info->max_unacknowledged_frame_count;
+    kbps = h264->kbps;
+    if (lag > max_lag / 2)
+    {
+        kbps = MAX(kbps * 3 / 4, XRDP_H264_MIN_KBPS);
+    }
+    else if (lag < 2)
+    {
+        kbps = MIN(kbps + h264->max_kbps / 8, h264->max_kbps);
+    }
+    if (kbps == h264->kbps)
+    {
+        return;
+    }
+    LLOGLN(10, ("xrdp_enc_h264_rate: lag %d kbps %d", lag, kbps));
+    h264->kbps = kbps;
+    h264->param.rc.i_bitrate = kbps;
+    h264->param.rc.i_vbv_max_bitrate = kbps;
+    h264->param.rc.i_vbv_buffer_size = kbps / XRDP_H264_FPS;
+    x264_encoder_reconfig(h264->x264, &(h264->param));
+}
+
+/*****************************************************************************/
+/* writes the RDPGFX_AVC420_METABLOCK, region rects, one qp / quality pair
+   per rect, followed by the Annex B bitstream */
+static int
+xrdp_enc_h264_frame(XRDP_ENC_DATA *enc, x264_nal_t *nals, int num_nals,
+                    int frame_bytes, int qp, char **out_data)
+{
+    int index;
+    int count;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    struct stream ls;
+    struct stream *s;
+
+    count = enc->num_drects;
+    s = &ls;
+    g_memset(s, 0, sizeof(struct stream));
+    s->size = 4 + count * 8 + count * 2 + frame_bytes;
+    *out_data = (char *) g_malloc(XRDP_H264_PAD + s->size, 0);
+    if (*out_data == 0)
+    {
+        return 0;
+    }
+    s->data = *out_data + XRDP_H264_PAD;
+    s->p = s->data;
+    out_uint32_le(s, count); /* numRegionRects */
+    for (index = 0; index < count; index++)
+    {
+        x = enc->drects[index * 4 + 0];
+        y = enc->drects[index * 4 + 1];
+        cx = enc->drects[index * 4 + 2];
+        cy = enc->drects[index * 4 + 3];
+        out_uint16_le(s, x);
+        out_uint16_le(s, y);
+        out_uint16_le(s, x + cx);
+        out_uint16_le(s, y + cy);
+    }
+    for (index = 0; index < count; index++)
+    {
+        out_uint8(s, qp); /* qpVal, progressive bit clear */
+        out_uint8(s, 100); /* qualityVal */
+    }
+    for (index = 0; index < num_nals; index++)
+    {
+        out_uint8a(s, nals[index].p_payload, nals[index].i_payload);
+    }
+    s_mark_end(s);
+    return (int) (s->end - s->data);
+}
+
+/*****************************************************************************/
+/* called from encoder thread
+   one surface bits command per frame, when anything fails the frame still
+   goes back empty so the main thread frees it and acks it to the module */
+static int
+process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    int frame_bytes;
+    int num_nals;
+    int qp;
+    int lost;
+    int out_data_bytes;
+    char *out_data;
+    struct xrdp_enc_h264 *h264;
+    x264_picture_t pic_in;
+    x264_picture_t pic_out;
+    x264_nal_t *nals;
+    XRDP_ENC_DATA_DONE *enc_done;
+
+    LLOGLN(10, ("process_enc_h264: num_drects %d", enc->num_drects));
+    out_data = 0;
+    out_data_bytes = 0;
+    h264 = (struct xrdp_enc_h264 *) (self->codec_handle);
+    if ((h264 != 0) &&
+        ((h264->width != enc->width) || (h264->height != enc->height)))
+    {
+        xrdp_enc_h264_delete(h264);
+        h264 = 0;
+        self->codec_handle = 0;
+    }
+    if ((enc->width & 1) || (enc->height & 1) ||
+        (enc->num_drects < 1) || (enc->num_drects > 512))
+    {
+        LLOGLN(0, ("process_enc_h264: error, width %d height %d "
+               "num_drects %d", enc->width, enc->height, enc->num_drects));
+    }
+    else
+    {
+        if (h264 == 0)
+        {
+            h264 = xrdp_enc_h264_create(self, enc->width, enc->height);
+            self->codec_handle = h264;
+        }
+        if (h264 == 0)
+        {
+            LLOGLN(0, ("process_enc_h264: xrdp_enc_h264_create failed"));
+        }
+        else
+        {
+            xrdp_enc_h264_rate(self, h264);
+            tc_mutex_lock(self->mutex);
+            lost = self->frame_lost;
+            self->frame_lost = 0;
+            tc_mutex_unlock(self->mutex);
+            if (lost)
+            {
+                /* the client is missing a frame, start a new intra
+                   refresh wave so the picture heals in one period */
+                LLOGLN(0, ("process_enc_h264: frame lost, intra refresh"));
+                x264_encoder_intra_refresh(h264->x264);
+            }
+            /* NV12, full size Y plane then interleaved UV at half height */
+            x264_picture_init(&pic_in);
+            pic_in.img.i_csp = X264_CSP_NV12;
+            pic_in.img.i_plane = 2;
+            pic_in.img.plane[0] = (unsigned char *) (enc->data);
+            pic_in.img.i_stride[0] = enc->width;
+            pic_in.img.plane[1] = (unsigned char *)
+                                  (enc->data + enc->width * enc->height);
+            pic_in.img.i_stride[1] = enc->width;
+            pic_in.i_pts = h264->pts++;
+            frame_bytes = x264_encoder_encode(h264->x264, &nals, &num_nals,
+                                              &pic_in, &pic_out);
+            if (frame_bytes > 0)
+            {
+                /* average qp of the frame */
+                qp = pic_out.i_qpplus1 - 1;
+                qp = MAX(MIN(qp, 51), 0);
+                out_data_bytes = xrdp_enc_h264_frame(enc, nals, num_nals,
+                                                     frame_bytes, qp,
+                                                     &out_data);
+            }
+            else if (frame_bytes < 0)
+            {
+                LLOGLN(0, ("process_enc_h264: x264_encoder_encode "
+                       "error %d", frame_bytes));
+            }
+        }
+    }
+
+    enc_done = (XRDP_ENC_DATA_DONE *)
+               g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
+    enc_done->comp_bytes = out_data_bytes;
+    enc_done->pad_bytes = XRDP_H264_PAD;
+    enc_done->comp_pad_data = out_data;
+    enc_done->enc = enc;
+    enc_done->last = 1;
+    enc_done->cx = enc->width;
+    enc_done->cy = enc->height;
+
+    /* done with msg */
+    /* inform main thread done */
+    tc_mutex_lock(self->mutex);
+    fifo_add_item(self->fifo_processed, enc_done);
+    tc_mutex_unlock(self->mutex);
+    /* signal completion for main thread */
+    g_set_wait_obj(self->xrdp_encoder_event_processed);
+
+    return 0;
+}
+
+#else
+
 /*****************************************************************************/
 /* called from encoder thread */
 static int
 process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 {
-    LLOGLN(0, ("process_enc_x264:"));
+    LLOGLN(0, ("process_enc_h264: not built with x264"));
     return 0;
 }
 
+#endif
+
 /**
  * Encoder thread main loop
  *****************************************************************************/
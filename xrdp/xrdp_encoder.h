@@ -25,6 +25,8 @@ struct xrdp_encoder
     int frame_id_client; /* last frame id received from client */
     int frame_id_server; /* last frame id received from Xorg */
     int frame_id_server_sent;
+    int header_sent; /* main thread, a codec header has reached the client */
+    int frame_lost; /* a frame did not go out, protected by mutex */
 };
 
 /* used when scheduling tasks in xrdp_encoder.c */
@@ -40,6 +42,7 @@ struct xrdp_enc_data
     int height;
     int flags;
     int frame_id;
+    int send_header; /* codec header goes in front, none has gone out yet */
 };
 
 typedef struct xrdp_enc_data XRDP_ENC_DATA;
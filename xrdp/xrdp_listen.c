@@ -158,7 +158,11 @@ xrdp_listen_get_port_address(char *port, int port_bytes,
     struct list *names;
     struct list *values;
     char cfg_file[256];
+    char certificate[1024];
+    char key_file[1024];
 
+    certificate[0] = 0;
+    key_file[0] = 0;
     /* default to port 3389 */
     g_strncpy(port, "3389", port_bytes - 1);
     /* Default to all */
@@ -236,6 +240,34 @@ xrdp_listen_get_port_address(char *port, int port_bytes,
                         val = (char *)list_get_item(values, index);
                         startup_param->recv_buffer_bytes = g_atoi(val);
                     }
+
+                    if (g_strcasecmp(val, "certificate") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        if (val[0] == '/')
+                        {
+                            g_strncpy(certificate, val, 1023);
+                        }
+                        else
+                        {
+                            g_snprintf(certificate, 1023, "%s/cert.pem",
+                                       XRDP_CFG_PATH);
+                        }
+                    }
+
+                    if (g_strcasecmp(val, "key_file") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        if (val[0] == '/')
+                        {
+                            g_strncpy(key_file, val, 1023);
+                        }
+                        else
+                        {
+                            g_snprintf(key_file, 1023, "%s/key.pem",
+                                       XRDP_CFG_PATH);
+                        }
+                    }
                 }
             }
         }
@@ -247,6 +279,20 @@ xrdp_listen_get_port_address(char *port, int port_bytes,
     if (fd != -1)
         g_file_close(fd);
 
+    /* load the TLS key and certificate once here, connections and forked
+       children share the context instead of reading them every time */
+    if ((certificate[0] != 0) && (key_file[0] != 0) &&
+        g_file_exist(certificate) && g_file_exist(key_file))
+    {
+        if (ssl_tls_ctx_preload(key_file, certificate,
+                                startup_param->fork) != 0)
+        {
+            log_message(LOG_LEVEL_WARNING, "xrdp_listen_get_port_address: "
+                        "could not load TLS key %s or certificate %s",
+                        key_file, certificate);
+        }
+    }
+
     /* startup_param overrides */
     if (startup_param->port[0] != 0)
     {
@@ -263,6 +309,8 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
     int pid;
     struct xrdp_process *process;
 
+    /* pick up a SIGHUP reload here so the child inherits it */
+    ssl_tls_ctx_refresh();
     pid = g_fork();
 
     if (pid == 0)
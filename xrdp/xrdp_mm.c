@@ -432,6 +432,8 @@ xrdp_mm_setup_mod1(struct xrdp_mm *self) {
 			self->mod->server_paint_rect_bpp = server_paint_rect_bpp;
 			self->mod->server_composite = server_composite;
 			self->mod->server_paint_rects = server_paint_rects;
+			self->mod->server_paint_rect_comp = server_paint_rect_comp;
+			self->mod->server_set_pointer_hash = server_set_pointer_hash;
 			self->mod->si = (tintptr) &(self->wm->session->si);
 		}
 	}
@@ -1981,6 +1983,7 @@ int cx;
 int cy;
 int use_frame_acks;
 int ex;
+int error;
 
 if (self == 0) {
 return 0;
@@ -2047,12 +2050,25 @@ if (g_is_wait_obj_set(self->encoder->xrdp_encoder_event_processed)) {
 		if (enc_done->comp_bytes > 0) {
 			libxrdp_fastpath_send_frame_marker(self->wm->session, 0,
 					enc_done->enc->frame_id);
-			libxrdp_fastpath_send_surface(self->wm->session,
+			error = libxrdp_fastpath_send_surface(self->wm->session,
 					enc_done->comp_pad_data, enc_done->pad_bytes,
 					enc_done->comp_bytes, x, y, x + cx, y + cy, 32,
 					self->encoder->codec_id, cx, cy);
 			libxrdp_fastpath_send_frame_marker(self->wm->session, 1,
 					enc_done->enc->frame_id);
+			if (error == 0) {
+				/* the codec header has gone out, later frames go without */
+				self->encoder->header_sent = 1;
+			} else {
+				/* too big for the client's fast path reassembly or the
+				   send failed, the encoder refreshes so a codec that
+				   predicts from this frame does not carry the damage */
+				LLOGLN(0, ("xrdp_mm_check_wait_objs: send surface failed, "
+						"%d bytes", enc_done->comp_bytes));
+				tc_mutex_lock(self->encoder->mutex);
+				self->encoder->frame_lost = 1;
+				tc_mutex_unlock(self->encoder->mutex);
+			}
 		}
 
 		/* free enc_done */
@@ -2236,6 +2252,33 @@ xrdp_bitmap_delete(b);
 return 0;
 }
 
+/*****************************************************************************/
+/* server_paint_rect with the bitmap cache v2 compressed form of data, used
+ when the front can take it as is */
+int DEFAULT_CC
+server_paint_rect_comp(struct xrdp_mod *mod, int x, int y, int cx, int cy,
+char *data, int width, int height, int srcx, int srcy, char *comp_data,
+int comp_bytes) {
+struct xrdp_wm *wm;
+struct xrdp_bitmap *b;
+struct xrdp_painter *p;
+
+p = (struct xrdp_painter *) (mod->painter);
+
+if (p == 0) {
+return 0;
+}
+
+wm = (struct xrdp_wm *) (mod->wm);
+b = xrdp_bitmap_create_with_data(width, height, wm->screen->bpp, data, wm);
+if (xrdp_painter_copy_comp(p, b, wm->target_surface, x, y, cx, cy, srcx, srcy,
+comp_data, comp_bytes) != 0) {
+xrdp_painter_copy(p, b, wm->target_surface, x, y, cx, cy, srcx, srcy);
+}
+xrdp_bitmap_delete(b);
+return 0;
+}
+
 /*****************************************************************************/
 int DEFAULT_CC
 server_paint_rect_bpp(struct xrdp_mod* mod, int x, int y, int cx, int cy,
@@ -2344,6 +2387,7 @@ enc_data->width = width;
 enc_data->height = height;
 enc_data->flags = flags;
 enc_data->frame_id = frame_id;
+enc_data->send_header = !mm->encoder->header_sent;
 mm->encoder->frame_id_server = frame_id;
 if (width == 0 || height == 0) {
 	LLOGLN(10, ("server_paint_rects: error"));
@@ -2398,6 +2442,23 @@ xrdp_wm_pointer(wm, data, mask, x, y, bpp);
 return 0;
 }
 
+/*****************************************************************************/
+/* the module sent the hash of a pointer it sent before
+ returns 1 if it is not in the pointer cache, the module sends it all then */
+int DEFAULT_CC
+server_set_pointer_hash(struct xrdp_mod *mod, int hash) {
+struct xrdp_wm *wm;
+int index;
+
+wm = (struct xrdp_wm *) (mod->wm);
+index = xrdp_cache_set_pointer_hash(wm->cache, hash);
+if (index < 0) {
+return 1;
+}
+wm->screen->pointer = index;
+return 0;
+}
+
 /*****************************************************************************/
 int DEFAULT_CC
 server_palette(struct xrdp_mod *mod, int *palette) {
@@ -2615,6 +2676,10 @@ return xrdp_painter_draw_text2(p, wm->target_surface, font, flags, mixmode,
 int DEFAULT_CC
 server_reset(struct xrdp_mod *mod, int width, int height, int bpp) {
 struct xrdp_wm *wm;
+int start_time;
+int lib_time;
+int cache_time;
+int screen_time;
 
 wm = (struct xrdp_wm *) (mod->wm);
 
@@ -2633,18 +2698,25 @@ if (wm->client_info->width == width && wm->client_info->height == height
 return 0;
 }
 
+start_time = g_time3();
 /* reset lib, client_info gets updated in libxrdp_reset */
 if (libxrdp_reset(wm->session, width, height, bpp) != 0) {
 return 1;
 }
+lib_time = g_time3();
 
-/* reset cache */
+/* reset cache, the caches the client did not change are kept */
 xrdp_cache_reset(wm->cache, wm->client_info);
+cache_time = g_time3();
 /* resize the main window */
 xrdp_bitmap_resize(wm->screen, wm->client_info->width, wm->client_info->height);
 /* load some stuff */
 xrdp_wm_load_static_colors_plus(wm, 0);
 xrdp_wm_load_static_pointers(wm);
+screen_time = g_time3();
+log_message(LOG_LEVEL_INFO, "server_reset: %dx%dx%d, reactivate %d ms "
+	"cache %d ms screen %d ms", width, height, bpp, lib_time - start_time,
+	cache_time - lib_time, screen_time - cache_time);
 return 0;
 }
 
@@ -2907,6 +2979,7 @@ error = xrdp_cache_add_os_bitmap(wm->cache, bitmap, rdpindex);
 if (error != 0) {
 log_message(LOG_LEVEL_ERROR,
 		"server_create_os_surface: xrdp_cache_add_os_bitmap failed");
+xrdp_bitmap_delete(bitmap);
 return 1;
 }
 
@@ -2929,6 +3002,7 @@ WND_TYPE_OFFSCREEN, wm);
 error = xrdp_cache_add_os_bitmap(wm->cache, bitmap, rdpindex);
 if (error != 0) {
 g_writeln("server_create_os_surface_bpp: xrdp_cache_add_os_bitmap failed");
+xrdp_bitmap_delete(bitmap);
 return 1;
 }
 bitmap->item_index = rdpindex;
@@ -3022,9 +3096,11 @@ return 0;
 wm = (struct xrdp_wm *) (mod->wm);
 bi = xrdp_cache_get_os_bitmap(wm->cache, rdpindex);
 
-if (bi != 0) {
+if ((bi != 0) && (bi->bitmap != 0)) {
 b = bi->bitmap;
 xrdp_painter_copy(p, b, wm->target_surface, x, y, cx, cy, srcx, srcy);
+wm->cache->os_blts++;
+wm->cache->os_blt_bytes += (double) cx * cy * ((wm->screen->bpp + 7) / 8);
 } else {
 log_message(LOG_LEVEL_ERROR, "server_paint_rect_os: error finding id %d",
 		rdpindex);
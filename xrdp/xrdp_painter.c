@@ -89,6 +89,7 @@ xrdp_painter_begin_update(struct xrdp_painter *self) {
 	}
 
 	libxrdp_orders_init(self->session);
+	xrdp_cache_begin_update(self->wm->cache);
 	wm_painter_set_target(self);
 	return 0;
 }
@@ -101,6 +102,7 @@ xrdp_painter_end_update(struct xrdp_painter *self) {
 	}
 
 	libxrdp_orders_send(self->session);
+	xrdp_cache_end_update(self->wm->cache);
 	return 0;
 }
 
@@ -624,6 +626,227 @@ xrdp_painter_draw_text2(struct xrdp_painter *self, struct xrdp_bitmap *dst,
 	return 0;
 }
 
+/*****************************************************************************/
+/* tile pipeline for xrdp_painter_copy, extracting and compressing tiles
+   runs on the wm worker threads, the cache and the orders stay on the
+   calling thread so the client sees the same order stream */
+struct xrdp_painter_tiles
+{
+	struct xrdp_wm *wm;
+	struct xrdp_bitmap *src;
+	struct xrdp_tile *tiles;
+	int comp; /* compress cache misses on the workers */
+};
+
+/*****************************************************************************/
+/* percent of pixels, sampled every other row, that differ from both their
+   left and upper neighbour, UI and text stay well under
+   XRDP_TILE_ENTROPY, photos and video go well over it */
+static int
+xrdp_painter_tile_entropy(struct xrdp_bitmap *b) {
+	tui32 *s32;
+	tui32 *u32;
+	int i;
+	int j;
+	int count;
+	int total;
+
+	if ((b->bpp != 24) && (b->bpp != 32)) {
+		return 0;
+	}
+	count = 0;
+	total = 0;
+	for (j = 1; j < b->height; j += 2) {
+		s32 = ((tui32 *) (b->data)) + j * b->width;
+		u32 = s32 - b->width;
+		for (i = 1; i < b->width; i++) {
+			if ((s32[i] != s32[i - 1]) && (s32[i] != u32[i])) {
+				count++;
+			}
+		}
+		total += b->width - 1;
+	}
+	if (total < 1) {
+		return 0;
+	}
+	return (count * 100) / total;
+}
+
+/*****************************************************************************/
+/* called on any thread */
+static void
+xrdp_painter_tile_extract(void *arg, int index) {
+	struct xrdp_painter_tiles *pt;
+	struct xrdp_tile *tile;
+
+	pt = (struct xrdp_painter_tiles *) arg;
+	tile = pt->tiles + index;
+	tile->b = xrdp_bitmap_create(tile->cx, tile->cy, pt->src->bpp, 0, pt->wm);
+	xrdp_bitmap_copy_box_with_crc(pt->src, tile->b, tile->srcx, tile->srcy,
+			tile->cx, tile->cy);
+	/* only high entropy tiles may use a lossy bitmap cache v3 codec */
+	tile->hints = pt->wm->hints;
+	if (xrdp_painter_tile_entropy(tile->b) < XRDP_TILE_ENTROPY) {
+		tile->hints |= 1;
+	}
+}
+
+/*****************************************************************************/
+/* called on any thread */
+static void
+xrdp_painter_tile_compress(void *arg, int index) {
+	struct xrdp_painter_tiles *pt;
+	struct xrdp_tile *tile;
+	struct xrdp_bitmap *b;
+
+	pt = (struct xrdp_painter_tiles *) arg;
+	tile = pt->tiles + index;
+	tile->comp = 0;
+	if (tile->status != 1) {
+		return;
+	}
+	if ((pt->wm->cache->bitmap_cache_version & 4) && !(tile->hints & 1)) {
+		/* codec tile, sent by xrdp_cache_send_bitmap */
+		return;
+	}
+	if (tile->s == 0) {
+		make_stream(tile->s);
+		make_stream(tile->temp_s);
+	}
+	b = tile->b;
+	if (libxrdp_orders_compress_bitmap2(b->width, b->height, b->bpp, b->data,
+			tile->s, tile->temp_s) == 0) {
+		tile->comp = 1;
+	}
+}
+
+/*****************************************************************************/
+/* how many tiles can be in flight, a batch must not evict its own bitmaps
+   from the cache before they are sent */
+static int APP_CC
+xrdp_painter_tile_batch(struct xrdp_cache *cache) {
+	int rv;
+
+	rv = XRDP_TILE_BATCH;
+	if (cache->cache1_entries > 0) {
+		rv = MIN(rv, cache->cache1_entries / 2);
+	}
+	if (cache->cache2_entries > 0) {
+		rv = MIN(rv, cache->cache2_entries / 2);
+	}
+	if (cache->cache3_entries > 0) {
+		rv = MIN(rv, cache->cache3_entries / 2);
+	}
+	return MAX(rv, 1);
+}
+
+/*****************************************************************************/
+/* extract, cache, compress and send count tiles then draw them, dx and dy
+   take a tile from source to screen coordinates */
+static void APP_CC
+xrdp_painter_tiles_flush(struct xrdp_painter *self,
+		struct xrdp_painter_tiles *pt, int count, int dx, int dy,
+		struct xrdp_rect *rects, int num_rects) {
+	struct xrdp_cache *cache;
+	struct xrdp_tile *tile;
+	struct xrdp_rect rect;
+	struct xrdp_rect draw_rect;
+	int index;
+	int k;
+	int dstx;
+	int dsty;
+
+	cache = self->wm->cache;
+	xrdp_workers_run(self->wm->workers, xrdp_painter_tile_extract, pt, count);
+
+	for (index = 0; index < count; index++) {
+		tile = pt->tiles + index;
+		tile->comp = 0;
+		tile->status = xrdp_cache_insert_bitmap(cache, tile->b,
+				&(tile->cache_id), &(tile->cache_idx));
+		if (tile->status == -1) {
+			xrdp_bitmap_delete(tile->b);
+		}
+	}
+
+	if (pt->comp) {
+		xrdp_workers_run(self->wm->workers, xrdp_painter_tile_compress, pt,
+				count);
+	}
+
+	for (index = 0; index < count; index++) {
+		tile = pt->tiles + index;
+		if (tile->status == -1) {
+			continue;
+		}
+		if (tile->status == 1) {
+			if (tile->comp) {
+				if (libxrdp_orders_send_bitmap2_comp(self->session,
+						tile->b->width, tile->b->height, tile->b->bpp,
+						tile->s->data, (int) (tile->s->end - tile->s->data),
+						tile->cache_id, tile->cache_idx) == 0) {
+					xrdp_cache_bitmap_sent(cache, XRDP_BITMAP_SENT_LOSSLESS);
+				}
+			} else {
+				xrdp_cache_send_bitmap(cache, tile->b, tile->cache_id,
+						tile->cache_idx, tile->hints);
+			}
+		}
+		dstx = tile->srcx + dx;
+		dsty = tile->srcy + dy;
+		MAKERECT(rect, dstx, dsty, tile->cx, tile->cy);
+		for (k = 0; k < num_rects; k++) {
+			if (rect_intersect(rects + k, &rect, &draw_rect)) {
+				libxrdp_orders_mem_blt(self->session, tile->cache_id, 0, dstx,
+						dsty, tile->cx, tile->cy, self->rop, 0, 0,
+						tile->cache_idx, &draw_rect);
+			}
+		}
+		tile->b = 0;
+	}
+}
+
+/*****************************************************************************/
+/* the visible parts of dst in x, y, cx, cy as screen rects, dx and dy take
+   dst to screen coordinates, free the return with g_free */
+static struct xrdp_rect *APP_CC
+xrdp_painter_vis_rects(struct xrdp_painter *self, struct xrdp_bitmap *dst,
+		int x, int y, int cx, int cy, int *dx, int *dy, int *num_rects) {
+	struct xrdp_rect clip_rect;
+	struct xrdp_rect rect1;
+	struct xrdp_rect rect2;
+	struct xrdp_region *region;
+	struct xrdp_rect *rects;
+	int k;
+
+	xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, dx, dy);
+	region = xrdp_region_create(self->wm);
+
+	if (dst->type != WND_TYPE_OFFSCREEN) {
+		xrdp_wm_get_vis_region(self->wm, dst, x, y, cx, cy, region,
+				self->clip_children);
+	} else {
+		xrdp_region_add_rect(region, &clip_rect);
+	}
+
+	k = 0;
+	while (xrdp_region_get_rect(region, k, &rect1) == 0) {
+		k++;
+	}
+	rects = (struct xrdp_rect *) g_malloc(sizeof(struct xrdp_rect) * (k + 1), 0);
+	*num_rects = 0;
+	k = 0;
+	while (xrdp_region_get_rect(region, k, &rect1) == 0) {
+		if (rect_intersect(&rect1, &clip_rect, &rect2)) {
+			rects[*num_rects] = rect2;
+			(*num_rects)++;
+		}
+		k++;
+	}
+	xrdp_region_delete(region);
+	return rects;
+}
+
 /*****************************************************************************/
 int APP_CC
 xrdp_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
@@ -634,14 +857,15 @@ xrdp_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
 	struct xrdp_rect rect1;
 	struct xrdp_rect rect2;
 	struct xrdp_region *region;
-	struct xrdp_bitmap *b;
+	struct xrdp_rect *rects;
+	struct xrdp_cache *cache;
+	struct xrdp_painter_tiles pt;
 	int i;
 	int j;
 	int k;
 	int dx;
 	int dy;
 	int palette_id;
-	int bitmap_id;
 	int cache_id;
 	int cache_idx;
 	int dstx;
@@ -649,6 +873,9 @@ xrdp_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
 	int w;
 	int h;
 	int index;
+	int num_rects;
+	int batch;
+	int count;
 	struct list *del_list;
 
 	if (self == 0 || src == 0 || dst == 0) {
@@ -741,19 +968,20 @@ xrdp_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
 	} else if (src->data != 0)
 	/* todo, the non bitmap cache part is gone, it should be put back */
 	{
-		xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-		region = xrdp_region_create(self->wm);
-
-		if (dst->type != WND_TYPE_OFFSCREEN) {
-			xrdp_wm_get_vis_region(self->wm, dst, x, y, cx, cy, region,
-					self->clip_children);
-		} else {
-			xrdp_region_add_rect(region, &clip_rect);
-		}
-
+		/* clip the visible region once, not once per tile */
+		rects = xrdp_painter_vis_rects(self, dst, x, y, cx, cy, &dx, &dy,
+				&num_rects);
 		x += dx;
 		y += dy;
-		palette_id = 0;
+
+		cache = self->wm->cache;
+		pt.wm = self->wm;
+		pt.src = src;
+		pt.tiles = self->wm->tiles;
+		pt.comp = cache->use_bitmap_comp &&
+				(cache->bitmap_cache_version & 2);
+		batch = xrdp_painter_tile_batch(cache);
+		count = 0;
 		j = srcy;
 
 		while (j < (srcy + cy)) {
@@ -762,33 +990,29 @@ xrdp_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
 			while (i < (srcx + cx)) {
 				w = MIN(64, ((srcx + cx) - i));
 				h = MIN(63, ((srcy + cy) - j));
-				b = xrdp_bitmap_create(w, h, src->bpp, 0, self->wm);
-#if 1
-				xrdp_bitmap_copy_box_with_crc(src, b, i, j, w, h);
-#else
-				xrdp_bitmap_copy_box(src, b, i, j, w, h);
-				xrdp_bitmap_hash_crc(b);
-#endif
-				bitmap_id = xrdp_cache_add_bitmap(self->wm->cache, b,
-						self->wm->hints);
-				cache_id = HIWORD(bitmap_id);
-				cache_idx = LOWORD(bitmap_id);
 				dstx = (x + i) - srcx;
 				dsty = (y + j) - srcy;
-				k = 0;
-
-				while (xrdp_region_get_rect(region, k, &rect1) == 0) {
-					if (rect_intersect(&rect1, &clip_rect, &rect2)) {
-						MAKERECT(rect1, dstx, dsty, w, h);
+				MAKERECT(rect1, dstx, dsty, w, h);
 
-						if (rect_intersect(&rect2, &rect1, &draw_rect)) {
-							libxrdp_orders_mem_blt(self->session, cache_id,
-									palette_id, dstx, dsty, w, h, self->rop, 0,
-									0, cache_idx, &draw_rect);
-						}
+				/* tiles nothing of is visible are not sent at all */
+				for (k = 0; k < num_rects; k++) {
+					if (rect_intersect(rects + k, &rect1, &draw_rect)) {
+						break;
 					}
+				}
 
-					k++;
+				if (k < num_rects) {
+					pt.tiles[count].srcx = i;
+					pt.tiles[count].srcy = j;
+					pt.tiles[count].cx = w;
+					pt.tiles[count].cy = h;
+					count++;
+
+					if (count == batch) {
+						xrdp_painter_tiles_flush(self, &pt, count, x - srcx,
+								y - srcy, rects, num_rects);
+						count = 0;
+					}
 				}
 
 				i += 64;
@@ -797,12 +1021,100 @@ xrdp_painter_copy(struct xrdp_painter *self, struct xrdp_bitmap *src,
 			j += 63;
 		}
 
-		xrdp_region_delete(region);
+		if (count > 0) {
+			xrdp_painter_tiles_flush(self, &pt, count, x - srcx, y - srcy,
+					rects, num_rects);
+		}
+
+		g_free(rects);
 	}
 
 	return 0;
 }
 
+/*****************************************************************************/
+/* like xrdp_painter_copy but src already has a bitmap cache v2 compressed
+   form, from a module that got it that way, so it is sent as is and not
+   compressed again, returns non zero if src can not go this way and
+   xrdp_painter_copy should be used */
+int APP_CC
+xrdp_painter_copy_comp(struct xrdp_painter *self, struct xrdp_bitmap *src,
+		struct xrdp_bitmap *dst, int x, int y, int cx, int cy, int srcx,
+		int srcy, char *comp_data, int comp_bytes) {
+	struct xrdp_rect rect1;
+	struct xrdp_rect draw_rect;
+	struct xrdp_rect *rects;
+	struct xrdp_cache *cache;
+	struct xrdp_bitmap *b;
+	int cache_id;
+	int cache_idx;
+	int num_rects;
+	int status;
+	int dx;
+	int dy;
+	int k;
+
+	if (self == 0 || src == 0 || dst == 0 || src->data == 0) {
+		return 1;
+	}
+	if (dst->type == WND_TYPE_BITMAP) {
+		return 0;
+	}
+	cache = self->wm->cache;
+	if (!cache->use_bitmap_comp || !(cache->bitmap_cache_version & 2)) {
+		return 1;
+	}
+	/* one tile, the same interleaved rle xrdp_bitmap_compress makes */
+	if ((src->width > 64) || (src->height > 64) || ((src->width % 4) != 0)) {
+		return 1;
+	}
+	if ((src->bpp != 15) && (src->bpp != 16) && (src->bpp != 24)) {
+		return 1;
+	}
+	/* bitmapLength in the order is 14 bits, rle can come out bigger than
+	   the raw tile, checked before the cache insert so the fallback still
+	   sends the bitmap */
+	if ((comp_bytes < 1) || (comp_bytes > 0x3fff)) {
+		return 1;
+	}
+
+	rects = xrdp_painter_vis_rects(self, dst, x, y, cx, cy, &dx, &dy,
+			&num_rects);
+	if (num_rects < 1) {
+		g_free(rects);
+		return 0;
+	}
+	x += dx;
+	y += dy;
+
+	b = xrdp_bitmap_create(src->width, src->height, src->bpp, 0, self->wm);
+	xrdp_bitmap_copy_box_with_crc(src, b, 0, 0, src->width, src->height);
+	status = xrdp_cache_insert_bitmap(cache, b, &cache_id, &cache_idx);
+	if (status == -1) {
+		xrdp_bitmap_delete(b);
+		g_free(rects);
+		return 1;
+	}
+	if (status == 1) {
+		if (libxrdp_orders_send_bitmap2_comp(self->session, src->width,
+				src->height, src->bpp, comp_data, comp_bytes, cache_id,
+				cache_idx) == 0) {
+			xrdp_cache_bitmap_sent(cache, XRDP_BITMAP_SENT_LOSSLESS);
+		}
+		cache->bitmap_passthrough++;
+	}
+
+	MAKERECT(rect1, x, y, cx, cy);
+	for (k = 0; k < num_rects; k++) {
+		if (rect_intersect(rects + k, &rect1, &draw_rect)) {
+			libxrdp_orders_mem_blt(self->session, cache_id, 0, x, y, cx, cy,
+					self->rop, srcx, srcy, cache_idx, &draw_rect);
+		}
+	}
+	g_free(rects);
+	return 0;
+}
+
 /*****************************************************************************/
 int APP_CC
 xrdp_painter_composite(struct xrdp_painter* self, struct xrdp_bitmap* src,
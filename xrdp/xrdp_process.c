@@ -247,6 +247,8 @@ xrdp_process_main_loop(struct xrdp_process *self)
             {
                 break;
             }
+
+            xrdp_wm_input_flush(self->wm);
         }
         /* send disconnect message if possible */
         libxrdp_disconnect(self->session);
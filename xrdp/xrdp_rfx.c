@@ -0,0 +1,878 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * RemoteFX encoder, used when not building with librfxcodec
+ * [MS-RDPRFX] ICT colour conversion, DWT 5/3, scalar quantization, RLGR1
+ */
+
+#include "xrdp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define RFX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define LLOG_LEVEL 1
+#define LLOGLN(_level, _args) \
+  do \
+  { \
+    if (_level < LLOG_LEVEL) \
+    { \
+        g_write("xrdp:xrdp_rfx [%10.10u]: ", g_time3()); \
+        g_writeln _args ; \
+    } \
+  } \
+  while (0)
+
+#define WBT_SYNC            0xCCC0
+#define WBT_CODEC_VERSIONS  0xCCC1
+#define WBT_CHANNELS        0xCCC2
+#define WBT_CONTEXT         0xCCC3
+#define WBT_FRAME_BEGIN     0xCCC4
+#define WBT_FRAME_END       0xCCC5
+#define WBT_REGION          0xCCC6
+#define WBT_EXTENSION       0xCCC7
+#define CBT_REGION          0xCAC1
+#define CBT_TILESET         0xCAC2
+#define CBT_TILE            0xCAC3
+
+#define COL_CONV_ICT        1
+#define CLW_XFORM_DWT_53_A  1
+#define CLW_ENTROPY_RLGR1   1
+#define SCALAR_QUANTIZATION 1
+
+#define RFX_TILE_HEADER 19
+/* a component that needs more than this is coded again with the coarse
+   quant, 16 bits a coefficient is already worse than raw */
+#define RFX_COMP_MAX 8192
+#define RFX_TILE_MAX (RFX_TILE_HEADER + RFX_COMP_MAX * 3)
+
+/* RLGR parameters */
+#define KPMAX 80
+#define LSGR 3
+#define UP_GR 4
+#define DN_GR 6
+#define UQ_GR 3
+#define DQ_GR 3
+
+/* LL3, LH3, HL3, HH3, LH2, HL2, HH2, LH1, HL1, HH1 */
+static const int g_rfx_quants[2][10] =
+{
+    { 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 },
+    { 9, 9, 9, 9, 10, 10, 11, 11, 11, 12 }
+};
+
+struct xrdp_rfx
+{
+    int width;
+    int height;
+    int frame_idx;
+    struct xrdp_workers *workers;
+    /* per frame scratch, kept between frames */
+    int tiles_alloc;
+    char *tile_data; /* RFX_TILE_MAX bytes per tile */
+    int *tile_bytes;
+    int *tile_xy;
+    int grid_alloc;
+    char *grid;
+    /* source for the tile procs */
+    const char *data;
+    int data_width;
+    int data_height;
+    int stride;
+};
+
+struct rfx_bits
+{
+    unsigned char *p;
+    unsigned char *end;
+    int acc;
+    int bits; /* bits in acc */
+    int error;
+};
+
+/*****************************************************************************/
+static void
+rfx_bits_out(struct rfx_bits *b, int nbits, int value)
+{
+    while (nbits > 0)
+    {
+        int take;
+
+        take = MIN(nbits, 8 - b->bits);
+        nbits -= take;
+        b->acc = (b->acc << take) | ((value >> nbits) & ((1 << take) - 1));
+        b->bits += take;
+        if (b->bits == 8)
+        {
+            if (b->p >= b->end)
+            {
+                b->error = 1;
+                return;
+            }
+            *(b->p++) = b->acc;
+            b->acc = 0;
+            b->bits = 0;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* count copies of bit */
+static void
+rfx_bits_out_run(struct rfx_bits *b, int count, int bit)
+{
+    while (count > 24)
+    {
+        rfx_bits_out(b, 24, bit ? 0xffffff : 0);
+        count -= 24;
+    }
+    rfx_bits_out(b, count, bit ? 0xffffff : 0);
+}
+
+/*****************************************************************************/
+#define RFX_UPDATE(_param, _delta, _k) do \
+{ \
+    _param += _delta; \
+    if (_param > KPMAX) _param = KPMAX; \
+    if (_param < 0) _param = 0; \
+    _k = _param >> LSGR; \
+} while (0)
+
+/*****************************************************************************/
+static void
+rfx_code_gr(struct rfx_bits *b, int *krp, int val)
+{
+    int kr;
+    int vk;
+
+    kr = *krp >> LSGR;
+    vk = val >> kr;
+    rfx_bits_out_run(b, vk, 1);
+    rfx_bits_out(b, 1, 0);
+    if (kr > 0)
+    {
+        rfx_bits_out(b, kr, val & ((1 << kr) - 1));
+    }
+    if (vk == 0)
+    {
+        RFX_UPDATE(*krp, -2, kr);
+    }
+    else if (vk > 1)
+    {
+        RFX_UPDATE(*krp, vk, kr);
+    }
+}
+
+/*****************************************************************************/
+/* RLGR1, returns bytes written or -1 if it does not fit */
+static int
+rfx_rlgr1_encode(const short *data, int count, char *out, int out_bytes)
+{
+    struct rfx_bits b;
+    int k;
+    int kp;
+    int krp;
+    int input;
+    int zeros;
+    int runmax;
+    int mag;
+    int twoms;
+
+    g_memset(&b, 0, sizeof(b));
+    b.p = (unsigned char *) out;
+    b.end = b.p + out_bytes;
+    /* [MS-RDPRFX] 3.1.8.1.7.3, k = 1, kr = 1 */
+    k = 1;
+    kp = 1 << LSGR;
+    krp = 1 << LSGR;
+    while ((count > 0) && !b.error)
+    {
+        input = *(data++);
+        count--;
+        if (k)
+        {
+            /* run length mode */
+            zeros = 0;
+            while ((input == 0) && (count > 0))
+            {
+                zeros++;
+                input = *(data++);
+                count--;
+            }
+            runmax = 1 << k;
+            while (zeros >= runmax)
+            {
+                rfx_bits_out(&b, 1, 0);
+                zeros -= runmax;
+                RFX_UPDATE(kp, UP_GR, k);
+                runmax = 1 << k;
+            }
+            rfx_bits_out(&b, 1, 1);
+            rfx_bits_out(&b, k, zeros);
+            mag = input < 0 ? -input : input;
+            rfx_bits_out(&b, 1, input < 0);
+            rfx_code_gr(&b, &krp, mag ? mag - 1 : 0);
+            RFX_UPDATE(kp, -DN_GR, k);
+        }
+        else
+        {
+            /* golomb rice mode, 2 * magnitude - sign */
+            twoms = input >= 0 ? 2 * input : -2 * input - 1;
+            rfx_code_gr(&b, &krp, twoms);
+            if (twoms)
+            {
+                RFX_UPDATE(kp, -DQ_GR, k);
+            }
+            else
+            {
+                RFX_UPDATE(kp, UQ_GR, k);
+            }
+        }
+    }
+    if (b.bits > 0)
+    {
+        rfx_bits_out(&b, 8 - b.bits, 0);
+    }
+    if (b.error)
+    {
+        return -1;
+    }
+    return (int) ((char *) b.p - out);
+}
+
+/*****************************************************************************/
+/* x8r8g8b8 to Y, Cb, Cr in 11.5 fixed point, Y shifted down by 128 */
+static void
+rfx_rgb_to_ycbcr_row(const int *src, short *y, short *cb, short *cr,
+                     int num_pixels)
+{
+    int index;
+    int r;
+    int g;
+    int b;
+    int v;
+
+    for (index = 0; index < num_pixels; index++)
+    {
+        r = (src[index] >> 16) & 0xff;
+        g = (src[index] >> 8) & 0xff;
+        b = src[index] & 0xff;
+        v = ((r * 9798 + g * 19235 + b * 3735) >> 10) - 4096;
+        y[index] = MAX(MIN(v, 4095), -4096);
+        v = (r * -5535 + g * -10868 + b * 16403) >> 10;
+        cb[index] = MAX(MIN(v, 4095), -4096);
+        v = (r * 16377 + g * -13714 + b * -2663) >> 10;
+        cr[index] = MAX(MIN(v, 4095), -4096);
+    }
+}
+
+#if defined(RFX_SSE2)
+
+/*****************************************************************************/
+/* 8 pixels, same integer maths as rfx_rgb_to_ycbcr_row */
+static void
+rfx_rgb_to_ycbcr_row_sse2(const int *src, short *y, short *cb, short *cr,
+                          int num_pixels)
+{
+    __m128i mask;
+    __m128i zero;
+    __m128i p0;
+    __m128i p1;
+    __m128i r;
+    __m128i g;
+    __m128i b;
+    __m128i rg_lo;
+    __m128i rg_hi;
+    __m128i b0_lo;
+    __m128i b0_hi;
+    __m128i lo;
+    __m128i hi;
+    __m128i vmin;
+    __m128i vmax;
+    __m128i ofs;
+    __m128i y_rg;
+    __m128i y_b;
+    __m128i cb_rg;
+    __m128i cb_b;
+    __m128i cr_rg;
+    __m128i cr_b;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    zero = _mm_setzero_si128();
+    vmin = _mm_set1_epi16(-4096);
+    vmax = _mm_set1_epi16(4095);
+    ofs = _mm_set1_epi16(4096);
+    y_rg = _mm_set_epi16(19235, 9798, 19235, 9798, 19235, 9798, 19235, 9798);
+    y_b = _mm_set_epi16(0, 3735, 0, 3735, 0, 3735, 0, 3735);
+    cb_rg = _mm_set_epi16(-10868, -5535, -10868, -5535,
+                          -10868, -5535, -10868, -5535);
+    cb_b = _mm_set_epi16(0, 16403, 0, 16403, 0, 16403, 0, 16403);
+    cr_rg = _mm_set_epi16(-13714, 16377, -13714, 16377,
+                          -13714, 16377, -13714, 16377);
+    cr_b = _mm_set_epi16(0, -2663, 0, -2663, 0, -2663, 0, -2663);
+    for (index = 0; index + 8 <= num_pixels; index += 8)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (src + index));
+        p1 = _mm_loadu_si128((const __m128i *) (src + index + 4));
+        b = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+        g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                            _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                            _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+        rg_lo = _mm_unpacklo_epi16(r, g);
+        rg_hi = _mm_unpackhi_epi16(r, g);
+        b0_lo = _mm_unpacklo_epi16(b, zero);
+        b0_hi = _mm_unpackhi_epi16(b, zero);
+
+        lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, y_rg),
+                           _mm_madd_epi16(b0_lo, y_b));
+        hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, y_rg),
+                           _mm_madd_epi16(b0_hi, y_b));
+        lo = _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+        lo = _mm_sub_epi16(lo, ofs);
+        lo = _mm_max_epi16(_mm_min_epi16(lo, vmax), vmin);
+        _mm_storeu_si128((__m128i *) (y + index), lo);
+
+        lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, cb_rg),
+                           _mm_madd_epi16(b0_lo, cb_b));
+        hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, cb_rg),
+                           _mm_madd_epi16(b0_hi, cb_b));
+        lo = _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+        lo = _mm_max_epi16(_mm_min_epi16(lo, vmax), vmin);
+        _mm_storeu_si128((__m128i *) (cb + index), lo);
+
+        lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, cr_rg),
+                           _mm_madd_epi16(b0_lo, cr_b));
+        hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, cr_rg),
+                           _mm_madd_epi16(b0_hi, cr_b));
+        lo = _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+        lo = _mm_max_epi16(_mm_min_epi16(lo, vmax), vmin);
+        _mm_storeu_si128((__m128i *) (cr + index), lo);
+    }
+    rfx_rgb_to_ycbcr_row(src + index, y + index, cb + index, cr + index,
+                         num_pixels - index);
+}
+
+#define rfx_rgb_to_ycbcr rfx_rgb_to_ycbcr_row_sse2
+#else
+#define rfx_rgb_to_ycbcr rfx_rgb_to_ycbcr_row
+#endif
+
+/*****************************************************************************/
+/* columns of src into rows of l then rows of h, inner loop runs along a row
+   so it vectorises */
+static void
+rfx_dwt_vert(const short *src, short *l, short *h, int sub_width)
+{
+    int total_width;
+    int n;
+    int x;
+    const short *x2n;
+    const short *x2n1;
+    const short *x2n2;
+    short *hn;
+    short *ln;
+
+    total_width = sub_width * 2;
+    for (n = 0; n < sub_width; n++)
+    {
+        x2n = src + 2 * n * total_width;
+        x2n1 = x2n + total_width;
+        x2n2 = (n < sub_width - 1) ? x2n1 + total_width : x2n;
+        hn = h + n * total_width;
+        ln = l + n * total_width;
+        for (x = 0; x < total_width; x++)
+        {
+            hn[x] = (x2n1[x] - ((x2n[x] + x2n2[x]) >> 1)) >> 1;
+        }
+        if (n == 0)
+        {
+            for (x = 0; x < total_width; x++)
+            {
+                ln[x] = x2n[x] + hn[x];
+            }
+        }
+        else
+        {
+            for (x = 0; x < total_width; x++)
+            {
+                ln[x] = x2n[x] + ((hn[x - total_width] + hn[x]) >> 1);
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+rfx_dwt_horiz(const short *src, short *l, short *h, int sub_width)
+{
+    int y;
+    int n;
+    int x2n2;
+
+    for (y = 0; y < sub_width; y++)
+    {
+        for (n = 0; n < sub_width; n++)
+        {
+            x2n2 = (n < sub_width - 1) ? src[2 * n + 2] : src[2 * n];
+            h[n] = (src[2 * n + 1] - ((src[2 * n] + x2n2) >> 1)) >> 1;
+            l[n] = src[2 * n] +
+                   (n == 0 ? h[n] : ((h[n - 1] + h[n]) >> 1));
+        }
+        src += sub_width * 2;
+        l += sub_width;
+        h += sub_width;
+    }
+}
+
+/*****************************************************************************/
+/* one level, buffer ends up HL, LH, HH, LL */
+static void
+rfx_dwt_level(short *buffer, short *tmp, int sub_width)
+{
+    int size;
+
+    size = sub_width * sub_width;
+    rfx_dwt_vert(buffer, tmp, tmp + size * 2, sub_width);
+    rfx_dwt_horiz(tmp, buffer + size * 3, buffer, sub_width);
+    rfx_dwt_horiz(tmp + size * 2, buffer + size, buffer + size * 2,
+                  sub_width);
+}
+
+/*****************************************************************************/
+static void
+rfx_quant_block(short *buffer, int count, int q)
+{
+    int index;
+    int shift;
+    int half;
+
+    /* (q - 6) for the spec plus 5 for the fixed point */
+    shift = q - 1;
+    half = 1 << (shift - 1);
+    for (index = 0; index < count; index++)
+    {
+        buffer[index] = (buffer[index] + half) >> shift;
+    }
+}
+
+/*****************************************************************************/
+/* one 64x64 component, returns bytes or -1 */
+static int
+rfx_encode_component(short *buffer, short *tmp, const int *quants,
+                     char *out)
+{
+    int index;
+
+    rfx_dwt_level(buffer, tmp, 32);
+    rfx_dwt_level(buffer + 3072, tmp, 16);
+    rfx_dwt_level(buffer + 3840, tmp, 8);
+    rfx_quant_block(buffer, 1024, quants[8]); /* HL1 */
+    rfx_quant_block(buffer + 1024, 1024, quants[7]); /* LH1 */
+    rfx_quant_block(buffer + 2048, 1024, quants[9]); /* HH1 */
+    rfx_quant_block(buffer + 3072, 256, quants[5]); /* HL2 */
+    rfx_quant_block(buffer + 3328, 256, quants[4]); /* LH2 */
+    rfx_quant_block(buffer + 3584, 256, quants[6]); /* HH2 */
+    rfx_quant_block(buffer + 3840, 64, quants[2]); /* HL3 */
+    rfx_quant_block(buffer + 3904, 64, quants[1]); /* LH3 */
+    rfx_quant_block(buffer + 3968, 64, quants[3]); /* HH3 */
+    rfx_quant_block(buffer + 4032, 64, quants[0]); /* LL3 */
+    /* LL3 is sent as differences */
+    for (index = 63; index > 0; index--)
+    {
+        buffer[4032 + index] -= buffer[4032 + index - 1];
+    }
+    return rfx_rlgr1_encode(buffer, 4096, out, RFX_COMP_MAX);
+}
+
+/*****************************************************************************/
+/* loads a 64x64 tile, edges past the source are repeated */
+static void
+rfx_load_tile(struct xrdp_rfx *self, int x, int y, short *ycbcr)
+{
+    int row;
+    int col;
+    int cx;
+    int sy;
+    int line[64];
+    const int *src;
+
+    cx = MIN(64, self->data_width - x);
+    for (row = 0; row < 64; row++)
+    {
+        sy = MIN(y + row, self->data_height - 1);
+        src = (const int *) (self->data + sy * self->stride) + x;
+        if (cx < 64)
+        {
+            for (col = 0; col < 64; col++)
+            {
+                line[col] = src[MIN(col, cx - 1)];
+            }
+            src = line;
+        }
+        rfx_rgb_to_ycbcr(src, ycbcr + row * 64, ycbcr + 4096 + row * 64,
+                         ycbcr + 8192 + row * 64, 64);
+    }
+}
+
+/*****************************************************************************/
+/* xrdp_workers_proc, encodes one CBT_TILE into its own slot */
+static void
+xrdp_rfx_tile_proc(void *arg, int index)
+{
+    struct xrdp_rfx *self;
+    short ycbcr[4096 * 3];
+    short tmp[4096];
+    short save[4096];
+    char *out;
+    char *p;
+    int comp;
+    int bytes;
+    int lens[3];
+    int quant_idx[3];
+    int tx;
+    int ty;
+    struct stream ls;
+    struct stream *s;
+
+    self = (struct xrdp_rfx *) arg;
+    tx = self->tile_xy[index * 2];
+    ty = self->tile_xy[index * 2 + 1];
+    out = self->tile_data + index * RFX_TILE_MAX;
+    rfx_load_tile(self, tx * 64, ty * 64, ycbcr);
+    p = out + RFX_TILE_HEADER;
+    for (comp = 0; comp < 3; comp++)
+    {
+        g_memcpy(save, ycbcr + comp * 4096, sizeof(save));
+        quant_idx[comp] = 0;
+        bytes = rfx_encode_component(ycbcr + comp * 4096, tmp,
+                                     g_rfx_quants[0], p);
+        if (bytes < 0)
+        {
+            quant_idx[comp] = 1;
+            bytes = rfx_encode_component(save, tmp, g_rfx_quants[1], p);
+        }
+        if (bytes < 0)
+        {
+            /* can not happen with the coarse quant, send it empty */
+            LLOGLN(0, ("xrdp_rfx_tile_proc: tile %d %d too big", tx, ty));
+            bytes = 0;
+        }
+        lens[comp] = bytes;
+        p += bytes;
+    }
+    s = &ls;
+    g_memset(s, 0, sizeof(struct stream));
+    s->data = out;
+    s->p = out;
+    s->size = RFX_TILE_HEADER;
+    out_uint16_le(s, CBT_TILE);
+    out_uint32_le(s, (int) (p - out)); /* blockLen */
+    out_uint8(s, quant_idx[0]);
+    out_uint8(s, quant_idx[1]);
+    out_uint8(s, quant_idx[2]);
+    out_uint16_le(s, tx);
+    out_uint16_le(s, ty);
+    out_uint16_le(s, lens[0]);
+    out_uint16_le(s, lens[1]);
+    out_uint16_le(s, lens[2]);
+    self->tile_bytes[index] = (int) (p - out);
+}
+
+/*****************************************************************************/
+struct xrdp_rfx *APP_CC
+xrdp_rfx_create(int width, int height)
+{
+    struct xrdp_rfx *self;
+
+    self = (struct xrdp_rfx *) g_malloc(sizeof(struct xrdp_rfx), 1);
+    self->width = width;
+    self->height = height;
+    self->workers = xrdp_workers_create(0);
+    LLOGLN(0, ("xrdp_rfx_create: width %d height %d", width, height));
+    return self;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_rfx_delete(struct xrdp_rfx *self)
+{
+    if (self == 0)
+    {
+        return;
+    }
+    xrdp_workers_delete(self->workers);
+    g_free(self->tile_data);
+    g_free(self->tile_bytes);
+    g_free(self->tile_xy);
+    g_free(self->grid);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* sync, codec versions, channels and context, in front of every frame
+   until one has reached the client */
+static void
+xrdp_rfx_out_header(struct xrdp_rfx *self, struct stream *s)
+{
+    int properties;
+
+    out_uint16_le(s, WBT_SYNC);
+    out_uint32_le(s, 12);
+    out_uint32_le(s, 0xCACCACCA); /* magic */
+    out_uint16_le(s, 0x0100); /* version */
+
+    out_uint16_le(s, WBT_CODEC_VERSIONS);
+    out_uint32_le(s, 10);
+    out_uint8(s, 1); /* numCodecs */
+    out_uint8(s, 1); /* codecId */
+    out_uint16_le(s, 0x0100); /* version */
+
+    out_uint16_le(s, WBT_CHANNELS);
+    out_uint32_le(s, 12);
+    out_uint8(s, 1); /* numChannels */
+    out_uint8(s, 0); /* channelId */
+    out_uint16_le(s, self->width);
+    out_uint16_le(s, self->height);
+
+    out_uint16_le(s, WBT_CONTEXT);
+    out_uint32_le(s, 13);
+    out_uint8(s, 1); /* codecId */
+    out_uint8(s, 0xFF); /* channelId */
+    out_uint8(s, 0); /* ctxId */
+    out_uint16_le(s, 64); /* tileSize */
+    properties = 0; /* flags, video mode */
+    properties |= COL_CONV_ICT << 3;
+    properties |= CLW_XFORM_DWT_53_A << 5;
+    properties |= CLW_ENTROPY_RLGR1 << 9;
+    properties |= SCALAR_QUANTIZATION << 13;
+    out_uint16_le(s, properties);
+}
+
+/*****************************************************************************/
+/* makes sure the per frame scratch can hold num_tiles tiles */
+static int
+xrdp_rfx_alloc(struct xrdp_rfx *self, int num_tiles, int grid_size)
+{
+    if (num_tiles > self->tiles_alloc)
+    {
+        g_free(self->tile_data);
+        g_free(self->tile_bytes);
+        g_free(self->tile_xy);
+        self->tile_data = (char *) g_malloc(num_tiles * RFX_TILE_MAX, 0);
+        self->tile_bytes = (int *) g_malloc(num_tiles * sizeof(int), 0);
+        self->tile_xy = (int *) g_malloc(num_tiles * 2 * sizeof(int), 0);
+        self->tiles_alloc = num_tiles;
+        if ((self->tile_data == 0) || (self->tile_bytes == 0) ||
+            (self->tile_xy == 0))
+        {
+            self->tiles_alloc = 0;
+            return 1;
+        }
+    }
+    if (grid_size > self->grid_alloc)
+    {
+        g_free(self->grid);
+        self->grid = (char *) g_malloc(grid_size, 0);
+        self->grid_alloc = self->grid == 0 ? 0 : grid_size;
+        if (self->grid == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* data is x8r8g8b8, drects are the region the client updates, crects the
+   areas that changed, both x, y, cx, cy, every 64x64 tile touching a crect
+   is coded, out_data is g_malloc'ed with pad_bytes in front of the message,
+   send_header puts the stream header blocks first
+   returns error */
+int APP_CC
+xrdp_rfx_encode(struct xrdp_rfx *self, const char *data, int width,
+                int height, int stride,
+                const short *drects, int num_drects,
+                const short *crects, int num_crects,
+                int send_header, int pad_bytes,
+                char **out_data, int *out_bytes)
+{
+    int index;
+    int gx;
+    int gy;
+    int gx1;
+    int gy1;
+    int grid_width;
+    int grid_height;
+    int num_tiles;
+    int tiles_bytes;
+    int bytes;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int properties;
+    int q;
+    struct stream ls;
+    struct stream *s;
+
+    *out_data = 0;
+    *out_bytes = 0;
+    if ((num_drects < 1) || (width < 1) || (height < 1))
+    {
+        return 1;
+    }
+    grid_width = (width + 63) / 64;
+    grid_height = (height + 63) / 64;
+    if (xrdp_rfx_alloc(self, grid_width * grid_height,
+                       grid_width * grid_height) != 0)
+    {
+        return 1;
+    }
+
+    /* collect the tiles, each once, in raster order */
+    g_memset(self->grid, 0, grid_width * grid_height);
+    for (index = 0; index < num_crects; index++)
+    {
+        x = MAX(crects[index * 4 + 0], 0);
+        y = MAX(crects[index * 4 + 1], 0);
+        cx = MIN(crects[index * 4 + 0] + crects[index * 4 + 2], width) - x;
+        cy = MIN(crects[index * 4 + 1] + crects[index * 4 + 3], height) - y;
+        if ((cx < 1) || (cy < 1))
+        {
+            continue;
+        }
+        gx1 = (x + cx - 1) / 64;
+        gy1 = (y + cy - 1) / 64;
+        for (gy = y / 64; gy <= gy1; gy++)
+        {
+            for (gx = x / 64; gx <= gx1; gx++)
+            {
+                self->grid[gy * grid_width + gx] = 1;
+            }
+        }
+    }
+    num_tiles = 0;
+    for (gy = 0; gy < grid_height; gy++)
+    {
+        for (gx = 0; gx < grid_width; gx++)
+        {
+            if (self->grid[gy * grid_width + gx])
+            {
+                self->tile_xy[num_tiles * 2] = gx;
+                self->tile_xy[num_tiles * 2 + 1] = gy;
+                num_tiles++;
+            }
+        }
+    }
+
+    self->data = data;
+    self->data_width = width;
+    self->data_height = height;
+    self->stride = stride;
+    xrdp_workers_run(self->workers, xrdp_rfx_tile_proc, self, num_tiles);
+
+    tiles_bytes = 0;
+    for (index = 0; index < num_tiles; index++)
+    {
+        tiles_bytes += self->tile_bytes[index];
+    }
+
+    bytes = 47 + 14 + 15 + num_drects * 8 + 22 + 10 + tiles_bytes + 8;
+    s = &ls;
+    g_memset(s, 0, sizeof(struct stream));
+    *out_data = (char *) g_malloc(pad_bytes + bytes, 0);
+    if (*out_data == 0)
+    {
+        return 1;
+    }
+    s->data = *out_data + pad_bytes;
+    s->p = s->data;
+    s->size = bytes;
+
+    if (send_header)
+    {
+        xrdp_rfx_out_header(self, s);
+    }
+
+    out_uint16_le(s, WBT_FRAME_BEGIN);
+    out_uint32_le(s, 14);
+    out_uint8(s, 1); /* codecId */
+    out_uint8(s, 0); /* channelId */
+    out_uint32_le(s, self->frame_idx);
+    out_uint16_le(s, 1); /* numRegions */
+    self->frame_idx++;
+
+    out_uint16_le(s, WBT_REGION);
+    out_uint32_le(s, 15 + num_drects * 8);
+    out_uint8(s, 1); /* codecId */
+    out_uint8(s, 0); /* channelId */
+    out_uint8(s, 1); /* regionFlags, lrf */
+    out_uint16_le(s, num_drects);
+    for (index = 0; index < num_drects; index++)
+    {
+        out_uint16_le(s, drects[index * 4 + 0]);
+        out_uint16_le(s, drects[index * 4 + 1]);
+        out_uint16_le(s, drects[index * 4 + 2]);
+        out_uint16_le(s, drects[index * 4 + 3]);
+    }
+    out_uint16_le(s, CBT_REGION);
+    out_uint16_le(s, 1); /* numTilesets */
+
+    out_uint16_le(s, WBT_EXTENSION);
+    out_uint32_le(s, 22 + 10 + tiles_bytes);
+    out_uint8(s, 1); /* codecId */
+    out_uint8(s, 0); /* channelId */
+    out_uint16_le(s, CBT_TILESET);
+    out_uint16_le(s, 0); /* idx */
+    properties = 1; /* lt */
+    properties |= COL_CONV_ICT << 4;
+    properties |= CLW_XFORM_DWT_53_A << 6;
+    properties |= CLW_ENTROPY_RLGR1 << 10;
+    properties |= SCALAR_QUANTIZATION << 14;
+    out_uint16_le(s, properties);
+    out_uint8(s, 2); /* numQuant */
+    out_uint8(s, 64); /* tileSize */
+    out_uint16_le(s, num_tiles);
+    out_uint32_le(s, tiles_bytes);
+    for (q = 0; q < 2; q++)
+    {
+        for (index = 0; index < 10; index += 2)
+        {
+            out_uint8(s, g_rfx_quants[q][index] |
+                      (g_rfx_quants[q][index + 1] << 4));
+        }
+    }
+    for (index = 0; index < num_tiles; index++)
+    {
+        out_uint8a(s, self->tile_data + index * RFX_TILE_MAX,
+                   self->tile_bytes[index]);
+    }
+
+    out_uint16_le(s, WBT_FRAME_END);
+    out_uint32_le(s, 8);
+    out_uint8(s, 1); /* codecId */
+    out_uint8(s, 0); /* channelId */
+    s_mark_end(s);
+
+    *out_bytes = (int) (s->end - s->data);
+    LLOGLN(10, ("xrdp_rfx_encode: tiles %d bytes %d", num_tiles, *out_bytes));
+    return 0;
+}
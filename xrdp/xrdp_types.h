@@ -48,7 +48,8 @@ struct xrdp_mod
                            tbus* write_objs, int* wcount, int* timeout);
   int (*mod_check_wait_objs)(struct xrdp_mod* v);
   int (*mod_frame_ack)(struct xrdp_mod* v, int flags, int frame_id);
-  tintptr mod_dumby[100 - 10]; /* align, 100 minus the number of mod
+  int (*mod_input_flush)(struct xrdp_mod* v);
+  tintptr mod_dumby[100 - 11]; /* align, 100 minus the number of mod
                                   functions above */
   /* server functions */
   int (*server_begin_update)(struct xrdp_mod* v);
@@ -146,7 +147,12 @@ struct xrdp_mod
                             int num_crects, short *crects,
                             char *data, int width, int height,
                             int flags, int frame_id);
-  tintptr server_dumby[100 - 43]; /* align, 100 minus the number of server
+  int (*server_paint_rect_comp)(struct xrdp_mod* v, int x, int y,
+                                int cx, int cy, char* data,
+                                int width, int height, int srcx, int srcy,
+                                char* comp_data, int comp_bytes);
+  int (*server_set_pointer_hash)(struct xrdp_mod* v, int hash);
+  tintptr server_dumby[100 - 45]; /* align, 100 minus the number of server
                                      functions above */
   /* common */
   tintptr handle; /* pointer to self as int */
@@ -194,6 +200,7 @@ struct xrdp_os_bitmap_item
 {
   int id;
   struct xrdp_bitmap* bitmap;
+  int bytes; /* what the surface takes in the client */
 };
 
 struct xrdp_char_item
@@ -210,6 +217,7 @@ struct xrdp_pointer_item
   char data[32 * 32 * 4];
   char mask[32 * 32 / 8];
   int bpp;
+  int hash; /* of all the above but stamp, 0 for an empty item */
 };
 
 struct xrdp_brush_item
@@ -223,6 +231,36 @@ struct xrdp_brush_item
 /* moved to xrdp_constants.h
 #define XRDP_BITMAP_CACHE_ENTRIES 2048 */
 
+/* one tile of a bitmap copy in flight, see xrdp_painter_copy */
+#define XRDP_TILE_BATCH 64
+/* tiles over this entropy, in percent, may be sent lossy */
+#define XRDP_TILE_ENTROPY 60
+
+/* kinds of bitmap order for xrdp_cache_bitmap_sent */
+#define XRDP_BITMAP_SENT_LOSSLESS 0
+#define XRDP_BITMAP_SENT_CODEC 1
+#define XRDP_BITMAP_SENT_RAW 2
+
+struct xrdp_tile
+{
+  int srcx; /* in the source bitmap */
+  int srcy;
+  int cx;
+  int cy;
+  struct xrdp_bitmap* b;
+  int status; /* from xrdp_cache_insert_bitmap */
+  int cache_id;
+  int cache_idx;
+  int comp; /* 1 if s holds the compressed bitmap2 data */
+  int hints; /* wm hints plus 1 (lossless) for low entropy tiles */
+  struct stream* s;
+  struct stream* temp_s;
+};
+
+struct xrdp_workers;
+struct xrdp_rfx;
+typedef void (*xrdp_workers_proc)(void* arg, int index);
+
 /* differnce caches */
 struct xrdp_cache
 {
@@ -246,6 +284,7 @@ struct xrdp_cache
   /* crc optimize */
   struct list16 crc16[XRDP_MAX_BITMAP_CACHE_ID][64 * 1024];
 
+  int bpp; /* client bpp the cached items are in */
   int use_bitmap_comp;
   int cache1_entries;
   int cache1_size;
@@ -255,6 +294,18 @@ struct xrdp_cache
   int cache3_size;
   int bitmap_cache_persist_enable;
   int bitmap_cache_version;
+  /* bitmap stats, logged when the cache is deleted */
+  int bitmap_hits;
+  int bitmap_misses;
+  int bitmap_codec; /* misses sent with the bitmap cache v3 codec */
+  int bitmap_passthrough; /* misses sent as the module compressed them */
+  double bitmap_bytes; /* order bytes the misses took, every path */
+  double bitmap_codec_bytes; /* of those, the v3 codec's */
+  double bitmap_raw_bytes; /* of those, uncompressed orders' */
+  int bitmap_frames; /* updates that sent bitmaps */
+  int bitmap_frame_bytes; /* sent in the update going on */
+  int bitmap_frame_max; /* most any update sent */
+  int update_level; /* painter begin_update nesting, the update ends at 0 */
   /* font */
   int char_stamp;
   struct xrdp_char_item char_items[12][256];
@@ -264,8 +315,24 @@ struct xrdp_cache
   int pointer_cache_entries;
   int brush_stamp;
   struct xrdp_brush_item brush_items[64];
+  int brush_cache_code; /* what the client said for these two, a reset */
+  int glyph_order; /* keeps the caches they did not change */
   struct xrdp_os_bitmap_item os_bitmap_items[2000];
   struct list* xrdp_os_del_list;
+  /* off screen, the module picks the index and evicts, these check it
+     stays in what the client said it can hold */
+  int os_entries_max;
+  int os_bytes_max;
+  int os_bytes; /* client bytes used by os_bitmap_items */
+  int os_bytes_peak;
+  int os_creates;
+  int os_blts; /* paints from an off screen bitmap */
+  double os_blt_bytes; /* screen bytes those paints did not have to send */
+  int pointer_sends; /* full pointers sent */
+  int pointer_hits; /* cached pointer used instead */
+  int pointer_repeats; /* already the client's pointer, nothing sent */
+  int pointer_hash_misses; /* hash from the X server not in the cache */
+  double pointer_bytes_saved;
 };
 
 /* defined later */
@@ -381,6 +448,14 @@ struct xrdp_wm
 
   /* configuration derived from xrdp.ini */
   struct xrdp_config *xrdp_config;
+  /* tile pipeline for xrdp_painter_copy */
+  struct xrdp_workers* workers;
+  struct xrdp_tile* tiles; /* XRDP_TILE_BATCH */
+  /* pointer moves are held until something else happens or the main
+     loop has drained the client socket, only the last one is sent */
+  int move_pending;
+  int move_x;
+  int move_y;
 };
 
 /* rdp process */
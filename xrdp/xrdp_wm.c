@@ -60,17 +60,29 @@ xrdp_wm_create(struct xrdp_process *owner, struct xrdp_client_info *client_info)
 	/* to store configuration from xrdp.ini */
 	self->xrdp_config = g_malloc(sizeof(struct xrdp_config), 1);
 
+	self->workers = xrdp_workers_create(0);
+	self->tiles = (struct xrdp_tile *) g_malloc(
+			sizeof(struct xrdp_tile) * XRDP_TILE_BATCH, 1);
+
 	return self;
 }
 
 /*****************************************************************************/
 void APP_CC
 xrdp_wm_delete(struct xrdp_wm *self) {
+	int index;
+
 	if (self == 0) {
 		return;
 	}
 
 	xrdp_mm_delete(self->mm);
+	xrdp_workers_delete(self->workers);
+	for (index = 0; index < XRDP_TILE_BATCH; index++) {
+		free_stream(self->tiles[index].s);
+		free_stream(self->tiles[index].temp_s);
+	}
+	g_free(self->tiles);
 	xrdp_cache_delete(self->cache);
 	xrdp_painter_delete(self->painter);
 	xrdp_bitmap_delete(self->screen);
@@ -1581,6 +1593,34 @@ xrdp_wm_process_channel_data(struct xrdp_wm *self, tbus param1, tbus param2,
 	return rv;
 }
 
+/*****************************************************************************/
+static void APP_CC
+xrdp_wm_move_flush(struct xrdp_wm *self) {
+	if (self->move_pending) {
+		self->move_pending = 0;
+		xrdp_wm_process_input_mouse(self, MOUSE_FLAG_MOVE, self->move_x,
+				self->move_y);
+	}
+}
+
+/*****************************************************************************/
+/* called once the main loop has processed everything the client sent,
+ sends the last pointer move and lets the module send what it batched */
+int APP_CC
+xrdp_wm_input_flush(struct xrdp_wm *self) {
+	struct xrdp_mod *mod;
+
+	if (self == 0) {
+		return 0;
+	}
+	xrdp_wm_move_flush(self);
+	mod = self->mm == 0 ? 0 : self->mm->mod;
+	if ((mod != 0) && (mod->mod_input_flush != 0)) {
+		return mod->mod_input_flush(mod);
+	}
+	return 0;
+}
+
 /******************************************************************************/
 /* this is the callbacks comming from libxrdp.so */
 int DEFAULT_CC
@@ -1602,6 +1642,16 @@ callback(long id, int msg, long param1, long param2, long param3, long param4) {
 
 	rv = 0;
 
+	/* a plain move only replaces the pending one, anything else sends the
+	 pending move first so the order the client sent is kept */
+	if ((msg == 0x8001) && (param3 == MOUSE_FLAG_MOVE)) {
+		wm->move_pending = 1;
+		wm->move_x = param1;
+		wm->move_y = param2;
+		return 0;
+	}
+	xrdp_wm_move_flush(wm);
+
 	switch (msg) {
 	case 0: /* RDP_INPUT_SYNCHRONIZE */
 		rv = xrdp_wm_key_sync(wm, param3, param1);
@@ -0,0 +1,193 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * worker threads, run a function over a set of independent items on
+ * all of them and the calling thread and return when all are done
+ */
+
+#include <pthread.h>
+
+#include "xrdp.h"
+#include "thread_calls.h"
+
+#define LLOG_LEVEL 1
+#define LLOGLN(_level, _args) \
+  do \
+  { \
+    if (_level < LLOG_LEVEL) \
+    { \
+        g_write("xrdp:xrdp_workers [%10.10u]: ", g_time3()); \
+        g_writeln _args ; \
+    } \
+  } \
+  while (0)
+
+/* upper limit, past this the serial parts dominate */
+#define XRDP_WORKERS_MAX 8
+
+struct xrdp_workers
+{
+    int num_threads;
+    pthread_t threads[XRDP_WORKERS_MAX];
+    tbus start_sem; /* one post per thread per run */
+    tbus done_sem; /* each thread posts once when its run is done */
+    tbus mutex; /* protects next */
+    int term;
+    xrdp_workers_proc proc;
+    void *arg;
+    int count;
+    int next;
+};
+
+/*****************************************************************************/
+/* take items until there are none left */
+static void APP_CC
+xrdp_workers_do(struct xrdp_workers *self)
+{
+    int index;
+
+    while (1)
+    {
+        tc_mutex_lock(self->mutex);
+        index = self->next;
+        self->next++;
+        tc_mutex_unlock(self->mutex);
+        if (index >= self->count)
+        {
+            break;
+        }
+        self->proc(self->arg, index);
+    }
+}
+
+/*****************************************************************************/
+static THREAD_RV THREAD_CC
+xrdp_workers_thread(void *arg)
+{
+    struct xrdp_workers *self;
+
+    self = (struct xrdp_workers *)arg;
+    while (1)
+    {
+        tc_sem_dec(self->start_sem);
+        if (self->term)
+        {
+            break;
+        }
+        xrdp_workers_do(self);
+        tc_sem_inc(self->done_sem);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* num_threads is the extra threads, the caller of xrdp_workers_run is
+   always one more, 0 means one per cpu */
+struct xrdp_workers *APP_CC
+xrdp_workers_create(int num_threads)
+{
+    struct xrdp_workers *self;
+    int index;
+
+    if (num_threads < 1)
+    {
+        num_threads = g_get_num_cpus() - 1;
+    }
+    num_threads = MIN(num_threads, XRDP_WORKERS_MAX - 1);
+    if (num_threads < 1)
+    {
+        return 0;
+    }
+    self = (struct xrdp_workers *)g_malloc(sizeof(struct xrdp_workers), 1);
+    self->start_sem = tc_sem_create(0);
+    self->done_sem = tc_sem_create(0);
+    self->mutex = tc_mutex_create();
+    /* not tc_thread_create, that detaches and xrdp_workers_delete has to
+       know the threads are gone before self is freed */
+    for (index = 0; index < num_threads; index++)
+    {
+        if (pthread_create(&(self->threads[index]), 0, xrdp_workers_thread,
+                           self) != 0)
+        {
+            break;
+        }
+        self->num_threads++;
+    }
+    LLOGLN(0, ("xrdp_workers_create: %d threads", self->num_threads));
+    return self;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_workers_delete(struct xrdp_workers *self)
+{
+    int index;
+
+    if (self == 0)
+    {
+        return;
+    }
+    self->term = 1;
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_inc(self->start_sem);
+    }
+    for (index = 0; index < self->num_threads; index++)
+    {
+        pthread_join(self->threads[index], 0);
+    }
+    tc_sem_delete(self->start_sem);
+    tc_sem_delete(self->done_sem);
+    tc_mutex_delete(self->mutex);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* calls proc(arg, index) for index 0 to count - 1, in any order and on any
+   thread, returns when all calls are done, self can be nil */
+int APP_CC
+xrdp_workers_run(struct xrdp_workers *self, xrdp_workers_proc proc,
+                 void *arg, int count)
+{
+    int index;
+    int num_threads;
+
+    if ((self == 0) || (count < 2))
+    {
+        for (index = 0; index < count; index++)
+        {
+            proc(arg, index);
+        }
+        return 0;
+    }
+    self->proc = proc;
+    self->arg = arg;
+    self->count = count;
+    self->next = 0;
+    /* no point waking more threads than there are items */
+    num_threads = MIN(self->num_threads, count - 1);
+    for (index = 0; index < num_threads; index++)
+    {
+        tc_sem_inc(self->start_sem);
+    }
+    xrdp_workers_do(self);
+    for (index = 0; index < num_threads; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+    return 0;
+}
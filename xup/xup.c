@@ -31,13 +31,96 @@
 static int APP_CC
 lib_mod_process_message(struct mod *mod, struct stream *s);
 
+/* events in one message 110 */
+#define XUP_INPUT_BATCH_MAX 128
+
+/******************************************************************************/
+/* sends the events held since the last flush as one message 110,
+   u32 len, u16 110, u16 count, then count times msg and 4 params */
+static int APP_CC
+lib_input_flush(struct mod *mod)
+{
+    struct stream *s;
+    int len;
+    int rv;
+
+    s = mod->input_s;
+    if ((s == 0) || (mod->input_count < 1))
+    {
+        return 0;
+    }
+    s_mark_end(s);
+    len = (int)(s->end - s->data);
+    s->p = s->data;
+    out_uint32_le(s, len);
+    out_uint16_le(s, 110);
+    out_uint16_le(s, mod->input_count);
+    rv = trans_write_copy_s(mod->trans, s);
+    mod->input_count = 0;
+    s->p = s->data + 8;
+    return rv;
+}
+
 /******************************************************************************/
 static int APP_CC
 lib_send_copy(struct mod *mod, struct stream *s)
 {
+    /* anything batched goes first to keep the order */
+    lib_input_flush(mod);
     return trans_write_copy_s(mod->trans, s);
 }
 
+/******************************************************************************/
+/* trans_recv used once the X server said it passes file descriptors, they
+   are held until the order they go with is processed */
+static int APP_CC
+lib_trans_recv_fd(struct trans *trans, void *ptr, int len)
+{
+    struct mod *mod;
+
+    mod = (struct mod *)(trans->callback_data);
+    return g_sck_recv_fd_set(trans->sck, ptr, len, mod->recv_fds,
+                             sizeof(mod->recv_fds) / sizeof(mod->recv_fds[0]),
+                             &(mod->recv_fds_count));
+}
+
+/******************************************************************************/
+/* returns the oldest passed file descriptor or -1 */
+static int APP_CC
+lib_take_fd(struct mod *mod)
+{
+    int fd;
+    int index;
+
+    if (mod->recv_fds_count < 1)
+    {
+        return -1;
+    }
+    fd = mod->recv_fds[0];
+    mod->recv_fds_count--;
+    for (index = 0; index < mod->recv_fds_count; index++)
+    {
+        mod->recv_fds[index] = mod->recv_fds[index + 1];
+    }
+    return fd;
+}
+
+/******************************************************************************/
+static void APP_CC
+lib_screen_memfd_free(struct mod *mod)
+{
+    if (mod->screen_memfd_pixels != 0)
+    {
+        g_munmap(mod->screen_memfd_pixels, mod->screen_memfd_bytes);
+        mod->screen_memfd_pixels = 0;
+        mod->screen_memfd_bytes = 0;
+    }
+    while (mod->recv_fds_count > 0)
+    {
+        g_file_close(lib_take_fd(mod));
+    }
+}
+
 /******************************************************************************/
 /* return error */
 int DEFAULT_CC
@@ -239,7 +322,7 @@ lib_mod_connect(struct mod *mod)
 
     if (error == 0)
     {
-        /* send version message */
+        /* send version message, 0.0.0.2 takes the cursor by hash */
         init_stream(s, 8192);
         s_push_layer(s, iso_hdr, 4);
         out_uint16_le(s, 103);
@@ -247,7 +330,7 @@ lib_mod_connect(struct mod *mod)
         out_uint32_le(s, 0);
         out_uint32_le(s, 0);
         out_uint32_le(s, 0);
-        out_uint32_le(s, 1);
+        out_uint32_le(s, 2);
         s_mark_end(s);
         len = (int)(s->end - s->data);
         s_pop_layer(s, iso_hdr);
@@ -372,6 +455,27 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
         }
     }
 
+    if (mod->input_batch)
+    {
+        /* held until xrdp calls lib_mod_input_flush after it has read
+           everything the client sent */
+        free_stream(s);
+        s = mod->input_s;
+        out_uint32_le(s, msg);
+        out_uint32_le(s, param1);
+        out_uint32_le(s, param2);
+        out_uint32_le(s, param3);
+        out_uint32_le(s, param4);
+        mod->input_count++;
+        rv = 0;
+        if (mod->input_count >= XUP_INPUT_BATCH_MAX)
+        {
+            rv = lib_input_flush(mod);
+        }
+        LIB_DEBUG(mod, "out lib_mod_event");
+        return rv;
+    }
+
     init_stream(s, 8192);
     s_push_layer(s, iso_hdr, 4);
     out_uint16_le(s, 103);
@@ -390,6 +494,14 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
     return rv;
 }
 
+/******************************************************************************/
+/* return error */
+int DEFAULT_CC
+lib_mod_input_flush(struct mod *mod)
+{
+    return lib_input_flush(mod);
+}
+
 /******************************************************************************/
 /* return error */
 static int APP_CC
@@ -1019,6 +1131,49 @@ process_server_set_pointer_ex(struct mod *mod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* message 103 302, the X server sends the pointer with hash in full */
+static int APP_CC
+lib_send_pointer_request(struct mod *mod, int hash)
+{
+    int len;
+    struct stream *s;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    s_push_layer(s, iso_hdr, 4);
+    out_uint16_le(s, 103);
+    out_uint32_le(s, 302);
+    out_uint32_le(s, hash);
+    out_uint32_le(s, 0);
+    out_uint32_le(s, 0);
+    out_uint32_le(s, 0);
+    s_mark_end(s);
+    len = (int)(s->end - s->data);
+    s_pop_layer(s, iso_hdr);
+    out_uint32_le(s, len);
+    lib_send_copy(mod, s);
+    free_stream(s);
+    return 0;
+}
+
+/******************************************************************************/
+/* order 52, the hash of a pointer the X server sent before, if xrdp does
+   not have it any more the X server is asked for all of it
+   return error */
+static int APP_CC
+process_server_set_pointer_hash(struct mod *mod, struct stream *s)
+{
+    int hash;
+
+    in_uint32_le(s, hash);
+    if (mod->server_set_pointer_hash(mod, hash) != 0)
+    {
+        return lib_send_pointer_request(mod, hash);
+    }
+    return 0;
+}
+
 /******************************************************************************/
 /* return error */
 static int APP_CC
@@ -1140,6 +1295,7 @@ send_paint_rect_ex_ack(struct mod *mod, int flags, int frame_id)
 static int APP_CC
 process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
 {
+    int line_bytes;
     int num_drects;
     int num_crects;
     int flags;
@@ -1195,7 +1351,20 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     in_uint16_le(s, height);
 
     bmpdata = 0;
-    if (flags == 0) /* screen */
+    if ((flags == 0) && (amod->screen_memfd_pixels != 0)) /* screen */
+    {
+        /* the whole frame, not just its start, has to be in the mapping,
+           24 bpp is 4 bytes a pixel there */
+        line_bytes = (amod->bpp + 7) / 8;
+        line_bytes = width * ((line_bytes == 3) ? 4 : line_bytes);
+        if ((shmem_offset >= 0) && (line_bytes > 0) &&
+            (shmem_offset < amod->screen_memfd_bytes) &&
+            (height <= (amod->screen_memfd_bytes - shmem_offset) / line_bytes))
+        {
+            bmpdata = amod->screen_memfd_pixels + shmem_offset;
+        }
+    }
+    else if (flags == 0) /* screen */
     {
         if (amod->screen_shmem_id_mapped == 0)
         {
@@ -1228,6 +1397,9 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     }
     else
     {
+        /* nothing to read the frame from, ack it so the X server does not
+           wait for it */
+        send_paint_rect_ex_ack(amod, flags, frame_id);
         rv = 1;
     }
 
@@ -1240,6 +1412,54 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     return 0;
 }
 
+/******************************************************************************/
+/* the X server's screen in client format, the fd came with this order,
+   paint_rect_shmem_ex for the screen reads from it after this */
+static int APP_CC
+process_server_screen_memfd(struct mod *amod, struct stream *s)
+{
+    int bytes;
+    int width;
+    int height;
+    int fd;
+
+    in_uint32_le(s, bytes);
+    in_uint16_le(s, width);
+    in_uint16_le(s, height);
+    fd = lib_take_fd(amod);
+    if (fd == -1)
+    {
+        g_writeln("process_server_screen_memfd: no fd passed");
+        return 0;
+    }
+    /* the X server seals it so it can not shrink under the mapping */
+    if ((bytes < 1) || (g_fd_sealed_size(fd) < bytes))
+    {
+        g_writeln("process_server_screen_memfd: fd not sealed or smaller "
+                  "than %d bytes", bytes);
+        g_file_close(fd);
+        return 0;
+    }
+    if (amod->screen_memfd_pixels != 0)
+    {
+        g_munmap(amod->screen_memfd_pixels, amod->screen_memfd_bytes);
+        amod->screen_memfd_pixels = 0;
+        amod->screen_memfd_bytes = 0;
+    }
+    amod->screen_memfd_pixels = (char *) g_mmap_fd(fd, bytes);
+    /* the mapping keeps it */
+    g_file_close(fd);
+    if (amod->screen_memfd_pixels == 0)
+    {
+        g_writeln("process_server_screen_memfd: map of %d bytes failed", bytes);
+        return 0;
+    }
+    amod->screen_memfd_bytes = bytes;
+    LLOGLN(0, ("process_server_screen_memfd: %dx%d %d bytes", width, height,
+           bytes));
+    return 0;
+}
+
 /******************************************************************************/
 /* return error */
 static int APP_CC
@@ -1334,12 +1554,18 @@ lib_mod_process_orders(struct mod *mod, int type, struct stream *s)
         case 51: /* server_set_pointer_ex */
             rv = process_server_set_pointer_ex(mod, s);
             break;
+        case 52: /* server_set_pointer_hash */
+            rv = process_server_set_pointer_hash(mod, s);
+            break;
         case 60: /* server_paint_rect_shmem */
             rv = process_server_paint_rect_shmem(mod, s);
             break;
         case 61: /* server_paint_rect_shmem_ex */
             rv = process_server_paint_rect_shmem_ex(mod, s);
             break;
+        case 62: /* screen memfd */
+            rv = process_server_screen_memfd(mod, s);
+            break;
         default:
             g_writeln("lib_mod_process_orders: unknown order type %d", type);
             rv = 0;
@@ -1372,6 +1598,27 @@ lib_send_client_info(struct mod *mod)
     return 0;
 }
 
+/******************************************************************************/
+/* message 111, X server replies with order 62 and the fd */
+static int APP_CC
+lib_send_memfd_request(struct mod *mod)
+{
+    int len;
+    struct stream *s;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    s_push_layer(s, iso_hdr, 4);
+    out_uint16_le(s, 111);
+    s_mark_end(s);
+    len = (int)(s->end - s->data);
+    s_pop_layer(s, iso_hdr);
+    out_uint32_le(s, len);
+    lib_send_copy(mod, s);
+    free_stream(s);
+    return 0;
+}
+
 /******************************************************************************/
 /* return error */
 static int APP_CC
@@ -1382,9 +1629,11 @@ lib_mod_process_message(struct mod *mod, struct stream *s)
     int rv;
     int len;
     int type;
+    int memfd;
     char *phold;
 
     rv = 0;
+    memfd = 0;
     if (rv == 0)
     {
         in_uint16_le(s, type);
@@ -1415,6 +1664,23 @@ lib_mod_process_message(struct mod *mod, struct stream *s)
 
                 switch (type)
                 {
+                    case 2: /* input batch, message 110 */
+                        if (mod->input_s == 0)
+                        {
+                            make_stream(mod->input_s);
+                            init_stream(mod->input_s,
+                                        8 + 20 * XUP_INPUT_BATCH_MAX);
+                            mod->input_s->p = mod->input_s->data + 8;
+                        }
+                        mod->input_batch = 1;
+                        break;
+                    case 3: /* screen memfd, passed on the unix socket */
+                        if (mod->trans->mode == TRANS_MODE_UNIX)
+                        {
+                            mod->trans->trans_recv = lib_trans_recv_fd;
+                            memfd = 1;
+                        }
+                        break;
                     default:
                         g_writeln("lib_mod_process_message: unknown cap type %d len %d",
                                   type, len);
@@ -1425,6 +1691,12 @@ lib_mod_process_message(struct mod *mod, struct stream *s)
             }
 
             lib_send_client_info(mod);
+            if (memfd)
+            {
+                /* ask for the screen memfd, after the client info so the
+                   X server knows the client bpp */
+                lib_send_memfd_request(mod);
+            }
         }
         else if (type == 3) /* order list with len after type */
         {
@@ -1471,6 +1743,7 @@ lib_mod_end(struct mod *mod)
         g_shmdt(mod->screen_shmem_pixels);
         mod->screen_shmem_pixels = 0;
     }
+    lib_screen_memfd_free(mod);
     return 0;
 }
 
@@ -1568,6 +1841,7 @@ mod_init(void)
     mod->mod_get_wait_objs = lib_mod_get_wait_objs;
     mod->mod_check_wait_objs = lib_mod_check_wait_objs;
     mod->mod_frame_ack = lib_mod_frame_ack;
+    mod->mod_input_flush = lib_mod_input_flush;
     return mod;
 }
 
@@ -1580,6 +1854,8 @@ mod_exit(struct mod *mod)
         return 0;
     }
     trans_delete(mod->trans);
+    free_stream(mod->input_s);
+    lib_screen_memfd_free(mod);
     g_free(mod);
     return 0;
 }
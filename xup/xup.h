@@ -45,7 +45,8 @@ struct mod
                            tbus* write_objs, int* wcount, int* timeout);
   int (*mod_check_wait_objs)(struct mod* v);
   int (*mod_frame_ack)(struct mod* v, int flags, int frame_id);
-  tintptr mod_dumby[100 - 10]; /* align, 100 minus the number of mod
+  int (*mod_input_flush)(struct mod* v);
+  tintptr mod_dumby[100 - 11]; /* align, 100 minus the number of mod
                                  functions above */
   /* server functions */
   int (*server_begin_update)(struct mod* v);
@@ -139,8 +140,13 @@ struct mod
                             int num_crects, short *crects,
                             char *data, int width, int height,
                             int flags, int frame_id);
+  int (*server_paint_rect_comp)(struct mod* v, int x, int y, int cx, int cy,
+                                char* data, int width, int height,
+                                int srcx, int srcy,
+                                char* comp_data, int comp_bytes);
+  int (*server_set_pointer_hash)(struct mod* v, int hash);
 
-  tintptr server_dumby[100 - 43]; /* align, 100 minus the number of server
+  tintptr server_dumby[100 - 45]; /* align, 100 minus the number of server
                                      functions above */
   /* common */
   tintptr handle; /* pointer to self as long */
@@ -162,4 +168,12 @@ struct mod
   int screen_shmem_id_mapped; /* boolean */
   char *screen_shmem_pixels;
   struct trans *trans;
+  int input_batch; /* X server takes message 110 */
+  struct stream *input_s; /* pending message 110 */
+  int input_count;
+  /* screen in a memfd the X server passed over the unix socket */
+  int recv_fds[4]; /* passed, not taken by an order yet */
+  int recv_fds_count;
+  char *screen_memfd_pixels;
+  int screen_memfd_bytes;
 };